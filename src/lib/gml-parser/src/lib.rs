@@ -58,3 +58,35 @@ pub fn parse(gml_str: &str) -> Result<gml::Gml, String> {
         Err(e) => Err(nom::error::convert_error(gml_str, e)),
     }
 }
+
+/// Parse the graph string like [`parse`], but pass each node and edge to `on_node` and `on_edge`
+/// as they're parsed instead of collecting them, so that they don't all need to be kept in memory
+/// at once. The returned [`gml::Gml`] object has no nodes or edges.
+/// ```
+/// let graph = r#"
+/// graph [
+///   node [
+///     id 0
+///   ]
+///   edge [
+///     source 0
+///     target 0
+///   ]
+/// ]"#;
+/// let mut node_ids = Vec::new();
+/// let mut edge_count = 0;
+/// let graph = gml_parser::parse_with(graph, |n| node_ids.push(n.id), |_| edge_count += 1).unwrap();
+/// assert!(graph.nodes.is_empty());
+/// assert_eq!(node_ids, [Some(0)]);
+/// assert_eq!(edge_count, 1);
+/// ```
+pub fn parse_with<'a>(
+    gml_str: &'a str,
+    on_node: impl FnMut(gml::Node<'a>),
+    on_edge: impl FnMut(gml::Edge<'a>),
+) -> Result<gml::Gml<'a>, String> {
+    match parser::gml_with::<nom::error::VerboseError<&str>>(gml_str, on_node, on_edge).finish() {
+        Ok((_remaining, graph)) => Ok(graph),
+        Err(e) => Err(nom::error::convert_error(gml_str, e)),
+    }
+}
@@ -66,84 +66,82 @@ pub fn item<'a, E: GmlParseError<'a>>(input: &'a str) -> IResult<&'a str, GmlIte
 
 /// Parse a GML graph.
 pub fn gml<'a, E: GmlParseError<'a>>(input: &'a str) -> IResult<&'a str, Gml<'a>, E> {
+    let mut nodes = Vec::new();
+    let mut edges = Vec::new();
+
+    let (input, mut graph) = gml_with(input, |x| nodes.push(x), |x| edges.push(x))?;
+
+    graph.nodes = nodes;
+    graph.edges = edges;
+
+    Ok((input, graph))
+}
+
+/// Parse a GML graph, passing each node and edge to `on_node` and `on_edge` as they're parsed. The
+/// returned graph has no nodes or edges.
+pub fn gml_with<'a, E: GmlParseError<'a>>(
+    input: &'a str,
+    mut on_node: impl FnMut(Node<'a>),
+    mut on_edge: impl FnMut(Edge<'a>),
+) -> IResult<&'a str, Gml<'a>, E> {
     let (input, _) = multispace0(input)?;
     let (input, _) = tag("graph")(input)?;
     let (input, _) = space0(input)?;
     let (input, _) = tag("[")(input)?;
-    let (input, _) = newline(input)?;
+    let (mut input, _) = newline(input)?;
+
+    let mut directed = None;
+    let mut others = HashMap::new();
 
-    let (input, (items, _)) = nom::multi::many_till(item, tag("]"))(input)?;
-
-    let [nodes, edges, directed, others]: [Vec<_>; 4] = partition(items.into_iter(), |x| match x {
-        GmlItem::Node(_) => 0,
-        GmlItem::Edge(_) => 1,
-        GmlItem::Directed(_) => 2,
-        GmlItem::KeyValue(_) => 3,
-    });
-
-    let nodes: Vec<_> = nodes
-        .into_iter()
-        .map(|x| {
-            if let GmlItem::Node(x) = x {
-                x
-            } else {
-                panic!()
+    // like `many_till(item, tag("]"))`, but without collecting the items
+    let input = loop {
+        if let Ok((input, _)) = tag::<_, _, E>("]")(input) {
+            break input;
+        }
+
+        let (remaining, item) = match item(input) {
+            Ok(x) => x,
+            Err(nom::Err::Error(e)) => {
+                return Err(nom::Err::Error(E::append(input, ErrorKind::ManyTill, e)))
             }
-        })
-        .collect();
-    let edges: Vec<_> = edges
-        .into_iter()
-        .map(|x| {
-            if let GmlItem::Edge(x) = x {
-                x
-            } else {
-                panic!()
+            Err(e) => return Err(e),
+        };
+
+        match item {
+            GmlItem::Node(x) => on_node(x),
+            GmlItem::Edge(x) => on_edge(x),
+            GmlItem::Directed(x) => {
+                if directed.replace(x).is_some() {
+                    result_str_to_nom(
+                        remaining,
+                        Err("The 'directed' key must only be specified once"),
+                        ErrorKind::Fail,
+                    )?;
+                }
             }
-        })
-        .collect();
-    let others: Vec<_> = others
-        .into_iter()
-        .map(|x| {
-            if let GmlItem::KeyValue(x) = x {
-                x
-            } else {
-                panic!()
+            GmlItem::KeyValue((name, value)) => {
+                if others.insert(name, value).is_some() {
+                    result_str_to_nom(
+                        remaining,
+                        Err("Duplicate keys are not supported"),
+                        ErrorKind::Fail,
+                    )?;
+                }
             }
-        })
-        .collect();
+        }
 
-    if directed.len() > 1 {
-        result_str_to_nom(
-            input,
-            Err("The 'directed' key must only be specified once"),
-            ErrorKind::Fail,
-        )?;
-    }
-    let directed = match directed.first() {
-        Some(GmlItem::Directed(x)) => *x,
-        Some(_) => panic!(),
-        // GML graphs are undirected by default
-        None => false,
+        input = remaining;
     };
 
-    let expected_len = others.len();
-    let others: HashMap<_, _> = others.into_iter().collect();
-    if others.len() != expected_len {
-        result_str_to_nom(
-            input,
-            Err("Duplicate keys are not supported"),
-            ErrorKind::Fail,
-        )?;
-    }
-
     let (input, _) = multispace0(input)?;
 
     Ok((
         input,
         Gml {
-            directed,
-            nodes,
-            edges,
+            // GML graphs are undirected by default
+            directed: directed.unwrap_or(false),
+            nodes: Vec::new(),
+            edges: Vec::new(),
             other: others,
         },
     ))
@@ -279,27 +277,3 @@ fn result_str_to_nom<'a, T, E: GmlParseError<'a>>(
 ) -> Result<T, nom::Err<E>> {
     result.map_err(|e| nom::Err::Failure(E::from_external_error(input, error_kind, e)))
 }
-
-fn partition<I, B, F, const N: usize>(iter: I, f: F) -> [B; N]
-where
-    I: Iterator + Sized,
-    B: Default + Extend<I::Item>,
-    [B; N]: Default,
-    F: FnMut(&I::Item) -> usize,
-{
-    #[inline]
-    fn extend<'a, T, B: Extend<T>, const N: usize>(
-        mut f: impl FnMut(&T) -> usize + 'a,
-        collections: &'a mut [B; N],
-    ) -> impl FnMut((), T) + 'a {
-        move |(), x| {
-            collections[f(&x)].extend(Some(x));
-        }
-    }
-
-    let mut collections: [B; N] = Default::default();
-
-    iter.fold((), extend(f, &mut collections));
-
-    collections
-}
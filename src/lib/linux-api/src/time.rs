@@ -6,6 +6,7 @@ use num_enum::{IntoPrimitive, TryFromPrimitive};
 use crate::bindings;
 use crate::const_conversions;
 use crate::errno::Errno;
+use crate::signal::Signal;
 
 pub use bindings::linux___kernel_clockid_t;
 
@@ -101,6 +102,87 @@ pub use bindings::linux_itimerval;
 pub type itimerval = linux_itimerval;
 unsafe impl shadow_pod::Pod for itimerval {}
 
+pub use bindings::linux___kernel_timer_t;
+#[allow(non_camel_case_types)]
+pub type kernel_timer_t = linux___kernel_timer_t;
+
+/// The kernel's `struct sigevent`, which our generated bindings don't include.
+/// Only the members used by `SIGEV_SIGNAL` and `SIGEV_THREAD_ID` notifications
+/// are exposed; the rest of the kernel's union is padding.
+#[derive(Debug, Copy, Clone)]
+#[repr(C)]
+#[allow(non_camel_case_types)]
+pub struct sigevent {
+    pub sigev_value: u64,
+    pub sigev_signo: i32,
+    pub sigev_notify: i32,
+    pub sigev_notify_thread_id: i32,
+    _pad: [i32; 11],
+}
+static_assertions::assert_eq_size!(sigevent, [u8; bindings::LINUX_SIGEV_MAX_SIZE as usize]);
+unsafe impl shadow_pod::Pod for sigevent {}
+
+impl sigevent {
+    /// Notify by sending `signal` to the thread with native thread id `tid`.
+    pub fn new_thread_id(signal: Signal, tid: i32) -> Self {
+        Self {
+            sigev_value: 0,
+            sigev_signo: signal.as_i32(),
+            sigev_notify: const_conversions::i32_from_u32(bindings::LINUX_SIGEV_THREAD_ID),
+            sigev_notify_thread_id: tid,
+            _pad: [0; 11],
+        }
+    }
+}
+
+/// Make a `timer_create` syscall.
+pub fn timer_create(clockid: ClockId, sevp: Option<&sigevent>) -> Result<kernel_timer_t, Errno> {
+    let sevp = sevp.map(core::ptr::from_ref).unwrap_or(core::ptr::null());
+    let mut timerid: kernel_timer_t = 0;
+    unsafe {
+        syscall!(
+            linux_syscall::SYS_timer_create,
+            i32::from(clockid),
+            sevp,
+            &mut timerid
+        )
+    }
+    .check()
+    .map_err(Errno::from)?;
+    Ok(timerid)
+}
+
+/// Make a `timer_settime` syscall.
+pub fn timer_settime(
+    timerid: kernel_timer_t,
+    flags: i32,
+    new_value: &itimerspec,
+    old_value: Option<&mut itimerspec>,
+) -> Result<(), Errno> {
+    let new_value = core::ptr::from_ref(new_value);
+    let old_value = old_value
+        .map(core::ptr::from_mut)
+        .unwrap_or(core::ptr::null_mut());
+    unsafe {
+        syscall!(
+            linux_syscall::SYS_timer_settime,
+            timerid,
+            flags,
+            new_value,
+            old_value
+        )
+    }
+    .check()
+    .map_err(Errno::from)
+}
+
+/// Make a `timer_delete` syscall.
+pub fn timer_delete(timerid: kernel_timer_t) -> Result<(), Errno> {
+    unsafe { syscall!(linux_syscall::SYS_timer_delete, timerid) }
+        .check()
+        .map_err(Errno::from)
+}
+
 /// Raw `alarm` syscall. Permits u64 arg and return value for generality with
 /// the general syscall ABI, but note that the `alarm` syscall definition itself
 /// uses u32.
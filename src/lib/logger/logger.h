@@ -24,13 +24,32 @@
 #define error(...)      logger_log(logger_getDefault(), LOGLEVEL_ERROR, __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__)
 #define warning(...)    logger_log(logger_getDefault(), LOGLEVEL_WARNING, __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__)
 #define info(...)       logger_log(logger_getDefault(), LOGLEVEL_INFO, __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__)
+#if defined(DEBUG) || !defined(SHADOW_STRIP_DEBUG_LOGS)
 #define debug(...)      logger_log(logger_getDefault(), LOGLEVEL_DEBUG, __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__)
+#else
+// Still type-checks the arguments (and so counts them as used), but never evaluates them.
+#define debug(...)      do { if (0) logger_log(logger_getDefault(), LOGLEVEL_DEBUG, __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__); } while (0)
+#endif
 #ifdef DEBUG
 #define trace(...)      logger_log(logger_getDefault(), LOGLEVEL_TRACE, __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__)
 #else
 #define trace(...)
 #endif
 
+// The most verbose level whose statements are compiled in.
+#if defined(DEBUG)
+#define LOGGER_MAX_COMPILED_LEVEL LOGLEVEL_TRACE
+#elif defined(SHADOW_STRIP_DEBUG_LOGS)
+#define LOGGER_MAX_COMPILED_LEVEL LOGLEVEL_INFO
+#else
+#define LOGGER_MAX_COMPILED_LEVEL LOGLEVEL_DEBUG
+#endif
+
+// Like `logger_isEnabled`, but constant false if statements at `level` are compiled out. Use it to
+// guard work that only builds arguments for those statements, so that the work is compiled out too.
+#define logger_isCompiledAndEnabled(logger, level)                                                 \
+    ((level) <= LOGGER_MAX_COMPILED_LEVEL && logger_isEnabled((logger), (level)))
+
 // clang-format on
 
 typedef struct _Logger Logger;
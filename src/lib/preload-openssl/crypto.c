@@ -5,9 +5,9 @@
  */
 
 #include <dlfcn.h>
-#include <execinfo.h>
-#include <pthread.h>
+#include <link.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -18,25 +18,81 @@
 #define debuglog(...)
 #endif
 
-// Caches whether or not a memory address is from libssl.so
-typedef struct {
-    void* addr;
-    bool is_libssl;
-} bt_cache_entry_t;
-
-// Lock for safely accessing this lib's global state from multiple threads.
-// TODO: We currently do no error checking when operating on this lock.
-static pthread_mutex_t global_state_lock = PTHREAD_MUTEX_INITIALIZER;
+// Caches whether or not a memory address is from libssl.so. An entry is the address, with
+// `CACHE_ENTRY_IS_LIBSSL` set if the address is in libssl. Userspace addresses never have the
+// top bit set, and 0 is an empty entry. Storing both in one word lets us update the shared cache
+// without a lock.
+typedef uintptr_t bt_cache_entry_t;
+#define CACHE_ENTRY_IS_LIBSSL (((uintptr_t)1) << (sizeof(uintptr_t) * 8 - 1))
 
 // We use a small cache size: in ad-hoc experiments with tor-0.4.6.9, we observed
 // at most three callers of EVP_EncryptUpdate.
 #define EVP_BACKTRACE_CACHE_LEN 10
-static bt_cache_entry_t evp_backtrace_cache[EVP_BACKTRACE_CACHE_LEN];
+// Each thread looks in its own cache first, and then in the cache shared by all threads.
+static __thread bt_cache_entry_t evp_backtrace_cache_local[EVP_BACKTRACE_CACHE_LEN];
+static bt_cache_entry_t evp_backtrace_cache_shared[EVP_BACKTRACE_CACHE_LEN];
+
+// The address ranges of libssl's loaded segments, if libssl was loaded when this lib was loaded.
+// These are only written by the constructor, before the application can create other threads.
+#define LIBSSL_MAX_RANGES 16
+typedef struct {
+    uintptr_t start;
+    uintptr_t end;
+} addr_range_t;
+static addr_range_t libssl_ranges[LIBSSL_MAX_RANGES];
+static int libssl_num_ranges = 0;
 
 // For storing a pointer to the original EVP_EncryptUpdate function.
 typedef int EVP_EncryptUpdate_func(void*, unsigned char*, int*, const unsigned char*, int);
 static void* evp_eu_funcptr = NULL;
 
+// The primitives that we elide, in addition to the ones above that we always skip. They are
+// chosen with a comma-separated list of mode names in this environment variable, which shadow
+// sets from its `experimental.openssl_crypto_elision` option. The elided outputs are only
+// understood by a process that elides the same primitives, so every peer must use the same modes.
+#define ELIDE_ENV_VAR "SHADOW_OPENSSL_CRYPTO_ELIDE"
+#define ELIDE_AES_GCM (1 << 0)
+#define ELIDE_SHA256 (1 << 1)
+#define ELIDE_ECDH (1 << 2)
+#define ELIDE_RSA (1 << 3)
+static const struct {
+    const char* name;
+    int flag;
+} elide_mode_names[] = {
+    {"aes-gcm", ELIDE_AES_GCM},
+    {"sha256", ELIDE_SHA256},
+    {"ecdh", ELIDE_ECDH},
+    {"rsa", ELIDE_RSA},
+};
+// Only written by the constructor.
+static int elide_modes = 0;
+
+// Pointers to the original functions of the primitives that we may elide. These are looked up on
+// first use, since we still need them when elision is disabled, and libcrypto might not have been
+// loaded yet when this lib was loaded.
+typedef int gcm128_crypt_func(void*, const unsigned char*, unsigned char*, size_t);
+typedef int gcm128_crypt_ctr32_func(void*, const unsigned char*, unsigned char*, size_t, void*);
+typedef unsigned char* SHA256_func(const unsigned char*, size_t, unsigned char*);
+typedef int EVP_PKEY_derive_func(void*, unsigned char*, size_t*);
+typedef void* EVP_PKEY_CTX_get0_pkey_func(void*);
+typedef int EVP_PKEY_id_func(const void*);
+typedef int RSA_crypt_func(int, const unsigned char*, unsigned char*, void*, int);
+typedef int RSA_size_func(const void*);
+static void* gcm_e_funcptr = NULL;
+static void* gcm_d_funcptr = NULL;
+static void* gcm_ec_funcptr = NULL;
+static void* gcm_dc_funcptr = NULL;
+static void* sha256_funcptr = NULL;
+static void* pkey_derive_funcptr = NULL;
+static void* pkey_ctx_get0_pkey_funcptr = NULL;
+static void* pkey_get_id_funcptr = NULL;
+static void* pkey_id_funcptr = NULL;
+static void* rsa_pre_funcptr = NULL;
+static void* rsa_pud_funcptr = NULL;
+static void* rsa_pue_funcptr = NULL;
+static void* rsa_prd_funcptr = NULL;
+static void* rsa_size_funcptr = NULL;
+
 // Counters for verifying that interception is happening correctly.
 static unsigned long aes_e_cnt = 0;
 static unsigned long aes_d_cnt = 0;
@@ -45,65 +101,117 @@ static unsigned long crypto_ce_cnt = 0;
 static unsigned long crypto_cec_cnt = 0;
 static unsigned long evp_c_cnt = 0;
 static unsigned long evp_eu_cnt = 0;
+static unsigned long gcm_e_cnt = 0;
+static unsigned long gcm_d_cnt = 0;
+static unsigned long gcm_ec_cnt = 0;
+static unsigned long gcm_dc_cnt = 0;
+static unsigned long sha256_cnt = 0;
+static unsigned long pkey_derive_cnt = 0;
+static unsigned long rsa_pre_cnt = 0;
+static unsigned long rsa_pud_cnt = 0;
+static unsigned long rsa_pue_cnt = 0;
+static unsigned long rsa_prd_cnt = 0;
+
+static unsigned long _load_counter(const unsigned long* cnt_ptr) {
+    return __atomic_load_n(cnt_ptr, __ATOMIC_RELAXED);
+}
 
 static void _print_counters() {
     debuglog("Counters: {'AES_encrypt':%lu, 'AES_decrypt':%lu, 'AES_ctr128_encrypt':%lu, "
              "'CRYPTO_ctr128_encrypt':%lu, 'CRYPTO_ctr128_encrypt_ctr32':%lu, "
-             "'EVP_Cipher':%lu, 'EVP_EncryptUpdate':%lu}\n",
-             aes_e_cnt, aes_d_cnt, aes_ce_cnt, crypto_ce_cnt, crypto_cec_cnt, evp_c_cnt,
-             evp_eu_cnt);
+             "'EVP_Cipher':%lu, 'EVP_EncryptUpdate':%lu, 'CRYPTO_gcm128_encrypt':%lu, "
+             "'CRYPTO_gcm128_decrypt':%lu, 'CRYPTO_gcm128_encrypt_ctr32':%lu, "
+             "'CRYPTO_gcm128_decrypt_ctr32':%lu, 'SHA256':%lu, 'EVP_PKEY_derive':%lu, "
+             "'RSA_private_encrypt':%lu, 'RSA_public_decrypt':%lu, 'RSA_public_encrypt':%lu, "
+             "'RSA_private_decrypt':%lu}\n",
+             _load_counter(&aes_e_cnt), _load_counter(&aes_d_cnt), _load_counter(&aes_ce_cnt),
+             _load_counter(&crypto_ce_cnt), _load_counter(&crypto_cec_cnt),
+             _load_counter(&evp_c_cnt), _load_counter(&evp_eu_cnt), _load_counter(&gcm_e_cnt),
+             _load_counter(&gcm_d_cnt), _load_counter(&gcm_ec_cnt), _load_counter(&gcm_dc_cnt),
+             _load_counter(&sha256_cnt), _load_counter(&pkey_derive_cnt),
+             _load_counter(&rsa_pre_cnt), _load_counter(&rsa_pud_cnt), _load_counter(&rsa_pue_cnt),
+             _load_counter(&rsa_prd_cnt));
 }
 
-static void _lock_global_state() {
-    int result = pthread_mutex_lock(&global_state_lock);
-    if (result != 0) {
-        abort();
+static int _find_libssl_ranges(struct dl_phdr_info* info, size_t size, void* data) {
+    if (info->dlpi_name == NULL || strstr(info->dlpi_name, "libssl.so") == NULL) {
+        return 0;
+    }
+
+    for (int i = 0; i < info->dlpi_phnum && libssl_num_ranges < LIBSSL_MAX_RANGES; i++) {
+        const ElfW(Phdr)* phdr = &info->dlpi_phdr[i];
+        if (phdr->p_type == PT_LOAD) {
+            uintptr_t start = info->dlpi_addr + phdr->p_vaddr;
+            libssl_ranges[libssl_num_ranges].start = start;
+            libssl_ranges[libssl_num_ranges].end = start + phdr->p_memsz;
+            libssl_num_ranges++;
+        }
     }
+
+    debuglog("Found %d loaded segments of %s\n", libssl_num_ranges, info->dlpi_name);
+
+    // stop iterating
+    return 1;
 }
 
-static void _unlock_global_state() {
-    int result = pthread_mutex_unlock(&global_state_lock);
-    if (result != 0) {
-        abort();
+static void _parse_elide_modes(const char* modes) {
+    char* copy = strdup(modes);
+    if (copy == NULL) {
+        return;
+    }
+
+    char* saveptr = NULL;
+    for (char* name = strtok_r(copy, ",", &saveptr); name != NULL;
+         name = strtok_r(NULL, ",", &saveptr)) {
+        bool found = false;
+        for (size_t i = 0; i < sizeof(elide_mode_names) / sizeof(elide_mode_names[0]); i++) {
+            if (strcmp(name, elide_mode_names[i].name) == 0) {
+                elide_modes |= elide_mode_names[i].flag;
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            fprintf(stderr, "Ignoring unknown crypto elision mode '%s' in %s\n", name,
+                    ELIDE_ENV_VAR);
+        }
     }
+
+    free(copy);
 }
 
 __attribute__((constructor)) void _crypto_load() {
     debuglog("Loading the preloaded crypto interception lib\n");
 
-    _lock_global_state();
-
-    // Initialize backtrace address cache pointers to NULL.
-    memset(evp_backtrace_cache, 0, sizeof(bt_cache_entry_t) * EVP_BACKTRACE_CACHE_LEN);
-
     // Get a ref to the EVP_EncryptUpdate that would be called if we didn't preload.
     evp_eu_funcptr = dlsym(RTLD_NEXT, "EVP_EncryptUpdate");
 
     debuglog("dlsym for EVP_EncryptUpdate returned %p\n", evp_eu_funcptr);
 
-    _unlock_global_state();
+    // If libssl is already loaded (it usually is, since the application links with it), we can
+    // tell whether an address is in libssl by comparing it with libssl's segments. Otherwise
+    // libssl may be loaded later with dlopen, and we look up each caller's library instead.
+    dl_iterate_phdr(_find_libssl_ranges, NULL);
+
+    const char* modes = getenv(ELIDE_ENV_VAR);
+    if (modes != NULL) {
+        _parse_elide_modes(modes);
+    }
+
+    debuglog("Crypto elision modes are 0x%x\n", elide_modes);
 }
 
 __attribute__((destructor)) void _crypto_unload() {
     debuglog("Unloading the preloaded crypto interception lib\n");
-
-    _lock_global_state();
     _print_counters();
-    _unlock_global_state();
 }
 
-static void _increment_unlocked(unsigned long* cnt_ptr) {
-    if ((++(*cnt_ptr) % 1000) == 0) {
+static void _increment(unsigned long* cnt_ptr) {
+    if ((__atomic_add_fetch(cnt_ptr, 1, __ATOMIC_RELAXED) % 1000) == 0) {
         _print_counters();
     }
 }
 
-static void _increment(unsigned long* cnt_ptr) {
-    _lock_global_state();
-    _increment_unlocked(cnt_ptr);
-    _unlock_global_state();
-}
-
 void AES_encrypt(const unsigned char* in, unsigned char* out, const void* key) {
     _increment(&aes_e_cnt);
 }
@@ -132,48 +240,86 @@ int EVP_Cipher(void* ctx, unsigned char* out, const unsigned char* in, unsigned
     return 1;
 }
 
-static const bt_cache_entry_t* _get_cache_entry(void* addr) {
+// Returns the cache entry for the address, or 0 if it isn't cached.
+static bt_cache_entry_t _get_cache_entry(const bt_cache_entry_t* cache, bool shared,
+                                         uintptr_t addr) {
     // An in-order traversal is fine since the cache is small.
-    // We can skip out early when we get to the first NULL pointer.
-    for (int i = 0; i < EVP_BACKTRACE_CACHE_LEN && evp_backtrace_cache[i].addr != NULL; i++) {
-        if (addr == evp_backtrace_cache[i].addr) {
-            return &evp_backtrace_cache[i];
+    // We can skip out early when we get to the first empty entry, since entries are filled in
+    // order and never removed.
+    for (int i = 0; i < EVP_BACKTRACE_CACHE_LEN; i++) {
+        bt_cache_entry_t entry =
+            shared ? __atomic_load_n(&cache[i], __ATOMIC_RELAXED) : cache[i];
+        if (entry == 0) {
+            break;
+        }
+        if ((entry & ~CACHE_ENTRY_IS_LIBSSL) == addr) {
+            return entry;
         }
     }
-    return NULL;
-}
-
-static bool _cache_has_space() {
-    return (evp_backtrace_cache[EVP_BACKTRACE_CACHE_LEN - 1].addr == NULL);
+    return 0;
 }
 
-static void _append_to_cache(void* addr, bool is_libssl) {
-    // Store at the first empty cache slot.
+// Stores the entry at the first empty slot, if there is one.
+static void _append_to_cache(bt_cache_entry_t* cache, bool shared, bt_cache_entry_t entry) {
     for (int i = 0; i < EVP_BACKTRACE_CACHE_LEN; i++) {
-        if (evp_backtrace_cache[i].addr == NULL) {
-            evp_backtrace_cache[i].addr = addr;
-            evp_backtrace_cache[i].is_libssl = is_libssl;
+        if (!shared) {
+            if (cache[i] == 0) {
+                cache[i] = entry;
+                return;
+            }
+            continue;
+        }
 
-            debuglog("Cached EVP_EncryptUpdate caller=%p, is_libssl=%s\n", addr,
-                     is_libssl ? "true" : "false");
-            break;
+        // other threads may be filling the same slot
+        bt_cache_entry_t expected = 0;
+        if (__atomic_compare_exchange_n(&cache[i], &expected, entry, false, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED)) {
+            debuglog("Cached EVP_EncryptUpdate caller=%p, is_libssl=%s\n",
+                     (void*)(entry & ~CACHE_ENTRY_IS_LIBSSL),
+                     (entry & CACHE_ENTRY_IS_LIBSSL) ? "true" : "false");
+            return;
+        }
+        if (expected == entry) {
+            // another thread cached it first
+            return;
         }
     }
 }
 
-static bool _is_addr_in_libssl(void* addr) {
-    bool found = false;
+static bool _is_addr_in_libssl(uintptr_t addr) {
+    if (libssl_num_ranges > 0) {
+        for (int i = 0; i < libssl_num_ranges; i++) {
+            if (addr >= libssl_ranges[i].start && addr < libssl_ranges[i].end) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // We use the caches first because checking the name of the library is expensive.
+    bt_cache_entry_t entry = _get_cache_entry(evp_backtrace_cache_local, false, addr);
+    if (entry != 0) {
+        return (entry & CACHE_ENTRY_IS_LIBSSL) != 0;
+    }
+
+    entry = _get_cache_entry(evp_backtrace_cache_shared, true, addr);
 
-    // Gets a string containing the full file path to the caller,
-    // e.g. /lib/x86_64-linux-gnu/libssl.so.1.1
-    char** bt_str_buf = backtrace_symbols(&addr, 1);
+    if (entry == 0) {
+        // Fall back to checking the path of the library containing the caller,
+        // e.g. /lib/x86_64-linux-gnu/libssl.so.1.1
+        // This might be more expensive than just performing the crypto op, and we might have to
+        // perform the crypto op anyway depending on the result, but we do it anyway to maintain
+        // consistency in behavior.
+        Dl_info info;
+        bool is_libssl = dladdr((void*)addr, &info) != 0 && info.dli_fname != NULL &&
+                         strstr(info.dli_fname, "libssl.so") != NULL;
 
-    if (bt_str_buf != NULL && bt_str_buf[0] != NULL) {
-        found = (strstr(bt_str_buf[0], "libssl.so") != NULL);
+        entry = addr | (is_libssl ? CACHE_ENTRY_IS_LIBSSL : 0);
+        _append_to_cache(evp_backtrace_cache_shared, true, entry);
     }
 
-    free(bt_str_buf);
-    return found;
+    _append_to_cache(evp_backtrace_cache_local, false, entry);
+    return (entry & CACHE_ENTRY_IS_LIBSSL) != 0;
 }
 
 int EVP_EncryptUpdate(void* cipher, unsigned char* out, int* outl, const unsigned char* in,
@@ -182,54 +328,13 @@ int EVP_EncryptUpdate(void* cipher, unsigned char* out, int* outl, const unsigne
     //   - calls from libssl are used for TLS and skipping will break TLS
     //   - calls from tor are used for AES and can be skipped
     // So we can skip the crypto op as long as the call is not made from libssl.
-    void* caller_addr = NULL;
-    bool caller_is_libssl = false;
-
-    {
-        // Get the backtrace addresses; we only need 2: our stack is in [0]
-        // and the caller's stack is in [1].
-        void* bt_addr_buf[2];
-
-        // We want to make sure we get the backtrace here and not in a helper
-        // function so that our stack offset math is correct.
-        int bt_len = backtrace(bt_addr_buf, 2);
-        if (bt_len == 2) {
-            caller_addr = bt_addr_buf[1];
-        }
-    }
-
-    if (caller_addr != NULL) {
-        _lock_global_state();
-
-        // We use a cache first because checking the name of the library is expensive.
-        const bt_cache_entry_t* entry = _get_cache_entry(caller_addr);
-
-        if (entry != NULL) {
-            // The answer we want is cached.
-            caller_is_libssl = entry->is_libssl;
-        } else {
-            // Fall back to check the caller backtrace symbols.
-            // This might be more expensive than just performing the crypto op, and we might have to
-            // perform the crypto op anyway depending on the result, but we do it anyway to maintain
-            // consistency in behavior.
-            caller_is_libssl = _is_addr_in_libssl(caller_addr);
-            // Cache it if there is space.
-            if (_cache_has_space()) {
-                _append_to_cache(caller_addr, caller_is_libssl);
-            }
-        }
+    // The return address tells us where we were called from; we want to make sure we get it
+    // here and not in a helper function.
+    uintptr_t caller_addr = (uintptr_t)__builtin_extract_return_addr(__builtin_return_address(0));
 
-        if (!caller_is_libssl) {
-            // We will skip the crypto, increment the counter while we still hold the lock.
-            _increment_unlocked(&evp_eu_cnt);
-        }
-
-        _unlock_global_state();
-    }
-
-    if (caller_addr != NULL && !caller_is_libssl) {
+    if (!_is_addr_in_libssl(caller_addr)) {
         // Skip the crypto in calls made from the application, e.g. tor.
-        // We already incremented the counter above.
+        _increment(&evp_eu_cnt);
         return 1; // success
     } else if (evp_eu_funcptr != NULL) {
         // Let openssl handle it.
@@ -239,3 +344,275 @@ int EVP_EncryptUpdate(void* cipher, unsigned char* out, int* outl, const unsigne
         return 0; // failure
     }
 }
+
+// Returns the function that would be called if we didn't preload, or NULL if there isn't one.
+static void* _next_func(void** funcptr, const char* name) {
+    void* func = __atomic_load_n(funcptr, __ATOMIC_RELAXED);
+    if (func == NULL) {
+        // Other threads may do the same lookup, but they'll all find the same function.
+        func = dlsym(RTLD_NEXT, name);
+        __atomic_store_n(funcptr, func, __ATOMIC_RELAXED);
+    }
+    return func;
+}
+
+// The GCM functions are called by libcrypto's AES-GCM ciphers for the bulk of the data, and by
+// skipping them we also skip GHASH of the data. The tag then only covers the AAD, but it's
+// computed the same way by the peer, so it still verifies.
+
+int CRYPTO_gcm128_encrypt(void* ctx, const unsigned char* in, unsigned char* out, size_t len) {
+    if (elide_modes & ELIDE_AES_GCM) {
+        _increment(&gcm_e_cnt);
+        memmove(out, in, len);
+        return 0; // success
+    }
+    gcm128_crypt_func* func = _next_func(&gcm_e_funcptr, "CRYPTO_gcm128_encrypt");
+    return func != NULL ? func(ctx, in, out, len) : -1;
+}
+
+int CRYPTO_gcm128_decrypt(void* ctx, const unsigned char* in, unsigned char* out, size_t len) {
+    if (elide_modes & ELIDE_AES_GCM) {
+        _increment(&gcm_d_cnt);
+        memmove(out, in, len);
+        return 0; // success
+    }
+    gcm128_crypt_func* func = _next_func(&gcm_d_funcptr, "CRYPTO_gcm128_decrypt");
+    return func != NULL ? func(ctx, in, out, len) : -1;
+}
+
+int CRYPTO_gcm128_encrypt_ctr32(void* ctx, const unsigned char* in, unsigned char* out, size_t len,
+                                void* stream) {
+    if (elide_modes & ELIDE_AES_GCM) {
+        _increment(&gcm_ec_cnt);
+        memmove(out, in, len);
+        return 0; // success
+    }
+    gcm128_crypt_ctr32_func* func = _next_func(&gcm_ec_funcptr, "CRYPTO_gcm128_encrypt_ctr32");
+    return func != NULL ? func(ctx, in, out, len, stream) : -1;
+}
+
+int CRYPTO_gcm128_decrypt_ctr32(void* ctx, const unsigned char* in, unsigned char* out, size_t len,
+                                void* stream) {
+    if (elide_modes & ELIDE_AES_GCM) {
+        _increment(&gcm_dc_cnt);
+        memmove(out, in, len);
+        return 0; // success
+    }
+    gcm128_crypt_ctr32_func* func = _next_func(&gcm_dc_funcptr, "CRYPTO_gcm128_decrypt_ctr32");
+    return func != NULL ? func(ctx, in, out, len, stream) : -1;
+}
+
+#define SHA256_DIGEST_LEN 32
+// Smaller inputs are cheap to hash, and are more likely to be keys or certificates whose digests
+// are compared with ones computed outside of the simulation.
+#define SHA256_ELIDE_MIN_LEN 4096
+// The dummy digest covers one word of the input per this many bytes.
+#define SHA256_ELIDE_STRIDE 256
+
+// Used when the caller doesn't provide a buffer, like openssl's own static buffer.
+static __thread unsigned char sha256_md[SHA256_DIGEST_LEN];
+
+// The splitmix64 finalizer.
+static uint64_t _mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+// A deterministic digest of the length, a sample of words from the input, and the end of the
+// input. Inputs that differ only between the sampled words will have the same digest.
+static void _dummy_digest(const unsigned char* d, size_t n, unsigned char* md) {
+    uint64_t h = _mix64(n);
+    for (size_t i = 0; i + sizeof(uint64_t) <= n; i += SHA256_ELIDE_STRIDE) {
+        uint64_t word;
+        memcpy(&word, &d[i], sizeof(word));
+        h = _mix64(h ^ word);
+    }
+    for (size_t i = n - 64; i + sizeof(uint64_t) <= n; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, &d[i], sizeof(word));
+        h = _mix64(h ^ word);
+    }
+    for (size_t i = 0; i < SHA256_DIGEST_LEN; i += sizeof(uint64_t)) {
+        uint64_t word = _mix64(h + i);
+        memcpy(&md[i], &word, sizeof(word));
+    }
+}
+
+unsigned char* SHA256(const unsigned char* d, size_t n, unsigned char* md) {
+    if ((elide_modes & ELIDE_SHA256) && n >= SHA256_ELIDE_MIN_LEN) {
+        _increment(&sha256_cnt);
+        if (md == NULL) {
+            md = sha256_md;
+        }
+        _dummy_digest(d, n, md);
+        return md;
+    }
+    SHA256_func* func = _next_func(&sha256_funcptr, "SHA256");
+    return func != NULL ? func(d, n, md) : NULL;
+}
+
+// Key types from openssl/obj_mac.h that are used for key exchange.
+#define NID_DH 28
+#define NID_EC 408
+#define NID_DHX 920
+#define NID_X25519 1034
+#define NID_X448 1035
+
+// Returns true if the derivation is a (EC)DH key exchange, rather than e.g. HKDF, which is also
+// done with EVP_PKEY_derive.
+static bool _is_key_exchange(void* ctx) {
+    EVP_PKEY_CTX_get0_pkey_func* get0_pkey =
+        _next_func(&pkey_ctx_get0_pkey_funcptr, "EVP_PKEY_CTX_get0_pkey");
+    // openssl 3 renamed EVP_PKEY_id
+    EVP_PKEY_id_func* get_id = _next_func(&pkey_get_id_funcptr, "EVP_PKEY_get_id");
+    if (get_id == NULL) {
+        get_id = _next_func(&pkey_id_funcptr, "EVP_PKEY_id");
+    }
+    if (ctx == NULL || get0_pkey == NULL || get_id == NULL) {
+        return false;
+    }
+
+    void* pkey = get0_pkey(ctx);
+    if (pkey == NULL) {
+        return false;
+    }
+
+    int id = get_id(pkey);
+    return id == NID_DH || id == NID_EC || id == NID_DHX || id == NID_X25519 || id == NID_X448;
+}
+
+int EVP_PKEY_derive(void* ctx, unsigned char* key, size_t* keylen) {
+    EVP_PKEY_derive_func* func = _next_func(&pkey_derive_funcptr, "EVP_PKEY_derive");
+    if (func == NULL) {
+        return 0; // failure
+    }
+
+    // A NULL key asks for the length of the secret, which is cheap.
+    if (!(elide_modes & ELIDE_ECDH) || key == NULL || keylen == NULL || !_is_key_exchange(ctx)) {
+        return func(ctx, key, keylen);
+    }
+
+    size_t len = 0;
+    if (func(ctx, NULL, &len) <= 0 || *keylen < len) {
+        // Let openssl report the error.
+        return func(ctx, key, keylen);
+    }
+
+    // Both peers derive the same secret.
+    _increment(&pkey_derive_cnt);
+    memset(key, 0, len);
+    *keylen = len;
+    return 1; // success
+}
+
+// An elided RSA output has this header, then the input length as two big-endian bytes, and then
+// the input, padded with zeros to the size of the key. The leading zero keeps it smaller than
+// the modulus, like a real output. An input with this header can only have come from an elided
+// operation, so we can still check signatures that were made outside of the simulation.
+static const unsigned char rsa_dummy_magic[] = {0, 'S', 'H', 'A', 'D', 'O', 'W', 0};
+#define RSA_DUMMY_HEADER_LEN (sizeof(rsa_dummy_magic) + 2)
+// RSA_NO_PADDING from openssl/rsa.h
+#define RSA_NO_PADDING_MODE 3
+
+// Writes the elided output of an RSA private key encryption (a signature) or public key
+// encryption. Returns the output length, or -1 if the operation can't be elided.
+static int _rsa_dummy_encode(int flen, const unsigned char* from, unsigned char* to, void* rsa,
+                             int padding) {
+    // Without padding the caller may expect a specific output, e.g. for RSA-PSS.
+    if (padding == RSA_NO_PADDING_MODE || flen < 0 || flen > 0xffff) {
+        return -1;
+    }
+
+    RSA_size_func* size_func = _next_func(&rsa_size_funcptr, "RSA_size");
+    if (size_func == NULL) {
+        return -1;
+    }
+
+    int size = size_func(rsa);
+    if (size < (int)RSA_DUMMY_HEADER_LEN + flen) {
+        return -1;
+    }
+
+    // `from` and `to` may be the same buffer, so move the input before writing the header.
+    memmove(&to[RSA_DUMMY_HEADER_LEN], from, flen);
+    memcpy(to, rsa_dummy_magic, sizeof(rsa_dummy_magic));
+    to[sizeof(rsa_dummy_magic)] = (unsigned char)(flen >> 8);
+    to[sizeof(rsa_dummy_magic) + 1] = (unsigned char)flen;
+    memset(&to[RSA_DUMMY_HEADER_LEN + flen], 0, size - RSA_DUMMY_HEADER_LEN - flen);
+    return size;
+}
+
+// Reads the input back out of an elided RSA output. Returns the input length, or -1 if `from`
+// isn't an elided output.
+static int _rsa_dummy_decode(int flen, const unsigned char* from, unsigned char* to) {
+    if (flen < (int)RSA_DUMMY_HEADER_LEN ||
+        memcmp(from, rsa_dummy_magic, sizeof(rsa_dummy_magic)) != 0) {
+        return -1;
+    }
+
+    int len = (from[sizeof(rsa_dummy_magic)] << 8) | from[sizeof(rsa_dummy_magic) + 1];
+    if (len > flen - (int)RSA_DUMMY_HEADER_LEN) {
+        return -1;
+    }
+
+    memmove(to, &from[RSA_DUMMY_HEADER_LEN], len);
+    return len;
+}
+
+static int _rsa_next(void** funcptr, const char* name, int flen, const unsigned char* from,
+                     unsigned char* to, void* rsa, int padding) {
+    RSA_crypt_func* func = _next_func(funcptr, name);
+    return func != NULL ? func(flen, from, to, rsa, padding) : -1;
+}
+
+int RSA_private_encrypt(int flen, const unsigned char* from, unsigned char* to, void* rsa,
+                        int padding) {
+    if (elide_modes & ELIDE_RSA) {
+        int rv = _rsa_dummy_encode(flen, from, to, rsa, padding);
+        if (rv >= 0) {
+            _increment(&rsa_pre_cnt);
+            return rv;
+        }
+    }
+    return _rsa_next(&rsa_pre_funcptr, "RSA_private_encrypt", flen, from, to, rsa, padding);
+}
+
+int RSA_public_decrypt(int flen, const unsigned char* from, unsigned char* to, void* rsa,
+                       int padding) {
+    if (elide_modes & ELIDE_RSA) {
+        int rv = _rsa_dummy_decode(flen, from, to);
+        if (rv >= 0) {
+            _increment(&rsa_pud_cnt);
+            return rv;
+        }
+    }
+    return _rsa_next(&rsa_pud_funcptr, "RSA_public_decrypt", flen, from, to, rsa, padding);
+}
+
+int RSA_public_encrypt(int flen, const unsigned char* from, unsigned char* to, void* rsa,
+                       int padding) {
+    if (elide_modes & ELIDE_RSA) {
+        int rv = _rsa_dummy_encode(flen, from, to, rsa, padding);
+        if (rv >= 0) {
+            _increment(&rsa_pue_cnt);
+            return rv;
+        }
+    }
+    return _rsa_next(&rsa_pue_funcptr, "RSA_public_encrypt", flen, from, to, rsa, padding);
+}
+
+int RSA_private_decrypt(int flen, const unsigned char* from, unsigned char* to, void* rsa,
+                        int padding) {
+    if (elide_modes & ELIDE_RSA) {
+        int rv = _rsa_dummy_decode(flen, from, to);
+        if (rv >= 0) {
+            _increment(&rsa_prd_cnt);
+            return rv;
+        }
+    }
+    return _rsa_next(&rsa_prd_funcptr, "RSA_private_decrypt", flen, from, to, rsa, padding);
+}
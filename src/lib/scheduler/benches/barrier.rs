@@ -0,0 +1,40 @@
+//! Measures the scheduler's per-round synchronization: starting a task on every thread and waiting
+//! for all of them to finish it, with a task that does nothing.
+
+use criterion::{criterion_group, criterion_main, BenchmarkId, Criterion};
+use scheduler::thread_per_core::ThreadPerCoreSched;
+
+fn empty_rounds(sched: &mut ThreadPerCoreSched<()>, rounds: u64) {
+    for _ in 0..rounds {
+        sched.scope(|s| s.run(|_| {}));
+    }
+}
+
+pub fn criterion_benchmark(c: &mut Criterion) {
+    let max_threads = std::thread::available_parallelism().unwrap().get();
+    let num_threads = [2, 8, 32, 128, 192]
+        .into_iter()
+        .filter(|x| *x <= max_threads)
+        .chain([max_threads]);
+
+    let mut group = c.benchmark_group("round");
+    for num_threads in num_threads {
+        for tree_barrier in [false, true] {
+            let name = if tree_barrier { "tree" } else { "latch" };
+            // spinning threads, as with shadow's default options
+            let mut sched =
+                ThreadPerCoreSched::<()>::new(&vec![None; num_threads], [], true, tree_barrier);
+            group.bench_function(BenchmarkId::new(name, num_threads), |b| {
+                b.iter_custom(|rounds| {
+                    let start = std::time::Instant::now();
+                    empty_rounds(&mut sched, rounds);
+                    start.elapsed()
+                })
+            });
+        }
+    }
+    group.finish();
+}
+
+criterion_group!(benches, criterion_benchmark);
+criterion_main!(benches);
@@ -0,0 +1,91 @@
+//! Assignment of hosts to threads by cost.
+
+#![forbid(unsafe_code)]
+
+use std::cmp::Reverse;
+use std::collections::BinaryHeap;
+
+/// Assigns hosts to threads given their costs. When given the hosts from most to least expensive,
+/// this is the "longest processing time first" heuristic.
+pub(crate) struct CostBalancer {
+    /// (total cost, number of hosts, thread index) for each thread.
+    loads: BinaryHeap<Reverse<(u64, usize, usize)>>,
+}
+
+impl CostBalancer {
+    pub fn new(num_threads: usize) -> Self {
+        Self {
+            loads: (0..num_threads).map(|i| Reverse((0, 0, i))).collect(),
+        }
+    }
+
+    /// Assign a host to the thread with the lowest total cost so far. Ties go to the thread with
+    /// the fewest hosts, so that hosts with no known cost are spread evenly.
+    pub fn assign(&mut self, cost_ns: u64) -> usize {
+        let Reverse((total, count, thread)) = self.loads.pop().unwrap();
+        self.loads
+            .push(Reverse((total.saturating_add(cost_ns), count + 1, thread)));
+        thread
+    }
+
+    /// Assign hosts with the given costs to `num_threads` threads, from the most to the least
+    /// expensive host. Returns the index of each host in `costs` and its thread, in the order that
+    /// they were assigned. Hosts with the same cost are assigned in the order given, so without any
+    /// known costs the hosts are assigned in a round-robin manner.
+    pub fn balance(num_threads: usize, costs: &[u64]) -> Vec<(usize, usize)> {
+        let mut order: Vec<usize> = (0..costs.len()).collect();
+        // a stable sort
+        order.sort_by_key(|i| Reverse(costs[*i]));
+
+        let mut balancer = Self::new(num_threads);
+        order
+            .into_iter()
+            .map(|i| (i, balancer.assign(costs[i])))
+            .collect()
+    }
+}
+
+#[cfg(any(test, doctest))]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_cost_balancer() {
+        // one expensive host and many cheap hosts
+        let costs = [100, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10];
+        let mut balancer = CostBalancer::new(3);
+        let mut loads = [0; 3];
+        let mut counts = [0; 3];
+        for cost in costs {
+            let thread = balancer.assign(cost);
+            loads[thread] += cost;
+            counts[thread] += 1;
+        }
+
+        // the expensive host gets a thread to itself
+        assert_eq!(loads, [100, 50, 50]);
+        assert_eq!(counts, [1, 5, 5]);
+
+        // hosts with no cost are spread evenly
+        let mut balancer = CostBalancer::new(3);
+        let mut counts = [0; 3];
+        for _ in 0..10 {
+            counts[balancer.assign(0)] += 1;
+        }
+        assert_eq!(counts, [4, 3, 3]);
+    }
+
+    #[test]
+    fn test_balance() {
+        assert_eq!(
+            CostBalancer::balance(2, &[10, 100, 10, 10, 10]),
+            [(1, 0), (0, 1), (2, 1), (3, 1), (4, 1)]
+        );
+
+        // round-robin without costs
+        assert_eq!(
+            CostBalancer::balance(2, &[0; 5]),
+            [(0, 0), (1, 1), (2, 0), (3, 1), (4, 0)]
+        );
+    }
+}
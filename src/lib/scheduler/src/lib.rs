@@ -14,9 +14,9 @@
 //! The scheduler in this library uses a thread pool optimized for running the same task across all
 //! threads. This means that the scheduler takes a single function/closure and runs it on each
 //! thread simultaneously (and sometimes repeatedly) until all of the hosts have been processed. The
-//! implementation details depend on which scheduler is in use ( [`ThreadPerCoreSched`] or
-//! [`ThreadPerHostSched`]), but all schedulers share a common interface so that they can easily be
-//! switched out.
+//! implementation details depend on which scheduler is in use ([`ThreadPerCoreSched`],
+//! [`WorkStealingSched`], or [`ThreadPerHostSched`]), but all schedulers share a common interface
+//! so that they can easily be switched out.
 //!
 //! The [`Scheduler`] provides a simple wrapper to make it easier to support both schedulers, which
 //! is useful if you want to choose one at runtime. The schedulers use a "[scoped
@@ -38,7 +38,7 @@
 //!
 //! // a scheduler with two threads (no cpu pinning) and three hosts
 //! let mut sched: ThreadPerCoreSched<Host> =
-//!     ThreadPerCoreSched::new(&[None, None], hosts, false);
+//!     ThreadPerCoreSched::new(&[None, None], hosts, false, false);
 //!
 //! // the counter is owned by this main thread with a non-static lifetime, but
 //! // because of the "scoped threads" design it can be accessed by the task in
@@ -74,6 +74,12 @@
 //! [`ThreadPerHostSched`] scheduler. If no one finds a situation where the `ThreadPerHostSched` is
 //! faster, then it should probably be removed sometime in the future.
 //!
+//! The [`WorkStealingSched`] scheduler is like the `ThreadPerCoreSched` scheduler, but keeps track
+//! of how long each host takes to run and regularly reassigns hosts to threads to balance this
+//! time. Each thread runs its most expensive hosts first, and steals the cheapest hosts of other
+//! threads when it runs out of hosts. This can help when a few hosts are much busier than the
+//! others.
+//!
 //! It's probably good to [`box`][Box] the host since the schedulers move the host frequently, and it's
 //! faster to move a pointer than the entire host object.
 //!
@@ -94,7 +100,9 @@
 
 pub mod thread_per_core;
 pub mod thread_per_host;
+pub mod work_stealing;
 
+mod cost_balancer;
 mod logical_processor;
 mod pools;
 mod sync;
@@ -102,7 +110,10 @@ mod sync;
 use std::cell::Cell;
 
 #[cfg(doc)]
-use {thread_per_core::ThreadPerCoreSched, thread_per_host::ThreadPerHostSched};
+use {
+    thread_per_core::ThreadPerCoreSched, thread_per_host::ThreadPerHostSched,
+    work_stealing::WorkStealingSched,
+};
 
 // any scheduler implementation can read/write the thread-local directly, but external modules can
 // only read it using `core_affinity()`
@@ -119,14 +130,15 @@ pub fn core_affinity() -> Option<u32> {
 }
 
 // the enum supports hosts that satisfy the trait bounds of each scheduler variant
-pub trait Host: thread_per_core::Host + thread_per_host::Host {}
-impl<T> Host for T where T: thread_per_core::Host + thread_per_host::Host {}
+pub trait Host: thread_per_core::Host + thread_per_host::Host + work_stealing::Host {}
+impl<T> Host for T where T: thread_per_core::Host + thread_per_host::Host + work_stealing::Host {}
 
 /// A wrapper for different host schedulers. It would have been nice to make this a trait, but would
 /// require support for GATs.
 pub enum Scheduler<HostType: Host> {
     ThreadPerHost(thread_per_host::ThreadPerHostSched<HostType>),
     ThreadPerCore(thread_per_core::ThreadPerCoreSched<HostType>),
+    WorkStealing(work_stealing::WorkStealingSched<HostType>),
 }
 
 impl<HostType: Host> Scheduler<HostType> {
@@ -136,6 +148,7 @@ impl<HostType: Host> Scheduler<HostType> {
         match self {
             Self::ThreadPerHost(sched) => sched.parallelism(),
             Self::ThreadPerCore(sched) => sched.parallelism(),
+            Self::WorkStealing(sched) => sched.parallelism(),
         }
     }
 
@@ -148,6 +161,7 @@ impl<HostType: Host> Scheduler<HostType> {
         match self {
             Self::ThreadPerHost(sched) => sched.scope(move |s| f(SchedulerScope::ThreadPerHost(s))),
             Self::ThreadPerCore(sched) => sched.scope(move |s| f(SchedulerScope::ThreadPerCore(s))),
+            Self::WorkStealing(sched) => sched.scope(move |s| f(SchedulerScope::WorkStealing(s))),
         }
     }
 
@@ -156,6 +170,7 @@ impl<HostType: Host> Scheduler<HostType> {
         match self {
             Self::ThreadPerHost(sched) => sched.join(),
             Self::ThreadPerCore(sched) => sched.join(),
+            Self::WorkStealing(sched) => sched.join(),
         }
     }
 }
@@ -164,6 +179,7 @@ impl<HostType: Host> Scheduler<HostType> {
 pub enum SchedulerScope<'sched, 'pool, 'scope, HostType: Host> {
     ThreadPerHost(thread_per_host::SchedulerScope<'pool, 'scope, HostType>),
     ThreadPerCore(thread_per_core::SchedulerScope<'sched, 'pool, 'scope, HostType>),
+    WorkStealing(work_stealing::SchedulerScope<'sched, 'pool, 'scope, HostType>),
 }
 
 impl<'sched, 'pool, 'scope, HostType: Host> SchedulerScope<'sched, 'pool, 'scope, HostType> {
@@ -173,6 +189,7 @@ impl<'sched, 'pool, 'scope, HostType: Host> SchedulerScope<'sched, 'pool, 'scope
         match self {
             Self::ThreadPerHost(scope) => scope.run(f),
             Self::ThreadPerCore(scope) => scope.run(f),
+            Self::WorkStealing(scope) => scope.run(f),
         }
     }
 
@@ -192,6 +209,10 @@ impl<'sched, 'pool, 'scope, HostType: Host> SchedulerScope<'sched, 'pool, 'scope
                 let mut iter = HostIter::ThreadPerCore(iter);
                 f(idx, &mut iter)
             }),
+            Self::WorkStealing(scope) => scope.run_with_hosts(move |idx, iter| {
+                let mut iter = HostIter::WorkStealing(iter);
+                f(idx, &mut iter)
+            }),
         }
     }
 
@@ -225,6 +246,10 @@ impl<'sched, 'pool, 'scope, HostType: Host> SchedulerScope<'sched, 'pool, 'scope
                 let mut iter = HostIter::ThreadPerCore(iter);
                 f(idx, &mut iter, elem)
             }),
+            Self::WorkStealing(scope) => scope.run_with_data(data, move |idx, iter, elem| {
+                let mut iter = HostIter::WorkStealing(iter);
+                f(idx, &mut iter, elem)
+            }),
         }
     }
 }
@@ -233,6 +258,7 @@ impl<'sched, 'pool, 'scope, HostType: Host> SchedulerScope<'sched, 'pool, 'scope
 pub enum HostIter<'a, 'b, HostType: Host> {
     ThreadPerHost(&'a mut thread_per_host::HostIter<HostType>),
     ThreadPerCore(&'a mut thread_per_core::HostIter<'b, HostType>),
+    WorkStealing(&'a mut work_stealing::HostIter<'b, HostType>),
 }
 
 impl<'a, 'b, HostType: Host> HostIter<'a, 'b, HostType> {
@@ -247,6 +273,7 @@ impl<'a, 'b, HostType: Host> HostIter<'a, 'b, HostType> {
         match self {
             Self::ThreadPerHost(x) => x.for_each(f),
             Self::ThreadPerCore(x) => x.for_each(f),
+            Self::WorkStealing(x) => x.for_each(f),
         }
     }
 }
@@ -1,26 +1,50 @@
 #![forbid(unsafe_code)]
 
+use std::cmp::Reverse;
+
 use crossbeam::queue::ArrayQueue;
 
 /// A set of `n` logical processors.
 pub struct LogicalProcessors {
     lps: Vec<LogicalProcessor>,
+    /// For each processor, the order of processors to take workers from: itself, then the other
+    /// processors on the same NUMA node, then the remaining processors, each in round-robin order.
+    steal_order: Vec<Vec<usize>>,
 }
 
 impl LogicalProcessors {
     pub fn new(processors: &[Option<u32>], num_workers: usize) -> Self {
+        let nodes: Vec<_> = processors
+            .iter()
+            .map(|cpu_id| cpu_id.and_then(numa_node))
+            .collect();
+        Self::with_nodes(processors, &nodes, num_workers)
+    }
+
+    fn with_nodes(processors: &[Option<u32>], nodes: &[Option<u32>], num_workers: usize) -> Self {
+        assert_eq!(processors.len(), nodes.len());
         let mut lps = Vec::new();
 
-        for cpu_id in processors {
+        for (cpu_id, node) in processors.iter().zip(nodes) {
             lps.push(LogicalProcessor {
                 cpu_id: *cpu_id,
+                node: *node,
                 // each queue must be large enough to store all the workers
                 ready_workers: ArrayQueue::new(num_workers),
                 done_workers: ArrayQueue::new(num_workers),
             });
         }
 
-        Self { lps }
+        let steal_order = (0..lps.len())
+            .map(|lpi| {
+                let mut order: Vec<_> = (0..lps.len()).cycle().skip(lpi).take(lps.len()).collect();
+                // a stable sort, so each group stays in round-robin order
+                order.sort_by_key(|x| lps[*x].node != lps[lpi].node);
+                order
+            })
+            .collect();
+
+        Self { lps, steal_order }
     }
 
     /// Add a worker id to be run on processor `lpi`.
@@ -30,17 +54,10 @@ impl LogicalProcessors {
 
     /// Get a worker id to run on processor `lpi`. Returns `None` if there are no more workers to run.
     pub fn next_worker(&self, lpi: usize) -> Option<(usize, usize)> {
-        // Start with workers that last ran on `lpi`; if none are available steal from another in
-        // round-robin order.
-        for (from_lpi, from_lp) in self
-            .lps
-            .iter()
-            .enumerate()
-            .cycle()
-            .skip(lpi)
-            .take(self.lps.len())
-        {
-            if let Some(worker) = from_lp.ready_workers.pop() {
+        // Start with workers that last ran on `lpi`; if none are available steal from another,
+        // preferring processors on the same NUMA node so that workers and their memory stay local.
+        for &from_lpi in &self.steal_order[lpi] {
+            if let Some(worker) = self.lps[from_lpi].ready_workers.pop() {
                 // Mark the worker as "done"; push the worker to `lpi`, not the processor that it
                 // was stolen from.
                 self.lps[lpi].done_workers.push(worker).unwrap();
@@ -60,6 +77,76 @@ impl LogicalProcessors {
         }
     }
 
+    /// Reassign workers to logical processors so that each processor has about the same total
+    /// cost, while keeping as many workers as possible on the processor that they last ran on, or
+    /// otherwise on the same NUMA node. `costs` is indexed by worker id. Must be called after [`Self::reset`]. Returns the workers
+    /// that were moved, and the processor that each was moved to.
+    pub fn repartition(&mut self, costs: &[u64]) -> Vec<(usize, usize)> {
+        // (worker, current processor)
+        let mut workers = Vec::new();
+        for (lpi, lp) in self.lps.iter().enumerate() {
+            assert!(lp.done_workers.is_empty());
+            while let Some(worker) = lp.ready_workers.pop() {
+                workers.push((worker, lpi));
+            }
+        }
+
+        // place the most expensive workers first (the "longest processing time first" heuristic),
+        // which also has each processor run its most expensive workers first
+        workers.sort_by_key(|(worker, _)| Reverse(costs[*worker]));
+
+        let total_cost = workers
+            .iter()
+            .fold(0u64, |sum, (worker, _)| sum.saturating_add(costs[*worker]));
+        let mean_cost = total_cost / self.lps.len() as u64;
+        // allow some imbalance so that we don't move workers for a small gain
+        let cost_limit = mean_cost.saturating_add(mean_cost / 16);
+
+        let mut loads = vec![0u64; self.lps.len()];
+        let mut moved = Vec::new();
+
+        for (worker, current_lpi) in workers {
+            let cost = costs[worker];
+            let (min_lpi, min_load) = loads
+                .iter()
+                .copied()
+                .enumerate()
+                .min_by_key(|(_, load)| *load)
+                .unwrap();
+
+            // the least loaded processor on the same NUMA node that the worker fits on
+            let node = self.lps[current_lpi].node;
+            let node_lpi = loads
+                .iter()
+                .copied()
+                .enumerate()
+                .filter(|(lpi, load)| {
+                    self.lps[*lpi].node == node && load.saturating_add(cost) <= cost_limit
+                })
+                .min_by_key(|(_, load)| *load)
+                .map(|(lpi, _)| lpi);
+
+            // keep the worker where it is if it fits, or if no other processor is less loaded;
+            // otherwise only move it to another NUMA node if it doesn't fit on its own node
+            let lpi = if loads[current_lpi].saturating_add(cost) <= cost_limit
+                || loads[current_lpi] <= min_load
+            {
+                current_lpi
+            } else {
+                node_lpi.unwrap_or(min_lpi)
+            };
+
+            loads[lpi] = loads[lpi].saturating_add(cost);
+            self.lps[lpi].ready_workers.push(worker).unwrap();
+
+            if lpi != current_lpi {
+                moved.push((worker, lpi));
+            }
+        }
+
+        moved
+    }
+
     /// Returns the cpu id that should be used with [`libc::sched_setaffinity`] to run a thread on
     /// `lpi`. Returns `None` if no cpu id was assigned to `lpi`.
     pub fn cpu_id(&self, lpi: usize) -> Option<u32> {
@@ -74,6 +161,116 @@ impl LogicalProcessors {
 
 pub struct LogicalProcessor {
     cpu_id: Option<u32>,
+    /// The NUMA node of `cpu_id`, if known.
+    node: Option<u32>,
     ready_workers: ArrayQueue<usize>,
     done_workers: ArrayQueue<usize>,
 }
+
+/// The NUMA node of a cpu, as listed in sysfs. Returns `None` if it couldn't be found, for example
+/// if the kernel was built without NUMA support.
+fn numa_node(cpu_id: u32) -> Option<u32> {
+    let entries = std::fs::read_dir(format!("/sys/devices/system/cpu/cpu{cpu_id}")).ok()?;
+    entries.filter_map(Result::ok).find_map(|entry| {
+        entry
+            .file_name()
+            .to_str()?
+            .strip_prefix("node")?
+            .parse()
+            .ok()
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Run all workers once without stealing, and return the workers of each processor in the
+    /// order they ran.
+    fn run_all(lps: &mut LogicalProcessors) -> Vec<Vec<usize>> {
+        let mut ran = vec![vec![]; lps.iter().len()];
+        for (lpi, lp) in lps.lps.iter().enumerate() {
+            while let Some(worker) = lp.ready_workers.pop() {
+                lp.done_workers.push(worker).unwrap();
+                ran[lpi].push(worker);
+            }
+        }
+        lps.reset();
+        ran
+    }
+
+    #[test]
+    fn test_repartition() {
+        let mut lps = LogicalProcessors::new(&[None, None], 6);
+        for worker in 0..6 {
+            lps.add_worker(worker % 2, worker);
+        }
+
+        // worker 0 is as expensive as all of the others combined
+        let costs = [50, 10, 10, 10, 10, 10];
+        let moved = lps.repartition(&costs);
+
+        // worker 0 keeps processor 0, and the other workers on processor 0 move to processor 1
+        assert_eq!(moved, [(2, 1), (4, 1)]);
+        assert_eq!(run_all(&mut lps), [vec![0], vec![2, 4, 1, 3, 5]]);
+
+        // already balanced, so nothing moves
+        assert_eq!(lps.repartition(&costs), []);
+        assert_eq!(run_all(&mut lps), [vec![0], vec![2, 4, 1, 3, 5]]);
+    }
+
+    #[test]
+    fn test_steal_same_node_first() {
+        let lps = LogicalProcessors::with_nodes(
+            &[None, None, None, None],
+            &[Some(0), Some(1), Some(0), Some(1)],
+            4,
+        );
+        assert_eq!(lps.steal_order[0], [0, 2, 1, 3]);
+        assert_eq!(lps.steal_order[1], [1, 3, 2, 0]);
+        assert_eq!(lps.steal_order[3], [3, 1, 0, 2]);
+
+        lps.add_worker(1, 0);
+        lps.add_worker(2, 1);
+
+        // processor 0 takes the worker of processor 2 first since they're on the same node
+        assert_eq!(lps.next_worker(0), Some((1, 2)));
+        assert_eq!(lps.next_worker(0), Some((0, 1)));
+        assert_eq!(lps.next_worker(0), None);
+    }
+
+    #[test]
+    fn test_repartition_same_node() {
+        let mut lps = LogicalProcessors::with_nodes(
+            &[None, None, None, None],
+            &[Some(0), Some(0), Some(1), Some(1)],
+            4,
+        );
+        for worker in 0..4 {
+            lps.add_worker(0, worker);
+        }
+
+        let costs = [10, 10, 10, 10];
+        let moved = lps.repartition(&costs);
+
+        // worker 1 moves to the other processor on node 0 before any workers leave the node
+        assert_eq!(moved[0], (1, 1));
+        assert_eq!(moved.len(), 3);
+        assert_eq!(
+            run_all(&mut lps).iter().map(Vec::len).collect::<Vec<_>>(),
+            [1, 1, 1, 1]
+        );
+    }
+
+    #[test]
+    fn test_repartition_unknown_costs() {
+        let mut lps = LogicalProcessors::new(&[None, None, None], 5);
+        for worker in 0..5 {
+            lps.add_worker(worker % 3, worker);
+        }
+
+        // no costs have been measured, so nothing moves
+        assert_eq!(lps.repartition(&[0; 5]), []);
+        assert_eq!(run_all(&mut lps), [vec![0, 3], vec![1, 4], vec![2]]);
+    }
+}
@@ -4,8 +4,9 @@
 
 use std::marker::PhantomData;
 use std::ops::Deref;
-use std::sync::atomic::{AtomicBool, AtomicUsize, Ordering};
+use std::sync::atomic::{AtomicBool, AtomicU64, AtomicUsize, Ordering};
 use std::sync::Arc;
+use std::time::Instant;
 
 use atomic_refcell::AtomicRefCell;
 
@@ -21,6 +22,9 @@ use crate::sync::thread_parking::{ThreadUnparker, ThreadUnparkerUnassigned};
 // lifetimes than we specify in the API, so the tests check to make sure the closures are invariant
 // over the lifetime and that the usage is sound.
 
+/// How many tasks to run between repartitions of the threads across logical processors.
+const REPARTITION_INTERVAL: u32 = 16;
+
 /// Context information provided to each task closure.
 pub struct TaskData {
     pub thread_idx: usize,
@@ -35,7 +39,8 @@ impl<T> TaskFn for T where T: Fn(&TaskData) + Send + Sync {}
 /// A thread pool that runs a task on many threads. A task will run once on each thread. Each
 /// logical processor will run threads sequentially, meaning that the thread pool's parallelism
 /// depends on the number of processors, not the number of threads. Threads are assigned to logical
-/// processors, which can be bound to operating system processors.
+/// processors, which can be bound to operating system processors. Threads are regularly reassigned
+/// so that each processor spends about the same time running its threads.
 pub struct ParallelismBoundedThreadPool {
     /// Handles for joining threads when they've exited.
     thread_handles: Vec<std::thread::JoinHandle<()>>,
@@ -43,6 +48,8 @@ pub struct ParallelismBoundedThreadPool {
     shared_state: Arc<SharedState>,
     /// The main thread uses this to wait for the threads to finish running the task.
     task_end_waiter: LatchWaiter,
+    /// The number of tasks that have run since the threads were last repartitioned.
+    tasks_since_repartition: u32,
 }
 
 pub struct SharedState {
@@ -65,6 +72,9 @@ pub struct ThreadScheduling {
     tid: nix::unistd::Pid,
     /// The logical processor index that this thread is assigned to.
     logical_processor_idx: AtomicUsize,
+    /// A moving average of how long this thread took to run a task, in nanoseconds. Only written
+    /// by this thread.
+    cost_ns: AtomicU64,
 }
 
 impl ParallelismBoundedThreadPool {
@@ -110,6 +120,7 @@ impl ParallelismBoundedThreadPool {
                 unparker: ThreadUnparkerUnassigned::new().assign(handle.thread().clone()),
                 tid: *tid,
                 logical_processor_idx: AtomicUsize::new(processor_idx),
+                cost_ns: AtomicU64::new(0),
             })
             .collect();
 
@@ -136,6 +147,24 @@ impl ParallelismBoundedThreadPool {
             thread_handles,
             shared_state,
             task_end_waiter,
+            tasks_since_repartition: 0,
+        }
+    }
+
+    /// Set an initial estimate of how long each thread takes to run a task, in nanoseconds, and
+    /// reassign the threads to logical processors to balance these costs. Must not be called while
+    /// a task is running.
+    pub fn set_thread_costs(&mut self, costs: &[u64]) {
+        assert_eq!(costs.len(), self.num_threads());
+
+        let threads = &self.shared_state.threads;
+        for (thread, cost) in threads.iter().zip(costs) {
+            thread.cost_ns.store(*cost, Ordering::Relaxed);
+        }
+
+        let mut logical_processors = self.shared_state.logical_processors.borrow_mut();
+        for (thread_idx, processor_idx) in logical_processors.repartition(costs) {
+            assign_to_processor(&threads[thread_idx], processor_idx, &logical_processors);
         }
     }
 
@@ -245,11 +274,33 @@ impl<'a> std::ops::Drop for WorkerScope<'a> {
             *self.pool.shared_state.task.borrow_mut() = None;
 
             // we should have run every thread, so swap the logical processors' internal queues
-            self.pool
-                .shared_state
-                .logical_processors
-                .borrow_mut()
-                .reset();
+            let mut logical_processors = self.pool.shared_state.logical_processors.borrow_mut();
+            logical_processors.reset();
+
+            // regularly rebalance the threads across the logical processors based on how long
+            // they've been taking, which shortens the time until the last processor finishes
+            self.pool.tasks_since_repartition += 1;
+            if self.pool.tasks_since_repartition >= REPARTITION_INTERVAL
+                && !self
+                    .pool
+                    .shared_state
+                    .has_thread_panicked
+                    .load(Ordering::Relaxed)
+            {
+                self.pool.tasks_since_repartition = 0;
+
+                let threads = &self.pool.shared_state.threads;
+                let costs: Vec<u64> = threads
+                    .iter()
+                    .map(|thread| thread.cost_ns.load(Ordering::Relaxed))
+                    .collect();
+
+                for (thread_idx, processor_idx) in logical_processors.repartition(&costs) {
+                    assign_to_processor(&threads[thread_idx], processor_idx, &logical_processors);
+                }
+            }
+
+            drop(logical_processors);
 
             // generally following https://docs.rs/rayon/latest/rayon/fn.scope.html#panics
             if self
@@ -402,6 +453,7 @@ fn work_loop(
             };
 
             // run the task
+            let start = Instant::now();
             match shared_state.task.borrow().deref() {
                 Some(task) => (task)(&task_data),
                 None => {
@@ -409,6 +461,13 @@ fn work_loop(
                     break;
                 }
             };
+            let elapsed_ns = u64::try_from(start.elapsed().as_nanos()).unwrap_or(u64::MAX);
+
+            // cost = 3/4 cost + 1/4 elapsed
+            let cost_ns = thread_data.cost_ns.load(Ordering::Relaxed);
+            thread_data
+                .cost_ns
+                .store(cost_ns - cost_ns / 4 + elapsed_ns / 4, Ordering::Relaxed);
         }
 
         // SAFETY: we do not hold any references/borrows to the task at this time
@@ -536,6 +595,28 @@ mod tests {
         assert_eq!(counter.load(Ordering::SeqCst), 12);
     }
 
+    #[test]
+    fn test_repartition() {
+        let mut pool = ParallelismBoundedThreadPool::new(&[None, None], 6, "worker");
+
+        let counter = AtomicU32::new(0);
+        let rounds = 3 * REPARTITION_INTERVAL;
+        for _ in 0..rounds {
+            pool.scope(|s| {
+                s.run(|t| {
+                    // make one thread much more expensive than the others so that the threads
+                    // are moved between processors
+                    if t.thread_idx == 0 {
+                        std::thread::sleep(std::time::Duration::from_micros(200));
+                    }
+                    counter.fetch_add(1, Ordering::SeqCst);
+                });
+            });
+        }
+
+        assert_eq!(counter.load(Ordering::SeqCst), 6 * rounds);
+    }
+
     #[test]
     fn test_large_num_threads() {
         let mut pool = ParallelismBoundedThreadPool::new(&[None, None], 100, "worker");
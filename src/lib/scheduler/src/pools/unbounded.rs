@@ -11,6 +11,7 @@ use atomic_refcell::AtomicRefCell;
 
 use crate::sync::count_down_latch::{self, build_count_down_latch};
 use crate::sync::simple_latch;
+use crate::sync::tree_latch::{self, build_tree_latch};
 
 // If making substantial changes to this scheduler, you should verify the compilation error message
 // for each test at the end of this file to make sure that they correctly cause the expected
@@ -34,7 +35,53 @@ pub struct UnboundedThreadPool {
     /// running the task.
     task_start_latch: simple_latch::Latch,
     /// The main thread uses this to wait for the threads to finish running the task.
-    task_end_waiter: count_down_latch::LatchWaiter,
+    task_end_waiter: TaskEndWaiter,
+}
+
+/// Used by a thread to signal that it has finished running the task.
+enum TaskEndCounter {
+    Latch(count_down_latch::LatchCounter),
+    Tree(tree_latch::TreeLatchCounter),
+}
+
+/// Used by the main thread to wait for all threads to finish running the task.
+enum TaskEndWaiter {
+    Latch(count_down_latch::LatchWaiter),
+    Tree(tree_latch::TreeLatchWaiter),
+}
+
+impl TaskEndCounter {
+    fn count_down(&mut self) {
+        match self {
+            Self::Latch(x) => x.count_down(),
+            Self::Tree(x) => x.count_down(),
+        }
+    }
+}
+
+impl TaskEndWaiter {
+    fn wait(&mut self) {
+        match self {
+            Self::Latch(x) => x.wait(),
+            Self::Tree(x) => x.wait(),
+        }
+    }
+}
+
+/// Build the counters (one per thread) and waiter that are used to wait for the threads to finish
+/// a task.
+fn build_task_end_latch(num_threads: usize, tree: bool) -> (Vec<TaskEndCounter>, TaskEndWaiter) {
+    if tree && num_threads > 0 {
+        let (counters, waiter) = build_tree_latch(num_threads);
+        let counters = counters.into_iter().map(TaskEndCounter::Tree).collect();
+        (counters, TaskEndWaiter::Tree(waiter))
+    } else {
+        let (counter, waiter) = build_count_down_latch();
+        let counters = (0..num_threads)
+            .map(|_| TaskEndCounter::Latch(counter.clone()))
+            .collect();
+        (counters, TaskEndWaiter::Latch(waiter))
+    }
 }
 
 pub struct SharedState {
@@ -45,35 +92,37 @@ pub struct SharedState {
 }
 
 impl UnboundedThreadPool {
-    pub fn new(num_threads: usize, thread_name: &str, yield_spin: bool) -> Self {
+    /// A new pool with `num_threads` threads. If `yield_spin` is `true`, the threads spin in a
+    /// `sched_yield` loop while waiting for a task. If `tree_barrier` is `true`, the threads
+    /// signal that they've finished a task through a combining tree rather than a single shared
+    /// counter, which reduces contention when there are many threads.
+    pub fn new(
+        num_threads: usize,
+        thread_name: &str,
+        yield_spin: bool,
+        tree_barrier: bool,
+    ) -> Self {
         let shared_state = Arc::new(SharedState {
             task: AtomicRefCell::new(None),
             has_thread_panicked: AtomicBool::new(false),
         });
 
-        let (task_end_counter, task_end_waiter) = build_count_down_latch();
+        let (task_end_counters, task_end_waiter) = build_task_end_latch(num_threads, tree_barrier);
         let mut task_start_latch = simple_latch::Latch::new();
 
         let mut thread_handles = Vec::new();
 
-        for i in 0..num_threads {
+        for (i, task_end_counter) in task_end_counters.into_iter().enumerate() {
             let shared_state_clone = Arc::clone(&shared_state);
 
             // enabling spinning on the threads may improve performance under some conditions
             // (see https://github.com/shadow/shadow/issues/2877)
             let task_start_waiter = task_start_latch.waiter(yield_spin);
 
-            let task_end_counter_clone = task_end_counter.clone();
-
             let handle = std::thread::Builder::new()
                 .name(thread_name.to_string())
                 .spawn(move || {
-                    work_loop(
-                        i,
-                        shared_state_clone,
-                        task_start_waiter,
-                        task_end_counter_clone,
-                    )
+                    work_loop(i, shared_state_clone, task_start_waiter, task_end_counter)
                 })
                 .unwrap();
 
@@ -224,7 +273,7 @@ fn work_loop(
     thread_index: usize,
     shared_state: Arc<SharedState>,
     mut start_waiter: simple_latch::LatchWaiter,
-    mut end_counter: count_down_latch::LatchCounter,
+    mut end_counter: TaskEndCounter,
 ) {
     // we don't use `catch_unwind` here for two main reasons:
     //
@@ -290,7 +339,7 @@ mod tests {
 
     #[test]
     fn test_scope() {
-        let mut pool = UnboundedThreadPool::new(4, "worker", false);
+        let mut pool = UnboundedThreadPool::new(4, "worker", false, false);
 
         let mut counter = 0u32;
         for _ in 0..3 {
@@ -304,7 +353,7 @@ mod tests {
 
     #[test]
     fn test_run() {
-        let mut pool = UnboundedThreadPool::new(4, "worker", false);
+        let mut pool = UnboundedThreadPool::new(4, "worker", false, false);
 
         let counter = AtomicU32::new(0);
         for _ in 0..3 {
@@ -320,7 +369,23 @@ mod tests {
 
     #[test]
     fn test_large_num_threads() {
-        let mut pool = UnboundedThreadPool::new(100, "worker", false);
+        let mut pool = UnboundedThreadPool::new(100, "worker", false, false);
+
+        let counter = AtomicU32::new(0);
+        for _ in 0..3 {
+            pool.scope(|s| {
+                s.run(|_| {
+                    counter.fetch_add(1, Ordering::SeqCst);
+                });
+            });
+        }
+
+        assert_eq!(counter.load(Ordering::SeqCst), 300);
+    }
+
+    #[test]
+    fn test_tree_barrier() {
+        let mut pool = UnboundedThreadPool::new(100, "worker", false, true);
 
         let counter = AtomicU32::new(0);
         for _ in 0..3 {
@@ -336,7 +401,7 @@ mod tests {
 
     #[test]
     fn test_scope_runner_order() {
-        let mut pool = UnboundedThreadPool::new(1, "worker", false);
+        let mut pool = UnboundedThreadPool::new(1, "worker", false, false);
 
         let flag = AtomicBool::new(false);
         pool.scope(|s| {
@@ -353,7 +418,7 @@ mod tests {
 
     #[test]
     fn test_non_aliasing_borrows() {
-        let mut pool = UnboundedThreadPool::new(4, "worker", false);
+        let mut pool = UnboundedThreadPool::new(4, "worker", false, false);
 
         let mut counter = 0;
         pool.scope(|s| {
@@ -370,7 +435,7 @@ mod tests {
     /// ```compile_fail
     /// # use shadow_rs::core::scheduler::pools::unbounded::*;
     /// let x = 5;
-    /// let mut pool = UnboundedThreadPool::new(4, "worker", false);
+    /// let mut pool = UnboundedThreadPool::new(4, "worker", false, false);
     ///
     /// let mut counter = 0;
     /// pool.scope(|s| {
@@ -387,7 +452,7 @@ mod tests {
     #[test]
     #[should_panic]
     fn test_panic_all() {
-        let mut pool = UnboundedThreadPool::new(4, "worker", false);
+        let mut pool = UnboundedThreadPool::new(4, "worker", false, false);
 
         pool.scope(|s| {
             s.run(|i| {
@@ -400,7 +465,7 @@ mod tests {
     #[test]
     #[should_panic]
     fn test_panic_single() {
-        let mut pool = UnboundedThreadPool::new(4, "worker", false);
+        let mut pool = UnboundedThreadPool::new(4, "worker", false, false);
 
         pool.scope(|s| {
             s.run(|i| {
@@ -415,7 +480,7 @@ mod tests {
     // should not compile: "`x` does not live long enough"
     /// ```compile_fail
     /// # use shadow_rs::core::scheduler::pools::unbounded::*;
-    /// let mut pool = UnboundedThreadPool::new(4, "worker", false);
+    /// let mut pool = UnboundedThreadPool::new(4, "worker", false, false);
     ///
     /// let x = 5;
     /// pool.scope(|s| {
@@ -430,7 +495,7 @@ mod tests {
     // owned by the current function"
     /// ```compile_fail
     /// # use shadow_rs::core::scheduler::pools::unbounded::*;
-    /// let mut pool = UnboundedThreadPool::new(4, "worker", false);
+    /// let mut pool = UnboundedThreadPool::new(4, "worker", false, false);
     ///
     /// pool.scope(|s| {
     ///     // 'x' will be dropped when the closure is dropped, but 's' lives longer than that
@@ -445,7 +510,7 @@ mod tests {
     #[test]
     fn test_queues() {
         let num_threads = 4;
-        let mut pool = UnboundedThreadPool::new(num_threads, "worker", false);
+        let mut pool = UnboundedThreadPool::new(num_threads, "worker", false, false);
 
         // a non-copy usize wrapper
         struct Wrapper(usize);
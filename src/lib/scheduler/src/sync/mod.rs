@@ -1,3 +1,4 @@
 pub mod count_down_latch;
 pub mod simple_latch;
 pub mod thread_parking;
+pub mod tree_latch;
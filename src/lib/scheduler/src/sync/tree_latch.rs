@@ -0,0 +1,298 @@
+use std::sync::atomic::{AtomicU32, Ordering};
+use std::sync::Arc;
+
+use crossbeam::utils::CachePadded;
+use nix::errno::Errno;
+
+use crate::sync::simple_latch::libc_futex;
+
+/// The number of counters (or child nodes) that share a node of the tree.
+const FANOUT: usize = 8;
+
+/// A latch counter for a [tree latch](build_tree_latch).
+#[derive(Debug)]
+pub struct TreeLatchCounter {
+    inner: Arc<TreeLatchInner>,
+    /// The leaf node that this counter counts down.
+    leaf: usize,
+    /// An ID for this counter's count-down round.
+    generation: u32,
+}
+
+/// A latch waiter for a [tree latch](build_tree_latch).
+#[derive(Debug)]
+pub struct TreeLatchWaiter {
+    inner: Arc<TreeLatchInner>,
+    /// An ID for this waiter's count-down round.
+    generation: u32,
+}
+
+#[derive(Debug)]
+struct TreeLatchInner {
+    /// The nodes of the tree. The leaves come first and the root is last.
+    nodes: Vec<CachePadded<Node>>,
+    /// The current latch "round". Incremented by the counter that completes the round.
+    generation: CachePadded<AtomicU32>,
+}
+
+#[derive(Debug)]
+struct Node {
+    /// Number of counters or child nodes that haven't finished counting down in this round.
+    remaining: AtomicU32,
+    /// Total number of counters or child nodes.
+    total: u32,
+    /// The node's parent, or `None` for the root.
+    parent: Option<usize>,
+}
+
+/// Build a count-down latch with a fixed number of counters and a single waiter, like
+/// [`build_count_down_latch`](crate::sync::count_down_latch::build_count_down_latch), but where
+/// the counters are arranged in a combining tree. Each counter only decrements a node that it
+/// shares with a few other counters, and only the last counter to reach a node continues to its
+/// parent, so with many threads the counters don't all contend on a single cache line (or lock).
+/// The last counter to reach the root wakes the waiter.
+///
+/// Each counter must count down exactly once per round, and must not count down for the next
+/// round until the waiter has returned from its [`wait()`](TreeLatchWaiter::wait) for this round.
+/// The latch panics if a counter counts down twice in a round. A counter that's dropped counts
+/// down for the current round if it hasn't yet (for example if its thread panicked), but it isn't
+/// removed from later rounds.
+pub fn build_tree_latch(num_counters: usize) -> (Vec<TreeLatchCounter>, TreeLatchWaiter) {
+    assert!(num_counters > 0);
+
+    let mut nodes = Vec::new();
+
+    // the number of counters or nodes in the level below that need a parent
+    let mut num_children = num_counters;
+    // the index of the first node in the level below, if the level below is a level of nodes
+    let mut children_start: Option<usize> = None;
+
+    loop {
+        let level_start = nodes.len();
+        let level_len = num_children.div_ceil(FANOUT);
+
+        for i in 0..level_len {
+            let total = std::cmp::min(FANOUT, num_children - i * FANOUT);
+            nodes.push(Node {
+                remaining: AtomicU32::new(total.try_into().unwrap()),
+                total: total.try_into().unwrap(),
+                parent: None,
+            });
+        }
+
+        // set the parent of each node in the level below
+        if let Some(children_start) = children_start {
+            for i in 0..num_children {
+                nodes[children_start + i].parent = Some(level_start + i / FANOUT);
+            }
+        }
+
+        if level_len == 1 {
+            break;
+        }
+
+        num_children = level_len;
+        children_start = Some(level_start);
+    }
+
+    let inner = Arc::new(TreeLatchInner {
+        nodes: nodes.into_iter().map(CachePadded::new).collect(),
+        generation: CachePadded::new(AtomicU32::new(0)),
+    });
+
+    let counters = (0..num_counters)
+        .map(|i| TreeLatchCounter {
+            inner: Arc::clone(&inner),
+            leaf: i / FANOUT,
+            generation: 0,
+        })
+        .collect();
+
+    let waiter = TreeLatchWaiter {
+        inner,
+        generation: 0,
+    };
+
+    (counters, waiter)
+}
+
+impl TreeLatchCounter {
+    /// Decrement the latch count and wake the waiter if this is the last counter of the round.
+    /// This must not be called more than once per round (must not be called again until the
+    /// waiter has returned from its [`TreeLatchWaiter::wait()`] call), otherwise it will panic.
+    pub fn count_down(&mut self) {
+        let latch_gen = self.inner.generation.load(Ordering::Relaxed);
+        if self.generation != latch_gen {
+            panic!(
+                "Counter generation does not match latch generation ({} != {latch_gen})",
+                self.generation
+            );
+        }
+
+        let mut node_idx = self.leaf;
+        loop {
+            let node = &self.inner.nodes[node_idx];
+
+            // the acquire-release chain through the nodes makes the writes of every counter of the
+            // round visible to the counter that completes the root, and then to the waiter
+            if node.remaining.fetch_sub(1, Ordering::AcqRel) != 1 {
+                break;
+            }
+
+            // we were the last to reach this node, so reset it for the next round; nobody can
+            // reach it again until the waiter has returned
+            node.remaining.store(node.total, Ordering::Relaxed);
+
+            match node.parent {
+                Some(parent) => node_idx = parent,
+                None => {
+                    self.inner.generation.fetch_add(1, Ordering::Release);
+                    libc_futex(
+                        &self.inner.generation,
+                        libc::FUTEX_WAKE | libc::FUTEX_PRIVATE_FLAG,
+                        1,
+                        None,
+                        None,
+                        0,
+                    )
+                    .expect("FUTEX_WAKE failed");
+                    break;
+                }
+            }
+        }
+
+        self.generation = self.generation.wrapping_add(1);
+    }
+}
+
+impl TreeLatchWaiter {
+    /// Wait for all counters to count down for the current round. If they already have, this
+    /// will return immediately.
+    pub fn wait(&mut self) {
+        loop {
+            let latch_gen = self.inner.generation.load(Ordering::Acquire);
+
+            match latch_gen.wrapping_sub(self.generation) {
+                // the round has finished
+                1 => break,
+                // the round hasn't finished
+                0 => {}
+                _ => panic!("Latch has finished multiple rounds without us waiting"),
+            }
+
+            let rv = libc_futex(
+                &self.inner.generation,
+                libc::FUTEX_WAIT | libc::FUTEX_PRIVATE_FLAG,
+                latch_gen,
+                None,
+                None,
+                0,
+            );
+            assert!(
+                matches!(rv, Ok(_) | Err(Errno::EAGAIN | Errno::EINTR)),
+                "FUTEX_WAIT failed with {rv:?}"
+            );
+        }
+
+        self.generation = self.generation.wrapping_add(1);
+    }
+}
+
+impl std::ops::Drop for TreeLatchCounter {
+    fn drop(&mut self) {
+        // if we haven't already counted down during the current round
+        if self.generation == self.inner.generation.load(Ordering::Relaxed) {
+            self.count_down();
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::sync::atomic::AtomicUsize;
+
+    use super::*;
+
+    #[test]
+    fn test_single_thread() {
+        for num_counters in [1, 2, FANOUT, FANOUT + 1, FANOUT * FANOUT + 3] {
+            let (mut counters, mut waiter) = build_tree_latch(num_counters);
+
+            for _ in 0..3 {
+                for counter in &mut counters {
+                    counter.count_down();
+                }
+                waiter.wait();
+            }
+        }
+    }
+
+    #[test]
+    fn test_tree_shape() {
+        let (counters, _waiter) = build_tree_latch(FANOUT * FANOUT + 3);
+        let nodes = &counters[0].inner.nodes;
+
+        // 9 leaves, 2 nodes in the middle level, and the root
+        assert_eq!(nodes.len(), FANOUT + 1 + 2 + 1);
+        assert_eq!(nodes.last().unwrap().total, 2);
+        assert_eq!(nodes.last().unwrap().parent, None);
+        assert_eq!(nodes[FANOUT].total, 3);
+        assert!(nodes[..nodes.len() - 1].iter().all(|x| x.parent.is_some()));
+    }
+
+    #[test]
+    #[should_panic]
+    fn test_double_count() {
+        let (mut counters, _waiter) = build_tree_latch(2);
+        counters[0].count_down();
+        counters[0].count_down();
+    }
+
+    #[test]
+    fn test_drop() {
+        let (mut counters, mut waiter) = build_tree_latch(3);
+
+        counters[0].count_down();
+        // a dropped counter counts down for the current round
+        counters.truncate(1);
+        waiter.wait();
+    }
+
+    #[test]
+    fn test_multi_thread() {
+        let num_threads = 20;
+        let rounds = 100;
+
+        let (counters, mut waiter) = build_tree_latch(num_threads);
+        let (mut start_counter, start_waiter) =
+            crate::sync::count_down_latch::build_count_down_latch();
+        let count = Arc::new(AtomicUsize::new(0));
+
+        let handles: Vec<_> = counters
+            .into_iter()
+            .map(|mut counter| {
+                let mut start_waiter = start_waiter.clone();
+                let count = Arc::clone(&count);
+                std::thread::spawn(move || {
+                    for _ in 0..rounds {
+                        start_waiter.wait();
+                        count.fetch_add(1, Ordering::Relaxed);
+                        counter.count_down();
+                    }
+                })
+            })
+            .collect();
+        std::mem::drop(start_waiter);
+
+        for round in 1..=rounds {
+            start_counter.count_down();
+            waiter.wait();
+            // every thread has counted down, and its increment must be visible
+            assert_eq!(count.load(Ordering::Relaxed), round * num_threads);
+        }
+
+        for h in handles {
+            h.join().unwrap();
+        }
+    }
+}
@@ -7,6 +7,7 @@ use std::fmt::Debug;
 
 use crossbeam::queue::ArrayQueue;
 
+use crate::cost_balancer::CostBalancer;
 use crate::pools::unbounded::{TaskRunner, UnboundedThreadPool};
 use crate::CORE_AFFINITY;
 
@@ -26,14 +27,32 @@ impl<HostType: Host> ThreadPerCoreSched<HostType> {
     /// A new host scheduler with threads that are pinned to the provided OS processors. Each thread
     /// is assigned many hosts, and threads may steal hosts from other threads. The number of
     /// threads created will be the length of `cpu_ids`.
-    pub fn new<T>(cpu_ids: &[Option<u32>], hosts: T, yield_spin: bool) -> Self
+    pub fn new<T>(cpu_ids: &[Option<u32>], hosts: T, yield_spin: bool, tree_barrier: bool) -> Self
     where
         T: IntoIterator<Item = HostType, IntoIter: ExactSizeIterator>,
+    {
+        let hosts = hosts.into_iter().map(|host| (host, 0));
+        Self::new_with_costs(cpu_ids, hosts, yield_spin, tree_barrier)
+    }
+
+    /// Like [`Self::new`], but each host is given with an estimate of how long it takes to run
+    /// each round in nanoseconds, such as from a previous run of the simulation. The hosts are
+    /// initially balanced across the threads using these costs, and each thread runs its most
+    /// expensive hosts first. A cost of 0 means that the cost isn't known.
+    pub fn new_with_costs<T>(
+        cpu_ids: &[Option<u32>],
+        hosts: T,
+        yield_spin: bool,
+        tree_barrier: bool,
+    ) -> Self
+    where
+        T: IntoIterator<Item = (HostType, u64), IntoIter: ExactSizeIterator>,
     {
         let hosts = hosts.into_iter();
 
         let num_threads = cpu_ids.len();
-        let mut pool = UnboundedThreadPool::new(num_threads, "shadow-worker", yield_spin);
+        let mut pool =
+            UnboundedThreadPool::new(num_threads, "shadow-worker", yield_spin, tree_barrier);
 
         // set the affinity of each thread
         pool.scope(|s| {
@@ -59,9 +78,13 @@ impl<HostType: Host> ThreadPerCoreSched<HostType> {
             .map(|_| ArrayQueue::new(hosts.len()))
             .collect();
 
-        // assign hosts to threads in a round-robin manner
-        for (thread_queue, host) in thread_hosts.iter().cycle().zip(hosts) {
-            thread_queue.push(host).unwrap();
+        // without any known costs, this assigns the hosts in a round-robin manner
+        let (hosts, costs): (Vec<_>, Vec<_>) = hosts.unzip();
+        let mut hosts: Vec<Option<HostType>> = hosts.into_iter().map(Some).collect();
+        for (host_idx, thread) in CostBalancer::balance(num_threads, &costs) {
+            thread_hosts[thread]
+                .push(hosts[host_idx].take().unwrap())
+                .unwrap();
         }
 
         Self {
@@ -223,7 +246,7 @@ mod tests {
     fn test_parallelism() {
         let hosts = [(); 5].map(|_| TestHost {});
         let sched: ThreadPerCoreSched<TestHost> =
-            ThreadPerCoreSched::new(&[None, None], hosts, false);
+            ThreadPerCoreSched::new(&[None, None], hosts, false, false);
 
         assert_eq!(sched.parallelism(), 2);
 
@@ -234,7 +257,7 @@ mod tests {
     fn test_no_join() {
         let hosts = [(); 5].map(|_| TestHost {});
         let _sched: ThreadPerCoreSched<TestHost> =
-            ThreadPerCoreSched::new(&[None, None], hosts, false);
+            ThreadPerCoreSched::new(&[None, None], hosts, false, false);
     }
 
     #[test]
@@ -242,7 +265,7 @@ mod tests {
     fn test_panic() {
         let hosts = [(); 5].map(|_| TestHost {});
         let mut sched: ThreadPerCoreSched<TestHost> =
-            ThreadPerCoreSched::new(&[None, None], hosts, false);
+            ThreadPerCoreSched::new(&[None, None], hosts, false, false);
 
         sched.scope(|s| {
             s.run(|x| {
@@ -257,7 +280,7 @@ mod tests {
     fn test_run() {
         let hosts = [(); 5].map(|_| TestHost {});
         let mut sched: ThreadPerCoreSched<TestHost> =
-            ThreadPerCoreSched::new(&[None, None], hosts, false);
+            ThreadPerCoreSched::new(&[None, None], hosts, false, false);
 
         let counter = AtomicU32::new(0);
 
@@ -278,7 +301,7 @@ mod tests {
     fn test_run_with_hosts() {
         let hosts = [(); 5].map(|_| TestHost {});
         let mut sched: ThreadPerCoreSched<TestHost> =
-            ThreadPerCoreSched::new(&[None, None], hosts, false);
+            ThreadPerCoreSched::new(&[None, None], hosts, false, false);
 
         let counter = AtomicU32::new(0);
 
@@ -302,7 +325,7 @@ mod tests {
     fn test_run_with_data() {
         let hosts = [(); 5].map(|_| TestHost {});
         let mut sched: ThreadPerCoreSched<TestHost> =
-            ThreadPerCoreSched::new(&[None, None], hosts, false);
+            ThreadPerCoreSched::new(&[None, None], hosts, false, false);
 
         let data = vec![0u32; sched.parallelism()];
         let data: Vec<_> = data.into_iter().map(std::sync::Mutex::new).collect();
@@ -1,4 +1,10 @@
 //! A thread-per-host host scheduler.
+//!
+//! Each host is given to a single thread when the scheduler is created, and always runs on that
+//! thread. By default every host gets its own thread, but the number of threads can be limited, in
+//! which case each thread is given several hosts. This keeps the guarantee that a host is only ever
+//! run by one OS thread without creating a thread (and its stack) for every host in large
+//! simulations.
 
 // unsafe code should be isolated to the thread pool
 #![forbid(unsafe_code)]
@@ -8,6 +14,7 @@ use std::fmt::Debug;
 use std::sync::Mutex;
 use std::thread::LocalKey;
 
+use crate::cost_balancer::CostBalancer;
 use crate::pools::bounded::{ParallelismBoundedThreadPool, TaskRunner};
 use crate::CORE_AFFINITY;
 
@@ -18,44 +25,87 @@ impl<T> Host for T where T: Debug + Send + 'static {}
 pub struct ThreadPerHostSched<HostType: Host> {
     /// The thread pool.
     pool: ParallelismBoundedThreadPool,
-    /// Thread-local storage where a thread can store its host.
-    host_storage: &'static LocalKey<RefCell<Option<HostType>>>,
+    /// Thread-local storage where a thread can store its hosts.
+    host_storage: &'static LocalKey<RefCell<Vec<HostType>>>,
 }
 
 impl<HostType: Host> ThreadPerHostSched<HostType> {
     /// A new host scheduler with logical processors that are pinned to the provided OS processors.
-    /// Each logical processor is assigned many threads, and each thread is given a single host. The
-    /// number of threads created will be the length of `hosts`.
+    /// Each logical processor is assigned many threads, and each thread is given the hosts that it
+    /// will run. If `max_threads` is `None`, each thread is given a single host and the number of
+    /// threads created will be the length of `hosts`. Otherwise at most `max_threads` threads are
+    /// created, and the hosts are assigned to them in turn.
     ///
     /// An empty `host_storage` for thread-local storage is required for each thread to have
-    /// efficient access to its host. A panic may occur if `host_storage` is not `None`, or if it is
+    /// efficient access to its hosts. A panic may occur if `host_storage` is not empty, or if it is
     /// borrowed while the scheduler is in use.
     pub fn new<T>(
         cpu_ids: &[Option<u32>],
-        host_storage: &'static LocalKey<RefCell<Option<HostType>>>,
+        host_storage: &'static LocalKey<RefCell<Vec<HostType>>>,
         hosts: T,
+        max_threads: Option<usize>,
     ) -> Self
     where
         T: IntoIterator<Item = HostType, IntoIter: ExactSizeIterator>,
     {
-        let hosts = hosts.into_iter();
+        let hosts = hosts.into_iter().map(|host| (host, 0));
+        Self::new_with_costs(cpu_ids, host_storage, hosts, max_threads)
+    }
 
-        let mut pool = ParallelismBoundedThreadPool::new(cpu_ids, hosts.len(), "shadow-worker");
+    /// Like [`Self::new`], but each host is given with an estimate of how long it takes to run
+    /// each round in nanoseconds, such as from a previous run of the simulation. If the number of
+    /// threads is limited, the hosts are balanced across the threads using these costs, and the
+    /// threads are initially placed on logical processors to balance their total costs. A cost of
+    /// 0 means that the cost isn't known.
+    pub fn new_with_costs<T>(
+        cpu_ids: &[Option<u32>],
+        host_storage: &'static LocalKey<RefCell<Vec<HostType>>>,
+        hosts: T,
+        max_threads: Option<usize>,
+    ) -> Self
+    where
+        T: IntoIterator<Item = (HostType, u64), IntoIter: ExactSizeIterator>,
+    {
+        let hosts = hosts.into_iter();
 
-        // for determinism, threads will take hosts from a vec rather than a queue
-        let hosts: Vec<Mutex<Option<HostType>>> = hosts.map(|x| Mutex::new(Some(x))).collect();
+        let num_threads = match max_threads {
+            Some(max_threads) => {
+                assert!(max_threads > 0);
+                std::cmp::min(max_threads, hosts.len())
+            }
+            None => hosts.len(),
+        };
+
+        let mut pool = ParallelismBoundedThreadPool::new(cpu_ids, num_threads, "shadow-worker");
+
+        // for determinism, hosts are assigned to threads in order rather than taken from a queue;
+        // without any known costs, this assigns the hosts in a round-robin manner
+        let (hosts, costs): (Vec<_>, Vec<_>) = hosts.unzip();
+        let mut hosts: Vec<Option<HostType>> = hosts.into_iter().map(Some).collect();
+        let mut thread_hosts: Vec<Vec<HostType>> = (0..num_threads).map(|_| Vec::new()).collect();
+        let mut thread_costs = vec![0u64; num_threads];
+        for (host_idx, thread) in CostBalancer::balance(num_threads, &costs) {
+            thread_hosts[thread].push(hosts[host_idx].take().unwrap());
+            thread_costs[thread] = thread_costs[thread].saturating_add(costs[host_idx]);
+        }
+        let thread_hosts: Vec<Mutex<Vec<HostType>>> =
+            thread_hosts.into_iter().map(Mutex::new).collect();
 
-        // have each thread take a host and store it as a thread-local
+        // have each thread take its hosts and store them as a thread-local
         pool.scope(|s| {
             s.run(|t| {
                 host_storage.with(|x| {
-                    assert!(x.borrow().is_none());
-                    let host = hosts[t.thread_idx].lock().unwrap().take().unwrap();
-                    *x.borrow_mut() = Some(host);
+                    assert!(x.borrow().is_empty());
+                    let hosts = std::mem::take(&mut *thread_hosts[t.thread_idx].lock().unwrap());
+                    *x.borrow_mut() = hosts;
                 });
             });
         });
 
+        if thread_costs.iter().any(|cost| *cost > 0) {
+            pool.set_thread_costs(&thread_costs);
+        }
+
         Self { pool, host_storage }
     }
 
@@ -82,16 +132,16 @@ impl<HostType: Host> ThreadPerHostSched<HostType> {
 
     /// See [`crate::Scheduler::join`].
     pub fn join(mut self) {
-        let hosts: Vec<Mutex<Option<HostType>>> = (0..self.pool.num_threads())
-            .map(|_| Mutex::new(None))
+        let hosts: Vec<Mutex<Vec<HostType>>> = (0..self.pool.num_threads())
+            .map(|_| Mutex::new(Vec::new()))
             .collect();
 
         // collect all of the hosts from the threads
         self.pool.scope(|s| {
             s.run(|t| {
                 self.host_storage.with(|x| {
-                    let host = x.borrow_mut().take().unwrap();
-                    *hosts[t.thread_idx].lock().unwrap() = Some(host);
+                    let thread_hosts = std::mem::take(&mut *x.borrow_mut());
+                    *hosts[t.thread_idx].lock().unwrap() = thread_hosts;
                 });
             });
         });
@@ -104,8 +154,8 @@ impl<HostType: Host> ThreadPerHostSched<HostType> {
 pub struct SchedulerScope<'pool, 'scope, HostType: Host> {
     /// The work pool's scoped runner.
     runner: TaskRunner<'pool, 'scope>,
-    /// Thread-local storage where a thread can retrieve its host.
-    host_storage: &'static LocalKey<RefCell<Option<HostType>>>,
+    /// Thread-local storage where a thread can retrieve its hosts.
+    host_storage: &'static LocalKey<RefCell<Vec<HostType>>>,
 }
 
 impl<'pool, 'scope, HostType: Host> SchedulerScope<'pool, 'scope, HostType> {
@@ -129,14 +179,16 @@ impl<'pool, 'scope, HostType: Host> SchedulerScope<'pool, 'scope, HostType> {
                 CORE_AFFINITY.with(|x| x.set(Some(cpu_id)));
             }
 
-            self.host_storage.with(|host| {
-                let mut host = host.borrow_mut();
+            self.host_storage.with(|hosts| {
+                let mut hosts = hosts.borrow_mut();
 
-                let mut host_iter = HostIter { host: host.take() };
+                let mut host_iter = HostIter {
+                    hosts: std::mem::take(&mut *hosts),
+                };
 
                 f(task_context.thread_idx, &mut host_iter);
 
-                host.replace(host_iter.host.take().unwrap());
+                *hosts = host_iter.hosts;
             });
         });
     }
@@ -157,33 +209,35 @@ impl<'pool, 'scope, HostType: Host> SchedulerScope<'pool, 'scope, HostType> {
 
             let this_elem = &data[task_context.processor_idx];
 
-            self.host_storage.with(|host| {
-                let mut host = host.borrow_mut();
+            self.host_storage.with(|hosts| {
+                let mut hosts = hosts.borrow_mut();
 
-                let mut host_iter = HostIter { host: host.take() };
+                let mut host_iter = HostIter {
+                    hosts: std::mem::take(&mut *hosts),
+                };
 
                 f(task_context.thread_idx, &mut host_iter, this_elem);
 
-                host.replace(host_iter.host.unwrap());
+                *hosts = host_iter.hosts;
             });
         });
     }
 }
 
-/// Supports iterating over all hosts assigned to this thread. For this thread-per-host scheduler,
-/// there will only ever be one host per thread.
+/// Supports iterating over all hosts assigned to this thread. Unless the number of threads was
+/// limited, there will only ever be one host per thread.
 pub struct HostIter<HostType: Host> {
-    host: Option<HostType>,
+    hosts: Vec<HostType>,
 }
 
 impl<HostType: Host> HostIter<HostType> {
     /// See [`crate::HostIter::for_each`].
-    pub fn for_each<F>(&mut self, mut f: F)
+    pub fn for_each<F>(&mut self, f: F)
     where
         F: FnMut(HostType) -> HostType,
     {
-        let host = self.host.take().unwrap();
-        self.host.replace(f(host));
+        // collecting into a vec of the same type reuses the allocation
+        self.hosts = std::mem::take(&mut self.hosts).into_iter().map(f).collect();
     }
 }
 
@@ -198,14 +252,14 @@ mod tests {
     struct TestHost {}
 
     std::thread_local! {
-        static SCHED_HOST_STORAGE: RefCell<Option<TestHost>> = const { RefCell::new(None) };
+        static SCHED_HOST_STORAGE: RefCell<Vec<TestHost>> = const { RefCell::new(Vec::new()) };
     }
 
     #[test]
     fn test_parallelism() {
         let hosts = [(); 5].map(|_| TestHost {});
         let sched: ThreadPerHostSched<TestHost> =
-            ThreadPerHostSched::new(&[None, None], &SCHED_HOST_STORAGE, hosts);
+            ThreadPerHostSched::new(&[None, None], &SCHED_HOST_STORAGE, hosts, None);
 
         assert_eq!(sched.parallelism(), 2);
 
@@ -216,7 +270,7 @@ mod tests {
     fn test_no_join() {
         let hosts = [(); 5].map(|_| TestHost {});
         let _sched: ThreadPerHostSched<TestHost> =
-            ThreadPerHostSched::new(&[None, None], &SCHED_HOST_STORAGE, hosts);
+            ThreadPerHostSched::new(&[None, None], &SCHED_HOST_STORAGE, hosts, None);
     }
 
     #[test]
@@ -224,7 +278,7 @@ mod tests {
     fn test_panic() {
         let hosts = [(); 5].map(|_| TestHost {});
         let mut sched: ThreadPerHostSched<TestHost> =
-            ThreadPerHostSched::new(&[None, None], &SCHED_HOST_STORAGE, hosts);
+            ThreadPerHostSched::new(&[None, None], &SCHED_HOST_STORAGE, hosts, None);
 
         sched.scope(|s| {
             s.run(|x| {
@@ -239,7 +293,7 @@ mod tests {
     fn test_run() {
         let hosts = [(); 5].map(|_| TestHost {});
         let mut sched: ThreadPerHostSched<TestHost> =
-            ThreadPerHostSched::new(&[None, None], &SCHED_HOST_STORAGE, hosts);
+            ThreadPerHostSched::new(&[None, None], &SCHED_HOST_STORAGE, hosts, None);
 
         let counter = AtomicU32::new(0);
 
@@ -260,7 +314,7 @@ mod tests {
     fn test_run_with_hosts() {
         let hosts = [(); 5].map(|_| TestHost {});
         let mut sched: ThreadPerHostSched<TestHost> =
-            ThreadPerHostSched::new(&[None, None], &SCHED_HOST_STORAGE, hosts);
+            ThreadPerHostSched::new(&[None, None], &SCHED_HOST_STORAGE, hosts, None);
 
         let counter = AtomicU32::new(0);
 
@@ -280,11 +334,47 @@ mod tests {
         sched.join();
     }
 
+    #[test]
+    fn test_max_threads() {
+        #[derive(Debug)]
+        struct TestHostWithId(usize);
+
+        std::thread_local! {
+            static SCHED_HOST_STORAGE: RefCell<Vec<TestHostWithId>> = const { RefCell::new(Vec::new()) };
+        }
+
+        let hosts = (0..5).map(TestHostWithId);
+        let mut sched: ThreadPerHostSched<TestHostWithId> =
+            ThreadPerHostSched::new(&[None, None], &SCHED_HOST_STORAGE, hosts, Some(2));
+
+        // the thread that ran each host
+        let host_threads: Vec<Mutex<Vec<usize>>> = (0..5).map(|_| Mutex::new(Vec::new())).collect();
+
+        for _ in 0..3 {
+            sched.scope(|s| {
+                s.run_with_hosts(|thread_idx, hosts| {
+                    hosts.for_each(|host| {
+                        host_threads[host.0].lock().unwrap().push(thread_idx);
+                        host
+                    });
+                });
+            });
+        }
+
+        for (i, threads) in host_threads.into_iter().enumerate() {
+            let threads = threads.into_inner().unwrap();
+            // each host ran in each round, and always on the same thread
+            assert_eq!(threads, [i % 2; 3]);
+        }
+
+        sched.join();
+    }
+
     #[test]
     fn test_run_with_data() {
         let hosts = [(); 5].map(|_| TestHost {});
         let mut sched: ThreadPerHostSched<TestHost> =
-            ThreadPerHostSched::new(&[None, None], &SCHED_HOST_STORAGE, hosts);
+            ThreadPerHostSched::new(&[None, None], &SCHED_HOST_STORAGE, hosts, None);
 
         let data = vec![0u32; sched.parallelism()];
         let data: Vec<_> = data.into_iter().map(std::sync::Mutex::new).collect();
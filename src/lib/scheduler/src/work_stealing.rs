@@ -0,0 +1,460 @@
+//! A work-stealing host scheduler.
+
+// unsafe code should be isolated to the thread pool
+#![forbid(unsafe_code)]
+
+use std::cmp::Reverse;
+use std::collections::VecDeque;
+use std::fmt::Debug;
+use std::sync::Mutex;
+use std::time::Instant;
+
+use crate::cost_balancer::CostBalancer;
+use crate::pools::unbounded::{TaskRunner, UnboundedThreadPool};
+use crate::CORE_AFFINITY;
+
+pub trait Host: Debug + Send {}
+impl<T> Host for T where T: Debug + Send {}
+
+/// How many rounds to run between full rebalances of the hosts across threads. Between rebalances,
+/// hosts stay with the thread that last ran them.
+const REBALANCE_INTERVAL: u32 = 16;
+
+/// A host and a moving average of how long it took to run, in nanoseconds.
+#[derive(Debug)]
+struct HostEntry<HostType> {
+    host: HostType,
+    cost_ns: u64,
+}
+
+impl<HostType> HostEntry<HostType> {
+    fn update_cost(&mut self, last_ns: u64) {
+        // cost = 3/4 cost + 1/4 last
+        self.cost_ns = self.cost_ns - self.cost_ns / 4 + last_ns / 4;
+    }
+}
+
+/// A host scheduler.
+pub struct WorkStealingSched<HostType: Host> {
+    pool: UnboundedThreadPool,
+    num_threads: usize,
+    /// The hosts to run in the current round. Each thread has a deque ordered from its most to its
+    /// least expensive host.
+    thread_hosts: Vec<Mutex<VecDeque<HostEntry<HostType>>>>,
+    /// The hosts that each thread has run in the current round.
+    thread_hosts_processed: Vec<Mutex<Vec<HostEntry<HostType>>>>,
+    hosts_need_swap: bool,
+    rounds_since_rebalance: u32,
+}
+
+impl<HostType: Host> WorkStealingSched<HostType> {
+    /// A new host scheduler with threads that are pinned to the provided OS processors. Each thread
+    /// is assigned many hosts, runs its most expensive hosts first, and steals the cheapest hosts of
+    /// other threads when it runs out of hosts. The hosts are regularly reassigned to threads to
+    /// balance the time that each thread spent running its hosts. The number of threads created
+    /// will be the length of `cpu_ids`.
+    pub fn new<T>(cpu_ids: &[Option<u32>], hosts: T, yield_spin: bool, tree_barrier: bool) -> Self
+    where
+        T: IntoIterator<Item = HostType, IntoIter: ExactSizeIterator>,
+    {
+        let hosts = hosts.into_iter().map(|host| (host, 0));
+        Self::new_with_costs(cpu_ids, hosts, yield_spin, tree_barrier)
+    }
+
+    /// Like [`Self::new`], but each host is given with an estimate of how long it takes to run
+    /// each round in nanoseconds, such as from a previous run of the simulation. The hosts are
+    /// initially balanced across the threads using these costs. A cost of 0 means that the cost
+    /// isn't known.
+    pub fn new_with_costs<T>(
+        cpu_ids: &[Option<u32>],
+        hosts: T,
+        yield_spin: bool,
+        tree_barrier: bool,
+    ) -> Self
+    where
+        T: IntoIterator<Item = (HostType, u64), IntoIter: ExactSizeIterator>,
+    {
+        let hosts = hosts.into_iter();
+
+        let num_threads = cpu_ids.len();
+        let mut pool =
+            UnboundedThreadPool::new(num_threads, "shadow-worker", yield_spin, tree_barrier);
+
+        // set the affinity of each thread
+        pool.scope(|s| {
+            s.run(|i| {
+                let cpu_id = cpu_ids[i];
+
+                if let Some(cpu_id) = cpu_id {
+                    let mut cpus = nix::sched::CpuSet::new();
+                    cpus.set(cpu_id as usize).unwrap();
+                    nix::sched::sched_setaffinity(nix::unistd::Pid::from_raw(0), &cpus).unwrap();
+
+                    // update the thread-local core affinity
+                    CORE_AFFINITY.with(|x| x.set(Some(cpu_id)));
+                }
+            });
+        });
+
+        let capacity = hosts.len();
+        let mut thread_hosts: Vec<_> = (0..num_threads)
+            .map(|_| Mutex::new(VecDeque::with_capacity(capacity)))
+            .collect();
+        let thread_hosts_processed: Vec<_> = (0..num_threads)
+            .map(|_| Mutex::new(Vec::with_capacity(capacity)))
+            .collect();
+
+        // without any known costs, this assigns the hosts in a round-robin manner
+        let entries = hosts
+            .map(|(host, cost_ns)| HostEntry { host, cost_ns })
+            .collect();
+        assign_hosts(&mut thread_hosts, entries);
+
+        Self {
+            pool,
+            num_threads,
+            thread_hosts,
+            thread_hosts_processed,
+            hosts_need_swap: false,
+            rounds_since_rebalance: 0,
+        }
+    }
+
+    /// See [`crate::Scheduler::parallelism`].
+    pub fn parallelism(&self) -> usize {
+        self.num_threads
+    }
+
+    /// Move the hosts that were run in the previous round back to the threads' deques.
+    fn requeue_hosts(&mut self) {
+        debug_assert!(self
+            .thread_hosts
+            .iter_mut()
+            .all(|queue| queue.get_mut().unwrap().is_empty()));
+
+        self.rounds_since_rebalance += 1;
+
+        if self.rounds_since_rebalance < REBALANCE_INTERVAL {
+            // each thread keeps the hosts that it ran, including any that it stole
+            for (queue, processed) in self
+                .thread_hosts
+                .iter_mut()
+                .zip(self.thread_hosts_processed.iter_mut())
+            {
+                queue
+                    .get_mut()
+                    .unwrap()
+                    .extend(processed.get_mut().unwrap().drain(..));
+            }
+            return;
+        }
+
+        self.rounds_since_rebalance = 0;
+
+        let entries = self
+            .thread_hosts_processed
+            .iter_mut()
+            .flat_map(|processed| processed.get_mut().unwrap().drain(..))
+            .collect();
+
+        assign_hosts(&mut self.thread_hosts, entries);
+    }
+
+    /// See [`crate::Scheduler::scope`].
+    pub fn scope<'scope>(
+        &'scope mut self,
+        f: impl for<'a, 'b> FnOnce(SchedulerScope<'a, 'b, 'scope, HostType>) + 'scope,
+    ) {
+        // we can't requeue after the below `pool.scope()` due to lifetime restrictions, so we need
+        // to do it before instead
+        if self.hosts_need_swap {
+            self.requeue_hosts();
+            self.hosts_need_swap = false;
+        }
+
+        // data/references that we'll pass to the scope
+        let thread_hosts = &self.thread_hosts;
+        let thread_hosts_processed = &self.thread_hosts_processed;
+        let hosts_need_swap = &mut self.hosts_need_swap;
+
+        // we cannot access `self` after calling `pool.scope()` since `SchedulerScope` has a
+        // lifetime of `'scope` (which at minimum spans the entire current function)
+
+        self.pool.scope(move |s| {
+            let sched_scope = SchedulerScope {
+                thread_hosts,
+                thread_hosts_processed,
+                hosts_need_swap,
+                runner: s,
+            };
+
+            (f)(sched_scope);
+        });
+    }
+
+    /// See [`crate::Scheduler::join`].
+    pub fn join(self) {
+        self.pool.join();
+    }
+}
+
+/// Balance `entries` across the threads' empty deques by their costs.
+fn assign_hosts<HostType>(
+    thread_hosts: &mut [Mutex<VecDeque<HostEntry<HostType>>>],
+    mut entries: Vec<HostEntry<HostType>>,
+) {
+    // assign the most expensive hosts first, so that the cheap hosts can fill in the gaps
+    entries.sort_by_key(|entry| Reverse(entry.cost_ns));
+
+    let mut balancer = CostBalancer::new(thread_hosts.len());
+    for entry in entries {
+        let thread = balancer.assign(entry.cost_ns);
+        // pushing to the back keeps each deque ordered from most to least expensive
+        thread_hosts[thread].get_mut().unwrap().push_back(entry);
+    }
+}
+
+/// A wrapper around the work pool's scoped runner.
+pub struct SchedulerScope<'sched, 'pool, 'scope, HostType: Host>
+where
+    'sched: 'scope,
+{
+    thread_hosts: &'sched Vec<Mutex<VecDeque<HostEntry<HostType>>>>,
+    thread_hosts_processed: &'sched Vec<Mutex<Vec<HostEntry<HostType>>>>,
+    hosts_need_swap: &'sched mut bool,
+    runner: TaskRunner<'pool, 'scope>,
+}
+
+impl<'sched, 'pool, 'scope, HostType: Host> SchedulerScope<'sched, 'pool, 'scope, HostType> {
+    /// See [`crate::SchedulerScope::run`].
+    pub fn run(self, f: impl Fn(usize) + Sync + Send + 'scope) {
+        self.runner.run(f);
+    }
+
+    /// See [`crate::SchedulerScope::run_with_hosts`].
+    pub fn run_with_hosts(
+        self,
+        f: impl Fn(usize, &mut HostIter<'_, HostType>) + Send + Sync + 'scope,
+    ) {
+        self.runner.run(move |i| {
+            let mut host_iter = HostIter {
+                thread_hosts_from: self.thread_hosts,
+                thread_hosts_to: &self.thread_hosts_processed[i],
+                this_thread_index: i,
+            };
+
+            f(i, &mut host_iter);
+        });
+
+        *self.hosts_need_swap = true;
+    }
+
+    /// See [`crate::SchedulerScope::run_with_data`].
+    pub fn run_with_data<T>(
+        self,
+        data: &'scope [T],
+        f: impl Fn(usize, &mut HostIter<'_, HostType>, &T) + Send + Sync + 'scope,
+    ) where
+        T: Sync,
+    {
+        self.runner.run(move |i| {
+            let this_elem = &data[i];
+
+            let mut host_iter = HostIter {
+                thread_hosts_from: self.thread_hosts,
+                thread_hosts_to: &self.thread_hosts_processed[i],
+                this_thread_index: i,
+            };
+
+            f(i, &mut host_iter, this_elem);
+        });
+
+        *self.hosts_need_swap = true;
+    }
+}
+
+/// Supports iterating over all hosts assigned to this thread. For this work-stealing scheduler,
+/// the iterator will steal hosts from other threads once this thread has run all of its own hosts.
+pub struct HostIter<'a, HostType: Host> {
+    /// Deques to take hosts from.
+    thread_hosts_from: &'a [Mutex<VecDeque<HostEntry<HostType>>>],
+    /// Where to add hosts to when done with them.
+    thread_hosts_to: &'a Mutex<Vec<HostEntry<HostType>>>,
+    /// The index of this thread. This is the deque of `thread_hosts_from` that we take hosts from
+    /// first.
+    this_thread_index: usize,
+}
+
+impl<'a, HostType: Host> HostIter<'a, HostType> {
+    /// Take this thread's most expensive host, or if it has none left, steal another thread's
+    /// cheapest host. The victim keeps its expensive hosts, which it's already going to run next.
+    fn next_entry(&self) -> Option<HostEntry<HostType>> {
+        let own_queue = &self.thread_hosts_from[self.this_thread_index];
+        if let Some(entry) = own_queue.lock().unwrap().pop_front() {
+            return Some(entry);
+        }
+
+        self.thread_hosts_from
+            .iter()
+            .cycle()
+            // start from the thread after the current thread
+            .skip(self.this_thread_index + 1)
+            .take(self.thread_hosts_from.len() - 1)
+            .find_map(|queue| queue.lock().unwrap().pop_back())
+    }
+
+    /// See [`crate::HostIter::for_each`].
+    pub fn for_each<F>(&mut self, mut f: F)
+    where
+        F: FnMut(HostType) -> HostType,
+    {
+        // no other thread adds hosts to the deques during a round, so once we've found them all
+        // empty we're done
+        while let Some(HostEntry { host, cost_ns }) = self.next_entry() {
+            let start = Instant::now();
+            let host = f(host);
+            let elapsed_ns = u64::try_from(start.elapsed().as_nanos()).unwrap_or(u64::MAX);
+
+            let mut entry = HostEntry { host, cost_ns };
+            entry.update_cost(elapsed_ns);
+            self.thread_hosts_to.lock().unwrap().push(entry);
+        }
+    }
+}
+
+#[cfg(any(test, doctest))]
+mod tests {
+    use std::sync::atomic::{AtomicU32, Ordering};
+
+    use super::*;
+
+    #[derive(Debug)]
+    struct TestHost {}
+
+    #[test]
+    fn test_parallelism() {
+        let hosts = [(); 5].map(|_| TestHost {});
+        let sched: WorkStealingSched<TestHost> =
+            WorkStealingSched::new(&[None, None], hosts, false, false);
+
+        assert_eq!(sched.parallelism(), 2);
+
+        sched.join();
+    }
+
+    #[test]
+    fn test_no_join() {
+        let hosts = [(); 5].map(|_| TestHost {});
+        let _sched: WorkStealingSched<TestHost> =
+            WorkStealingSched::new(&[None, None], hosts, false, false);
+    }
+
+    #[test]
+    #[should_panic]
+    fn test_panic() {
+        let hosts = [(); 5].map(|_| TestHost {});
+        let mut sched: WorkStealingSched<TestHost> =
+            WorkStealingSched::new(&[None, None], hosts, false, false);
+
+        sched.scope(|s| {
+            s.run(|x| {
+                if x == 1 {
+                    panic!();
+                }
+            });
+        });
+    }
+
+    #[test]
+    fn test_run() {
+        let hosts = [(); 5].map(|_| TestHost {});
+        let mut sched: WorkStealingSched<TestHost> =
+            WorkStealingSched::new(&[None, None], hosts, false, false);
+
+        let counter = AtomicU32::new(0);
+
+        for _ in 0..3 {
+            sched.scope(|s| {
+                s.run(|_| {
+                    counter.fetch_add(1, Ordering::SeqCst);
+                });
+            });
+        }
+
+        assert_eq!(counter.load(Ordering::SeqCst), 2 * 3);
+
+        sched.join();
+    }
+
+    #[test]
+    fn test_run_with_hosts() {
+        let hosts = [(); 5].map(|_| TestHost {});
+        let mut sched: WorkStealingSched<TestHost> =
+            WorkStealingSched::new(&[None, None], hosts, false, false);
+
+        let counter = AtomicU32::new(0);
+
+        // enough rounds to rebalance at least once
+        let rounds = 2 * REBALANCE_INTERVAL;
+
+        for _ in 0..rounds {
+            sched.scope(|s| {
+                s.run_with_hosts(|_, hosts| {
+                    hosts.for_each(|host| {
+                        counter.fetch_add(1, Ordering::SeqCst);
+                        host
+                    });
+                });
+            });
+        }
+
+        assert_eq!(counter.load(Ordering::SeqCst), 5 * rounds);
+
+        sched.join();
+    }
+
+    #[test]
+    fn test_run_with_data() {
+        let hosts = [(); 5].map(|_| TestHost {});
+        let mut sched: WorkStealingSched<TestHost> =
+            WorkStealingSched::new(&[None, None], hosts, false, false);
+
+        let data = vec![0u32; sched.parallelism()];
+        let data: Vec<_> = data.into_iter().map(std::sync::Mutex::new).collect();
+
+        for _ in 0..3 {
+            sched.scope(|s| {
+                s.run_with_data(&data, |_, hosts, elem| {
+                    let mut elem = elem.lock().unwrap();
+                    hosts.for_each(|host| {
+                        *elem += 1;
+                        host
+                    });
+                });
+            });
+        }
+
+        let sum: u32 = data.into_iter().map(|x| x.into_inner().unwrap()).sum();
+        assert_eq!(sum, 5 * 3);
+
+        sched.join();
+    }
+
+    #[test]
+    fn test_new_with_costs() {
+        let hosts = [10, 100, 10, 10, 10].map(|cost| (TestHost {}, cost));
+        let sched: WorkStealingSched<TestHost> =
+            WorkStealingSched::new_with_costs(&[None, None], hosts, false, false);
+
+        let costs: Vec<Vec<u64>> = sched
+            .thread_hosts
+            .iter()
+            .map(|queue| queue.lock().unwrap().iter().map(|x| x.cost_ns).collect())
+            .collect();
+
+        // the expensive host gets a thread to itself
+        assert_eq!(costs, [vec![100], vec![10, 10, 10, 10]]);
+
+        sched.join();
+    }
+}
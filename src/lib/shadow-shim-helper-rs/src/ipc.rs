@@ -1,3 +1,6 @@
+use core::cell::UnsafeCell;
+use core::sync::atomic::{AtomicU32, Ordering};
+
 use vasi::VirtualAddressSpaceIndependent;
 use vasi_sync::scchannel::SelfContainedChannel;
 
@@ -14,6 +17,7 @@ use crate::shim_event::{ShimEventToShadow, ShimEventToShim};
 pub struct IPCData {
     shadow_to_plugin: SelfContainedChannel<ShimEventToShim>,
     plugin_to_shadow: SelfContainedChannel<ShimEventToShadow>,
+    shim_log: ShimLogBuffer,
 }
 
 impl IPCData {
@@ -21,6 +25,7 @@ impl IPCData {
         Self {
             shadow_to_plugin: SelfContainedChannel::new(),
             plugin_to_shadow: SelfContainedChannel::new(),
+            shim_log: ShimLogBuffer::new(),
         }
     }
 
@@ -43,6 +48,19 @@ impl IPCData {
     pub fn from_shadow(&self) -> &SelfContainedChannel<ShimEventToShim> {
         &self.shadow_to_plugin
     }
+
+    /// Log output that the shim has buffered for Shadow to write out.
+    pub fn shim_log(&self) -> &ShimLogBuffer {
+        &self.shim_log
+    }
+
+    /// Whether both channels are idle (see [`SelfContainedChannel::is_idle`]) and there is no
+    /// buffered log output.
+    pub fn is_idle(&self) -> bool {
+        self.shadow_to_plugin.is_idle()
+            && self.plugin_to_shadow.is_idle()
+            && self.shim_log.is_empty()
+    }
 }
 
 impl Default for IPCData {
@@ -50,3 +68,116 @@ impl Default for IPCData {
         Self::new()
     }
 }
+
+/// The number of bytes of log output that the shim can buffer for each thread.
+pub const SHIM_LOG_BUFFER_NBYTES: usize = 16 * 1024;
+
+/// Log output from the shim, which Shadow writes out to the process's shim log file each time the
+/// thread passes control back to it. This lets the shim log without making a `write` syscall for
+/// each record, which would distort the timing of the thread being debugged.
+#[derive(VirtualAddressSpaceIndependent)]
+#[repr(C)]
+pub struct ShimLogBuffer {
+    len: AtomicU32,
+    bytes: UnsafeCell<[u8; SHIM_LOG_BUFFER_NBYTES]>,
+}
+
+// SAFETY: `append` only writes to ranges of `bytes` that it has exclusively reserved by advancing
+// `len`, and the caller of `drain` guarantees that there are no concurrent calls to `append`.
+unsafe impl Sync for ShimLogBuffer {}
+
+impl ShimLogBuffer {
+    pub fn new() -> Self {
+        Self {
+            len: AtomicU32::new(0),
+            bytes: UnsafeCell::new([0; SHIM_LOG_BUFFER_NBYTES]),
+        }
+    }
+
+    /// Append `bytes` to the buffer. Returns an error without changing the buffer if there isn't
+    /// room for all of `bytes`.
+    pub fn append(&self, bytes: &[u8]) -> Result<(), ()> {
+        let mut start = self.len.load(Ordering::Relaxed);
+        let end = loop {
+            let end = (start as usize)
+                .checked_add(bytes.len())
+                .filter(|end| *end <= SHIM_LOG_BUFFER_NBYTES)
+                .ok_or(())?;
+            // Reserve `start..end` before writing to it, so that a log call from a signal handler
+            // that interrupts this one can't write to the same range.
+            match self.len.compare_exchange_weak(
+                start,
+                end.try_into().unwrap(),
+                Ordering::Relaxed,
+                Ordering::Relaxed,
+            ) {
+                Ok(_) => break end,
+                Err(len) => start = len,
+            }
+        };
+
+        // SAFETY: We've reserved this range, and it isn't read until `drain`.
+        let dst = unsafe { &mut (&mut *self.bytes.get())[start as usize..end] };
+        dst.copy_from_slice(bytes);
+        Ok(())
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len.load(Ordering::Relaxed) == 0
+    }
+
+    /// Pass the buffered bytes to `f`, and then empty the buffer.
+    ///
+    /// # Safety
+    ///
+    /// There must be no concurrent calls to `append`, and earlier calls must be visible to the
+    /// calling thread. e.g. Shadow may drain a thread's buffer after receiving an event from it
+    /// over the same [`IPCData`], and before sending the response.
+    pub unsafe fn drain<T>(&self, f: impl FnOnce(&[u8]) -> T) -> T {
+        let len = self.len.load(Ordering::Relaxed) as usize;
+        // SAFETY: Caller guarantees there are no concurrent writers.
+        let bytes = unsafe { &(&*self.bytes.get())[..len] };
+        let rv = f(bytes);
+        self.len.store(0, Ordering::Relaxed);
+        rv
+    }
+}
+
+impl Default for ShimLogBuffer {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn test_shim_log_buffer() {
+        let log = ShimLogBuffer::new();
+        assert!(log.is_empty());
+
+        log.append(b"hello ").unwrap();
+        log.append(b"world").unwrap();
+        assert_eq!(unsafe { log.drain(|b| b.to_vec()) }, b"hello world");
+        assert!(log.is_empty());
+        assert_eq!(unsafe { log.drain(|b| b.len()) }, 0);
+    }
+
+    #[test]
+    fn test_shim_log_buffer_full() {
+        let log = ShimLogBuffer::new();
+
+        let record = [b'x'; 1000];
+        let mut appended = 0;
+        while log.append(&record).is_ok() {
+            appended += record.len();
+        }
+        assert_eq!(appended, SHIM_LOG_BUFFER_NBYTES / 1000 * 1000);
+
+        // A failed append leaves the buffer unchanged.
+        assert_eq!(unsafe { log.drain(|b| b.len()) }, appended);
+        log.append(&record).unwrap();
+    }
+}
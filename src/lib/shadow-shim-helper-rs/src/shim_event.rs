@@ -20,6 +20,28 @@ pub struct ShimEventSyscallComplete {
     pub restartable: bool,
 }
 
+/// The maximum number of syscalls in a [`ShimEventSyscallBatch`]. Every message in the IPC
+/// channels is as large as the largest event, so this is kept small enough that a batch is no
+/// larger than a [`ShimEventAddThreadReq`].
+pub const SYSCALL_BATCH_MAX: usize = 4;
+
+/// Data for [`ShimEventToShim::SyscallBatch`]
+#[derive(Copy, Clone, Debug, VirtualAddressSpaceIndependent)]
+#[repr(C)]
+pub struct ShimEventSyscallBatch {
+    /// The number of syscalls in `syscall_args`.
+    pub len: usize,
+    pub syscall_args: [SyscallArgs; SYSCALL_BATCH_MAX],
+}
+
+/// Data for [`ShimEventToShadow::SyscallBatchComplete`]
+#[derive(Copy, Clone, Debug, VirtualAddressSpaceIndependent)]
+#[repr(C)]
+pub struct ShimEventSyscallBatchComplete {
+    /// The return value of each syscall in the batch, in order.
+    pub retvals: [SyscallReg; SYSCALL_BATCH_MAX],
+}
+
 /// Data for [`ShimEventToShim::AddThreadReq`]
 #[derive(Copy, Clone, Debug, VirtualAddressSpaceIndependent)]
 #[repr(C)]
@@ -86,6 +108,8 @@ pub enum ShimEventToShadow {
     SyscallComplete(ShimEventSyscallComplete),
     /// Response to `ShimEventToShim::AddThreadReq`
     AddThreadRes(ShimEventAddThreadRes),
+    /// Response to `ShimEventToShim::SyscallBatch`
+    SyscallBatchComplete(ShimEventSyscallBatchComplete),
 }
 
 #[derive(Copy, Clone, Debug, VirtualAddressSpaceIndependent)]
@@ -109,4 +133,11 @@ pub enum ShimEventToShim {
     /// Response to ShimEventToShadow::Syscall indicating to execute it
     /// natively.
     SyscallDoNative,
+    /// Request to execute the given syscalls natively, in order, and return
+    /// all of the results in a single response.
+    SyscallBatch(ShimEventSyscallBatch),
 }
+
+static_assertions::const_assert!(
+    core::mem::size_of::<ShimEventSyscallBatch>() <= core::mem::size_of::<ShimEventAddThreadReq>()
+);
@@ -1,9 +1,13 @@
+use std::sync::atomic::{AtomicBool, AtomicI32, AtomicU32, AtomicU64, Ordering};
+
 use linux_api::signal::{sigaction, siginfo_t, sigset_t, stack_t, Signal};
+use linux_api::utsname::new_utsname;
 use shadow_shmem::allocator::{ShMemBlock, ShMemBlockSerialized};
 use vasi::VirtualAddressSpaceIndependent;
 use vasi_sync::scmutex::SelfContainedMutex;
 
 use crate::option::FfiOption;
+use crate::syscall_types::ManagedPhysicalMemoryAddr;
 use crate::HostId;
 use crate::{
     emulated_time::{AtomicEmulatedTime, EmulatedTime},
@@ -50,6 +54,41 @@ macro_rules! assert_shmem_safe {
 #[repr(C)]
 pub struct ManagerShmem {
     pub log_start_time_micros: i64,
+    // Bitmap of the syscall numbers that the shim's seccomp filter should let
+    // through to the kernel. See `experimental.native_syscall_passthrough`.
+    pub native_syscall_passthrough: [u64; NATIVE_SYSCALL_PASSTHROUGH_WORDS],
+    // Whether the shim should rewrite trapped rdtsc and rdtscp instructions.
+    // See `experimental.use_rdtsc_patching`.
+    pub patch_rdtsc_sites: bool,
+}
+
+/// Number of words in [`ManagerShmem::native_syscall_passthrough`]; enough
+/// for syscall numbers below 512.
+pub const NATIVE_SYSCALL_PASSTHROUGH_WORDS: usize = 8;
+
+impl ManagerShmem {
+    /// Whether syscall `n` should bypass the shim's seccomp trap.
+    pub fn native_syscall_passthrough(&self, n: u32) -> bool {
+        let (word, bit) = ((n / 64) as usize, n % 64);
+        self.native_syscall_passthrough
+            .get(word)
+            .is_some_and(|w| w & (1 << bit) != 0)
+    }
+}
+
+/// Number of buckets in [`HostShmem::futex_waiters`].
+pub const FUTEX_WAITER_BUCKETS: usize = 1024;
+
+/// Number of descriptors in [`ProcessShmem::read_would_block`].
+pub const READ_WOULD_BLOCK_SLOTS: usize = 64;
+
+/// A descriptor that a non-blocking read would fail on with `EAGAIN`, as long
+/// as the host's [`HostShmem::file_state_epoch`] hasn't changed.
+#[derive(VirtualAddressSpaceIndependent)]
+#[repr(C)]
+struct ReadWouldBlockSlot {
+    fd: AtomicI32,
+    epoch: AtomicU64,
 }
 
 #[derive(VirtualAddressSpaceIndependent)]
@@ -81,6 +120,13 @@ pub struct HostShmem {
     // per-process option.
     pub unblocked_vdso_latency: SimulationTime,
 
+    // Whether the shim should preempt managed threads after they've run for
+    // `native_preemption_native_interval` of native CPU time, moving time
+    // forward by `native_preemption_sim_interval`.
+    pub native_preemption_enabled: bool,
+    pub native_preemption_native_interval: SimulationTime,
+    pub native_preemption_sim_interval: SimulationTime,
+
     // Native pid of the Shadow simulator process.
     pub shadow_pid: libc::pid_t,
 
@@ -90,9 +136,31 @@ pub struct HostShmem {
     // Current simulation time.
     pub sim_time: AtomicEmulatedTime,
 
+    // Max simulation time to which sim_time may be incremented. Moving time
+    // beyond this value requires the current thread to be rescheduled. Only
+    // Shadow changes this, before it transfers control to the shim, so the shim
+    // can read it without taking the lock.
+    pub max_runahead_time: AtomicEmulatedTime,
+
     pub shim_log_level: logger::LogLevel,
 
     pub manager_shmem: ShMemBlockSerialized,
+
+    // What `uname` reports on this host.
+    // SAFETY: Contains only character arrays.
+    #[unsafe_assume_virtual_address_space_independent]
+    pub utsname: new_utsname,
+
+    // Number of futexes with threads waiting on them in Shadow, bucketed by the
+    // futex word's physical address, as used by Shadow's futex table. Only Shadow changes the counts; the shim
+    // reads them to answer wakes on futexes nobody is waiting on without
+    // making a syscall to Shadow.
+    futex_waiters: [AtomicU32; FUTEX_WAITER_BUCKETS],
+
+    // Incremented by Shadow whenever the state of any file on this host
+    // changes, or a syscall may have changed which file a descriptor refers to
+    // or its flags. Invalidates the processes' `read_would_block` entries.
+    file_state_epoch: AtomicU64,
 }
 assert_shmem_safe!(HostShmem, _hostshmem_test_fn);
 
@@ -104,10 +172,14 @@ impl HostShmem {
         max_unapplied_cpu_latency: SimulationTime,
         unblocked_syscall_latency: SimulationTime,
         unblocked_vdso_latency: SimulationTime,
+        native_preemption_enabled: bool,
+        native_preemption_native_interval: SimulationTime,
+        native_preemption_sim_interval: SimulationTime,
         shadow_pid: libc::pid_t,
         tsc_hz: u64,
         shim_log_level: ::logger::LogLevel,
         manager_shmem: &ShMemBlock<ManagerShmem>,
+        utsname: new_utsname,
     ) -> Self {
         Self {
             host_id,
@@ -115,23 +187,69 @@ impl HostShmem {
                 host_id,
                 root: Root::new(),
                 unapplied_cpu_latency: SimulationTime::ZERO,
-                max_runahead_time: EmulatedTime::MIN,
             }),
             model_unblocked_syscall_latency,
             max_unapplied_cpu_latency,
             unblocked_syscall_latency,
             unblocked_vdso_latency,
+            native_preemption_enabled,
+            native_preemption_native_interval,
+            native_preemption_sim_interval,
             shadow_pid,
             tsc_hz,
             sim_time: AtomicEmulatedTime::new(EmulatedTime::MIN),
+            max_runahead_time: AtomicEmulatedTime::new(EmulatedTime::MIN),
             shim_log_level,
             manager_shmem: manager_shmem.serialize(),
+            utsname,
+            futex_waiters: std::array::from_fn(|_| AtomicU32::new(0)),
+            file_state_epoch: AtomicU64::new(1),
         }
     }
 
     pub fn protected(&self) -> &SelfContainedMutex<HostShmemProtected> {
         &self.protected
     }
+
+    fn futex_waiters_bucket(&self, word: ManagedPhysicalMemoryAddr) -> &AtomicU32 {
+        // Futex words are 4-byte aligned, so the low bits don't tell them apart.
+        &self.futex_waiters[((u64::from(word) >> 2) % FUTEX_WAITER_BUCKETS as u64) as usize]
+    }
+
+    /// Records whether the futex whose word is at the physical address `word`
+    /// has waiters. Must be called exactly once each time the futex's waiters
+    /// become non-empty, and again once they become empty.
+    pub fn set_futex_has_waiters(&self, word: ManagedPhysicalMemoryAddr, has_waiters: bool) {
+        let bucket = self.futex_waiters_bucket(word);
+        if has_waiters {
+            bucket.fetch_add(1, Ordering::Relaxed);
+        } else {
+            let prev = bucket.fetch_sub(1, Ordering::Relaxed);
+            debug_assert!(prev > 0);
+        }
+    }
+
+    /// Whether a futex whose word is at the physical address `word` might have
+    /// waiters. A `false` result means that a wake on it can't wake anything.
+    ///
+    /// Only Shadow changes the result, and Shadow doesn't run while a managed
+    /// thread on this host does, so the result can't change while the shim is
+    /// acting on it.
+    pub fn futex_may_have_waiters(&self, word: ManagedPhysicalMemoryAddr) -> bool {
+        self.futex_waiters_bucket(word).load(Ordering::Relaxed) != 0
+    }
+
+    /// Invalidates every process's [`ProcessShmem::read_would_block`] entries.
+    /// Must be called whenever the state of a file on this host changes, and
+    /// after any syscall that may change a descriptor table or a file's status
+    /// flags.
+    pub fn file_state_changed(&self) {
+        self.file_state_epoch.fetch_add(1, Ordering::Relaxed);
+    }
+
+    pub fn file_state_epoch(&self) -> u64 {
+        self.file_state_epoch.load(Ordering::Relaxed)
+    }
 }
 
 #[derive(VirtualAddressSpaceIndependent)]
@@ -143,10 +261,6 @@ pub struct HostShmemProtected {
 
     // Modeled CPU latency that hasn't been applied to the clock yet.
     pub unapplied_cpu_latency: SimulationTime,
-
-    // Max simulation time to which sim_time may be incremented.  Moving time
-    // beyond this value requires the current thread to be rescheduled.
-    pub max_runahead_time: EmulatedTime,
 }
 
 #[derive(VirtualAddressSpaceIndependent)]
@@ -154,11 +268,21 @@ pub struct HostShmemProtected {
 pub struct ProcessShmem {
     host_id: HostId,
 
+    pub pid: libc::pid_t,
+    // Changes when the parent process exits.
+    pub ppid: AtomicI32,
+
     /// Handle to shared memory for the Host
     pub host_shmem: ShMemBlockSerialized,
     pub strace_fd: FfiOption<libc::c_int>,
 
     pub protected: RootedRefCell<ProcessShmemProtected>,
+
+    // Descriptors that non-blocking reads are known to fail on with `EAGAIN`,
+    // indexed by the descriptor modulo the number of slots. Only Shadow writes
+    // them; the shim reads them to fail such reads without making a syscall to
+    // Shadow.
+    read_would_block: [ReadWouldBlockSlot; READ_WOULD_BLOCK_SLOTS],
 }
 assert_shmem_safe!(ProcessShmem, _test_processshmem_fn);
 
@@ -167,10 +291,14 @@ impl ProcessShmem {
         host_root: &Root,
         host_shmem: ShMemBlockSerialized,
         host_id: HostId,
+        pid: libc::pid_t,
+        ppid: libc::pid_t,
         strace_fd: Option<libc::c_int>,
     ) -> Self {
         Self {
             host_id,
+            pid,
+            ppid: AtomicI32::new(ppid),
             host_shmem,
             strace_fd: strace_fd.into(),
             protected: RootedRefCell::new(
@@ -183,8 +311,42 @@ impl ProcessShmem {
                     signal_actions: [sigaction::default(); Signal::MAX.as_i32() as usize],
                 },
             ),
+            read_would_block: std::array::from_fn(|_| ReadWouldBlockSlot {
+                fd: AtomicI32::new(-1),
+                epoch: AtomicU64::new(0),
+            }),
         }
     }
+
+    fn read_would_block_slot(&self, fd: libc::c_int) -> Option<&ReadWouldBlockSlot> {
+        let fd = usize::try_from(fd).ok()?;
+        Some(&self.read_would_block[fd % READ_WOULD_BLOCK_SLOTS])
+    }
+
+    /// Records that a non-blocking `read` or `recv` on `fd` will fail with
+    /// `EAGAIN` until the host's file state epoch changes from `epoch`.
+    ///
+    /// Shadow must only call this if the descriptor refers to a file that
+    /// isn't readable, since a file must become readable (changing the epoch)
+    /// before a read of it can succeed.
+    pub fn set_read_would_block(&self, fd: libc::c_int, epoch: u64) {
+        if let Some(slot) = self.read_would_block_slot(fd) {
+            slot.fd.store(fd, Ordering::Relaxed);
+            slot.epoch.store(epoch, Ordering::Relaxed);
+        }
+    }
+
+    /// Whether a non-blocking `read` or `recv` on `fd` is known to fail with
+    /// `EAGAIN`, given the host's current file state epoch.
+    ///
+    /// Only Shadow changes the slots and the epoch, and Shadow doesn't run
+    /// while a managed thread on this host does, so the result can't change
+    /// while the shim is acting on it.
+    pub fn read_would_block(&self, fd: libc::c_int, epoch: u64) -> bool {
+        self.read_would_block_slot(fd).is_some_and(|slot| {
+            slot.fd.load(Ordering::Relaxed) == fd && slot.epoch.load(Ordering::Relaxed) == epoch
+        })
+    }
 }
 
 #[derive(VirtualAddressSpaceIndependent)]
@@ -283,6 +445,12 @@ pub struct ThreadShmem {
     pub host_id: HostId,
     pub tid: libc::pid_t,
 
+    // Whether the thread had an unblocked thread- or process-directed signal
+    // pending when Shadow last completed a syscall for it. Shadow updates this
+    // before returning each syscall result, so that the shim only needs to take
+    // the host lock to process signals when there's one to deliver.
+    pub unblocked_signal_pending: AtomicBool,
+
     pub protected: RootedRefCell<ThreadShmemProtected>,
 }
 assert_shmem_safe!(ThreadShmem, _test_threadshmem_fn);
@@ -292,6 +460,7 @@ impl ThreadShmem {
         Self {
             host_id: host.host_id,
             tid,
+            unblocked_signal_pending: AtomicBool::new(false),
             protected: RootedRefCell::new(
                 &host.root,
                 ThreadShmemProtected {
@@ -316,6 +485,9 @@ impl ThreadShmem {
         Self {
             host_id: self.host_id,
             tid: self.tid,
+            unblocked_signal_pending: AtomicBool::new(
+                self.unblocked_signal_pending.load(Ordering::Relaxed),
+            ),
             protected: RootedRefCell::new(root, *self.protected.borrow(root)),
         }
     }
@@ -420,6 +592,7 @@ pub mod export {
 
     use bytemuck::TransparentWrapper;
     use linux_api::signal::{linux_sigaction, linux_sigset_t, linux_stack_t};
+    use linux_api::utsname::linux_new_utsname;
     use vasi_sync::scmutex::SelfContainedMutexGuard;
 
     use super::*;
@@ -520,15 +693,57 @@ pub mod export {
             .store(EmulatedTime::from_c_emutime(t).unwrap(), Ordering::Relaxed);
     }
 
+    /// # Safety
+    ///
+    /// Pointer args must be safely dereferenceable. The returned pointer is
+    /// valid as long as `host_mem` is.
+    #[no_mangle]
+    pub unsafe extern "C-unwind" fn shimshmem_getUtsname(
+        host_mem: *const ShimShmemHost,
+    ) -> *const linux_new_utsname {
+        let host_mem = unsafe { host_mem.as_ref().unwrap() };
+        &host_mem.utsname
+    }
+
+    /// # Safety
+    ///
+    /// Pointer args must be safely dereferenceable.
+    #[no_mangle]
+    pub unsafe extern "C-unwind" fn shimshmem_futexMayHaveWaiters(
+        host_mem: *const ShimShmemHost,
+        process_mem: *const ShimShmemProcess,
+        vaddr: u64,
+    ) -> bool {
+        let host_mem = unsafe { host_mem.as_ref().unwrap() };
+        let process_mem = unsafe { process_mem.as_ref().unwrap() };
+        let word =
+            ManagedPhysicalMemoryAddr::new_private(process_mem.pid.try_into().unwrap(), vaddr);
+        host_mem.futex_may_have_waiters(word)
+    }
+
+    /// # Safety
+    ///
+    /// Pointer args must be safely dereferenceable.
+    #[no_mangle]
+    pub unsafe extern "C-unwind" fn shimshmem_readWouldBlock(
+        host_mem: *const ShimShmemHost,
+        process: *const ShimShmemProcess,
+        fd: libc::c_int,
+    ) -> bool {
+        let host_mem = unsafe { host_mem.as_ref().unwrap() };
+        let process_mem = unsafe { process.as_ref().unwrap() };
+        process_mem.read_would_block(fd, host_mem.file_state_epoch())
+    }
+
     /// # Safety
     ///
     /// Pointer args must be safely dereferenceable.
     #[no_mangle]
     pub unsafe extern "C-unwind" fn shimshmem_getMaxRunaheadTime(
-        host_mem: *const ShimShmemHostLock,
+        host_mem: *const ShimShmemHost,
     ) -> CEmulatedTime {
         let host_mem = unsafe { host_mem.as_ref().unwrap() };
-        EmulatedTime::to_c_emutime(Some(host_mem.max_runahead_time))
+        EmulatedTime::to_c_emutime(Some(host_mem.max_runahead_time.load(Ordering::Relaxed)))
     }
 
     /// # Safety
@@ -536,11 +751,13 @@ pub mod export {
     /// Pointer args must be safely dereferenceable.
     #[no_mangle]
     pub unsafe extern "C-unwind" fn shimshmem_setMaxRunaheadTime(
-        host_mem: *mut ShimShmemHostLock,
+        host_mem: *const ShimShmemHost,
         t: CEmulatedTime,
     ) {
-        let host_mem = unsafe { host_mem.as_mut().unwrap() };
-        host_mem.max_runahead_time = EmulatedTime::from_c_emutime(t).unwrap();
+        let host_mem = unsafe { host_mem.as_ref().unwrap() };
+        host_mem
+            .max_runahead_time
+            .store(EmulatedTime::from_c_emutime(t).unwrap(), Ordering::Relaxed);
     }
 
     /// # Safety
@@ -554,6 +771,28 @@ pub mod export {
         process_mem.strace_fd.unwrap_or(-1)
     }
 
+    /// # Safety
+    ///
+    /// Pointer args must be safely dereferenceable.
+    #[no_mangle]
+    pub unsafe extern "C-unwind" fn shimshmem_getProcessId(
+        process: *const ShimShmemProcess,
+    ) -> libc::pid_t {
+        let process_mem = unsafe { process.as_ref().unwrap() };
+        process_mem.pid
+    }
+
+    /// # Safety
+    ///
+    /// Pointer args must be safely dereferenceable.
+    #[no_mangle]
+    pub unsafe extern "C-unwind" fn shimshmem_getProcessParentId(
+        process: *const ShimShmemProcess,
+    ) -> libc::pid_t {
+        let process_mem = unsafe { process.as_ref().unwrap() };
+        process_mem.ppid.load(Ordering::Relaxed)
+    }
+
     /// # Safety
     ///
     /// Pointer args must be safely dereferenceable.
@@ -602,6 +841,20 @@ pub mod export {
         thread_mem.tid
     }
 
+    /// Whether the thread had an unblocked signal pending when Shadow last
+    /// completed a syscall for it.
+    ///
+    /// # Safety
+    ///
+    /// Pointer args must be safely dereferenceable.
+    #[no_mangle]
+    pub unsafe extern "C-unwind" fn shimshmem_getUnblockedSignalPending(
+        thread: *const ShimShmemThread,
+    ) -> bool {
+        let thread_mem = unsafe { thread.as_ref().unwrap() };
+        thread_mem.unblocked_signal_pending.load(Ordering::Relaxed)
+    }
+
     /// # Safety
     ///
     /// Pointer args must be safely dereferenceable.
@@ -700,6 +953,35 @@ pub mod export {
         lock.unapplied_cpu_latency = SimulationTime::ZERO;
     }
 
+    /// Get whether the shim's seccomp filter should let syscall `n` through
+    /// to the kernel.
+    ///
+    /// # Safety
+    ///
+    /// Pointer args must be safely dereferenceable.
+    #[no_mangle]
+    pub unsafe extern "C-unwind" fn shimshmem_getNativeSyscallPassthrough(
+        manager: *const ShimShmemManager,
+        n: u32,
+    ) -> bool {
+        let manager = unsafe { manager.as_ref().unwrap() };
+        manager.native_syscall_passthrough(n)
+    }
+
+    /// Get whether the shim should rewrite trapped rdtsc and rdtscp
+    /// instructions.
+    ///
+    /// # Safety
+    ///
+    /// Pointer args must be safely dereferenceable.
+    #[no_mangle]
+    pub unsafe extern "C-unwind" fn shimshmem_getPatchRdtscSites(
+        manager: *const ShimShmemManager,
+    ) -> bool {
+        let manager = unsafe { manager.as_ref().unwrap() };
+        manager.patch_rdtsc_sites
+    }
+
     /// Get whether to model latency of unblocked syscalls.
     ///
     /// # Safety
@@ -190,6 +190,30 @@ pub struct ManagedPhysicalMemoryAddr {
     val: usize,
 }
 
+impl ManagedPhysicalMemoryAddr {
+    // Linux uses the bottom 48-bits for user-space virtual addresses, giving us 16 bits for the
+    // pid.
+    const VADDR_BITS: u32 = 48;
+    const PID_BITS: u32 = 16;
+    // Set in the addresses of words in shared memory. Pids are normally below 2^15, so these
+    // don't overlap with the addresses of words in private memory.
+    const SHARED_BIT: u64 = 1 << 63;
+
+    /// The address of the word at `vaddr` in memory private to the process `pid`.
+    pub fn new_private(pid: u32, vaddr: u64) -> Self {
+        assert_eq!(Self::VADDR_BITS + Self::PID_BITS, u64::BITS);
+        assert_eq!(pid >> Self::PID_BITS, 0);
+        assert_eq!(vaddr >> Self::VADDR_BITS, 0);
+        Self::from((u64::from(pid) << Self::VADDR_BITS) | vaddr)
+    }
+
+    /// The address of a word in memory shared between mappings, given a hash of the object that
+    /// the memory belongs to and the word's offset in it.
+    pub fn new_shared(object_offset_hash: u64) -> Self {
+        Self::from(Self::SHARED_BIT | (object_offset_hash >> 1))
+    }
+}
+
 impl From<ManagedPhysicalMemoryAddr> for usize {
     #[inline]
     fn from(v: ManagedPhysicalMemoryAddr) -> usize {
@@ -231,6 +255,16 @@ pub struct SyscallArgs {
 }
 
 impl SyscallArgs {
+    /// The syscall `number` with the given arguments. Any arguments that aren't given are 0.
+    #[inline]
+    pub fn new(number: libc::c_long, args: &[SyscallReg]) -> Self {
+        let mut syscall_args = Self {
+            number,
+            args: [SyscallReg::from(0u64); 6],
+        };
+        syscall_args.args[..args.len()].copy_from_slice(args);
+        syscall_args
+    }
     #[inline]
     pub fn get(&self, i: usize) -> SyscallReg {
         self.args[i]
@@ -17,6 +17,8 @@ fn run_bindgen(build_common: &ShadowBuildCommon) {
         .allowlist_function("shim_sys_get_simtime_nanos")
         .header("shim_syscall.h")
         .header("shim_tls.h")
+        .header("../../main/host/syscall_numbers.h")
+        .allowlist_type("ShadowSyscallNum")
         // get libc types from libc crate
         .blocklist_type("addrinfo")
         .raw_line("use libc::addrinfo;")
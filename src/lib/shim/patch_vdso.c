@@ -1,6 +1,9 @@
 #include <assert.h>
+#include <dlfcn.h>
 #include <elf.h>
 #include <errno.h>
+#include <link.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,6 +12,8 @@
 #include <unistd.h>
 
 #include "lib/logger/logger.h"
+#include "lib/shim/shim_api.h"
+#include "lib/shim/shim_sys.h"
 
 static void _getVdsoBounds(void** start, void** end) {
     assert(start);
@@ -144,13 +149,29 @@ static const Elf64_Sym* _findSymbol(const struct ParsedElf* parsedElf, const cha
     return NULL;
 }
 
+// The time functions read the time from shared memory directly when they can,
+// rather than going through `syscall` and the shim's generic syscall dispatch.
+// They're by far the most frequently called.
+
 static int _replacement_gettimeofday(void* arg1, void* arg2) {
+    if (shim_sys_try_gettimeofday(arg1)) {
+        return 0;
+    }
     return (int)syscall(SYS_gettimeofday, arg1, arg2);
 }
 
-static int _replacement_time(void* arg1) { return (int)syscall(SYS_time, arg1); }
+static int _replacement_time(void* arg1) {
+    time_t rv;
+    if (shim_sys_try_time(arg1, &rv)) {
+        return (int)rv;
+    }
+    return (int)syscall(SYS_time, arg1);
+}
 
 static int _replacement_clock_gettime(void* arg1, void* arg2) {
+    if (shim_sys_try_clock_gettime((clockid_t)(intptr_t)arg1, arg2)) {
+        return 0;
+    }
     return (int)syscall(SYS_clock_gettime, arg1, arg2);
 }
 
@@ -158,6 +179,21 @@ static int _replacement_getcpu(void* arg1, void* arg2, void* arg3) {
     return (int)syscall(SYS_getcpu, arg1, arg2, arg3);
 }
 
+// Like the `syscall` wrapper in our preloaded libc.
+static long _replacement_syscall(long n, ...) {
+    va_list args;
+    va_start(args, n);
+    long arg1 = va_arg(args, long);
+    long arg2 = va_arg(args, long);
+    long arg3 = va_arg(args, long);
+    long arg4 = va_arg(args, long);
+    long arg5 = va_arg(args, long);
+    long arg6 = va_arg(args, long);
+    va_end(args);
+
+    return shim_api_syscall(n, arg1, arg2, arg3, arg4, arg5, arg6);
+}
+
 // Inject a trampoline that uses a relative jump. Only needs 5 bytes, but requires
 // that the offset fits in an i32.
 //
@@ -272,4 +308,47 @@ void patch_vdso(void* vdsoBase) {
     if (mprotect((void*)parsedElf.mapStart, regionSize, PROT_READ | PROT_EXEC)) {
         panic("mprotect: %s", strerror(errno));
     }
-}
\ No newline at end of file
+}
+void patch_libc_syscall() {
+    // RTLD_NOLOAD: only patch libc if the program already uses it; e.g.
+    // statically linked programs don't.
+    void* libc = dlopen("libc.so.6", RTLD_NOW | RTLD_NOLOAD);
+    if (libc == NULL) {
+        trace("libc.so.6 isn't loaded; not patching `syscall`");
+        return;
+    }
+
+    // Looking up the symbol via libc's own handle gets libc's definition, even
+    // if another library (such as our preloaded libc) interposes it.
+    void* fn = dlsym(libc, "syscall");
+    Dl_info info;
+    const Elf64_Sym* symbol = NULL;
+    if (fn == NULL || !dladdr1(fn, &info, (void**)&symbol, RTLD_DL_SYMENT) || symbol == NULL) {
+        warning("Couldn't find libc's `syscall` to override");
+        dlclose(libc);
+        return;
+    }
+
+    long pageSize = sysconf(_SC_PAGESIZE);
+    void* pagesStart = (void*)((uintptr_t)fn & ~(pageSize - 1));
+    size_t pagesSize = (uintptr_t)fn + symbol->st_size - (uintptr_t)pagesStart;
+    if (mprotect(pagesStart, pagesSize, PROT_READ | PROT_WRITE | PROT_EXEC)) {
+        panic("mprotect: %s", strerror(errno));
+    }
+
+    size_t actualTrampolineSize =
+        _inject_trampoline_relative(fn, symbol->st_size, _replacement_syscall);
+    if (actualTrampolineSize == 0) {
+        actualTrampolineSize = _inject_trampoline_absolute(fn, symbol->st_size, _replacement_syscall);
+    }
+    if (actualTrampolineSize == 0) {
+        // Calls will still be trapped by the seccomp filter; just slower.
+        warning("Couldn't patch libc's `syscall`");
+    }
+
+    if (mprotect(pagesStart, pagesSize, PROT_READ | PROT_EXEC)) {
+        panic("mprotect: %s", strerror(errno));
+    }
+
+    dlclose(libc);
+}
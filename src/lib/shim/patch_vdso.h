@@ -5,4 +5,10 @@
 // `syscall(2)` function, which can be intercepted via LD_PRELOAD. 
 void patch_vdso(void* vdsoBase);
 
+// Hot-patch libc's `syscall(2)` function to jump directly into the shim,
+// instead of its `syscall` instruction being trapped by the seccomp filter.
+// This matters when libc's definition isn't interposed, e.g. when our
+// preloaded libc is disabled, or for libc-internal callers.
+void patch_libc_syscall();
+
 #endif
\ No newline at end of file
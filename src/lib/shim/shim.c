@@ -122,11 +122,13 @@ void _shim_parent_init_preload() {
 
     shim_install_hardware_error_handlers();
     patch_vdso((void*)getauxval(AT_SYSINFO_EHDR));
+    patch_libc_syscall();
     _shim_parent_init_host_shm();
     _shim_parent_init_manager_shm();
     _shim_parent_init_logging();
     _shim_init_signal_stack();
     _shim_init_death_signal();
+    _shim_parent_init_preemption();
     _shim_parent_init_memory_manager();
     _shim_parent_init_rdtsc_emu();
     _shim_parent_init_seccomp();
@@ -141,6 +143,7 @@ void _shim_child_thread_init_preload() {
     _shim_preload_only_child_ipc_wait_for_start_event();
 
     _shim_init_signal_stack();
+    _shim_init_preemption_timer();
 
     shim_swapAllowNativeSyscalls(oldNativeSyscallFlag);
 }
@@ -151,6 +154,7 @@ void _shim_child_process_init_preload() {
     _shim_preload_only_child_ipc_wait_for_start_event();
     _shim_init_signal_stack();
     _shim_init_death_signal();
+    _shim_init_preemption_timer();
 
     shim_swapAllowNativeSyscalls(oldNativeSyscallFlag);
 }
@@ -140,83 +140,74 @@ static void _getaddrinfo_appendv4(struct addrinfo** head, struct addrinfo** tail
     }
 }
 
-// Looks for matching IPv4 addresses in /etc/hosts and them to the list
-// specified by `head` and `tail`.
-static void _getaddrinfo_add_matching_hosts_ipv4(struct addrinfo** head, struct addrinfo** tail,
-                                                 const char* node, bool add_tcp, bool add_udp,
-                                                 bool add_raw, in_port_t port) {
-    // TODO: Parse hosts file once and keep it in an efficiently-searchable
-    // in-memory format.
+// Parses the IPv4 entries of /etc/hosts into a table mapping each name to the
+// address of the first line listing it. See HOSTS(5) for the format.
+static GHashTable* _getaddrinfo_parse_hosts_ipv4() {
     GError* error = NULL;
     gchar* hosts = NULL;
-    char* pattern = NULL;
-    GMatchInfo* match_info = NULL;
-    GRegex* regex = NULL;
 
     trace("Reading /etc/hosts file");
 
     g_file_get_contents("/etc/hosts", &hosts, NULL, &error);
     if (error != NULL) {
         panic("Reading /etc/hosts: %s", error->message);
-        goto out;
     }
     assert(hosts != NULL);
 
-    trace("Scanning /etc/hosts contents for name %s", node);
-
-    {
-        gchar* escaped_node = g_regex_escape_string(node, -1);
-        // Build a regex to match an IPv4 address entry for the given `node` in
-        // /etc/hosts. See HOSTS(5) for format specification.
-        int rv = asprintf(&pattern, "^(\\d+\\.\\d+\\.\\d+\\.\\d+)[^#\n]*\\b%s\\b", escaped_node);
-        g_free(escaped_node);
-        if (rv < 0) {
-            panic("asprintf failed: %d", rv);
-            goto out;
+    GHashTable* table = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    char* line_saveptr = NULL;
+    for (char* line = strtok_r(hosts, "\n", &line_saveptr); line != NULL;
+         line = strtok_r(NULL, "\n", &line_saveptr)) {
+        char* comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+
+        char* field_saveptr = NULL;
+        const char* address_string = strtok_r(line, " \t", &field_saveptr);
+        uint32_t addr;
+        if (address_string == NULL || inet_pton(AF_INET, address_string, &addr) != 1) {
+            // Blank, or not an IPv4 entry.
+            continue;
+        }
+
+        for (const char* name = strtok_r(NULL, " \t", &field_saveptr); name != NULL;
+             name = strtok_r(NULL, " \t", &field_saveptr)) {
+            // /etc/host.conf specifies whether to return all matching addresses
+            // or only the first. The recommended configuration is to only
+            // return the first. For now we hard-code that behavior.
+            if (!g_hash_table_contains(table, name)) {
+                g_hash_table_insert(table, g_strdup(name), GUINT_TO_POINTER(addr));
+            }
         }
     }
-    trace("Node:%s -> regex:%s", node, pattern);
 
-    regex = g_regex_new(pattern, G_REGEX_MULTILINE, 0, &error);
-    if (error != NULL) {
-        panic("g_regex_new: %s", error->message);
-        goto out;
+    trace("Parsed %u names from /etc/hosts", g_hash_table_size(table));
+
+    g_free(hosts);
+    return table;
+}
+
+// Looks for matching IPv4 addresses in /etc/hosts and them to the list
+// specified by `head` and `tail`.
+static void _getaddrinfo_add_matching_hosts_ipv4(struct addrinfo** head, struct addrinfo** tail,
+                                                 const char* node, bool add_tcp, bool add_udp,
+                                                 bool add_raw, in_port_t port) {
+    // Shadow writes the hosts file before starting any managed process, and
+    // doesn't change it afterwards, so we only parse it once.
+    static gsize hosts_table_init = 0;
+    static GHashTable* hosts_table = NULL;
+    if (g_once_init_enter(&hosts_table_init)) {
+        hosts_table = _getaddrinfo_parse_hosts_ipv4();
+        g_once_init_leave(&hosts_table_init, 1);
     }
-    assert(regex != NULL);
 
-    g_regex_match(regex, hosts, 0, &match_info);
-    // /etc/host.conf specifies whether to return all matching addresses or only
-    // the first. The recommended configuration is to only return the first. For
-    // now we hard-code that behavior.
-    if (g_match_info_matches(match_info)) {
-#ifdef DEBUG
-        {
-            gchar* matched_string = g_match_info_fetch(match_info, 0);
-            trace("Node:%s -> match:%s", node, matched_string);
-            g_free(matched_string);
-        }
-#endif
-        gchar* address_string = g_match_info_fetch(match_info, 1);
-        trace("Node:%s -> address string:%s", node, address_string);
-        assert(address_string != NULL);
-        uint32_t addr;
-        int rv = inet_pton(AF_INET, address_string, &addr);
-        if (rv != 1) {
-            panic("Bad address in /etc/hosts: %s\n", address_string);
-        } else {
-            _getaddrinfo_appendv4(head, tail, add_tcp, add_udp, add_raw, addr, port);
-        }
-        g_free(address_string);
-    }
-out:
-    if (match_info != NULL)
-        g_match_info_free(match_info);
-    if (regex != NULL)
-        g_regex_unref(regex);
-    if (pattern != NULL)
-        free(pattern);
-    if (hosts != NULL)
-        g_free(hosts);
+    gpointer addr;
+    if (g_hash_table_lookup_extended(hosts_table, node, NULL, &addr)) {
+        trace("Node:%s -> address:%u", node, GPOINTER_TO_UINT(addr));
+        _getaddrinfo_appendv4(head, tail, add_tcp, add_udp, add_raw, GPOINTER_TO_UINT(addr), port);
+    }
 }
 
 // Ask shadow to provide an ipv4 addr for a node using a custom syscall.
@@ -234,6 +225,25 @@ static bool _shim_api_hostname_to_addr_ipv4(const char* node, uint32_t* addr) {
         return true;
     }
 
+    // Names don't change address once the simulation has started, so we remember every successful
+    // lookup. Failed ones aren't remembered, since then any name looked up would take memory.
+    static GMutex cache_lock;
+    static GHashTable* cache = NULL;
+
+    g_mutex_lock(&cache_lock);
+    if (cache == NULL) {
+        cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    }
+    gpointer cached_addr;
+    bool found = g_hash_table_lookup_extended(cache, node, NULL, &cached_addr);
+    g_mutex_unlock(&cache_lock);
+
+    if (found) {
+        *addr = GPOINTER_TO_UINT(cached_addr);
+        trace("handled getaddrinfo() lookup for name %s from the cache", node);
+        return true;
+    }
+
     // Resolve the hostname (find the ipv4 `addr` associated with hostname `name`) using a custom
     // syscall that Shadow handles internally. We want to execute natively in ptrace mode so ptrace
     // can intercept it, but we want to send to Shadow through shmem in preload mode. Let
@@ -252,6 +262,9 @@ static bool _shim_api_hostname_to_addr_ipv4(const char* node, uint32_t* addr) {
             trace("SYS_shadow_hostname_to_addr_ipv4 succeeded for name %s", node);
         }
 #endif
+        g_mutex_lock(&cache_lock);
+        g_hash_table_insert(cache, g_strdup(node), GUINT_TO_POINTER(*addr));
+        g_mutex_unlock(&cache_lock);
         return true;
     } else {
         trace("SYS_shadow_hostname_to_addr_ipv4 failed for name %s", node);
@@ -3,15 +3,25 @@
  * See LICENSE for licensing information
  */
 
+#include <cpuid.h>
+#include <elf.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/prctl.h>
+#include <sys/stat.h>
 #include <sys/syscall.h>
 #include <sys/ucontext.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "lib/logger/logger.h"
+#include "lib/shadow-shim-helper-rs/shim_helper.h"
 #include "lib/shim/shim.h"
 #include "lib/shim/shim_api.h"
 #include "lib/shim/shim_sys.h"
@@ -39,9 +49,7 @@ static uint64_t _shim_rdtsc_nanos(bool allowNative) {
     return (uint64_t)t.tv_nsec + (uint64_t)t.tv_sec * 1000000000;
 }
 
-static void _shim_rdtsc_handle_sigsegv(int sig, siginfo_t* info, void* voidUcontext) {
-    bool oldNativeSyscallFlag = shim_swapAllowNativeSyscalls(true);
-    trace("Trapped sigsegv");
+static const Tsc* _shim_rdtsc_tsc() {
     static bool tsc_initd = false;
     static Tsc tsc;
     if (!tsc_initd) {
@@ -49,6 +57,475 @@ static void _shim_rdtsc_handle_sigsegv(int sig, siginfo_t* info, void* voidUcont
         tsc = Tsc_create(shimshmem_getTscHz(shim_hostSharedMem()));
         tsc_initd = true;
     }
+    return &tsc;
+}
+
+// Called from the trampolines below, on the managed thread's stack. Writes the
+// emulated rax, rdx, and (for rdtscp) rcx to `out`.
+__attribute__((used, noinline)) static void _shim_rdtsc_emulate_for_trampoline(uint64_t out[3],
+                                                                              int isRdtscp) {
+    bool oldNativeSyscallFlag = shim_swapAllowNativeSyscalls(true);
+    uint64_t nanos = _shim_rdtsc_nanos(oldNativeSyscallFlag);
+    // Trampolines return to the next instruction themselves.
+    uint64_t ignoredRip = 0;
+    if (isRdtscp) {
+        Tsc_emulateRdtscp(_shim_rdtsc_tsc(), &out[0], &out[1], &out[2], &ignoredRip, nanos);
+    } else {
+        Tsc_emulateRdtsc(_shim_rdtsc_tsc(), &out[0], &out[1], &ignoredRip, nanos);
+    }
+    shim_swapAllowNativeSyscalls(oldNativeSyscallFlag);
+}
+
+// The size of the XSAVE area that the trampolines save the extended register
+// state to, rounded up to a multiple of 64 bytes, and the mask of the state
+// components to save: every component enabled in XCR0. The size is 0 if the
+// CPU or kernel doesn't support XSAVE, in which case nothing is patched. Set
+// by `shim_rdtsc_init`.
+__attribute__((visibility("hidden"))) uint64_t _shim_rdtsc_xsave_size = 0;
+__attribute__((visibility("hidden"))) uint64_t _shim_rdtsc_xsave_mask = 0;
+
+static void _shim_rdtsc_init_xsave() {
+    unsigned int eax, ebx, ecx, edx;
+    // CPUID.1:ECX.OSXSAVE[bit 27] says that the kernel enabled XSAVE and xgetbv.
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_OSXSAVE)) {
+        return;
+    }
+    uint32_t xcr0Lo, xcr0Hi;
+    __asm__ volatile("xgetbv" : "=a"(xcr0Lo), "=d"(xcr0Hi) : "c"(0));
+    // CPUID.(EAX=0xD,ECX=0):EBX is the size of the area for the components
+    // currently enabled in XCR0.
+    if (!__get_cpuid_count(0xd, 0, &eax, &ebx, &ecx, &edx) || ebx == 0) {
+        return;
+    }
+    _shim_rdtsc_xsave_mask = ((uint64_t)xcr0Hi << 32) | xcr0Lo;
+    _shim_rdtsc_xsave_size = ((uint64_t)ebx + 63) & ~(uint64_t)63;
+    trace("Saving xsave components %#lx (%lu bytes) in rdtsc trampolines",
+          _shim_rdtsc_xsave_mask, _shim_rdtsc_xsave_size);
+}
+
+// Trampolines that a patched rdtsc or rdtscp site ends up calling (via a
+// per-site stub; see `_shim_rdtsc_try_patch`). They preserve all registers and
+// flags other than the instruction's outputs, including all of the extended
+// (x87, SSE, AVX, AVX-512, ...) state, since the emulation may use it. That
+// state is saved with xsave to a 64-byte aligned area on the stack, whose
+// header must be zeroed first for xrstor to accept it.
+//
+// Stack layout relative to %rbx after the pushes: saved rbx at 0, r11 at 8,
+// ..., rcx at 56, flags at 64, return address at 72. The emulation's outputs
+// are at %rsp during the call, and the xsave area just above them.
+#define SHIM_RDTSC_TRAMPOLINE(name, isRdtscp, setRcx)                                          \
+    ".pushsection .text\n"                                                                     \
+    ".globl " name "\n"                                                                        \
+    ".hidden " name "\n"                                                                       \
+    ".type " name ", @function\n" name ":\n"                                                   \
+    "pushfq\n"                                                                                 \
+    "cld\n"                                                                                    \
+    "push %rcx\n"                                                                              \
+    "push %rsi\n"                                                                              \
+    "push %rdi\n"                                                                              \
+    "push %r8\n"                                                                               \
+    "push %r9\n"                                                                               \
+    "push %r10\n"                                                                              \
+    "push %r11\n"                                                                              \
+    "push %rbx\n"                                                                              \
+    "mov %rsp, %rbx\n"                                                                         \
+    "sub _shim_rdtsc_xsave_size(%rip), %rsp\n"                                                 \
+    "and $-64, %rsp\n"                                                                         \
+    "lea 512(%rsp), %rdi\n"                                                                    \
+    "xor %eax, %eax\n"                                                                         \
+    "mov $8, %ecx\n"                                                                           \
+    "rep stosq\n"                                                                              \
+    "mov _shim_rdtsc_xsave_mask(%rip), %eax\n"                                                 \
+    "mov 4+_shim_rdtsc_xsave_mask(%rip), %edx\n"                                               \
+    "xsave64 (%rsp)\n"                                                                         \
+    "sub $32, %rsp\n"                                                                          \
+    "mov %rsp, %rdi\n"                                                                         \
+    "mov $" isRdtscp ", %esi\n"                                                                \
+    "call _shim_rdtsc_emulate_for_trampoline\n"                                                \
+    "mov _shim_rdtsc_xsave_mask(%rip), %eax\n"                                                 \
+    "mov 4+_shim_rdtsc_xsave_mask(%rip), %edx\n"                                               \
+    "xrstor64 32(%rsp)\n"                                                                      \
+    "mov (%rsp), %rax\n"                                                                       \
+    "mov 8(%rsp), %rdx\n" setRcx "mov %rbx, %rsp\n"                                            \
+    "pop %rbx\n"                                                                               \
+    "pop %r11\n"                                                                               \
+    "pop %r10\n"                                                                               \
+    "pop %r9\n"                                                                                \
+    "pop %r8\n"                                                                                \
+    "pop %rdi\n"                                                                               \
+    "pop %rsi\n"                                                                               \
+    "pop %rcx\n"                                                                               \
+    "popfq\n"                                                                                  \
+    "ret\n"                                                                                    \
+    ".size " name ", .-" name "\n"                                                             \
+    ".popsection\n"
+
+__asm__(SHIM_RDTSC_TRAMPOLINE("_shim_rdtsc_trampoline", "0", ""));
+__asm__(SHIM_RDTSC_TRAMPOLINE("_shim_rdtscp_trampoline", "1",
+                              "mov 16(%rsp), %rcx\nmov %rcx, 56(%rbx)\n"));
+
+__attribute__((visibility("hidden"))) void _shim_rdtsc_trampoline(void);
+__attribute__((visibility("hidden"))) void _shim_rdtscp_trampoline(void);
+
+// Per-site stubs are allocated from an arena within a 32-bit offset of the
+// sites that jump to them. Only one thread of a process runs at a time, so no
+// locking is needed.
+#define STUB_ARENA_SIZE (64 * 1024)
+static uint8_t* _stub_arena = NULL;
+static size_t _stub_arena_used = 0;
+
+// The jump written into the padding after a function.
+#define CAVE_SIZE 5
+
+static bool _fits_rel32(const void* nextInsn, const void* target) {
+    intptr_t offset = (intptr_t)target - (intptr_t)nextInsn;
+    return offset >= INT32_MIN && offset <= INT32_MAX;
+}
+
+static uint8_t* _alloc_stub(const void* near, size_t size) {
+    if (_stub_arena == NULL || _stub_arena_used + size > STUB_ARENA_SIZE ||
+        !_fits_rel32(near, _stub_arena) || !_fits_rel32(near, _stub_arena + STUB_ARENA_SIZE)) {
+        _stub_arena = NULL;
+        _stub_arena_used = 0;
+        // Look for a free region below, then above, `near`.
+        for (int i = 1; i <= 16 && _stub_arena == NULL; ++i) {
+            intptr_t delta = (intptr_t)i * (64l << 20);
+            uintptr_t base = (uintptr_t)near & ~(uintptr_t)(STUB_ARENA_SIZE - 1);
+            for (int sign = -1; sign <= 1 && _stub_arena == NULL; sign += 2) {
+                void* hint = (void*)(base + sign * delta);
+                void* arena = mmap(hint, STUB_ARENA_SIZE, PROT_READ | PROT_EXEC,
+                                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+                if (arena == MAP_FAILED) {
+                    continue;
+                }
+                if (!_fits_rel32(near, arena) ||
+                    !_fits_rel32(near, (uint8_t*)arena + STUB_ARENA_SIZE)) {
+                    munmap(arena, STUB_ARENA_SIZE);
+                    continue;
+                }
+                _stub_arena = arena;
+            }
+        }
+        if (_stub_arena == NULL) {
+            return NULL;
+        }
+    }
+    uint8_t* stub = _stub_arena + _stub_arena_used;
+    _stub_arena_used += size;
+    return stub;
+}
+
+// A file-backed mapping of the process, from /proc/self/maps.
+typedef struct _ShimRdtscMapping {
+    uintptr_t start;
+    uintptr_t end;
+    int prot;
+    uint64_t offset;
+    char path[PATH_MAX];
+} ShimRdtscMapping;
+
+static bool _shim_rdtsc_parse_maps_line(const char* line, ShimRdtscMapping* mapping) {
+    char* p;
+    mapping->start = strtoul(line, &p, 16);
+    if (*p++ != '-') {
+        return false;
+    }
+    mapping->end = strtoul(p, &p, 16);
+    if (*p++ != ' ' || strlen(p) < 5) {
+        return false;
+    }
+    mapping->prot = (p[0] == 'r' ? PROT_READ : 0) | (p[1] == 'w' ? PROT_WRITE : 0) |
+                    (p[2] == 'x' ? PROT_EXEC : 0);
+    p += 4;
+    mapping->offset = strtoull(p, &p, 16);
+    // Skip the device and inode.
+    for (int i = 0; i < 2; ++i) {
+        while (*p == ' ') {
+            ++p;
+        }
+        while (*p != ' ' && *p != '\0') {
+            ++p;
+        }
+    }
+    while (*p == ' ') {
+        ++p;
+    }
+    // Anonymous mappings and ones like [vdso] have no file to read symbols from.
+    if (*p != '/' || strlen(p) >= sizeof(mapping->path)) {
+        return false;
+    }
+    strcpy(mapping->path, p);
+    return true;
+}
+
+// Finds the file-backed mapping containing `addr`. This reads /proc/self/maps
+// rather than asking the dynamic loader, since the rdtsc may have trapped while
+// the loader's lock was held.
+static bool _shim_rdtsc_find_mapping(uintptr_t addr, ShimRdtscMapping* mapping) {
+    int fd = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        trace("open /proc/self/maps: %s", strerror(errno));
+        return false;
+    }
+
+    char buf[PATH_MAX + 256];
+    size_t len = 0;
+    bool found = false;
+    while (!found) {
+        ssize_t n = read(fd, buf + len, sizeof(buf) - 1 - len);
+        if (n <= 0) {
+            break;
+        }
+        len += n;
+        buf[len] = '\0';
+
+        char* line = buf;
+        char* newline;
+        while (!found && (newline = strchr(line, '\n')) != NULL) {
+            *newline = '\0';
+            found = _shim_rdtsc_parse_maps_line(line, mapping) && mapping->start <= addr &&
+                    addr < mapping->end;
+            line = newline + 1;
+        }
+        // Keep the start of an incomplete line for the next read.
+        len -= line - buf;
+        memmove(buf, line, len);
+        if (len == sizeof(buf) - 1) {
+            // A line too long to be a mapping we can use.
+            len = 0;
+        }
+    }
+
+    close(fd);
+    return found;
+}
+
+// Finds CAVE_SIZE int3 bytes after the end of a function in the ELF file `elf`
+// (of size `elfSize`) that no symbol covers, and that are within reach of a
+// rel8 jump from the instruction ending at file offset `siteEndOffset`. Returns
+// their file offset, or 0 if there are none. Only the full symbol table is
+// used: in a stripped file, .dynsym omits local functions, so a gap between two
+// exported functions may contain code.
+static uint64_t _shim_rdtsc_find_padding(const uint8_t* elf, size_t elfSize,
+                                         uint64_t siteEndOffset) {
+    const Elf64_Ehdr* ehdr = (const Elf64_Ehdr*)elf;
+    if (elfSize < sizeof(*ehdr) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+        ehdr->e_ident[EI_CLASS] != ELFCLASS64 || ehdr->e_shentsize != sizeof(Elf64_Shdr) ||
+        ehdr->e_shoff > elfSize ||
+        ehdr->e_shnum > (elfSize - ehdr->e_shoff) / sizeof(Elf64_Shdr)) {
+        return 0;
+    }
+    const Elf64_Shdr* shdrs = (const Elf64_Shdr*)(elf + ehdr->e_shoff);
+
+    const Elf64_Sym* syms = NULL;
+    size_t numSyms = 0;
+    for (size_t i = 0; i < ehdr->e_shnum; ++i) {
+        if (shdrs[i].sh_type == SHT_SYMTAB && shdrs[i].sh_offset <= elfSize &&
+            shdrs[i].sh_size <= elfSize - shdrs[i].sh_offset) {
+            syms = (const Elf64_Sym*)(elf + shdrs[i].sh_offset);
+            numSyms = shdrs[i].sh_size / sizeof(Elf64_Sym);
+            break;
+        }
+    }
+    if (syms == NULL) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < numSyms; ++i) {
+        const Elf64_Sym* func = &syms[i];
+        if (ELF64_ST_TYPE(func->st_info) != STT_FUNC || func->st_size == 0 ||
+            func->st_shndx == SHN_UNDEF || func->st_shndx >= ehdr->e_shnum) {
+            continue;
+        }
+        const Elf64_Shdr* text = &shdrs[func->st_shndx];
+        if (text->sh_type != SHT_PROGBITS || !(text->sh_flags & SHF_EXECINSTR) ||
+            text->sh_offset > elfSize || text->sh_size > elfSize - text->sh_offset) {
+            continue;
+        }
+
+        // The padding runs from the end of the function to the next symbol in
+        // the same section, or to the end of the section.
+        uint64_t gapStart = func->st_value + func->st_size;
+        uint64_t gapEnd = text->sh_addr + text->sh_size;
+        uint64_t gapStartOffset = gapStart - text->sh_addr + text->sh_offset;
+        if (gapStart + CAVE_SIZE > gapEnd || gapStartOffset > siteEndOffset + INT8_MAX ||
+            gapStartOffset + (gapEnd - gapStart) < siteEndOffset + INT8_MIN + CAVE_SIZE) {
+            continue;
+        }
+        for (size_t j = 0; j < numSyms && gapStart < gapEnd; ++j) {
+            const Elf64_Sym* sym = &syms[j];
+            // Zero-sized symbols (e.g. labels in assembly) still mark code.
+            uint64_t symEnd = sym->st_value + (sym->st_size > 0 ? sym->st_size : 1);
+            if (sym->st_shndx != func->st_shndx || symEnd <= gapStart ||
+                sym->st_value >= gapEnd) {
+                continue;
+            }
+            gapEnd = sym->st_value > gapStart ? sym->st_value : gapStart;
+        }
+
+        for (uint64_t c = gapStart; c + CAVE_SIZE <= gapEnd; ++c) {
+            uint64_t cOffset = c - text->sh_addr + text->sh_offset;
+            int64_t jump = (int64_t)cOffset - (int64_t)siteEndOffset;
+            if (jump > INT8_MAX) {
+                break;
+            }
+            if (jump < INT8_MIN) {
+                continue;
+            }
+            bool isPadding = true;
+            for (size_t k = 0; k < CAVE_SIZE; ++k) {
+                isPadding = isPadding && elf[cOffset + k] == 0xcc;
+            }
+            if (isPadding) {
+                return cOffset;
+            }
+        }
+    }
+    return 0;
+}
+
+// Finds padding after the end of a function, within reach of a rel8 jump from
+// `siteEnd`, that can hold a CAVE_SIZE-byte jump. Returns NULL if there is
+// none. The padding must be shown to be outside of every function by the
+// symbol table of the file that the site was loaded from, and still be int3s in
+// memory, so that a stale or wrong symbol table can't lead to overwriting code.
+static uint8_t* _shim_rdtsc_find_cave(const uint8_t* siteEnd, ShimRdtscMapping* mapping) {
+    if (!_shim_rdtsc_find_mapping((uintptr_t)siteEnd - 1, mapping)) {
+        return NULL;
+    }
+
+    int fd = open(mapping->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        trace("open %s: %s", mapping->path, strerror(errno));
+        return NULL;
+    }
+    struct stat st;
+    void* elf = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        elf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (elf == MAP_FAILED) {
+        return NULL;
+    }
+
+    uint64_t siteEndOffset = (uintptr_t)siteEnd - mapping->start + mapping->offset;
+    uint64_t caveOffset = _shim_rdtsc_find_padding(elf, st.st_size, siteEndOffset);
+    munmap(elf, st.st_size);
+
+    if (caveOffset == 0) {
+        return NULL;
+    }
+    uint8_t* cave = (uint8_t*)(mapping->start + (caveOffset - mapping->offset));
+    if (caveOffset < mapping->offset || (uintptr_t)cave + CAVE_SIZE > mapping->end) {
+        return NULL;
+    }
+    for (size_t i = 0; i < CAVE_SIZE; ++i) {
+        if (cave[i] != 0xcc) {
+            return NULL;
+        }
+    }
+    return cave;
+}
+
+// Try to rewrite the `insnLen`-byte rdtsc or rdtscp instruction at `insn` into
+// a jump to a stub that calls `trampoline`:
+//
+//   site: jmp cave (2 bytes, rel8)
+//   cave: jmp stub (5 bytes, rel32; in int3 padding after a nearby function)
+//   stub: lea -128(%rsp), %rsp   ; skip the red zone
+//         call *trampoline(%rip)
+//         lea 128(%rsp), %rsp
+//         jmp site+insnLen
+//
+// Returns whether the site was rewritten.
+static bool _shim_rdtsc_try_patch(uint8_t* insn, size_t insnLen, void (*trampoline)(void)) {
+    uint8_t* siteEnd = insn + 2;
+
+    if (_shim_rdtsc_xsave_size == 0) {
+        trace("Not patching rdtsc at %p without xsave", insn);
+        return false;
+    }
+
+    ShimRdtscMapping mapping;
+    uint8_t* cave = _shim_rdtsc_find_cave(siteEnd, &mapping);
+    if (cave == NULL || insn < (uint8_t*)mapping.start ||
+        insn + insnLen > (uint8_t*)mapping.end) {
+        trace("No padding near rdtsc at %p", insn);
+        return false;
+    }
+
+    const uint8_t stubTemplate[] = {
+        // lea -0x80(%rsp), %rsp
+        0x48, 0x8d, 0x64, 0x24, 0x80,
+        // call *0xd(%rip)
+        0xff, 0x15, 0x0d, 0x00, 0x00, 0x00,
+        // lea 0x80(%rsp), %rsp
+        0x48, 0x8d, 0xa4, 0x24, 0x80, 0x00, 0x00, 0x00,
+        // jmp <rel32, filled in below>
+        0xe9, 0x00, 0x00, 0x00, 0x00,
+        // trampoline address, filled in below
+    };
+    const size_t jmpOffset = 19;
+    const size_t stubSize = sizeof(stubTemplate) + sizeof(void*);
+
+    uint8_t* stub = _alloc_stub(cave, stubSize);
+    if (stub == NULL || !_fits_rel32(stub + jmpOffset + 5, insn + insnLen)) {
+        trace("Couldn't allocate a stub near rdtsc at %p", insn);
+        return false;
+    }
+    if (mprotect(_stub_arena, STUB_ARENA_SIZE, PROT_READ | PROT_WRITE)) {
+        trace("mprotect: %s", strerror(errno));
+        return false;
+    }
+    memcpy(stub, stubTemplate, sizeof(stubTemplate));
+    int32_t backOffset = (int32_t)((intptr_t)(insn + insnLen) - (intptr_t)(stub + jmpOffset + 5));
+    memcpy(&stub[jmpOffset + 1], &backOffset, sizeof(backOffset));
+    void* trampolineAddr = trampoline;
+    memcpy(&stub[sizeof(stubTemplate)], &trampolineAddr, sizeof(trampolineAddr));
+    if (mprotect(_stub_arena, STUB_ARENA_SIZE, PROT_READ | PROT_EXEC)) {
+        panic("mprotect: %s", strerror(errno));
+    }
+
+    // The site and the cave may be on different pages of the same mapping.
+    long pageSize = sysconf(_SC_PAGESIZE);
+    uint8_t* lo = (cave < insn) ? cave : insn;
+    uint8_t* hi = (cave + CAVE_SIZE > insn + insnLen) ? cave + CAVE_SIZE : insn + insnLen;
+    uint8_t* pages = (uint8_t*)((uintptr_t)lo & ~(uintptr_t)(pageSize - 1));
+    size_t pagesLen = (size_t)(hi - pages);
+    if (mprotect(pages, pagesLen, mapping.prot | PROT_WRITE)) {
+        trace("mprotect: %s", strerror(errno));
+        return false;
+    }
+
+    int32_t caveOffset = (int32_t)((intptr_t)stub - (intptr_t)(cave + CAVE_SIZE));
+    cave[0] = 0xe9;
+    memcpy(&cave[1], &caveOffset, sizeof(caveOffset));
+
+    // Only one thread of the process runs at a time, and none of the others
+    // can be stopped in the middle of this instruction, so it's safe to
+    // overwrite it non-atomically. Any remaining byte is never executed.
+    insn[0] = 0xeb;
+    insn[1] = (uint8_t)(int8_t)(cave - siteEnd);
+    for (size_t i = 2; i < insnLen; ++i) {
+        insn[i] = 0x90;
+    }
+
+    // Restore the mapping's own protections, normally R-X.
+    if (mprotect(pages, pagesLen, mapping.prot)) {
+        panic("mprotect: %s", strerror(errno));
+    }
+
+    trace("Patched rdtsc at %p via %p to stub %p", insn, cave, stub);
+    return true;
+}
+
+static void _shim_rdtsc_handle_sigsegv(int sig, siginfo_t* info, void* voidUcontext) {
+    bool oldNativeSyscallFlag = shim_swapAllowNativeSyscalls(true);
+    trace("Trapped sigsegv");
+    const Tsc* tsc = _shim_rdtsc_tsc();
+    const ShimShmemManager* manager = shim_managerSharedMem();
+    bool patch = manager && shimshmem_getPatchRdtscSites(manager);
 
     bool handled = false;
 
@@ -70,22 +547,28 @@ static void _shim_rdtsc_handle_sigsegv(int sig, siginfo_t* info, void* voidUcont
             uint64_t nanos = _shim_rdtsc_nanos(oldNativeSyscallFlag);
             uint64_t rax, rdx;
             uint64_t rip = regs[REG_RIP];
-            Tsc_emulateRdtsc(&tsc, &rax, &rdx, &rip, nanos);
+            Tsc_emulateRdtsc(tsc, &rax, &rdx, &rip, nanos);
             regs[REG_RDX] = rdx;
             regs[REG_RAX] = rax;
             regs[REG_RIP] = rip;
             handled = true;
+            if (patch) {
+                _shim_rdtsc_try_patch(insn, 2, _shim_rdtsc_trampoline);
+            }
         } else if (isRdtscp(insn)) {
             trace("Emulating rdtscp");
             uint64_t nanos = _shim_rdtsc_nanos(oldNativeSyscallFlag);
             uint64_t rax, rdx, rcx;
             uint64_t rip = regs[REG_RIP];
-            Tsc_emulateRdtscp(&tsc, &rax, &rdx, &rcx, &rip, nanos);
+            Tsc_emulateRdtscp(tsc, &rax, &rdx, &rcx, &rip, nanos);
             regs[REG_RDX] = rdx;
             regs[REG_RAX] = rax;
             regs[REG_RCX] = rcx;
             regs[REG_RIP] = rip;
             handled = true;
+            if (patch) {
+                _shim_rdtsc_try_patch(insn, 3, _shim_rdtscp_trampoline);
+            }
         }
     }
 
@@ -101,6 +584,8 @@ static void _shim_rdtsc_handle_sigsegv(int sig, siginfo_t* info, void* voidUcont
 }
 
 void shim_rdtsc_init() {
+    _shim_rdtsc_init_xsave();
+
     // Force a SEGV on any rdtsc or rdtscp instruction.
     if (prctl(PR_SET_TSC, PR_TSC_SIGSEGV) < 0) {
         panic("pctl: %s", strerror(errno));
@@ -19,6 +19,8 @@
 #include <unistd.h>
 
 #include "lib/logger/logger.h"
+#include "lib/shadow-shim-helper-rs/shim_helper.h"
+#include "lib/shim/shim.h"
 #include "lib/shim/shim_syscall.h"
 #include "lib/shim/shim_tls.h"
 
@@ -31,6 +33,9 @@ static void* TEXT_START = NULL;
 // one thread.
 static void* TEXT_END = NULL;
 #define SIZEOF_SYSCALL_INSN 2
+// Syscall numbers that may be configured to bypass the filter. Matches the
+// size of the bitmap in `ManagerShmem`.
+#define MAX_PASSTHROUGH_SYSCALL 512
 
 // Handler function that receives syscalls that are stopped by the seccomp filter.
 static void _shim_seccomp_handle_sigsys(int sig, siginfo_t* info, void* voidUcontext) {
@@ -184,13 +189,26 @@ void shim_seccomp_init() {
      * version 5.11, though.
      * https://www.kernel.org/doc./html/latest/admin-guide/syscall-user-dispatch.html
      */
-    struct sock_filter filter[] = {
+    struct sock_filter filter_head[] = {
         /* accumulator := syscall number */
         BPF_STMT(BPF_LD + BPF_W + BPF_ABS, offsetof(struct seccomp_data, nr)),
 
         /* Always allow sigreturn; otherwise we'd crash returning from our signal handler. */
         BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, SYS_rt_sigreturn, /*true-skip=*/0, /*false-skip=*/1),
         BPF_STMT(BPF_RET + BPF_K, SECCOMP_RET_ALLOW),
+    };
+
+    /* Followed by a pair of instructions for each syscall configured to go
+     * straight to the kernel (experimental.native_syscall_passthrough):
+     *
+     * if (nr == passthrough_nr) allow;
+     *
+     * The accumulator still holds the syscall number at this point. These are
+     * placed before the instruction pointer checks, so that they don't affect
+     * the relative jumps below.
+     */
+
+    struct sock_filter filter_tail[] = {
 
     /* This block was intended to whitelist reads and writes to a socket
      * used to communicate with Shadow. It turns out to be unnecessary though,
@@ -267,8 +285,31 @@ void shim_seccomp_init() {
         /* Allow  */
         BPF_STMT(BPF_RET + BPF_K, SECCOMP_RET_ALLOW),
     };
+
+    const size_t head_len = sizeof(filter_head) / sizeof(filter_head[0]);
+    const size_t tail_len = sizeof(filter_tail) / sizeof(filter_tail[0]);
+    struct sock_filter filter[head_len + 2 * MAX_PASSTHROUGH_SYSCALL + tail_len];
+    size_t len = 0;
+
+    memcpy(&filter[len], filter_head, sizeof(filter_head));
+    len += head_len;
+
+    const ShimShmemManager* manager = shim_managerSharedMem();
+    for (uint32_t nr = 0; manager && nr < MAX_PASSTHROUGH_SYSCALL; ++nr) {
+        if (!shimshmem_getNativeSyscallPassthrough(manager, nr)) {
+            continue;
+        }
+        trace("Letting syscall %" PRIu32 " bypass the seccomp filter", nr);
+        filter[len++] = (struct sock_filter)BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, nr,
+                                                     /*true-skip=*/0, /*false-skip=*/1);
+        filter[len++] = (struct sock_filter)BPF_STMT(BPF_RET + BPF_K, SECCOMP_RET_ALLOW);
+    }
+
+    memcpy(&filter[len], filter_tail, sizeof(filter_tail));
+    len += tail_len;
+
     struct sock_fprog prog = {
-        .len = (unsigned short)(sizeof(filter) / sizeof(filter[0])),
+        .len = (unsigned short)len,
         .filter = filter,
     };
 
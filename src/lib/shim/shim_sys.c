@@ -5,11 +5,14 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <linux/futex.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/param.h>
+#include <sys/random.h>
+#include <sys/socket.h>
 #include <sys/syscall.h>
 #include <sys/time.h>
 #include <time.h>
@@ -20,6 +23,7 @@
 #include "lib/shim/shim.h"
 #include "lib/shim/shim_api.h"
 #include "lib/shim/shim_sys.h"
+#include "lib/shim/shim_syscall.h"
 #include "main/host/syscall_numbers.h"
 
 static CEmulatedTime _shim_sys_get_time() {
@@ -58,6 +62,101 @@ static CSimulationTime _shim_sys_latency_for_syscall(long n) {
     return shimshmem_unblockedSyscallLatency(shim_hostSharedMem());
 }
 
+static void _shim_sys_fill_timespec(CEmulatedTime emulated_time, struct timespec* tp) {
+    *tp = (struct timespec){
+        .tv_sec = emulated_time / SIMTIME_ONE_SECOND,
+        .tv_nsec = emulated_time % SIMTIME_ONE_SECOND,
+    };
+}
+
+static void _shim_sys_fill_timeval(CEmulatedTime emulated_time, struct timeval* tv) {
+    uint64_t micros = emulated_time / SIMTIME_ONE_MICROSECOND;
+    tv->tv_sec = micros / 1000000;
+    tv->tv_usec = micros % 1000000;
+}
+
+static void _shim_sys_finish_local_syscall(long syscall_num, const char* syscallName, long rv);
+
+// Sleeps until `wakeup` without involving Shadow, by moving the emulated time
+// forward in shared memory. That's only equivalent to Shadow blocking the
+// thread if nothing else on the host would run before the thread wakes up,
+// which is what the max runahead time bounds; so this is only possible for
+// short sleeps. Returns false if the sleep has to be left to Shadow.
+static bool _shim_sys_try_sleep_locally(CEmulatedTime wakeup) {
+    // Shadow would interrupt the sleep to deliver the signal.
+    if (shimshmem_getUnblockedSignalPending(shim_threadSharedMem())) {
+        return false;
+    }
+
+    const ShimShmemHost* mem = shim_hostSharedMem();
+    if (wakeup > shimshmem_getMaxRunaheadTime(mem)) {
+        return false;
+    }
+
+    // A wakeup time in the past means we return without sleeping. Any
+    // unapplied latency is left to be applied as usual, as it would be if
+    // Shadow had blocked the thread.
+    if (wakeup > _shim_sys_get_time()) {
+        shimshmem_setEmulatedTime(mem, wakeup);
+    }
+
+    return true;
+}
+
+// Reads a sleep duration or absolute time; returns false if it's invalid, in
+// which case the error is left to Shadow.
+static bool _shim_sys_read_sleep_time(const struct timespec* ts, CSimulationTime* t) {
+    if (ts == NULL || ts->tv_sec < 0 || ts->tv_nsec < 0 || ts->tv_nsec >= SIMTIME_ONE_SECOND ||
+        ts->tv_sec > (SIMTIME_MAX / SIMTIME_ONE_SECOND) - 1) {
+        return false;
+    }
+    *t = ts->tv_sec * SIMTIME_ONE_SECOND + ts->tv_nsec;
+    return true;
+}
+
+bool shim_sys_try_clock_gettime(clockid_t clk_id, struct timespec* tp) {
+    shim_ensure_init();
+
+    // Errors are rare, so leave them to the generic path.
+    if (!shim_interpositionEnabled() || clk_id < LINUX_CLOCK_REALTIME ||
+        clk_id > LINUX_CLOCK_TAI || tp == NULL) {
+        return false;
+    }
+
+    _shim_sys_fill_timespec(_shim_sys_get_time(), tp);
+    _shim_sys_finish_local_syscall(SYS_clock_gettime, "clock_gettime", 0);
+    return true;
+}
+
+bool shim_sys_try_gettimeofday(struct timeval* tv) {
+    shim_ensure_init();
+
+    if (!shim_interpositionEnabled()) {
+        return false;
+    }
+
+    if (tv) {
+        _shim_sys_fill_timeval(_shim_sys_get_time(), tv);
+    }
+    _shim_sys_finish_local_syscall(SYS_gettimeofday, "gettimeofday", 0);
+    return true;
+}
+
+bool shim_sys_try_time(time_t* tp, time_t* rv) {
+    shim_ensure_init();
+
+    if (!shim_interpositionEnabled()) {
+        return false;
+    }
+
+    *rv = _shim_sys_get_time() / SIMTIME_ONE_SECOND;
+    if (tp) {
+        *tp = *rv;
+    }
+    _shim_sys_finish_local_syscall(SYS_time, "time", *rv);
+    return true;
+}
+
 bool shim_sys_handle_syscall_locally(long syscall_num, long* rv, va_list args) {
     // This function is called on every syscall operation so be careful not to doing
     // anything too expensive outside of the switch cases.
@@ -79,10 +178,7 @@ bool shim_sys_handle_syscall_locally(long syscall_num, long* rv, va_list args) {
                 trace("found invalid clock id %ld", (long)clk_id);
                 *rv = -EINVAL;
             } else if (tp) {
-                *tp = (struct timespec){
-                    .tv_sec = emulated_time / SIMTIME_ONE_SECOND,
-                    .tv_nsec = emulated_time % SIMTIME_ONE_SECOND,
-                };
+                _shim_sys_fill_timespec(emulated_time, tp);
                 trace("clock_gettime() successfully copied time");
                 *rv = 0;
             } else {
@@ -116,15 +212,13 @@ bool shim_sys_handle_syscall_locally(long syscall_num, long* rv, va_list args) {
             syscallName = "gettimeofday";
 
             CEmulatedTime emulated_time = _shim_sys_get_time();
-            uint64_t micros = emulated_time / SIMTIME_ONE_MICROSECOND;
 
             trace("servicing syscall %ld:gettimeofday from the shim", syscall_num);
 
             struct timeval* tp = va_arg(args, struct timeval*);
 
             if (tp) {
-                tp->tv_sec = micros / 1000000;
-                tp->tv_usec = micros % 1000000;
+                _shim_sys_fill_timeval(emulated_time, tp);
                 trace("gettimeofday() successfully copied time");
             }
             *rv = 0;
@@ -132,6 +226,198 @@ bool shim_sys_handle_syscall_locally(long syscall_num, long* rv, va_list args) {
             break;
         }
 
+        case SYS_futex: {
+            // Read the args from a copy, so that they're still there for
+            // Shadow if we can't handle the syscall here.
+            va_list futex_args;
+            va_copy(futex_args, args);
+            uintptr_t uaddr = va_arg(futex_args, uintptr_t);
+            int futex_op = va_arg(futex_args, long);
+            (void)va_arg(futex_args, long);  // val
+            (void)va_arg(futex_args, long);  // timeout
+            (void)va_arg(futex_args, long);  // uaddr2
+            uint32_t val3 = va_arg(futex_args, long);
+            va_end(futex_args);
+
+            // Match the operations that Shadow's futex handler treats as wakes
+            // of the futex at `uaddr` only.
+            int operation = futex_op & ~(FUTEX_PRIVATE_FLAG | FUTEX_CLOCK_REALTIME);
+            bool is_wake = operation == FUTEX_WAKE ||
+                           (operation == FUTEX_WAKE_BITSET && val3 == FUTEX_BITSET_MATCH_ANY);
+
+            // A word of a shared futex is identified by the memory it's in,
+            // which may be mapped at other addresses in other processes, so
+            // only Shadow can tell whether anyone waits on it.
+            if (!is_wake || !(futex_op & FUTEX_PRIVATE_FLAG)) {
+                return false;
+            }
+
+            // Shadow only runs while no managed thread on this host runs, so
+            // if nobody is waiting on the futex now, nobody can start waiting
+            // before the wake would have been handled.
+            if (shimshmem_futexMayHaveWaiters(
+                    shim_hostSharedMem(), shim_processSharedMem(), uaddr)) {
+                return false;
+            }
+
+            syscallName = "futex";
+            trace("servicing syscall %ld:futex wake with no waiters from the shim", syscall_num);
+            *rv = 0;
+
+            break;
+        }
+
+        case SYS_read:
+        case SYS_recvfrom: {
+            va_list read_args;
+            va_copy(read_args, args);
+            int fd = va_arg(read_args, long);
+            (void)va_arg(read_args, long);  // buf
+            size_t len = va_arg(read_args, size_t);
+            int flags = syscall_num == SYS_recvfrom ? va_arg(read_args, long) : 0;
+            va_end(read_args);
+
+            // Shadow only marks descriptors of non-blocking files, after a read
+            // of them failed with EAGAIN. Leave anything that might behave
+            // differently from that read to Shadow.
+            if (len == 0 || (flags & ~MSG_DONTWAIT) != 0 ||
+                !shimshmem_readWouldBlock(shim_hostSharedMem(), shim_processSharedMem(), fd)) {
+                return false;
+            }
+
+            syscallName = syscall_num == SYS_read ? "read" : "recvfrom";
+            trace("servicing syscall %ld:%s on empty non-blocking fd %d from the shim",
+                  syscall_num, syscallName, fd);
+            *rv = -EAGAIN;
+
+            break;
+        }
+
+        case SYS_getpid: {
+            syscallName = "getpid";
+            *rv = shimshmem_getProcessId(shim_processSharedMem());
+            break;
+        }
+
+        case SYS_getppid: {
+            syscallName = "getppid";
+            *rv = shimshmem_getProcessParentId(shim_processSharedMem());
+            break;
+        }
+
+        case SYS_gettid: {
+            syscallName = "gettid";
+            *rv = shimshmem_getThreadId(shim_threadSharedMem());
+            break;
+        }
+
+        case SYS_getuid:
+        case SYS_geteuid: {
+            syscallName = syscall_num == SYS_getuid ? "getuid" : "geteuid";
+
+            // Shadow would have us make these natively anyway.
+            *rv = shim_native_syscall(NULL, syscall_num);
+            break;
+        }
+
+        case SYS_uname: {
+            va_list uname_args;
+            va_copy(uname_args, args);
+            struct linux_new_utsname* name = va_arg(uname_args, struct linux_new_utsname*);
+            va_end(uname_args);
+
+            syscallName = "uname";
+
+            // The native uname checks the buffer for us: it fails with EFAULT
+            // instead of crashing if the buffer isn't writable. What it writes
+            // is then replaced by Shadow's utsname.
+            long nativeRv = shim_native_syscall(NULL, SYS_uname, name);
+            if (nativeRv != 0) {
+                trace("found invalid utsname pointer in uname");
+                *rv = nativeRv;
+                break;
+            }
+
+            *name = *shimshmem_getUtsname(shim_hostSharedMem());
+            *rv = 0;
+            break;
+        }
+
+        case SYS_sched_getaffinity: {
+            va_list affinity_args;
+            va_copy(affinity_args, args);
+            pid_t tid = va_arg(affinity_args, long);
+            size_t cpusetsize = va_arg(affinity_args, size_t);
+            unsigned char* mask = va_arg(affinity_args, unsigned char*);
+            va_end(affinity_args);
+
+            // Other threads, and errors other than an invalid mask, are left
+            // to Shadow.
+            if ((tid != 0 && tid != shimshmem_getThreadId(shim_threadSharedMem())) ||
+                cpusetsize == 0) {
+                return false;
+            }
+
+            syscallName = "sched_getaffinity";
+
+            // Check that the first byte of the mask is writable, by having the
+            // kernel write to it: a 1-byte getrandom fails with EFAULT instead
+            // of crashing if it isn't.
+            long nativeRv = shim_native_syscall(NULL, SYS_getrandom, mask, 1, GRND_NONBLOCK);
+            if (nativeRv == -EFAULT) {
+                trace("found invalid mask pointer in sched_getaffinity");
+                *rv = -EFAULT;
+                break;
+            } else if (nativeRv != 1) {
+                return false;
+            }
+
+            // Like Shadow, report a single CPU. This assumes little endian.
+            mask[0] = 1;
+            *rv = 1;
+            break;
+        }
+
+        case SYS_nanosleep:
+        case SYS_clock_nanosleep: {
+            va_list sleep_args;
+            va_copy(sleep_args, args);
+            clockid_t clk_id = LINUX_CLOCK_MONOTONIC;
+            int flags = 0;
+            if (syscall_num == SYS_clock_nanosleep) {
+                clk_id = va_arg(sleep_args, long);
+                flags = va_arg(sleep_args, long);
+            }
+            const struct timespec* request = va_arg(sleep_args, const struct timespec*);
+            va_end(sleep_args);
+
+            // Leave the alarm clocks, unknown flags, and errors to Shadow.
+            if ((clk_id != LINUX_CLOCK_REALTIME && clk_id != LINUX_CLOCK_MONOTONIC &&
+                 clk_id != LINUX_CLOCK_BOOTTIME && clk_id != LINUX_CLOCK_TAI) ||
+                (flags & ~TIMER_ABSTIME) != 0) {
+                return false;
+            }
+
+            CSimulationTime request_time;
+            if (!_shim_sys_read_sleep_time(request, &request_time)) {
+                return false;
+            }
+
+            // Shadow uses the same time for every clock.
+            CEmulatedTime wakeup = (flags & TIMER_ABSTIME)
+                                       ? emutime_add_simtime(EMUTIME_UNIX_EPOCH, request_time)
+                                       : emutime_add_simtime(_shim_sys_get_time(), request_time);
+            if (wakeup == EMUTIME_INVALID || !_shim_sys_try_sleep_locally(wakeup)) {
+                return false;
+            }
+
+            syscallName = syscall_num == SYS_nanosleep ? "nanosleep" : "clock_nanosleep";
+            trace("servicing syscall %ld:%s from the shim", syscall_num, syscallName);
+            *rv = 0;
+
+            break;
+        }
+
         case SYS_sched_yield: {
             syscallName = "sched_yield";
 
@@ -148,6 +434,14 @@ bool shim_sys_handle_syscall_locally(long syscall_num, long* rv, va_list args) {
         }
     }
 
+    _shim_sys_finish_local_syscall(syscall_num, syscallName, *rv);
+
+    // the syscall was handled
+    return true;
+}
+
+// Logs a syscall that was handled in the shim, and charges its latency.
+static void _shim_sys_finish_local_syscall(long syscall_num, const char* syscallName, long rv) {
     int straceFd = shimshmem_getProcessStraceFd(shim_processSharedMem());
 
     if (straceFd >= 0) {
@@ -159,7 +453,7 @@ bool shim_sys_handle_syscall_locally(long syscall_num, long* rv, va_list args) {
 
         char buf[100] = {0};
         int len = snprintf(buf, sizeof(buf), "%018ld [tid %d] %s(...) = %ld\n", emulated_time_ms,
-                           tid, syscallName, *rv);
+                           tid, syscallName, rv);
         len = MIN(len, sizeof(buf));
 
         int written = 0;
@@ -186,19 +480,39 @@ bool shim_sys_handle_syscall_locally(long syscall_num, long* rv, va_list args) {
         shimshmem_incrementUnappliedCpuLatency(
             host_lock, _shim_sys_latency_for_syscall(syscall_num));
         CSimulationTime unappliedCpuLatency = shimshmem_getUnappliedCpuLatency(host_lock);
-        // TODO: Once ptrace mode is deprecated, we can hold this lock longer to
-        // avoid having to reacquire it below. We currently can't hold the lock
-        // over when any syscalls would be made though, since those result in a
-        // ptrace-stop returning control to shadow without giving us a chance to
-        // release the lock.
-        shimshmemhost_unlock(shim_hostSharedMem(), &host_lock);
 
         // Count the syscall and check whether we ought to yield.
         CSimulationTime maxUnappliedCpuLatency =
             shimshmem_maxUnappliedCpuLatency(shim_hostSharedMem());
+        bool reachedMax = unappliedCpuLatency > maxUnappliedCpuLatency;
+        bool shouldYield = false;
+        CEmulatedTime newTime = 0;
+        CEmulatedTime maxTime = 0;
+        if (reachedMax) {
+            // The max runahead time is published outside of the lock, so we
+            // can decide whether to move time forward locally while we still
+            // hold the lock for the unapplied latency.
+            newTime = _shim_sys_get_time() + unappliedCpuLatency;
+            maxTime = shimshmem_getMaxRunaheadTime(shim_hostSharedMem());
+            if (newTime <= maxTime) {
+                shimshmem_setEmulatedTime(shim_hostSharedMem(), newTime);
+                shimshmem_resetUnappliedCpuLatency(host_lock);
+            } else {
+                shouldYield = true;
+            }
+        }
+        // Release the lock before logging, and before yielding to shadow,
+        // which needs to take it.
+        shimshmemhost_unlock(shim_hostSharedMem(), &host_lock);
+        // Should have been released and NULLed.
+        assert(!host_lock);
+
         trace("unappliedCpuLatency=%ld maxUnappliedCpuLatency=%ld", unappliedCpuLatency,
               maxUnappliedCpuLatency);
-        if (unappliedCpuLatency > maxUnappliedCpuLatency) {
+        if (reachedMax && !shouldYield) {
+            trace("Reached maxUnappliedCpuLatency. Updated time locally. (%ld ns until max)",
+                  maxTime - newTime);
+        } else if (shouldYield) {
             // We still want to eventually return the syscall result we just
             // got, but first we yield control to Shadow so that it can move
             // time forward and reschedule this thread. This syscall itself is
@@ -208,27 +522,8 @@ bool shim_sys_handle_syscall_locally(long syscall_num, long* rv, va_list args) {
             //
             // Since this is a Shadow syscall, it will always be passed through
             // to Shadow instead of being executed natively.
-
-            CEmulatedTime newTime = _shim_sys_get_time() + unappliedCpuLatency;
-            host_lock = shimshmemhost_lock(shim_hostSharedMem());
-            CEmulatedTime maxTime = shimshmem_getMaxRunaheadTime(host_lock);
-            if (newTime <= maxTime) {
-                shimshmem_setEmulatedTime(shim_hostSharedMem(), newTime);
-                shimshmem_resetUnappliedCpuLatency(host_lock);
-                shimshmemhost_unlock(shim_hostSharedMem(), &host_lock);
-                trace("Reached maxUnappliedCpuLatency. Updated time locally. (%ld ns until max)",
-                      maxTime - newTime);
-            } else {
-                shimshmemhost_unlock(shim_hostSharedMem(), &host_lock);
-                trace("Reached maxUnappliedCpuLatency. Yielding. (%ld ns past max)",
-                      newTime - maxTime);
-                syscall(SYS_shadow_yield);
-            }
+            trace("Reached maxUnappliedCpuLatency. Yielding. (%ld ns past max)", newTime - maxTime);
+            syscall(SYS_shadow_yield);
         }
-        // Should have been released and NULLed.
-        assert(!host_lock);
     }
-
-    // the syscall was handled
-    return true;
 }
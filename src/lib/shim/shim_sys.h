@@ -4,6 +4,8 @@
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/time.h>
+#include <time.h>
 
 /// This module allows us to short-circuit syscalls that can be handled directly
 /// in the shim without needing to perform a more expensive inter-pocess syscall
@@ -23,4 +25,14 @@ uint64_t shim_sys_get_simtime_nanos();
 // responsibility to set errno from `rv`.
 bool shim_sys_handle_syscall_locally(long syscall_num, long* rv, va_list args);
 
+// Like `shim_sys_handle_syscall_locally` for `clock_gettime`, `gettimeofday`,
+// and `time`, for callers that can skip the generic syscall dispatch, such as
+// the vdso replacements.
+//
+// Returns false without doing anything if the call must instead be made as a
+// syscall, e.g. because interposition is disabled or the call would fail.
+bool shim_sys_try_clock_gettime(clockid_t clk_id, struct timespec* tp);
+bool shim_sys_try_gettimeofday(struct timeval* tv);
+bool shim_sys_try_time(time_t* tp, time_t* rv);
+
 #endif // SRC_LIB_SHIM_SHIM_SYS_H_
\ No newline at end of file
@@ -1,6 +1,11 @@
 #include "lib/shim/shim_tls.h"
 
 TlsOneThreadStorageAllocation* shim_native_tls() {
-    static __thread TlsOneThreadStorageAllocation _tls = {0};
+    // The shim is always loaded when the managed process starts (it's a dependency of the
+    // preloaded injector library), so its TLS block is in the static TLS area and we can use the
+    // initial-exec model. The address of `_tls` is then a fixed offset from the thread pointer in
+    // %fs, rather than the result of a call to `__tls_get_addr`, which isn't async-signal-safe.
+    static __thread __attribute__((tls_model("initial-exec")))
+    TlsOneThreadStorageAllocation _tls = {0};
     return &_tls;
-}
\ No newline at end of file
+}
@@ -32,6 +32,7 @@ mod bindings {
 
 pub mod clone;
 pub mod mmap_box;
+pub mod preempt;
 pub mod shimlogger;
 pub mod syscall;
 pub mod tls;
@@ -185,6 +186,13 @@ mod tls_ipc {
         ipc.as_ref().map(|block| f(block)).unwrap()
     }
 
+    /// Returns `None` if this thread's IPC hasn't been initialized yet.
+    pub fn try_with<O>(f: impl FnOnce(&IPCData) -> O) -> Option<O> {
+        let ipc = IPC_DATA_BLOCK.get();
+        let ipc = ipc.borrow();
+        ipc.as_ref().map(|block| f(block))
+    }
+
     /// The previous value, if any, is dropped.
     ///
     /// # Safety
@@ -0,0 +1,133 @@
+//! Preemption of managed threads that run for a long time without returning
+//! control to Shadow, e.g. in a busy loop that never makes a syscall.
+//!
+//! When `native_preemption_enabled` is set, each managed thread gets a timer on
+//! its own native CPU time (`CLOCK_THREAD_CPUTIME_ID`). When it expires while
+//! the thread is running managed code, we charge
+//! `native_preemption_sim_interval` to the host's unapplied CPU latency and
+//! yield to Shadow, which moves time forward and potentially reschedules the
+//! thread. Unlike `model_unblocked_syscall_latency`, this doesn't need any
+//! bookkeeping on each syscall.
+
+use core::cell::Cell;
+
+use linux_api::signal::{sigaction, siginfo_t, sigset_t, SigActionFlags, Signal, SignalHandler};
+use linux_api::time::{itimerspec, kernel_timer_t, sigevent, timespec, ClockId};
+use shadow_shim_helper_rs::syscall_types::{SyscallArgs, SyscallReg};
+
+use crate::tls::ShimTlsVar;
+use crate::{bindings, global_host_shmem, tls_allow_native_syscalls};
+
+/// The native signal used for the preemption timers. Managed code can't
+/// install native signal handlers, so this doesn't conflict with its own use
+/// of the signal.
+const PREEMPTION_SIGNAL: Signal = Signal::SIGVTALRM;
+
+static THREAD_TIMER: ShimTlsVar<Cell<Option<kernel_timer_t>>> =
+    ShimTlsVar::new(&crate::SHIM_TLS, || Cell::new(None));
+
+extern "C" fn handle_timer_signal(
+    _signo: i32,
+    _info: *mut siginfo_t,
+    _ctx: *mut core::ffi::c_void,
+) {
+    let old_native_syscall_flag = tls_allow_native_syscalls::swap(true);
+
+    if old_native_syscall_flag {
+        // We interrupted the shim rather than managed code; e.g. while it was
+        // waiting for Shadow. The timer is periodic, so we'll get another
+        // chance once the thread has run managed code for another interval.
+        tls_allow_native_syscalls::swap(old_native_syscall_flag);
+        return;
+    }
+
+    let host = global_host_shmem::get();
+    host.protected().lock().unapplied_cpu_latency += host.native_preemption_sim_interval;
+
+    log::trace!("Native preemption timer expired; yielding");
+
+    let args = SyscallArgs {
+        number: bindings::ShadowSyscallNum_SYS_shadow_yield.into(),
+        args: [SyscallReg::from(0i64); 6],
+    };
+    // SAFETY: `shadow_yield` doesn't access any memory.
+    unsafe { crate::syscall::emulated_syscall(args) };
+
+    tls_allow_native_syscalls::swap(old_native_syscall_flag);
+}
+
+/// Installs the handler for the preemption timers, and arms the timer for the
+/// current thread. Does nothing unless native preemption is enabled.
+pub fn process_init() {
+    if !global_host_shmem::get().native_preemption_enabled {
+        return;
+    }
+
+    // SA_SIGINFO: Required because we're specifying sa_sigaction.
+    // SA_ONSTACK: Use the alternate signal handling stack, to avoid interfering
+    // with userspace thread stacks.
+    // SA_RESTART: The timer can fire while the shim is in a native syscall,
+    // which shouldn't fail with EINTR.
+    let flags =
+        SigActionFlags::SA_SIGINFO | SigActionFlags::SA_ONSTACK | SigActionFlags::SA_RESTART;
+    let handler = SignalHandler::Action(handle_timer_signal);
+    let action = sigaction::new_with_default_restorer(handler, flags, sigset_t::EMPTY);
+    // SAFETY: We've set up a valid handler.
+    unsafe { linux_api::signal::rt_sigaction(PREEMPTION_SIGNAL, &action, None) }.unwrap();
+
+    thread_init();
+}
+
+/// Creates and arms the preemption timer for the current thread. Does nothing
+/// unless native preemption is enabled.
+///
+/// Timers aren't inherited across `fork`, so this also needs to be called in a
+/// forked child.
+pub fn thread_init() {
+    let host = global_host_shmem::get();
+    if !host.native_preemption_enabled {
+        return;
+    }
+
+    let tid = rustix::thread::gettid().as_raw_nonzero().get();
+    let event = sigevent::new_thread_id(PREEMPTION_SIGNAL, tid);
+    let timer =
+        linux_api::time::timer_create(ClockId::CLOCK_THREAD_CPUTIME_ID, Some(&event)).unwrap();
+
+    let interval = timespec::try_from(host.native_preemption_native_interval).unwrap();
+    let spec = itimerspec {
+        it_interval: interval,
+        it_value: interval,
+    };
+    linux_api::time::timer_settime(timer, 0, &spec, None).unwrap();
+
+    // In a forked child this replaces the parent thread's timer id, which
+    // doesn't exist in the child.
+    THREAD_TIMER.get().set(Some(timer));
+}
+
+/// Deletes the current thread's preemption timer, if any. Should be called
+/// when the thread exits.
+pub fn free_thread_timer() {
+    if let Some(timer) = THREAD_TIMER.get().take() {
+        if let Err(e) = linux_api::time::timer_delete(timer) {
+            log::warn!("timer_delete: {e:?}");
+        }
+    }
+}
+
+mod export {
+    /// Installs the preemption timer signal handler, and arms the current
+    /// thread's timer, if native preemption is enabled.
+    #[no_mangle]
+    pub extern "C-unwind" fn _shim_parent_init_preemption() {
+        super::process_init();
+    }
+
+    /// Arms the current thread's preemption timer, if native preemption is
+    /// enabled. Should be called once per thread, and in forked children.
+    #[no_mangle]
+    pub extern "C-unwind" fn _shim_init_preemption_timer() {
+        super::thread_init();
+    }
+}
@@ -5,8 +5,8 @@ use formatting_nostd::{BorrowedFdWriter, FormatBuffer};
 use rustix::fd::BorrowedFd;
 use shadow_shim_helper_rs::util::time::TimeParts;
 
-/// For internal use; writes to an internal buffer, flushing to stdout
-/// when the buffer fills or the object is dropped.
+/// For internal use; writes to an internal buffer, flushing to the thread's
+/// shared log buffer when the buffer fills or the object is dropped.
 struct ShimLoggerWriter {
     buffer: FormatBuffer<1000>,
     stdout: BorrowedFdWriter<'static>,
@@ -23,11 +23,43 @@ impl ShimLoggerWriter {
     }
 
     pub fn flush(&mut self) {
-        self.stdout.write_str(self.buffer.as_str()).unwrap();
+        write_output(&mut self.stdout, self.buffer.as_str()).unwrap();
         self.buffer.reset();
     }
 }
 
+/// Write `s` to this thread's log buffer in shared memory, which Shadow writes
+/// out to the shim log the next time this thread passes control to it. Only
+/// writes to stdout directly (which is the shim log) if the buffer isn't
+/// available yet or `s` doesn't fit.
+fn write_output(stdout: &mut BorrowedFdWriter<'static>, s: &str) -> Result<(), core::fmt::Error> {
+    let buffered = crate::tls_ipc::try_with(|ipc| {
+        let log = ipc.shim_log();
+        if log.append(s.as_bytes()).is_ok() {
+            return Ok(true);
+        }
+        // Write out what's already buffered first, to keep the output in order.
+        //
+        // SAFETY: Shadow only drains the buffer while this thread has passed
+        // control to it, and the shim's native signal handlers only run for
+        // faults in managed code, so they can't interrupt this.
+        unsafe {
+            log.drain(|bytes| {
+                // Only whole `str`s are appended, so this is valid utf8.
+                stdout.write_str(core::str::from_utf8(bytes).unwrap())
+            })
+        }?;
+        Ok(log.append(s.as_bytes()).is_ok())
+    })
+    .unwrap_or(Ok(false))?;
+
+    if buffered {
+        Ok(())
+    } else {
+        stdout.write_str(s)
+    }
+}
+
 impl core::fmt::Write for ShimLoggerWriter {
     fn write_str(&mut self, s: &str) -> Result<(), core::fmt::Error> {
         if s.len() > self.buffer.capacity_remaining() {
@@ -35,8 +67,8 @@ impl core::fmt::Write for ShimLoggerWriter {
             self.flush();
         }
         if s.len() > self.buffer.capacity_remaining() {
-            // There will never be enough room. Write directly to stdout.
-            self.stdout.write_str(s)
+            // There will never be enough room. Write it out directly.
+            write_output(&mut self.stdout, s)
         } else {
             // Write to buffer. Should be impossible to fail.
             self.buffer.write_str(s)
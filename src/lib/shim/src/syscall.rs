@@ -8,8 +8,8 @@ use rustix::fd::BorrowedFd;
 use shadow_shim_helper_rs::emulated_time::EmulatedTime;
 use shadow_shim_helper_rs::option::FfiOption;
 use shadow_shim_helper_rs::shim_event::{
-    ShimEventAddThreadRes, ShimEventSyscall, ShimEventSyscallComplete, ShimEventToShadow,
-    ShimEventToShim,
+    ShimEventAddThreadRes, ShimEventSyscall, ShimEventSyscallBatchComplete,
+    ShimEventSyscallComplete, ShimEventToShadow, ShimEventToShim, SYSCALL_BATCH_MAX,
 };
 use shadow_shim_helper_rs::syscall_types::{SyscallArgs, SyscallReg};
 use shadow_shim_helper_rs::util::time::TimeParts;
@@ -27,6 +27,7 @@ unsafe fn native_syscall(args: &SyscallArgs) -> SyscallReg {
         // This thread is exiting. Arrange for its thread-local-storage and
         // signal stack to be freed.
         unsafe { bindings::shim_freeSignalStack() };
+        crate::preempt::free_thread_timer();
         // SAFETY: We don't try to recover from panics.
         // TODO: make shim fully no_std and install a panic handler that aborts.
         // https://doc.rust-lang.org/nomicon/panic-handler.html
@@ -90,9 +91,20 @@ unsafe fn emulated_syscall_event(
                     ctx.uc_mcontext.rax = syscall_complete.retval.into();
                 }
 
-                // SAFETY: `ctx` should be valid if present.
-                let all_sigactions_had_sa_restart =
-                    unsafe { crate::signals::process_signals(ctx.as_deref_mut()) };
+                // Shadow tells us whether there's a signal to process, so that we only take the
+                // host lock to process signals when there is one.
+                let signal_pending = tls_thread_shmem::with(|thread| {
+                    thread
+                        .unblocked_signal_pending
+                        .load(atomic::Ordering::Relaxed)
+                });
+
+                let all_sigactions_had_sa_restart = if signal_pending {
+                    // SAFETY: `ctx` should be valid if present.
+                    unsafe { crate::signals::process_signals(ctx.as_deref_mut()) }
+                } else {
+                    true
+                };
 
                 if i64::from(syscall_complete.retval) == Errno::EINTR.to_negated_i64()
                     && all_sigactions_had_sa_restart
@@ -155,6 +167,23 @@ unsafe fn emulated_syscall_event(
                     ))
                 });
             }
+            ShimEventToShim::SyscallBatch(batch) => {
+                // Execute the syscalls in order and return all of the results to Shadow.
+
+                let mut complete = ShimEventSyscallBatchComplete {
+                    retvals: [SyscallReg::from(0u64); SYSCALL_BATCH_MAX],
+                };
+                for (args, retval) in batch.syscall_args[..batch.len]
+                    .iter()
+                    .zip(&mut complete.retvals)
+                {
+                    *retval = unsafe { native_syscall(args) };
+                }
+                tls_ipc::with(|ipc| {
+                    ipc.to_shadow()
+                        .send(ShimEventToShadow::SyscallBatchComplete(complete))
+                });
+            }
             ShimEventToShim::AddThreadReq(r) => {
                 // Create a new native thread under our control
 
@@ -173,6 +202,20 @@ unsafe fn emulated_syscall_event(
     }
 }
 
+/// Make an emulated syscall from shim code that doesn't have a `ucontext` to
+/// update with the result, such as one of the shim's own signal handlers.
+///
+/// # Safety
+///
+/// The specified syscall must be safe to make.
+pub unsafe fn emulated_syscall(syscall_args: SyscallArgs) -> SyscallReg {
+    let old_native_syscall_flag = crate::tls_allow_native_syscalls::swap(true);
+    let event = ShimEventSyscall { syscall_args };
+    let retval = unsafe { emulated_syscall_event(None, &event) };
+    crate::tls_allow_native_syscalls::swap(old_native_syscall_flag);
+    retval
+}
+
 pub mod export {
     use super::*;
 
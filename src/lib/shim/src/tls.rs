@@ -22,21 +22,28 @@ use crate::mmap_box::MmapBox;
 #[repr(i8)]
 pub enum Mode {
     /// Delegate back to ELF native thread local storage. This is the fastest
-    /// option, and simplest with respect to our own code, but is unsound.
-    /// We should probably ultimately disable or remove it.
+    /// option, and simplest with respect to our own code.
     ///
     /// In native thread local storage for ELF executables, an access to a
     /// thread-local variable (with C storage specifier `__thread`) from a
-    /// dynamically shared object (like the Shadow shim) involves implicitly calling
-    /// the libc function `__tls_get_addr`. That function is *not* guaranteed to be
-    /// async-signal-safe (See `signal-safety(7)`), and can end up making system
-    /// calls and doing memory allocation. This has caused problems with some versions of
-    /// glibc (Can't find the issue #...), and recently when running managed
-    /// processed compiled with asan <https://github.com/shadow/shadow/issues/2790>.
+    /// dynamically shared object (like the Shadow shim) by default involves
+    /// implicitly calling the libc function `__tls_get_addr`. That function is
+    /// *not* guaranteed to be async-signal-safe (See `signal-safety(7)`), and
+    /// can end up making system calls and doing memory allocation. This has
+    /// caused problems with some versions of glibc (Can't find the issue #...),
+    /// and when running managed processed compiled with asan
+    /// <https://github.com/shadow/shadow/issues/2790>.
     ///
-    /// SAFETY: `__tls_get_addr` in the linked version of libc must not make
-    /// system calls or do anything async-signal unsafe. This basically
-    /// can't be ensured, but is often true in practice.
+    /// To avoid this, the shim's native storage uses the "initial-exec" TLS
+    /// model (see "ELF Handling For Thread-Local Storage", linked in
+    /// [`Mode::NativeTlsId`]), so that its address is a fixed offset from
+    /// the thread pointer in `%fs`, resolved once by the dynamic linker when
+    /// the shim is loaded. Each lookup is then a couple of instructions, with no
+    /// calls into libc.
+    ///
+    /// SAFETY: The shim must be loaded when the process starts (e.g. by
+    /// `LD_PRELOAD` or as a dependency of a preloaded library), and not with
+    /// `dlopen`, so that its thread local storage is in the static TLS area.
     //
     // TODO: I *think* if we want to avoid the shim linking with libc at all,
     // we'll need to disable this mode at compile-time by removing it or making
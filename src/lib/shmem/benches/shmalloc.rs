@@ -0,0 +1,60 @@
+use criterion::{criterion_group, BenchmarkId, Criterion};
+use shadow_shmem::allocator::{shmalloc, ShMemBlock, SharedMemAllocatorDropGuard};
+
+/// Number of blocks allocated and freed per iteration.
+const BLOCKS: usize = 1000;
+
+/// Mock-ups of the host, process, and thread shared memory, which are the blocks that Shadow
+/// allocates most often.
+type HostShmem = [u64; 64];
+type ProcessShmem = [u64; 512];
+type ThreadShmem = [u64; 32];
+
+/// A block of any of the mocked-up types, so that blocks of different sizes are freed in the same
+/// order that they were allocated.
+#[allow(dead_code)]
+enum AnyBlock {
+    Host(ShMemBlock<'static, HostShmem>),
+    Process(ShMemBlock<'static, ProcessShmem>),
+    Thread(ShMemBlock<'static, ThreadShmem>),
+}
+
+fn alloc_any(i: usize) -> AnyBlock {
+    // mostly threads, like a simulation with many threads per process
+    match i % 8 {
+        0 => AnyBlock::Host(shmalloc([0; 64])),
+        1 => AnyBlock::Process(shmalloc([0; 512])),
+        _ => AnyBlock::Thread(shmalloc([0; 32])),
+    }
+}
+
+fn bench_alloc_free(c: &mut Criterion) {
+    let mut group = c.benchmark_group("shmalloc");
+
+    // the number of blocks that remain allocated while we allocate and free others, which
+    // determines how many free blocks the allocator has to choose from
+    for live in [0, 10_000, 100_000] {
+        let live_blocks: Vec<_> = (0..live).map(alloc_any).collect();
+
+        group.bench_function(BenchmarkId::new("alloc_free", live), |b| {
+            b.iter(|| {
+                let blocks: Vec<_> = (0..BLOCKS).map(alloc_any).collect();
+                drop(blocks);
+            })
+        });
+
+        drop(live_blocks);
+    }
+
+    group.finish();
+}
+
+criterion_group!(benches, bench_alloc_free);
+
+fn main() {
+    // clean up the shared memory files when the benchmarks are done
+    let _guard = unsafe { SharedMemAllocatorDropGuard::new() };
+
+    benches();
+    Criterion::default().configure_from_args().final_summary();
+}
@@ -313,8 +313,9 @@ impl<'alloc> SharedMemAllocator<'alloc> {
 
     fn free<T: Sync + VirtualAddressSpaceIndependent>(&mut self, mut block: ShMemBlock<'alloc, T>) {
         self.nallocs -= 1;
-        block.block = core::ptr::null_mut();
-        self.internal.dealloc(block.block);
+        // Take the block so that it isn't freed again when dropped.
+        let block = core::mem::replace(&mut block.block, core::ptr::null_mut());
+        self.internal.dealloc(block);
     }
 
     fn destruct(&mut self) {
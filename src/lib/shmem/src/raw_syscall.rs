@@ -20,6 +20,12 @@ pub const S_IRUSR: u32 = 0o400;
 pub const S_IWUSR: u32 = 0o200;
 pub const S_IRGRP: u32 = S_IRUSR >> 3;
 pub const S_IWGRP: u32 = S_IWUSR >> 3;
+pub const S_IXUSR: u32 = 0o100;
+pub const S_IXGRP: u32 = S_IXUSR >> 3;
+
+// from linux/fcntl.h
+pub const LOCK_EX: i32 = 2;
+pub const LOCK_NB: i32 = 4;
 
 fn null_terminated(string: &[u8]) -> bool {
     string.iter().any(|x| *x == 0)
@@ -67,6 +73,52 @@ pub unsafe fn unlink(filename: &[u8]) -> Result<(), Errno> {
         .map_err(Errno::from)
 }
 
+/// # Safety
+///
+/// Assumes pathname is a null-terminated ASCII string.
+pub unsafe fn mkdir(pathname: &[u8], mode: u32) -> Result<(), Errno> {
+    assert!(null_terminated(pathname));
+
+    unsafe { syscall!(linux_syscall::SYS_mkdir, pathname.as_ptr(), mode) }
+        .check()
+        .map_err(Errno::from)
+}
+
+/// # Safety
+///
+/// Assumes pathname is a null-terminated ASCII string.
+pub unsafe fn rmdir(pathname: &[u8]) -> Result<(), Errno> {
+    assert!(null_terminated(pathname));
+
+    unsafe { syscall!(linux_syscall::SYS_rmdir, pathname.as_ptr()) }
+        .check()
+        .map_err(Errno::from)
+}
+
+/// # Safety
+///
+/// Assumes oldpath and newpath are null-terminated ASCII strings.
+pub unsafe fn rename(oldpath: &[u8], newpath: &[u8]) -> Result<(), Errno> {
+    assert!(null_terminated(oldpath));
+    assert!(null_terminated(newpath));
+
+    unsafe {
+        syscall!(
+            linux_syscall::SYS_rename,
+            oldpath.as_ptr(),
+            newpath.as_ptr()
+        )
+    }
+    .check()
+    .map_err(Errno::from)
+}
+
+pub fn flock(fd: i32, operation: i32) -> Result<(), Errno> {
+    unsafe { syscall!(linux_syscall::SYS_flock, fd, operation) }
+        .check()
+        .map_err(Errno::from)
+}
+
 /// # Safety
 ///
 /// `addr` should be a pointer hinting at a mapping location, or null. The other arguments should
@@ -54,6 +54,10 @@ pub(crate) enum AllocError {
     MMap,
     MUnmap,
     Unlink,
+    MkDir,
+    RmDir,
+    Flock,
+    Rename,
     WrongAllocator,
     // Leak,
     GetPID,
@@ -67,6 +71,10 @@ const fn alloc_error_to_str(e: AllocError) -> Option<&'static str> {
         AllocError::MMap => Some("Error calling mmap()"),
         AllocError::MUnmap => Some("Error calling munmap()"),
         AllocError::Unlink => Some("Error calling unlink()"),
+        AllocError::MkDir => Some("Error calling mkdir()"),
+        AllocError::RmDir => Some("Error calling rmdir()"),
+        AllocError::Flock => Some("Error calling flock()"),
+        AllocError::Rename => Some("Error calling rename()"),
         AllocError::WrongAllocator => Some("Block was passed to incorrect allocator"),
         // AllocError::Leak => Some("Allocator destroyed but not all blocks are deallocated first"),
         AllocError::GetPID => Some("Error calling getpid()"),
@@ -113,26 +121,107 @@ pub(crate) fn log_err_and_exit(error: AllocError, errno: Option<Errno>) -> ! {
     unreachable!()
 }
 
-fn format_shmem_name(buf: &mut PathBuf) {
+fn monotonic_time() -> linux_api::time::timespec {
+    match clock_monotonic_gettime() {
+        Ok(ts) => ts,
+        Err(errno) => log_err_and_exit(AllocError::Clock, Some(errno)),
+    }
+}
+
+fn format_shmem_name(run_dir: &PathBuf, buf: &mut PathBuf) {
+    let ts = monotonic_time();
+
+    let mut fb = FormatBuffer::<{ crate::util::PATH_MAX_NBYTES }>::new();
+    write!(
+        &mut fb,
+        "{}/shadow_shmemfile_{}.{}",
+        core::str::from_utf8(crate::util::trim_null_bytes(run_dir).unwrap()).unwrap(),
+        ts.tv_sec,
+        ts.tv_nsec
+    )
+    .unwrap();
+
+    *buf = crate::util::buf_from_utf8_str(fb.as_str()).unwrap();
+}
+
+fn format_lock_path(run_dir: &PathBuf, suffix: &str) -> PathBuf {
+    let mut fb = FormatBuffer::<{ crate::util::PATH_MAX_NBYTES }>::new();
+    write!(
+        &mut fb,
+        "{}/{}{}",
+        core::str::from_utf8(crate::util::trim_null_bytes(run_dir).unwrap()).unwrap(),
+        crate::util::SHM_RUN_DIR_LOCK_NAME,
+        suffix
+    )
+    .unwrap();
+
+    crate::util::buf_from_utf8_str(fb.as_str()).unwrap()
+}
+
+/// Create a new directory for an allocator's shared memory files, and lock its lock file.
+/// Returns the directory's path and the lock file's descriptor, which must stay open while the
+/// directory is in use.
+fn create_run_dir() -> (PathBuf, i32) {
+    use linux_api::fcntl::OFlag;
+
     let pid = match getpid() {
         Ok(pid) => pid,
         Err(err) => log_err_and_exit(AllocError::GetPID, Some(err)),
     };
-
-    let ts = match clock_monotonic_gettime() {
-        Ok(ts) => ts,
-        Err(errno) => log_err_and_exit(AllocError::Clock, Some(errno)),
-    };
+    let ts = monotonic_time();
 
     let mut fb = FormatBuffer::<{ crate::util::PATH_MAX_NBYTES }>::new();
     write!(
         &mut fb,
-        "/dev/shm/shadow_shmemfile_{}.{}-{}",
-        ts.tv_sec, ts.tv_nsec, pid
+        "{}/{}{}.{}-{}",
+        crate::util::SHM_DIR_PATH,
+        crate::util::SHM_RUN_DIR_PREFIX,
+        ts.tv_sec,
+        ts.tv_nsec,
+        pid
     )
     .unwrap();
+    let run_dir: PathBuf = crate::util::buf_from_utf8_str(fb.as_str()).unwrap();
 
-    *buf = crate::util::buf_from_utf8_str(fb.as_str()).unwrap();
+    const DIR_MODE: u32 = S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IWGRP | S_IXGRP;
+    if let Err(errno) = unsafe { mkdir(&run_dir, DIR_MODE) } {
+        log_err_and_exit(AllocError::MkDir, Some(errno));
+    }
+
+    // The lock file is locked under a temporary name and then renamed, so that a cleanup that
+    // finds the lock file never finds it before it's locked.
+    let tmp_lock_path = format_lock_path(&run_dir, ".tmp");
+    let lock_path = format_lock_path(&run_dir, "");
+
+    const MODE: u32 = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+    let open_flags = OFlag::O_RDWR | OFlag::O_CREAT | OFlag::O_EXCL | OFlag::O_CLOEXEC;
+    let lock_fd = match unsafe { open(&tmp_lock_path, open_flags, MODE) } {
+        Ok(fd) => fd,
+        Err(errno) => log_err_and_exit(AllocError::Open, Some(errno)),
+    };
+    if let Err(errno) = flock(lock_fd, LOCK_EX | LOCK_NB) {
+        log_err_and_exit(AllocError::Flock, Some(errno));
+    }
+    if let Err(errno) = unsafe { rename(&tmp_lock_path, &lock_path) } {
+        log_err_and_exit(AllocError::Rename, Some(errno));
+    }
+    (run_dir, lock_fd)
+}
+
+/// Remove a directory created by `create_run_dir`, after all of its shared memory files have been
+/// removed. If the process exits between unlinking the lock file and removing the directory, the
+/// lock-less directory is reclaimed by the shm cleanup once it's older than a grace period.
+fn remove_run_dir(run_dir: &PathBuf, lock_fd: i32) {
+    let lock_path = format_lock_path(run_dir, "");
+
+    if let Err(errno) = unsafe { unlink(&lock_path) } {
+        log_err(AllocError::Unlink, Some(errno));
+    }
+    // closing the file releases the lock
+    let _ = close(lock_fd);
+    if let Err(errno) = unsafe { rmdir(run_dir) } {
+        log_err(AllocError::RmDir, Some(errno));
+    }
 }
 
 const CHUNK_NBYTES_DEFAULT: usize = 8 * 1024 * 1024; // 8 MiB
@@ -388,29 +477,48 @@ pub(crate) fn rewind(p: *mut u8) -> *mut Block {
 
 */
 
+/// The number of size classes, one for each power of two up to `u32::MAX`.
+const NUM_SIZE_CLASSES: usize = u32::BITS as usize + 1;
+
+/// Returns the size class of a block, which is the base-2 logarithm of its size rounded up.
+fn size_class(alloc_nbytes: usize) -> usize {
+    let class = alloc_nbytes.max(1).next_power_of_two().trailing_zeros() as usize;
+    assert!(class < NUM_SIZE_CLASSES);
+    class
+}
+
 #[derive(Debug)]
 pub(crate) struct FreelistAllocator {
     first_chunk: *mut Chunk,
-    next_free_block: *mut Block,
+    // One free list per size class. Most allocations are of a few types (the host, process, and
+    // thread shared memory), so the first block in a size class's list almost always has the
+    // right size, and we rarely need to walk past blocks of other sizes.
+    free_lists: [*mut Block; NUM_SIZE_CLASSES],
     chunk_nbytes: usize,
+    // The directory that the chunks' files are created in, and its lock file. Created in `init`.
+    run_dir: PathBuf,
+    run_dir_lock_fd: i32,
 }
 
 impl FreelistAllocator {
     pub const fn new() -> Self {
         FreelistAllocator {
             first_chunk: core::ptr::null_mut(),
-            next_free_block: core::ptr::null_mut(),
+            free_lists: [core::ptr::null_mut(); NUM_SIZE_CLASSES],
             chunk_nbytes: CHUNK_NBYTES_DEFAULT,
+            run_dir: crate::util::NULL_PATH_BUF,
+            run_dir_lock_fd: -1,
         }
     }
 
     pub fn init(&mut self) -> Result<(), i32> {
+        (self.run_dir, self.run_dir_lock_fd) = create_run_dir();
         self.add_chunk()
     }
 
     fn add_chunk(&mut self) -> Result<(), i32> {
         let mut path_buf = crate::util::NULL_PATH_BUF;
-        format_shmem_name(&mut path_buf);
+        format_shmem_name(&self.run_dir, &mut path_buf);
 
         let new_chunk = allocate_shared_chunk(&path_buf, self.chunk_nbytes);
 
@@ -423,14 +531,14 @@ impl FreelistAllocator {
         Ok(())
     }
 
-    /// Returns the block and its predecessor (if it exists)
+    /// Returns the block and its predecessor (if it exists) in the size class's free list.
     fn check_free_list_for_acceptable_block(
         &mut self,
         alloc_nbytes: usize,
         alloc_alignment: usize,
     ) -> (*mut Block, *mut Block) // (pred, block)
     {
-        let mut block = self.next_free_block;
+        let mut block = self.free_lists[size_class(alloc_nbytes)];
         let mut pred: *mut Block = core::ptr::null_mut();
 
         while !block.is_null() {
@@ -512,7 +620,7 @@ impl FreelistAllocator {
             // But first we update the free list.
             if pred.is_null() {
                 // The block was the first element on the list.
-                self.next_free_block = unsafe { (*block).next_free_block };
+                self.free_lists[size_class(alloc_nbytes)] = unsafe { (*block).next_free_block };
             } else {
                 // We can just update the predecessor
                 unsafe {
@@ -573,11 +681,11 @@ impl FreelistAllocator {
         unsafe {
             (*block).canary_assert();
         }
-        let old_block = self.next_free_block;
+        let free_list = &mut self.free_lists[size_class(unsafe { (*block).alloc_nbytes } as usize)];
         unsafe {
-            (*block).next_free_block = old_block;
+            (*block).next_free_block = *free_list;
         }
-        self.next_free_block = block;
+        *free_list = block;
     }
 
     // PRE: Block was allocated with this allocator
@@ -647,6 +755,12 @@ impl FreelistAllocator {
 
             self.first_chunk = core::ptr::null_mut();
         }
+
+        if self.run_dir_lock_fd != -1 {
+            remove_run_dir(&self.run_dir, self.run_dir_lock_fd);
+            self.run_dir = crate::util::NULL_PATH_BUF;
+            self.run_dir_lock_fd = -1;
+        }
     }
 }
 
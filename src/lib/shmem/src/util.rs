@@ -1,6 +1,19 @@
 // The standard path length limit on Linux.
 pub const PATH_MAX_NBYTES: usize = 255;
 
+/// The directory that the shared memory files are created under. Each allocator (usually one per
+/// Shadow process) creates its files in its own subdirectory.
+pub const SHM_DIR_PATH: &str = "/dev/shm";
+
+/// The prefix of the name of each allocator's subdirectory in [`SHM_DIR_PATH`].
+pub const SHM_RUN_DIR_PREFIX: &str = "shadow_shmemdir_";
+
+/// A file in each allocator's subdirectory that the allocator keeps locked with `flock` while it's
+/// running. If the file can be locked, the process that created the subdirectory has exited and
+/// the subdirectory can be removed. The lock is released by the kernel even if the process
+/// crashes.
+pub const SHM_RUN_DIR_LOCK_NAME: &str = "lock";
+
 // One extra byte for the null terminator.
 pub(crate) type PathBuf = [u8; PATH_MAX_NBYTES + 1];
 
@@ -0,0 +1,81 @@
+use std::cmp::Reverse;
+use std::collections::BinaryHeap;
+
+use criterion::{criterion_group, criterion_main, BenchmarkId, Criterion};
+use std_util::calendar_queue::CalendarQueue;
+
+/// Number of "hold" operations (pop the earliest value, then push a new one later in time) per
+/// iteration.
+const HOLDS: u64 = 1000;
+
+/// Mock-up of a host's timer events: each event is rescheduled a random interval after the
+/// earliest event, similar to retransmission and delayed-ACK timers being re-armed.
+const MAX_INTERVAL_NS: u64 = 200_000_000;
+
+/// A small deterministic generator, so that both queues see the same sequence of intervals.
+struct XorShift(u64);
+
+impl XorShift {
+    fn next(&mut self) -> u64 {
+        self.0 ^= self.0 << 13;
+        self.0 ^= self.0 >> 7;
+        self.0 ^= self.0 << 17;
+        self.0
+    }
+}
+
+trait Queue {
+    fn push(&mut self, time: u64, id: u64);
+    fn pop(&mut self) -> Option<(u64, u64)>;
+}
+
+impl Queue for BinaryHeap<Reverse<(u64, u64)>> {
+    fn push(&mut self, time: u64, id: u64) {
+        BinaryHeap::push(self, Reverse((time, id)));
+    }
+
+    fn pop(&mut self) -> Option<(u64, u64)> {
+        BinaryHeap::pop(self).map(|x| x.0)
+    }
+}
+
+impl Queue for CalendarQueue<u64> {
+    fn push(&mut self, time: u64, id: u64) {
+        CalendarQueue::push(self, time, id);
+    }
+
+    fn pop(&mut self) -> Option<(u64, u64)> {
+        CalendarQueue::pop(self)
+    }
+}
+
+fn bench_hold<Q: Queue>(c: &mut Criterion, name: &str, new_queue: impl Fn() -> Q) {
+    let mut group = c.benchmark_group(name);
+
+    for size in [100, 10_000, 1_000_000] {
+        let mut rng = XorShift(0x2545_f491_4f6c_dd1d);
+        let mut queue = new_queue();
+        for id in 0..size {
+            queue.push(rng.next() % MAX_INTERVAL_NS, id);
+        }
+
+        group.bench_function(BenchmarkId::from_parameter(size), |b| {
+            b.iter(|| {
+                for _ in 0..HOLDS {
+                    let (time, id) = queue.pop().unwrap();
+                    queue.push(time + rng.next() % MAX_INTERVAL_NS, id);
+                }
+            })
+        });
+    }
+
+    group.finish();
+}
+
+pub fn criterion_benchmark(c: &mut Criterion) {
+    bench_hold(c, "event_queue_hold_heap", BinaryHeap::new);
+    bench_hold(c, "event_queue_hold_calendar", CalendarQueue::new);
+}
+
+criterion_group!(benches, criterion_benchmark);
+criterion_main!(benches);
@@ -0,0 +1,275 @@
+//! A calendar queue: a priority queue with amortized O(1) push and pop when priorities are spread
+//! somewhat evenly over time, as described in "Calendar Queues: A Fast O(1) Priority Queue
+//! Implementation for the Simulation Event Set Problem" (R. Brown, 1988).
+//!
+//! Values are placed in a ring of buckets ("days"), each covering a fixed width of priorities. A
+//! full cycle around the ring is a "year", and a bucket holds the values of its day from every
+//! year. Popping scans forward from the day of the last popped value, so as long as most values
+//! are scheduled within a year of each other, only a few buckets are visited for each pop. The
+//! number of buckets and the bucket width are recomputed as the queue grows and shrinks.
+
+use std::cmp::Ordering;
+
+/// The queue never has fewer buckets than this.
+const MIN_BUCKETS: usize = 4;
+
+/// The number of the lowest priorities used to estimate the bucket width when resizing.
+const WIDTH_SAMPLE_SIZE: usize = 32;
+
+/// A min-priority queue of values ordered by a `u64` priority and then by the values themselves.
+///
+/// To keep the amortized O(1) costs, values should usually not be pushed with a priority lower
+/// than the last popped priority. Doing so is still correct.
+#[derive(Debug)]
+pub struct CalendarQueue<T> {
+    /// Each bucket is sorted in descending order, so that its lowest entry is at the end.
+    buckets: Vec<Vec<(u64, T)>>,
+    /// The range of priorities covered by each bucket. Never 0.
+    width: u64,
+    len: usize,
+    /// A lower bound of the priorities in the queue.
+    cursor: u64,
+}
+
+impl<T: Ord> CalendarQueue<T> {
+    pub fn new() -> Self {
+        Self::with_width(1)
+    }
+
+    /// A new queue whose buckets initially each cover `width` priorities. The width is
+    /// re-estimated from the queued priorities whenever the queue is resized.
+    pub fn with_width(width: u64) -> Self {
+        Self {
+            buckets: Self::new_buckets(MIN_BUCKETS),
+            width: width.max(1),
+            len: 0,
+            cursor: 0,
+        }
+    }
+
+    fn new_buckets(count: usize) -> Vec<Vec<(u64, T)>> {
+        std::iter::repeat_with(Vec::new).take(count).collect()
+    }
+
+    pub fn len(&self) -> usize {
+        self.len
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len == 0
+    }
+
+    fn compare(a: &(u64, T), b: &(u64, T)) -> Ordering {
+        a.0.cmp(&b.0).then_with(|| a.1.cmp(&b.1))
+    }
+
+    fn bucket_index(&self, priority: u64) -> usize {
+        ((priority / self.width) % self.buckets.len() as u64) as usize
+    }
+
+    fn insert(&mut self, priority: u64, value: T) {
+        let index = self.bucket_index(priority);
+        let bucket = &mut self.buckets[index];
+        let entry = (priority, value);
+
+        // the bucket is sorted in descending order; values are usually pushed with a higher
+        // priority than what's already in the bucket, so they usually go near the front
+        let position = bucket.partition_point(|x| Self::compare(x, &entry).is_gt());
+        bucket.insert(position, entry);
+    }
+
+    /// Push a value with the given priority on to the queue.
+    pub fn push(&mut self, priority: u64, value: T) {
+        self.cursor = self.cursor.min(priority);
+        self.insert(priority, value);
+        self.len += 1;
+
+        if self.len > 2 * self.buckets.len() {
+            self.resize(2 * self.buckets.len());
+        }
+    }
+
+    /// The index of the bucket containing the lowest entry.
+    fn find_min(&self) -> Option<usize> {
+        if self.len == 0 {
+            return None;
+        }
+
+        // look through the buckets starting at the day of the cursor, for at most a year
+        let mut day_start = self.cursor - self.cursor % self.width;
+        for _ in 0..self.buckets.len() {
+            let index = self.bucket_index(day_start);
+            if let Some(last) = self.buckets[index].last() {
+                if last.0 < day_start.saturating_add(self.width) {
+                    return Some(index);
+                }
+            }
+            day_start = day_start.saturating_add(self.width);
+        }
+
+        // the next entry is more than a year away, so search every bucket directly
+        self.buckets
+            .iter()
+            .enumerate()
+            .filter_map(|(index, bucket)| Some((index, bucket.last()?)))
+            .min_by(|a, b| Self::compare(a.1, b.1))
+            .map(|(index, _)| index)
+    }
+
+    /// Pop the value with the lowest priority from the queue.
+    pub fn pop(&mut self) -> Option<(u64, T)> {
+        let index = self.find_min()?;
+        let entry = self.buckets[index].pop().unwrap();
+        self.cursor = entry.0;
+        self.len -= 1;
+
+        if self.buckets.len() > MIN_BUCKETS && self.len < self.buckets.len() / 2 {
+            self.resize(self.buckets.len() / 2);
+        }
+
+        Some(entry)
+    }
+
+    /// The value with the lowest priority in the queue.
+    pub fn peek(&self) -> Option<(u64, &T)> {
+        let index = self.find_min()?;
+        self.buckets[index].last().map(|(p, v)| (*p, v))
+    }
+
+    /// Estimate a bucket width from the lowest priorities in the queue; about three times the
+    /// average separation between them, as suggested by Brown.
+    fn estimate_width(&self) -> Option<u64> {
+        let mut sample: Vec<u64> = self
+            .buckets
+            .iter()
+            .flat_map(|bucket| bucket.iter().map(|x| x.0))
+            .collect();
+
+        if sample.len() > WIDTH_SAMPLE_SIZE {
+            sample.select_nth_unstable(WIDTH_SAMPLE_SIZE - 1);
+            sample.truncate(WIDTH_SAMPLE_SIZE);
+        }
+        sample.sort_unstable();
+        sample.dedup();
+
+        if sample.len() < 2 {
+            return None;
+        }
+
+        let span = sample.last().unwrap() - sample.first().unwrap();
+        let separation = span / (sample.len() as u64 - 1);
+        Some(separation.saturating_mul(3).max(1))
+    }
+
+    fn resize(&mut self, bucket_count: usize) {
+        if let Some(width) = self.estimate_width() {
+            self.width = width;
+        }
+
+        let old_buckets = std::mem::replace(&mut self.buckets, Self::new_buckets(bucket_count));
+        for (priority, value) in old_buckets.into_iter().flatten() {
+            self.insert(priority, value);
+        }
+    }
+}
+
+impl<T: Ord> Default for CalendarQueue<T> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::cmp::Reverse;
+    use std::collections::BinaryHeap;
+
+    use super::*;
+
+    /// A small deterministic generator so that the tests don't need a dependency.
+    struct XorShift(u64);
+
+    impl XorShift {
+        fn next(&mut self) -> u64 {
+            self.0 ^= self.0 << 13;
+            self.0 ^= self.0 >> 7;
+            self.0 ^= self.0 << 17;
+            self.0
+        }
+    }
+
+    #[test]
+    fn test_empty() {
+        let mut queue = CalendarQueue::<u32>::new();
+        assert!(queue.is_empty());
+        assert_eq!(queue.peek(), None);
+        assert_eq!(queue.pop(), None);
+    }
+
+    #[test]
+    fn test_order() {
+        let mut queue = CalendarQueue::new();
+        for (priority, value) in [(5, 'a'), (1, 'b'), (5, 'c'), (1_000_000, 'd'), (0, 'e')] {
+            queue.push(priority, value);
+        }
+
+        assert_eq!(queue.len(), 5);
+        assert_eq!(queue.peek(), Some((0, &'e')));
+
+        let popped: Vec<_> = std::iter::from_fn(|| queue.pop()).collect();
+        assert_eq!(
+            popped,
+            [(0, 'e'), (1, 'b'), (5, 'a'), (5, 'c'), (1_000_000, 'd')]
+        );
+        assert!(queue.is_empty());
+    }
+
+    #[test]
+    fn test_matches_heap() {
+        let mut rng = XorShift(0x2545_f491_4f6c_dd1d);
+        let mut queue = CalendarQueue::new();
+        let mut heap = BinaryHeap::new();
+        let mut now = 0;
+
+        // "hold" operations with bursts of pushes and pops, so that the queue is resized several
+        // times. Occasionally push far into the future or into the past.
+        for round in 0..20_000u64 {
+            let pushes = if (round / 2000) % 2 == 0 { 2 } else { 1 };
+            for _ in 0..pushes {
+                let priority = match rng.next() % 100 {
+                    0 => now + rng.next() % (1 << 40),
+                    1 => now.saturating_sub(rng.next() % 1000),
+                    _ => now + rng.next() % 1000,
+                };
+                let value = rng.next() % 4;
+                queue.push(priority, value);
+                heap.push(Reverse((priority, value)));
+            }
+
+            if round % 3 != 0 {
+                let expected = heap.pop().map(|x| x.0);
+                assert_eq!(queue.peek().map(|(p, v)| (p, *v)), expected);
+                assert_eq!(queue.pop(), expected);
+                if let Some((priority, _)) = expected {
+                    now = priority;
+                }
+            }
+            assert_eq!(queue.len(), heap.len());
+        }
+
+        while let Some(Reverse(expected)) = heap.pop() {
+            assert_eq!(queue.pop(), Some(expected));
+        }
+        assert_eq!(queue.pop(), None);
+    }
+
+    #[test]
+    fn test_extreme_priorities() {
+        let mut queue = CalendarQueue::with_width(u64::MAX);
+        for priority in [u64::MAX, 0, u64::MAX - 1, u64::MAX / 2] {
+            queue.push(priority, ());
+        }
+        let popped: Vec<_> = std::iter::from_fn(|| queue.pop().map(|x| x.0)).collect();
+        assert_eq!(popped, [0, u64::MAX / 2, u64::MAX - 1, u64::MAX]);
+    }
+}
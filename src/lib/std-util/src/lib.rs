@@ -3,4 +3,5 @@
 
 //! Utilities that extend the `std` crate.
 
+pub mod calendar_queue;
 pub mod nested_ref;
@@ -0,0 +1,169 @@
+//! Measures the TCP state machine by running connections between two [`TcpState`] endpoints over
+//! a mock network that delivers every packet immediately and in order. The throughput is the
+//! number of segments that the endpoints process.
+
+use std::net::SocketAddrV4;
+
+use criterion::{criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+use tcp::{Dependencies, RecvError, SendError, TcpConfig, TcpState, TimerRegisteredBy};
+
+const CLIENT_ADDR: SocketAddrV4 = SocketAddrV4::new(std::net::Ipv4Addr::new(1, 2, 3, 4), 10);
+const SERVER_ADDR: SocketAddrV4 = SocketAddrV4::new(std::net::Ipv4Addr::new(5, 6, 7, 8), 20);
+
+/// The number of bytes sent in each iteration of the transfer benchmarks.
+const TRANSFER_LEN: usize = 1 << 20;
+
+#[derive(Debug, Clone)]
+struct BenchDeps {
+    current_time: std::time::Instant,
+}
+
+impl Dependencies for BenchDeps {
+    type Instant = std::time::Instant;
+    type Duration = std::time::Duration;
+
+    fn register_timer(
+        &self,
+        _time: Self::Instant,
+        _f: impl FnOnce(&mut TcpState<Self>, TimerRegisteredBy) + Send + Sync + 'static,
+    ) {
+        // simulated time never advances, so the state machine's timeouts never fire
+    }
+
+    fn current_time(&self) -> Self::Instant {
+        self.current_time
+    }
+
+    fn fork(&self) -> Self {
+        self.clone()
+    }
+}
+
+/// Move all packets that `from` wants to send to `to`. Returns the number of packets moved.
+fn deliver(from: &mut TcpState<BenchDeps>, to: &mut TcpState<BenchDeps>) -> u64 {
+    let mut segments = 0;
+    while from.wants_to_send() {
+        let (header, payload) = from.pop_packet().unwrap();
+        to.push_packet(&header, payload).unwrap();
+        segments += 1;
+    }
+    segments
+}
+
+/// Move packets between `a` and `b` until neither has a packet to send. Returns the number of
+/// packets moved.
+fn exchange(a: &mut TcpState<BenchDeps>, b: &mut TcpState<BenchDeps>) -> u64 {
+    let mut segments = 0;
+    loop {
+        let moved = deliver(a, b) + deliver(b, a);
+        if moved == 0 {
+            return segments;
+        }
+        segments += moved;
+    }
+}
+
+/// Open a connection. Returns the client and the accepted server states, and the number of
+/// segments of the handshake.
+fn connect(config: TcpConfig) -> (TcpState<BenchDeps>, TcpState<BenchDeps>, u64) {
+    let deps = BenchDeps {
+        current_time: std::time::Instant::now(),
+    };
+
+    let mut listener = TcpState::new(deps.clone(), config);
+    listener.listen(1, || Ok::<(), ()>(())).unwrap();
+
+    let mut client = TcpState::new(deps, config);
+    client
+        .connect(SERVER_ADDR, || Ok::<_, ()>((CLIENT_ADDR, ())))
+        .unwrap();
+
+    let segments = exchange(&mut client, &mut listener);
+    let server = listener.accept().unwrap().finalize(|_| {});
+
+    (client, server, segments)
+}
+
+/// Send `len` bytes from `sender` to `receiver`, with the receiver reading the data as it arrives.
+/// Returns the number of segments exchanged.
+fn transfer(
+    sender: &mut TcpState<BenchDeps>,
+    receiver: &mut TcpState<BenchDeps>,
+    len: usize,
+) -> u64 {
+    let data = vec![0u8; 64 * 1024];
+
+    let mut remaining = len;
+    let mut segments = 0;
+
+    while remaining > 0 {
+        let to_send = std::cmp::min(remaining, data.len());
+        let sent = match sender.send(&data[..to_send], to_send) {
+            Ok(x) => x,
+            Err(SendError::Full) => 0,
+            Err(e) => panic!("Unexpected send error: {e:?}"),
+        };
+        remaining -= sent;
+
+        let mut moved = exchange(sender, receiver);
+
+        // read everything so that the receiver opens its window
+        loop {
+            match receiver.recv(std::io::sink(), len) {
+                Ok(0) | Err(RecvError::Empty) => break,
+                Ok(_) => {}
+                Err(e) => panic!("Unexpected recv error: {e:?}"),
+            }
+        }
+
+        // window updates
+        moved += exchange(sender, receiver);
+
+        assert!(sent > 0 || moved > 0, "The transfer stalled");
+        segments += moved;
+    }
+
+    segments
+}
+
+fn config(window_scaling: bool, buffer_size: u32) -> TcpConfig {
+    let mut config = TcpConfig::default();
+    config.window_scaling(window_scaling);
+    config.send_buffer_size(buffer_size.try_into().unwrap());
+    config.recv_buffer_size(buffer_size);
+    config
+}
+
+pub fn criterion_benchmark(c: &mut Criterion) {
+    let mut group = c.benchmark_group("tcp");
+
+    // a new connection for each iteration
+    let (_, _, segments) = connect(TcpConfig::default());
+    group.throughput(Throughput::Elements(segments));
+    group.bench_function("handshake", |b| b.iter(|| connect(TcpConfig::default())));
+
+    // bulk transfers over an established connection; without window scaling the window is limited
+    // to 64 KiB, so the large buffers only help with scaling enabled
+    let transfers = [
+        ("bulk", TcpConfig::default()),
+        ("window-scaling/enabled", config(true, 4 * 1024 * 1024)),
+        ("window-scaling/disabled", config(false, 4 * 1024 * 1024)),
+    ];
+
+    for (name, config) in transfers {
+        let (mut client, mut server, _) = connect(config);
+
+        // the number of segments is about the same for each iteration
+        let segments = transfer(&mut client, &mut server, TRANSFER_LEN);
+        group.throughput(Throughput::Elements(segments));
+
+        group.bench_function(BenchmarkId::new(name, TRANSFER_LEN), |b| {
+            b.iter(|| transfer(&mut client, &mut server, TRANSFER_LEN))
+        });
+    }
+
+    group.finish();
+}
+
+criterion_group!(benches, criterion_benchmark);
+criterion_main!(benches);
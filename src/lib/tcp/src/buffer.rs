@@ -1,4 +1,4 @@
-use std::collections::LinkedList;
+use std::collections::{LinkedList, VecDeque};
 use std::io::{Read, Write};
 
 use bytes::{Buf, Bytes, BytesMut};
@@ -8,7 +8,9 @@ use crate::util::time::Instant;
 
 #[derive(Debug)]
 pub(crate) struct SendQueue<T: Instant> {
-    segments: LinkedList<Segment>,
+    // each segment with its starting sequence number, so that segments can be found with a binary
+    // search
+    segments: VecDeque<(Seq, Segment)>,
     time_last_segment_sent: Option<T>,
     // exclusive
     transmitted_up_to: Seq,
@@ -23,7 +25,7 @@ pub(crate) struct SendQueue<T: Instant> {
 impl<T: Instant> SendQueue<T> {
     pub fn new(initial_seq: Seq) -> Self {
         let mut queue = Self {
-            segments: LinkedList::new(),
+            segments: VecDeque::new(),
             time_last_segment_sent: None,
             transmitted_up_to: initial_seq,
             start_seq: initial_seq,
@@ -107,8 +109,9 @@ impl<T: Instant> SendQueue<T> {
             return;
         }
 
-        self.end_seq += seg.len();
-        self.segments.push_back(seg);
+        let len = seg.len();
+        self.segments.push_back((self.end_seq, seg));
+        self.end_seq += len;
     }
 
     pub fn start_seq(&self) -> Seq {
@@ -119,6 +122,11 @@ impl<T: Instant> SendQueue<T> {
         self.end_seq
     }
 
+    /// The sequence number after the last transmitted byte.
+    pub fn transmitted_up_to(&self) -> Seq {
+        self.transmitted_up_to
+    }
+
     pub fn contains(&self, seq: Seq) -> bool {
         SeqRange::new(self.start_seq, self.end_seq).contains(seq)
     }
@@ -134,7 +142,7 @@ impl<T: Instant> SendQueue<T> {
             let advance_by = new_start - self.start_seq;
 
             // this shouldn't panic due to the assertion above
-            let front = self.segments.front_mut().unwrap();
+            let (front_seq, front) = self.segments.front_mut().unwrap();
 
             // if the chunk would be completely removed
             if front.len() <= advance_by {
@@ -154,13 +162,14 @@ impl<T: Instant> SendQueue<T> {
             data.advance(advance_by.try_into().unwrap());
             assert!(!data.is_empty());
 
+            *front_seq += advance_by;
             self.start_seq += advance_by;
         }
     }
 
     /// Get the next segment that has not yet been transmitted. The `offset` argument can be used to
     /// return the next segment starting at `offset` bytes from the next non-transmitted segment.
-    // TODO: this is slow and is called often
+    /// The returned data shares the buffer's chunks and isn't copied.
     pub fn next_not_transmitted(&self, offset: u32) -> Option<(Seq, Segment)> {
         // the sequence number of the segment we want to return
         let target_seq = self.transmitted_up_to + offset;
@@ -170,33 +179,32 @@ impl<T: Instant> SendQueue<T> {
             return None;
         }
 
-        let mut seq_cursor = self.start_seq;
-        for seg in &self.segments {
-            let len = seg.len();
-
-            // if the target sequence number is within this segment
-            if SeqRange::new(seq_cursor, seq_cursor + len).contains(target_seq) {
-                let new_segment = match seg {
-                    Segment::Syn => Segment::Syn,
-                    Segment::Fin => Segment::Fin,
-                    Segment::Data(chunk) => {
-                        // the target sequence number might be somewhere within this chunk, so we
-                        // need to trim any bytes with a lower sequence number
-                        let chunk_offset = target_seq - seq_cursor;
-                        let chunk_offset: usize = chunk_offset.try_into().unwrap();
-                        Segment::Data(chunk.slice(chunk_offset..))
-                    }
-                };
-
-                return Some((target_seq, new_segment));
+        // sequence numbers wrap, so compare offsets from the start of the buffer instead
+        let target_offset = target_seq - self.start_seq;
+
+        // the first segment that ends after the target sequence number, which must be the segment
+        // containing it
+        let index = self
+            .segments
+            .partition_point(|(seq, seg)| (*seq - self.start_seq) + seg.len() <= target_offset);
+
+        // we confirmed above that the target sequence number is contained within the buffer
+        let (seg_seq, seg) = &self.segments[index];
+        debug_assert!(SeqRange::new(*seg_seq, *seg_seq + seg.len()).contains(target_seq));
+
+        let new_segment = match seg {
+            Segment::Syn => Segment::Syn,
+            Segment::Fin => Segment::Fin,
+            Segment::Data(chunk) => {
+                // the target sequence number might be somewhere within this chunk, so we need to
+                // trim any bytes with a lower sequence number
+                let chunk_offset = target_seq - *seg_seq;
+                let chunk_offset: usize = chunk_offset.try_into().unwrap();
+                Segment::Data(chunk.slice(chunk_offset..))
             }
+        };
 
-            seq_cursor += len;
-        }
-
-        // we confirmed above that the target sequence number is contained within the buffer, but we
-        // looped over all segments in the buffer and didn't find it
-        unreachable!();
+        Some((target_seq, new_segment))
     }
 
     pub fn mark_as_transmitted(&mut self, up_to: Seq, time: T) {
@@ -348,3 +356,56 @@ impl Segment {
         }
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_send_queue_next_not_transmitted() {
+        // start near the wrap-around point of the sequence numbers
+        let initial_seq = Seq::new(u32::MAX - 10);
+        let mut queue = SendQueue::<std::time::Instant>::new(initial_seq);
+
+        let data: Vec<u8> = (0..100).collect();
+        for chunk in data.chunks(7) {
+            queue.add_data(chunk, chunk.len()).unwrap();
+        }
+        queue.add_fin();
+
+        // the syn, the data, and the fin
+        assert_eq!(queue.len(), 1 + 100 + 1);
+
+        let (seq, seg) = queue.next_not_transmitted(0).unwrap();
+        assert_eq!(seq, initial_seq);
+        assert!(matches!(seg, Segment::Syn));
+
+        for offset in 1..=100 {
+            let (seq, seg) = queue.next_not_transmitted(offset).unwrap();
+            assert_eq!(seq, initial_seq + offset);
+            let Segment::Data(chunk) = seg else {
+                panic!("Expected a data segment");
+            };
+            let i = usize::try_from(offset).unwrap() - 1;
+            // the segment ends at the end of the chunk that contains it
+            let chunk_end = std::cmp::min((i / 7 + 1) * 7, data.len());
+            assert_eq!(chunk[..], data[i..chunk_end]);
+        }
+
+        let (_, seg) = queue.next_not_transmitted(101).unwrap();
+        assert!(matches!(seg, Segment::Fin));
+        assert!(queue.next_not_transmitted(102).is_none());
+
+        // acknowledge part of a chunk, and the rest of the data should still be found
+        queue.advance_start(initial_seq + 20);
+        queue.mark_as_transmitted(initial_seq + 20, std::time::Instant::now());
+        for offset in 0..81 {
+            let (seq, seg) = queue.next_not_transmitted(offset).unwrap();
+            assert_eq!(seq, initial_seq + 20 + offset);
+            let Segment::Data(chunk) = seg else {
+                panic!("Expected a data segment");
+            };
+            assert_eq!(chunk[0], u8::try_from(19 + offset).unwrap());
+        }
+    }
+}
@@ -8,7 +8,7 @@ use crate::util::time::Instant;
 use crate::window_scaling::WindowScaling;
 use crate::{
     Ipv4Header, Payload, PopPacketError, PushPacketError, RecvError, SendError, TcpConfig,
-    TcpFlags, TcpHeader,
+    TcpFlags, TcpHeader, TcpInfo,
 };
 
 /// Information for a TCP connection. Equivalent to the Transmission Control Block (TCB).
@@ -28,11 +28,6 @@ pub(crate) struct Connection<I: Instant> {
 }
 
 impl<I: Instant> Connection<I> {
-    /// The max number of bytes allowed in the send and receive buffers. These should be made
-    /// dynamic in the future.
-    const SEND_BUF_MAX: usize = 100_000;
-    const RECV_BUF_MAX: u32 = 100_000;
-
     pub fn new(
         local_addr: SocketAddrV4,
         remote_addr: SocketAddrV4,
@@ -96,7 +91,7 @@ impl<I: Instant> Connection<I> {
         }
 
         let send_buffer_len = self.send.buffer.len() as usize;
-        let send_buffer_space = Self::SEND_BUF_MAX.saturating_sub(send_buffer_len);
+        let send_buffer_space = self.config.send_buf_max.saturating_sub(send_buffer_len);
 
         let len = std::cmp::min(len, send_buffer_space);
         if let Err(e) = self.send.buffer.add_data(reader, len) {
@@ -613,7 +608,7 @@ impl<I: Instant> Connection<I> {
     pub fn send_buf_has_space(&self) -> bool {
         let send_buffer_len = self.send.buffer.len() as usize;
 
-        send_buffer_len < Self::SEND_BUF_MAX
+        send_buffer_len < self.config.send_buf_max
     }
 
     /// Returns true if the recv buffer has data to read. Does not consider whether the connection
@@ -659,7 +654,21 @@ impl<I: Instant> Connection<I> {
 
     /// The total capacity of the receive buffer.
     fn recv_buffer_capacity(&self) -> u32 {
-        Self::RECV_BUF_MAX
+        self.config.recv_buf_max
+    }
+
+    /// Fill in the connection-specific fields of `info`.
+    pub(crate) fn fill_info(&self, info: &mut TcpInfo) {
+        if self.window_scaling.is_configured() {
+            info.recv_window_scale = self.window_scaling.recv_window_scale_shift();
+            info.send_window_scale = self.window_scaling.send_window_scale_shift();
+        }
+
+        info.unacked = self.send.buffer.transmitted_up_to() - self.send.buffer.start_seq();
+        info.send_buffer_len = self.send.buffer.len();
+        info.recv_buffer_len = self.recv.as_ref().map(|x| x.buffer.len()).unwrap_or(0);
+        info.send_window = self.send.window;
+        info.recv_window = self.recv_window_len();
     }
 }
 
@@ -338,6 +338,11 @@ impl<X: Dependencies> TcpState<X> {
     pub fn local_remote_addrs(&self) -> Option<(SocketAddrV4, SocketAddrV4)> {
         self.0.as_ref().unwrap().local_remote_addrs()
     }
+
+    #[inline]
+    pub fn info(&self) -> TcpInfo {
+        self.0.as_ref().unwrap().info()
+    }
 }
 
 /// A macro that forwards an argument-less method to the inner type.
@@ -394,6 +399,37 @@ enum TcpStateEnum<X: Dependencies> {
     Closed(ClosedState<X>),
 }
 
+impl<X: Dependencies> TcpStateEnum<X> {
+    fn info(&self) -> TcpInfo {
+        let (state, connection) = match self {
+            Self::Init(_) => (TcpStateKind::Init, None),
+            Self::Listen(_) => (TcpStateKind::Listen, None),
+            Self::SynSent(x) => (TcpStateKind::SynSent, Some(&x.connection)),
+            Self::SynReceived(x) => (TcpStateKind::SynReceived, Some(&x.connection)),
+            Self::Established(x) => (TcpStateKind::Established, Some(&x.connection)),
+            Self::FinWaitOne(x) => (TcpStateKind::FinWaitOne, Some(&x.connection)),
+            Self::FinWaitTwo(x) => (TcpStateKind::FinWaitTwo, Some(&x.connection)),
+            Self::Closing(x) => (TcpStateKind::Closing, Some(&x.connection)),
+            Self::TimeWait(x) => (TcpStateKind::TimeWait, Some(&x.connection)),
+            Self::CloseWait(x) => (TcpStateKind::CloseWait, Some(&x.connection)),
+            Self::LastAck(x) => (TcpStateKind::LastAck, Some(&x.connection)),
+            Self::Rst(_) => (TcpStateKind::Rst, None),
+            Self::Closed(_) => (TcpStateKind::Closed, None),
+        };
+
+        let mut info = TcpInfo {
+            state,
+            ..Default::default()
+        };
+
+        if let Some(connection) = connection {
+            connection.fill_info(&mut info);
+        }
+
+        info
+    }
+}
+
 /// A macro that creates a method which casts to an inner variant.
 ///
 /// ```ignore
@@ -504,6 +540,49 @@ impl<X: Dependencies> From<AcceptedTcpStateInner<X>> for TcpStateEnum<X> {
     }
 }
 
+/// The TCP state, without any of the state's data.
+#[derive(Copy, Clone, Debug, Default, PartialEq, Eq)]
+pub enum TcpStateKind {
+    #[default]
+    Init,
+    Listen,
+    SynSent,
+    SynReceived,
+    Established,
+    FinWaitOne,
+    FinWaitTwo,
+    Closing,
+    TimeWait,
+    CloseWait,
+    LastAck,
+    Rst,
+    Closed,
+}
+
+/// Information about a TCP socket, similar to Linux's `struct tcp_info`. Values that depend on the
+/// connection are 0 if there is no connection (for example in the "listen" state).
+#[derive(Copy, Clone, Debug, Default, PartialEq, Eq)]
+pub struct TcpInfo {
+    pub state: TcpStateKind,
+    /// The window scale shift that the peer applies to our advertised window. This is 0 if window
+    /// scaling is not in use or hasn't been negotiated yet.
+    pub recv_window_scale: u8,
+    /// The window scale shift that we apply to the peer's advertised window. This is 0 if window
+    /// scaling is not in use or hasn't been negotiated yet.
+    pub send_window_scale: u8,
+    /// The number of sequence numbers (payload bytes and SYN/FIN flags) that were transmitted but
+    /// not yet acknowledged.
+    pub unacked: u32,
+    /// The number of bytes in the send buffer, including bytes that have not been transmitted.
+    pub send_buffer_len: u32,
+    /// The number of bytes in the receive buffer that have not yet been read.
+    pub recv_buffer_len: u32,
+    /// The peer's receive window.
+    pub send_window: u32,
+    /// Our receive window.
+    pub recv_window: u32,
+}
+
 #[derive(Copy, Clone, Debug, PartialEq, Eq)]
 pub enum Shutdown {
     Read,
@@ -644,18 +723,33 @@ bitflags::bitflags! {
 #[derive(Copy, Clone, Debug)]
 pub struct TcpConfig {
     pub(crate) window_scaling_enabled: bool,
+    pub(crate) send_buf_max: usize,
+    pub(crate) recv_buf_max: u32,
 }
 
 impl TcpConfig {
     pub fn window_scaling(&mut self, enable: bool) {
         self.window_scaling_enabled = enable;
     }
+
+    /// The max number of bytes allowed in the send buffer.
+    pub fn send_buffer_size(&mut self, size: usize) {
+        self.send_buf_max = size;
+    }
+
+    /// The max number of bytes allowed in the receive buffer. This also decides the window scale
+    /// that is offered in the SYN packet, and therefore the largest receive window.
+    pub fn recv_buffer_size(&mut self, size: u32) {
+        self.recv_buf_max = size;
+    }
 }
 
 impl Default for TcpConfig {
     fn default() -> Self {
         Self {
             window_scaling_enabled: true,
+            send_buf_max: 100_000,
+            recv_buf_max: 100_000,
         }
     }
 }
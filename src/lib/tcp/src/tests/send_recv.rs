@@ -6,7 +6,7 @@ use std::rc::Rc;
 use bytes::Bytes;
 
 use crate::tests::{establish_helper, Host, Scheduler, TcpSocket, TestEnvState};
-use crate::{Ipv4Header, Payload, Shutdown, TcpFlags, TcpHeader, TcpState};
+use crate::{Ipv4Header, Payload, Shutdown, TcpFlags, TcpHeader, TcpState, TcpStateKind};
 
 #[test]
 fn test_send_recv() {
@@ -57,6 +57,54 @@ fn test_send_recv() {
     assert_eq!(recv_buf, b"world");
 }
 
+#[test]
+fn test_info() {
+    let scheduler = Scheduler::new();
+    let mut host = Host::new();
+
+    // get an established tcp socket
+    let tcp = establish_helper(&scheduler, &mut host);
+
+    let info = tcp.borrow().tcp_state().info();
+    assert_eq!(info.state, TcpStateKind::Established);
+    assert_eq!(info.unacked, 0);
+    assert_eq!(info.send_buffer_len, 0);
+
+    // send on the socket
+    TcpSocket::sendmsg(&tcp, &b"hello"[..], 5).unwrap();
+    scheduler.pop_packet().unwrap();
+
+    let info = tcp.borrow().tcp_state().info();
+    assert_eq!(info.unacked, 5);
+    assert_eq!(info.send_buffer_len, 5);
+
+    // acknowledge the data and send a payload to the socket
+    let header = TcpHeader {
+        ip: Ipv4Header {
+            src: "5.6.7.8".parse().unwrap(),
+            dst: host.ip_addr,
+        },
+        flags: TcpFlags::ACK,
+        src_port: 20,
+        dst_port: 10,
+        seq: 1,
+        ack: 6,
+        window_size: 10000,
+        selective_acks: None,
+        window_scale: None,
+        timestamp: None,
+        timestamp_echo: None,
+    };
+    tcp.borrow_mut()
+        .push_in_packet(&header, Bytes::from(&b"world"[..]).into());
+
+    let info = tcp.borrow().tcp_state().info();
+    assert_eq!(info.unacked, 0);
+    assert_eq!(info.send_buffer_len, 0);
+    assert_eq!(info.recv_buffer_len, 5);
+    assert_eq!(info.send_window, 10000);
+}
+
 /// This test tries to make sure that an acknowledgement sent while the socket's usable send window
 /// (send window excluding in-flight not-acked data) is empty uses the correct sequence number.
 /// (This test doesn't require that the usable send window is actually empty, just that it's empty
@@ -0,0 +1,159 @@
+//! Adaptive spin-then-park policy for waiting on a peer.
+
+/// Decides how long a waiter should busy-wait for a peer before falling back
+/// to sleeping on a futex, and keeps statistics about which path was taken.
+///
+/// The spin window is learned from recent round trips, counted in spin
+/// iterations: when the peer answers while we're spinning, the window tracks
+/// a moving average of how long that took; when we end up parking, the
+/// window shrinks. After a run of parks the next wait probes with the largest
+/// window once, so that the spinner can learn round trips longer than its
+/// current window. On a dedicated machine the peer usually answers quickly,
+/// so we avoid the futex syscalls; on an oversubscribed machine the peer
+/// usually isn't running, so we quickly stop wasting the core.
+///
+/// This object isn't shared between threads; each waiter owns its own.
+#[derive(Debug, Copy, Clone)]
+pub struct AdaptiveSpinner {
+    // Moving average of the number of spins needed when spinning succeeded,
+    // scaled by `AVG_SCALE`.
+    scaled_avg_spins: u32,
+    window: u32,
+    consecutive_parks: u32,
+    stats: AdaptiveSpinStats,
+}
+
+/// How often each path was taken by an [`AdaptiveSpinner`].
+#[derive(Debug, Copy, Clone, Default, Eq, PartialEq)]
+pub struct AdaptiveSpinStats {
+    /// Waits that completed while spinning.
+    pub spun: u64,
+    /// Waits that fell back to parking.
+    pub parked: u64,
+}
+
+impl AdaptiveSpinner {
+    pub const MIN_WINDOW: u32 = 16;
+    pub const INITIAL_WINDOW: u32 = 1 << 10;
+    /// Largest window; on the order of a few microseconds.
+    pub const MAX_WINDOW: u32 = 1 << 14;
+    /// Number of consecutive parks after which we probe with `MAX_WINDOW`.
+    pub const PROBE_INTERVAL: u32 = 64;
+    const AVG_SCALE: u32 = 8;
+
+    pub const fn new() -> Self {
+        Self {
+            scaled_avg_spins: Self::INITIAL_WINDOW / 2 * Self::AVG_SCALE,
+            window: Self::INITIAL_WINDOW,
+            consecutive_parks: 0,
+            stats: AdaptiveSpinStats { spun: 0, parked: 0 },
+        }
+    }
+
+    /// Number of spin iterations to try before parking.
+    pub fn window(&self) -> u32 {
+        self.window
+    }
+
+    /// Spins for up to `window()` iterations, until `ready` returns true.
+    /// Records the outcome and returns whether `ready` returned true.
+    pub fn spin_until<F: FnMut() -> bool>(&mut self, mut ready: F) -> bool {
+        for spins in 0..self.window {
+            if ready() {
+                self.record_spun(spins);
+                return true;
+            }
+            core::hint::spin_loop();
+        }
+        self.record_parked();
+        false
+    }
+
+    fn record_spun(&mut self, spins: u32) {
+        self.stats.spun += 1;
+        self.consecutive_parks = 0;
+        // avg = 7/8 avg + 1/8 spins, in fixed point.
+        self.scaled_avg_spins = self.scaled_avg_spins - self.scaled_avg_spins / Self::AVG_SCALE
+            + spins.min(Self::MAX_WINDOW);
+        // Leave headroom over the average, so that the slower round trips
+        // still complete while spinning. Also cover this round trip, so that
+        // a successful probe isn't immediately forgotten.
+        let avg = self.scaled_avg_spins / Self::AVG_SCALE;
+        self.window = (avg.max(spins) * 2).clamp(Self::MIN_WINDOW, Self::MAX_WINDOW);
+    }
+
+    fn record_parked(&mut self) {
+        self.stats.parked += 1;
+        // The peer took longer than the whole window. Back off, so that we
+        // don't keep burning the window when the peer isn't running.
+        self.scaled_avg_spins /= 2;
+        self.window = (self.window / 2).max(Self::MIN_WINDOW);
+        self.consecutive_parks += 1;
+        if self.consecutive_parks == Self::PROBE_INTERVAL {
+            self.consecutive_parks = 0;
+            self.window = Self::MAX_WINDOW;
+        }
+    }
+
+    pub fn stats(&self) -> AdaptiveSpinStats {
+        self.stats
+    }
+}
+
+impl Default for AdaptiveSpinner {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+#[cfg(all(test, not(loom)))]
+mod tests {
+    use super::*;
+
+    fn spin_for(spinner: &mut AdaptiveSpinner, spins: u32) -> bool {
+        let mut remaining = spins;
+        spinner.spin_until(|| {
+            let done = remaining == 0;
+            remaining = remaining.saturating_sub(1);
+            done
+        })
+    }
+
+    #[test]
+    fn test_window_tracks_round_trip() {
+        let mut spinner = AdaptiveSpinner::new();
+        for _ in 0..100 {
+            assert!(spin_for(&mut spinner, 100));
+        }
+        assert_eq!(
+            spinner.stats(),
+            AdaptiveSpinStats {
+                spun: 100,
+                parked: 0
+            }
+        );
+        assert!((100..=400).contains(&spinner.window()));
+    }
+
+    #[test]
+    fn test_window_shrinks_when_parking() {
+        let mut spinner = AdaptiveSpinner::new();
+        for _ in 0..10 {
+            assert!(!spinner.spin_until(|| false));
+        }
+        assert_eq!(spinner.window(), AdaptiveSpinner::MIN_WINDOW);
+        assert_eq!(spinner.stats().parked, 10);
+    }
+
+    #[test]
+    fn test_probes_after_parking() {
+        let mut spinner = AdaptiveSpinner::new();
+        for _ in 0..AdaptiveSpinner::PROBE_INTERVAL {
+            assert!(!spinner.spin_until(|| false));
+        }
+        assert_eq!(spinner.window(), AdaptiveSpinner::MAX_WINDOW);
+        // A round trip longer than the initial window is now learned.
+        assert!(spin_for(&mut spinner, 2 * AdaptiveSpinner::INITIAL_WINDOW));
+        assert!(spinner.window() > AdaptiveSpinner::INITIAL_WINDOW);
+    }
+}
@@ -38,6 +38,7 @@
 // https://github.com/shadow/shadow/issues/2919
 #![cfg_attr(all(not(test), not(loom)), no_std)]
 
+pub mod adaptive_spin;
 pub mod atomic_tls_map;
 pub mod lazy_lock;
 pub mod scchannel;
@@ -3,6 +3,7 @@ use core::mem::MaybeUninit;
 
 use vasi::VirtualAddressSpaceIndependent;
 
+use crate::adaptive_spin::AdaptiveSpinner;
 use crate::sync::{self, AtomicU32, UnsafeCell};
 
 #[derive(Debug, Copy, Clone, Eq, PartialEq, VirtualAddressSpaceIndependent)]
@@ -293,6 +294,20 @@ impl<T> SelfContainedChannel<T> {
         Ok(val)
     }
 
+    /// Like `receive`, but first busy-waits for up to `spinner`'s current
+    /// window for the channel to become ready, avoiding the futex syscalls
+    /// when the writer answers quickly.
+    pub fn receive_with_spinner(
+        &self,
+        spinner: &mut AdaptiveSpinner,
+    ) -> Result<T, SelfContainedChannelError> {
+        spinner.spin_until(|| {
+            let state = self.state.load(sync::atomic::Ordering::Relaxed);
+            state.contents_state == ChannelContentsState::Ready || state.writer_closed
+        });
+        self.receive()
+    }
+
     /// Closes the "write" end of the channel. This will cause any current
     /// and subsequent `receive` operations to fail once the channel is empty.
     ///
@@ -322,6 +337,19 @@ impl<T> SelfContainedChannel<T> {
             .load(sync::atomic::Ordering::Relaxed)
             .writer_closed
     }
+
+    /// Whether the channel is in the same state as a newly created one: empty,
+    /// with no waiting reader, and with the write-end still open. A channel
+    /// that's idle and that no other thread can access can be reused as if it
+    /// were new.
+    pub fn is_idle(&self) -> bool {
+        self.state.load(sync::atomic::Ordering::Acquire)
+            == ChannelState {
+                has_sleeper: false,
+                writer_closed: false,
+                contents_state: ChannelContentsState::Empty,
+            }
+    }
 }
 
 unsafe impl<T> Send for SelfContainedChannel<T> where T: Send {}
@@ -21,6 +21,20 @@ mod scchannel_tests {
         })
     }
 
+    #[test]
+    fn test_is_idle() {
+        sync::model(|| {
+            let channel = SelfContainedChannel::new();
+            assert!(channel.is_idle());
+            channel.send(42);
+            assert!(!channel.is_idle());
+            assert_eq!(channel.receive().unwrap(), 42);
+            assert!(channel.is_idle());
+            channel.close_writer();
+            assert!(!channel.is_idle());
+        })
+    }
+
     #[test]
     fn test_two_threads() {
         sync::model(|| {
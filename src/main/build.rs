@@ -57,6 +57,8 @@ fn run_cbindgen(build_common: &ShadowBuildCommon) {
             "main/bindings/c/bindings-opaque.h".into(),
             "main/core/worker.h".into(),
             "main/host/descriptor/descriptor_types.h".into(),
+            "main/host/descriptor/file_cache.h".into(),
+            "main/host/descriptor/stat_cache.h".into(),
             "main/host/descriptor/tcp.h".into(),
             "main/host/descriptor/epoll.h".into(),
             "main/host/futex.h".into(),
@@ -115,7 +117,12 @@ fn run_cbindgen(build_common: &ShadowBuildCommon) {
             Some(v)
         };
         config.export = cbindgen::ExportConfig {
-            include: vec!["QDiscMode".into(), "FileSignals".into(), "FileState".into()],
+            include: vec![
+                "QDiscMode".into(),
+                "FileSignals".into(),
+                "FileState".into(),
+                "ObjectType".into(),
+            ],
             // Export everything except function definitions, since those are already
             // exported in the other header file, and need the C header files.
             item_types: base_config
@@ -145,8 +152,11 @@ fn run_bindgen(build_common: &ShadowBuildCommon) {
         .header("host/descriptor/compat_socket.h")
         .header("host/descriptor/descriptor.h")
         .header("host/descriptor/epoll.h")
+        .header("host/descriptor/file_cache.h")
         .header("host/descriptor/regular_file.h")
+        .header("host/descriptor/stat_cache.h")
         .header("host/descriptor/tcp_cong.h")
+        .header("host/descriptor/tcp_cong_cubic.h")
         .header("host/descriptor/tcp_cong_reno.h")
         .header("host/futex.h")
         .header("host/status_listener.h")
@@ -170,9 +180,6 @@ fn run_bindgen(build_common: &ShadowBuildCommon) {
         // Haven't decided how to handle glib struct types yet. Avoid using them
         // until we do.
         .blocklist_type("_?GQueue")
-        .allowlist_function("g_list_append")
-        .allowlist_function("g_list_free")
-        .allowlist_type("GList")
         // Needs GQueue
         .opaque_type("_?LegacySocket.*")
         .blocklist_type("_?Socket.*")
@@ -219,6 +226,8 @@ fn run_bindgen(build_common: &ShadowBuildCommon) {
         .allowlist_function("workerc_.*")
         .allowlist_function("packet_.*")
         .allowlist_function("epoll_new")
+        .allowlist_function("filecache_.*")
+        .allowlist_function("statcache_new")
         .allowlist_function("glib_check_version")
         //# Needs GQueue
         .blocklist_function("worker_finish")
@@ -232,6 +241,8 @@ fn run_bindgen(build_common: &ShadowBuildCommon) {
         .allowlist_type("Manager")
         .allowlist_type("RegularFile")
         .allowlist_type("Epoll")
+        .allowlist_type("FileCache")
+        .allowlist_type("StatCache")
         .allowlist_type("FileType")
         .allowlist_type("Trigger")
         .allowlist_type("TriggerType")
@@ -242,12 +253,18 @@ fn run_bindgen(build_common: &ShadowBuildCommon) {
         .allowlist_type("ShadowSyscallNum")
         .allowlist_var("AFFINITY_UNINIT")
         .allowlist_var("CONFIG_HEADER_SIZE_TCP")
+        .allowlist_var("CONFIG_HEADER_SIZE_UDPIP")
         .allowlist_var("CONFIG_PIPE_BUFFER_SIZE")
         .allowlist_var("CONFIG_MTU")
+        .allowlist_var("CONFIG_TCP_MAX_SEGMENT_SIZE")
+        .allowlist_var("CONFIG_TCP_MAX_SEGMENTS_PER_PACKET")
+        .allowlist_var("PACKET_TCP_MAX_SACK_BLOCKS")
         .allowlist_var("SYSCALL_IO_BUFSIZE")
         .allowlist_var("SHADOW_SOMAXCONN")
+        .allowlist_var("TCP_CONG_CUBIC_NAME")
         .allowlist_var("TCP_CONG_RENO_NAME")
         .allowlist_var("SHADOW_FLAG_MASK")
+        .allowlist_var("TRACKER_SOCKET_HANDLE_NONE")
         .allowlist_var("GLIB_MAJOR_VERSION")
         .allowlist_var("GLIB_MINOR_VERSION")
         .allowlist_var("GLIB_MICRO_VERSION")
@@ -352,10 +369,13 @@ fn build_shadow_c(build_common: &ShadowBuildCommon) {
         "host/status_listener.c",
         "host/descriptor/compat_socket.c",
         "host/descriptor/epoll.c",
+        "host/descriptor/file_cache.c",
         "host/descriptor/regular_file.c",
         "host/descriptor/socket.c",
+        "host/descriptor/stat_cache.c",
         "host/descriptor/tcp.c",
         "host/descriptor/tcp_cong.c",
+        "host/descriptor/tcp_cong_cubic.c",
         "host/descriptor/tcp_cong_reno.c",
         "host/process.c",
         "host/futex.c",
@@ -378,6 +398,7 @@ fn build_shadow_c(build_common: &ShadowBuildCommon) {
         "routing/packet.c",
         "routing/address.c",
         "routing/dns.c",
+        "utility/freelist.c",
         "utility/priority_queue.c",
         "utility/rpath.c",
         "utility/utility.c",
@@ -41,6 +41,9 @@ typedef struct _PlatformCPUInfo {
     CPUInfo* p_cpus;
     size_t n_cpus;
     int max_cpu_num;
+    // The CPU that managed processes are pinned to, indexed by the logical CPU
+    // number of their worker.
+    int* process_cpus;
     // Keep track of how many workers are assigned to each core, socket, and
     // node.
     GHashTable *cpu_loads, *core_loads, *socket_loads, *node_loads;
@@ -213,6 +216,17 @@ int affinity_getGoodWorkerAffinity() {
     return p_best_cpu->logical_cpu_num;
 }
 
+int affinity_getProcessAffinity(int worker_cpu_num) {
+    if (!_affinity_enabled || worker_cpu_num == AFFINITY_UNINIT) {
+        return worker_cpu_num;
+    }
+
+    assert(worker_cpu_num >= 0 && worker_cpu_num <= _global_platform_info.max_cpu_num);
+
+    // the table isn't modified after initialization, so doesn't need a lock
+    return _global_platform_info.process_cpus[worker_cpu_num];
+}
+
 /*
  * Read the output of the lscpu command, allocates a buffer, and sets contents
  * to point to the buffer.
@@ -383,7 +397,48 @@ static cpu_set_t* _getAffinity(size_t cpu_num) {
     }
 }
 
-int affinity_initPlatformInfo() {
+/*
+ * Fill the table of process CPUs. Each eligible CPU maps to the first other
+ * eligible CPU on the same core, or to itself if the core has no other eligible
+ * CPUs (for example if SMT is disabled or the process affinity excludes them).
+ */
+static void _global_platform_info_process_cpus_init(bool use_sibling_cpus) {
+    assert(_global_platform_info.p_cpus);
+
+    int n_entries = _global_platform_info.max_cpu_num + 1;
+    _global_platform_info.process_cpus = malloc(sizeof(int) * n_entries);
+    assert(_global_platform_info.process_cpus);
+
+    for (int cpu_num = 0; cpu_num < n_entries; ++cpu_num) {
+        _global_platform_info.process_cpus[cpu_num] = cpu_num;
+    }
+
+    if (!use_sibling_cpus) {
+        return;
+    }
+
+    for (size_t idx = 0; idx < _global_platform_info.n_cpus; ++idx) {
+        const CPUInfo* p_info = &_global_platform_info.p_cpus[idx];
+        if (!_cpuIdxIsEligible(idx)) {
+            continue;
+        }
+
+        for (size_t sibling_idx = 0; sibling_idx < _global_platform_info.n_cpus; ++sibling_idx) {
+            const CPUInfo* p_sibling = &_global_platform_info.p_cpus[sibling_idx];
+            if (sibling_idx != idx && p_sibling->core == p_info->core &&
+                p_sibling->socket == p_info->socket && _cpuIdxIsEligible(sibling_idx)) {
+                _global_platform_info.process_cpus[p_info->logical_cpu_num] =
+                    p_sibling->logical_cpu_num;
+                break;
+            }
+        }
+
+        trace("Processes of workers on CPU %d will run on CPU %d", p_info->logical_cpu_num,
+              _global_platform_info.process_cpus[p_info->logical_cpu_num]);
+    }
+}
+
+int affinity_initPlatformInfo(bool use_sibling_cpus) {
 
     char* lscpu_contents = NULL;
     int rc = _affinity_readLSCPU(&lscpu_contents);
@@ -413,6 +468,8 @@ int affinity_initPlatformInfo() {
             MAX(_global_platform_info.max_cpu_num, p_info->logical_cpu_num);
     }
 
+    _global_platform_info_process_cpus_init(use_sibling_cpus);
+
     if (lscpu_contents) {
         free(lscpu_contents);
     }
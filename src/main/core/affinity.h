@@ -3,6 +3,7 @@
 
 #include <glib.h>
 #include <sched.h>
+#include <stdbool.h>
 #include <sys/types.h>
 
 /*
@@ -14,15 +15,30 @@
 enum { AFFINITY_UNINIT = -1 };
 
 /*
- * Returns a good CPU number affinity for the next worker.
+ * Returns a good CPU number affinity for the next worker. Workers are spread
+ * across physical cores before two workers are assigned to the same core.
  *
  * THREAD SAFETY: Thread-safe.
  */
 int affinity_getGoodWorkerAffinity();
 
+/*
+ * Returns the CPU number that the managed processes of a worker pinned to
+ * worker_cpu_num should be pinned to. This is an SMT (hyperthread) sibling of
+ * worker_cpu_num if use_sibling_cpus was set in affinity_initPlatformInfo() and
+ * the sibling is available to this process, and worker_cpu_num otherwise.
+ *
+ * THREAD SAFETY: Thread-safe.
+ */
+int affinity_getProcessAffinity(int worker_cpu_num);
+
 /*
  * Try to parse platform CPU orientation information from the host machine.
  *
+ * If use_sibling_cpus is set, affinity_getProcessAffinity() returns an SMT
+ * sibling of each worker's CPU, so that a worker and its managed processes run
+ * on the same physical core without sharing a logical CPU.
+ *
  * THREAD SAFETY: Not thread-safe. Only call this function once per program
  * execution.
  *
@@ -31,7 +47,7 @@ int affinity_getGoodWorkerAffinity();
  * 0 if no errors occurred and platform information was successfully
  * initialized. Otherwise returns -1 and emits an error message to the log.
  */
-int affinity_initPlatformInfo();
+int affinity_initPlatformInfo(bool use_sibling_cpus);
 
 /*
  * Try to set the affinity of the process with the given pid to new_cpu_num. Logs a
@@ -25,7 +25,7 @@ use serde::{Deserialize, Serialize};
 use shadow_shim_helper_rs::simulation_time::SimulationTime;
 
 use crate::cshadow as c;
-use crate::host::syscall::formatter::FmtOptions;
+use crate::host::syscall::formatter::{FmtOptions, StraceOptions};
 use crate::utility::units::{self, Unit};
 
 const START_HELP_TEXT: &str = "\
@@ -50,7 +50,7 @@ static VERSION: Lazy<String> = Lazy::new(crate::shadow::version);
 #[clap(hide_possible_values = true)]
 pub struct CliOptions {
     /// Path to the Shadow configuration file. Use '-' to read from stdin
-    #[clap(required_unless_present_any(&["show_build_info", "shm_cleanup"]))]
+    #[clap(required_unless_present_any(&["show_build_info", "shm_cleanup", "decode_strace"]))]
     pub config: Option<String>,
 
     /// Pause to allow gdb to attach
@@ -74,6 +74,10 @@ pub struct CliOptions {
     #[clap(long)]
     pub show_config: bool,
 
+    /// Exit after printing the syscalls in a binary strace file as text
+    #[clap(long, exclusive(true), value_name = "path")]
+    pub decode_strace: Option<String>,
+
     #[clap(flatten)]
     pub general: GeneralOptions,
 
@@ -104,7 +108,12 @@ pub struct ConfigFileOptions {
     // we use a BTreeMap so that the hosts are sorted by their hostname (useful for determinism)
     // since shadow parses to a serde_yaml::Value initially, we don't need to worry about duplicate
     // hostnames here
+    #[serde(default)]
     pub hosts: BTreeMap<HostName, HostOptions>,
+
+    // keyed by the hostname prefix of the group's hosts
+    #[serde(default)]
+    pub host_groups: BTreeMap<HostName, HostGroupOptions>,
 }
 
 /// Shadow configuration options after processing command-line and configuration file options.
@@ -118,6 +127,10 @@ pub struct ConfigOptions {
 
     // we use a BTreeMap so that the hosts are sorted by their hostname (useful for determinism)
     pub hosts: BTreeMap<HostName, HostOptions>,
+
+    // the groups aren't expanded here, since they may contain a very large number of hosts; see
+    // `HostGroupOptions::host`
+    pub host_groups: BTreeMap<HostName, HostGroupOptions>,
 }
 
 impl ConfigOptions {
@@ -143,12 +156,20 @@ impl ConfigOptions {
                 .clone()
                 .with_defaults(config_file.host_option_defaults.clone());
         }
+        for group in config_file.host_groups.values_mut() {
+            group.host.host_options = group
+                .host
+                .host_options
+                .clone()
+                .with_defaults(config_file.host_option_defaults.clone());
+        }
 
         Self {
             general: config_file.general,
             network: config_file.network,
             experimental: config_file.experimental,
             hosts: config_file.hosts,
+            host_groups: config_file.host_groups,
         }
     }
 
@@ -156,6 +177,12 @@ impl ConfigOptions {
         self.general.model_unblocked_syscall_latency.unwrap()
     }
 
+    pub fn early_process_launch_lead(&self) -> SimulationTime {
+        let nanos = self.experimental.early_process_launch_lead.unwrap();
+        let nanos = nanos.convert(units::TimePrefix::Nano).unwrap().value();
+        SimulationTime::from_nanos(nanos)
+    }
+
     pub fn max_unapplied_cpu_latency(&self) -> SimulationTime {
         let nanos = self.experimental.max_unapplied_cpu_latency.unwrap();
         let nanos = nanos.convert(units::TimePrefix::Nano).unwrap().value();
@@ -174,10 +201,53 @@ impl ConfigOptions {
         SimulationTime::from_nanos(nanos)
     }
 
-    pub fn strace_logging_mode(&self) -> Option<FmtOptions> {
+    pub fn native_preemption_native_interval(&self) -> SimulationTime {
+        let nanos = self.experimental.native_preemption_native_interval.unwrap();
+        let nanos = nanos.convert(units::TimePrefix::Nano).unwrap().value();
+        SimulationTime::from_nanos(nanos)
+    }
+
+    pub fn native_preemption_sim_interval(&self) -> SimulationTime {
+        let nanos = self.experimental.native_preemption_sim_interval.unwrap();
+        let nanos = nanos.convert(units::TimePrefix::Nano).unwrap().value();
+        SimulationTime::from_nanos(nanos)
+    }
+
+    pub fn cpu_delay_threshold(&self) -> Option<SimulationTime> {
+        let nanos = self.experimental.cpu_delay_threshold.flatten()?;
+        let nanos = nanos.convert(units::TimePrefix::Nano).unwrap().value();
+        Some(SimulationTime::from_nanos(nanos))
+    }
+
+    pub fn cpu_delay_precision(&self) -> Option<SimulationTime> {
+        let nanos = self.experimental.cpu_delay_precision.flatten()?;
+        let nanos = nanos.convert(units::TimePrefix::Nano).unwrap().value();
+        Some(SimulationTime::from_nanos(nanos))
+    }
+
+    pub fn cpu_delay_quantum(&self) -> SimulationTime {
+        let nanos = self.experimental.cpu_delay_quantum.unwrap();
+        let nanos = nanos.convert(units::TimePrefix::Nano).unwrap().value();
+        SimulationTime::from_nanos(nanos)
+    }
+
+    pub fn strace_logging_mode(&self) -> Option<StraceOptions> {
         match self.experimental.strace_logging_mode.as_ref().unwrap() {
-            StraceLoggingMode::Standard => Some(FmtOptions::Standard),
-            StraceLoggingMode::Deterministic => Some(FmtOptions::Deterministic),
+            StraceLoggingMode::Standard => Some(StraceOptions::Text(FmtOptions::Standard)),
+            StraceLoggingMode::Deterministic => {
+                Some(StraceOptions::Text(FmtOptions::Deterministic))
+            }
+            StraceLoggingMode::Binary => Some(StraceOptions::Binary {
+                buffer_prefix: self
+                    .experimental
+                    .strace_buffer_prefix
+                    .unwrap()
+                    .convert(units::SiPrefixUpper::Base)
+                    .unwrap()
+                    .value()
+                    .try_into()
+                    .unwrap(),
+            }),
             StraceLoggingMode::Off => None,
         }
     }
@@ -324,6 +394,12 @@ pub struct ExperimentalOptions {
     #[clap(help = EXP_HELP.get("use_syscall_counters").unwrap().as_str())]
     pub use_syscall_counters: Option<bool>,
 
+    /// Record histograms of the wall-clock time spent handling each syscall
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_syscall_latency_histograms").unwrap().as_str())]
+    pub use_syscall_latency_histograms: Option<bool>,
+
     /// Count object allocations and deallocations. If disabled, we will not be able to detect object memory leaks
     #[clap(hide_short_help = true)]
     #[clap(long, value_name = "bool")]
@@ -350,6 +426,22 @@ pub struct ExperimentalOptions {
     #[clap(help = EXP_HELP.get("use_preload_openssl_crypto").unwrap().as_str())]
     pub use_preload_openssl_crypto: Option<bool>,
 
+    /// Additional crypto primitives for the preloaded OpenSSL crypto library to elide: any of
+    /// "aes-gcm", "sha256", "ecdh", and "rsa". Requires `use_preload_openssl_crypto`.
+    #[clap(hide_short_help = true)]
+    #[clap(value_parser = parse_set_str)]
+    #[clap(long, value_name = "primitives")]
+    #[clap(help = EXP_HELP.get("openssl_crypto_elision").unwrap().as_str())]
+    pub openssl_crypto_elision: Option<HashSet<String>>,
+
+    /// Rewrite each rdtsc and rdtscp instruction the first time it's trapped,
+    /// so that later executions call the emulation directly instead of raising
+    /// a SIGSEGV. The emulation then runs on the managed thread's own stack.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_rdtsc_patching").unwrap().as_str())]
+    pub use_rdtsc_patching: Option<bool>,
+
     /// Use the MemoryManager in memory-mapping mode. This can improve
     /// performance, but disables support for dynamically spawning processes
     /// inside the simulation (e.g. the `fork` syscall).
@@ -358,19 +450,104 @@ pub struct ExperimentalOptions {
     #[clap(help = EXP_HELP.get("use_memory_manager").unwrap().as_str())]
     pub use_memory_manager: Option<bool>,
 
+    /// Ask for the memory manager's mappings of managed process memory into Shadow to be backed by
+    /// transparent huge pages, and fill in the page tables of the initial heap up front. Only
+    /// has an effect with `use_memory_manager`, and only if the kernel allows huge pages for
+    /// shared memory.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_memory_manager_huge_pages").unwrap().as_str())]
+    pub use_memory_manager_huge_pages: Option<bool>,
+
+    /// Serve reads of files that are only open for reading from a cache of memory-mapped files
+    /// shared by all hosts. Files must not be modified while the simulation is running.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_file_read_cache").unwrap().as_str())]
+    pub use_file_read_cache: Option<bool>,
+
+    /// Make writes and fsyncs of os-backed files from a background I/O thread rather than from
+    /// the worker thread. An error from a write is returned by a later write, fsync, or close of the
+    /// file.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_async_file_writes").unwrap().as_str())]
+    pub use_async_file_writes: Option<bool>,
+
+    /// Don't create a host's data directory until it's needed, or a process's stdout and stderr
+    /// files until the process first uses them.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_lazy_output_files").unwrap().as_str())]
+    pub use_lazy_output_files: Option<bool>,
+
+    /// Absolute paths of directory trees that don't change during the simulation. Metadata lookups
+    /// (stat, statx, access, and readlink) of paths in these trees are cached and shared by all
+    /// hosts
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "paths", value_delimiter = ',')]
+    #[clap(help = EXP_HELP.get("read_only_paths").unwrap().as_str())]
+    pub read_only_paths: Option<Vec<String>>,
+
+    /// Write the packets captured for all hosts with `pcap_enabled` to a single pcapng file in the
+    /// data directory, rather than to a pcap file per interface
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_merged_pcap").unwrap().as_str())]
+    pub use_merged_pcap: Option<bool>,
+
+    /// Cache the paths that each host's managed processes have looked up and found don't exist,
+    /// and answer repeated lookups of them without a syscall
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_missing_path_cache").unwrap().as_str())]
+    pub use_missing_path_cache: Option<bool>,
+
     /// Pin each thread and any processes it executes to the same logical CPU Core to improve cache affinity
     #[clap(hide_short_help = true)]
     #[clap(long, value_name = "bool")]
     #[clap(help = EXP_HELP.get("use_cpu_pinning").unwrap().as_str())]
     pub use_cpu_pinning: Option<bool>,
 
+    /// When CPU pinning is enabled, pin each worker's managed processes to a hyperthread sibling of
+    /// the worker's CPU rather than to the worker's CPU itself
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_smt_sibling_pinning").unwrap().as_str())]
+    pub use_smt_sibling_pinning: Option<bool>,
+
     /// Each worker thread will spin in a `sched_yield` loop while waiting for a new task. This is
-    /// ignored if not using the thread-per-core scheduler.
+    /// ignored if not using the thread-per-core or work-stealing scheduler.
     #[clap(hide_short_help = true)]
     #[clap(long, value_name = "bool")]
     #[clap(help = EXP_HELP.get("use_worker_spinning").unwrap().as_str())]
     pub use_worker_spinning: Option<bool>,
 
+    /// Write a timeline of the hosts that each worker thread runs, the time that it waits for the
+    /// other workers, and any long syscalls, to `worker-trace.json` in the data directory. The
+    /// file is in the Chrome trace event format, and can be viewed with Perfetto.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_worker_trace").unwrap().as_str())]
+    pub use_worker_trace: Option<bool>,
+
+    /// Worker threads signal the end of each round through a combining tree rather than a single
+    /// shared counter, which reduces contention with many worker threads. This is ignored if not
+    /// using the thread-per-core or work-stealing scheduler.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_worker_tree_barrier").unwrap().as_str())]
+    pub use_worker_tree_barrier: Option<bool>,
+
+    /// Count hardware and software performance events (cycles, instructions, last-level cache
+    /// misses, and context switches) of each worker thread with `perf_event_open`, and report them
+    /// for each host in the sim-stats file. Only Shadow's work for a host is counted, not the work
+    /// of its managed processes.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_perf_counters").unwrap().as_str())]
+    pub use_perf_counters: Option<bool>,
+
     /// If set, overrides the automatically calculated minimum time workers may run ahead when sending events between nodes
     #[clap(hide_short_help = true)]
     #[clap(long, value_name = "seconds")]
@@ -383,6 +560,46 @@ pub struct ExperimentalOptions {
     #[clap(help = EXP_HELP.get("use_dynamic_runahead").unwrap().as_str())]
     pub use_dynamic_runahead: Option<bool>,
 
+    /// Let each host run ahead by the lowest latency of any path to that host, rather than by the
+    /// lowest latency in the simulation.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_per_host_runahead").unwrap().as_str())]
+    pub use_per_host_runahead: Option<bool>,
+
+    /// Store each host's events in a calendar queue rather than a binary heap
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_calendar_event_queue").unwrap().as_str())]
+    pub use_calendar_event_queue: Option<bool>,
+
+    /// Compute the shortest paths from each graph node when a packet is first sent from it,
+    /// rather than between all nodes when the simulation starts
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_on_demand_routing").unwrap().as_str())]
+    pub use_on_demand_routing: Option<bool>,
+
+    /// The number of graph nodes whose shortest paths are cached when `use_on_demand_routing` is
+    /// enabled
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "N")]
+    #[clap(help = EXP_HELP.get("routing_cache_size").unwrap().as_str())]
+    pub routing_cache_size: Option<u32>,
+
+    /// Launch each process's native process ahead of its start time
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_early_process_launch").unwrap().as_str())]
+    pub use_early_process_launch: Option<bool>,
+
+    /// How long before its start time each process is launched when `use_early_process_launch` is
+    /// enabled
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "seconds")]
+    #[clap(help = EXP_HELP.get("early_process_launch_lead").unwrap().as_str())]
+    pub early_process_launch_lead: Option<units::Time<units::TimePrefix>>,
+
     /// Initial size of the socket's send buffer
     #[clap(hide_short_help = true)]
     #[clap(long, value_name = "bytes")]
@@ -407,12 +624,41 @@ pub struct ExperimentalOptions {
     #[clap(help = EXP_HELP.get("socket_recv_autotune").unwrap().as_str())]
     pub socket_recv_autotune: Option<bool>,
 
+    /// Pace TCP data packets at a rate derived from the connection's estimated bottleneck
+    /// bandwidth and minimum round-trip time, instead of sending the whole congestion window at
+    /// once
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("tcp_pacing").unwrap().as_str())]
+    pub tcp_pacing: Option<bool>,
+
+    /// The number of MSS-sized segments the legacy TCP implementation may send in a single
+    /// packet, similar to TCP segmentation offload. Each packet counts as one segment for
+    /// sequence numbers, windows, and acks.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "N")]
+    #[clap(help = EXP_HELP.get("tcp_segments_per_packet").unwrap().as_str())]
+    pub tcp_segments_per_packet: Option<u32>,
+
     /// The queueing discipline to use at the network interface
     #[clap(hide_short_help = true)]
     #[clap(long, value_name = "mode")]
     #[clap(help = EXP_HELP.get("interface_qdisc").unwrap().as_str())]
     pub interface_qdisc: Option<QDiscMode>,
 
+    /// Deliver packets between sockets on the same host in batches, like packets that arrive
+    /// from the router, rather than one at a time
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_loopback_batching").unwrap().as_str())]
+    pub use_loopback_batching: Option<bool>,
+
+    /// The queueing discipline to use for packets that the router delivers to a host
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "mode")]
+    #[clap(help = EXP_HELP.get("router_qdisc").unwrap().as_str())]
+    pub router_qdisc: Option<RouterQDiscMode>,
+
     /// Log level at which to print host statistics
     #[clap(hide_short_help = true)]
     #[clap(long, value_name = "level")]
@@ -426,6 +672,19 @@ pub struct ExperimentalOptions {
     #[clap(help = EXP_HELP.get("host_heartbeat_log_info").unwrap().as_str())]
     pub host_heartbeat_log_info: Option<HashSet<LogInfoFlag>>,
 
+    /// Format in which to write host heartbeat statistics
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "format")]
+    #[clap(help = EXP_HELP.get("host_heartbeat_format").unwrap().as_str())]
+    pub host_heartbeat_format: Option<HeartbeatFormat>,
+
+    /// Account for only about one in every N packets in the host heartbeat's packet and byte
+    /// counters, and scale them up by N
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "N")]
+    #[clap(help = EXP_HELP.get("host_heartbeat_packet_sampling").unwrap().as_str())]
+    pub host_heartbeat_packet_sampling: Option<u32>,
+
     /// Amount of time between heartbeat messages for this host
     #[clap(hide_short_help = true)]
     #[clap(long, value_name = "seconds")]
@@ -438,6 +697,21 @@ pub struct ExperimentalOptions {
     #[clap(help = EXP_HELP.get("strace_logging_mode").unwrap().as_str())]
     pub strace_logging_mode: Option<StraceLoggingMode>,
 
+    /// In the "binary" strace logging mode, the number of bytes of each buffer read or written by
+    /// a read or write syscall, or address passed to connect or bind, to include in the log
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bytes")]
+    #[clap(help = EXP_HELP.get("strace_buffer_prefix").unwrap().as_str())]
+    pub strace_buffer_prefix: Option<units::Bytes<units::SiPrefixUpper>>,
+
+    /// File in which to cache the native TSC frequency, keyed by CPU model, so
+    /// that it's only measured once per machine. The cached value is used for
+    /// rdtsc emulation in place of measuring it again.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "path")]
+    #[clap(help = EXP_HELP.get("tsc_frequency_cache").unwrap().as_str())]
+    pub tsc_frequency_cache: Option<NullableOption<String>>,
+
     /// Max amount of execution-time latency allowed to accumulate before the
     /// clock is moved forward. Moving the clock forward is a potentially
     /// expensive operation, so larger values reduce simulation overhead, at the
@@ -448,6 +722,25 @@ pub struct ExperimentalOptions {
     #[clap(help = EXP_HELP.get("max_unapplied_cpu_latency").unwrap().as_str())]
     pub max_unapplied_cpu_latency: Option<units::Time<units::TimePrefix>>,
 
+    /// If set, write live performance metrics in the Prometheus text format to "metrics.prom" in
+    /// the data directory at this interval of real (wall-clock) time.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "seconds")]
+    #[clap(help = EXP_HELP.get("metrics_interval").unwrap().as_str())]
+    pub metrics_interval: Option<NullableOption<units::Time<units::TimePrefix>>>,
+
+    /// Syscalls (by name) that the shim's seccomp filter lets go straight to
+    /// the kernel instead of trapping them. Only syscalls that Shadow would
+    /// execute natively anyway are allowed. These syscalls are then no longer
+    /// counted, logged to strace files, or charged
+    /// `unblocked_syscall_latency`. Candidates are listed under
+    /// `native_syscalls` in sim-stats.json.
+    #[clap(hide_short_help = true)]
+    #[clap(value_parser = parse_set_str)]
+    #[clap(long, value_name = "syscalls")]
+    #[clap(help = EXP_HELP.get("native_syscall_passthrough").unwrap().as_str())]
+    pub native_syscall_passthrough: Option<HashSet<String>>,
+
     /// Simulated latency of an unblocked syscall. For efficiency Shadow only
     /// actually adds this latency if and when `max_unapplied_cpu_latency` is
     /// reached.
@@ -464,6 +757,54 @@ pub struct ExperimentalOptions {
     #[clap(help = EXP_HELP.get("unblocked_vdso_latency").unwrap().as_str())]
     pub unblocked_vdso_latency: Option<units::Time<units::TimePrefix>>,
 
+    /// When enabled, the shim arms a timer on each managed thread's native CPU
+    /// time, and preempts the thread each time it has run for
+    /// `native_preemption_native_interval` without returning control to
+    /// Shadow, moving simulated time forward by
+    /// `native_preemption_sim_interval`. This bounds how long a busy loop that
+    /// never makes a syscall can run for.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("native_preemption_enabled").unwrap().as_str())]
+    pub native_preemption_enabled: Option<bool>,
+
+    /// Native CPU time a managed thread may run for before being preempted,
+    /// when `native_preemption_enabled` is set.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "seconds")]
+    #[clap(help = EXP_HELP.get("native_preemption_native_interval").unwrap().as_str())]
+    pub native_preemption_native_interval: Option<units::Time<units::TimePrefix>>,
+
+    /// Simulated time to move forward each time a managed thread is preempted,
+    /// when `native_preemption_enabled` is set.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "seconds")]
+    #[clap(help = EXP_HELP.get("native_preemption_sim_interval").unwrap().as_str())]
+    pub native_preemption_sim_interval: Option<units::Time<units::TimePrefix>>,
+
+    /// If set, model a host's CPU as busy for the native time spent running its
+    /// processes, and delay the host's events once the accumulated CPU delay is
+    /// more than this threshold. Requires Shadow to be built with perf timers.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "seconds")]
+    #[clap(help = EXP_HELP.get("cpu_delay_threshold").unwrap().as_str())]
+    pub cpu_delay_threshold: Option<NullableOption<units::Time<units::TimePrefix>>>,
+
+    /// If set, round the CPU delay accumulated during each
+    /// `cpu_delay_quantum` to this granularity.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "seconds")]
+    #[clap(help = EXP_HELP.get("cpu_delay_precision").unwrap().as_str())]
+    pub cpu_delay_precision: Option<NullableOption<units::Time<units::TimePrefix>>>,
+
+    /// The simulated time between folding the accumulated native CPU time into
+    /// a host's CPU delay. Larger values reduce the overhead of the CPU model,
+    /// at the cost of applying delays later.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "seconds")]
+    #[clap(help = EXP_HELP.get("cpu_delay_quantum").unwrap().as_str())]
+    pub cpu_delay_quantum: Option<units::Time<units::TimePrefix>>,
+
     /// The host scheduler implementation, which decides how to assign hosts to threads and threads
     /// to CPU cores
     #[clap(hide_short_help = true)]
@@ -471,6 +812,21 @@ pub struct ExperimentalOptions {
     #[clap(help = EXP_HELP.get("scheduler").unwrap().as_str())]
     pub scheduler: Option<Scheduler>,
 
+    /// The maximum number of threads that the thread-per-host scheduler runs hosts on, or 0 for a
+    /// thread for every host
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "N")]
+    #[clap(help = EXP_HELP.get("thread_per_host_max_threads").unwrap().as_str())]
+    pub thread_per_host_max_threads: Option<u32>,
+
+    /// A host profile written by a previous run of the same simulation ("host-profile.json" in
+    /// its data directory), used to balance the hosts across the worker threads and CPU cores
+    /// before the first round
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "path")]
+    #[clap(help = EXP_HELP.get("partition_profile").unwrap().as_str())]
+    pub partition_profile: Option<NullableOption<String>>,
+
     /// When true, report error-level messages to stderr in addition to logging to stdout.
     #[clap(hide_short_help = true)]
     #[clap(long, value_name = "bool")]
@@ -497,39 +853,83 @@ impl Default for ExperimentalOptions {
         Self {
             use_sched_fifo: Some(false),
             use_syscall_counters: Some(true),
+            use_syscall_latency_histograms: Some(false),
             use_object_counters: Some(true),
             use_preload_libc: Some(true),
             use_preload_openssl_rng: Some(true),
             use_preload_openssl_crypto: Some(false),
+            openssl_crypto_elision: Some(HashSet::new()),
             max_unapplied_cpu_latency: Some(units::Time::new(1, units::TimePrefix::Micro)),
+            metrics_interval: Some(NullableOption::Null),
             // 1-2 microseconds is a ballpark estimate of the minimal latency for
             // context switching to the kernel and back on modern machines.
             // Default to the lower end to minimize effect in simualations without busy loops.
             unblocked_syscall_latency: Some(units::Time::new(1, units::TimePrefix::Micro)),
+            native_syscall_passthrough: Some(HashSet::new()),
             // Actual latencies vary from ~40 to ~400 CPU cycles. https://stackoverflow.com/a/13096917
             // Default to the lower end to minimize effect in simualations without busy loops.
             unblocked_vdso_latency: Some(units::Time::new(10, units::TimePrefix::Nano)),
+            native_preemption_enabled: Some(false),
+            native_preemption_native_interval: Some(units::Time::new(
+                100,
+                units::TimePrefix::Milli,
+            )),
+            native_preemption_sim_interval: Some(units::Time::new(10, units::TimePrefix::Milli)),
+            cpu_delay_threshold: Some(NullableOption::Null),
+            cpu_delay_precision: Some(NullableOption::Value(units::Time::new(
+                200,
+                units::TimePrefix::Nano,
+            ))),
+            cpu_delay_quantum: Some(units::Time::new(1, units::TimePrefix::Milli)),
             use_memory_manager: Some(false),
+            use_memory_manager_huge_pages: Some(false),
+            use_file_read_cache: Some(false),
+            use_async_file_writes: Some(false),
+            use_lazy_output_files: Some(false),
+            use_merged_pcap: Some(false),
+            use_missing_path_cache: Some(false),
+            read_only_paths: Some(Vec::new()),
+            use_rdtsc_patching: Some(false),
             use_cpu_pinning: Some(true),
+            use_smt_sibling_pinning: Some(false),
             use_worker_spinning: Some(true),
+            use_worker_trace: Some(false),
+            use_worker_tree_barrier: Some(false),
+            use_perf_counters: Some(false),
             runahead: Some(NullableOption::Value(units::Time::new(
                 1,
                 units::TimePrefix::Milli,
             ))),
             use_dynamic_runahead: Some(false),
+            use_per_host_runahead: Some(false),
+            use_calendar_event_queue: Some(false),
+            use_on_demand_routing: Some(false),
+            routing_cache_size: Some(1024),
+            use_early_process_launch: Some(false),
+            early_process_launch_lead: Some(units::Time::new(1, units::TimePrefix::Sec)),
             socket_send_buffer: Some(units::Bytes::new(131_072, units::SiPrefixUpper::Base)),
             socket_send_autotune: Some(true),
             socket_recv_buffer: Some(units::Bytes::new(174_760, units::SiPrefixUpper::Base)),
             socket_recv_autotune: Some(true),
+            tcp_pacing: Some(false),
+            tcp_segments_per_packet: Some(1),
             interface_qdisc: Some(QDiscMode::Fifo),
+            use_loopback_batching: Some(false),
+            router_qdisc: Some(RouterQDiscMode::Codel),
             host_heartbeat_log_level: Some(LogLevel::Info),
             host_heartbeat_log_info: Some(IntoIterator::into_iter([LogInfoFlag::Node]).collect()),
+            host_heartbeat_format: Some(HeartbeatFormat::Log),
+            host_heartbeat_packet_sampling: Some(1),
             host_heartbeat_interval: Some(NullableOption::Value(units::Time::new(
                 1,
                 units::TimePrefix::Sec,
             ))),
             strace_logging_mode: Some(StraceLoggingMode::Off),
+            strace_buffer_prefix: Some(units::Bytes::new(0, units::SiPrefixUpper::Base)),
+            tsc_frequency_cache: Some(NullableOption::Null),
             scheduler: Some(Scheduler::ThreadPerCore),
+            thread_per_host_max_threads: Some(0),
+            partition_profile: Some(NullableOption::Null),
             report_errors_to_stderr: Some(true),
             use_new_tcp: Some(false),
         }
@@ -563,6 +963,16 @@ pub struct HostDefaultOptions {
     #[clap(long, value_name = "bytes")]
     #[clap(help = HOST_HELP.get("pcap_capture_size").unwrap().as_str())]
     pub pcap_capture_size: Option<units::Bytes<units::SiPrefixUpper>>,
+
+    /// Only capture the packet headers if pcap logging is enabled
+    #[clap(long, value_name = "bool")]
+    #[clap(help = HOST_HELP.get("pcap_headers_only").unwrap().as_str())]
+    pub pcap_headers_only: Option<bool>,
+
+    /// The congestion control algorithm used by new TCP sockets
+    #[clap(long, value_name = "algorithm")]
+    #[clap(help = HOST_HELP.get("tcp_congestion_control").unwrap().as_str())]
+    pub tcp_congestion_control: Option<TcpCongestionControl>,
 }
 
 impl HostDefaultOptions {
@@ -574,6 +984,8 @@ impl HostDefaultOptions {
             // capture all the data available from the packet". The maximum length of an IP packet
             // (including the header) is 65535 bytes.
             pcap_capture_size: Some(units::Bytes::new(65535, units::SiPrefixUpper::Base)),
+            pcap_headers_only: Some(false),
+            tcp_congestion_control: Some(TcpCongestionControl::Reno),
         }
     }
 
@@ -596,6 +1008,8 @@ impl Default for HostDefaultOptions {
             log_level: None,
             pcap_enabled: None,
             pcap_capture_size: None,
+            pcap_headers_only: None,
+            tcp_congestion_control: None,
         }
     }
 }
@@ -691,6 +1105,89 @@ pub struct HostOptions {
 
     #[serde(default)]
     pub host_options: HostDefaultOptions,
+
+    /// Background traffic that the host sends without running a process
+    #[serde(default)]
+    pub traffic: Vec<TrafficOptions>,
+}
+
+/// Background traffic that Shadow generates for a host. Flows start as a Poisson process and have
+/// Pareto-distributed sizes, and are sent to the peer as UDP datagrams.
+#[derive(Debug, Clone, Serialize, Deserialize, JsonSchema)]
+#[serde(deny_unknown_fields)]
+pub struct TrafficOptions {
+    /// The host to send the traffic to
+    pub peer: HostName,
+
+    /// The UDP port on the peer that the traffic is sent to
+    #[serde(default = "default_traffic_port")]
+    pub port: u16,
+
+    /// The mean number of flows started per second
+    pub flow_rate: f64,
+
+    /// The minimum size of a flow (the scale of the Pareto distribution)
+    pub flow_size_min: units::Bytes<units::SiPrefixUpper>,
+
+    /// The shape of the Pareto distribution of flow sizes
+    #[serde(default = "default_traffic_flow_size_shape")]
+    pub flow_size_shape: f64,
+
+    /// The simulated time at which to start sending
+    #[serde(default)]
+    pub start_time: units::Time<units::TimePrefix>,
+
+    /// The simulated time at which to stop starting new flows
+    #[serde(default)]
+    pub stop_time: Option<units::Time<units::TimePrefix>>,
+}
+
+/// A group of hosts with the same options, which is much smaller to parse than a separate entry
+/// for each host.
+#[derive(Debug, Clone, Serialize, Deserialize, JsonSchema)]
+#[serde(deny_unknown_fields)]
+pub struct HostGroupOptions {
+    /// Number of hosts in the group
+    pub count: u32,
+
+    /// Options for each host in the group
+    pub host: HostOptions,
+}
+
+impl HostGroupOptions {
+    /// The string that is replaced by a host's index in its process arguments and environment.
+    const INDEX_PATTERN: &'static str = "{index}";
+
+    /// The name of the host at `index` (starting from 1) in the group with name prefix `prefix`.
+    pub fn host_name(prefix: &HostName, index: u32) -> Result<HostName, String> {
+        let name = format!("{prefix}{index}");
+        // the prefix is a valid hostname and we only appended digits, so we only need to check
+        // the length
+        if name.len() > 253 {
+            return Err(format!("hostname '{name}' exceeds 253 characters"));
+        }
+        Ok(HostName(name))
+    }
+
+    /// The options of the host at `index` (starting from 1) in the group.
+    pub fn host(&self, index: u32) -> HostOptions {
+        let index = index.to_string();
+        let substitute = |s: &mut String| {
+            if s.contains(Self::INDEX_PATTERN) {
+                *s = s.replace(Self::INDEX_PATTERN, &index);
+            }
+        };
+
+        let mut host = self.host.clone();
+        for process in &mut host.processes {
+            match &mut process.args {
+                ProcessArgs::List(args) => args.iter_mut().for_each(substitute),
+                ProcessArgs::Str(args) => substitute(args),
+            }
+            process.environment.values_mut().for_each(substitute);
+        }
+        host
+    }
 }
 
 #[derive(Debug, Copy, Clone, Serialize, Deserialize, JsonSchema)]
@@ -894,6 +1391,7 @@ impl std::fmt::Display for EnvName {
 pub enum Scheduler {
     ThreadPerHost,
     ThreadPerCore,
+    WorkStealing,
 }
 
 impl FromStr for Scheduler {
@@ -934,6 +1432,21 @@ impl FromStr for LogInfoFlag {
     }
 }
 
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Serialize, Deserialize, JsonSchema)]
+#[serde(rename_all = "kebab-case")]
+pub enum HeartbeatFormat {
+    Log,
+    Binary,
+}
+
+impl FromStr for HeartbeatFormat {
+    type Err = serde_yaml::Error;
+
+    fn from_str(s: &str) -> Result<Self, Self::Err> {
+        serde_yaml::from_str(s)
+    }
+}
+
 /// Parse a string as a comma-delimited set of `T` values.
 fn parse_set<T>(s: &str) -> Result<HashSet<T>, <T as FromStr>::Err>
 where
@@ -960,6 +1473,8 @@ fn parse_set_str(s: &str) -> Result<HashSet<String>, <String as FromStr>::Err> {
 pub enum QDiscMode {
     Fifo,
     RoundRobin,
+    /// Deficit round robin, weighted by each socket's `SO_PRIORITY`.
+    DeficitRoundRobin,
 }
 
 impl FromStr for QDiscMode {
@@ -970,6 +1485,45 @@ impl FromStr for QDiscMode {
     }
 }
 
+#[derive(Debug, Clone, Copy, Hash, PartialEq, Eq, Serialize, Deserialize, JsonSchema)]
+#[serde(rename_all = "kebab-case")]
+pub enum RouterQDiscMode {
+    Codel,
+    FqCodel,
+}
+
+impl FromStr for RouterQDiscMode {
+    type Err = serde_yaml::Error;
+
+    fn from_str(s: &str) -> Result<Self, Self::Err> {
+        serde_yaml::from_str(s)
+    }
+}
+
+#[derive(Debug, Clone, Copy, Hash, PartialEq, Eq, Serialize, Deserialize, JsonSchema)]
+#[serde(rename_all = "kebab-case")]
+pub enum TcpCongestionControl {
+    Reno,
+    Cubic,
+}
+
+impl FromStr for TcpCongestionControl {
+    type Err = serde_yaml::Error;
+
+    fn from_str(s: &str) -> Result<Self, Self::Err> {
+        serde_yaml::from_str(s)
+    }
+}
+
+impl TcpCongestionControl {
+    pub fn to_c_congestion_type(&self) -> c::TCPCongestionType {
+        match self {
+            Self::Reno => c::_TCPCongestionType_TCP_CC_RENO,
+            Self::Cubic => c::_TCPCongestionType_TCP_CC_CUBIC,
+        }
+    }
+}
+
 #[derive(Debug, Clone, Serialize, Deserialize, JsonSchema)]
 #[serde(rename_all = "kebab-case")]
 pub enum Compression {
@@ -1163,6 +1717,7 @@ pub enum StraceLoggingMode {
     Off,
     Standard,
     Deterministic,
+    Binary,
 }
 
 impl FromStr for StraceLoggingMode {
@@ -1310,6 +1865,16 @@ fn default_args_empty() -> ProcessArgs {
     ProcessArgs::Str("".to_string())
 }
 
+/// Helper function for serde default `TrafficOptions::port` values. It's the "discard" port.
+fn default_traffic_port() -> u16 {
+    9
+}
+
+/// Helper function for serde default `TrafficOptions::flow_size_shape` values.
+fn default_traffic_flow_size_shape() -> f64 {
+    1.5
+}
+
 /// Helper function for serde default `Signal(Signal::SIGTERM)` values.
 fn default_sigterm() -> Signal {
     Signal(nix::sys::signal::Signal::SIGTERM)
@@ -1609,4 +2174,97 @@ mod tests {
             Some(NullableOption::Null)
         );
     }
+
+    #[test]
+    // can't call foreign function: process_parseArgStr
+    #[cfg_attr(miri, ignore)]
+    fn test_host_group() {
+        let yaml = r#"
+            general:
+              stop_time: 1 min
+            network:
+              graph:
+                type: 1_gbit_switch
+            host_groups:
+              peer:
+                count: 3
+                host:
+                  network_node_id: 0
+                  processes:
+                  - path: /bin/echo
+                    args: id={index} name=peer{index}
+                    environment:
+                      ID: "{index}"
+            "#;
+
+        let config_file: ConfigFileOptions = serde_yaml::from_str(yaml).unwrap();
+        let cli: CliOptions = CliOptions::try_parse_from(["shadow", "-"]).unwrap();
+        let merged = ConfigOptions::new(config_file, cli);
+
+        assert!(merged.hosts.is_empty());
+        let (prefix, group) = merged.host_groups.iter().next().unwrap();
+        assert_eq!(group.count, 3);
+
+        let name = HostGroupOptions::host_name(prefix, 2).unwrap();
+        assert_eq!(&*name, "peer2");
+
+        let host = group.host(2);
+        let process = &host.processes[0];
+        assert!(matches!(&process.args, ProcessArgs::Str(x) if x == "id=2 name=peer2"));
+        assert_eq!(
+            process
+                .environment
+                .get(&EnvName::new("ID").unwrap())
+                .unwrap(),
+            "2"
+        );
+
+        // the group's template shouldn't be modified
+        assert!(
+            matches!(&group.host.processes[0].args, ProcessArgs::Str(x) if x.contains("{index}"))
+        );
+    }
+    #[test]
+    fn test_host_traffic() {
+        let yaml = r#"
+            general:
+              stop_time: 1 min
+            network:
+              graph:
+                type: 1_gbit_switch
+            hosts:
+              client:
+                network_node_id: 0
+                processes: []
+                traffic:
+                - peer: server
+                  flow_rate: 0.5
+                  flow_size_min: 10 KB
+              server:
+                network_node_id: 0
+                processes: []
+            "#;
+
+        let config_file: ConfigFileOptions = serde_yaml::from_str(yaml).unwrap();
+        let cli: CliOptions = CliOptions::try_parse_from(["shadow", "-"]).unwrap();
+        let merged = ConfigOptions::new(config_file, cli);
+
+        let client = merged.hosts.get(&HostName("client".to_string())).unwrap();
+        let traffic = &client.traffic[0];
+        assert_eq!(&*traffic.peer, "server");
+        assert_eq!(traffic.port, 9);
+        assert_eq!(traffic.flow_size_shape, 1.5);
+        assert_eq!(
+            traffic
+                .flow_size_min
+                .convert(units::SiPrefixUpper::Base)
+                .unwrap()
+                .value(),
+            10_000
+        );
+        assert!(traffic.stop_time.is_none());
+
+        let server = merged.hosts.get(&HostName("server".to_string())).unwrap();
+        assert!(server.traffic.is_empty());
+    }
 }
@@ -128,6 +128,12 @@ typedef struct Host Host;
  */
 #define CONFIG_TCP_MAX_SEGMENT_SIZE (CONFIG_MTU - CONFIG_HEADER_SIZE_TCPIP)
 
+/**
+ * Maximum number of TCP segments that may be sent in a single packet, so that
+ * the packet stays within the maximum IP packet size
+ */
+#define CONFIG_TCP_MAX_SEGMENTS_PER_PACKET ((65535 - CONFIG_HEADER_SIZE_TCPIP) / CONFIG_TCP_MAX_SEGMENT_SIZE)
+
 /**
  * Maximum size of a datagram we are allowed to send out over the network
  */
@@ -138,4 +144,15 @@ typedef struct Host Host;
  */
 #define CONFIG_TCPCLOSETIMER_DELAY (60 * SIMTIME_ONE_SECOND)
 
+/**
+ * Number of delivery rate samples (roughly one per round trip) over which TCP pacing takes the
+ * maximum to estimate the bottleneck bandwidth.
+ */
+#define CONFIG_TCP_PACING_RATE_SAMPLES 10
+
+/**
+ * How long in nanoseconds a minimum RTT measurement stays valid for TCP pacing.
+ */
+#define CONFIG_TCP_PACING_MIN_RTT_WINDOW (10 * SIMTIME_ONE_SECOND)
+
 #endif /* SHD_DEFINITIONS_H_ */
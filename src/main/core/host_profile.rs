@@ -0,0 +1,127 @@
+//! The costs of each host measured during a simulation. Shadow writes these to "host-profile.json"
+//! in the data directory at the end of each simulation, and a later run of the same simulation can
+//! load them (`experimental.partition_profile`) to balance the hosts across the worker threads and
+//! logical processors before the first round, rather than only learning the costs as it runs.
+
+use std::collections::BTreeMap;
+
+use anyhow::Context;
+use serde::{Deserialize, Serialize};
+
+/// The costs of a single host over the whole simulation.
+#[derive(Copy, Clone, Debug, Default, PartialEq, Eq, Serialize, Deserialize)]
+pub struct HostProfile {
+    /// Wall-clock time spent running the host's events.
+    pub execution_ns: u64,
+    /// Syscalls handled by Shadow for the host's processes.
+    pub syscalls: u64,
+    /// Packets created by the host.
+    pub packets: u64,
+    /// The sum of the peak resident memory of each of the host's processes.
+    pub process_rss_bytes: u64,
+}
+
+impl HostProfile {
+    /// Add the costs of `other`, for example from a different worker thread.
+    pub fn add(&mut self, other: &Self) {
+        self.execution_ns = self.execution_ns.saturating_add(other.execution_ns);
+        self.syscalls = self.syscalls.saturating_add(other.syscalls);
+        self.packets = self.packets.saturating_add(other.packets);
+        self.process_rss_bytes = self
+            .process_rss_bytes
+            .saturating_add(other.process_rss_bytes);
+    }
+}
+
+/// The costs of all hosts in a simulation.
+#[derive(Clone, Debug, Default, PartialEq, Eq, Serialize, Deserialize)]
+pub struct SimProfile {
+    /// The number of scheduling rounds that the simulation ran.
+    pub rounds: u64,
+    /// The costs of each host, keyed by hostname.
+    pub hosts: BTreeMap<String, HostProfile>,
+}
+
+impl SimProfile {
+    /// The average time that the host `name` took to run in each round, or 0 if the host isn't in
+    /// the profile. This is the cost expected by the schedulers' `new_with_costs` constructors.
+    pub fn host_cost_ns(&self, name: &str) -> u64 {
+        let Some(host) = self.hosts.get(name) else {
+            return 0;
+        };
+        host.execution_ns / std::cmp::max(self.rounds, 1)
+    }
+
+    pub fn read_from_file(filename: &std::path::Path) -> anyhow::Result<Self> {
+        let file = std::fs::File::open(filename)
+            .with_context(|| format!("Failed to open file '{}'", filename.display()))?;
+
+        serde_json::from_reader(std::io::BufReader::new(file)).with_context(|| {
+            format!(
+                "Failed to parse host profile json from file '{}'",
+                filename.display()
+            )
+        })
+    }
+
+    pub fn write_to_file(&self, filename: &std::path::Path) -> anyhow::Result<()> {
+        let file = std::fs::File::create(filename)
+            .with_context(|| format!("Failed to create file '{}'", filename.display()))?;
+
+        serde_json::to_writer_pretty(file, self).with_context(|| {
+            format!(
+                "Failed to write host profile json to file '{}'",
+                filename.display()
+            )
+        })?;
+
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_host_cost() {
+        let mut profile = SimProfile {
+            rounds: 10,
+            hosts: BTreeMap::new(),
+        };
+        profile.hosts.insert(
+            "server".into(),
+            HostProfile {
+                execution_ns: 1000,
+                ..Default::default()
+            },
+        );
+
+        assert_eq!(profile.host_cost_ns("server"), 100);
+        assert_eq!(profile.host_cost_ns("client"), 0);
+
+        // a simulation that ended before its first round
+        profile.rounds = 0;
+        assert_eq!(profile.host_cost_ns("server"), 1000);
+    }
+
+    #[test]
+    fn test_round_trip() {
+        let mut profile = SimProfile {
+            rounds: 3,
+            hosts: BTreeMap::new(),
+        };
+        profile.hosts.insert(
+            "server".into(),
+            HostProfile {
+                execution_ns: 1,
+                syscalls: 2,
+                packets: 3,
+                process_rss_bytes: 4,
+            },
+        );
+
+        let json = serde_json::to_string(&profile).unwrap();
+        assert_eq!(serde_json::from_str::<SimProfile>(&json).unwrap(), profile);
+    }
+}
@@ -0,0 +1,224 @@
+//! Live performance metrics for `experimental.metrics_interval`. The manager periodically writes
+//! them to a file in the Prometheus text exposition format, so that a long-running simulation can
+//! be inspected (or scraped) while it runs.
+
+use std::collections::HashMap;
+use std::fmt::Write as _;
+use std::path::PathBuf;
+use std::time::{Duration, Instant};
+
+use atomic_refcell::AtomicRefCell;
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+use shadow_shim_helper_rs::HostId;
+
+use crate::core::resource_usage::ProcessUsage;
+
+/// The number of hosts to include in the `shadow_host_events` metric.
+const NUM_BUSIEST_HOSTS: usize = 10;
+
+/// Metrics collected by a scheduler thread while it runs hosts. Each thread only updates its own,
+/// and the manager only reads them between rounds.
+#[derive(Debug, Default)]
+pub struct ThreadMetrics {
+    /// Real time spent running hosts.
+    busy_time: Duration,
+    hosts_executed: u64,
+    events_executed: u64,
+    /// Events executed by each host since the metrics were last written.
+    host_events: HashMap<HostId, u64>,
+}
+
+impl ThreadMetrics {
+    /// Record that the thread executed `events` events of the host `host_id`.
+    pub fn add_host(&mut self, host_id: HostId, events: u64) {
+        self.hosts_executed += 1;
+        self.events_executed += events;
+        *self.host_events.entry(host_id).or_default() += events;
+    }
+
+    /// Record that the thread spent `time` running hosts in a round.
+    pub fn add_busy_time(&mut self, time: Duration) {
+        self.busy_time += time;
+    }
+}
+
+pub struct LiveMetrics {
+    path: PathBuf,
+    interval: Duration,
+    page_size: u64,
+    start: Instant,
+    last_write: Instant,
+    rounds: u64,
+    /// Real time spent in scheduling rounds. A thread that isn't running hosts during a round is
+    /// waiting for the other threads to finish it.
+    round_time: Duration,
+}
+
+impl LiveMetrics {
+    pub fn new(path: PathBuf, interval: Duration) -> Self {
+        let page_size = nix::unistd::sysconf(nix::unistd::SysconfVar::PAGE_SIZE)
+            .unwrap()
+            .unwrap();
+        let now = Instant::now();
+        Self {
+            path,
+            interval,
+            page_size: u64::try_from(page_size).unwrap(),
+            start: now,
+            last_write: now,
+            rounds: 0,
+            round_time: Duration::ZERO,
+        }
+    }
+
+    /// Record a completed round that took `round_time` of real time, and write the metrics if
+    /// they're due.
+    pub fn finish_round(
+        &mut self,
+        round_time: Duration,
+        sim_time: EmulatedTime,
+        threads: &[AtomicRefCell<ThreadMetrics>],
+    ) {
+        self.rounds += 1;
+        self.round_time += round_time;
+
+        let now = Instant::now();
+        if now.duration_since(self.last_write) < self.interval {
+            return;
+        }
+        self.last_write = now;
+
+        if let Err(e) = self.write(now, sim_time, threads) {
+            log::warn!(
+                "Unable to write metrics to '{}': {}",
+                self.path.display(),
+                e
+            );
+        }
+    }
+
+    fn write(
+        &self,
+        now: Instant,
+        sim_time: EmulatedTime,
+        threads: &[AtomicRefCell<ThreadMetrics>],
+    ) -> std::io::Result<()> {
+        let mut out = String::new();
+
+        let mut metric = |name: &str, kind: &str, help: &str, values: &[(String, String)]| {
+            writeln!(out, "# HELP {name} {help}").unwrap();
+            writeln!(out, "# TYPE {name} {kind}").unwrap();
+            for (labels, value) in values {
+                writeln!(out, "{name}{labels} {value}").unwrap();
+            }
+        };
+        let unlabeled = |value: String| [(String::new(), value)];
+        let seconds = |t: Duration| format!("{:.6}", t.as_secs_f64());
+
+        metric(
+            "shadow_rounds_total",
+            "counter",
+            "Scheduling rounds completed.",
+            &unlabeled(self.rounds.to_string()),
+        );
+        metric(
+            "shadow_sim_time_seconds",
+            "gauge",
+            "Simulated time at the start of the last round.",
+            &unlabeled(seconds(
+                sim_time
+                    .duration_since(&EmulatedTime::SIMULATION_START)
+                    .into(),
+            )),
+        );
+        metric(
+            "shadow_real_time_seconds",
+            "counter",
+            "Real time since the simulation started running.",
+            &unlabeled(seconds(now.duration_since(self.start))),
+        );
+
+        let mut self_usage = ProcessUsage::default();
+        if self_usage
+            .add_process(i32::try_from(std::process::id()).unwrap(), self.page_size)
+            .is_ok()
+        {
+            metric(
+                "shadow_resident_memory_bytes",
+                "gauge",
+                "Resident memory of the Shadow process.",
+                &unlabeled(self_usage.rss_bytes().to_string()),
+            );
+        }
+
+        let mut hosts_executed = Vec::new();
+        let mut events_executed = Vec::new();
+        let mut busy_time = Vec::new();
+        let mut wait_time = Vec::new();
+        let mut host_events: HashMap<HostId, u64> = HashMap::new();
+        for (i, thread) in threads.iter().enumerate() {
+            let mut thread = thread.borrow_mut();
+            let labels = format!("{{worker=\"{i}\"}}");
+            hosts_executed.push((labels.clone(), thread.hosts_executed.to_string()));
+            events_executed.push((labels.clone(), thread.events_executed.to_string()));
+            busy_time.push((labels.clone(), seconds(thread.busy_time)));
+            wait_time.push((
+                labels,
+                seconds(self.round_time.saturating_sub(thread.busy_time)),
+            ));
+            for (host_id, events) in thread.host_events.drain() {
+                *host_events.entry(host_id).or_default() += events;
+            }
+        }
+
+        metric(
+            "shadow_worker_hosts_executed_total",
+            "counter",
+            "Times that a worker thread ran a host with events in a round.",
+            &hosts_executed,
+        );
+        metric(
+            "shadow_worker_events_total",
+            "counter",
+            "Events executed by a worker thread.",
+            &events_executed,
+        );
+        metric(
+            "shadow_worker_busy_seconds_total",
+            "counter",
+            "Real time that a worker thread spent running hosts.",
+            &busy_time,
+        );
+        metric(
+            "shadow_worker_wait_seconds_total",
+            "counter",
+            "Real time that a worker thread spent waiting for the other workers to finish a round.",
+            &wait_time,
+        );
+
+        // sort by the number of events, using the host id to break ties deterministically
+        let mut host_events: Vec<(HostId, u64)> = host_events.into_iter().collect();
+        host_events.sort_unstable_by(|a, b| b.1.cmp(&a.1).then(a.0.cmp(&b.0)));
+        let busiest_hosts: Vec<(String, String)> = host_events
+            .iter()
+            .take(NUM_BUSIEST_HOSTS)
+            .map(|(host_id, events)| {
+                (
+                    format!("{{host_id=\"{}\"}}", u32::from(*host_id)),
+                    events.to_string(),
+                )
+            })
+            .collect();
+        metric(
+            "shadow_host_events",
+            "gauge",
+            "Events executed since the last update by the hosts that executed the most.",
+            &busiest_hosts,
+        );
+
+        // write to a temporary file and rename it so that readers never see a partial file
+        let tmp_path = self.path.with_extension("prom.tmp");
+        std::fs::write(&tmp_path, out)?;
+        std::fs::rename(&tmp_path, &self.path)
+    }
+}
@@ -1,7 +1,8 @@
-use std::cell::RefCell;
+use std::cell::{Cell, RefCell};
+use std::sync::atomic::{AtomicBool, Ordering};
 use std::sync::mpsc::{Receiver, Sender};
 use std::sync::Arc;
-use std::sync::{Mutex, RwLock};
+use std::sync::Mutex;
 use std::time::Duration;
 
 use crossbeam::queue::ArrayQueue;
@@ -24,6 +25,9 @@ const ASYNC_FLUSH_QD_LINES_THRESHOLD: usize = 100_000;
 /// continue growing.
 const SYNC_FLUSH_QD_LINES_THRESHOLD: usize = 10 * ASYNC_FLUSH_QD_LINES_THRESHOLD;
 
+/// Initial capacity of a record's message buffer. Enough for most messages.
+const MESSAGE_INITIAL_CAPACITY: usize = 256;
+
 /// Logging thread flushes at least this often.
 const MIN_FLUSH_FREQUENCY: Duration = Duration::from_secs(10);
 
@@ -58,6 +62,7 @@ pub fn init(
         // may have already been destructed, and because the logger thread
         // itself may be in a bad state), and ignore errors.
         SHADOW_LOGGER.flush_records(None).ok();
+        SHADOW_LOGGER.flush_round_records().ok();
         default_panic_handler(panic_info);
     }));
 
@@ -93,9 +98,18 @@ pub struct ShadowLogger {
     // large.
     records: ArrayQueue<ShadowLogRecord>,
 
+    // Batches of records that worker threads logged during the current
+    // scheduling round. They're sent to the logger thread when the round
+    // finishes, which merges them by simulation time. Each thread only locks
+    // this once per round (or when its local buffer gets large), rather than
+    // once per record.
+    round_records: Mutex<Vec<Vec<ShadowLogRecord>>>,
+
     // When false, sends a (still-asynchronous) flush command to the logger
-    // thread every time a record is pushed into `records`.
-    buffering_enabled: RwLock<bool>,
+    // thread every time a record is pushed into `records`, and records aren't
+    // buffered until the end of the round. Read for every record, so it's an
+    // atomic rather than a lock.
+    buffering_enabled: AtomicBool,
 
     // The maximum log level, unless overridden by a host-specific log level.
     max_log_level: OnceCell<LevelFilter>,
@@ -105,8 +119,14 @@ pub struct ShadowLogger {
 }
 
 thread_local!(static SENDER: RefCell<Option<Sender<LoggerCommand>>> = const{ RefCell::new(None)});
-thread_local!(static THREAD_NAME: String = get_thread_name());
+// Shared with every record logged from the thread, so that logging doesn't
+// need to copy it.
+thread_local!(static THREAD_NAME: Arc<str> = get_thread_name().into());
 thread_local!(static THREAD_ID: nix::unistd::Pid = nix::unistd::gettid());
+// Whether the thread is running hosts in a scheduling round, and the records
+// that it has logged during the round.
+thread_local!(static IN_ROUND: Cell<bool> = const { Cell::new(false) });
+thread_local!(static THREAD_ROUND_RECORDS: RefCell<Vec<ShadowLogRecord>> = const { RefCell::new(Vec::new()) });
 
 fn get_thread_name() -> String {
     let mut thread_name = Vec::<i8>::with_capacity(16);
@@ -149,7 +169,8 @@ impl ShadowLogger {
             records: ArrayQueue::new(SYNC_FLUSH_QD_LINES_THRESHOLD),
             command_sender: Mutex::new(sender),
             command_receiver: Mutex::new(receiver),
-            buffering_enabled: RwLock::new(false),
+            round_records: Mutex::new(Vec::new()),
+            buffering_enabled: AtomicBool::new(false),
             max_log_level: OnceCell::new(),
             report_errors_to_stderr: OnceCell::new(),
         }
@@ -164,6 +185,10 @@ impl ShadowLogger {
             use std::sync::mpsc::RecvTimeoutError;
             match command_receiver.recv_timeout(MIN_FLUSH_FREQUENCY) {
                 Ok(LoggerCommand::Flush(done_sender)) => self.flush_records(done_sender).unwrap(),
+                Ok(LoggerCommand::FinishRound {
+                    num_queued,
+                    batches,
+                }) => self.write_round(num_queued, batches).unwrap(),
                 Err(RecvTimeoutError::Timeout) => {
                     // Flush
                     self.flush_records(None).unwrap();
@@ -184,46 +209,13 @@ impl ShadowLogger {
         // synchronous flush (whether this flush operation or another one that
         // arrives while we're flushing) will be left waiting longer than
         // necessary. Also keeps us from holding the stdout lock indefinitely.
-        let mut toflush = self.records.len();
+        let toflush = self.records.len();
 
         let stdout_unlocked = std::io::stdout();
         let stdout_locked = stdout_unlocked.lock();
         let mut stdout = std::io::BufWriter::new(stdout_locked);
 
-        while toflush > 0 {
-            let record = match self.records.pop() {
-                Some(r) => r,
-                None => {
-                    // This can happen if another thread panics while the
-                    // logging thread is flushing. In that case both threads
-                    // will be consuming from the queue.
-                    break;
-                }
-            };
-            toflush -= 1;
-
-            write!(stdout, "{record}")?;
-
-            if record.level <= Level::Error && *self.report_errors_to_stderr.get().unwrap() {
-                // *also* summarize on stderr.
-
-                // First flush stdout to avoid confusing interleaving if stdout and stderr are merged.
-                stdout.flush()?;
-
-                // Summarize on stderr. We use a `BufWriter` to try to help
-                // ensure we ultimately make a single `write` syscall, though
-                // the flushes above and below *should* already prevent any
-                // interleaving with stdout.
-                let stderr_unlocked = std::io::stderr();
-                let stderr_locked = stderr_unlocked.lock();
-                let mut stderr = std::io::BufWriter::new(stderr_locked);
-                writeln!(stderr, "Error: {}", record.message)?;
-
-                // Explicitly flush before dropping to detect errors.
-                stderr.flush()?;
-                drop(stderr);
-            }
-        }
+        self.write_queued_records(&mut stdout, toflush)?;
 
         // Explicitly flush before dropping to detect errors.
         stdout.flush()?;
@@ -244,12 +236,178 @@ impl ShadowLogger {
         Ok(())
     }
 
+    // Function called by the logger's helper thread when a scheduling round
+    // has finished. Writes the `num_queued` records that were queued before the
+    // round finished, and then the records that worker threads logged during
+    // the round, ordered by simulation time.
+    fn write_round(
+        &self,
+        num_queued: usize,
+        batches: Vec<Vec<ShadowLogRecord>>,
+    ) -> std::io::Result<()> {
+        use std::io::Write;
+
+        let stdout_unlocked = std::io::stdout();
+        let stdout_locked = stdout_unlocked.lock();
+        let mut stdout = std::io::BufWriter::new(stdout_locked);
+
+        self.write_queued_records(&mut stdout, num_queued)?;
+        for record in merge_round_records(batches) {
+            self.write_record(&mut stdout, &record)?;
+        }
+
+        // Explicitly flush before dropping to detect errors.
+        stdout.flush()?;
+        Ok(())
+    }
+
+    // Write the records of the current round that haven't been sent to the
+    // logger thread yet, from the current thread. Only intended for use when
+    // panicking, since records from other threads that are still in their
+    // thread-local buffers won't be written.
+    fn flush_round_records(&self) -> std::io::Result<()> {
+        use std::io::Write;
+
+        let mut batches = self
+            .round_records
+            .try_lock()
+            .map(|mut batches| std::mem::take(&mut *batches))
+            .unwrap_or_default();
+        if let Ok(records) = THREAD_ROUND_RECORDS.try_with(|records| records.take()) {
+            batches.push(records);
+        }
+
+        let stdout_unlocked = std::io::stdout();
+        let stdout_locked = stdout_unlocked.lock();
+        let mut stdout = std::io::BufWriter::new(stdout_locked);
+
+        for record in merge_round_records(batches) {
+            self.write_record(&mut stdout, &record)?;
+        }
+
+        stdout.flush()?;
+        Ok(())
+    }
+
+    // Write up to `count` records from `self.records`.
+    fn write_queued_records(
+        &self,
+        stdout: &mut std::io::BufWriter<std::io::StdoutLock>,
+        mut count: usize,
+    ) -> std::io::Result<()> {
+        while count > 0 {
+            let record = match self.records.pop() {
+                Some(r) => r,
+                None => {
+                    // This can happen if another thread panics while the
+                    // logging thread is flushing. In that case both threads
+                    // will be consuming from the queue.
+                    break;
+                }
+            };
+            count -= 1;
+
+            self.write_record(stdout, &record)?;
+        }
+        Ok(())
+    }
+
+    fn write_record(
+        &self,
+        stdout: &mut std::io::BufWriter<std::io::StdoutLock>,
+        record: &ShadowLogRecord,
+    ) -> std::io::Result<()> {
+        use std::io::Write;
+
+        write!(stdout, "{record}")?;
+
+        if record.level <= Level::Error && *self.report_errors_to_stderr.get().unwrap() {
+            // *also* summarize on stderr.
+
+            // First flush stdout to avoid confusing interleaving if stdout and stderr are merged.
+            stdout.flush()?;
+
+            // Summarize on stderr. We use a `BufWriter` to try to help
+            // ensure we ultimately make a single `write` syscall, though
+            // the flushes above and below *should* already prevent any
+            // interleaving with stdout.
+            let stderr_unlocked = std::io::stderr();
+            let stderr_locked = stderr_unlocked.lock();
+            let mut stderr = std::io::BufWriter::new(stderr_locked);
+            writeln!(stderr, "Error: {}", record.message)?;
+
+            // Explicitly flush before dropping to detect errors.
+            stderr.flush()?;
+            drop(stderr);
+        }
+        Ok(())
+    }
+
     /// When disabled, the logger thread is notified to write each record as
     /// soon as it's created.  The calling thread still isn't blocked on the
     /// record actually being written, though.
     pub fn set_buffering_enabled(&self, buffering_enabled: bool) {
-        let mut writer = self.buffering_enabled.write().unwrap();
-        *writer = buffering_enabled;
+        self.buffering_enabled
+            .store(buffering_enabled, Ordering::Relaxed);
+    }
+
+    fn start_thread_round(&self) {
+        // with buffering disabled, records are written as soon as they're created
+        let buffering_enabled = self.buffering_enabled.load(Ordering::Relaxed);
+        IN_ROUND.with(|in_round| in_round.set(buffering_enabled));
+    }
+
+    fn finish_thread_round(&self) {
+        if !IN_ROUND.with(|in_round| in_round.replace(false)) {
+            return;
+        }
+        self.send_thread_round_records();
+    }
+
+    // Hand the current thread's round records to the logger, to be written
+    // when the round finishes.
+    fn send_thread_round_records(&self) {
+        let records = THREAD_ROUND_RECORDS.with(|records| records.take());
+        if !records.is_empty() {
+            self.round_records.lock().unwrap().push(records);
+        }
+    }
+
+    fn finish_round(&self) {
+        let batches = std::mem::take(&mut *self.round_records.lock().unwrap());
+        if batches.is_empty() {
+            return;
+        }
+
+        // records that are queued after this point were logged after the
+        // round's records, so they must be written after them
+        let num_queued = self.records.len();
+        self.send_command(LoggerCommand::FinishRound {
+            num_queued,
+            batches,
+        });
+    }
+
+    // Move the current thread's round records to `self.records`, in the
+    // order that they were logged. Used before logging an error, so that the
+    // records leading up to it are written before it is.
+    fn queue_thread_round_records(&self) {
+        for record in THREAD_ROUND_RECORDS.with(|records| records.take()) {
+            self.push_record(record);
+        }
+    }
+
+    fn push_record(&self, mut record: ShadowLogRecord) {
+        loop {
+            match self.records.push(record) {
+                Ok(()) => break,
+                Err(r) => {
+                    // Queue is full. Flush it and try again.
+                    record = r;
+                    self.flush_sync();
+                }
+            }
+        }
     }
 
     /// If the maximum log level has not yet been set, returns `LevelFilter::Trace`.
@@ -331,11 +489,19 @@ impl Log for ShadowLogger {
             return;
         }
 
-        let message = std::fmt::format(*record.args());
+        // Formatting into an empty `String` would start with no capacity when
+        // the message is only a formatted argument, as it is for messages from
+        // C code, and then reallocate several times as the message grows.
+        let message = {
+            use std::fmt::Write;
+            let mut message = String::with_capacity(MESSAGE_INITIAL_CAPACITY);
+            message.write_fmt(*record.args()).unwrap();
+            message
+        };
 
         let host_info = Worker::with_active_host(|host| host.info().clone());
 
-        let mut shadowrecord = ShadowLogRecord {
+        let shadowrecord = ShadowLogRecord {
             level: record.level(),
             file: record.file_static(),
             module_path: record.module_path_static(),
@@ -348,24 +514,36 @@ impl Log for ShadowLogger {
             emu_time: Worker::current_time(),
             thread_name: THREAD_NAME
                 .try_with(|name| (*name).clone())
-                .unwrap_or_else(|_| get_thread_name()),
+                .unwrap_or_else(|_| get_thread_name().into()),
             thread_id: THREAD_ID
                 .try_with(|id| *id)
                 .unwrap_or_else(|_| nix::unistd::gettid()),
             host_info,
         };
 
-        loop {
-            match self.records.push(shadowrecord) {
-                Ok(()) => break,
-                Err(r) => {
-                    // Queue is full. Flush it and try again.
-                    shadowrecord = r;
-                    self.flush_sync();
+        // During a scheduling round, worker threads keep their records until
+        // the end of the round so that they don't contend with each other on
+        // the shared queue.
+        if IN_ROUND.try_with(Cell::get).unwrap_or(false) {
+            if record.level() != Level::Error {
+                let num_records = THREAD_ROUND_RECORDS.with(|records| {
+                    let mut records = records.borrow_mut();
+                    records.push(shadowrecord);
+                    records.len()
+                });
+                // don't let the thread's buffer grow indefinitely during a
+                // long round; it's still merged with the other threads'
+                // records when the round finishes
+                if num_records >= ASYNC_FLUSH_QD_LINES_THRESHOLD {
+                    self.send_thread_round_records();
                 }
+                return;
             }
+            self.queue_thread_round_records();
         }
 
+        self.push_record(shadowrecord);
+
         if record.level() == Level::Error {
             // Unlike in Shadow's C code, we don't abort the program on Error
             // logs. In Rust the same purpose is filled with `panic` and
@@ -374,7 +552,7 @@ impl Log for ShadowLogger {
             // Flush *synchronously*, since we're likely about to crash one way or another.
             self.flush_sync();
         } else if self.records.len() > ASYNC_FLUSH_QD_LINES_THRESHOLD
-            || !*self.buffering_enabled.read().unwrap()
+            || !self.buffering_enabled.load(Ordering::Relaxed)
         {
             self.flush_async();
         }
@@ -394,7 +572,7 @@ struct ShadowLogRecord {
     wall_time: Duration,
 
     emu_time: Option<EmulatedTime>,
-    thread_name: String,
+    thread_name: Arc<str>,
     thread_id: nix::unistd::Pid,
     host_info: Option<Arc<HostInfo>>,
 }
@@ -465,12 +643,52 @@ impl std::fmt::Display for ShadowLogRecord {
 enum LoggerCommand {
     // Flush; takes an optional one-shot channel to notify that the flush has completed.
     Flush(Option<Sender<()>>),
+    // A scheduling round has finished; write the `num_queued` records that are
+    // first in the queue, and then the records that worker threads logged
+    // during the round.
+    FinishRound {
+        num_queued: usize,
+        batches: Vec<Vec<ShadowLogRecord>>,
+    },
+}
+
+/// Merge the records that worker threads logged during a round. They're
+/// ordered by simulation time, and then by host, so that the output doesn't
+/// depend on which thread ran each host. The sort is stable, so each host's
+/// records stay in the order that they were logged (a host only runs on one
+/// thread in a round, and that thread's batches are in the order that it logged
+/// them).
+fn merge_round_records(batches: Vec<Vec<ShadowLogRecord>>) -> Vec<ShadowLogRecord> {
+    let mut records: Vec<ShadowLogRecord> = batches.into_iter().flatten().collect();
+    records.sort_by_key(|r| (r.emu_time, r.host_info.as_ref().map(|h| h.id)));
+    records
 }
 
 pub fn set_buffering_enabled(buffering_enabled: bool) {
     SHADOW_LOGGER.set_buffering_enabled(buffering_enabled);
 }
 
+/// Start buffering the records that the current thread logs until
+/// [`finish_thread_round`] is called. Intended to be called by each worker
+/// thread before it runs hosts in a scheduling round.
+pub fn start_thread_round() {
+    SHADOW_LOGGER.start_thread_round();
+}
+
+/// Stop buffering the current thread's records, and hand the records that it
+/// logged during the round to the logger. They aren't written until
+/// [`finish_round`] is called.
+pub fn finish_thread_round() {
+    SHADOW_LOGGER.finish_thread_round();
+}
+
+/// Write the records that worker threads logged during the round, merged by
+/// simulation time. Intended to be called once every worker thread has called
+/// [`finish_thread_round`].
+pub fn finish_round() {
+    SHADOW_LOGGER.finish_round();
+}
+
 mod export {
     use super::*;
 
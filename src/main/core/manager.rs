@@ -1,40 +1,54 @@
 use std::cell::RefCell;
-use std::collections::HashMap;
+use std::collections::{HashMap, HashSet};
 use std::ffi::{CStr, CString, OsStr, OsString};
 use std::os::unix::ffi::OsStrExt;
 use std::path::PathBuf;
 use std::sync::atomic::AtomicU32;
-use std::sync::Arc;
+use std::sync::{Arc, Mutex};
 use std::time::Duration;
 
 use anyhow::Context;
 use atomic_refcell::AtomicRefCell;
+use linux_api::syscall::SyscallNum;
 use log::warn;
 use rand::seq::SliceRandom;
 use rand_xoshiro::Xoshiro256PlusPlus;
+use rayon::iter::{IndexedParallelIterator, IntoParallelRefIterator, ParallelIterator};
 use scheduler::thread_per_core::ThreadPerCoreSched;
 use scheduler::thread_per_host::ThreadPerHostSched;
+use scheduler::work_stealing::WorkStealingSched;
 use scheduler::{HostIter, Scheduler};
 use shadow_shim_helper_rs::emulated_time::EmulatedTime;
-use shadow_shim_helper_rs::shim_shmem::ManagerShmem;
+use shadow_shim_helper_rs::shim_shmem::{
+    HostShmem, ManagerShmem, NATIVE_SYSCALL_PASSTHROUGH_WORDS,
+};
 use shadow_shim_helper_rs::simulation_time::SimulationTime;
 use shadow_shim_helper_rs::util::SyncSendPointer;
 use shadow_shim_helper_rs::HostId;
 use shadow_shmem::allocator::ShMemBlock;
 
-use crate::core::configuration::{self, ConfigOptions, Flatten};
+use crate::core::configuration::{self, ConfigOptions, Flatten, HeartbeatFormat};
 use crate::core::controller::{Controller, ShadowStatusBarState, SimController};
 use crate::core::cpu;
-use crate::core::resource_usage;
+use crate::core::host_profile::SimProfile;
+use crate::core::live_metrics::{LiveMetrics, ThreadMetrics};
+use crate::core::logger::shadow_logger;
+use crate::core::resource_usage::{self, ProcessUsage};
 use crate::core::runahead::Runahead;
 use crate::core::sim_config::{Bandwidth, HostInfo};
 use crate::core::sim_stats;
 use crate::core::worker;
+use crate::core::worker_trace;
 use crate::cshadow as c;
 use crate::host::host::{Host, HostParameters};
-use crate::network::graph::{IpAssignment, RoutingInfo};
+use crate::host::network::namespace::NamespaceAddresses;
+use crate::host::syscall::handler::{NATIVE_PATH_CREATING_SYSCALLS, NATIVE_SYSCALLS};
+use crate::network::graph::{DenseIpMap, IpAssignment, RoutingInfo};
 use crate::utility;
+use crate::utility::async_file_writer;
 use crate::utility::childpid_watcher::ChildPidWatcher;
+use crate::utility::heartbeat_writer;
+use crate::utility::pcap_writer;
 use crate::utility::status_bar::Status;
 
 pub struct Manager<'a> {
@@ -53,6 +67,10 @@ pub struct Manager<'a> {
 
     check_fd_usage: bool,
     check_mem_usage: bool,
+    /// The peak usage of managed processes that are running, and of those that have been launched
+    /// early but haven't reached their start time yet.
+    peak_running_process_usage: ProcessUsage,
+    peak_pending_process_usage: ProcessUsage,
 
     meminfo_file: std::fs::File,
     shmem: ShMemBlock<'static, ManagerShmem>,
@@ -76,7 +94,8 @@ impl<'a> Manager<'a> {
             default_freq
         });
 
-        let native_tsc_frequency = if let Some(f) = shadow_tsc::Tsc::native_cycles_per_second() {
+        let tsc_frequency_cache = config.experimental.tsc_frequency_cache.flatten_ref();
+        let native_tsc_frequency = if let Some(f) = native_tsc_frequency(tsc_frequency_cache) {
             f
         } else {
             warn!(
@@ -179,6 +198,16 @@ impl<'a> Manager<'a> {
             })?;
         }
 
+        if config.experimental.host_heartbeat_format.unwrap() == HeartbeatFormat::Binary {
+            let heartbeats_path = data_path.join("heartbeats");
+            std::fs::create_dir(&heartbeats_path).with_context(|| {
+                format!(
+                    "Failed to create heartbeats directory '{}'",
+                    heartbeats_path.display(),
+                )
+            })?;
+        }
+
         // save the processed config as yaml
         let config_out_filename = data_path.join("processed-config.yaml");
         let config_out_file = std::fs::File::create(&config_out_filename).with_context(|| {
@@ -195,8 +224,20 @@ impl<'a> Manager<'a> {
         let meminfo_file =
             std::fs::File::open("/proc/meminfo").context("Failed to open '/proc/meminfo'")?;
 
+        let native_syscall_passthrough = native_syscall_passthrough_bitmap(
+            config
+                .experimental
+                .native_syscall_passthrough
+                .as_ref()
+                .unwrap(),
+            config.experimental.use_missing_path_cache.unwrap(),
+            config.experimental.use_file_read_cache.unwrap(),
+        )?;
+
         let shmem = shadow_shmem::allocator::shmalloc(ManagerShmem {
             log_start_time_micros: unsafe { c::logger_get_global_start_time_micros() },
+            native_syscall_passthrough,
+            patch_rdtsc_sites: config.experimental.use_rdtsc_patching.unwrap(),
         });
 
         Ok(Self {
@@ -211,6 +252,8 @@ impl<'a> Manager<'a> {
             preload_paths: Arc::new(preload_paths),
             check_fd_usage: true,
             check_mem_usage: true,
+            peak_running_process_usage: ProcessUsage::default(),
+            peak_pending_process_usage: ProcessUsage::default(),
             meminfo_file,
             shmem,
         })
@@ -254,19 +297,109 @@ impl<'a> Manager<'a> {
             x => x.try_into().unwrap(),
         };
 
-        // note: there are several return points before we add these hosts to the scheduler and we
-        // would leak memory if we return before then, but not worrying about that since the issues
-        // will go away when we move the hosts to rust, and if we don't add them to the scheduler
-        // then it means there was an error and we're going to exit anyways
-        let mut hosts: Vec<_> = manager_config
+        // register the addresses of all hosts in order first, so that the addresses don't depend on
+        // the order in which the hosts are built below
+        let addresses: Vec<_> = manager_config
             .hosts
             .iter()
             .enumerate()
             .map(|(i, x)| {
-                self.build_host(HostId::from(u32::try_from(i).unwrap()), x, dns)
-                    .with_context(|| format!("Failed to build host '{}'", x.name))
+                let hostname = CString::new(&*x.name).unwrap();
+                let ip = match x.ip_addr.unwrap() {
+                    std::net::IpAddr::V4(ip) => ip,
+                    // the config only allows ipv4 addresses, so this shouldn't happen
+                    std::net::IpAddr::V6(_) => unreachable!("IPv6 not supported"),
+                };
+                unsafe {
+                    NamespaceAddresses::register(
+                        dns,
+                        HostId::from(u32::try_from(i).unwrap()),
+                        &hostname,
+                        ip,
+                    )
+                }
+            })
+            .collect();
+
+        // all hosts have registered their addresses, so workers can now look up addresses without
+        // locking the dns
+        unsafe { c::dns_freeze(dns) };
+
+        // the interfaces in the merged pcap file must be described before any packets are captured,
+        // and in an order that doesn't depend on the order the hosts are built in
+        let merged_pcap_interfaces: Vec<_> = manager_config
+            .hosts
+            .iter()
+            .filter_map(|host| Some((&host.name, host.pcap_config.filter(|x| x.merged)?)))
+            .flat_map(|(name, pcap)| {
+                let capture_size = u32::try_from(pcap.capture_size).unwrap();
+                // the interfaces that each host's network namespace has
+                ["lo", "eth0"].map(|interface| (format!("{name}:{interface}"), capture_size))
             })
-            .collect::<anyhow::Result<_>>()?;
+            .collect();
+        if !merged_pcap_interfaces.is_empty() {
+            let path = self.data_path.join("packets.pcapng");
+            let file = pcap_writer::MergedPcapFile::create(&path, merged_pcap_interfaces)
+                .with_context(|| format!("Failed to create pcap file '{}'", path.display()))?;
+            pcap_writer::set_merged_pcap_file(file);
+        }
+
+        // Most of the work of building a host (allocating its shared memory, setting up its
+        // interfaces, creating its data directory) is independent of other hosts, so build them in
+        // parallel. The hosts are collected in order, so this doesn't affect determinism.
+        let build_pool = rayon::ThreadPoolBuilder::new()
+            .num_threads(std::cmp::max(
+                1,
+                std::cmp::min(parallelism, manager_config.hosts.len()),
+            ))
+            .thread_name(|i| format!("host-builder-{i}"))
+            .build()
+            .context("Failed to start the threads that build hosts")?;
+
+        // note: there are several return points before we add these hosts to the scheduler and we
+        // would leak memory if we return before then, but not worrying about that since the issues
+        // will go away when we move the hosts to rust, and if we don't add them to the scheduler
+        // then it means there was an error and we're going to exit anyways
+        let heap_bytes_before_hosts = heap_bytes_in_use();
+
+        let mut hosts: Vec<_> = build_pool.install(|| {
+            manager_config
+                .hosts
+                .par_iter()
+                .zip(addresses)
+                .enumerate()
+                .map(|(i, (x, addresses))| {
+                    self.build_host(HostId::from(u32::try_from(i).unwrap()), x, addresses)
+                        .with_context(|| format!("Failed to build host '{}'", x.name))
+                })
+                .collect::<anyhow::Result<_>>()
+        })?;
+
+        // the threads aren't needed after the hosts are built
+        drop(build_pool);
+
+        if !hosts.is_empty() {
+            let num_hosts = i64::try_from(hosts.len()).unwrap();
+            let heap_bytes = heap_bytes_in_use().saturating_sub(heap_bytes_before_hosts);
+            let heap_bytes_per_host = i64::try_from(heap_bytes).unwrap() / num_hosts;
+            log::debug!(
+                "Built {num_hosts} hosts using about {heap_bytes_per_host} heap bytes each"
+            );
+
+            worker::with_global_sim_stats(|stats| {
+                let mut host_memory = stats.host_memory.lock().unwrap();
+                host_memory.set_value("hosts", num_hosts);
+                host_memory.set_value("heap_bytes_per_host", heap_bytes_per_host);
+                host_memory.set_value(
+                    "shmem_bytes_per_host",
+                    std::mem::size_of::<HostShmem>().try_into().unwrap(),
+                );
+                host_memory.set_value(
+                    "host_struct_bytes",
+                    std::mem::size_of::<Host>().try_into().unwrap(),
+                );
+            });
+        }
 
         // shuffle the list of hosts to make sure that they are randomly assigned by the scheduler
         hosts.shuffle(&mut manager_config.random);
@@ -297,15 +430,76 @@ impl<'a> Manager<'a> {
         }
         assert_eq!(cpus.len(), parallelism);
 
+        // if each host runs ahead by its own amount, the runahead of each host is the lowest
+        // latency of any path to that host
+        let use_per_host_runahead = self.config.experimental.use_per_host_runahead.unwrap();
+        if use_per_host_runahead && self.config.experimental.use_dynamic_runahead.unwrap() {
+            log::warn!("Dynamic runahead has no effect when per-host runahead is enabled");
+        }
+        let host_runaheads = use_per_host_runahead.then(|| {
+            // the same lower bound as the global runahead, which never changes since the hosts'
+            // runaheads must never decrease
+            let min_runahead = std::cmp::max(
+                smallest_latency,
+                min_runahead_config.unwrap_or(SimulationTime::ZERO),
+            );
+            let node_latencies = manager_config.routing_info.get_smallest_latencies_to_ns();
+
+            hosts
+                .iter()
+                .map(|host| {
+                    let node = manager_config
+                        .ip_assignment
+                        .get_node(host.default_ip().into())
+                        .unwrap();
+                    let latency = SimulationTime::from_nanos(node_latencies[&node]);
+                    (host.id(), std::cmp::max(latency, min_runahead))
+                })
+                .collect()
+        });
+
+        let host_ids = DenseIpMap::new(
+            hosts
+                .iter()
+                .map(|host| (host.default_ip().into(), host.id())),
+        );
+
+        let use_async_file_writes = self.config.experimental.use_async_file_writes.unwrap();
+
+        let read_only_paths = self.config.experimental.read_only_paths.as_ref().unwrap();
+        if let Some(path) = read_only_paths.iter().find(|x| !x.starts_with('/')) {
+            anyhow::bail!("The read-only path '{path}' is not an absolute path");
+        }
+        let stat_cache = (!read_only_paths.is_empty()).then(|| {
+            let paths: Vec<CString> = read_only_paths
+                .iter()
+                .map(|x| CString::new(x.as_str()).unwrap())
+                .collect();
+            let paths: Vec<*const libc::c_char> = paths.iter().map(|x| x.as_ptr()).collect();
+            unsafe { c::statcache_new(paths.as_ptr(), paths.len()) }
+        });
+
         // set the simulation's global state
         worker::WORKER_SHARED
             .borrow_mut()
             .replace(worker::WorkerShared {
                 ip_assignment: manager_config.ip_assignment,
+                host_ids,
                 routing_info: manager_config.routing_info,
                 host_bandwidths: manager_config.host_bandwidths,
                 // safe since the DNS type has an internal mutex
                 dns: unsafe { SyncSendPointer::new(dns) },
+                // safe since the file cache has an internal mutex
+                file_cache: self
+                    .config
+                    .experimental
+                    .use_file_read_cache
+                    .unwrap()
+                    .then(|| unsafe { SyncSendPointer::new(c::filecache_new()) }),
+                // safe since the stat cache has an internal lock
+                stat_cache: stat_cache.map(|x| unsafe { SyncSendPointer::new(x) }),
+                use_async_file_writes,
+                use_perf_counters: self.config.experimental.use_perf_counters.unwrap(),
                 num_plugin_errors: AtomicU32::new(0),
                 // allow the status logger's state to be updated from anywhere
                 status_logger_state: status_logger_state.map(Arc::clone),
@@ -315,33 +509,76 @@ impl<'a> Manager<'a> {
                     min_runahead_config,
                 ),
                 child_pid_watcher: ChildPidWatcher::new(),
-                event_queues: hosts
+                pending_process_pids: Mutex::new(HashSet::new()),
+                event_inboxes: hosts
                     .iter()
-                    .map(|x| (x.id(), x.event_queue().clone()))
+                    .map(|x| (x.id(), x.event_inbox().clone()))
                     .collect(),
                 bootstrap_end_time,
                 sim_end_time: self.end_time,
+                heartbeat_dir: (self.config.experimental.host_heartbeat_format.unwrap()
+                    == HeartbeatFormat::Binary)
+                    .then(|| self.data_path.join("heartbeats")),
+                host_runaheads,
             });
 
+        // the cost of each host in a previous run, used to balance the hosts before the first round
+        let host_costs: Vec<u64> = match self.config.experimental.partition_profile.flatten_ref() {
+            Some(path) => match SimProfile::read_from_file(std::path::Path::new(path)) {
+                Ok(profile) => hosts
+                    .iter()
+                    .map(|host| profile.host_cost_ns(host.name()))
+                    .collect(),
+                Err(e) => {
+                    log::warn!("Unable to load the host profile, so not using it: {e:?}");
+                    vec![0; hosts.len()]
+                }
+            },
+            None => vec![0; hosts.len()],
+        };
+        let hosts = hosts.into_iter().zip(host_costs);
+
+        // the number of scheduling rounds, for the host profile
+        let mut num_rounds: u64 = 0;
+
         // scope used so that the scheduler is dropped before we log the global counters below
         {
             let mut scheduler = match self.config.experimental.scheduler.unwrap() {
                 configuration::Scheduler::ThreadPerHost => {
                     std::thread_local! {
                         /// A thread-local required by the thread-per-host scheduler.
-                        static SCHED_HOST_STORAGE: RefCell<Option<Box<Host>>> = const { RefCell::new(None) };
+                        static SCHED_HOST_STORAGE: RefCell<Vec<Box<Host>>> = const { RefCell::new(Vec::new()) };
                     }
-                    Scheduler::ThreadPerHost(ThreadPerHostSched::new(
+                    let max_threads = match self
+                        .config
+                        .experimental
+                        .thread_per_host_max_threads
+                        .unwrap()
+                    {
+                        0 => None,
+                        x => Some(x.try_into().unwrap()),
+                    };
+                    Scheduler::ThreadPerHost(ThreadPerHostSched::new_with_costs(
                         &cpus,
                         &SCHED_HOST_STORAGE,
                         hosts,
+                        max_threads,
                     ))
                 }
                 configuration::Scheduler::ThreadPerCore => {
-                    Scheduler::ThreadPerCore(ThreadPerCoreSched::new(
+                    Scheduler::ThreadPerCore(ThreadPerCoreSched::new_with_costs(
+                        &cpus,
+                        hosts,
+                        self.config.experimental.use_worker_spinning.unwrap(),
+                        self.config.experimental.use_worker_tree_barrier.unwrap(),
+                    ))
+                }
+                configuration::Scheduler::WorkStealing => {
+                    Scheduler::WorkStealing(WorkStealingSched::new_with_costs(
                         &cpus,
                         hosts,
                         self.config.experimental.use_worker_spinning.unwrap(),
+                        self.config.experimental.use_worker_tree_barrier.unwrap(),
                     ))
                 }
             };
@@ -388,8 +625,39 @@ impl<'a> Manager<'a> {
             let mut last_heartbeat = EmulatedTime::SIMULATION_START;
             let mut time_of_last_usage_check = std::time::Instant::now();
 
+            // live performance metrics, if enabled
+            let mut live_metrics = self
+                .config
+                .experimental
+                .metrics_interval
+                .flatten()
+                .map(|x| LiveMetrics::new(self.data_path.join("metrics.prom"), x.into()));
+            let collect_metrics = live_metrics.is_some();
+            let thread_metrics: Vec<AtomicRefCell<ThreadMetrics>> = (0..scheduler.parallelism())
+                .map(|_| AtomicRefCell::new(ThreadMetrics::default()))
+                .collect();
+
+            // a timeline of the worker threads, if enabled
+            let trace_workers = self.config.experimental.use_worker_trace.unwrap()
+                && match worker_trace::init(
+                    &self.data_path.join("worker-trace.json"),
+                    scheduler.parallelism(),
+                ) {
+                    Ok(()) => true,
+                    Err(e) => {
+                        log::warn!("Unable to create the worker trace: {e}");
+                        false
+                    }
+                };
+            let time_threads = collect_metrics || trace_workers;
+            // when each thread finished running hosts in the current round
+            let thread_round_ends: Vec<AtomicRefCell<Option<std::time::Instant>>> =
+                vec![AtomicRefCell::new(None); scheduler.parallelism()];
+
             // the scheduling loop
             while let Some((window_start, window_end)) = window {
+                num_rounds += 1;
+
                 // update the status logger
                 let display_time = std::cmp::min(window_start, window_end);
                 worker::WORKER_SHARED
@@ -400,39 +668,132 @@ impl<'a> Manager<'a> {
                         state.current = display_time;
                     });
 
+                let round_start = time_threads.then(std::time::Instant::now);
+
                 // run the events
                 scheduler.scope(|s| {
+                    let thread_metrics = &thread_metrics;
+                    let thread_round_ends = &thread_round_ends;
+
                     // run the closure on each of the scheduler's threads
                     s.run_with_data(
                         &thread_next_event_times,
                         // each call of the closure is given an abstract thread-specific host
                         // iterator, and an element of 'thread_next_event_times'
-                        move |_, hosts, next_event_time| {
+                        move |thread_idx, hosts, next_event_time| {
+                            let thread_start = time_threads.then(std::time::Instant::now);
                             let mut next_event_time = next_event_time.borrow_mut();
 
                             worker::Worker::reset_next_event_time();
-                            worker::Worker::set_round_end_time(window_end);
-
-                            for_each_host(hosts, |host| {
-                                let host_next_event_time = {
-                                    host.lock_shmem();
-                                    host.execute(window_end);
-                                    let host_next_event_time = host.next_event_time();
-                                    host.unlock_shmem();
-                                    host_next_event_time
+                            worker::Worker::reset_round_arena();
+                            worker::Worker::set_round(window_start, window_end);
+                            shadow_logger::start_thread_round();
+
+                            hosts.for_each(|host| {
+                                // tracker heartbeats are run here rather than as events, so that
+                                // the event queues only hold simulation work
+                                let host = if host.heartbeat_due(window_start) {
+                                    worker::Worker::set_active_host(host);
+                                    worker::Worker::with_active_host(|host| {
+                                        worker::Worker::set_current_time(window_start);
+                                        host.heartbeat();
+                                        worker::Worker::clear_current_time();
+                                    })
+                                    .unwrap();
+                                    worker::Worker::take_active_host()
+                                } else {
+                                    host
                                 };
-                                *next_event_time = [*next_event_time, host_next_event_time]
-                                    .into_iter()
-                                    .flatten() // filter out None
-                                    .reduce(std::cmp::min);
+
+                                // with per-host runahead, hosts may run past the window end
+                                let host_window_end =
+                                    worker::Worker::host_round_end_time(host.id());
+
+                                // most hosts in large simulations are idle in most rounds, so skip
+                                // activating and locking a host that has nothing to run
+                                if !host.has_events_before(host_window_end) {
+                                    *next_event_time = [*next_event_time, host.next_event_time()]
+                                        .into_iter()
+                                        .flatten() // filter out None
+                                        .reduce(std::cmp::min);
+                                    return host;
+                                }
+
+                                worker::Worker::set_active_host(host);
+                                worker::Worker::with_active_host(|host| {
+                                    worker::Worker::set_round_end_time(host_window_end);
+
+                                    let host_next_event_time = {
+                                        let host_start = std::time::Instant::now();
+                                        let perf_start = worker::Worker::read_perf_counters();
+                                        host.lock_shmem();
+                                        let num_events = host.execute(host_window_end);
+                                        let host_next_event_time = host.next_event_time();
+                                        host.unlock_shmem();
+                                        host.add_execution_time(host_start.elapsed());
+                                        let perf_counts = perf_start.map(|start| {
+                                            worker::Worker::add_host_perf_counts(host, &start)
+                                        });
+                                        if trace_workers {
+                                            let mut args: Vec<(&str, u64)> = vec![
+                                                ("host_id", u32::from(host.id()).into()),
+                                                ("events", num_events),
+                                            ];
+                                            if let Some(perf_counts) = &perf_counts {
+                                                args.extend(perf_counts.iter());
+                                            }
+                                            worker_trace::span(
+                                                thread_idx.try_into().unwrap(),
+                                                host.name(),
+                                                host_start,
+                                                std::time::Instant::now(),
+                                                &args,
+                                            );
+                                        }
+                                        if collect_metrics {
+                                            thread_metrics[thread_idx]
+                                                .borrow_mut()
+                                                .add_host(host.id(), num_events);
+                                        }
+                                        host_next_event_time
+                                    };
+                                    *next_event_time = [*next_event_time, host_next_event_time]
+                                        .into_iter()
+                                        .flatten() // filter out None
+                                        .reduce(std::cmp::min);
+                                })
+                                .unwrap();
+                                worker::Worker::take_active_host()
                             });
 
+                            shadow_logger::finish_thread_round();
+                            worker::Worker::publish_lowest_used_latency();
+
                             let packet_next_event_time = worker::Worker::get_next_event_time();
 
                             *next_event_time = [*next_event_time, packet_next_event_time]
                                 .into_iter()
                                 .flatten() // filter out None
                                 .reduce(std::cmp::min);
+
+                            if let Some(thread_start) = thread_start {
+                                let thread_end = std::time::Instant::now();
+                                if collect_metrics {
+                                    thread_metrics[thread_idx]
+                                        .borrow_mut()
+                                        .add_busy_time(thread_end - thread_start);
+                                }
+                                if trace_workers {
+                                    worker_trace::span(
+                                        thread_idx.try_into().unwrap(),
+                                        "round",
+                                        thread_start,
+                                        thread_end,
+                                        &[],
+                                    );
+                                    *thread_round_ends[thread_idx].borrow_mut() = Some(thread_end);
+                                }
+                            }
                         },
                     );
 
@@ -454,6 +815,36 @@ impl<'a> Manager<'a> {
                     }
                 });
 
+                // write the records that the workers logged during the round, in simulation-time
+                // order
+                shadow_logger::finish_round();
+
+                // writes queued by hosts during this round must complete before the next round
+                if use_async_file_writes {
+                    async_file_writer::wait_for_all();
+                }
+
+                if let (Some(metrics), Some(round_start)) = (live_metrics.as_mut(), round_start) {
+                    metrics.finish_round(round_start.elapsed(), window_start, &thread_metrics);
+                }
+
+                // the time between a thread finishing its hosts and the end of the round is spent
+                // waiting for the other threads at the scheduler's barrier
+                if trace_workers {
+                    let round_end = std::time::Instant::now();
+                    for (thread_idx, thread_end) in thread_round_ends.iter().enumerate() {
+                        if let Some(thread_end) = thread_end.borrow_mut().take() {
+                            worker_trace::span(
+                                thread_idx.try_into().unwrap(),
+                                "wait",
+                                thread_end,
+                                round_end,
+                                &[],
+                            );
+                        }
+                    }
+                }
+
                 // get the minimum next event time for all threads (also resets the next event times
                 // to None while we have them borrowed)
                 let min_next_event_time = thread_next_event_times
@@ -483,19 +874,25 @@ impl<'a> Manager<'a> {
                         worker::Worker::set_current_time(self.end_time);
                         host.free_all_applications();
                         host.shutdown();
+                        worker::Worker::add_host_profile(host);
                         worker::Worker::clear_current_time();
                     });
                 });
             });
 
-            // add each thread's local sim statistics to the global sim statistics.
+            // add each thread's local sim statistics to the global sim statistics, and flush
+            // each thread's heartbeat output.
             scheduler.scope(|s| {
                 s.run(|_| {
                     worker::Worker::add_to_global_sim_stats();
+                    heartbeat_writer::flush_thread_writer();
+                    worker_trace::flush_thread_buffer();
                 });
             });
 
             scheduler.join();
+
+            worker_trace::finish();
         }
 
         // simulation is finished, so update the status logger
@@ -507,12 +904,35 @@ impl<'a> Manager<'a> {
                 state.current = self.end_time;
             });
 
+        // the workers' packet counts were merged into the global sim statistics
+        if log::log_enabled!(log::Level::Debug) {
+            worker::with_global_sim_stats(|stats| {
+                worker::WORKER_SHARED
+                    .borrow()
+                    .as_ref()
+                    .unwrap()
+                    .routing_info
+                    .log_packet_counts(&stats.packet_counts.lock().unwrap())
+            });
+        }
+
         let num_plugin_errors = worker::WORKER_SHARED
             .borrow()
             .as_ref()
             .unwrap()
             .plugin_error_count();
 
+        if self.config.experimental.use_early_process_launch.unwrap() {
+            log::info!(
+                "Peak usage of running managed processes: {}",
+                serde_json::to_string(&self.peak_running_process_usage).unwrap(),
+            );
+            log::info!(
+                "Peak usage of managed processes waiting for their start time: {}",
+                serde_json::to_string(&self.peak_pending_process_usage).unwrap(),
+            );
+        }
+
         // drop the simulation's global state
         // must drop before the allocation counters have been checked
         worker::WORKER_SHARED.borrow_mut().take();
@@ -530,8 +950,14 @@ impl<'a> Manager<'a> {
             if self.config.experimental.use_object_counters.unwrap() {
                 let alloc_counts = stats.alloc_counts.lock().unwrap();
                 let dealloc_counts = stats.dealloc_counts.lock().unwrap();
-                log::info!("Global allocated object counts: {}", alloc_counts);
-                log::info!("Global deallocated object counts: {}", dealloc_counts);
+                log::info!(
+                    "Global allocated object counts: {}",
+                    alloc_counts.to_counter()
+                );
+                log::info!(
+                    "Global deallocated object counts: {}",
+                    dealloc_counts.to_counter()
+                );
 
                 if *alloc_counts == *dealloc_counts {
                     log::info!("We allocated and deallocated the same number of objects :)");
@@ -541,6 +967,14 @@ impl<'a> Manager<'a> {
                 }
             }
 
+            let profile = SimProfile {
+                rounds: num_rounds,
+                hosts: std::mem::take(&mut *stats.host_profiles.lock().unwrap())
+                    .into_values()
+                    .collect(),
+            };
+            profile.write_to_file(&self.data_path.join("host-profile.json"))?;
+
             let stats_filename = self.data_path.clone().join("sim-stats.json");
             sim_stats::write_stats_to_file(&stats_filename, stats)
         })?;
@@ -552,7 +986,7 @@ impl<'a> Manager<'a> {
         &self,
         host_id: HostId,
         host_info: &HostInfo,
-        dns: *mut c::DNS,
+        addresses: NamespaceAddresses,
     ) -> anyhow::Result<Box<Host>> {
         let hostname = CString::new(&*host_info.name).unwrap();
 
@@ -576,6 +1010,7 @@ impl<'a> Manager<'a> {
                 requested_bw_up_bits: host_info.bandwidth_up_bits.unwrap(),
                 cpu_threshold: host_info.cpu_threshold,
                 cpu_precision: host_info.cpu_precision,
+                cpu_quantum: host_info.cpu_quantum,
                 heartbeat_interval: host_info.heartbeat_interval,
                 heartbeat_log_level: host_info
                     .heartbeat_log_level
@@ -587,21 +1022,34 @@ impl<'a> Manager<'a> {
                     .map(|x| x.to_c_loginfoflag())
                     .reduce(|x, y| x | y)
                     .unwrap_or(c::_LogInfoFlags_LOG_INFO_FLAGS_NONE),
+                heartbeat_format: host_info.heartbeat_format,
+                heartbeat_packet_sampling: host_info.heartbeat_packet_sampling,
                 log_level: host_info
                     .log_level
                     .map(|x| x.to_c_loglevel())
                     .unwrap_or(c::_LogLevel_LOGLEVEL_UNSET),
                 pcap_config: host_info.pcap_config,
+                tcp_congestion_control: host_info.tcp_congestion_control,
                 qdisc: host_info.qdisc,
+                router_qdisc: host_info.router_qdisc,
                 init_sock_recv_buf_size: host_info.recv_buf_size,
                 autotune_recv_buf: host_info.autotune_recv_buf,
                 init_sock_send_buf_size: host_info.send_buf_size,
                 autotune_send_buf: host_info.autotune_send_buf,
+                tcp_pacing: host_info.tcp_pacing,
+                tcp_segments_per_packet: host_info.tcp_segments_per_packet,
                 native_tsc_frequency: self.native_tsc_frequency,
                 model_unblocked_syscall_latency: self.config.model_unblocked_syscall_latency(),
                 max_unapplied_cpu_latency: self.config.max_unapplied_cpu_latency(),
                 unblocked_syscall_latency: self.config.unblocked_syscall_latency(),
                 unblocked_vdso_latency: self.config.unblocked_vdso_latency(),
+                native_preemption_enabled: self
+                    .config
+                    .experimental
+                    .native_preemption_enabled
+                    .unwrap(),
+                native_preemption_native_interval: self.config.native_preemption_native_interval(),
+                native_preemption_sim_interval: self.config.native_preemption_sim_interval(),
                 strace_logging_options: self.config.strace_logging_mode(),
                 shim_log_level: host_info
                     .log_level
@@ -609,23 +1057,49 @@ impl<'a> Manager<'a> {
                     .to_c_loglevel(),
                 use_new_tcp: self.config.experimental.use_new_tcp.unwrap(),
                 use_mem_mapper: self.config.experimental.use_memory_manager.unwrap(),
+                use_mem_mapper_huge_pages: self
+                    .config
+                    .experimental
+                    .use_memory_manager_huge_pages
+                    .unwrap(),
                 use_syscall_counters: self.config.experimental.use_syscall_counters.unwrap(),
+                use_syscall_latency_histograms: self
+                    .config
+                    .experimental
+                    .use_syscall_latency_histograms
+                    .unwrap(),
+                use_calendar_event_queue: self
+                    .config
+                    .experimental
+                    .use_calendar_event_queue
+                    .unwrap(),
+                use_lazy_output_files: self.config.experimental.use_lazy_output_files.unwrap(),
+                use_missing_path_cache: self.config.experimental.use_missing_path_cache.unwrap(),
+                use_loopback_batching: self.config.experimental.use_loopback_batching.unwrap(),
+                early_process_launch_lead: self
+                    .config
+                    .experimental
+                    .use_early_process_launch
+                    .unwrap()
+                    .then(|| self.config.early_process_launch_lead()),
             };
 
-            Box::new(unsafe {
-                Host::new(
-                    params,
-                    &self.hosts_path,
-                    self.raw_frequency,
-                    dns,
-                    self.shmem(),
-                    self.preload_paths.clone(),
-                )
-            })
+            Box::new(Host::new(
+                params,
+                &self.hosts_path,
+                self.raw_frequency,
+                addresses,
+                self.shmem(),
+                self.preload_paths.clone(),
+            ))
         };
 
         host.lock_shmem();
 
+        for traffic in &host_info.traffic {
+            host.add_traffic(traffic.clone());
+        }
+
         for proc in &host_info.processes {
             let plugin_path =
                 CString::new(proc.plugin.clone().into_os_string().as_bytes()).unwrap();
@@ -748,19 +1222,76 @@ impl<'a> Manager<'a> {
                 Ok(_) => {}
             }
         }
+
+        // reading each process's usage is slow with many processes, so only do so when the usage
+        // of pending processes is interesting
+        if self.config.experimental.use_early_process_launch.unwrap() {
+            match self.process_usage() {
+                Ok((running, pending)) => {
+                    self.peak_running_process_usage = self.peak_running_process_usage.max(&running);
+                    self.peak_pending_process_usage = self.peak_pending_process_usage.max(&pending);
+                }
+                Err(e) => log::warn!("Unable to check managed process usage: {e}"),
+            }
+        }
     }
 
-    /// Returns a tuple of (usage, limit).
-    fn fd_usage(&mut self) -> anyhow::Result<(u64, u64)> {
-        let dir = std::fs::read_dir("/proc/self/fd").context("Failed to open '/proc/self/fd'")?;
+    /// Returns a tuple of (running, pending) managed process usage.
+    fn process_usage(&self) -> anyhow::Result<(ProcessUsage, ProcessUsage)> {
+        let page_size = nix::unistd::sysconf(nix::unistd::SysconfVar::PAGE_SIZE)
+            .context("Failed to get the page size")?
+            .ok_or_else(|| anyhow::anyhow!("Failed to get the page size (no errno)"))?;
+        let page_size = u64::try_from(page_size).unwrap();
 
-        let mut fd_count: u64 = 0;
-        for entry in dir {
-            // short-circuit and return on error
-            entry.context("Failed to read entry in '/proc/self/fd'")?;
-            fd_count += 1;
+        let worker_shared = worker::WORKER_SHARED.borrow();
+        let worker_shared = worker_shared.as_ref().unwrap();
+        let pids = worker_shared.child_pid_watcher().registered_pids();
+        let pending_pids = worker_shared.pending_process_pids.lock().unwrap().clone();
+
+        let mut running = ProcessUsage::default();
+        let mut pending = ProcessUsage::default();
+
+        for pid in pids {
+            let usage = if pending_pids.contains(&pid) {
+                &mut pending
+            } else {
+                &mut running
+            };
+
+            // the process may have exited since we got the list of pids
+            if let Err(e) = usage.add_process(pid.as_raw_nonzero().get(), page_size) {
+                log::trace!("Unable to read the usage of process {pid:?}: {e}");
+            }
         }
 
+        Ok((running, pending))
+    }
+
+    /// Returns a tuple of (usage, limit).
+    fn fd_usage(&mut self) -> anyhow::Result<(u64, u64)> {
+        // Since Linux 6.2 the size of '/proc/self/fd' is the number of open fds, which saves us from
+        // enumerating the directory. Enumerating it is slow with many fds (a simulation can have
+        // millions), and would stall the simulation each time we check. Older kernels report a size
+        // of 0, and we always have at least the standard streams open, so 0 means we need to count
+        // them ourselves.
+        let metadata =
+            std::fs::metadata("/proc/self/fd").context("Failed to stat '/proc/self/fd'")?;
+
+        let fd_count = if metadata.len() > 0 {
+            metadata.len()
+        } else {
+            let dir =
+                std::fs::read_dir("/proc/self/fd").context("Failed to open '/proc/self/fd'")?;
+
+            let mut fd_count: u64 = 0;
+            for entry in dir {
+                // short-circuit and return on error
+                entry.context("Failed to read entry in '/proc/self/fd'")?;
+                fd_count += 1;
+            }
+            fd_count
+        };
+
         let (soft_limit, _) =
             nix::sys::resource::getrlimit(nix::sys::resource::Resource::RLIMIT_NOFILE)
                 .context("Failed to get the fd limit")?;
@@ -774,6 +1305,7 @@ impl<'a> Manager<'a> {
             .context("Failed to get the page size")?
             .ok_or_else(|| anyhow::anyhow!("Failed to get the page size (no errno)"))?;
 
+        // glibc gets this from sysinfo(2) rather than by parsing '/proc/meminfo', so it's cheap
         let avl_pages = nix::unistd::sysconf(nix::unistd::SysconfVar::_AVPHYS_PAGES)
             .context("Failed to get the number of available pages of physical memory")?
             .ok_or_else(|| {
@@ -822,6 +1354,37 @@ fn for_each_host(host_iter: &mut HostIter<Box<Host>>, mut f: impl FnMut(&Host))
     });
 }
 
+/// The number of bytes currently allocated by the C allocator, including large allocations that it
+/// made with mmap.
+#[cfg(not(feature = "mimalloc"))]
+fn heap_bytes_in_use() -> u64 {
+    // SAFETY: mallinfo2 has no preconditions
+    let info = unsafe { libc::mallinfo2() };
+    u64::try_from(info.uordblks + info.hblkhd).unwrap()
+}
+
+/// The number of bytes currently committed by mimalloc. This includes memory in mimalloc's free
+/// lists, so it overestimates the bytes in use.
+#[cfg(feature = "mimalloc")]
+fn heap_bytes_in_use() -> u64 {
+    let mut current_commit = 0;
+    let null = std::ptr::null_mut();
+    // SAFETY: any of the outputs can be null
+    unsafe {
+        libmimalloc_sys::mi_process_info(
+            null,
+            null,
+            null,
+            null,
+            null,
+            &mut current_commit,
+            null,
+            null,
+        )
+    };
+    u64::try_from(current_commit).unwrap()
+}
+
 /// Get the raw speed of the experiment machine.
 fn get_raw_cpu_frequency_hz() -> anyhow::Result<u64> {
     const CONFIG_CPU_MAX_FREQ_FILE: &str = "/sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_max_freq";
@@ -829,6 +1392,94 @@ fn get_raw_cpu_frequency_hz() -> anyhow::Result<u64> {
     Ok(khz * 1000)
 }
 
+/// Get the native TSC frequency, using the cache file at `cache_path` if given.
+/// The cache has one `<cpu model>\t<hz>` line per CPU model.
+fn native_tsc_frequency(cache_path: Option<&String>) -> Option<u64> {
+    let Some(cache_path) = cache_path else {
+        return shadow_tsc::Tsc::native_cycles_per_second();
+    };
+
+    let model = match std::fs::read_to_string("/proc/cpuinfo") {
+        Ok(cpuinfo) => cpuinfo
+            .lines()
+            .find_map(|line| {
+                let (key, value) = line.split_once(':')?;
+                (key.trim() == "model name").then(|| value.trim().replace('\t', " "))
+            })
+            .unwrap_or_default(),
+        Err(e) => {
+            log::debug!("Couldn't read the CPU model; not caching the TSC frequency: {e}");
+            return shadow_tsc::Tsc::native_cycles_per_second();
+        }
+    };
+
+    let cache = std::fs::read_to_string(cache_path).unwrap_or_default();
+    let cached = cache.lines().find_map(|line| {
+        let (key, hz) = line.split_once('\t')?;
+        (key == model).then(|| hz.parse::<u64>().ok()).flatten()
+    });
+    if let Some(hz) = cached {
+        log::debug!("Using TSC frequency {hz} Hz for '{model}' from {cache_path}");
+        return Some(hz);
+    }
+
+    let hz = shadow_tsc::Tsc::native_cycles_per_second()?;
+    let res = std::fs::OpenOptions::new()
+        .create(true)
+        .append(true)
+        .open(cache_path)
+        .and_then(|mut file| {
+            use std::io::Write;
+            writeln!(file, "{model}\t{hz}")
+        });
+    if let Err(e) = res {
+        warn!("Couldn't write the TSC frequency to {cache_path}: {e}");
+    }
+    Some(hz)
+}
+
+/// Convert the syscall names in `experimental.native_syscall_passthrough` to a
+/// bitmap of syscall numbers for the shim. `missing_path_cache` is whether
+/// `experimental.use_missing_path_cache` is enabled.
+fn native_syscall_passthrough_bitmap(
+    names: &std::collections::HashSet<String>,
+    missing_path_cache: bool,
+    file_read_cache: bool,
+) -> anyhow::Result<[u64; NATIVE_SYSCALL_PASSTHROUGH_WORDS]> {
+    let mut bitmap = [0u64; NATIVE_SYSCALL_PASSTHROUGH_WORDS];
+    for name in names {
+        let Some(syscall) = (0..(NATIVE_SYSCALL_PASSTHROUGH_WORDS * 64) as u32)
+            .map(SyscallNum::new)
+            .find(|x| x.to_str() == Some(name.as_str()))
+        else {
+            anyhow::bail!("Unknown syscall '{name}' in native_syscall_passthrough");
+        };
+        // Shadow needs to see `exit` to know when the thread is exiting.
+        if !NATIVE_SYSCALLS.contains(&syscall) || syscall == SyscallNum::NR_exit {
+            anyhow::bail!(
+                "Syscall '{name}' in native_syscall_passthrough is not executed natively by Shadow"
+            );
+        }
+        // Shadow needs to see these to invalidate the missing-path cache.
+        if missing_path_cache && NATIVE_PATH_CREATING_SYSCALLS.contains(&syscall) {
+            anyhow::bail!(
+                "Syscall '{name}' in native_syscall_passthrough can create paths, so it can't be \
+                 passed through while use_missing_path_cache is enabled"
+            );
+        }
+        // Shadow needs to see `truncate` to stop reading the file from the file cache first.
+        if file_read_cache && syscall == SyscallNum::NR_truncate {
+            anyhow::bail!(
+                "Syscall '{name}' in native_syscall_passthrough can't be passed through while \
+                 use_file_read_cache is enabled"
+            );
+        }
+        let n = u32::from(syscall);
+        bitmap[(n / 64) as usize] |= 1 << (n % 64);
+    }
+    Ok(bitmap)
+}
+
 fn get_required_preload_path(libname: &str) -> anyhow::Result<PathBuf> {
     let libname_c = CString::new(libname).unwrap();
     let libpath_c = unsafe { c::scanRpathForLib(libname_c.as_ptr()) };
@@ -3,6 +3,8 @@
 pub mod configuration;
 pub mod controller;
 pub mod cpu;
+pub mod host_profile;
+pub mod live_metrics;
 pub mod logger;
 pub mod manager;
 pub mod resource_usage;
@@ -11,3 +13,4 @@ pub mod sim_config;
 pub mod sim_stats;
 pub mod work;
 pub mod worker;
+pub mod worker_trace;
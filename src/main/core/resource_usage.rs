@@ -66,6 +66,55 @@ pub fn meminfo(file: &mut File) -> std::io::Result<MemInfo> {
     Ok(mem)
 }
 
+/// The combined resident memory and open file descriptors of a group of processes.
+#[derive(Copy, Clone, Debug, Default, Serialize)]
+pub struct ProcessUsage {
+    processes: u64,
+    rss_bytes: u64,
+    fds: u64,
+}
+
+impl ProcessUsage {
+    /// Add the usage of the process `pid`, read from '/proc/[pid]'. Processes that exit part way
+    /// through are only partially counted.
+    pub fn add_process(&mut self, pid: libc::pid_t, page_size: u64) -> std::io::Result<()> {
+        // the second field is the number of resident pages
+        let statm = std::fs::read_to_string(format!("/proc/{pid}/statm"))?;
+        let resident_pages: u64 = statm
+            .split_whitespace()
+            .nth(1)
+            .and_then(|x| x.parse().ok())
+            .ok_or_else(|| {
+                std::io::Error::new(
+                    std::io::ErrorKind::InvalidData,
+                    format!("Unexpected statm format: {statm:?}"),
+                )
+            })?;
+
+        let fds = std::fs::read_dir(format!("/proc/{pid}/fd"))?.count();
+
+        self.processes += 1;
+        self.rss_bytes += resident_pages * page_size;
+        self.fds += u64::try_from(fds).unwrap();
+
+        Ok(())
+    }
+
+    /// The combined resident memory of the processes.
+    pub fn rss_bytes(&self) -> u64 {
+        self.rss_bytes
+    }
+
+    /// The largest value of each field of `self` and `other`.
+    pub fn max(&self, other: &Self) -> Self {
+        Self {
+            processes: std::cmp::max(self.processes, other.processes),
+            rss_bytes: std::cmp::max(self.rss_bytes, other.rss_bytes),
+            fds: std::cmp::max(self.fds, other.fds),
+        }
+    }
+}
+
 /// Returns `None` if either the `unit` wasn't known, or the base unit is too large.
 fn as_base_unit(val: u64, unit: Option<&str>) -> Option<u64> {
     let mul = match unit {
@@ -3,6 +3,7 @@
 //! This involves loading and verifying network graphs, converting options to types/formats that are
 //! easier to use in Shadow, verifying that paths exist, etc.
 
+use std::borrow::Cow;
 use std::collections::hash_map::Entry;
 use std::collections::{BTreeMap, HashMap, HashSet};
 use std::ffi::{OsStr, OsString};
@@ -18,9 +19,11 @@ use rand_xoshiro::Xoshiro256PlusPlus;
 use shadow_shim_helper_rs::simulation_time::SimulationTime;
 
 use crate::core::configuration::{
-    parse_string_as_args, ConfigOptions, EnvName, Flatten, HostOptions, LogInfoFlag, LogLevel,
-    ProcessArgs, ProcessFinalState, ProcessOptions, QDiscMode,
+    parse_string_as_args, ConfigOptions, EnvName, Flatten, HeartbeatFormat, HostGroupOptions,
+    HostName, HostOptions, LogInfoFlag, LogLevel, ProcessArgs, ProcessFinalState, ProcessOptions,
+    QDiscMode, RouterQDiscMode, TcpCongestionControl, TrafficOptions,
 };
+use crate::cshadow;
 use crate::network::graph::{load_network_graph, IpAssignment, NetworkGraph, RoutingInfo};
 use crate::utility::units::{self, Unit};
 use crate::utility::{tilde_expansion, verify_plugin_path};
@@ -53,12 +56,42 @@ impl SimConfig {
         // this should be the same for all hosts
         let randomness_for_seed_calc = random.gen();
 
-        // build the host list
+        // list the hosts, including the hosts of each group
+        let mut host_entries: Vec<(HostName, HostEntry)> = config
+            .hosts
+            .iter()
+            .map(|(name, host)| (name.clone(), HostEntry::Host(host)))
+            .collect();
+        for (prefix, group) in &config.host_groups {
+            for index in 1..=group.count {
+                let name = HostGroupOptions::host_name(prefix, index)
+                    .map_err(|e| anyhow::anyhow!(e))
+                    .with_context(|| format!("Failed to configure host group '{prefix}'"))?;
+                host_entries.push((name, HostEntry::Group(group, index)));
+            }
+        }
+
+        // sort by hostname as in `config.hosts` (useful for determinism), so that a group
+        // configures the same simulation as listing its hosts individually would
+        host_entries.sort_unstable_by(|a, b| a.0.cmp(&b.0));
+        if let Some(x) = host_entries.windows(2).find(|x| x[0].0 == x[1].0) {
+            return Err(anyhow::anyhow!(
+                "The hostname '{}' is used more than once",
+                x[0].0
+            ));
+        }
+
+        // build the host list; a group host's options are only built from the group here, and are
+        // dropped once its `HostInfo` is built
         let mut hosts = vec![];
-        for (name, host_options) in &config.hosts {
+        for (name, entry) in &host_entries {
+            let host_options = match entry {
+                HostEntry::Host(host) => Cow::Borrowed(*host),
+                HostEntry::Group(group, index) => Cow::Owned(group.host(*index)),
+            };
             let new_host = build_host(
                 config,
-                host_options,
+                &host_options,
                 name,
                 randomness_for_seed_calc,
                 hosts_to_debug,
@@ -73,7 +106,7 @@ impl SimConfig {
         }
 
         // load and parse the network graph
-        let graph: String = load_network_graph(config.network.graph.as_ref().unwrap())
+        let graph = load_network_graph(config.network.graph.as_ref().unwrap())
             .map_err(|e| anyhow::anyhow!(e))
             .context("Failed to load the network graph")?;
         let graph = NetworkGraph::parse(&graph)
@@ -133,11 +166,38 @@ impl SimConfig {
         // assign IP addresses to hosts and graph nodes
         let ip_assignment = assign_ips(&mut hosts)?;
 
+        // now that every host has an address, find the addresses of the traffic peers
+        let host_ips: HashMap<String, std::net::IpAddr> = hosts
+            .iter()
+            .map(|host| (host.name.clone(), host.ip_addr.unwrap()))
+            .collect();
+        for host in &mut hosts {
+            for traffic in &mut host.traffic {
+                let Some(peer_ip) = host_ips.get(&traffic.peer) else {
+                    return Err(anyhow::anyhow!(
+                        "The traffic peer '{}' of host '{}' doesn't exist",
+                        traffic.peer,
+                        host.name
+                    ));
+                };
+                let std::net::IpAddr::V4(peer_ip) = peer_ip else {
+                    // the config only allows ipv4 addresses, so this shouldn't happen
+                    unreachable!("IPv6 not supported");
+                };
+                traffic.peer_ip = Some(*peer_ip);
+            }
+        }
+
         // generate routing info between every pair of in-use nodes
         let routing_info = generate_routing_info(
-            &graph,
+            graph,
             &ip_assignment.get_nodes(),
             config.network.use_shortest_path.unwrap(),
+            config
+                .experimental
+                .use_on_demand_routing
+                .unwrap()
+                .then(|| config.experimental.routing_cache_size.unwrap()),
         )?;
 
         // get all host bandwidths
@@ -173,19 +233,27 @@ pub struct HostInfo {
     pub pause_for_debugging: bool,
     pub cpu_threshold: Option<SimulationTime>,
     pub cpu_precision: Option<SimulationTime>,
+    pub cpu_quantum: SimulationTime,
     pub bandwidth_down_bits: Option<u64>,
     pub bandwidth_up_bits: Option<u64>,
     pub ip_addr: Option<std::net::IpAddr>,
     pub log_level: Option<LogLevel>,
     pub pcap_config: Option<PcapConfig>,
+    pub tcp_congestion_control: TcpCongestionControl,
     pub heartbeat_log_level: Option<LogLevel>,
     pub heartbeat_log_info: HashSet<LogInfoFlag>,
+    pub heartbeat_format: HeartbeatFormat,
+    pub heartbeat_packet_sampling: u32,
     pub heartbeat_interval: Option<SimulationTime>,
     pub send_buf_size: u64,
     pub recv_buf_size: u64,
     pub autotune_send_buf: bool,
     pub autotune_recv_buf: bool,
+    pub tcp_pacing: bool,
+    pub tcp_segments_per_packet: u32,
     pub qdisc: QDiscMode,
+    pub router_qdisc: RouterQDiscMode,
+    pub traffic: Vec<TrafficInfo>,
 }
 
 #[derive(Clone)]
@@ -199,6 +267,19 @@ pub struct ProcessInfo {
     pub expected_final_state: ProcessFinalState,
 }
 
+#[derive(Debug, Clone)]
+pub struct TrafficInfo {
+    pub peer: String,
+    /// The peer's IP address, which is set once IP addresses have been assigned.
+    pub peer_ip: Option<std::net::Ipv4Addr>,
+    pub port: u16,
+    pub flow_rate: f64,
+    pub flow_size_min: u64,
+    pub flow_size_shape: f64,
+    pub start_time: SimulationTime,
+    pub stop_time: Option<SimulationTime>,
+}
+
 #[derive(Debug, Clone)]
 pub struct Bandwidth {
     pub up_bytes: u64,
@@ -208,6 +289,16 @@ pub struct Bandwidth {
 #[derive(Debug, Clone, Copy)]
 pub struct PcapConfig {
     pub capture_size: u64,
+    pub headers_only: bool,
+    /// Capture to the simulation's merged pcapng file rather than to a file per interface.
+    pub merged: bool,
+}
+
+/// A host in the configuration options.
+enum HostEntry<'a> {
+    Host(&'a HostOptions),
+    /// The host at an index of a group.
+    Group(&'a HostGroupOptions, u32),
 }
 
 /// For a host entry in the configuration options, build `HostInfo` object.
@@ -238,6 +329,32 @@ fn build_host(
         })
         .collect::<anyhow::Result<_>>()?;
 
+    let traffic: Vec<_> = host
+        .traffic
+        .iter()
+        .map(|traffic| {
+            build_traffic(traffic, config).with_context(|| {
+                format!("Failed to configure traffic to peer '{}'", &*traffic.peer)
+            })
+        })
+        .collect::<anyhow::Result<_>>()?;
+
+    let tcp_segments_per_packet = config.experimental.tcp_segments_per_packet.unwrap();
+    if !(1..=cshadow::CONFIG_TCP_MAX_SEGMENTS_PER_PACKET).contains(&tcp_segments_per_packet) {
+        return Err(anyhow::anyhow!(
+            "The TCP segments per packet must be between 1 and {}, but was {}",
+            cshadow::CONFIG_TCP_MAX_SEGMENTS_PER_PACKET,
+            tcp_segments_per_packet
+        ));
+    }
+
+    let cpu_precision = config.cpu_delay_precision();
+    if cpu_precision == Some(SimulationTime::ZERO) {
+        return Err(anyhow::anyhow!(
+            "The CPU delay precision must be greater than 0 if set"
+        ));
+    }
+
     Ok(HostInfo {
         name: hostname,
         processes,
@@ -246,8 +363,9 @@ fn build_host(
         network_node_id: host.network_node_id,
         pause_for_debugging,
 
-        cpu_threshold: None,
-        cpu_precision: Some(SimulationTime::from_nanos(200)),
+        cpu_threshold: config.cpu_delay_threshold(),
+        cpu_precision,
+        cpu_quantum: config.cpu_delay_quantum(),
 
         bandwidth_down_bits: host
             .bandwidth_down
@@ -270,7 +388,10 @@ fn build_host(
                     .convert(units::SiPrefixUpper::Base)
                     .unwrap()
                     .value(),
+                headers_only: host.host_options.pcap_headers_only.unwrap(),
+                merged: config.experimental.use_merged_pcap.unwrap(),
             }),
+        tcp_congestion_control: host.host_options.tcp_congestion_control.unwrap(),
 
         // some options come from the config options and not the host options
         heartbeat_log_level: config.experimental.host_heartbeat_log_level,
@@ -279,6 +400,8 @@ fn build_host(
             .host_heartbeat_log_info
             .clone()
             .unwrap_or_default(),
+        heartbeat_format: config.experimental.host_heartbeat_format.unwrap(),
+        heartbeat_packet_sampling: config.experimental.host_heartbeat_packet_sampling.unwrap(),
         heartbeat_interval: config
             .experimental
             .host_heartbeat_interval
@@ -300,7 +423,75 @@ fn build_host(
             .value(),
         autotune_send_buf: config.experimental.socket_send_autotune.unwrap(),
         autotune_recv_buf: config.experimental.socket_recv_autotune.unwrap(),
+        tcp_pacing: config.experimental.tcp_pacing.unwrap(),
+        tcp_segments_per_packet,
         qdisc: config.experimental.interface_qdisc.unwrap(),
+        router_qdisc: config.experimental.router_qdisc.unwrap(),
+        traffic,
+    })
+}
+
+/// For a traffic entry in the host's configuration options, build a `TrafficInfo` object.
+fn build_traffic(traffic: &TrafficOptions, config: &ConfigOptions) -> anyhow::Result<TrafficInfo> {
+    let start_time = Duration::from(traffic.start_time).try_into().unwrap();
+    let stop_time = traffic
+        .stop_time
+        .map(|x| Duration::from(x).try_into().unwrap());
+    let sim_stop_time =
+        SimulationTime::try_from(Duration::from(config.general.stop_time.unwrap())).unwrap();
+
+    if !(traffic.flow_rate.is_finite() && traffic.flow_rate > 0.0) {
+        return Err(anyhow::anyhow!(
+            "The flow rate must be greater than 0, but was {}",
+            traffic.flow_rate
+        ));
+    }
+
+    if !(traffic.flow_size_shape.is_finite() && traffic.flow_size_shape > 0.0) {
+        return Err(anyhow::anyhow!(
+            "The flow size shape must be greater than 0, but was {}",
+            traffic.flow_size_shape
+        ));
+    }
+
+    let flow_size_min = traffic
+        .flow_size_min
+        .convert(units::SiPrefixUpper::Base)
+        .unwrap()
+        .value();
+    if flow_size_min == 0 {
+        return Err(anyhow::anyhow!(
+            "The minimum flow size must be greater than 0"
+        ));
+    }
+
+    if start_time >= sim_stop_time {
+        return Err(anyhow::anyhow!(
+            "Traffic start time '{}' must be earlier than the simulation stop time '{}'",
+            traffic.start_time,
+            config.general.stop_time.unwrap(),
+        ));
+    }
+
+    if let Some(stop_time) = stop_time {
+        if start_time >= stop_time {
+            return Err(anyhow::anyhow!(
+                "Traffic start time '{}' must be earlier than its stop time '{}'",
+                traffic.start_time,
+                traffic.stop_time.unwrap(),
+            ));
+        }
+    }
+
+    Ok(TrafficInfo {
+        peer: traffic.peer.to_string(),
+        peer_ip: None,
+        port: traffic.port,
+        flow_rate: traffic.flow_rate,
+        flow_size_min,
+        flow_size_shape: traffic.flow_size_shape,
+        start_time,
+        stop_time,
     })
 }
 
@@ -384,17 +575,56 @@ fn build_process(proc: &ProcessOptions, config: &ConfigOptions) -> anyhow::Resul
     // set argv[0] as the user-provided expanded string, not the canonicalized version
     args.insert(0, expanded_path.into());
 
+    let mut env = proc.environment.clone();
+    if let Some(modes) = openssl_crypto_elision_env(config)? {
+        // the process's own environment takes precedence
+        env.entry(EnvName::new("SHADOW_OPENSSL_CRYPTO_ELIDE").unwrap())
+            .or_insert(modes);
+    }
+
     Ok(ProcessInfo {
         plugin: canonical_path,
         start_time,
         shutdown_time,
         shutdown_signal,
         args,
-        env: proc.environment.clone(),
+        env,
         expected_final_state: proc.expected_final_state,
     })
 }
 
+/// The crypto primitives that the preloaded OpenSSL crypto library can elide.
+const OPENSSL_CRYPTO_ELISION_MODES: &[&str] = &["aes-gcm", "sha256", "ecdh", "rsa"];
+
+/// The value of the `SHADOW_OPENSSL_CRYPTO_ELIDE` environment variable that tells the preloaded
+/// OpenSSL crypto library which primitives to elide, or `None` if it shouldn't elide any.
+fn openssl_crypto_elision_env(config: &ConfigOptions) -> anyhow::Result<Option<String>> {
+    let modes = config.experimental.openssl_crypto_elision.as_ref().unwrap();
+    if modes.is_empty() {
+        return Ok(None);
+    }
+
+    if !config.experimental.use_preload_openssl_crypto.unwrap() {
+        return Err(anyhow::anyhow!(
+            "The openssl_crypto_elision option requires use_preload_openssl_crypto"
+        ));
+    }
+
+    if let Some(mode) = modes
+        .iter()
+        .find(|x| !OPENSSL_CRYPTO_ELISION_MODES.contains(&x.as_str()))
+    {
+        return Err(anyhow::anyhow!(
+            "Unknown primitive '{mode}' in openssl_crypto_elision"
+        ));
+    }
+
+    // sort them so that the environment is deterministic
+    let mut modes: Vec<&str> = modes.iter().map(String::as_str).collect();
+    modes.sort_unstable();
+    Ok(Some(modes.join(",")))
+}
+
 /// Generate an IP assignment map using hosts' configured IP addresses and graph node IDs. For hosts
 /// without IP addresses, they will be assigned an arbitrary IP address.
 fn assign_ips(hosts: &mut [HostInfo]) -> anyhow::Result<IpAssignment<u32>> {
@@ -417,46 +647,69 @@ fn assign_ips(hosts: &mut [HostInfo]) -> anyhow::Result<IpAssignment<u32>> {
         host.ip_addr = Some(ip);
     }
 
+    // addresses are looked up for every packet that's sent between hosts
+    ip_assignment.build_index();
+
     Ok(ip_assignment)
 }
 
 /// Generate a map containing routing information (latency, packet loss, etc) for each pair of
-/// nodes.
+/// nodes. If `on_demand_cache_size` is set, shortest paths are instead computed as they're needed,
+/// and cached for that many source nodes.
 fn generate_routing_info(
-    graph: &NetworkGraph,
+    graph: NetworkGraph,
     nodes: &std::collections::HashSet<u32>,
     use_shortest_paths: bool,
+    on_demand_cache_size: Option<u32>,
 ) -> anyhow::Result<RoutingInfo<u32>> {
     // convert gml node IDs to petgraph indexes
     let nodes: Vec<_> = nodes
         .iter()
         .map(|x| *graph.node_id_to_index(*x).unwrap())
         .collect();
+    let ids: Vec<u32> = nodes
+        .iter()
+        .map(|x| graph.node_index_to_id(*x).unwrap())
+        .collect();
 
-    // helper to convert petgraph indexes back to gml node IDs
-    let to_ids = |((src, dst), path)| {
-        let src = graph.node_index_to_id(src).unwrap();
-        let dst = graph.node_index_to_id(dst).unwrap();
-        ((src, dst), path)
-    };
+    if let (true, Some(cache_size)) = (use_shortest_paths, on_demand_cache_size) {
+        anyhow::ensure!(
+            cache_size > 0,
+            "The routing cache size must be greater than 0"
+        );
+
+        graph
+            .check_shortest_paths(&nodes[..])
+            .map_err(|e| anyhow::anyhow!(e))
+            .context("Failed to check the paths between graph nodes")?;
+
+        let smallest_latencies_to_ns = graph
+            .get_smallest_edge_latencies_to_ns(&nodes[..])
+            .into_iter()
+            .map(|(node, latency)| (graph.node_index_to_id(node).unwrap(), latency))
+            .collect();
+
+        let compute = move |src: usize| graph.shortest_paths_from(nodes[src], &nodes[..]);
+
+        return Ok(RoutingInfo::new_on_demand(
+            &ids[..],
+            smallest_latencies_to_ns,
+            compute,
+            cache_size.try_into().unwrap(),
+        ));
+    }
 
     let paths = if use_shortest_paths {
         graph
             .compute_shortest_paths(&nodes[..])
             .map_err(|e| anyhow::anyhow!(e))
             .context("Failed to compute shortest paths between graph nodes")?
-            .into_iter()
-            .map(to_ids)
-            .collect()
     } else {
         graph
             .get_direct_paths(&nodes[..])
             .map_err(|e| anyhow::anyhow!(e))
             .context("Failed to get the direct paths between graph nodes")?
-            .into_iter()
-            .map(to_ids)
-            .collect()
     };
 
-    Ok(RoutingInfo::new(paths))
+    Ok(RoutingInfo::new(&ids[..], paths))
 }
@@ -1,25 +1,49 @@
 use std::cell::RefCell;
+use std::collections::{BTreeMap, HashMap};
 use std::sync::Mutex;
 
 use anyhow::Context;
 use serde::Serialize;
+use shadow_shim_helper_rs::HostId;
 
+use crate::core::host_profile::HostProfile;
 use crate::utility::counter::Counter;
+use crate::utility::histogram::{LatencyHistograms, LatencySummary};
+use crate::utility::perf_counters::PerfCounts;
+use crate::utility::ObjectCounts;
 
 /// Simulation statistics to be accessed by a single thread.
 #[derive(Debug)]
 pub struct LocalSimStats {
-    pub alloc_counts: RefCell<Counter>,
-    pub dealloc_counts: RefCell<Counter>,
+    pub alloc_counts: RefCell<ObjectCounts>,
+    pub dealloc_counts: RefCell<ObjectCounts>,
     pub syscall_counts: RefCell<Counter>,
+    pub ipc_wait_counts: RefCell<Counter>,
+    pub native_syscall_counts: RefCell<Counter>,
+    pub memory_access_counts: RefCell<Counter>,
+    pub syscall_latencies: RefCell<LatencyHistograms>,
+    /// Packets sent between each pair of network graph nodes. Not included in the output.
+    pub packet_counts: RefCell<HashMap<(u32, u32), u64>>,
+    /// The name of each host and the perf counts of this worker while running it.
+    pub host_perf_counts: RefCell<HashMap<HostId, (String, PerfCounts)>>,
+    /// The name and costs of each host that this worker shut down. Written to the host profile
+    /// rather than the sim stats.
+    pub host_profiles: RefCell<HashMap<HostId, (String, HostProfile)>>,
 }
 
 impl LocalSimStats {
     pub fn new() -> Self {
         Self {
-            alloc_counts: RefCell::new(Counter::new()),
-            dealloc_counts: RefCell::new(Counter::new()),
+            alloc_counts: RefCell::new(ObjectCounts::new()),
+            dealloc_counts: RefCell::new(ObjectCounts::new()),
             syscall_counts: RefCell::new(Counter::new()),
+            ipc_wait_counts: RefCell::new(Counter::new()),
+            native_syscall_counts: RefCell::new(Counter::new()),
+            memory_access_counts: RefCell::new(Counter::new()),
+            syscall_latencies: RefCell::new(LatencyHistograms::new()),
+            packet_counts: RefCell::new(HashMap::new()),
+            host_perf_counts: RefCell::new(HashMap::new()),
+            host_profiles: RefCell::new(HashMap::new()),
         }
     }
 }
@@ -33,17 +57,37 @@ impl Default for LocalSimStats {
 /// Simulation statistics to be accessed by multiple threads.
 #[derive(Debug)]
 pub struct SharedSimStats {
-    pub alloc_counts: Mutex<Counter>,
-    pub dealloc_counts: Mutex<Counter>,
+    pub alloc_counts: Mutex<ObjectCounts>,
+    pub dealloc_counts: Mutex<ObjectCounts>,
     pub syscall_counts: Mutex<Counter>,
+    pub ipc_wait_counts: Mutex<Counter>,
+    pub native_syscall_counts: Mutex<Counter>,
+    pub memory_access_counts: Mutex<Counter>,
+    pub syscall_latencies: Mutex<LatencyHistograms>,
+    pub packet_counts: Mutex<HashMap<(u32, u32), u64>>,
+    pub host_perf_counts: Mutex<HashMap<HostId, (String, PerfCounts)>>,
+    pub host_profiles: Mutex<HashMap<HostId, (String, HostProfile)>>,
+    /// Set once by the manager after building the hosts.
+    pub host_memory: Mutex<Counter>,
+    /// Usage of the workers' round arenas, added by each worker at the end of the simulation.
+    pub round_arena: Mutex<Counter>,
 }
 
 impl SharedSimStats {
     pub fn new() -> Self {
         Self {
-            alloc_counts: Mutex::new(Counter::new()),
-            dealloc_counts: Mutex::new(Counter::new()),
+            alloc_counts: Mutex::new(ObjectCounts::new()),
+            dealloc_counts: Mutex::new(ObjectCounts::new()),
             syscall_counts: Mutex::new(Counter::new()),
+            ipc_wait_counts: Mutex::new(Counter::new()),
+            native_syscall_counts: Mutex::new(Counter::new()),
+            memory_access_counts: Mutex::new(Counter::new()),
+            syscall_latencies: Mutex::new(LatencyHistograms::new()),
+            packet_counts: Mutex::new(HashMap::new()),
+            host_perf_counts: Mutex::new(HashMap::new()),
+            host_profiles: Mutex::new(HashMap::new()),
+            host_memory: Mutex::new(Counter::new()),
+            round_arena: Mutex::new(Counter::new()),
         }
     }
 
@@ -52,18 +96,58 @@ impl SharedSimStats {
         let mut shared_alloc_counts = self.alloc_counts.lock().unwrap();
         let mut shared_dealloc_counts = self.dealloc_counts.lock().unwrap();
         let mut shared_syscall_counts = self.syscall_counts.lock().unwrap();
+        let mut shared_ipc_wait_counts = self.ipc_wait_counts.lock().unwrap();
+        let mut shared_native_syscall_counts = self.native_syscall_counts.lock().unwrap();
+        let mut shared_memory_access_counts = self.memory_access_counts.lock().unwrap();
+        let mut shared_syscall_latencies = self.syscall_latencies.lock().unwrap();
+        let mut shared_packet_counts = self.packet_counts.lock().unwrap();
+        let mut shared_host_perf_counts = self.host_perf_counts.lock().unwrap();
+        let mut shared_host_profiles = self.host_profiles.lock().unwrap();
 
         let mut local_alloc_counts = local.alloc_counts.borrow_mut();
         let mut local_dealloc_counts = local.dealloc_counts.borrow_mut();
         let mut local_syscall_counts = local.syscall_counts.borrow_mut();
-
-        shared_alloc_counts.add_counter(&local_alloc_counts);
-        shared_dealloc_counts.add_counter(&local_dealloc_counts);
+        let mut local_ipc_wait_counts = local.ipc_wait_counts.borrow_mut();
+        let mut local_native_syscall_counts = local.native_syscall_counts.borrow_mut();
+        let mut local_memory_access_counts = local.memory_access_counts.borrow_mut();
+        let mut local_syscall_latencies = local.syscall_latencies.borrow_mut();
+        let mut local_packet_counts = local.packet_counts.borrow_mut();
+        let mut local_host_perf_counts = local.host_perf_counts.borrow_mut();
+        let mut local_host_profiles = local.host_profiles.borrow_mut();
+
+        shared_alloc_counts.add_counts(&local_alloc_counts);
+        shared_dealloc_counts.add_counts(&local_dealloc_counts);
         shared_syscall_counts.add_counter(&local_syscall_counts);
+        shared_ipc_wait_counts.add_counter(&local_ipc_wait_counts);
+        shared_native_syscall_counts.add_counter(&local_native_syscall_counts);
+        shared_memory_access_counts.add_counter(&local_memory_access_counts);
+        shared_syscall_latencies.merge(&local_syscall_latencies);
+        for (path, count) in local_packet_counts.drain() {
+            let shared_count = shared_packet_counts.entry(path).or_insert(0);
+            *shared_count = shared_count.saturating_add(count);
+        }
+        for (host_id, (name, counts)) in local_host_perf_counts.drain() {
+            shared_host_perf_counts
+                .entry(host_id)
+                .or_insert_with(|| (name, PerfCounts::default()))
+                .1
+                .add(&counts);
+        }
+        for (host_id, (name, profile)) in local_host_profiles.drain() {
+            shared_host_profiles
+                .entry(host_id)
+                .or_insert_with(|| (name, HostProfile::default()))
+                .1
+                .add(&profile);
+        }
 
-        *local_alloc_counts = Counter::new();
-        *local_dealloc_counts = Counter::new();
+        *local_alloc_counts = ObjectCounts::new();
+        *local_dealloc_counts = ObjectCounts::new();
         *local_syscall_counts = Counter::new();
+        *local_ipc_wait_counts = Counter::new();
+        *local_native_syscall_counts = Counter::new();
+        *local_memory_access_counts = Counter::new();
+        *local_syscall_latencies = LatencyHistograms::new();
     }
 }
 
@@ -78,6 +162,31 @@ impl Default for SharedSimStats {
 struct SimStatsForOutput {
     pub objects: ObjectStatsForOutput,
     pub syscalls: Counter,
+    /// How often Shadow's waits for a managed thread completed while
+    /// spinning ("spun") or had to sleep ("parked").
+    pub ipc_waits: Counter,
+    /// Syscalls that were executed natively, keyed by "plugin:syscall". These
+    /// are candidates for `experimental.native_syscall_passthrough`.
+    pub native_syscalls: Counter,
+    /// How many accesses of managed process memory used the memory mapper ("mapped_reads",
+    /// "mapped_writes") or had to fall back to copying with a syscall ("copied_reads",
+    /// "copied_writes").
+    pub memory_accesses: Counter,
+    /// Wall-clock time spent handling each syscall, when
+    /// `experimental.use_syscall_latency_histograms` is enabled.
+    pub syscall_latencies: BTreeMap<String, LatencySummary>,
+    /// The memory used by each host once the hosts have been built (before any processes have
+    /// started): "heap_bytes_per_host" is the average increase in Shadow's heap usage, and
+    /// "shmem_bytes_per_host" and "host_struct_bytes" are the sizes of the host's shared memory
+    /// block and `Host` object.
+    pub host_memory: Counter,
+    /// Performance counters of the worker threads while running each host, keyed by hostname,
+    /// when `experimental.use_perf_counters` is enabled.
+    pub host_perf_counters: BTreeMap<String, Counter>,
+    /// Usage of the workers' arenas for data that only lives until the end of a scheduling round:
+    /// "max_bytes_per_round" is the most that any worker allocated in a single round, and
+    /// "allocations" is the total number of allocations.
+    pub round_arena: Counter,
 }
 
 #[derive(Serialize, Clone, Debug)]
@@ -92,16 +201,31 @@ impl SimStatsForOutput {
     pub fn new(stats: &SharedSimStats) -> Self {
         Self {
             objects: ObjectStatsForOutput {
-                alloc_counts: std::mem::replace(
-                    &mut stats.alloc_counts.lock().unwrap(),
-                    Counter::new(),
-                ),
-                dealloc_counts: std::mem::replace(
-                    &mut stats.dealloc_counts.lock().unwrap(),
-                    Counter::new(),
-                ),
+                alloc_counts: std::mem::take(&mut *stats.alloc_counts.lock().unwrap()).to_counter(),
+                dealloc_counts: std::mem::take(&mut *stats.dealloc_counts.lock().unwrap())
+                    .to_counter(),
             },
             syscalls: std::mem::replace(&mut stats.syscall_counts.lock().unwrap(), Counter::new()),
+            ipc_waits: std::mem::replace(
+                &mut stats.ipc_wait_counts.lock().unwrap(),
+                Counter::new(),
+            ),
+            native_syscalls: std::mem::replace(
+                &mut stats.native_syscall_counts.lock().unwrap(),
+                Counter::new(),
+            ),
+            memory_accesses: std::mem::replace(
+                &mut stats.memory_access_counts.lock().unwrap(),
+                Counter::new(),
+            ),
+            syscall_latencies: std::mem::take(&mut *stats.syscall_latencies.lock().unwrap())
+                .summaries(),
+            host_memory: std::mem::replace(&mut stats.host_memory.lock().unwrap(), Counter::new()),
+            host_perf_counters: std::mem::take(&mut *stats.host_perf_counts.lock().unwrap())
+                .into_values()
+                .map(|(name, counts)| (name, counts.to_counter()))
+                .collect(),
+            round_arena: std::mem::replace(&mut stats.round_arena.lock().unwrap(), Counter::new()),
         }
     }
 }
@@ -4,7 +4,7 @@ use shadow_shim_helper_rs::HostId;
 use super::task::TaskRef;
 use crate::host::host::Host;
 use crate::network::packet::PacketRc;
-use crate::utility::{Magic, ObjectCounter};
+use crate::utility::{Magic, ObjectCounter, ObjectType};
 
 #[derive(Debug)]
 pub struct Event {
@@ -26,7 +26,7 @@ impl Event {
                 src_host_id: src_host.id(),
                 src_host_event_id: src_host.get_new_event_id(),
             }),
-            _counter: ObjectCounter::new("Event"),
+            _counter: ObjectCounter::new(ObjectType::Event),
         }
     }
 
@@ -40,7 +40,7 @@ impl Event {
                 task,
                 event_id: host.get_new_event_id(),
             }),
-            _counter: ObjectCounter::new("Event"),
+            _counter: ObjectCounter::new(ObjectType::Event),
         }
     }
 
@@ -1,21 +1,42 @@
 use std::cmp::Reverse;
 use std::collections::binary_heap::BinaryHeap;
 
+use crossbeam::queue::SegQueue;
 use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+use std_util::calendar_queue::CalendarQueue;
 
 use super::event::Event;
 
 /// A queue of [`Event`]s ordered by their times.
 #[derive(Debug)]
 pub struct EventQueue {
-    queue: BinaryHeap<Reverse<PanickingOrd<Event>>>,
+    queue: Queue,
     last_popped_event_time: EmulatedTime,
 }
 
+#[derive(Debug)]
+enum Queue {
+    Heap(BinaryHeap<Reverse<PanickingOrd<Event>>>),
+    /// Keyed by the nanoseconds since the simulation start.
+    Calendar(CalendarQueue<PanickingOrd<Event>>),
+}
+
 impl EventQueue {
+    /// A new queue backed by a binary heap.
     pub fn new() -> Self {
+        Self::with_queue(Queue::Heap(BinaryHeap::new()))
+    }
+
+    /// A new queue backed by a calendar queue, which has amortized O(1) pushes and pops rather
+    /// than O(log n). This may be faster for hosts with many pending events, such as hosts with
+    /// many TCP connections each with their own timers.
+    pub fn new_calendar() -> Self {
+        Self::with_queue(Queue::Calendar(CalendarQueue::new()))
+    }
+
+    fn with_queue(queue: Queue) -> Self {
         Self {
-            queue: BinaryHeap::new(),
+            queue,
             last_popped_event_time: EmulatedTime::SIMULATION_START,
         }
     }
@@ -32,12 +53,21 @@ impl EventQueue {
         // make sure time never moves backward
         assert!(event.time() >= self.last_popped_event_time);
 
-        self.queue.push(Reverse(event.into()));
+        match &mut self.queue {
+            Queue::Heap(queue) => queue.push(Reverse(event.into())),
+            Queue::Calendar(queue) => {
+                let time = u64::try_from(event.time().to_abs_simtime().as_nanos()).unwrap();
+                queue.push(time, event.into());
+            }
+        }
     }
 
     /// Pop the earliest [`Event`] from the queue.
     pub fn pop(&mut self) -> Option<Event> {
-        let event = self.queue.pop().map(|x| x.0.into_inner());
+        let event = match &mut self.queue {
+            Queue::Heap(queue) => queue.pop().map(|x| x.0.into_inner()),
+            Queue::Calendar(queue) => queue.pop().map(|(_time, x)| x.into_inner()),
+        };
 
         // make sure time never moves backward
         if let Some(ref event) = event {
@@ -50,7 +80,10 @@ impl EventQueue {
 
     /// The time of the next [`Event`] (the time of the earliest event in the queue).
     pub fn next_event_time(&self) -> Option<EmulatedTime> {
-        self.queue.peek().map(|x| x.0.time())
+        match &self.queue {
+            Queue::Heap(queue) => queue.peek().map(|x| x.0.time()),
+            Queue::Calendar(queue) => queue.peek().map(|(_time, x)| x.time()),
+        }
     }
 }
 
@@ -60,6 +93,38 @@ impl Default for EventQueue {
     }
 }
 
+/// A lock-free queue of [`Event`]s sent to a host from other hosts, which may be running on other
+/// threads. The host moves these events to its own [`EventQueue`] before it runs, so that senders
+/// never contend on a lock for the destination host's queue.
+#[derive(Debug, Default)]
+pub struct EventInbox {
+    events: SegQueue<Event>,
+}
+
+impl EventInbox {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Push a new [`Event`] on to the inbox. Events are moved to the destination's [`EventQueue`]
+    /// in an arbitrary order, so the order of events is still determined only by the event queue.
+    pub fn push(&self, event: Event) {
+        self.events.push(event);
+    }
+
+    /// Returns true if the inbox has no events.
+    pub fn is_empty(&self) -> bool {
+        self.events.is_empty()
+    }
+
+    /// Move all events from the inbox to `queue`.
+    pub fn drain_into(&self, queue: &mut EventQueue) {
+        while let Some(event) = self.events.pop() {
+            queue.push(event);
+        }
+    }
+}
+
 /// A wrapper type that implements [`Ord`] for types that implement [`PartialOrd`]. If the two
 /// objects cannot be compared (`PartialOrd::partial_cmp` returns `None`), the comparison will
 /// panic.
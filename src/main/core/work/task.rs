@@ -2,7 +2,7 @@ use std::sync::Arc;
 
 use crate::{
     host::host::Host,
-    utility::{IsSend, IsSync, Magic, ObjectCounter},
+    utility::{IsSend, IsSync, Magic, ObjectCounter, ObjectType},
 };
 
 /// Mostly for interoperability with C APIs.
@@ -20,7 +20,7 @@ impl TaskRef {
         Self {
             inner: Arc::new(f),
             magic: Magic::new(),
-            _counter: ObjectCounter::new("TaskRef"),
+            _counter: ObjectCounter::new(ObjectType::TaskRef),
         }
     }
 
@@ -59,6 +59,9 @@ impl PartialEq for TaskRef {
 impl Eq for TaskRef {}
 
 pub mod export {
+    use std::cell::RefCell;
+    use std::mem::MaybeUninit;
+
     use shadow_shim_helper_rs::util::SyncSendPointer;
     use shadow_shim_helper_rs::{notnull::notnull_mut, HostId};
 
@@ -70,6 +73,50 @@ pub mod export {
     pub type TaskObjectFreeFunc = Option<extern "C-unwind" fn(*mut libc::c_void)>;
     pub type TaskArgumentFreeFunc = Option<extern "C-unwind" fn(*mut libc::c_void)>;
 
+    /// The most `TaskRef` allocations that each thread keeps for reuse.
+    const TASKREF_POOL_MAX_LEN: usize = 1024;
+
+    thread_local! {
+        /// Allocations of `TaskRef`s that were dropped from C, for reuse by the next tasks that are
+        /// created from C. C code typically creates a task, schedules it (which clones the
+        /// `TaskRef` into the event), and then immediately drops it, so with the pool that
+        /// allocation and free are skipped for most timers and wakeups.
+        static TASKREF_POOL: RefCell<Vec<Box<MaybeUninit<TaskRef>>>> =
+            const { RefCell::new(Vec::new()) };
+    }
+
+    /// Move `task` into an allocation from the pool, or a new one if the pool is empty. The
+    /// returned pointer must be freed with `taskref_drop`.
+    fn taskref_into_raw(task: TaskRef) -> *mut TaskRef {
+        let slot = TASKREF_POOL
+            .try_with(|pool| pool.borrow_mut().pop())
+            .ok()
+            .flatten()
+            .unwrap_or_else(|| Box::new(MaybeUninit::uninit()));
+        let slot = Box::into_raw(slot);
+        unsafe { (*slot).write(task) };
+        slot.cast::<TaskRef>()
+    }
+
+    /// Drop the task in an allocation from `taskref_into_raw`, and return the allocation to the
+    /// pool.
+    ///
+    /// # Safety
+    ///
+    /// `task` must have been returned by `taskref_into_raw`, and not already dropped.
+    unsafe fn taskref_drop_raw(task: *mut TaskRef) {
+        let mut slot = unsafe { Box::from_raw(task.cast::<MaybeUninit<TaskRef>>()) };
+        // The pool isn't borrowed while the task is dropped, since dropping the last reference to
+        // a C task frees its object and argument, which may create and drop other tasks.
+        unsafe { slot.assume_init_drop() };
+        let _ = TASKREF_POOL.try_with(|pool| {
+            let mut pool = pool.borrow_mut();
+            if pool.len() < TASKREF_POOL_MAX_LEN {
+                pool.push(slot);
+            }
+        });
+    }
+
     /// Compatibility struct for creating a `TaskRef` from function pointers.
     struct CTaskHostTreePtrs {
         callback: TaskCallbackFunc,
@@ -217,7 +264,7 @@ pub mod export {
         // pointer indirection. Unfortunately that doesn't work because of the
         // internal dynamic Trait object, making the resulting pointer non-ABI
         // safe.
-        Box::into_raw(Box::new(task))
+        taskref_into_raw(task)
     }
 
     /// Create a new reference-counted task that may be executed on any Host.
@@ -256,7 +303,7 @@ pub mod export {
         // pointer indirection. Unfortunately that doesn't work because of the
         // internal dynamic Trait object, making the resulting pointer non-ABI
         // safe.
-        Box::into_raw(Box::new(task))
+        taskref_into_raw(task)
     }
 
     /// Destroys this reference to the `Task`, dropping the `Task` if no references remain.
@@ -268,6 +315,6 @@ pub mod export {
     /// `task` must be legally dereferencable.
     #[no_mangle]
     pub unsafe extern "C-unwind" fn taskref_drop(task: *mut TaskRef) {
-        drop(unsafe { Box::from_raw(notnull_mut(task)) });
+        unsafe { taskref_drop_raw(notnull_mut(task)) };
     }
 }
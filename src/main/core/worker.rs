@@ -1,5 +1,8 @@
+use std::alloc::Layout;
 use std::cell::{Cell, RefCell};
-use std::collections::HashMap;
+use std::collections::{HashMap, HashSet};
+use std::path::PathBuf;
+use std::ptr::NonNull;
 use std::sync::atomic::{AtomicBool, AtomicU32};
 use std::sync::{Arc, Mutex};
 
@@ -14,21 +17,25 @@ use shadow_shim_helper_rs::simulation_time::SimulationTime;
 use shadow_shim_helper_rs::util::SyncSendPointer;
 use shadow_shim_helper_rs::HostId;
 
-use super::work::event_queue::EventQueue;
+use super::work::event_queue::EventInbox;
 use crate::core::controller::ShadowStatusBarState;
 use crate::core::runahead::Runahead;
 use crate::core::sim_config::Bandwidth;
 use crate::core::sim_stats::{LocalSimStats, SharedSimStats};
 use crate::core::work::event::Event;
 use crate::cshadow;
-use crate::host::host::Host;
+use crate::host::host::{Host, RandomStream};
 use crate::host::process::{Process, ProcessId};
 use crate::host::thread::{Thread, ThreadId};
-use crate::network::graph::{IpAssignment, RoutingInfo};
+use crate::network::graph::{DenseIpMap, IpAssignment, RoutingInfo};
 use crate::network::packet::PacketRc;
 use crate::utility::childpid_watcher::ChildPidWatcher;
 use crate::utility::counter::Counter;
+use crate::utility::histogram::LatencyHistograms;
+use crate::utility::perf_counters::{PerfCounters, PerfCounts};
+use crate::utility::round_arena::RoundArena;
 use crate::utility::status_bar;
+use crate::utility::ObjectType;
 
 static USE_OBJECT_COUNTERS: AtomicBool = AtomicBool::new(false);
 
@@ -51,7 +58,19 @@ pub struct WorkerThreadID(pub u32);
 
 struct Clock {
     now: Option<EmulatedTime>,
+    /// The time until which the current host runs in this round.
     barrier: Option<EmulatedTime>,
+    /// The start and end of the current scheduling round.
+    round: Option<(EmulatedTime, EmulatedTime)>,
+}
+
+/// The properties of the path between two hosts that are needed to send each packet.
+#[derive(Copy, Clone, Debug)]
+struct Route {
+    src_node: u32,
+    dst_node: u32,
+    latency: SimulationTime,
+    reliability: f32,
 }
 
 /// Worker context, containing 'global' information for the current thread.
@@ -74,30 +93,63 @@ pub struct Worker {
     // This value is not the minimum latency of the simulation, but just a saved copy of this
     // worker's minimum latency.
     min_latency_cache: Cell<Option<SimulationTime>>,
+    // Whether `min_latency_cache` has been lowered since it was last given to the shared runahead.
+    min_latency_unpublished: Cell<bool>,
 
     // Statistics about the simulation, such as syscall counts.
     sim_stats: LocalSimStats,
 
     next_event_time: Cell<Option<EmulatedTime>>,
+
+    // Routes between pairs of host addresses that this worker has sent packets on, so that packets
+    // of the same flow don't need to look up the network graph nodes and the path between them.
+    // Routing doesn't change during the simulation, so the entries never need to be invalidated.
+    route_cache: RefCell<HashMap<(std::net::Ipv4Addr, std::net::Ipv4Addr), Route>>,
+
+    // Performance counters for this thread, if enabled.
+    perf_counters: Option<PerfCounters>,
+
+    // Memory for data that's only needed until the end of the current round. Reset at the start of
+    // each round.
+    round_arena: RefCell<RoundArena>,
 }
 
 impl Worker {
     // Create worker for this thread.
     pub fn new_for_this_thread(worker_id: WorkerThreadID) {
         WORKER.with(|worker| {
+            let shared = AtomicRef::map(WORKER_SHARED.borrow(), |x| x.as_ref().unwrap());
+
+            let perf_counters = if shared.use_perf_counters {
+                match PerfCounters::new() {
+                    Ok(x) => Some(x),
+                    Err(e) => {
+                        warn_once_then_debug!("Unable to open perf counters: {e}");
+                        None
+                    }
+                }
+            } else {
+                None
+            };
+
             let res = worker.set(RefCell::new(Self {
                 worker_id,
-                shared: AtomicRef::map(WORKER_SHARED.borrow(), |x| x.as_ref().unwrap()),
+                shared,
                 active_host: RefCell::new(None),
                 active_process: RefCell::new(None),
                 active_thread: RefCell::new(None),
                 clock: RefCell::new(Clock {
                     now: None,
                     barrier: None,
+                    round: None,
                 }),
                 min_latency_cache: Cell::new(None),
+                min_latency_unpublished: Cell::new(false),
                 sim_stats: LocalSimStats::new(),
                 next_event_time: Cell::new(None),
+                route_cache: RefCell::new(HashMap::new()),
+                perf_counters,
+                round_arena: RefCell::new(RoundArena::new()),
             }));
             assert!(res.is_ok(), "Worker already initialized");
         });
@@ -179,6 +231,17 @@ impl Worker {
         Worker::with(|w| f(w.shared.dns())).unwrap()
     }
 
+    /// Stop the shared file cache's contents of the file at the absolute path `path` from being
+    /// read, if the cache is enabled. Must be called before the file is truncated.
+    pub fn invalidate_cached_file(path: &std::ffi::CStr) {
+        Worker::with(|w| {
+            if let Some(cache) = &w.shared.file_cache {
+                unsafe { cshadow::filecache_invalidatePath(cache.ptr(), path.as_ptr()) };
+            }
+        })
+        .unwrap()
+    }
+
     /// Set the currently-active Host.
     pub fn set_active_host(host: Box<Host>) {
         let old = Worker::with(|w| w.active_host.borrow_mut().replace(host)).unwrap();
@@ -268,6 +331,21 @@ impl Worker {
         Worker::with(|w| w.clock.borrow().barrier).flatten()
     }
 
+    /// Set the start and end of the current scheduling round.
+    pub fn set_round(start: EmulatedTime, end: EmulatedTime) {
+        Worker::with(|w| w.clock.borrow_mut().round.replace((start, end))).unwrap();
+    }
+
+    /// The time until which the host runs in the current scheduling round. See
+    /// [`WorkerShared::host_round_end_time`].
+    pub fn host_round_end_time(host_id: HostId) -> EmulatedTime {
+        Worker::with(|w| {
+            let (start, end) = w.clock.borrow().round.unwrap();
+            w.shared.host_round_end_time(host_id, start, end)
+        })
+        .unwrap()
+    }
+
     /// Maximum time that the current event may run ahead to.
     pub fn max_event_runahead_time(host: &Host) -> EmulatedTime {
         let mut max = Worker::round_end_time().unwrap();
@@ -289,6 +367,9 @@ impl Worker {
         Worker::with(|w| w.clock.borrow().now).flatten()
     }
 
+    /// Record a packet latency that was used. The lowest latency that this worker has used is only
+    /// given to the shared runahead by [`Worker::publish_lowest_used_latency`], so that sending a
+    /// packet never touches state that's shared with other workers.
     pub fn update_lowest_used_latency(t: SimulationTime) {
         assert!(t != SimulationTime::ZERO);
 
@@ -296,7 +377,20 @@ impl Worker {
             let min_latency_cache = w.min_latency_cache.get();
             if min_latency_cache.is_none() || t < min_latency_cache.unwrap() {
                 w.min_latency_cache.set(Some(t));
-                w.shared.update_lowest_used_latency(t);
+                w.min_latency_unpublished.set(true);
+            }
+        })
+        .unwrap();
+    }
+
+    /// Give the lowest latency that this worker has used to the shared runahead, if it's changed.
+    /// Must be called by each worker at the end of each round, before the runahead for the next
+    /// round is chosen.
+    pub fn publish_lowest_used_latency() {
+        Worker::with(|w| {
+            if w.min_latency_unpublished.replace(false) {
+                w.shared
+                    .update_lowest_used_latency(w.min_latency_cache.get().unwrap());
             }
         })
         .unwrap();
@@ -331,7 +425,6 @@ impl Worker {
         assert!(!packet.is_null());
 
         let current_time = Worker::current_time().unwrap();
-        let round_end_time = Worker::round_end_time().unwrap();
 
         let is_completed = current_time >= Worker::with(|w| w.shared.sim_end_time).unwrap();
         let is_bootstrapping =
@@ -367,14 +460,11 @@ impl Worker {
             return;
         };
 
-        let src_ip = std::net::IpAddr::V4(src_ip);
-        let dst_ip = std::net::IpAddr::V4(dst_ip);
+        let route = Worker::with(|w| w.route(src_ip, dst_ip)).unwrap();
 
         // check if network reliability forces us to 'drop' the packet
-        let reliability: f64 = Worker::with(|w| w.shared.reliability(src_ip, dst_ip).unwrap())
-            .unwrap()
-            .into();
-        let chance: f64 = src_host.random_mut().gen();
+        let reliability: f64 = route.reliability.into();
+        let chance: f64 = src_host.random_mut(RandomStream::PacketLoss).gen();
 
         // don't drop control packets with length 0, otherwise congestion control has problems
         // responding to packet loss
@@ -389,10 +479,10 @@ impl Worker {
             return;
         }
 
-        let delay = Worker::with(|w| w.shared.latency(src_ip, dst_ip).unwrap()).unwrap();
+        let delay = route.latency;
 
         Worker::update_lowest_used_latency(delay);
-        Worker::with(|w| w.shared.increment_packet_count(src_ip, dst_ip)).unwrap();
+        Worker::increment_packet_count(route.src_node, route.dst_node);
 
         // TODO: this should change for sending to remote manager (on a different machine); this is
         // the only place where tasks are sent between separate host
@@ -407,10 +497,12 @@ impl Worker {
         // copy the packet
         let packet = PacketRc::from_raw(unsafe { cshadow::packet_copy(packet) });
 
-        // delay the packet until the next round
+        // delay the packet until the destination's next round; the destination may run further
+        // ahead than this host
+        let dst_round_end_time = Worker::host_round_end_time(dst_host_id);
         let mut deliver_time = current_time + delay;
-        if deliver_time < round_end_time {
-            deliver_time = round_end_time;
+        if deliver_time < dst_round_end_time {
+            deliver_time = dst_round_end_time;
         }
 
         // we may have sent this packet after the destination host finished running the current
@@ -437,31 +529,67 @@ impl Worker {
             .flatten()
     }
 
-    pub fn increment_object_alloc_counter(s: &str) {
+    /// The route from the host with address `src` to the host with address `dst`, which must both
+    /// exist in the simulation.
+    fn route(&self, src: std::net::Ipv4Addr, dst: std::net::Ipv4Addr) -> Route {
+        if let Some(route) = self.route_cache.borrow().get(&(src, dst)) {
+            return *route;
+        }
+
+        let src_node = self.shared.ip_assignment.get_node(src.into()).unwrap();
+        let dst_node = self.shared.ip_assignment.get_node(dst.into()).unwrap();
+        let path = self.shared.routing_info.path(src_node, dst_node).unwrap();
+
+        let route = Route {
+            src_node,
+            dst_node,
+            latency: SimulationTime::from_nanos(path.latency_ns),
+            reliability: 1.0 - path.packet_loss,
+        };
+        self.route_cache.borrow_mut().insert((src, dst), route);
+        route
+    }
+
+    /// Increment the number of packets sent from one node to another. The counts are kept in the
+    /// worker's local stats so that sending a packet doesn't need to take a lock.
+    fn increment_packet_count(src: u32, dst: u32) {
+        Worker::with(|w| {
+            let mut packet_counts = w.sim_stats.packet_counts.borrow_mut();
+            let count = packet_counts.entry((src, dst)).or_insert(0);
+            *count = count.saturating_add(1);
+        })
+        .unwrap()
+    }
+
+    pub fn increment_object_alloc_counter(object_type: ObjectType) {
         if !USE_OBJECT_COUNTERS.load(std::sync::atomic::Ordering::Relaxed) {
             return;
         }
 
         Worker::with(|w| {
-            w.sim_stats.alloc_counts.borrow_mut().add_one(s);
+            w.sim_stats.alloc_counts.borrow_mut().add_one(object_type);
         })
         .unwrap_or_else(|| {
             // no live worker; fall back to the shared counter
-            SIM_STATS.alloc_counts.lock().unwrap().add_one(s);
+            SIM_STATS.alloc_counts.lock().unwrap().add_one(object_type);
         });
     }
 
-    pub fn increment_object_dealloc_counter(s: &str) {
+    pub fn increment_object_dealloc_counter(object_type: ObjectType) {
         if !USE_OBJECT_COUNTERS.load(std::sync::atomic::Ordering::Relaxed) {
             return;
         }
 
         Worker::with(|w| {
-            w.sim_stats.dealloc_counts.borrow_mut().add_one(s);
+            w.sim_stats.dealloc_counts.borrow_mut().add_one(object_type);
         })
         .unwrap_or_else(|| {
             // no live worker; fall back to the shared counter
-            SIM_STATS.dealloc_counts.lock().unwrap().add_one(s);
+            SIM_STATS
+                .dealloc_counts
+                .lock()
+                .unwrap()
+                .add_one(object_type);
         });
     }
 
@@ -486,8 +614,155 @@ impl Worker {
         });
     }
 
+    pub fn add_syscall_latencies(syscall_latencies: &LatencyHistograms) {
+        Worker::with(|w| {
+            w.sim_stats
+                .syscall_latencies
+                .borrow_mut()
+                .merge(syscall_latencies);
+        })
+        .unwrap_or_else(|| {
+            // no live worker; fall back to the shared histograms
+            SIM_STATS
+                .syscall_latencies
+                .lock()
+                .unwrap()
+                .merge(syscall_latencies);
+
+            // while we handle this okay, this probably indicates an issue somewhere else in the
+            // code so panic only in debug builds
+            debug_panic!("Trying to add syscall latencies when there is no worker");
+        });
+    }
+
+    pub fn add_native_syscall_counts(native_syscall_counts: &Counter) {
+        Worker::with(|w| {
+            w.sim_stats
+                .native_syscall_counts
+                .borrow_mut()
+                .add_counter(native_syscall_counts);
+        })
+        .unwrap_or_else(|| {
+            // no live worker; fall back to the shared counter
+            SIM_STATS
+                .native_syscall_counts
+                .lock()
+                .unwrap()
+                .add_counter(native_syscall_counts);
+
+            // while we handle this okay, this probably indicates an issue somewhere else in the
+            // code so panic only in debug builds
+            debug_panic!("Trying to add native syscall counts when there is no worker");
+        });
+    }
+
+    pub fn add_memory_access_counts(memory_access_counts: &Counter) {
+        Worker::with(|w| {
+            w.sim_stats
+                .memory_access_counts
+                .borrow_mut()
+                .add_counter(memory_access_counts);
+        })
+        .unwrap_or_else(|| {
+            // no live worker; fall back to the shared counter
+            SIM_STATS
+                .memory_access_counts
+                .lock()
+                .unwrap()
+                .add_counter(memory_access_counts);
+        });
+    }
+
+    pub fn add_ipc_wait_counts(ipc_wait_counts: &Counter) {
+        Worker::with(|w| {
+            w.sim_stats
+                .ipc_wait_counts
+                .borrow_mut()
+                .add_counter(ipc_wait_counts);
+        })
+        .unwrap_or_else(|| {
+            // no live worker; fall back to the shared counter
+            SIM_STATS
+                .ipc_wait_counts
+                .lock()
+                .unwrap()
+                .add_counter(ipc_wait_counts);
+        });
+    }
+
+    /// The current values of this worker's perf counters, or `None` if perf counters aren't
+    /// enabled.
+    pub fn read_perf_counters() -> Option<PerfCounts> {
+        Worker::with(|w| w.perf_counters.as_ref().map(PerfCounters::read)).unwrap()
+    }
+
+    /// Attribute the perf counts since `start` (from [`Worker::read_perf_counters`]) to `host`,
+    /// and return them.
+    pub fn add_host_perf_counts(host: &Host, start: &PerfCounts) -> PerfCounts {
+        Worker::with(|w| {
+            let counts = w.perf_counters.as_ref().unwrap().read().since(start);
+            w.sim_stats
+                .host_perf_counts
+                .borrow_mut()
+                .entry(host.id())
+                .or_insert_with(|| (host.name().to_string(), PerfCounts::default()))
+                .1
+                .add(&counts);
+            counts
+        })
+        .unwrap()
+    }
+
+    /// Record the costs of `host` for the host profile. Should be called once for each host,
+    /// after it has been shut down.
+    pub fn add_host_profile(host: &Host) {
+        Worker::with(|w| {
+            w.sim_stats
+                .host_profiles
+                .borrow_mut()
+                .insert(host.id(), (host.name().to_string(), host.profile()));
+        })
+        .unwrap()
+    }
+
     pub fn add_to_global_sim_stats() {
-        Worker::with(|w| SIM_STATS.add_from_local_stats(&w.sim_stats)).unwrap()
+        Worker::with(|w| {
+            SIM_STATS.add_from_local_stats(&w.sim_stats);
+
+            let arena = w.round_arena.borrow();
+            let mut counts = SIM_STATS.round_arena.lock().unwrap();
+            let high_water = i64::try_from(arena.high_water_bytes()).unwrap();
+            let high_water = std::cmp::max(counts.get_value("max_bytes_per_round"), high_water);
+            counts.set_value("max_bytes_per_round", high_water);
+            counts.add_value("allocations", arena.num_allocs().try_into().unwrap());
+        })
+        .unwrap()
+    }
+
+    /// Allocate uninitialized memory from this worker's [`RoundArena`]. The memory is freed at the
+    /// start of the next scheduling round, so it must only be used for data that isn't needed
+    /// after the current round, and must not be shared with other workers. Panics if the
+    /// alignment is larger than [`round_arena::MAX_ALIGN`](crate::utility::round_arena::MAX_ALIGN).
+    pub fn round_alloc(layout: Layout) -> NonNull<u8> {
+        Worker::with(|w| w.round_arena.borrow_mut().alloc(layout)).unwrap()
+    }
+
+    /// Free everything allocated with [`Worker::round_alloc`]. Should be called by each worker at
+    /// the start of each scheduling round.
+    pub fn reset_round_arena() {
+        Worker::with(|w| w.round_arena.borrow_mut().reset()).unwrap()
+    }
+
+    /// The path of this worker's binary heartbeat file, or `None` if heartbeats aren't written
+    /// in the binary format.
+    pub fn heartbeat_path() -> Option<PathBuf> {
+        Worker::with(|w| {
+            w.shared
+                .heartbeat_dir
+                .as_ref()
+                .map(|dir| dir.join(format!("worker-{}.bin", w.worker_id.0)))
+        })
+        .flatten()
     }
 
     pub fn is_routable(src: std::net::IpAddr, dst: std::net::IpAddr) -> bool {
@@ -522,9 +797,19 @@ impl Worker {
 #[derive(Debug)]
 pub struct WorkerShared {
     pub ip_assignment: IpAssignment<u32>,
+    /// The host with each host's default IP address.
+    pub host_ids: DenseIpMap<HostId>,
     pub routing_info: RoutingInfo<u32>,
     pub host_bandwidths: HashMap<std::net::IpAddr, Bandwidth>,
     pub dns: SyncSendPointer<cshadow::DNS>,
+    /// Read-only cache of file contents shared by all hosts, if enabled.
+    pub file_cache: Option<SyncSendPointer<cshadow::FileCache>>,
+    /// Cache of metadata lookups in read-only trees shared by all hosts, if enabled.
+    pub stat_cache: Option<SyncSendPointer<cshadow::StatCache>>,
+    /// Whether writes to os-backed files are made from a background I/O thread.
+    pub use_async_file_writes: bool,
+    /// Whether each worker counts perf events while running each host.
+    pub use_perf_counters: bool,
     // allows for easy updating of the status bar's state
     pub status_logger_state: Option<Arc<status_bar::Status<ShadowStatusBarState>>>,
     // number of plugins that failed with a non-zero exit code
@@ -532,10 +817,16 @@ pub struct WorkerShared {
     // calculates the runahead for the next simulation round
     pub runahead: Runahead,
     pub child_pid_watcher: ChildPidWatcher,
+    /// Native processes that have been launched but haven't been started yet.
+    pub pending_process_pids: Mutex<HashSet<Pid>>,
     /// Event queues for each host. This should only be used to push packet events.
-    pub event_queues: HashMap<HostId, Arc<Mutex<EventQueue>>>,
+    pub event_inboxes: HashMap<HostId, Arc<EventInbox>>,
     pub bootstrap_end_time: EmulatedTime,
     pub sim_end_time: EmulatedTime,
+    /// Directory in which each worker writes its binary heartbeat file, if enabled.
+    pub heartbeat_dir: Option<PathBuf>,
+    /// The runahead of each host, if hosts run ahead by different amounts.
+    pub host_runaheads: Option<HashMap<HostId, SimulationTime>>,
 }
 
 impl WorkerShared {
@@ -571,13 +862,6 @@ impl WorkerShared {
         self.host_bandwidths.get(&ip)
     }
 
-    pub fn increment_packet_count(&self, src: std::net::IpAddr, dst: std::net::IpAddr) {
-        let src = self.ip_assignment.get_node(src).unwrap();
-        let dst = self.ip_assignment.get_node(dst).unwrap();
-
-        self.routing_info.increment_packet_count(src, dst)
-    }
-
     pub fn is_routable(&self, src: std::net::IpAddr, dst: std::net::IpAddr) -> bool {
         if self.ip_assignment.get_node(src).is_none() {
             return false;
@@ -592,13 +876,7 @@ impl WorkerShared {
     }
 
     pub fn resolve_ip_to_host_id(&self, ip: std::net::Ipv4Addr) -> Option<HostId> {
-        let dns = self.dns.ptr();
-        let ip = u32::from(ip).to_be();
-        let addr = unsafe { cshadow::dns_resolveIPToAddress(dns, ip) };
-        if addr.is_null() {
-            return None;
-        }
-        Some(unsafe { cshadow::address_getID(addr) })
+        self.host_ids.get(ip.into())
     }
 
     pub fn increment_plugin_error_count(&self) {
@@ -629,6 +907,28 @@ impl WorkerShared {
         self.runahead.get()
     }
 
+    /// The time until which the host runs in the scheduling round from `start` to `end`.
+    ///
+    /// With per-host runahead, every packet is sent at or after `start`, so a host can't receive a
+    /// packet before `start` plus the lowest latency of any path to the host, and it runs until
+    /// then instead. Since `start` never decreases and the host's runahead is fixed, a host never
+    /// receives a packet from before the end of its previous round.
+    pub fn host_round_end_time(
+        &self,
+        host_id: HostId,
+        start: EmulatedTime,
+        end: EmulatedTime,
+    ) -> EmulatedTime {
+        let Some(host_runaheads) = &self.host_runaheads else {
+            return end;
+        };
+
+        let host_end = start
+            .checked_add(*host_runaheads.get(&host_id).unwrap())
+            .unwrap_or(EmulatedTime::MAX);
+        std::cmp::min(host_end, self.sim_end_time)
+    }
+
     /// Should only be called from the thread-local worker.
     fn update_lowest_used_latency(&self, min_path_latency: SimulationTime) {
         self.runahead.update_lowest_used_latency(min_path_latency);
@@ -639,7 +939,17 @@ impl WorkerShared {
         &self.child_pid_watcher
     }
 
-    /// Push a packet to the destination host's event queue. Does not check that the time is valid
+    /// Record that the native process `pid` was launched, and is waiting to be started.
+    pub fn add_pending_process(&self, pid: Pid) {
+        self.pending_process_pids.lock().unwrap().insert(pid);
+    }
+
+    /// Record that the native process `pid` was started or killed.
+    pub fn remove_pending_process(&self, pid: Pid) {
+        self.pending_process_pids.lock().unwrap().remove(&pid);
+    }
+
+    /// Push a packet to the destination host's event inbox. Does not check that the time is valid
     /// (is outside of the current scheduling round, etc).
     pub fn push_packet_to_host(
         &self,
@@ -649,8 +959,8 @@ impl WorkerShared {
         src_host: &Host,
     ) {
         let event = Event::new_packet(packet, time, src_host);
-        let event_queue = self.event_queues.get(&dst_host_id).unwrap();
-        event_queue.lock().unwrap().push(event);
+        let event_inbox = self.event_inboxes.get(&dst_host_id).unwrap();
+        event_inbox.push(event);
     }
 }
 
@@ -675,11 +985,40 @@ mod export {
 
     use super::*;
 
+    /// Allocate `size` bytes of uninitialized memory, suitably aligned for any type, that is freed
+    /// at the start of the next scheduling round. See [`Worker::round_alloc`].
+    #[no_mangle]
+    pub extern "C-unwind" fn worker_roundAlloc(size: usize) -> *mut libc::c_void {
+        let layout = Layout::from_size_align(size, crate::utility::round_arena::MAX_ALIGN).unwrap();
+        Worker::round_alloc(layout).as_ptr().cast()
+    }
+
     #[no_mangle]
     pub extern "C-unwind" fn worker_getDNS() -> *mut cshadow::DNS {
         Worker::with_dns(std::ptr::from_ref).cast_mut()
     }
 
+    /// Returns the file cache shared by all hosts, or NULL if it's disabled.
+    #[no_mangle]
+    pub extern "C-unwind" fn worker_getFileCache() -> *mut cshadow::FileCache {
+        Worker::with(|w| w.shared.file_cache.as_ref().map(|x| x.ptr()))
+            .flatten()
+            .unwrap_or(std::ptr::null_mut())
+    }
+
+    /// Returns the stat cache shared by all hosts, or NULL if it's disabled.
+    #[no_mangle]
+    pub extern "C-unwind" fn worker_getStatCache() -> *mut cshadow::StatCache {
+        Worker::with(|w| w.shared.stat_cache.as_ref().map(|x| x.ptr()))
+            .flatten()
+            .unwrap_or(std::ptr::null_mut())
+    }
+
+    #[no_mangle]
+    pub extern "C-unwind" fn worker_useAsyncFileWrites() -> bool {
+        Worker::with(|w| w.shared.use_async_file_writes).unwrap_or(false)
+    }
+
     /// Addresses must be provided in network byte order.
     #[no_mangle]
     pub extern "C-unwind" fn worker_getLatency(
@@ -725,27 +1064,15 @@ mod export {
     /// Implementation for counting allocated objects. Do not use this function directly.
     /// Use worker_count_allocation instead from the call site.
     #[no_mangle]
-    pub extern "C-unwind" fn worker_increment_object_alloc_counter(
-        object_name: *const libc::c_char,
-    ) {
-        assert!(!object_name.is_null());
-
-        let s = unsafe { std::ffi::CStr::from_ptr(object_name) };
-        let s = s.to_str().unwrap();
-        Worker::increment_object_alloc_counter(s);
+    pub extern "C-unwind" fn worker_increment_object_alloc_counter(object_type: ObjectType) {
+        Worker::increment_object_alloc_counter(object_type);
     }
 
     /// Implementation for counting deallocated objects. Do not use this function directly.
     /// Use worker_count_deallocation instead from the call site.
     #[no_mangle]
-    pub extern "C-unwind" fn worker_increment_object_dealloc_counter(
-        object_name: *const libc::c_char,
-    ) {
-        assert!(!object_name.is_null());
-
-        let s = unsafe { std::ffi::CStr::from_ptr(object_name) };
-        let s = s.to_str().unwrap();
-        Worker::increment_object_dealloc_counter(s);
+    pub extern "C-unwind" fn worker_increment_object_dealloc_counter(object_type: ObjectType) {
+        Worker::increment_object_dealloc_counter(object_type);
     }
 
     /// Aggregate the given syscall counts in a worker syscall counter.
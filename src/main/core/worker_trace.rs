@@ -0,0 +1,136 @@
+//! A timeline of what each worker thread is doing, for `experimental.use_worker_trace`. It's
+//! written in the Chrome trace event format, which can be opened in Perfetto
+//! (<https://ui.perfetto.dev>) or `chrome://tracing`, and shows each worker as a track with the
+//! hosts that it ran in each round, the time that it spent waiting for the other workers to finish
+//! the round, and any syscalls that took a long time to handle.
+//!
+//! Each thread buffers its own events, and only locks the trace file when its buffer is full or
+//! when it's flushed, so that recording a span is cheap.
+
+use std::cell::RefCell;
+use std::fmt::Write as _;
+use std::fs::File;
+use std::io::{BufWriter, Write};
+use std::path::Path;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::Mutex;
+use std::time::{Duration, Instant};
+
+use once_cell::sync::OnceCell;
+
+/// Syscalls that take at least this long to handle are included in the trace.
+pub const LONG_SYSCALL: Duration = Duration::from_micros(100);
+
+/// A thread's buffered events are written to the file once they reach this size.
+const THREAD_BUFFER_SIZE: usize = 64 * 1024;
+
+static ENABLED: AtomicBool = AtomicBool::new(false);
+static START: OnceCell<Instant> = OnceCell::new();
+static FILE: Mutex<Option<BufWriter<File>>> = Mutex::new(None);
+
+std::thread_local! {
+    static BUFFER: RefCell<String> = const { RefCell::new(String::new()) };
+}
+
+/// Create the trace file at `path`, with a named track for each of `num_workers` worker threads.
+/// Spans are only recorded after this has succeeded.
+pub fn init(path: &Path, num_workers: usize) -> std::io::Result<()> {
+    let mut file = BufWriter::new(File::create(path)?);
+
+    writeln!(file, "[")?;
+    for i in 0..num_workers {
+        writeln!(
+            file,
+            r#"{{"name":"thread_name","ph":"M","pid":0,"tid":{i},"args":{{"name":"worker {i}"}}}},"#
+        )?;
+    }
+
+    *FILE.lock().unwrap() = Some(file);
+    START.get_or_init(Instant::now);
+    ENABLED.store(true, Ordering::Relaxed);
+
+    Ok(())
+}
+
+/// Whether spans are being recorded.
+#[inline]
+pub fn is_enabled() -> bool {
+    ENABLED.load(Ordering::Relaxed)
+}
+
+/// Record a span from `start` to `end` on the track of worker `tid`. Does nothing unless the
+/// trace is enabled.
+pub fn span(tid: u32, name: &str, start: Instant, end: Instant, args: &[(&str, u64)]) {
+    if !is_enabled() {
+        return;
+    }
+
+    let trace_start = *START.get().unwrap();
+    let micros = |t: Instant| t.saturating_duration_since(trace_start).as_secs_f64() * 1e6;
+
+    BUFFER.with(|buf| {
+        let buf = &mut *buf.borrow_mut();
+        write!(
+            buf,
+            r#"{{"name":{},"ph":"X","pid":0,"tid":{tid},"ts":{:.3},"dur":{:.3},"args":{{"#,
+            serde_json::to_string(name).unwrap(),
+            micros(start),
+            micros(end) - micros(start),
+        )
+        .unwrap();
+        for (i, (key, value)) in args.iter().enumerate() {
+            let sep = if i == 0 { "" } else { "," };
+            write!(buf, r#"{sep}"{key}":{value}"#).unwrap();
+        }
+        buf.push_str("}},\n");
+
+        if buf.len() >= THREAD_BUFFER_SIZE {
+            write_buffer(buf);
+        }
+    });
+}
+
+fn write_buffer(buf: &mut String) {
+    if let Some(file) = FILE.lock().unwrap().as_mut() {
+        if let Err(e) = file.write_all(buf.as_bytes()) {
+            log::warn!("Unable to write to the worker trace: {e}");
+        }
+    }
+    buf.clear();
+}
+
+/// Write the current thread's buffered spans to the trace file. Each worker thread must call this
+/// before [`finish`] is called.
+pub fn flush_thread_buffer() {
+    if !is_enabled() {
+        return;
+    }
+
+    BUFFER.with(|buf| write_buffer(&mut buf.borrow_mut()));
+}
+
+/// Flush the current thread's spans, terminate the JSON array, and close the trace file.
+pub fn finish() {
+    if !is_enabled() {
+        return;
+    }
+
+    flush_thread_buffer();
+    ENABLED.store(false, Ordering::Relaxed);
+
+    let Some(mut file) = FILE.lock().unwrap().take() else {
+        return;
+    };
+
+    // every span ends with a comma, so end the array with an event that doesn't
+    let rv = writeln!(
+        file,
+        r#"{{"name":"process_name","ph":"M","pid":0,"args":{{"name":"shadow"}}}}"#
+    )
+    .and_then(|()| writeln!(file, "]"))
+    .and_then(|()| file.flush());
+
+    if let Err(e) = rv {
+        log::warn!("Unable to write to the worker trace: {e}");
+    }
+}
@@ -5,26 +5,38 @@ use shadow_shim_helper_rs::{emulated_time::EmulatedTime, simulation_time::Simula
 /// Accounts for time executing code on the native CPU, calculating a
 /// corresponding delay for when the simulated CPU should be allowed to run
 /// next.
+///
+/// Native time is accumulated cheaply by [`Cpu::add_delay`], and only converted
+/// to simulated time and folded into the model once per `quantum` of simulated
+/// time (see [`Cpu::update_time`]).
 pub struct Cpu {
     simulated_frequency: u64,
     native_frequency: u64,
     threshold: Option<SimulationTime>,
     precision: Option<SimulationTime>,
+    quantum: SimulationTime,
     now: EmulatedTime,
     time_cpu_available: EmulatedTime,
+    // native time that hasn't been folded into `time_cpu_available` yet
+    pending_native_delay: Duration,
+    next_fold: EmulatedTime,
 }
 
 impl Cpu {
     /// `threshold`: if None, never report a delay. Otherwise only report a
     /// delay after it is more than this threshold.
     ///
-    /// `precision`: if provided, round individual native delays to this
+    /// `precision`: if provided, round each batch of native delays to this
     /// granularity (rounding up at midpoint). Panics if this is `Some(0)`.
+    ///
+    /// `quantum`: the minimum simulated time between folding accumulated native
+    /// delays into the model. If zero, they're folded on every time update.
     pub fn new(
         simulated_frequency: u64,
         native_frequency: u64,
         threshold: Option<SimulationTime>,
         precision: Option<SimulationTime>,
+        quantum: SimulationTime,
     ) -> Self {
         if let Some(precision) = precision {
             assert!(precision > SimulationTime::ZERO)
@@ -35,18 +47,41 @@ impl Cpu {
             native_frequency,
             threshold,
             precision,
+            quantum,
             now: EmulatedTime::MIN,
             time_cpu_available: EmulatedTime::MIN,
+            pending_native_delay: Duration::ZERO,
+            next_fold: EmulatedTime::MIN,
         }
     }
 
-    /// Configure the current time.
+    /// Configure the current time. If a quantum has passed since the last time
+    /// update that did so, folds the accumulated native delays into the model.
     pub fn update_time(&mut self, now: EmulatedTime) {
         self.now = now;
+        if now >= self.next_fold {
+            self.fold_pending_delay();
+            self.next_fold = now.saturating_add(self.quantum);
+        }
     }
 
-    /// Account for `native_delay` spent natively executing code.
+    /// Account for `native_delay` spent natively executing code. This only
+    /// accumulates the delay; it won't affect [`Cpu::delay`] until the next
+    /// quantum starts.
     pub fn add_delay(&mut self, native_delay: Duration) {
+        if self.threshold.is_none() {
+            // we'll never report a delay, so don't bother keeping track
+            return;
+        }
+        self.pending_native_delay += native_delay;
+    }
+
+    fn fold_pending_delay(&mut self) {
+        let native_delay = std::mem::replace(&mut self.pending_native_delay, Duration::ZERO);
+        if native_delay.is_zero() {
+            return;
+        }
+
         // first normalize the physical CPU to the virtual CPU. We use u128 here
         // to guarantee no overflow when multiplying two u64's.
         let cycles = native_delay
@@ -74,7 +109,8 @@ impl Cpu {
             }
         }
 
-        self.time_cpu_available += adjusted_delay;
+        // the CPU can't have been busy before the delay was added
+        self.time_cpu_available = std::cmp::max(self.time_cpu_available, self.now) + adjusted_delay;
     }
 
     /// Calculate the simulated delay until this CPU is ready to run again.
@@ -101,10 +137,11 @@ mod tests {
 
     #[test]
     fn no_threshold_never_delays() {
-        let mut cpu = Cpu::new(1000 * MHZ, 1000 * MHZ, None, None);
+        let mut cpu = Cpu::new(1000 * MHZ, 1000 * MHZ, None, None, SimulationTime::ZERO);
         assert_eq!(cpu.delay(), SimulationTime::ZERO);
 
         cpu.add_delay(Duration::from_secs(1));
+        cpu.update_time(EmulatedTime::UNIX_EPOCH);
         assert_eq!(cpu.delay(), SimulationTime::ZERO);
     }
 
@@ -115,6 +152,7 @@ mod tests {
             1000 * MHZ,
             Some(SimulationTime::NANOSECOND),
             None,
+            SimulationTime::ZERO,
         );
         assert_eq!(cpu.delay(), SimulationTime::ZERO);
 
@@ -123,6 +161,7 @@ mod tests {
 
         // Simulate having spent 1 native second.
         cpu.add_delay(Duration::from_secs(1));
+        cpu.update_time(EmulatedTime::UNIX_EPOCH);
 
         // With this configuration, simulated delay should be 1:1 with native time spent.
         assert_eq!(cpu.delay(), SimulationTime::SECOND);
@@ -148,10 +187,12 @@ mod tests {
             1_000_000 * MHZ,
             Some(SimulationTime::NANOSECOND),
             None,
+            SimulationTime::ZERO,
         );
 
         // Simulate having spent a native hour
         cpu.add_delay(Duration::from_secs(3600));
+        cpu.update_time(EmulatedTime::UNIX_EPOCH);
 
         assert_eq!(cpu.delay(), SimulationTime::from_secs(3600));
     }
@@ -163,11 +204,13 @@ mod tests {
             1100 * MHZ,
             Some(SimulationTime::NANOSECOND),
             None,
+            SimulationTime::ZERO,
         );
         assert_eq!(cpu.delay(), SimulationTime::ZERO);
 
         // Since the simulated CPU is slower, it takes longer to execute.
         cpu.add_delay(Duration::from_millis(1000));
+        cpu.update_time(EmulatedTime::UNIX_EPOCH);
         assert_eq!(cpu.delay(), SimulationTime::from_millis(1100));
     }
 
@@ -178,28 +221,38 @@ mod tests {
             1000 * MHZ,
             Some(SimulationTime::NANOSECOND),
             None,
+            SimulationTime::ZERO,
         );
         assert_eq!(cpu.delay(), SimulationTime::ZERO);
 
         // Since the simulated CPU is faster, it takes less time to execute.
         cpu.add_delay(Duration::from_millis(1100));
+        cpu.update_time(EmulatedTime::UNIX_EPOCH);
         assert_eq!(cpu.delay(), SimulationTime::from_millis(1000));
     }
 
     #[test]
     fn thresholded() {
         let threshold = SimulationTime::from_millis(100);
-        let mut cpu = Cpu::new(1000 * MHZ, 1000 * MHZ, Some(threshold), None);
+        let mut cpu = Cpu::new(
+            1000 * MHZ,
+            1000 * MHZ,
+            Some(threshold),
+            None,
+            SimulationTime::ZERO,
+        );
         assert_eq!(cpu.delay(), SimulationTime::ZERO);
 
         // Simulate having spent 1 ms.
         cpu.add_delay(Duration::from_millis(1));
+        cpu.update_time(EmulatedTime::UNIX_EPOCH);
 
         // Since this is below the threshold, delay should still be 0.
         assert_eq!(cpu.delay(), SimulationTime::ZERO);
 
         // Spend another 100 ms.
         cpu.add_delay(Duration::from_millis(100));
+        cpu.update_time(EmulatedTime::UNIX_EPOCH);
 
         // Now that we're past the threshold, should see the full 101 ms we've spent.
         assert_eq!(cpu.delay(), SimulationTime::from_millis(101));
@@ -213,8 +266,10 @@ mod tests {
             1000 * MHZ,
             Some(SimulationTime::NANOSECOND),
             Some(precision),
+            SimulationTime::ZERO,
         );
         cpu.add_delay(Duration::from_millis(149));
+        cpu.update_time(EmulatedTime::UNIX_EPOCH);
         assert_eq!(cpu.delay(), SimulationTime::from_millis(100));
     }
 
@@ -226,8 +281,10 @@ mod tests {
             1000 * MHZ,
             Some(SimulationTime::NANOSECOND),
             Some(precision),
+            SimulationTime::ZERO,
         );
         cpu.add_delay(Duration::from_millis(150));
+        cpu.update_time(EmulatedTime::UNIX_EPOCH);
         assert_eq!(cpu.delay(), SimulationTime::from_millis(200));
     }
 
@@ -239,8 +296,35 @@ mod tests {
             1000 * MHZ,
             Some(SimulationTime::NANOSECOND),
             Some(precision),
+            SimulationTime::ZERO,
         );
         cpu.add_delay(Duration::from_millis(151));
+        cpu.update_time(EmulatedTime::UNIX_EPOCH);
         assert_eq!(cpu.delay(), SimulationTime::from_millis(200));
     }
+
+    #[test]
+    fn folded_once_per_quantum() {
+        let quantum = SimulationTime::from_millis(10);
+        let mut cpu = Cpu::new(
+            1000 * MHZ,
+            1000 * MHZ,
+            Some(SimulationTime::NANOSECOND),
+            Some(SimulationTime::from_millis(1)),
+            quantum,
+        );
+        cpu.update_time(EmulatedTime::UNIX_EPOCH);
+
+        // Individually these would each round down to zero, but they're rounded as a batch.
+        for _ in 0..4 {
+            cpu.add_delay(Duration::from_micros(400));
+        }
+
+        // Not folded in until the quantum has passed.
+        cpu.update_time(EmulatedTime::UNIX_EPOCH + SimulationTime::from_millis(5));
+        assert_eq!(cpu.delay(), SimulationTime::ZERO);
+
+        cpu.update_time(EmulatedTime::UNIX_EPOCH + quantum);
+        assert_eq!(cpu.delay(), SimulationTime::from_millis(2));
+    }
 }
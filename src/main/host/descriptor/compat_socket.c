@@ -38,3 +38,14 @@ uintptr_t compatsocket_getCanonicalHandle(const CompatSocket* socket) {
 
     utility_panic("Invalid CompatSocket type");
 }
+
+TrackerSocketHandle compatsocket_getTrackerHandle(const CompatSocket* socket) {
+    switch (socket->type) {
+        case CST_LEGACY_SOCKET:
+            return legacysocket_getTrackerHandle(socket->object.as_legacy_socket);
+        case CST_INET_SOCKET: return inetsocket_getTrackerHandle(socket->object.as_inet_socket);
+        case CST_NONE: utility_panic("Unexpected CompatSocket type");
+    }
+
+    utility_panic("Invalid CompatSocket type");
+}
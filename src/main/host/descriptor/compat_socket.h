@@ -12,6 +12,7 @@ typedef struct _CompatSocket CompatSocket;
 
 #include "main/bindings/c/bindings-opaque.h"
 #include "main/host/descriptor/socket.h"
+#include "main/host/tracker_types.h"
 
 enum _CompatSocketTypes {
     CST_NONE,
@@ -35,4 +36,7 @@ CompatSocket compatsocket_fromInetSocket(const InetSocket* socket);
 /* handle to the socket object */
 uintptr_t compatsocket_getCanonicalHandle(const CompatSocket* socket);
 
+/* handle to the socket's stats in the tracker, or TRACKER_SOCKET_HANDLE_NONE */
+TrackerSocketHandle compatsocket_getTrackerHandle(const CompatSocket* socket);
+
 #endif /* SRC_MAIN_HOST_DESCRIPTOR_COMPAT_SOCKET_H_ */
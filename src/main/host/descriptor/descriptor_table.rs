@@ -1,4 +1,5 @@
-use std::collections::{BTreeSet, HashMap};
+use std::collections::HashMap;
+use std::ops::Bound;
 
 use log::*;
 use shadow_shim_helper_rs::explicit_drop::ExplicitDrop;
@@ -7,23 +8,28 @@ use shadow_shim_helper_rs::syscall_types::SyscallReg;
 use crate::host::descriptor::Descriptor;
 use crate::host::host::Host;
 use crate::utility::callback_queue::CallbackQueue;
-use crate::utility::ObjectCounter;
+use crate::utility::{ObjectCounter, ObjectType};
 
 /// POSIX requires fds to be assigned as `libc::c_int`, so we can't allow any fds larger than this.
 pub const FD_MAX: u32 = i32::MAX as u32;
 
+/// Descriptors with fds less than this are stored in a `Vec` indexed by fd. Larger fds are rare
+/// (for example from `dup2()` with a large fd), and are stored in a map so that they don't make the
+/// `Vec` huge.
+const DENSE_FD_LIMIT: u32 = 1 << 20;
+
 /// Map of file handles to file descriptors. Typically owned by a
 /// [`Thread`][crate::host::thread::Thread].
 #[derive(Clone)]
 pub struct DescriptorTable {
-    descriptors: HashMap<DescriptorHandle, Descriptor>,
+    /// Descriptors with fds less than [`DENSE_FD_LIMIT`], indexed by fd.
+    dense: Vec<Option<Descriptor>>,
 
-    // Indices less than `next_index` known to be available.
-    available_indices: BTreeSet<u32>,
+    /// Which entries of `dense` are in use.
+    dense_used: FdBitmap,
 
-    // Lowest index not in `available_indices` that *might* be available. We still need to verify
-    // availability in `descriptors`, though.
-    next_index: u32,
+    /// Descriptors with fds of at least [`DENSE_FD_LIMIT`].
+    sparse: HashMap<DescriptorHandle, Descriptor>,
 
     _counter: ObjectCounter,
 }
@@ -31,10 +37,10 @@ pub struct DescriptorTable {
 impl DescriptorTable {
     pub fn new() -> Self {
         DescriptorTable {
-            descriptors: HashMap::new(),
-            available_indices: BTreeSet::new(),
-            next_index: 0,
-            _counter: ObjectCounter::new("DescriptorTable"),
+            dense: Vec::new(),
+            dense_used: FdBitmap::default(),
+            sparse: HashMap::new(),
+            _counter: ObjectCounter::new(ObjectType::DescriptorTable),
         }
     }
 
@@ -45,97 +51,76 @@ impl DescriptorTable {
         descriptor: Descriptor,
         min_index: DescriptorHandle,
     ) -> Result<DescriptorHandle, Descriptor> {
-        let idx = if let Some(idx) = self.available_indices.range(min_index.val()..).next() {
-            // Un-borrow from `available_indices`.
-            let idx = *idx;
-            // Take from `available_indices`
-            trace!("Reusing available index {}", idx);
-            self.available_indices.remove(&idx);
-            idx
-        } else {
-            // Start our search at either the next likely available index or the minimum index,
-            // whichever is larger.
-            let mut idx = std::cmp::max(self.next_index, min_index.val());
-
-            // Check if this index out of range.
-            if idx > FD_MAX {
-                return Err(descriptor);
+        if min_index.val() < DENSE_FD_LIMIT {
+            let idx = self.dense_used.first_unset(min_index.val());
+            if idx < DENSE_FD_LIMIT {
+                trace!("Using index {}", idx);
+                let idx = DescriptorHandle::new(idx).unwrap();
+                let prev = self.set(idx, descriptor);
+                assert!(prev.is_none(), "Already a descriptor at {}", idx);
+                return Ok(idx);
             }
+        }
 
-            // Only update next_index if we started at it, otherwise there may be other
-            // available indexes lower than idx.
-            let should_update_next_index = idx == self.next_index;
-
-            // Skip past any indexes that are in use. This can happen after
-            // calling `set` with a value greater than `next_index`.
-            while self
-                .descriptors
-                .contains_key(&DescriptorHandle::new(idx).unwrap())
-            {
-                trace!("Skipping past in-use index {}", idx);
-
-                // Check if the next index is out of range.
-                if idx >= FD_MAX {
-                    return Err(descriptor);
-                }
+        // Search the sparse descriptors, which are rarely used.
+        let mut idx = std::cmp::max(min_index.val(), DENSE_FD_LIMIT);
 
-                // Won't overflow because of the check above.
-                idx += 1;
-            }
+        // Skip past any indexes that are in use.
+        while self
+            .sparse
+            .contains_key(&DescriptorHandle::new(idx).unwrap())
+        {
+            trace!("Skipping past in-use index {}", idx);
 
-            if should_update_next_index {
-                self.next_index = idx + 1;
+            // Check if the next index is out of range.
+            if idx >= FD_MAX {
+                return Err(descriptor);
             }
 
-            // Take the next index.
-            trace!("Using index {}", idx);
-            idx
-        };
+            // Won't overflow because of the check above.
+            idx += 1;
+        }
 
+        trace!("Using index {}", idx);
         let idx = DescriptorHandle::new(idx).unwrap();
-
-        let prev = self.descriptors.insert(idx, descriptor);
+        let prev = self.sparse.insert(idx, descriptor);
         assert!(prev.is_none(), "Already a descriptor at {}", idx);
 
         Ok(idx)
     }
 
-    // Call after inserting to `available_indices`, to free any that are contiguous
-    // with `next_index`.
-    fn trim_tail(&mut self) {
-        while let Some(last_in_available) = self.available_indices.iter().next_back().copied() {
-            if (last_in_available + 1) == self.next_index {
-                // Last entry in available_indices is adjacent to next_index.
-                // We can merge them, freeing an entry in `available_indices`.
-                self.next_index -= 1;
-                self.available_indices.remove(&last_in_available);
-            } else {
-                break;
-            }
-        }
-    }
-
     /// Get the descriptor at `idx`, if any.
     pub fn get(&self, idx: DescriptorHandle) -> Option<&Descriptor> {
-        self.descriptors.get(&idx)
+        if idx.val() < DENSE_FD_LIMIT {
+            self.dense.get(idx.val() as usize)?.as_ref()
+        } else {
+            self.sparse.get(&idx)
+        }
     }
 
     /// Get the descriptor at `idx`, if any.
     pub fn get_mut(&mut self, idx: DescriptorHandle) -> Option<&mut Descriptor> {
-        self.descriptors.get_mut(&idx)
+        if idx.val() < DENSE_FD_LIMIT {
+            self.dense.get_mut(idx.val() as usize)?.as_mut()
+        } else {
+            self.sparse.get_mut(&idx)
+        }
     }
 
     /// Insert a descriptor at `index`. If a descriptor is already present at that index, it is
     /// unregistered from that index and returned.
     #[must_use]
     fn set(&mut self, index: DescriptorHandle, descriptor: Descriptor) -> Option<Descriptor> {
-        // We ensure the index is no longer in `self.available_indices`. We *don't* ensure
-        // `self.next_index` is > `index`, since that'd require adding the indices in between to
-        // `self.available_indices`. It uses less memory and is no more expensive to iterate when
-        // *using* `self.available_indices` instead.
-        self.available_indices.remove(&index.val());
-
-        let prev = self.descriptors.insert(index, descriptor);
+        let prev = if index.val() < DENSE_FD_LIMIT {
+            let i = index.val() as usize;
+            if i >= self.dense.len() {
+                self.dense.resize_with(i + 1, || None);
+            }
+            self.dense_used.set(index.val());
+            self.dense[i].replace(descriptor)
+        } else {
+            self.sparse.insert(index, descriptor)
+        };
 
         if prev.is_some() {
             trace!("Overwriting index {}", index);
@@ -183,10 +168,19 @@ impl DescriptorTable {
     /// Deregister the descriptor with the given fd handle and return it.
     #[must_use]
     pub fn deregister_descriptor(&mut self, fd: DescriptorHandle) -> Option<Descriptor> {
-        let maybe_descriptor = self.descriptors.remove(&fd);
-        self.available_indices.insert(fd.val());
-        self.trim_tail();
-        maybe_descriptor
+        if fd.val() < DENSE_FD_LIMIT {
+            let descriptor = self.dense.get_mut(fd.val() as usize)?.take();
+            self.dense_used.clear(fd.val());
+
+            // don't keep empty slots at the end
+            while matches!(self.dense.last(), Some(None)) {
+                self.dense.pop();
+            }
+
+            descriptor
+        } else {
+            self.sparse.remove(&fd)
+        }
     }
 
     /// Remove and return all descriptors.
@@ -194,23 +188,21 @@ impl DescriptorTable {
         // reset the descriptor table
         let old_self = std::mem::replace(self, Self::new());
         // return the old descriptors
-        old_self.descriptors.into_values()
+        old_self
+            .dense
+            .into_iter()
+            .flatten()
+            .chain(old_self.sparse.into_values())
     }
 
     /// Remove and return all descriptors in the range. If you want to remove all descriptors, you
-    /// should use [`remove_all`](Self::remove_all).
+    /// should use [`remove_all`](Self::remove_all). This only visits the fds in the range that are
+    /// less than the largest fd in use.
     pub fn remove_range(
         &mut self,
         range: impl std::ops::RangeBounds<DescriptorHandle>,
     ) -> impl Iterator<Item = Descriptor> {
-        // This code is not very efficient but it shouldn't be called often, so it should be fine
-        // for now. If we wanted something more efficient, we'd need to redesign the descriptor
-        // table to not use a hash map.
-
-        let fds: Vec<_> = self
-            .iter()
-            .filter_map(|(fd, _)| range.contains(fd).then_some(*fd))
-            .collect();
+        let fds: Vec<_> = self.iter_range(range).map(|(fd, _)| fd).collect();
 
         let mut descriptors = Vec::with_capacity(fds.len());
         for fd in fds {
@@ -220,12 +212,133 @@ impl DescriptorTable {
         descriptors.into_iter()
     }
 
-    pub fn iter(&self) -> impl Iterator<Item = (&DescriptorHandle, &Descriptor)> {
-        self.descriptors.iter()
+    pub fn iter(&self) -> impl Iterator<Item = (DescriptorHandle, &Descriptor)> {
+        self.iter_range(..)
     }
 
-    pub fn iter_mut(&mut self) -> impl Iterator<Item = (&DescriptorHandle, &mut Descriptor)> {
-        self.descriptors.iter_mut()
+    pub fn iter_mut(&mut self) -> impl Iterator<Item = (DescriptorHandle, &mut Descriptor)> {
+        self.iter_range_mut(..)
+    }
+
+    /// Iterate over the descriptors in the range, which aren't necessarily in order.
+    pub fn iter_range(
+        &self,
+        range: impl std::ops::RangeBounds<DescriptorHandle>,
+    ) -> impl Iterator<Item = (DescriptorHandle, &Descriptor)> {
+        let dense = dense_range(&range, self.dense.len());
+        let dense = self.dense[dense.clone()]
+            .iter()
+            .zip(dense)
+            .filter_map(|(desc, fd)| Some((dense_handle(fd), desc.as_ref()?)));
+        let sparse = self
+            .sparse
+            .iter()
+            .filter(move |(fd, _)| range.contains(fd))
+            .map(|(fd, desc)| (*fd, desc));
+        dense.chain(sparse)
+    }
+
+    /// Iterate over the descriptors in the range, which aren't necessarily in order.
+    pub fn iter_range_mut(
+        &mut self,
+        range: impl std::ops::RangeBounds<DescriptorHandle>,
+    ) -> impl Iterator<Item = (DescriptorHandle, &mut Descriptor)> {
+        let dense = dense_range(&range, self.dense.len());
+        let dense = self.dense[dense.clone()]
+            .iter_mut()
+            .zip(dense)
+            .filter_map(|(desc, fd)| Some((dense_handle(fd), desc.as_mut()?)));
+        let sparse = self
+            .sparse
+            .iter_mut()
+            .filter(move |(fd, _)| range.contains(fd))
+            .map(|(fd, desc)| (*fd, desc));
+        dense.chain(sparse)
+    }
+}
+
+/// The indexes of the dense descriptors that are in the range, given the number of dense slots.
+fn dense_range(
+    range: &impl std::ops::RangeBounds<DescriptorHandle>,
+    len: usize,
+) -> std::ops::Range<usize> {
+    let start = match range.start_bound() {
+        Bound::Included(x) => x.val() as usize,
+        Bound::Excluded(x) => x.val() as usize + 1,
+        Bound::Unbounded => 0,
+    };
+    let end = match range.end_bound() {
+        Bound::Included(x) => x.val() as usize + 1,
+        Bound::Excluded(x) => x.val() as usize,
+        Bound::Unbounded => len,
+    };
+    let end = std::cmp::min(end, len);
+    std::cmp::min(start, end)..end
+}
+
+fn dense_handle(index: usize) -> DescriptorHandle {
+    DescriptorHandle::new(index.try_into().unwrap()).unwrap()
+}
+
+/// A set of indexes that can quickly find the lowest index not in the set. The second level has a
+/// bit for each word of the first level, so that runs of full words can be skipped 64 at a time.
+#[derive(Clone, Default)]
+struct FdBitmap {
+    /// Bit `i % 64` of word `i / 64` is set if index `i` is in the set.
+    words: Vec<u64>,
+    /// Bit `w % 64` of word `w / 64` is set if word `w` of `words` is full.
+    full: Vec<u64>,
+}
+
+impl FdBitmap {
+    fn set(&mut self, index: u32) {
+        let w = (index / 64) as usize;
+        if w >= self.words.len() {
+            self.words.resize(w + 1, 0);
+            self.full.resize(w / 64 + 1, 0);
+        }
+
+        self.words[w] |= 1 << (index % 64);
+        if self.words[w] == u64::MAX {
+            self.full[w / 64] |= 1 << (w % 64);
+        }
+    }
+
+    fn clear(&mut self, index: u32) {
+        let w = (index / 64) as usize;
+        if w >= self.words.len() {
+            return;
+        }
+
+        self.words[w] &= !(1 << (index % 64));
+        self.full[w / 64] &= !(1 << (w % 64));
+    }
+
+    /// Returns the lowest index of at least `min` that isn't in the set. Indexes past the end of
+    /// the bitmap are never in the set.
+    fn first_unset(&self, min: u32) -> u32 {
+        let w = (min / 64) as usize;
+        if w >= self.words.len() {
+            return min;
+        }
+
+        let unset = !self.words[w] & (u64::MAX << (min % 64));
+        if unset != 0 {
+            return (w as u32) * 64 + unset.trailing_zeros();
+        }
+
+        // find the next word that isn't full
+        let w = w + 1;
+        let mut s = w / 64;
+        let mut not_full = !self.full.get(s).copied().unwrap_or(0) & (u64::MAX << (w % 64));
+        while not_full == 0 {
+            s += 1;
+            not_full = !self.full.get(s).copied().unwrap_or(0);
+        }
+
+        let w = s * 64 + not_full.trailing_zeros() as usize;
+        let unset = !self.words.get(w).copied().unwrap_or(0);
+        (w as u32) * 64 + unset.trailing_zeros()
     }
 }
 
@@ -360,3 +473,178 @@ impl std::fmt::Display for DescriptorHandleError {
 }
 
 impl std::error::Error for DescriptorHandleError {}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// The lowest index of at least `min` that isn't in `set`.
+    fn first_unset_linear(set: &[bool], min: u32) -> u32 {
+        (min..)
+            .find(|&i| !set.get(i as usize).copied().unwrap_or(false))
+            .unwrap()
+    }
+
+    #[test]
+    fn test_bitmap_fill_across_full_word_boundary() {
+        // more than 64 full words, so the `full` summary spills into a second word
+        let n = 64 * 64 + 70;
+        let mut bitmap = FdBitmap::default();
+        for i in 0..n {
+            assert_eq!(bitmap.first_unset(0), i);
+            bitmap.set(i);
+        }
+        assert_eq!(bitmap.full[0], u64::MAX);
+        assert_eq!(bitmap.first_unset(0), n);
+        assert_eq!(bitmap.first_unset(64 * 64 - 1), n);
+        assert_eq!(bitmap.first_unset(n + 3), n + 3);
+    }
+
+    #[test]
+    fn test_bitmap_clear_in_full_word() {
+        let n = 64 * 70;
+        let mut bitmap = FdBitmap::default();
+        for i in 0..n {
+            bitmap.set(i);
+        }
+        assert_eq!(bitmap.first_unset(0), n);
+
+        let freed = 64 * 65 + 7;
+        bitmap.clear(freed);
+        assert_eq!(bitmap.full[1] & (1 << 1), 0);
+        assert_eq!(bitmap.first_unset(0), freed);
+        assert_eq!(bitmap.first_unset(freed), freed);
+        assert_eq!(bitmap.first_unset(freed + 1), n);
+
+        // the word is full again
+        bitmap.set(freed);
+        assert_eq!(bitmap.full[1] & (1 << 1), 1 << 1);
+        assert_eq!(bitmap.first_unset(0), n);
+
+        // clearing an index that was never set, or past the end, is a no-op
+        bitmap.clear(n + 100);
+        assert_eq!(bitmap.first_unset(0), n);
+    }
+
+    #[test]
+    // Too slow for miri
+    #[cfg_attr(miri, ignore)]
+    fn test_bitmap_random() {
+        use rand::Rng;
+        use rand_core::SeedableRng;
+        let mut rng = rand_chacha::ChaCha8Rng::seed_from_u64(10);
+
+        for _ in 0..5 {
+            let mut bitmap = FdBitmap::default();
+            let mut set = vec![false; 64 * 64 * 3];
+            // bias towards allocating, so that the bitmap fills beyond a single summary word
+            for _ in 0..20_000 {
+                let min = if rng.gen_bool(0.5) {
+                    0
+                } else {
+                    rng.gen_range(0..set.len() as u32)
+                };
+                let expected = first_unset_linear(&set, min);
+                assert_eq!(bitmap.first_unset(min), expected, "min {min}");
+
+                if rng.gen_bool(0.7) {
+                    if (expected as usize) < set.len() {
+                        bitmap.set(expected);
+                        set[expected as usize] = true;
+                    }
+                } else {
+                    let i = rng.gen_range(0..set.len() as u32);
+                    bitmap.clear(i);
+                    set[i as usize] = false;
+                }
+            }
+        }
+    }
+
+    fn new_descriptor() -> Descriptor {
+        use crate::host::descriptor::eventfd::EventFd;
+        use crate::host::descriptor::{CompatFile, File, FileStatus, OpenFile};
+
+        let eventfd = EventFd::new(0, false, FileStatus::empty());
+        let file = File::EventFd(std::sync::Arc::new(atomic_refcell::AtomicRefCell::new(
+            eventfd,
+        )));
+        Descriptor::new(CompatFile::New(OpenFile::new(file)))
+    }
+
+    fn handle(fd: u32) -> DescriptorHandle {
+        DescriptorHandle::new(fd).unwrap()
+    }
+
+    #[test]
+    // can't call foreign function, when dropping the descriptors
+    #[cfg_attr(miri, ignore)]
+    fn test_table_sparse_fds() {
+        let mut table = DescriptorTable::new();
+
+        assert!(table
+            .register_descriptor_with_fd(new_descriptor(), handle(DENSE_FD_LIMIT + 1))
+            .is_none());
+        assert!(table
+            .register_descriptor_with_fd(new_descriptor(), handle(FD_MAX))
+            .is_none());
+
+        // sparse fds don't affect the dense allocation
+        assert_eq!(
+            table.register_descriptor(new_descriptor()).unwrap(),
+            handle(0)
+        );
+
+        let min = handle(DENSE_FD_LIMIT);
+        let fd = table
+            .register_descriptor_with_min_fd(new_descriptor(), min)
+            .unwrap();
+        assert_eq!(fd, handle(DENSE_FD_LIMIT));
+        let fd = table
+            .register_descriptor_with_min_fd(new_descriptor(), min)
+            .unwrap();
+        assert_eq!(fd, handle(DENSE_FD_LIMIT + 2));
+
+        // a full dense range spills over to the sparse fds
+        let fd = table
+            .register_descriptor_with_min_fd(new_descriptor(), handle(DENSE_FD_LIMIT - 1))
+            .unwrap();
+        assert_eq!(fd, handle(DENSE_FD_LIMIT - 1));
+        let fd = table
+            .register_descriptor_with_min_fd(new_descriptor(), handle(DENSE_FD_LIMIT - 1))
+            .unwrap();
+        assert_eq!(fd, handle(DENSE_FD_LIMIT + 3));
+
+        // there's no fd past FD_MAX
+        assert!(table
+            .register_descriptor_with_min_fd(new_descriptor(), handle(FD_MAX))
+            .is_err());
+
+        assert!(table.get(handle(DENSE_FD_LIMIT + 1)).is_some());
+        assert!(table.get(handle(DENSE_FD_LIMIT + 4)).is_none());
+        assert!(table
+            .deregister_descriptor(handle(DENSE_FD_LIMIT))
+            .is_some());
+        assert!(table.get(handle(DENSE_FD_LIMIT)).is_none());
+        let fd = table
+            .register_descriptor_with_min_fd(new_descriptor(), min)
+            .unwrap();
+        assert_eq!(fd, handle(DENSE_FD_LIMIT));
+
+        let fds: Vec<_> = table.iter().map(|(fd, _)| fd.val()).collect();
+        let mut sorted = fds.clone();
+        sorted.sort();
+        assert_eq!(
+            sorted,
+            [
+                0,
+                DENSE_FD_LIMIT - 1,
+                DENSE_FD_LIMIT,
+                DENSE_FD_LIMIT + 1,
+                DENSE_FD_LIMIT + 2,
+                DENSE_FD_LIMIT + 3,
+                FD_MAX
+            ]
+        );
+    }
+}
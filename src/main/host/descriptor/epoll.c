@@ -66,6 +66,16 @@ union _EpollWatchObject {
     const File* as_file;
 };
 
+/* the epoll tables are indexed by the (fd, objectPtr) tuple so you can add the same object
+ * multiple times under different fds, and you can add the same fd multiple times as long as the
+ * object is different */
+typedef struct _EpollKey EpollKey;
+struct _EpollKey {
+    int fd;
+    /* store the pointer as an int so that we never accidentally de-reference it */
+    uintptr_t objectPtr;
+};
+
 typedef struct _EpollWatch EpollWatch;
 struct _EpollWatch {
     /* A unique id for this watch relative to other watches in this epoll instance.
@@ -77,6 +87,8 @@ struct _EpollWatch {
     EpollWatchObject watchObject;
     /* the fd of the object we are watching */
     int fd;
+    /* the key of this watch in the epoll tables */
+    EpollKey key;
     /* the listener that notifies us when status changes */
     StatusListener* listener;
     /* holds the actual event info */
@@ -86,19 +98,20 @@ struct _EpollWatch {
     /* The last time we reported an event on this watch.
      * This is used to ensure fairness across watches when reporting events. */
     CEmulatedTime last_reported_event_time;
+    /* true if the status changed and the watch is waiting in the epoll's pendingWatches */
+    gboolean statusPending;
+    /* the epoll's syncRound when this watch was last added or synced */
+    guint syncRound;
+    /* the epoll whose arena holds this watch */
+    Epoll* epoll;
+    /* the next released watch in the arena, while this one is released */
+    EpollWatch* nextFree;
     gint referenceCount;
     MAGIC_DECLARE;
 };
 
-/* the epoll tables are indexed by the (fd, objectPtr) tuple so you can add the same object
- * multiple times under different fds, and you can add the same fd multiple times as long as the
- * object is different */
-typedef struct _EpollKey EpollKey;
-struct _EpollKey {
-    int fd;
-    /* store the pointer as an int so that we never accidentally de-reference it */
-    uintptr_t objectPtr;
-};
+/* watches are allocated from their epoll in chunks of this many */
+#define EPOLL_WATCH_CHUNK_LEN 64
 
 struct _Epoll {
     /* epoll itself is also a descriptor */
@@ -107,25 +120,36 @@ struct _Epoll {
     /* holds the wrappers for the descriptors we are watching for events */
     GHashTable* watching;
 
-    /* holds the descriptors that we are watching that have events */
-    GHashTable* ready;
+    /* holds the descriptors that we are watching that have events, ordered by key so that we
+     * can report them deterministically without sorting */
+    GTree* ready;
 
     /* A counter for sorting watches, for guaranteeing determinism when reporting events. */
     uint64_t watch_id_counter;
 
+    /* watches whose status changed since we last processed them, in the order they changed.
+     * a file's status can flip several times within one simulated instant, so we process each
+     * watch once from a task instead of on every flip. */
+    GPtrArray* pendingWatches;
+    /* true if a task to process the pending watches is scheduled */
+    gboolean processPendingIsScheduled;
+
+    /* arena of EpollWatch chunks, so that the watches of an epoll are close together in memory
+     * and are freed together with it */
+    GPtrArray* watchChunks;
+    /* how many watches of the last chunk were handed out */
+    guint lastChunkUsed;
+    /* released watches that can be handed out again, linked by nextFree */
+    EpollWatch* freeWatches;
+
+    /* incremented by every epoll_beginWatchSync */
+    guint syncRound;
+    /* number of distinct watches synced in the current round */
+    guint numSynced;
+
     MAGIC_DECLARE;
 };
 
-static EpollKey* _epollkey_new(int fd, uintptr_t objectPtr) {
-    EpollKey* key = g_new0(EpollKey, 1);
-    utility_debugAssert(key);
-
-    key->fd = fd;
-    key->objectPtr = objectPtr;
-
-    return key;
-}
-
 static guint _epollkey_hash(gconstpointer ptr) {
     const EpollKey* key = ptr;
     return g_int_hash(&key->fd) ^ g_int_hash(&key->objectPtr);
@@ -137,45 +161,54 @@ static gboolean _epollkey_equal(gconstpointer ptr_1, gconstpointer ptr_2) {
     return key_1->fd == key_2->fd && key_1->objectPtr == key_2->objectPtr;
 }
 
-/* compare by the associated file descriptor */
-static gint _epollkey_compare(gconstpointer ptr_1, gconstpointer ptr_2) {
+/* compare by the associated file descriptor, then by object so that keys are totally ordered */
+static gint _epollkey_compare(gconstpointer ptr_1, gconstpointer ptr_2, gpointer userData) {
     const EpollKey* key_1 = ptr_1;
     const EpollKey* key_2 = ptr_2;
 
-    /* if the fds are the same but the objects are different, something went wrong */
-    if (key_1->fd == key_2->fd) {
-        assert(key_1->objectPtr == key_2->objectPtr);
+    if (key_1->fd != key_2->fd) {
+        return (key_1->fd < key_2->fd) ? -1 : 1;
+    } else if (key_1->objectPtr != key_2->objectPtr) {
+        return (key_1->objectPtr < key_2->objectPtr) ? -1 : 1;
+    } else {
+        return 0;
     }
-
-    return key_1->fd - key_2->fd;
 }
 
-static gint _epollwatch_compare(gconstpointer ptr_1, gconstpointer ptr_2) {
-    const EpollWatch* watch_1 = ptr_1;
-    const EpollWatch* watch_2 = ptr_2;
-    /* Prioritize watches whose last events were reported longest ago. */
-    if (watch_1->last_reported_event_time < watch_2->last_reported_event_time) {
-        /* watch_1 was reported longest ago and should come first. */
-        return -1;
-    } else if (watch_1->last_reported_event_time > watch_2->last_reported_event_time) {
-        /* watch_2 was reported longest ago and should come first. */
-        return 1;
+static void _epoll_fileStatusChanged(Epoll* epoll, const EpollKey* key);
+static void _epoll_watchStatusChanged(Epoll* epoll, const EpollKey* key);
+
+/* returns a zeroed watch from the epoll's arena */
+static EpollWatch* _epoll_allocWatch(Epoll* epoll) {
+    EpollWatch* watch = epoll->freeWatches;
+
+    if (watch != NULL) {
+        epoll->freeWatches = watch->nextFree;
     } else {
-        /* Both were previously reported at the same time (or never reported yet),
-         * so now we fall back to the deterministic unique id ordering. */
-        utility_debugAssert(watch_1->id != watch_2->id);
-        return (watch_1->id < watch_2->id) ? -1 : 1;
+        if (epoll->watchChunks->len == 0 || epoll->lastChunkUsed == EPOLL_WATCH_CHUNK_LEN) {
+            g_ptr_array_add(epoll->watchChunks, g_new(EpollWatch, EPOLL_WATCH_CHUNK_LEN));
+            epoll->lastChunkUsed = 0;
+        }
+        EpollWatch* chunk = g_ptr_array_index(epoll->watchChunks, epoll->watchChunks->len - 1);
+        watch = &chunk[epoll->lastChunkUsed++];
     }
+
+    memset(watch, 0, sizeof(*watch));
+    watch->epoll = epoll;
+    return watch;
 }
 
-/* forward declaration */
-static void _epoll_fileStatusChanged(Epoll* epoll, const EpollKey* key);
+/* returns the watch to its epoll's arena; the memory stays valid until the epoll is freed */
+static void _epoll_releaseWatch(Epoll* epoll, EpollWatch* watch) {
+    watch->nextFree = epoll->freeWatches;
+    epoll->freeWatches = watch;
+}
 
 // Will take its own reference to the file object.
 static EpollWatch* _epollwatch_new(Epoll* epoll, int fd, EpollWatchTypes type,
                                    EpollWatchObject object, const struct epoll_event* event,
                                    const Host* host) {
-    EpollWatch* watch = g_new0(EpollWatch, 1);
+    EpollWatch* watch = _epoll_allocWatch(epoll);
     MAGIC_INIT(watch);
     utility_debugAssert(event);
     utility_debugAssert(epoll);
@@ -205,15 +238,17 @@ static EpollWatch* _epollwatch_new(Epoll* epoll, int fd, EpollWatchTypes type,
         objectPtr = (uintptr_t)NULL;
     }
 
-    EpollKey *key = _epollkey_new(fd, objectPtr);
+    watch->key.fd = fd;
+    watch->key.objectPtr = objectPtr;
 
     /* Create the listener and ref the objects held by the listener.
      * The watch object already holds a ref to the descriptor so we
-     * don't ref it again. */
+     * don't ref it again. The listener is removed from the file before
+     * the watch is freed, so it can't outlive the key. */
     watch->listener = statuslistener_new(
-        (StatusCallbackFunc)_epoll_fileStatusChanged, epoll, NULL, key, g_free, host);
+        (StatusCallbackFunc)_epoll_watchStatusChanged, epoll, NULL, &watch->key, NULL, host);
 
-    worker_count_allocation(EpollWatch);
+    worker_count_allocation(EPOLL_WATCH);
     return watch;
 }
 
@@ -230,9 +265,9 @@ static void _epollwatch_free(EpollWatch* watch) {
 
     statuslistener_unref(watch->listener);
 
-    worker_count_deallocation(EpollWatch);
+    worker_count_deallocation(EPOLL_WATCH);
     MAGIC_CLEAR(watch);
-    g_free(watch);
+    _epoll_releaseWatch(watch->epoll, watch);
 }
 
 static void _epollwatch_ref(EpollWatch* watch) {
@@ -260,35 +295,33 @@ static void _epoll_free(LegacyFile* descriptor) {
 
     /* this unrefs all of the remaining watches */
     g_hash_table_destroy(epoll->watching);
-    g_hash_table_destroy(epoll->ready);
+    g_tree_destroy(epoll->ready);
+    g_ptr_array_free(epoll->pendingWatches, TRUE);
+
+    /* every watch was released above, so we can free them all at once */
+    g_ptr_array_free(epoll->watchChunks, TRUE);
 
     legacyfile_clear((LegacyFile*)epoll);
     MAGIC_CLEAR(epoll);
     g_free(epoll);
 
-    worker_count_deallocation(Epoll);
+    worker_count_deallocation(EPOLL);
 }
 
 void epoll_clearWatchListeners(Epoll* epoll) {
     MAGIC_ASSERT(epoll);
 
-    /* Iterate the hash table in a deterministic order.
-     * It might be better to maintain the watching values in a sorted structure so we
-     * don't have to re-sort every time this function is called. One option is:
-     * https://developer.gnome.org/glib/2.68/glib-Balanced-Binary-Trees.html
-     * We should probably check the performance before/after such a change. */
-    GList* watch_list = g_hash_table_get_values(epoll->watching);
-    GList* next_item = NULL;
-
-    /* Prepare the list for deterministic iteration. */
-    if (watch_list != NULL) {
-        watch_list = g_list_sort(watch_list, _epollwatch_compare);
-        next_item = g_list_first(watch_list);
-    }
+    /* The hash table's iteration order isn't deterministic, but that's okay here: we only disable
+     * and remove each watch's listener, which doesn't run any callbacks, and removing a listener
+     * keeps the remaining listeners of the file in the order they were added. So the order that
+     * we visit the watches in has no effect on the simulation. */
+    GHashTableIter iter;
+    gpointer value = NULL;
+    g_hash_table_iter_init(&iter, epoll->watching);
 
     /* make sure none of our watch descriptors notify us anymore */
-    while (next_item != NULL) {
-        EpollWatch* watch = next_item->data;
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        EpollWatch* watch = value;
         MAGIC_ASSERT(watch);
 
         statuslistener_setMonitorStatus(watch->listener, FileState_NONE, SLF_NEVER);
@@ -298,21 +331,20 @@ void epoll_clearWatchListeners(Epoll* epoll) {
         } else if (watch->watchType == EWT_GENERIC_FILE) {
             file_removeListener(watch->watchObject.as_file, watch->listener);
         }
-
-        next_item = g_list_next(next_item);
     }
+}
 
-    /* Cleanup just the list but not the list values, which are owned by the hash table. */
-    if (watch_list) {
-        g_list_free(watch_list);
-    }
+static GTree* _epoll_newReadyTree() {
+    /* the keys are owned by the watches */
+    return g_tree_new_full(_epollkey_compare, NULL, NULL, (GDestroyNotify)_epollwatch_unref);
 }
 
 void epoll_reset(Epoll* epoll) {
     MAGIC_ASSERT(epoll);
     epoll_clearWatchListeners(epoll);
-    // Removing will also unref previously stored descriptors
-    g_hash_table_remove_all(epoll->ready);
+    // Removing will also unref previously stored descriptors. g_tree_remove_all() needs glib 2.70.
+    g_tree_destroy(epoll->ready);
+    epoll->ready = _epoll_newReadyTree();
     g_hash_table_remove_all(epoll->watching);
 }
 
@@ -331,13 +363,17 @@ Epoll* epoll_new() {
     legacyfile_init(&(epoll->super), DT_EPOLL, &epollFunctions);
 
     /* allocate backend needed for managing events for this descriptor */
-    epoll->watching = g_hash_table_new_full(_epollkey_hash, _epollkey_equal, g_free, (GDestroyNotify)_epollwatch_unref);
-    epoll->ready = g_hash_table_new_full(_epollkey_hash, _epollkey_equal, g_free, (GDestroyNotify)_epollwatch_unref);
+    /* the keys are owned by the watches */
+    epoll->watching = g_hash_table_new_full(
+        _epollkey_hash, _epollkey_equal, NULL, (GDestroyNotify)_epollwatch_unref);
+    epoll->ready = _epoll_newReadyTree();
+    epoll->pendingWatches = g_ptr_array_new_with_free_func((GDestroyNotify)_epollwatch_unref);
+    epoll->watchChunks = g_ptr_array_new_with_free_func(g_free);
 
     /* the epoll descriptor itself is always able to be epolled */
     legacyfile_adjustStatus(&(epoll->super), FileState_ACTIVE, TRUE, 0);
 
-    worker_count_allocation(Epoll);
+    worker_count_allocation(EPOLL);
 
     return epoll;
 }
@@ -459,6 +495,35 @@ static void _getWatchObject(const Descriptor* descriptor, EpollWatchTypes* watch
     }
 }
 
+// Drops the reference taken by `_getWatchObject`.
+static void _dropWatchObject(EpollWatchTypes watchType, EpollWatchObject watchObject) {
+    switch (watchType) {
+        case EWT_LEGACY_FILE:
+            legacyfile_unref(watchObject.as_legacy_file);
+            break;
+        case EWT_GENERIC_FILE:
+            file_drop(watchObject.as_file);
+            break;
+        default: utility_panic("unrecognized watch type");
+    }
+}
+
+static EpollKey _epollkey_forWatchObject(int fd, EpollWatchTypes watchType,
+                                         EpollWatchObject watchObject) {
+    EpollKey key;
+    key.fd = fd;
+    switch (watchType) {
+        case EWT_LEGACY_FILE:
+            key.objectPtr = (uintptr_t)(void*)watchObject.as_legacy_file;
+            break;
+        case EWT_GENERIC_FILE:
+            key.objectPtr = file_getCanonicalHandle(watchObject.as_file);
+            break;
+        default: utility_panic("unrecognized watch type");
+    }
+    return key;
+}
+
 gint epoll_control(Epoll* epoll, gint operation, int fd, const Descriptor* descriptor,
                    const struct epoll_event* event, const Host* host) {
     MAGIC_ASSERT(epoll);
@@ -473,17 +538,7 @@ gint epoll_control(Epoll* epoll, gint operation, int fd, const Descriptor* descr
     _getWatchObject(descriptor, &watchType, &watchObject);
 
     /* this on-stack key can be used for lookups only, not new entries */
-    EpollKey key;
-    key.fd = fd;
-    switch (watchType) {
-        case EWT_LEGACY_FILE:
-            key.objectPtr = (uintptr_t)(void*)watchObject.as_legacy_file;
-            break;
-        case EWT_GENERIC_FILE:
-            key.objectPtr = file_getCanonicalHandle(watchObject.as_file);
-            break;
-        default: utility_panic("unrecognized watch type");
-    }
+    EpollKey key = _epollkey_forWatchObject(fd, watchType, watchObject);
 
     EpollWatch* watch = g_hash_table_lookup(epoll->watching, &key);
 
@@ -518,8 +573,8 @@ gint epoll_control(Epoll* epoll, gint operation, int fd, const Descriptor* descr
             /* start watching for status changes */
             watch = _epollwatch_new(epoll, fd, watchType, watchObject, event, host);
             watch->flags |= EWF_WATCHING;
-            gpointer new_key = _epollkey_new(key.fd, key.objectPtr);
-            g_hash_table_replace(epoll->watching, new_key, watch);
+            watch->syncRound = epoll->syncRound;
+            g_hash_table_replace(epoll->watching, &watch->key, watch);
 
             /* It's added, so we need to listen for changes. Here we listen for
              * all statuses, because epoll will filter what it needs.
@@ -583,7 +638,7 @@ gint epoll_control(Epoll* epoll, gint operation, int fd, const Descriptor* descr
             }
 
             /* unref gets called on the watch when it is removed from these tables */
-            g_hash_table_remove(epoll->ready, &key);
+            g_tree_remove(epoll->ready, &key);
             g_hash_table_remove(epoll->watching, &key);
             /* if that was the last watch, this epoll is not readable to its parents */
             _epoll_fileStatusChanged(epoll, NULL);
@@ -598,132 +653,220 @@ gint epoll_control(Epoll* epoll, gint operation, int fd, const Descriptor* descr
         }
     }
 
-    switch (watchType) {
-        case EWT_LEGACY_FILE:
-            legacyfile_unref(watchObject.as_legacy_file);
-            break;
-        case EWT_GENERIC_FILE:
-            file_drop(watchObject.as_file);
-            break;
-        default: utility_panic("unrecognized watch type");
-    }
+    _dropWatchObject(watchType, watchObject);
 
     return rv;
 }
 
-guint epoll_getNumReadyEvents(Epoll* epoll) {
+void epoll_beginWatchSync(Epoll* epoll) {
     MAGIC_ASSERT(epoll);
-    return g_hash_table_size(epoll->ready);
+    epoll->syncRound++;
+    epoll->numSynced = 0;
 }
 
-gint epoll_getEvents(Epoll* epoll, struct epoll_event* eventArray, gint eventArrayLength, gint* nEvents) {
+gint epoll_syncWatch(Epoll* epoll, int fd, const Descriptor* descriptor,
+                     const struct epoll_event* event, const Host* host) {
     MAGIC_ASSERT(epoll);
-    utility_debugAssert(nEvents);
+    utility_debugAssert(event);
 
-    /* return the available events in the eventArray, making sure not to
-     * overflow. the number of actual events is returned in nEvents. */
-    gint eventIndex = 0;
-
-    /*
-     * We need to guarantee that the events are returned in a deterministic order when the
-     * simulation is run multiple times, so we cannot use hash table iterator.
-     * Using a list here has some potential performance implications:
-     * - O(n) to loop the hash table and create the list of values
-     * - O(n) to sort the list
-     * - O(n) for our iteration of the list
-     * We think that the ready list is typically small and so 3*O(n) will be small in practice.
-     * If this turns out not to be the case, we could consider maintaining a sorted object of the
-     * ready watch values alongside the epoll->ready hash table instead, which may allow us
-     * to improve the performance of this function. One option is to use binary trees, e.g.,
-     * https://developer.gnome.org/glib/2.68/glib-Balanced-Binary-Trees.html
-     * We should test the performance before and after such a change.
-     */
-    GList* ready_list = g_hash_table_get_keys(epoll->ready);
-    GList* next_key = NULL;
-
-    /* Prepare the list for deterministic iteration. */
-    if (ready_list != NULL) {
-        ready_list = g_list_sort(ready_list, _epollkey_compare);
-        next_key = g_list_first(ready_list);
-    }
-
-    GList* not_ready_list = NULL;
-
-    /* Iterate the list. */
-    while ((next_key != NULL) && (eventIndex < eventArrayLength)) {
-        EpollKey* key = next_key->data;
-        assert(key != NULL);
-
-        EpollWatch* watch = g_hash_table_lookup(epoll->ready, key);
-        MAGIC_ASSERT(watch);
+    EpollWatchTypes watchType;
+    EpollWatchObject watchObject;
+    _getWatchObject(descriptor, &watchType, &watchObject);
+    EpollKey key = _epollkey_forWatchObject(fd, watchType, watchObject);
+    EpollWatch* watch = g_hash_table_lookup(epoll->watching, &key);
+    _dropWatchObject(watchType, watchObject);
 
-        if (_epollwatch_isReady(watch)) {
-            /* report the event */
-            eventArray[eventIndex] = watch->event;
-            eventArray[eventIndex].events = 0;
+    if (watch == NULL) {
+        gint rv = epoll_control(epoll, EPOLL_CTL_ADD, fd, descriptor, event, host);
+        if (rv == 0) {
+            epoll->numSynced++;
+        }
+        return rv;
+    }
 
-            if((watch->flags & EWF_READABLE) && (watch->flags & EWF_WAITINGREAD)) {
-                eventArray[eventIndex].events |= EPOLLIN;
-            }
-            if((watch->flags & EWF_WRITEABLE) && (watch->flags & EWF_WAITINGWRITE)) {
-                eventArray[eventIndex].events |= EPOLLOUT;
-            }
+    MAGIC_ASSERT(watch);
 
-            /* Record that we are reporting the event now. */
-            watch->last_reported_event_time = worker_getCurrentEmulatedTime();
+    /* like a repeated EPOLL_CTL_ADD, the first sync of a watch in a round wins */
+    if (watch->syncRound == epoll->syncRound) {
+        return -EEXIST;
+    }
+    watch->syncRound = epoll->syncRound;
 
-            /* event was just collected, unset the change status */
-            watch->flags &= ~EWF_READCHANGED;
-            watch->flags &= ~EWF_WRITECHANGED;
+    if (watch->event.events != event->events || watch->event.data.u64 != event->data.u64) {
+        /* same as EPOLL_CTL_MOD */
+        watch->event = *event;
+        watch->flags &= ~EWF_EDGETRIGGER_REPORTED;
+        watch->flags &= ~EWF_ONESHOT_REPORTED;
+    }
 
-            eventIndex++;
-            utility_debugAssert(eventIndex <= eventArrayLength);
+    /* the listener may have been paused since the watch was last synced, so its status may be
+     * stale; resume listening and update it now */
+    statuslistener_setMonitorStatus(
+        watch->listener,
+        FileState_ACTIVE | FileState_CLOSED | FileState_READABLE | FileState_WRITABLE, SLF_ALWAYS);
+
+    /* this removes the watch if its file was closed in the meantime */
+    _epollwatch_ref(watch);
+    _epoll_fileStatusChanged(epoll, &key);
+    if (!(watch->flags & EWF_CLOSED)) {
+        epoll->numSynced++;
+    }
+    _epollwatch_unref(watch);
 
-            if(watch->flags & EWF_EDGETRIGGER) {
-                /* tag that an event was collected in ET mode */
-                watch->flags |= EWF_EDGETRIGGER_REPORTED;
-            }
-            if(watch->flags & EWF_ONESHOT) {
-                /* they collected the event, dont report any more */
-                watch->flags |= EWF_ONESHOT_REPORTED;
-            }
+    return 0;
+}
 
-            /* record any that are no longer ready */
-            if (!_epollwatch_isReady(watch)) {
-                not_ready_list = g_list_append(not_ready_list, key);
-            }
-        } else {
-            error("epoll %p ready list has items that aren't ready", &epoll->super);
-        }
+static gboolean _epoll_removeUnsyncedWatch(gpointer key, gpointer value, gpointer data) {
+    EpollWatch* watch = value;
+    Epoll* epoll = data;
+    MAGIC_ASSERT(watch);
 
-        next_key = g_list_next(next_key);
+    if (watch->syncRound == epoll->syncRound) {
+        return FALSE;
     }
 
-    /* Cleanup just the list but not the list values, which are owned by the hash table. */
-    if (ready_list) {
-        g_list_free(ready_list);
+    /* the same as EPOLL_CTL_DEL */
+    watch->flags &= ~EWF_WATCHING;
+    statuslistener_setMonitorStatus(watch->listener, FileState_NONE, SLF_NEVER);
+    if (watch->watchType == EWT_LEGACY_FILE) {
+        legacyfile_removeListener(watch->watchObject.as_legacy_file, watch->listener);
+    } else if (watch->watchType == EWT_GENERIC_FILE) {
+        file_removeListener(watch->watchObject.as_file, watch->listener);
     }
+    g_tree_remove(epoll->ready, key);
 
-    *nEvents = eventIndex;
+    /* the hash table unrefs the watch as we return TRUE */
+    return TRUE;
+}
 
-    trace("epoll descriptor %p collected %i events", &epoll->super, eventIndex);
+void epoll_endWatchSync(Epoll* epoll) {
+    MAGIC_ASSERT(epoll);
 
-    next_key = NULL;
-    if (not_ready_list) {
-        next_key = g_list_first(not_ready_list);
+    /* every watch was synced unless there are more watches than that */
+    if (g_hash_table_size(epoll->watching) != epoll->numSynced) {
+        g_hash_table_foreach_remove(epoll->watching, _epoll_removeUnsyncedWatch, epoll);
     }
+    utility_debugAssert(g_hash_table_size(epoll->watching) == epoll->numSynced);
 
-    /* We modified some watched objects above, so remove any that are no longer ready. */
-    while (next_key != NULL) {
-        EpollKey* key = next_key->data;
-        gboolean removed = g_hash_table_remove(epoll->ready, key);
-        assert(removed);
+    /* check the status on the epoll itself now that its watches are up to date */
+    _epoll_fileStatusChanged(epoll, NULL);
+}
+
+static void _epollwatch_pauseListener(gpointer key, gpointer value, gpointer data) {
+    EpollWatch* watch = value;
+    MAGIC_ASSERT(watch);
+    statuslistener_setMonitorStatus(watch->listener, FileState_NONE, SLF_NEVER);
+}
 
-        next_key = g_list_next(next_key);
+void epoll_pauseWatches(Epoll* epoll) {
+    MAGIC_ASSERT(epoll);
+    g_hash_table_foreach(epoll->watching, _epollwatch_pauseListener, NULL);
+}
+
+guint epoll_getNumReadyEvents(Epoll* epoll) {
+    MAGIC_ASSERT(epoll);
+    return g_tree_nnodes(epoll->ready);
+}
+
+typedef struct _EpollCollectState EpollCollectState;
+struct _EpollCollectState {
+    Epoll* epoll;
+    struct epoll_event* eventArray;
+    gint eventArrayLength;
+    gint eventIndex;
+    /* keys of reported watches that are no longer ready, removed once the traversal is done;
+     * there's room for one per reported event */
+    gpointer* notReadyKeys;
+    gint numNotReadyKeys;
+};
+
+/* reports the event for one ready watch; returns TRUE to stop the traversal */
+static gboolean _epoll_collectEvent(gpointer key, gpointer value, gpointer data) {
+    EpollCollectState* state = data;
+    EpollWatch* watch = value;
+    MAGIC_ASSERT(watch);
+
+    if (state->eventIndex >= state->eventArrayLength) {
+        return TRUE;
     }
 
-    if (not_ready_list) {
-        g_list_free(not_ready_list);
+    if (_epollwatch_isReady(watch)) {
+        struct epoll_event* event = &state->eventArray[state->eventIndex];
+
+        /* report the event */
+        *event = watch->event;
+        event->events = 0;
+
+        if((watch->flags & EWF_READABLE) && (watch->flags & EWF_WAITINGREAD)) {
+            event->events |= EPOLLIN;
+        }
+        if((watch->flags & EWF_WRITEABLE) && (watch->flags & EWF_WAITINGWRITE)) {
+            event->events |= EPOLLOUT;
+        }
+
+        /* Record that we are reporting the event now. */
+        watch->last_reported_event_time = worker_getCurrentEmulatedTime();
+
+        /* event was just collected, unset the change status */
+        watch->flags &= ~EWF_READCHANGED;
+        watch->flags &= ~EWF_WRITECHANGED;
+
+        state->eventIndex++;
+        utility_debugAssert(state->eventIndex <= state->eventArrayLength);
+
+        if(watch->flags & EWF_EDGETRIGGER) {
+            /* tag that an event was collected in ET mode */
+            watch->flags |= EWF_EDGETRIGGER_REPORTED;
+        }
+        if(watch->flags & EWF_ONESHOT) {
+            /* they collected the event, dont report any more */
+            watch->flags |= EWF_ONESHOT_REPORTED;
+        }
+
+        /* record any that are no longer ready */
+        if (!_epollwatch_isReady(watch)) {
+            utility_debugAssert(state->numNotReadyKeys < state->eventIndex);
+            state->notReadyKeys[state->numNotReadyKeys++] = key;
+        }
+    } else {
+        error("epoll %p ready list has items that aren't ready", &state->epoll->super);
+    }
+
+    return FALSE;
+}
+
+gint epoll_getEvents(Epoll* epoll, struct epoll_event* eventArray, gint eventArrayLength, gint* nEvents) {
+    MAGIC_ASSERT(epoll);
+    utility_debugAssert(nEvents);
+
+    /* return the available events in the eventArray, making sure not to
+     * overflow. the number of actual events is returned in nEvents.
+     *
+     * The ready tree is ordered by key, so traversing it reports events in a deterministic order
+     * when the simulation is run multiple times. Collecting k events visits k nodes, and removing
+     * the ones that are no longer ready costs O(k log n). The keys to remove are only needed
+     * during this call, so they're allocated from the worker's round arena. */
+    gint maxEvents = MIN(eventArrayLength, g_tree_nnodes(epoll->ready));
+    EpollCollectState state = {
+        .epoll = epoll,
+        .eventArray = eventArray,
+        .eventArrayLength = eventArrayLength,
+        .eventIndex = 0,
+        .notReadyKeys = maxEvents > 0 ? worker_roundAlloc(maxEvents * sizeof(gpointer)) : NULL,
+        .numNotReadyKeys = 0,
+    };
+
+    g_tree_foreach(epoll->ready, _epoll_collectEvent, &state);
+
+    *nEvents = state.eventIndex;
+
+    trace("epoll descriptor %p collected %i events", &epoll->super, state.eventIndex);
+
+    /* We modified some watched objects above, so remove any that are no longer ready. The tree
+     * can't be modified while we traverse it, so we do it here. */
+    for (gint i = 0; i < state.numNotReadyKeys; i++) {
+        gboolean removed = g_tree_remove(epoll->ready, state.notReadyKeys[i]);
+        assert(removed);
     }
 
     /* if we consumed all the events that we had to report,
@@ -734,6 +877,63 @@ gint epoll_getEvents(Epoll* epoll, struct epoll_event* eventArray, gint eventArr
     return 0;
 }
 
+static void _epoll_processPendingWatchesTask(const Host* host, gpointer voidEpoll,
+                                             gpointer unused) {
+    Epoll* epoll = voidEpoll;
+    MAGIC_ASSERT(epoll);
+
+    epoll->processPendingIsScheduled = FALSE;
+
+    /* watches that change while we process these will be handled by the next task */
+    GPtrArray* pending = epoll->pendingWatches;
+    epoll->pendingWatches = g_ptr_array_new_with_free_func((GDestroyNotify)_epollwatch_unref);
+
+    trace("processing %u pending status changes on epoll %p", pending->len, &epoll->super);
+
+    /* if the epoll was closed in the meantime, we don't care */
+    gboolean isClosed = (legacyfile_getStatus(&epoll->super) & FileState_CLOSED) ? TRUE : FALSE;
+
+    for (guint i = 0; i < pending->len; i++) {
+        EpollWatch* watch = g_ptr_array_index(pending, i);
+        MAGIC_ASSERT(watch);
+        watch->statusPending = FALSE;
+
+        /* does nothing if the watch was removed since it changed */
+        if (!isClosed) {
+            _epoll_fileStatusChanged(epoll, &watch->key);
+        }
+    }
+
+    /* this unrefs the watches */
+    g_ptr_array_free(pending, TRUE);
+}
+
+/* called by a watch's status listener; defers handling the change so that a watch whose status
+ * flips several times before the task runs is only processed once */
+static void _epoll_watchStatusChanged(Epoll* epoll, const EpollKey* key) {
+    MAGIC_ASSERT(epoll);
+
+    EpollWatch* watch = g_hash_table_lookup(epoll->watching, key);
+    if (watch == NULL || watch->statusPending) {
+        return;
+    }
+
+    _epollwatch_ref(watch);
+    watch->statusPending = TRUE;
+    g_ptr_array_add(epoll->pendingWatches, watch);
+
+    if (!epoll->processPendingIsScheduled) {
+        const Host* host = worker_getCurrentHost();
+        legacyfile_ref(epoll);
+        TaskRef* task = taskref_new_bound(host_getID(host), _epoll_processPendingWatchesTask,
+                                          epoll, NULL, legacyfile_unref, NULL);
+        host_scheduleTaskWithDelay(host, task, 0); // Call without moving time forward
+        taskref_drop(task);
+
+        epoll->processPendingIsScheduled = TRUE;
+    }
+}
+
 static void _epoll_fileStatusChanged(Epoll* epoll, const EpollKey* key) {
     MAGIC_ASSERT(epoll);
 
@@ -749,22 +949,22 @@ static void _epoll_fileStatusChanged(Epoll* epoll, const EpollKey* key) {
 
             /* check if its ready (has an event to report) now */
             if (_epollwatch_isReady(watch)) {
-                if (!g_hash_table_contains(epoll->ready, key)) {
+                if (g_tree_lookup(epoll->ready, key) == NULL) {
                     _epollwatch_ref(watch);
-                    gpointer keyCopy = _epollkey_new(key->fd, key->objectPtr);
-                    g_hash_table_replace(epoll->ready, keyCopy, watch);
+                    g_tree_insert(epoll->ready, &watch->key, watch);
                 }
             } else {
-                /* this calls unref on the watch if its in the table */
-                g_hash_table_remove(epoll->ready, key);
+                /* this calls unref on the watch if its in the tree */
+                g_tree_remove(epoll->ready, key);
             }
 
             /* if it's closed, then remove it from the watching list */
             if (watch->flags & EWF_CLOSED) {
-                /* unref gets called on the watch when it is removed from these tables */
-                g_hash_table_remove(epoll->watching, key);
                 /* we should have removed it from the ready list earlier */
-                utility_debugAssert(!g_hash_table_contains(epoll->ready, key));
+                utility_debugAssert(g_tree_lookup(epoll->ready, key) == NULL);
+                /* unref gets called on the watch when it is removed from these tables. `key` may
+                 * belong to the watch, so don't use it after this. */
+                g_hash_table_remove(epoll->watching, key);
             }
         }
     }
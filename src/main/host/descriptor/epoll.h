@@ -29,4 +29,19 @@ guint epoll_getNumReadyEvents(Epoll* epoll);
 // After this call, the epoll instance should be "empty" but usable like new
 void epoll_reset(Epoll* epoll);
 
+// Syncing makes the epoll watch exactly the fds passed to epoll_syncWatch between
+// epoll_beginWatchSync and epoll_endWatchSync, while keeping the listeners of watches that stay
+// in the set attached. This lets callers that register (mostly) the same fds over and over, such
+// as poll, avoid tearing down and recreating every watch each time.
+void epoll_beginWatchSync(Epoll* epoll);
+// Adds a watch for fd, or updates the existing one with `event`. Returns -EEXIST if the watch was
+// already synced in this round, or the epoll_control error if a new watch could not be added.
+gint epoll_syncWatch(Epoll* epoll, int fd, const Descriptor* descriptor,
+                     const struct epoll_event* event, const Host* host);
+// Removes the watches that were not synced in this round.
+void epoll_endWatchSync(Epoll* epoll);
+// Stops the watch listeners from notifying the epoll, but leaves them attached to their files
+// so that the next sync can resume them cheaply. The epoll's events are stale until then.
+void epoll_pauseWatches(Epoll* epoll);
+
 #endif /* SHD_EPOLL_H_ */
@@ -56,6 +56,11 @@ impl Entry {
         self.collected = FileState::empty();
     }
 
+    /// Whether the entry was added with `EPOLLEXCLUSIVE`.
+    pub fn is_exclusive(&self) -> bool {
+        self.interest.contains(EpollEvents::EPOLLEXCLUSIVE)
+    }
+
     pub fn set_priority(&mut self, priority: Option<u64>) {
         self.priority = priority;
     }
@@ -14,7 +14,7 @@ use crate::host::memory_manager::MemoryManager;
 use crate::host::syscall::io::IoVec;
 use crate::host::syscall::types::SyscallError;
 use crate::utility::callback_queue::CallbackQueue;
-use crate::utility::{HostTreePointer, ObjectCounter};
+use crate::utility::{HostTreePointer, ObjectCounter, ObjectType};
 
 use self::entry::Entry;
 use self::key::{Key, PriorityKey};
@@ -54,7 +54,7 @@ impl Epoll {
             pri_counter: u64::MAX,
             monitoring: HashMap::new(),
             ready: BinaryHeap::new(),
-            _counter: ObjectCounter::new("Epoll"),
+            _counter: ObjectCounter::new(ObjectType::Epoll),
         };
 
         CallbackQueue::queue_and_run_with_legacy(|cb_queue| epoll.refresh_state(cb_queue));
@@ -192,6 +192,13 @@ impl Epoll {
             }
             EpollCtlOp::EPOLL_CTL_MOD => {
                 let entry = self.monitoring.get_mut(&key).ok_or(Errno::ENOENT)?;
+
+                // From epoll_ctl(2): Returns EINVAL when "op was EPOLL_CTL_MOD and the
+                // EPOLLEXCLUSIVE flag has previously been applied to this epfd, fd pair."
+                if entry.is_exclusive() {
+                    return Err(Errno::EINVAL);
+                }
+
                 entry.modify(events, data, state);
             }
             EpollCtlOp::EPOLL_CTL_DEL => {
@@ -276,8 +283,21 @@ impl Epoll {
     ) {
         let states_changed = self.state ^ old_state;
 
-        // If something changed, notify our listeners.
-        if !states_changed.is_empty() || !signals.is_empty() {
+        if states_changed == FileState::READABLE
+            && self.state.contains(FileState::READABLE)
+            && signals.is_empty()
+        {
+            // We have events to report. Threads blocked in `epoll_wait` are woken one at a time,
+            // like Linux does for waiters on an epoll instance, since only one of them would
+            // collect the events if they were all woken.
+            self.event_source.notify_listeners_exclusive(
+                self.state,
+                states_changed,
+                signals,
+                cb_queue,
+            );
+        } else if !states_changed.is_empty() || !signals.is_empty() {
+            // If something changed, notify our listeners.
             self.event_source
                 .notify_listeners(self.state, states_changed, signals, cb_queue);
         }
@@ -0,0 +1,245 @@
+/*
+ * The Shadow Simulator
+ * See LICENSE for licensing information
+ */
+
+#include "main/host/descriptor/file_cache.h"
+
+#include <errno.h>
+#include <glib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "lib/logger/logger.h"
+#include "main/utility/utility.h"
+
+/* Identifies a file independently of the path or fd it was opened with. */
+typedef struct _FileCacheKey {
+    dev_t dev;
+    ino_t ino;
+} FileCacheKey;
+
+struct _FileCacheEntry {
+    FileCacheKey key;
+    /* Used to detect whether the file changed since it was mapped. */
+    struct timespec mtime;
+    off_t size;
+    /* The mapped contents, or NULL if the file is empty. */
+    void* content;
+    /* Set once the file may have been truncated, after which the mapping must
+     * not be read; a read past the new end would raise SIGBUS. Readers hold
+     * the read lock while copying from the mapping, so that no copy is still in
+     * progress once the flag is set. */
+    GRWLock lock;
+    bool invalidated;
+    gint referenceCount;
+    MAGIC_DECLARE;
+};
+
+struct _FileCache {
+    GMutex lock;
+    /* Maps a FileCacheKey to the FileCacheEntry for the latest version of the
+     * file. The table holds a reference to each entry. */
+    GHashTable* entries;
+    MAGIC_DECLARE;
+};
+
+static guint _filecachekey_hash(gconstpointer p) {
+    const FileCacheKey* key = p;
+    return (guint)(key->ino ^ (key->ino >> 32) ^ key->dev);
+}
+
+static gboolean _filecachekey_equal(gconstpointer a, gconstpointer b) {
+    const FileCacheKey* ka = a;
+    const FileCacheKey* kb = b;
+    return ka->dev == kb->dev && ka->ino == kb->ino;
+}
+
+static void _filecacheentry_free(FileCacheEntry* entry) {
+    MAGIC_ASSERT(entry);
+
+    if (entry->content != NULL && munmap(entry->content, entry->size) != 0) {
+        warning("munmap of cached file failed: %s", strerror(errno));
+    }
+
+    g_rw_lock_clear(&entry->lock);
+
+    MAGIC_CLEAR(entry);
+    g_free(entry);
+}
+
+static FileCacheEntry* _filecacheentry_ref(FileCacheEntry* entry) {
+    MAGIC_ASSERT(entry);
+    g_atomic_int_inc(&entry->referenceCount);
+    return entry;
+}
+
+void filecacheentry_unref(FileCacheEntry* entry) {
+    MAGIC_ASSERT(entry);
+    if (g_atomic_int_dec_and_test(&entry->referenceCount)) {
+        _filecacheentry_free(entry);
+    }
+}
+
+static bool _filecacheentry_isCurrent(const FileCacheEntry* entry, const struct stat* st) {
+    return entry->size == st->st_size && entry->mtime.tv_sec == st->st_mtim.tv_sec &&
+           entry->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static FileCacheEntry* _filecacheentry_new(int fd, const struct stat* st) {
+    void* content = NULL;
+    if (st->st_size > 0) {
+        content = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (content == MAP_FAILED) {
+            trace("Not caching file with inode %lu, mmap failed: %s", (unsigned long)st->st_ino,
+                  strerror(errno));
+            return NULL;
+        }
+    }
+
+    FileCacheEntry* entry = g_new0(FileCacheEntry, 1);
+    MAGIC_INIT(entry);
+
+    entry->key = (FileCacheKey){.dev = st->st_dev, .ino = st->st_ino};
+    entry->mtime = st->st_mtim;
+    entry->size = st->st_size;
+    entry->content = content;
+    g_rw_lock_init(&entry->lock);
+    entry->invalidated = false;
+    entry->referenceCount = 1;
+
+    return entry;
+}
+
+ssize_t filecacheentry_read(FileCacheEntry* entry, int fd, void* buf, size_t bufSize,
+                            off_t offset) {
+    MAGIC_ASSERT(entry);
+    utility_debugAssert(offset >= 0);
+
+    g_rw_lock_reader_lock(&entry->lock);
+
+    if (entry->invalidated) {
+        g_rw_lock_reader_unlock(&entry->lock);
+        ssize_t result = pread(fd, buf, bufSize, offset);
+        return (result < 0) ? -errno : result;
+    }
+
+    size_t numBytes = 0;
+    if (offset < entry->size) {
+        numBytes = MIN(bufSize, (size_t)(entry->size - offset));
+        memcpy(buf, (const char*)entry->content + offset, numBytes);
+    }
+
+    g_rw_lock_reader_unlock(&entry->lock);
+
+    return (ssize_t)numBytes;
+}
+
+static void _filecacheentry_invalidate(FileCacheEntry* entry) {
+    MAGIC_ASSERT(entry);
+
+    /* Waits for any reads from the mapping to finish. */
+    g_rw_lock_writer_lock(&entry->lock);
+    entry->invalidated = true;
+    g_rw_lock_writer_unlock(&entry->lock);
+}
+
+off_t filecacheentry_getSize(const FileCacheEntry* entry) {
+    MAGIC_ASSERT(entry);
+    return entry->size;
+}
+
+FileCache* filecache_new() {
+    FileCache* cache = g_new0(FileCache, 1);
+    MAGIC_INIT(cache);
+
+    g_mutex_init(&cache->lock);
+    /* the key is owned by the entry */
+    cache->entries = g_hash_table_new_full(_filecachekey_hash, _filecachekey_equal, NULL,
+                                           (GDestroyNotify)filecacheentry_unref);
+
+    return cache;
+}
+
+void filecache_free(FileCache* cache) {
+    MAGIC_ASSERT(cache);
+
+    g_hash_table_destroy(cache->entries);
+    g_mutex_clear(&cache->lock);
+
+    MAGIC_CLEAR(cache);
+    g_free(cache);
+}
+
+FileCacheEntry* filecache_get(FileCache* cache, int fd) {
+    MAGIC_ASSERT(cache);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return NULL;
+    }
+
+    FileCacheKey key = {.dev = st.st_dev, .ino = st.st_ino};
+
+    g_mutex_lock(&cache->lock);
+
+    FileCacheEntry* entry = g_hash_table_lookup(cache->entries, &key);
+
+    if (entry == NULL || !_filecacheentry_isCurrent(entry, &st)) {
+        /* Readers of an old version keep their reference to it, but read the
+         * file itself from now on, since it changed and may have shrunk. */
+        if (entry != NULL) {
+            _filecacheentry_invalidate(entry);
+        }
+        entry = _filecacheentry_new(fd, &st);
+        if (entry == NULL) {
+            g_hash_table_remove(cache->entries, &key);
+            g_mutex_unlock(&cache->lock);
+            return NULL;
+        }
+        g_hash_table_replace(cache->entries, &entry->key, entry);
+    }
+
+    _filecacheentry_ref(entry);
+
+    g_mutex_unlock(&cache->lock);
+
+    return entry;
+}
+
+static void _filecache_invalidateStat(FileCache* cache, const struct stat* st) {
+    FileCacheKey key = {.dev = st->st_dev, .ino = st->st_ino};
+
+    g_mutex_lock(&cache->lock);
+
+    /* Only the entry in the table can still be valid, since replaced entries
+     * are invalidated. The next filecache_get() maps the file again. */
+    FileCacheEntry* entry = g_hash_table_lookup(cache->entries, &key);
+    if (entry != NULL) {
+        _filecacheentry_invalidate(entry);
+        g_hash_table_remove(cache->entries, &key);
+    }
+
+    g_mutex_unlock(&cache->lock);
+}
+
+void filecache_invalidate(FileCache* cache, int fd) {
+    MAGIC_ASSERT(cache);
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        _filecache_invalidateStat(cache, &st);
+    }
+}
+
+void filecache_invalidatePath(FileCache* cache, const char* path) {
+    MAGIC_ASSERT(cache);
+
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+        _filecache_invalidateStat(cache, &st);
+    }
+}
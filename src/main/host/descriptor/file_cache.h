@@ -0,0 +1,59 @@
+/*
+ * The Shadow Simulator
+ * See LICENSE for licensing information
+ */
+
+#ifndef SRC_MAIN_HOST_DESCRIPTOR_FILE_CACHE_H_
+#define SRC_MAIN_HOST_DESCRIPTOR_FILE_CACHE_H_
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/* A read-only cache of file contents that is shared by all hosts. Each cached
+ * file is memory-mapped once, so that reads from any host become copies from
+ * memory instead of syscalls on the os-backed file. The kernel pages the file
+ * in lazily, so only the parts of a file that are read take up memory.
+ *
+ * Files are identified by their device and inode, and an entry is replaced if
+ * the file's size or modification time changed since it was mapped. Reading a
+ * mapping past the end of a truncated file raises SIGBUS, so Shadow invalidates
+ * an entry before anything it handles could truncate the file, after which
+ * readers of the entry read their own fd instead. Other changes to a file while
+ * it's open through the cache may not be seen by its readers, so the cache
+ * should only be used for files that don't change during the simulation.
+ *
+ * All functions are thread-safe. */
+typedef struct _FileCache FileCache;
+
+/* A reference to the contents of a single cached file. */
+typedef struct _FileCacheEntry FileCacheEntry;
+
+FileCache* filecache_new();
+void filecache_free(FileCache* cache);
+
+/* Returns a new reference to the cached contents of the regular file open at
+ * `fd`, mapping the file if it isn't cached yet. Returns NULL if the file can't
+ * be cached, in which case it should be read using `fd` as usual. The
+ * reference must be released with filecacheentry_unref(). */
+FileCacheEntry* filecache_get(FileCache* cache, int fd);
+
+void filecacheentry_unref(FileCacheEntry* entry);
+
+/* Stops the cached contents of the regular file open at `fd` from being read,
+ * since the file is about to be written or truncated. */
+void filecache_invalidate(FileCache* cache, int fd);
+
+/* Like filecache_invalidate(), for the file at the absolute path `path`. */
+void filecache_invalidatePath(FileCache* cache, const char* path);
+
+/* Copies up to `bufSize` bytes at `offset` into `buf`, and returns the number
+ * of bytes copied. This is 0 if `offset` is at or past the end of the file. If
+ * the entry was invalidated, reads from `fd` (the reader's own fd for the file)
+ * instead, and returns a negative errno on failure. */
+ssize_t filecacheentry_read(FileCacheEntry* entry, int fd, void* buf, size_t bufSize,
+                            off_t offset);
+
+/* The size of the file when it was mapped. */
+off_t filecacheentry_getSize(const FileCacheEntry* entry);
+
+#endif /* SRC_MAIN_HOST_DESCRIPTOR_FILE_CACHE_H_ */
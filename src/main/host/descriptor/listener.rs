@@ -14,7 +14,7 @@ pub enum StateListenerFilter {
     Always,
 }
 
-/// A wrapper for a `*mut c::StatusListener` that increments its ref count when created,
+/// A wrapper for a `*mut c::StatusListener` that increments its ref count when created or cloned,
 /// and decrements when dropped.
 struct LegacyListener(HostTreePointer<c::StatusListener>);
 
@@ -26,6 +26,12 @@ impl LegacyListener {
     }
 }
 
+impl Clone for LegacyListener {
+    fn clone(&self) -> Self {
+        Self::new(self.0)
+    }
+}
+
 impl std::ops::Deref for LegacyListener {
     type Target = HostTreePointer<c::StatusListener>;
 
@@ -43,57 +49,120 @@ impl Drop for LegacyListener {
 /// [Handles](Handle) for [event source](StateEventSource) listeners.
 pub type StateListenHandle = Handle<(FileState, FileState, FileSignals)>;
 
-/// Stores event listener handles so that `c::StatusListener` objects can subscribe to events.
+/// Stores the `c::StatusListener` objects that subscribe to events. These are stored directly
+/// rather than as closures in the [`EventSource`], so adding a listener doesn't allocate a closure
+/// and a [`Handle`].
 struct LegacyListenerHelper {
-    // We expect only a small number of listeners at a time, which means that performance is
-    // generally better and memory usage is lower with a `Vec` than a `HashMap`. The `usize` is the
-    // pointer of the [`c::StatusListener`] that corresponds to this [`Handle`].
-    handles: Vec<(usize, StateListenHandle)>,
+    // We expect only a small number of listeners at a time (typically one or two), which means
+    // that performance is generally better and memory usage is lower with a `Vec` than a
+    // `HashMap`. Listeners are kept in the order they were added, and are notified in that order.
+    listeners: Vec<LegacyListener>,
+    /// The listener notified by the last exclusive notification, and the state and changed bits
+    /// that it was notified with, until that state turns off.
+    exclusive: Option<(LegacyListener, FileState, FileState)>,
 }
 
 impl LegacyListenerHelper {
     fn new() -> Self {
         Self {
-            handles: Vec::new(),
+            listeners: Vec::new(),
+            exclusive: None,
         }
     }
 
-    fn add_listener(
-        &mut self,
-        ptr: HostTreePointer<c::StatusListener>,
-        event_source: &mut EventSource<(FileState, FileState, FileSignals)>,
-    ) {
+    fn add_listener(&mut self, ptr: HostTreePointer<c::StatusListener>) {
         assert!(!unsafe { ptr.ptr() }.is_null());
 
         // if it's already listening, don't add a second time
-        if self
-            .handles
-            .iter()
-            .any(|x| x.0 == (unsafe { ptr.ptr() } as usize))
-        {
+        if self.position(unsafe { ptr.ptr() }).is_some() {
             return;
         }
 
-        // this will ref the pointer and unref it when the closure is dropped
-        let ptr_wrapper = LegacyListener::new(ptr);
-
-        let handle =
-            event_source.add_listener(move |(state, changed, _signals), _cb_queue| unsafe {
-                c::statuslistener_onStatusChanged(ptr_wrapper.ptr(), state, changed)
-            });
-
-        // use a usize as the key so we don't accidentally deref the pointer
-        self.handles.push((unsafe { ptr.ptr() } as usize, handle));
+        // this will ref the pointer and unref it when removed
+        self.listeners.push(LegacyListener::new(ptr));
     }
 
     fn remove_listener(&mut self, ptr: *mut c::StatusListener) {
         assert!(!ptr.is_null());
 
         // find the position and remove it
-        if let Some(x) = self.handles.iter().position(|x| x.0 == (ptr as usize)) {
-            // drop the handle
-            let _ = self.handles.remove(x);
+        if let Some(x) = self.position(ptr) {
+            // unref the listener
+            let _ = self.listeners.remove(x);
+        }
+
+        // If the listener was the one notified by an exclusive notification, it may stop listening
+        // without having handled the state (for example if its thread exited while the wakeup was
+        // pending), so pass the notification on to the next listener.
+        let was_exclusive = self
+            .exclusive
+            .as_ref()
+            .is_some_and(|(x, _, _)| std::ptr::eq(unsafe { x.ptr() }, ptr));
+        if was_exclusive {
+            let (_, state, changed) = self.exclusive.take().unwrap();
+            if let Some(next) = self.first_to_notify(state, changed) {
+                // there's no callback queue here, but legacy listeners only schedule a task when
+                // notified
+                unsafe { c::statuslistener_onStatusChanged(next.ptr(), state, changed) };
+                self.exclusive = Some((next, state, changed));
+            }
+        }
+    }
+
+    fn position(&self, ptr: *mut c::StatusListener) -> Option<usize> {
+        // compare the addresses so we don't accidentally deref the pointer
+        self.listeners
+            .iter()
+            .position(|x| std::ptr::eq(unsafe { x.ptr() }, ptr))
+    }
+
+    /// The first listener that would be notified of the change, if any.
+    fn first_to_notify(&self, state: FileState, changed: FileState) -> Option<LegacyListener> {
+        self.listeners
+            .iter()
+            .find(|x| unsafe { c::statuslistener_wouldNotify(x.ptr(), state, changed) })
+            .cloned()
+    }
+
+    fn notify_listeners(
+        &mut self,
+        state: FileState,
+        changed: FileState,
+        cb_queue: &mut CallbackQueue,
+    ) {
+        // the exclusive notification has been handled once its state turns off
+        if let Some((_, _, exclusive_changed)) = &self.exclusive {
+            if !state.intersects(*exclusive_changed) {
+                self.exclusive = None;
+            }
         }
+
+        for listener in &self.listeners {
+            // the listener stays alive until the callback runs, even if it's removed first
+            let listener = listener.clone();
+            cb_queue.add(move |_cb_queue| unsafe {
+                c::statuslistener_onStatusChanged(listener.ptr(), state, changed)
+            });
+        }
+    }
+
+    /// Notify only the first listener that would handle the change.
+    fn notify_one_listener(
+        &mut self,
+        state: FileState,
+        changed: FileState,
+        cb_queue: &mut CallbackQueue,
+    ) {
+        self.exclusive = None;
+
+        let Some(listener) = self.first_to_notify(state, changed) else {
+            return;
+        };
+        self.exclusive = Some((listener.clone(), state, changed));
+
+        cb_queue.add(move |_cb_queue| unsafe {
+            c::statuslistener_onStatusChanged(listener.ptr(), state, changed)
+        });
     }
 }
 
@@ -157,7 +226,7 @@ impl StateEventSource {
     }
 
     pub fn add_legacy_listener(&mut self, ptr: HostTreePointer<c::StatusListener>) {
-        self.legacy_helper.add_listener(ptr, &mut self.inner);
+        self.legacy_helper.add_listener(ptr);
     }
 
     pub fn remove_legacy_listener(&mut self, ptr: *mut c::StatusListener) {
@@ -171,8 +240,35 @@ impl StateEventSource {
         signals: FileSignals,
         cb_queue: &mut CallbackQueue,
     ) {
+        // the shim may be failing reads of this file without asking us
+        worker::Worker::with_active_host(|host| host.shim_shmem().file_state_changed());
+
+        self.inner
+            .notify_listeners((state, changed, signals), cb_queue);
+        self.legacy_helper
+            .notify_listeners(state, changed, cb_queue);
+    }
+
+    /// Like [`notify_listeners`](Self::notify_listeners), but only one legacy listener is
+    /// notified, like an exclusive waiter on a Linux wait queue. If that listener stops listening
+    /// before the state turns off again, the next legacy listener is notified. This should only be
+    /// used when `changed` bits have turned on.
+    pub fn notify_listeners_exclusive(
+        &mut self,
+        state: FileState,
+        changed: FileState,
+        signals: FileSignals,
+        cb_queue: &mut CallbackQueue,
+    ) {
+        debug_assert!(state.contains(changed));
+
+        // the shim may be failing reads of this file without asking us
+        worker::Worker::with_active_host(|host| host.shim_shmem().file_state_changed());
+
         self.inner
-            .notify_listeners((state, changed, signals), cb_queue)
+            .notify_listeners((state, changed, signals), cb_queue);
+        self.legacy_helper
+            .notify_one_listener(state, changed, cb_queue);
     }
 }
 
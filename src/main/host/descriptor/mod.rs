@@ -16,7 +16,7 @@ use crate::host::memory_manager::MemoryManager;
 use crate::host::syscall::io::IoVec;
 use crate::host::syscall::types::{SyscallError, SyscallResult};
 use crate::utility::callback_queue::CallbackQueue;
-use crate::utility::{HostTreePointer, IsSend, IsSync, ObjectCounter};
+use crate::utility::{HostTreePointer, IsSend, IsSync, ObjectCounter, ObjectType};
 
 pub mod descriptor_table;
 pub mod epoll;
@@ -409,7 +409,7 @@ impl OpenFile {
 
         Self {
             inner: Arc::new(OpenFileInner::new(file)),
-            _counter: ObjectCounter::new("OpenFile"),
+            _counter: ObjectCounter::new(ObjectType::OpenFile),
         }
     }
 
@@ -438,7 +438,7 @@ impl OpenFileInner {
     pub fn new(file: File) -> Self {
         Self {
             file: Some(file),
-            _counter: ObjectCounter::new("OpenFileInner"),
+            _counter: ObjectCounter::new(ObjectType::OpenFileInner),
         }
     }
 
@@ -481,7 +481,7 @@ impl Descriptor {
         Self {
             file,
             flags: DescriptorFlags::empty(),
-            _counter: ObjectCounter::new("Descriptor"),
+            _counter: ObjectCounter::new(ObjectType::Descriptor),
         }
     }
 
@@ -517,7 +517,7 @@ impl Descriptor {
         Self {
             file: self.file.clone(),
             flags,
-            _counter: ObjectCounter::new("Descriptor"),
+            _counter: ObjectCounter::new(ObjectType::Descriptor),
         }
     }
 
@@ -627,26 +627,39 @@ impl LegacyFileCounter {
     }
 
     /// Should drop `self` immediately after calling this.
-    fn close_helper(&mut self, host: &Host) {
+    fn close_helper(&mut self, host: &Host) -> Result<(), SyscallError> {
         // this isn't subject to race conditions since we should never access descriptors
         // from multiple threads at the same time
         if Arc::<()>::strong_count(&self.open_count) == 1 {
             if let Some(file) = self.file.take() {
+                // a regular file may have asynchronous writes that haven't completed, and
+                // their errors are returned by the close
+                let file_type = unsafe { c::legacyfile_getType(file.ptr()) };
+                let rv = if file_type == c::_LegacyFileType_DT_FILE {
+                    unsafe { c::regularfile_finishWrites(file.ptr() as *mut c::RegularFile) }
+                } else {
+                    0
+                };
                 unsafe { c::legacyfile_close(file.ptr(), host) }
+                if rv < 0 {
+                    return Err(linux_api::errno::Errno::try_from(-rv).unwrap().into());
+                }
             }
         }
+        Ok(())
     }
 
     /// Close the descriptor, and if this is the last descriptor pointing to its legacy file, close
     /// the legacy file as well.
-    pub fn close(mut self, host: &Host) {
-        self.close_helper(host);
+    pub fn close(mut self, host: &Host) -> Result<(), SyscallError> {
+        self.close_helper(host)
     }
 }
 
 impl std::ops::Drop for LegacyFileCounter {
     fn drop(&mut self) {
-        worker::Worker::with_active_host(|host| self.close_helper(host)).unwrap();
+        // there's no caller to return an error to
+        worker::Worker::with_active_host(|host| self.close_helper(host).ok()).unwrap();
     }
 }
 
@@ -666,10 +679,7 @@ impl CompatFile {
     ) -> Option<Result<(), SyscallError>> {
         match self {
             Self::New(file) => file.close(cb_queue),
-            Self::Legacy(file) => {
-                file.close(host);
-                Some(Ok(()))
-            }
+            Self::Legacy(file) => Some(file.close(host)),
         }
     }
 }
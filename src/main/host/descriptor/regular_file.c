@@ -7,6 +7,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <poll.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -24,8 +25,11 @@
 #include <unistd.h>
 
 #include "lib/logger/logger.h"
+#include "main/bindings/c/bindings.h"
 #include "main/core/worker.h"
 #include "main/host/descriptor/descriptor.h"
+#include "main/host/descriptor/file_cache.h"
+#include "main/host/descriptor/stat_cache.h"
 #include "main/host/syscall/kernel_types.h"
 #include "main/routing/dns.h"
 #include "main/utility/utility.h"
@@ -51,6 +55,18 @@ struct _RegularFile {
             mode_t modeAtOpen;
             /* The path of the file when it was opened. */
             char* absPathAtOpen;
+            /* The contents of the file in the shared file cache, or NULL if reads
+             * go to the os-backed file. */
+            FileCacheEntry* cached;
+            /* The file offset used instead of the os-backed file's offset if
+             * the file is cached. */
+            off_t cursor;
+            /* Makes writes to the os-backed file from a background thread, or
+             * NULL if writes are made directly. */
+            AsyncFileWriter* writer;
+            /* The os-backed file hasn't been opened yet, and will be opened
+             * at absPathAtOpen when the file is first used. */
+            bool openDeferred;
         } osfile;
         struct {
             off_t cursor;
@@ -101,7 +117,8 @@ static inline RegularFile* _regularfile_legacyFileToRegularFile(LegacyFile* desc
     return file;
 }
 
-static inline int _regularfile_getOSBackedFD(RegularFile* file) {
+/* Returns the os-backed fd without opening a deferred file. */
+static inline int _regularfile_getOpenedOSBackedFD(RegularFile* file) {
     MAGIC_ASSERT(file);
     if (file->type != FILE_TYPE_IN_MEMORY) {
         return file->osfile.fd;
@@ -113,14 +130,67 @@ static inline int _regularfile_getOSBackedFD(RegularFile* file) {
     }
 }
 
+static void _regularfile_openDeferredNow(RegularFile* file);
+
+static inline int _regularfile_getOSBackedFD(RegularFile* file) {
+    MAGIC_ASSERT(file);
+    if (file->type != FILE_TYPE_IN_MEMORY && file->osfile.openDeferred) {
+        _regularfile_openDeferredNow(file);
+    }
+    return _regularfile_getOpenedOSBackedFD(file);
+}
+
 static inline bool _fd_isValid(int fd) { return fd >= 0; }
 
-int regularfile_getOSBackedFD(RegularFile* file) { return _regularfile_getOSBackedFD(file); }
+/* Wait for any asynchronous writes to the os-backed file to complete before
+ * using it directly. This includes writes made through other descriptors and
+ * processes. A write error is still returned by the next write, fsync or close
+ * of the file that made it. */
+static inline void _regularfile_waitForWrites(RegularFile* file) {
+    if (worker_useAsyncFileWrites() && file->type != FILE_TYPE_IN_MEMORY &&
+        _fd_isValid(file->osfile.fd)) {
+        asyncfilewriter_waitForFd(file->osfile.fd);
+    }
+}
+
+/* Wait for any asynchronous writes to the file at the path to complete before
+ * looking it up. */
+static inline void _regularfile_waitForPathWrites(int osDirFd, const char* pathname, int flags) {
+    if (worker_useAsyncFileWrites()) {
+        asyncfilewriter_waitForPath(osDirFd, pathname, flags);
+    }
+}
+
+int regularfile_finishWrites(RegularFile* file) {
+    MAGIC_ASSERT(file);
+    if (file->type == FILE_TYPE_IN_MEMORY || file->osfile.writer == NULL) {
+        return 0;
+    }
+    asyncfilewriter_wait(file->osfile.writer);
+    return -asyncfilewriter_takeError(file->osfile.writer);
+}
+
+int regularfile_getOSBackedFD(RegularFile* file) {
+    // the caller may use the fd directly
+    _regularfile_waitForWrites(file);
+    return _regularfile_getOSBackedFD(file);
+}
 
 static void _regularfile_closeHelper(RegularFile* file) {
     if(file && file->type != FILE_TYPE_IN_MEMORY) {
+        if (file->osfile.openDeferred) {
+            /* It was never used, so there's no need to create it. */
+            file->osfile.openDeferred = false;
+            legacyfile_adjustStatus(&file->super, FileState_ACTIVE, FALSE, 0);
+        }
+        if (file->osfile.writer != NULL) {
+            /* Waits for the queued writes, which need the os-backed file. */
+            asyncfilewriter_free(file->osfile.writer);
+            file->osfile.writer = NULL;
+        }
         if (file && _fd_isValid(file->osfile.fd)) {
-            trace("On file %p, closing os-backed file %i", file, _regularfile_getOSBackedFD(file));
+            trace("On file %p, closing os-backed file %i", file,
+                  _regularfile_getOpenedOSBackedFD(file));
 
             close(file->osfile.fd);
             file->osfile.fd = OSFILE_INVALID;
@@ -128,13 +198,17 @@ static void _regularfile_closeHelper(RegularFile* file) {
             /* The os-backed file is no longer ready. */
             legacyfile_adjustStatus(&file->super, FileState_ACTIVE, FALSE, 0);
         }
+        if (file->osfile.cached != NULL) {
+            filecacheentry_unref(file->osfile.cached);
+            file->osfile.cached = NULL;
+        }
     }
 }
 
 static void _regularfile_close(LegacyFile* desc, const Host* host) {
     RegularFile* file = _regularfile_legacyFileToRegularFile(desc);
 
-    trace("Closing file %p with os-backed file %i", file, _regularfile_getOSBackedFD(file));
+    trace("Closing file %p with os-backed file %i", file, _regularfile_getOpenedOSBackedFD(file));
 
     /* Make sure we mimic the close on the OS-backed file now. */
     _regularfile_closeHelper(file);
@@ -143,7 +217,7 @@ static void _regularfile_close(LegacyFile* desc, const Host* host) {
 static void _regularfile_free(LegacyFile* desc) {
     RegularFile* file = _regularfile_legacyFileToRegularFile(desc);
 
-    trace("Freeing file %p with os-backed file %i", file, _regularfile_getOSBackedFD(file));
+    trace("Freeing file %p with os-backed file %i", file, _regularfile_getOpenedOSBackedFD(file));
 
     _regularfile_closeHelper(file);
 
@@ -159,7 +233,7 @@ static void _regularfile_free(LegacyFile* desc) {
     MAGIC_CLEAR(file);
     free(file);
 
-    worker_count_deallocation(RegularFile);
+    worker_count_deallocation(REGULAR_FILE);
 }
 
 static LegacyFileFunctionTable _fileFunctions = (LegacyFileFunctionTable){
@@ -177,7 +251,7 @@ RegularFile* regularfile_new() {
     MAGIC_INIT(file);
     file->osfile.fd = OSFILE_INVALID; // negative means uninitialized (0 is a valid fd)
 
-    worker_count_allocation(RegularFile);
+    worker_count_allocation(REGULAR_FILE);
     return file;
 }
 
@@ -212,6 +286,67 @@ static char* _regularfile_getAbsolutePath(RegularFile* dir, const char* pathname
     return abspath;
 }
 
+/* Returns the absolute path that a lookup of pathname relative to dir refers
+ * to, or NULL if it isn't known (dir's path at open is unknown). The caller
+ * must free the returned path. */
+static char* _regularfile_getLookupPath(RegularFile* dir, const char* pathname,
+                                        const char* workingDir) {
+    if (pathname[0] != '/' && dir &&
+        (dir->type == FILE_TYPE_IN_MEMORY || !dir->osfile.absPathAtOpen)) {
+        return NULL;
+    }
+    return _regularfile_getAbsolutePath(dir, pathname, workingDir);
+}
+
+/* The current host caches lookups of paths that don't exist, for
+ * `experimental.use_missing_path_cache`. Only ENOENT results are cached,
+ * since a path that exists has to be opened or stat'ed anyway. Since entries
+ * are only ever for missing paths, the cache only needs to be cleared when a
+ * path may have been created, not when one is unlinked. */
+static bool _regularfile_usesMissingPathCache() {
+    const Host* host = worker_getCurrentHost();
+    return host && host_usesMissingPathCache(host);
+}
+
+static bool _regularfile_isMissingPath(const char* abspath) {
+    if (!_regularfile_usesMissingPathCache() ||
+        !host_isMissingPath(worker_getCurrentHost(), abspath)) {
+        return false;
+    }
+    trace("Path '%s' is in the missing path cache", abspath);
+    return true;
+}
+
+static void _regularfile_addMissingPath(const char* abspath) {
+    if (_regularfile_usesMissingPathCache()) {
+        host_addMissingPath(worker_getCurrentHost(), abspath);
+    }
+}
+
+static void _regularfile_clearMissingPaths() {
+    if (_regularfile_usesMissingPathCache()) {
+        host_clearMissingPaths(worker_getCurrentHost());
+    }
+}
+
+/* Returns the absolute path of a lookup of pathname relative to dir if its
+ * result can be stored in the shared stat cache, or NULL if it can't. The
+ * caller must free the returned path. */
+static char* _regularfile_getStatCachePath(RegularFile* dir, const char* pathname,
+                                           const char* workingDir) {
+    StatCache* cache = worker_getStatCache();
+    if (cache == NULL || pathname[0] == '\0') {
+        return NULL;
+    }
+
+    char* path = _regularfile_getLookupPath(dir, pathname, workingDir);
+    if (path && !statcache_isCacheable(cache, path)) {
+        free(path);
+        return NULL;
+    }
+    return path;
+}
+
 #ifdef DEBUG
 #define CHECK_FLAG(flag)                                                                           \
     if (flags & flag) {                                                                            \
@@ -274,6 +409,49 @@ int _regularfile_initRoInMemoryFile(RegularFile* file, int flags, mode_t mode, s
     return 0;
 }
 
+/* An open with O_TRUNC truncates the file itself, so its cached contents must
+ * stop being read before then. */
+static void _regularfile_invalidateCacheBeforeOpen(const char* abspath, int flags) {
+    FileCache* cache = worker_getFileCache();
+    if (cache != NULL && (flags & O_TRUNC)) {
+        filecache_invalidatePath(cache, abspath);
+    }
+}
+
+/* Set up the caching and asynchronous writing (if enabled) of a newly opened os-backed file. */
+static void _regularfile_initOSBackedFile(RegularFile* file) {
+    int osfd = file->osfile.fd;
+    int flags = file->osfile.flagsAtOpen;
+
+    FileCache* cache = worker_getFileCache();
+
+    /* Readers of a file that's open for writing can't keep using its mapping,
+     * since it may be truncated through this file. */
+    if (cache != NULL && (flags & O_ACCMODE) != O_RDONLY && !(flags & O_PATH)) {
+        filecache_invalidate(cache, osfd);
+    }
+
+    /* Files that are only open for reading can be read from the shared file
+     * cache, if it's enabled. */
+    if (cache != NULL && (flags & O_ACCMODE) == O_RDONLY && !(flags & (O_PATH | O_DIRECTORY))) {
+        file->osfile.cached = filecache_get(cache, osfd);
+        file->osfile.cursor = 0;
+        if (file->osfile.cached != NULL) {
+            trace("RegularFile %p will read os-backed file %i from the file cache", file, osfd);
+        }
+    }
+
+    /* Writes to regular files can be made asynchronously, if enabled. Writes to
+     * files opened for synchronous I/O must complete before they return. */
+    if (worker_useAsyncFileWrites() && (flags & O_ACCMODE) != O_RDONLY &&
+        !(flags & (O_PATH | O_DIRECT | O_SYNC | O_DSYNC))) {
+        struct stat st;
+        if (fstat(osfd, &st) == 0 && S_ISREG(st.st_mode)) {
+            file->osfile.writer = asyncfilewriter_new(osfd, st.st_dev, st.st_ino);
+        }
+    }
+}
+
 int regularfile_openat(RegularFile* file, RegularFile* dir, const char* pathname, int flags,
                        mode_t mode, const char* workingDir) {
     MAGIC_ASSERT(file);
@@ -329,6 +507,20 @@ int regularfile_openat(RegularFile* file, RegularFile* dir, const char* pathname
     // we should always use O_CLOEXEC for files opened in shadow
     flags |= O_CLOEXEC;
 
+    /* An open that creates the file can't fail with ENOENT because of the last
+     * component, and with O_NOFOLLOW a dangling symlink fails with ELOOP
+     * instead, so only cache the results of other opens. */
+    bool cacheMissing = !(flags & (O_CREAT | O_NOFOLLOW)) && (flags & O_TMPFILE) != O_TMPFILE;
+
+    if (cacheMissing && _regularfile_isMissingPath(abspath)) {
+        free(abspath);
+        file->type = FILE_TYPE_NOTSET;
+        return -ENOENT;
+    }
+
+    _regularfile_invalidateCacheBeforeOpen(abspath, flags);
+    _regularfile_waitForPathWrites(AT_FDCWD, abspath, 0);
+
     // TODO: we should open the os-backed file in non-blocking mode even if a
     // non-block is not requested, and then properly handle the io by, e.g.,
     // epolling on all such files with a shadow support thread.
@@ -338,6 +530,9 @@ int regularfile_openat(RegularFile* file, RegularFile* dir, const char* pathname
     if (osfd < 0) {
         trace("RegularFile %p opening path '%s' returned %i: %s", file, abspath, osfd,
               strerror(errcode));
+        if (cacheMissing && errcode == ENOENT) {
+            _regularfile_addMissingPath(abspath);
+        }
         if (abspath) {
             free(abspath);
         }
@@ -345,6 +540,10 @@ int regularfile_openat(RegularFile* file, RegularFile* dir, const char* pathname
         return -errcode;
     }
 
+    if (flags & (O_CREAT | O_TMPFILE)) {
+        _regularfile_clearMissingPaths();
+    }
+
     /* Store the create information, which is used if we mmap the file later. */
     file->osfile.fd = osfd;
     file->osfile.absPathAtOpen = abspath;
@@ -354,6 +553,8 @@ int regularfile_openat(RegularFile* file, RegularFile* dir, const char* pathname
     trace("RegularFile %p opened os-backed file %i at absolute path %s", file,
           _regularfile_getOSBackedFD(file), file->osfile.absPathAtOpen);
 
+    _regularfile_initOSBackedFile(file);
+
     /* The os-backed file is now ready. */
     legacyfile_adjustStatus(&file->super, FileState_ACTIVE, TRUE, 0);
 
@@ -365,6 +566,47 @@ int regularfile_open(RegularFile* file, const char* pathname, int flags, mode_t
     return regularfile_openat(file, NULL, pathname, flags, mode, workingDir);
 }
 
+void regularfile_openDeferred(RegularFile* file, const char* pathname, int flags, mode_t mode,
+                              const char* workingDir) {
+    MAGIC_ASSERT(file);
+    utility_debugAssert(file->type == FILE_TYPE_NOTSET && file->osfile.fd == OSFILE_INVALID);
+
+    file->type = FILE_TYPE_REGULAR;
+    file->shadowFlags = flags & SHADOW_FLAG_MASK;
+    file->osfile.absPathAtOpen = _regularfile_getAbsolutePath(NULL, pathname, workingDir);
+    file->osfile.flagsAtOpen = (flags & ~SHADOW_FLAG_MASK) | O_CLOEXEC;
+    file->osfile.modeAtOpen = mode;
+    file->osfile.openDeferred = true;
+
+    trace("RegularFile %p will open os-backed file at absolute path %s when first used", file,
+          file->osfile.absPathAtOpen);
+
+    /* The file can be used as if it were open. */
+    legacyfile_adjustStatus(&file->super, FileState_ACTIVE, TRUE, 0);
+}
+
+static void _regularfile_openDeferredNow(RegularFile* file) {
+    utility_debugAssert(file->osfile.openDeferred && file->osfile.fd == OSFILE_INVALID);
+    file->osfile.openDeferred = false;
+
+    _regularfile_invalidateCacheBeforeOpen(file->osfile.absPathAtOpen, file->osfile.flagsAtOpen);
+    _regularfile_waitForPathWrites(AT_FDCWD, file->osfile.absPathAtOpen, 0);
+
+    int osfd = open(file->osfile.absPathAtOpen, file->osfile.flagsAtOpen, file->osfile.modeAtOpen);
+    if (osfd < 0) {
+        warning("RegularFile %p could not open deferred os-backed file at path '%s': %s", file,
+                file->osfile.absPathAtOpen, strerror(errno));
+        return;
+    }
+
+    file->osfile.fd = osfd;
+
+    trace("RegularFile %p opened deferred os-backed file %i at absolute path %s", file, osfd,
+          file->osfile.absPathAtOpen);
+
+    _regularfile_initOSBackedFile(file);
+}
+
 static void _regularfile_readRandomBytes(RegularFile* file, const Host* host, void* buf,
                                          size_t numBytes) {
     utility_debugAssert(file->type == FILE_TYPE_RANDOM);
@@ -387,6 +629,31 @@ static size_t _regularfile_readvRandomBytes(RegularFile* file, const Host* host,
     return total;
 }
 
+static ssize_t _regularfile_readvCached(RegularFile* file, const struct iovec* iov, int iovcnt,
+                                        off_t offset) {
+    utility_debugAssert(file->osfile.cached != NULL);
+
+    if (offset < 0 || iovcnt < 0) {
+        return -EINVAL;
+    }
+
+    int osfd = _regularfile_getOSBackedFD(file);
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        ssize_t numBytes = filecacheentry_read(file->osfile.cached, osfd, iov[i].iov_base,
+                                               iov[i].iov_len, offset);
+        if (numBytes < 0) {
+            return (total > 0) ? (ssize_t)total : numBytes;
+        }
+        offset += numBytes;
+        total += numBytes;
+        if ((size_t)numBytes < iov[i].iov_len) {
+            break;
+        }
+    }
+    return (ssize_t)total;
+}
+
 ssize_t regularfile_read(RegularFile* file, const Host* host, void* buf, size_t bufSize) {
     MAGIC_ASSERT(file);
 
@@ -405,6 +672,18 @@ ssize_t regularfile_read(RegularFile* file, const Host* host, void* buf, size_t
         return -EBADF;
     }
 
+    _regularfile_waitForWrites(file);
+
+    if (file->osfile.cached != NULL) {
+        ssize_t numBytes = filecacheentry_read(file->osfile.cached,
+                                               _regularfile_getOSBackedFD(file), buf, bufSize,
+                                               file->osfile.cursor);
+        if (numBytes > 0) {
+            file->osfile.cursor += numBytes;
+        }
+        return numBytes;
+    }
+
     trace("RegularFile %p will read %zu bytes from os-backed file %i at path '%s'", file, bufSize,
           _regularfile_getOSBackedFD(file), file->osfile.absPathAtOpen);
 
@@ -435,6 +714,16 @@ ssize_t regularfile_pread(RegularFile* file, const Host* host, void* buf, size_t
         return -EBADF;
     }
 
+    _regularfile_waitForWrites(file);
+
+    if (file->osfile.cached != NULL) {
+        if (offset < 0) {
+            return -EINVAL;
+        }
+        return filecacheentry_read(
+            file->osfile.cached, _regularfile_getOSBackedFD(file), buf, bufSize, offset);
+    }
+
     trace("RegularFile %p will pread %zu bytes from os-backed file %i offset %ld at path '%s'",
           file, bufSize, _regularfile_getOSBackedFD(file), offset, file->osfile.absPathAtOpen);
 
@@ -487,6 +776,12 @@ ssize_t regularfile_preadv(RegularFile* file, const Host* host, const struct iov
         return -EBADF;
     }
 
+    _regularfile_waitForWrites(file);
+
+    if (file->osfile.cached != NULL) {
+        return _regularfile_readvCached(file, iov, iovcnt, offset);
+    }
+
     trace("RegularFile %p will preadv %d vector items from os-backed file %i at path '%s'", file,
           iovcnt, _regularfile_getOSBackedFD(file), file->osfile.absPathAtOpen);
 
@@ -514,6 +809,21 @@ ssize_t regularfile_preadv2(RegularFile* file, const Host* host, const struct io
         return -EBADF;
     }
 
+    _regularfile_waitForWrites(file);
+
+    if (file->osfile.cached != NULL) {
+        // an offset of -1 means to use and update the current file offset
+        if (offset == -1) {
+            ssize_t result = _regularfile_readvCached(file, iov, iovcnt, file->osfile.cursor);
+            if (result > 0) {
+                file->osfile.cursor += result;
+            }
+            return result;
+        }
+        // the flags are hints for blocking reads, which cached reads never are
+        return _regularfile_readvCached(file, iov, iovcnt, offset);
+    }
+
     trace("RegularFile %p will preadv2 %d vector items from os-backed file %i at path '%s'", file,
           iovcnt, _regularfile_getOSBackedFD(file), file->osfile.absPathAtOpen);
 
@@ -525,6 +835,49 @@ ssize_t regularfile_preadv2(RegularFile* file, const Host* host, const struct io
 }
 #endif
 
+/* Queue the write and return the number of bytes it will write, or an error
+ * from a previous asynchronous write. */
+static ssize_t _regularfile_writeAsync(RegularFile* file, const void* buf, size_t bufSize,
+                                       off_t offset) {
+    utility_debugAssert(file->osfile.writer != NULL);
+
+    int err = asyncfilewriter_takeError(file->osfile.writer);
+    if (err != 0) {
+        return -err;
+    }
+
+    trace("RegularFile %p will asynchronously write %zu bytes to os-backed file %i offset %ld",
+          file, bufSize, _regularfile_getOSBackedFD(file), offset);
+
+    asyncfilewriter_write(file->osfile.writer, buf, bufSize, offset);
+    return (ssize_t)bufSize;
+}
+
+static ssize_t _regularfile_writevAsync(RegularFile* file, const struct iovec* iov, int iovcnt,
+                                        off_t offset) {
+    utility_debugAssert(file->osfile.writer != NULL);
+
+    if (iovcnt < 0 || iovcnt > IOV_MAX) {
+        return -EINVAL;
+    }
+
+    int err = asyncfilewriter_takeError(file->osfile.writer);
+    if (err != 0) {
+        return -err;
+    }
+
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+
+    trace("RegularFile %p will asynchronously write %zu bytes to os-backed file %i offset %ld",
+          file, total, _regularfile_getOSBackedFD(file), offset);
+
+    asyncfilewriter_writev(file->osfile.writer, iov, iovcnt, offset);
+    return (ssize_t)total;
+}
+
 ssize_t regularfile_write(RegularFile* file, const void* buf, size_t bufSize) {
     MAGIC_ASSERT(file);
 
@@ -536,6 +889,10 @@ ssize_t regularfile_write(RegularFile* file, const void* buf, size_t bufSize) {
         return -EBADF;
     }
 
+    if (file->osfile.writer != NULL) {
+        return _regularfile_writeAsync(file, buf, bufSize, -1);
+    }
+
     trace("RegularFile %p will write %zu bytes to os-backed file %i at path '%s'", file, bufSize,
           _regularfile_getOSBackedFD(file), file->osfile.absPathAtOpen);
 
@@ -556,6 +913,13 @@ ssize_t regularfile_pwrite(RegularFile* file, const void* buf, size_t bufSize, o
         return -EBADF;
     }
 
+    if (file->osfile.writer != NULL) {
+        if (offset < 0) {
+            return -EINVAL;
+        }
+        return _regularfile_writeAsync(file, buf, bufSize, offset);
+    }
+
     trace("RegularFile %p will pwrite %zu bytes to os-backed file %i offset %ld at path '%s'", file,
           bufSize, _regularfile_getOSBackedFD(file), offset, file->osfile.absPathAtOpen);
 
@@ -576,6 +940,13 @@ ssize_t regularfile_pwritev(RegularFile* file, const struct iovec* iov, int iovc
         return -EBADF;
     }
 
+    if (file->osfile.writer != NULL) {
+        if (offset < 0) {
+            return -EINVAL;
+        }
+        return _regularfile_writevAsync(file, iov, iovcnt, offset);
+    }
+
     trace("RegularFile %p will pwritev %d vector items from os-backed file %i at path '%s'", file,
           iovcnt, _regularfile_getOSBackedFD(file), file->osfile.absPathAtOpen);
 
@@ -598,6 +969,15 @@ ssize_t regularfile_pwritev2(RegularFile* file, const struct iovec* iov, int iov
         return -EBADF;
     }
 
+    if (file->osfile.writer != NULL) {
+        /* An offset of -1 means to use the current file offset. The flags
+         * change how the write is made, so those writes are made directly. */
+        if (flags == 0 && offset >= -1) {
+            return _regularfile_writevAsync(file, iov, iovcnt, offset);
+        }
+        _regularfile_waitForWrites(file);
+    }
+
     trace("RegularFile %p will pwritev2 %d vector items from os-backed file %i at path '%s'", file,
           iovcnt, _regularfile_getOSBackedFD(file), file->osfile.absPathAtOpen);
 
@@ -616,6 +996,8 @@ int regularfile_fstat(RegularFile* file, struct stat* statbuf) {
         return -EBADF;
     }
 
+    _regularfile_waitForWrites(file);
+
     trace("RegularFile %p fstat os-backed file %i", file, _regularfile_getOSBackedFD(file));
 
     int result = fstat(_regularfile_getOSBackedFD(file), statbuf);
@@ -629,6 +1011,8 @@ int regularfile_fstatfs(RegularFile* file, struct statfs* statbuf) {
         return -EBADF;
     }
 
+    _regularfile_waitForWrites(file);
+
     trace("RegularFile %p fstatfs os-backed file %i", file, _regularfile_getOSBackedFD(file));
 
     int result = fstatfs(_regularfile_getOSBackedFD(file), statbuf);
@@ -644,6 +1028,13 @@ int regularfile_fsync(RegularFile* file) {
 
     trace("RegularFile %p fsync os-backed file %i", file, _regularfile_getOSBackedFD(file));
 
+    /* The queued writes must be on disk when the fsync returns, and any of
+     * them that failed is reported by it. */
+    if (file->osfile.writer != NULL) {
+        asyncfilewriter_fsync(file->osfile.writer);
+        return regularfile_finishWrites(file);
+    }
+
     int result = fsync(_regularfile_getOSBackedFD(file));
     return (result < 0) ? -errno : result;
 }
@@ -655,6 +1046,8 @@ int regularfile_fchown(RegularFile* file, uid_t owner, gid_t group) {
         return -EBADF;
     }
 
+    _regularfile_waitForWrites(file);
+
     trace("RegularFile %p fchown os-backed file %i", file, _regularfile_getOSBackedFD(file));
 
     int result = fchown(_regularfile_getOSBackedFD(file), owner, group);
@@ -668,6 +1061,8 @@ int regularfile_fchmod(RegularFile* file, mode_t mode) {
         return -EBADF;
     }
 
+    _regularfile_waitForWrites(file);
+
     trace("RegularFile %p fchmod os-backed file %i", file, _regularfile_getOSBackedFD(file));
 
     int result = fchmod(_regularfile_getOSBackedFD(file), mode);
@@ -681,8 +1076,14 @@ int regularfile_ftruncate(RegularFile* file, off_t length) {
         return -EBADF;
     }
 
+    _regularfile_waitForWrites(file);
+
     trace("RegularFile %p ftruncate os-backed file %i", file, _regularfile_getOSBackedFD(file));
 
+    if (worker_getFileCache() != NULL) {
+        filecache_invalidate(worker_getFileCache(), _regularfile_getOSBackedFD(file));
+    }
+
     int result = ftruncate(_regularfile_getOSBackedFD(file), length);
     return (result < 0) ? -errno : result;
 }
@@ -694,8 +1095,14 @@ int regularfile_fallocate(RegularFile* file, int mode, off_t offset, off_t lengt
         return -EBADF;
     }
 
+    _regularfile_waitForWrites(file);
+
     trace("RegularFile %p fallocate os-backed file %i", file, _regularfile_getOSBackedFD(file));
 
+    if (worker_getFileCache() != NULL) {
+        filecache_invalidate(worker_getFileCache(), _regularfile_getOSBackedFD(file));
+    }
+
     int result = fallocate(_regularfile_getOSBackedFD(file), mode, offset, length);
     return (result < 0) ? -errno : result;
 }
@@ -707,6 +1114,8 @@ int regularfile_fadvise(RegularFile* file, off_t offset, off_t len, int advice)
         return -EBADF;
     }
 
+    _regularfile_waitForWrites(file);
+
     trace("RegularFile %p fadvise os-backed file %i", file, _regularfile_getOSBackedFD(file));
 
     int result = posix_fadvise(_regularfile_getOSBackedFD(file), offset, len, advice);
@@ -720,6 +1129,8 @@ int regularfile_flock(RegularFile* file, int operation) {
         return -EBADF;
     }
 
+    _regularfile_waitForWrites(file);
+
     trace("RegularFile %p flock os-backed file %i", file, _regularfile_getOSBackedFD(file));
 
     int result = flock(_regularfile_getOSBackedFD(file), operation);
@@ -734,6 +1145,8 @@ int regularfile_fsetxattr(RegularFile* file, const char* name, const void* value
         return -EBADF;
     }
 
+    _regularfile_waitForWrites(file);
+
     trace("RegularFile %p fsetxattr os-backed file %i", file, _regularfile_getOSBackedFD(file));
 
     int result = fsetxattr(_regularfile_getOSBackedFD(file), name, value, size, flags);
@@ -747,6 +1160,8 @@ ssize_t regularfile_fgetxattr(RegularFile* file, const char* name, void* value,
         return -EBADF;
     }
 
+    _regularfile_waitForWrites(file);
+
     trace("RegularFile %p fgetxattr os-backed file %i", file, _regularfile_getOSBackedFD(file));
 
     ssize_t result = fgetxattr(_regularfile_getOSBackedFD(file), name, value, size);
@@ -760,6 +1175,8 @@ ssize_t regularfile_flistxattr(RegularFile* file, char* list, size_t size) {
         return -EBADF;
     }
 
+    _regularfile_waitForWrites(file);
+
     trace("RegularFile %p flistxattr os-backed file %i", file, _regularfile_getOSBackedFD(file));
 
     ssize_t result = flistxattr(_regularfile_getOSBackedFD(file), list, size);
@@ -773,6 +1190,8 @@ int regularfile_fremovexattr(RegularFile* file, const char* name) {
         return -EBADF;
     }
 
+    _regularfile_waitForWrites(file);
+
     trace("RegularFile %p fremovexattr os-backed file %i", file, _regularfile_getOSBackedFD(file));
 
     int result = fremovexattr(_regularfile_getOSBackedFD(file), name);
@@ -786,6 +1205,8 @@ int regularfile_sync_range(RegularFile* file, off64_t offset, off64_t nbytes, un
         return -EBADF;
     }
 
+    _regularfile_waitForWrites(file);
+
     trace(
         "RegularFile %p sync_file_range os-backed file %i", file, _regularfile_getOSBackedFD(file));
 
@@ -801,6 +1222,8 @@ ssize_t regularfile_readahead(RegularFile* file, off64_t offset, size_t count) {
         return -EBADF;
     }
 
+    _regularfile_waitForWrites(file);
+
     trace("RegularFile %p readahead os-backed file %i", file, _regularfile_getOSBackedFD(file));
 
     ssize_t result = readahead(_regularfile_getOSBackedFD(file), offset, count);
@@ -814,9 +1237,22 @@ off_t regularfile_lseek(RegularFile* file, off_t offset, int whence) {
         return -EBADF;
     }
 
+    _regularfile_waitForWrites(file);
+
     trace("RegularFile %p lseek os-backed file %i", file, _regularfile_getOSBackedFD(file));
 
+    if (file->osfile.cached != NULL && whence == SEEK_CUR) {
+        // the os-backed file's offset isn't updated by cached reads
+        offset += file->osfile.cursor;
+        whence = SEEK_SET;
+    }
+
     ssize_t result = lseek(_regularfile_getOSBackedFD(file), offset, whence);
+
+    if (result >= 0 && file->osfile.cached != NULL) {
+        file->osfile.cursor = result;
+    }
+
     return (result < 0) ? -errno : result;
 }
 
@@ -827,6 +1263,8 @@ int regularfile_getdents(RegularFile* file, struct linux_dirent* dirp, unsigned
         return -EBADF;
     }
 
+    _regularfile_waitForWrites(file);
+
     trace("RegularFile %p getdents os-backed file %i", file, _regularfile_getOSBackedFD(file));
 
     // getdents is not available for a direct call
@@ -843,6 +1281,8 @@ int regularfile_getdents64(RegularFile* file, struct linux_dirent64* dirp,
         return -EBADF;
     }
 
+    _regularfile_waitForWrites(file);
+
     trace("RegularFile %p getdents64 os-backed file %i", file, _regularfile_getOSBackedFD(file));
 
     int result =
@@ -857,6 +1297,8 @@ int regularfile_ioctl(RegularFile* file, unsigned long request, void* arg) {
         return -EBADF;
     }
 
+    _regularfile_waitForWrites(file);
+
     trace("RegularFile %p ioctl os-backed file %i", file, _regularfile_getOSBackedFD(file));
 
     int result = ioctl(_regularfile_getOSBackedFD(file), request, arg);
@@ -872,6 +1314,8 @@ int regularfile_fcntl(RegularFile* file, unsigned long command, void* arg) {
         return -EBADF;
     }
 
+    _regularfile_waitForWrites(file);
+
     if (command == F_SETFD) {
         intptr_t arg_int = (intptr_t)arg;
         // if the arg contains FD_CLOEXEC
@@ -906,6 +1350,8 @@ int regularfile_poll(RegularFile* file, struct pollfd* pfd) {
         return -EBADF;
     }
 
+    _regularfile_waitForWrites(file);
+
     trace("RegularFile %p poll os-backed file %i", file, _regularfile_getOSBackedFD(file));
 
     // Don't let the OS block us
@@ -937,18 +1383,56 @@ int regularfile_fstatat(RegularFile* dir, const char* pathname, struct stat* sta
 
     trace("RegularFile %p fstatat os-backed file %i, flags %d", dir, osFd, flags);
 
+    char* cachePath = _regularfile_getStatCachePath(dir, pathname, workingDir);
+    if (cachePath) {
+        int cachedResult;
+        bool found =
+            statcache_getStat(worker_getStatCache(), cachePath, flags, statbuf, &cachedResult);
+        if (found) {
+            free(cachePath);
+            return cachedResult;
+        }
+    }
+
+    /* Without AT_SYMLINK_NOFOLLOW, a missing path gives the same ENOENT as
+     * it does for an open. */
+    char* lookupPath = NULL;
+    if (!(flags & AT_SYMLINK_NOFOLLOW) && pathname[0] != '\0' &&
+        _regularfile_usesMissingPathCache()) {
+        lookupPath = _regularfile_getLookupPath(dir, pathname, workingDir);
+        if (lookupPath && _regularfile_isMissingPath(lookupPath)) {
+            free(lookupPath);
+            return -ENOENT;
+        }
+    }
+
     if (osFd == AT_FDCWD) {
         osFd = -1;
         pathnameTmp = _regularfile_getAbsolutePath(NULL, pathname, workingDir);
     }
 
+    _regularfile_waitForPathWrites(osFd, pathnameTmp, flags);
+
     int result = fstatat(osFd, pathnameTmp, statbuf, flags);
+    int errcode = errno;
+
+    if (result < 0 && errcode == ENOENT && lookupPath) {
+        _regularfile_addMissingPath(lookupPath);
+    }
 
+    if (cachePath) {
+        statcache_putStat(
+            worker_getStatCache(), cachePath, flags, statbuf, (result < 0) ? -errcode : result);
+        free(cachePath);
+    }
+    if (lookupPath) {
+        free(lookupPath);
+    }
     if (pathnameTmp != pathname) {
         free((char*)pathnameTmp);
     }
 
-    return (result < 0) ? -errno : result;
+    return (result < 0) ? -errcode : result;
 }
 
 int regularfile_fchownat(RegularFile* dir, const char* pathname, uid_t owner, gid_t group,
@@ -1042,18 +1526,35 @@ int regularfile_faccessat(RegularFile* dir, const char* pathname, int mode, int
 
     trace("RegularFile %p faccessat os-backed file %i", dir, osFd);
 
+    char* cachePath = _regularfile_getStatCachePath(dir, pathname, workingDir);
+    if (cachePath) {
+        int cachedResult;
+        bool found =
+            statcache_getAccess(worker_getStatCache(), cachePath, mode, flags, &cachedResult);
+        if (found) {
+            free(cachePath);
+            return cachedResult;
+        }
+    }
+
     if (osFd == AT_FDCWD) {
         osFd = -1;
         pathnameTmp = _regularfile_getAbsolutePath(NULL, pathname, workingDir);
     }
 
     int result = faccessat(osFd, pathnameTmp, mode, flags);
+    int errcode = errno;
 
+    if (cachePath) {
+        statcache_putAccess(
+            worker_getStatCache(), cachePath, mode, flags, (result < 0) ? -errcode : result);
+        free(cachePath);
+    }
     if (pathnameTmp != pathname) {
         free((char*)pathnameTmp);
     }
 
-    return (result < 0) ? -errno : result;
+    return (result < 0) ? -errcode : result;
 }
 
 int regularfile_mkdirat(RegularFile* dir, const char* pathname, mode_t mode,
@@ -1069,12 +1570,17 @@ int regularfile_mkdirat(RegularFile* dir, const char* pathname, mode_t mode,
     }
 
     int result = mkdirat(osFd, pathnameTmp, mode);
+    int errcode = errno;
+
+    if (result == 0) {
+        _regularfile_clearMissingPaths();
+    }
 
     if (pathnameTmp != pathname) {
         free((char*)pathnameTmp);
     }
 
-    return (result < 0) ? -errno : result;
+    return (result < 0) ? -errcode : result;
 }
 
 int regularfile_mknodat(RegularFile* dir, const char* pathname, mode_t mode, dev_t dev,
@@ -1090,12 +1596,17 @@ int regularfile_mknodat(RegularFile* dir, const char* pathname, mode_t mode, dev
     }
 
     int result = mknodat(osFd, pathnameTmp, mode, dev);
+    int errcode = errno;
+
+    if (result == 0) {
+        _regularfile_clearMissingPaths();
+    }
 
     if (pathnameTmp != pathname) {
         free((char*)pathnameTmp);
     }
 
-    return (result < 0) ? -errno : result;
+    return (result < 0) ? -errcode : result;
 }
 
 int regularfile_linkat(RegularFile* oldDir, const char* oldPath, RegularFile* newDir,
@@ -1117,6 +1628,11 @@ int regularfile_linkat(RegularFile* oldDir, const char* oldPath, RegularFile* ne
     }
 
     int result = linkat(oldOsFd, oldPathTmp, newOsFd, newPathTmp, flags);
+    int errcode = errno;
+
+    if (result == 0) {
+        _regularfile_clearMissingPaths();
+    }
 
     if (oldPathTmp != oldPath) {
         free((char*)oldPathTmp);
@@ -1125,7 +1641,7 @@ int regularfile_linkat(RegularFile* oldDir, const char* oldPath, RegularFile* ne
         free((char*)newPathTmp);
     }
 
-    return (result < 0) ? -errno : result;
+    return (result < 0) ? -errcode : result;
 }
 
 int regularfile_unlinkat(RegularFile* dir, const char* pathname, int flags,
@@ -1162,12 +1678,17 @@ int regularfile_symlinkat(RegularFile* dir, const char* linkpath, const char* ta
     }
 
     int result = symlinkat(target, osFd, linkpathTmp);
+    int errcode = errno;
+
+    if (result == 0) {
+        _regularfile_clearMissingPaths();
+    }
 
     if (linkpathTmp != linkpath) {
         free((char*)linkpathTmp);
     }
 
-    return (result < 0) ? -errno : result;
+    return (result < 0) ? -errcode : result;
 }
 
 ssize_t regularfile_readlinkat(RegularFile* dir, const char* pathname, char* buf, size_t bufsize,
@@ -1177,18 +1698,52 @@ ssize_t regularfile_readlinkat(RegularFile* dir, const char* pathname, char* buf
 
     trace("RegularFile %p readlinkat os-backed file %i", dir, osFd);
 
+    char* cachePath = _regularfile_getStatCachePath(dir, pathname, workingDir);
+    if (cachePath) {
+        ssize_t cachedResult;
+        bool found =
+            statcache_getReadlink(worker_getStatCache(), cachePath, buf, bufsize, &cachedResult);
+        if (found) {
+            free(cachePath);
+            return cachedResult;
+        }
+    }
+
     if (osFd == AT_FDCWD) {
         osFd = -1;
         pathnameTmp = _regularfile_getAbsolutePath(NULL, pathname, workingDir);
     }
 
-    ssize_t result = readlinkat(osFd, pathnameTmp, buf, bufsize);
+    ssize_t result;
+    int errcode;
+
+    if (cachePath) {
+        /* Read the whole target so that it can be cached, even if the caller's
+         * buffer is smaller. */
+        char target[PATH_MAX];
+        result = readlinkat(osFd, pathnameTmp, target, sizeof(target));
+        errcode = errno;
+
+        /* A target that fills the buffer may have been truncated. */
+        if (result < (ssize_t)sizeof(target)) {
+            statcache_putReadlink(
+                worker_getStatCache(), cachePath, target, (result < 0) ? -errcode : result);
+        }
+        if (result >= 0) {
+            result = MIN((size_t)result, bufsize);
+            memcpy(buf, target, result);
+        }
+        free(cachePath);
+    } else {
+        result = readlinkat(osFd, pathnameTmp, buf, bufsize);
+        errcode = errno;
+    }
 
     if (pathnameTmp != pathname) {
         free((char*)pathnameTmp);
     }
 
-    return (result < 0) ? -errno : result;
+    return (result < 0) ? -errcode : result;
 }
 
 int regularfile_renameat2(RegularFile* oldDir, const char* oldPath, RegularFile* newDir,
@@ -1211,6 +1766,11 @@ int regularfile_renameat2(RegularFile* oldDir, const char* oldPath, RegularFile*
     }
 
     int result = (int)syscall(SYS_renameat2, oldOsFd, oldPathTmp, newOsFd, newPathTmp, flags);
+    int errcode = errno;
+
+    if (result == 0) {
+        _regularfile_clearMissingPaths();
+    }
 
     if (oldPathTmp != oldPath) {
         free((char*)oldPathTmp);
@@ -1219,7 +1779,7 @@ int regularfile_renameat2(RegularFile* oldDir, const char* oldPath, RegularFile*
         free((char*)newPathTmp);
     }
 
-    return (result < 0) ? -errno : result;
+    return (result < 0) ? -errcode : result;
 }
 
 #ifdef SYS_statx
@@ -1230,17 +1790,36 @@ int regularfile_statx(RegularFile* dir, const char* pathname, int flags, unsigne
 
     trace("RegularFile %p statx os-backed file %i", dir, osFd);
 
+    char* cachePath = _regularfile_getStatCachePath(dir, pathname, workingDir);
+    if (cachePath) {
+        int cachedResult;
+        bool found = statcache_getStatx(
+            worker_getStatCache(), cachePath, flags, mask, statxbuf, &cachedResult);
+        if (found) {
+            free(cachePath);
+            return cachedResult;
+        }
+    }
+
     if (osFd == AT_FDCWD) {
         osFd = -1;
         pathnameTmp = _regularfile_getAbsolutePath(NULL, pathname, workingDir);
     }
 
+    _regularfile_waitForPathWrites(osFd, pathnameTmp, flags);
+
     int result = syscall(SYS_statx, osFd, pathnameTmp, flags, mask, statxbuf);
+    int errcode = errno;
 
+    if (cachePath) {
+        statcache_putStatx(worker_getStatCache(), cachePath, flags, mask, statxbuf,
+                           (result < 0) ? -errcode : result);
+        free(cachePath);
+    }
     if (pathnameTmp != pathname) {
         free((char*)pathnameTmp);
     }
 
-    return (result < 0) ? -errno : result;
+    return (result < 0) ? -errcode : result;
 }
 #endif
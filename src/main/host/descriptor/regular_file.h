@@ -58,6 +58,11 @@ int regularfile_open(RegularFile* file, const char* pathname, int flags, mode_t
                      const char* workingDir);
 int regularfile_openat(RegularFile* file, RegularFile* dir, const char* pathname, int flags,
                        mode_t mode, const char* workingDir);
+/* Like regularfile_open(), but the os-backed regular file isn't opened (or created) until the
+ * file is first used. An error from opening it is logged, and makes operations on the file fail
+ * with EBADF. */
+void regularfile_openDeferred(RegularFile* file, const char* pathname, int flags, mode_t mode,
+                              const char* workingDir);
 
 // ************************
 // Accessors
@@ -79,6 +84,11 @@ FileType regularfile_getType(RegularFile* file);
 /* Returns the linux-backed fd that shadow uses to perform the file operations.  */
 int regularfile_getOSBackedFD(RegularFile* file);
 
+/* Waits for the file's asynchronous writes to complete. Returns 0, or the
+ * negative errno of the first of them that failed and hasn't been returned
+ * yet by a write or fsync. */
+int regularfile_finishWrites(RegularFile* file);
+
 // ****************************************
 // Operations that require a non-null RegularFile*
 // ****************************************
@@ -118,9 +118,12 @@ impl SharedBuf {
             return Err(Errno::EAGAIN.into());
         }
 
+        // large writes are stored in a single chunk so that they can be copied to and from managed
+        // memory in one operation each
+        let len = std::cmp::min(len, self.space_available());
         let written = self
             .queue
-            .push_stream(bytes.take(self.space_available().try_into().unwrap()))?;
+            .push_stream_sized(bytes.take(len.try_into().unwrap()), len)?;
 
         let signals = if written > 0 {
             BufferSignals::BUFFER_GREW
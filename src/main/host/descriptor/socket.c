@@ -127,11 +127,13 @@ void legacysocket_init(LegacySocket* socket, const Host* host, SocketFunctionTab
     socket->outputControlBuffer = g_queue_new();
     socket->outputBufferSize = sendBufferSize;
 
+    socket->trackerHandle = TRACKER_SOCKET_HANDLE_NONE;
     Tracker* tracker = host_getTracker(host);
     if (tracker != NULL) {
         CompatSocket compatSocket = compatsocket_fromLegacySocket(socket);
-        tracker_addSocket(tracker, &compatSocket, socket->protocol, socket->inputBufferSize,
-                          socket->outputBufferSize);
+        socket->trackerHandle =
+            tracker_addSocket(tracker, &compatSocket, socket->protocol, socket->inputBufferSize,
+                              socket->outputBufferSize);
     }
 }
 
@@ -140,6 +142,11 @@ ProtocolType legacysocket_getProtocol(LegacySocket* socket) {
     return socket->protocol;
 }
 
+TrackerSocketHandle legacysocket_getTrackerHandle(const LegacySocket* socket) {
+    MAGIC_ASSERT(socket);
+    return socket->trackerHandle;
+}
+
 /* interface functions, implemented by subtypes */
 
 gboolean legacysocket_isFamilySupported(LegacySocket* socket, sa_family_t family) {
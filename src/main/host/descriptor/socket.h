@@ -18,6 +18,7 @@ typedef struct _SocketFunctionTable SocketFunctionTable;
 #include "main/core/definitions.h"
 #include "main/host/descriptor/descriptor_types.h"
 #include "main/host/protocol.h"
+#include "main/host/tracker_types.h"
 #include "main/routing/packet.minimal.h"
 
 typedef gboolean (*SocketIsFamilySupportedFunc)(LegacySocket* socket, sa_family_t family);
@@ -83,6 +84,9 @@ struct _LegacySocket {
     gsize outputBufferSizePending;
     gsize outputBufferLength;
 
+    /* our stats in the host's tracker */
+    TrackerSocketHandle trackerHandle;
+
     MAGIC_DECLARE_ALWAYS;
 };
 
@@ -124,6 +128,7 @@ gboolean legacysocket_getSocketName(LegacySocket* socket, in_addr_t* ip, in_port
 void legacysocket_setSocketName(LegacySocket* socket, in_addr_t ip, in_port_t port);
 
 ProtocolType legacysocket_getProtocol(LegacySocket* socket);
+TrackerSocketHandle legacysocket_getTrackerHandle(const LegacySocket* socket);
 
 gboolean legacysocket_isFamilySupported(LegacySocket* socket, sa_family_t family);
 gint legacysocket_connectToPeer(LegacySocket* socket, const Host* host, in_addr_t ip,
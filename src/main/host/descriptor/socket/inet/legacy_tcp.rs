@@ -28,7 +28,7 @@ use crate::host::thread::ThreadId;
 use crate::network::packet::PacketRc;
 use crate::utility::callback_queue::CallbackQueue;
 use crate::utility::sockaddr::SockaddrStorage;
-use crate::utility::{HostTreePointer, ObjectCounter};
+use crate::utility::{HostTreePointer, ObjectCounter, ObjectType};
 
 pub struct LegacyTcpSocket {
     socket: HostTreePointer<c::TCP>,
@@ -37,6 +37,8 @@ pub struct LegacyTcpSocket {
     has_open_file: bool,
     /// Did the last connect() call block, and if so what thread?
     thread_of_blocked_connect: Option<ThreadId>,
+    /// The `SO_PRIORITY` socket option, used by the network interface's queuing discipline.
+    send_priority: u32,
     _counter: ObjectCounter,
 }
 
@@ -45,7 +47,9 @@ impl LegacyTcpSocket {
         let recv_buf_size = host.params.init_sock_recv_buf_size.try_into().unwrap();
         let send_buf_size = host.params.init_sock_send_buf_size.try_into().unwrap();
 
-        let tcp = unsafe { c::tcp_new(host, recv_buf_size, send_buf_size) };
+        let congestion_type = host.params.tcp_congestion_control.to_c_congestion_type();
+
+        let tcp = unsafe { c::tcp_new(host, recv_buf_size, send_buf_size, congestion_type) };
         let tcp = unsafe { Self::new_from_legacy(tcp) };
 
         tcp.borrow_mut().set_status(status);
@@ -65,7 +69,8 @@ impl LegacyTcpSocket {
             socket: HostTreePointer::new(legacy_tcp),
             has_open_file: false,
             thread_of_blocked_connect: None,
-            _counter: ObjectCounter::new("LegacyTcpSocket"),
+            send_priority: 0,
+            _counter: ObjectCounter::new(ObjectType::LegacyTcpSocket),
         };
 
         let rv = Arc::new(AtomicRefCell::new(socket));
@@ -134,12 +139,12 @@ impl LegacyTcpSocket {
 
     pub fn push_in_packet(
         &mut self,
-        packet: PacketRc,
+        packet: &mut PacketRc,
         _cb_queue: &mut CallbackQueue,
         _recv_time: EmulatedTime,
     ) {
         Worker::with_active_host(|host| {
-            // the C code should ref the inner `Packet`, so it's fine to drop the `PacketRc`
+            // the C code will take its own reference to the inner `Packet` if it keeps it
             unsafe {
                 c::legacysocket_pushInPacket(self.as_legacy_socket(), host, packet.borrow_inner())
             };
@@ -147,6 +152,23 @@ impl LegacyTcpSocket {
         .unwrap();
     }
 
+    /// Only pushes the first packet, since a legacy tcp socket may change its associations with
+    /// the network interface when handling a packet (for example a listening socket creates and
+    /// associates a child socket when it receives a SYN), so the remaining packets must be looked
+    /// up again. Returns the number of packets that were pushed.
+    pub fn push_in_packets(
+        &mut self,
+        packets: &mut dyn Iterator<Item = &mut PacketRc>,
+        cb_queue: &mut CallbackQueue,
+        recv_time: EmulatedTime,
+    ) -> usize {
+        let Some(packet) = packets.next() else {
+            return 0;
+        };
+        self.push_in_packet(packet, cb_queue, recv_time);
+        1
+    }
+
     pub fn pull_out_packet(&mut self, _cb_queue: &mut CallbackQueue) -> Option<PacketRc> {
         let packet = Worker::with_active_host(|host| unsafe {
             c::legacysocket_pullOutPacket(self.as_legacy_socket(), host)
@@ -185,6 +207,11 @@ impl LegacyTcpSocket {
         self.peek_packet().is_some()
     }
 
+    /// The socket's `SO_PRIORITY` option.
+    pub fn send_priority(&self) -> u32 {
+        self.send_priority
+    }
+
     pub fn getsockname(&self) -> Result<Option<SockaddrIn>, Errno> {
         let mut ip: libc::in_addr_t = 0;
         let mut port: libc::in_port_t = 0;
@@ -362,70 +389,49 @@ impl LegacyTcpSocket {
 
         // run in a closure so that an early return doesn't skip checking if we should block
         let result = (|| {
-            let mut bytes_sent = 0;
-
-            for iov in args.iovs {
-                let errcode = unsafe { c::tcp_getConnectionError(tcp) };
-
-                log::trace!("Connection error state is currently {errcode}");
-
-                #[allow(clippy::if_same_then_else)]
-                if errcode > 0 {
-                    // connect() was not called yet
-                    // TODO: Can they can piggy back a connect() on sendto() if they provide an
-                    // address for the connection?
-                    if bytes_sent == 0 {
-                        return Err(Errno::EPIPE);
-                    } else {
-                        break;
-                    }
-                } else if errcode == 0 {
-                    // They connected, but never read the success code with a second call to
-                    // connect(). That's OK, proceed to send as usual.
-                } else if errcode == -libc::EISCONN {
-                    // they are connected, and we can send now
-                } else if errcode == -libc::EALREADY {
-                    // connection in progress
-                    // TODO: should we wait, or just return -EALREADY?
-                    if bytes_sent == 0 {
-                        return Err(Errno::EWOULDBLOCK);
-                    } else {
-                        break;
-                    }
-                }
+            let errcode = unsafe { c::tcp_getConnectionError(tcp) };
+
+            log::trace!("Connection error state is currently {errcode}");
+
+            #[allow(clippy::if_same_then_else)]
+            if errcode > 0 {
+                // connect() was not called yet
+                // TODO: Can they can piggy back a connect() on sendto() if they provide an
+                // address for the connection?
+                return Err(Errno::EPIPE);
+            } else if errcode == 0 {
+                // They connected, but never read the success code with a second call to
+                // connect(). That's OK, proceed to send as usual.
+            } else if errcode == -libc::EISCONN {
+                // they are connected, and we can send now
+            } else if errcode == -libc::EALREADY {
+                // connection in progress
+                // TODO: should we wait, or just return -EALREADY?
+                return Err(Errno::EWOULDBLOCK);
+            }
 
-                // SAFETY: We're passing an immutable pointer to the memory manager. We should not
-                // have any other mutable references to the memory manager at this point.
-                let rv = Worker::with_active_host(|host| unsafe {
-                    c::tcp_sendUserData(
-                        tcp,
-                        host,
-                        iov.base.cast::<()>(),
-                        iov.len.try_into().unwrap(),
-                        0,
-                        0,
-                        mem,
-                    )
-                })
-                .unwrap();
-
-                if rv < 0 {
-                    if bytes_sent == 0 {
-                        return Err(Errno::try_from(-rv).unwrap());
-                    } else {
-                        break;
-                    }
-                }
+            // send all of the iovs at once so that the data is packed into as few packets as
+            // possible
+            let iovs = to_c_iovs(args.iovs);
 
-                bytes_sent += rv;
+            // SAFETY: We're passing an immutable pointer to the memory manager. We should not
+            // have any other mutable references to the memory manager at this point.
+            let rv = Worker::with_active_host(|host| unsafe {
+                c::tcp_sendUserData(
+                    tcp,
+                    host,
+                    iovs.as_ptr(),
+                    iovs.len().try_into().unwrap(),
+                    mem,
+                )
+            })
+            .unwrap();
 
-                if usize::try_from(rv).unwrap() < iov.len {
-                    // stop if we didn't write all of the data in the iov
-                    break;
-                }
+            if rv < 0 {
+                return Err(Errno::try_from(-rv).unwrap());
             }
 
-            Ok(bytes_sent)
+            Ok(rv)
         })();
 
         // if the syscall would block and we don't have the MSG_DONTWAIT flag
@@ -442,7 +448,7 @@ impl LegacyTcpSocket {
 
     pub fn recvmsg(
         socket: &Arc<AtomicRefCell<Self>>,
-        mut args: RecvmsgArgs,
+        args: RecvmsgArgs,
         mem: &mut MemoryManager,
         _cb_queue: &mut CallbackQueue,
     ) -> Result<RecvmsgReturn, SyscallError> {
@@ -473,67 +479,37 @@ impl LegacyTcpSocket {
 
         // run in a closure so that an early return doesn't skip checking if we should block
         let result = (|| {
-            let mut bytes_read = 0;
-
-            // want to make sure we run the loop at least once so that we can return any errors
-            if args.iovs.is_empty() {
-                const EMPTY_IOV: IoVec = IoVec {
-                    base: ForeignPtr::null(),
-                    len: 0,
-                };
-                args.iovs = std::slice::from_ref(&EMPTY_IOV);
+            let errcode = unsafe { c::tcp_getConnectionError(tcp) };
+
+            if errcode > 0 {
+                // connect() was not called yet
+                return Err(Errno::ENOTCONN);
+            } else if errcode == -libc::EALREADY {
+                // Connection in progress
+                return Err(Errno::EWOULDBLOCK);
             }
 
-            for iov in args.iovs {
-                let errcode = unsafe { c::tcp_getConnectionError(tcp) };
-
-                if errcode > 0 {
-                    // connect() was not called yet
-                    if bytes_read == 0 {
-                        return Err(Errno::ENOTCONN);
-                    } else {
-                        break;
-                    }
-                } else if errcode == -libc::EALREADY {
-                    // Connection in progress
-                    if bytes_read == 0 {
-                        return Err(Errno::EWOULDBLOCK);
-                    } else {
-                        break;
-                    }
-                }
-
-                // SAFETY: We're passing a mutable pointer to the memory manager. We should not have
-                // any other mutable references to the memory manager at this point.
-                let rv = Worker::with_active_host(|host| unsafe {
-                    c::tcp_receiveUserData(
-                        tcp,
-                        host,
-                        iov.base.cast::<()>(),
-                        iov.len.try_into().unwrap(),
-                        std::ptr::null_mut(),
-                        std::ptr::null_mut(),
-                        mem,
-                    )
-                })
-                .unwrap();
-
-                if rv < 0 {
-                    if bytes_read == 0 {
-                        return Err(Errno::try_from(-rv).unwrap());
-                    } else {
-                        break;
-                    }
-                }
+            let iovs = to_c_iovs(args.iovs);
 
-                bytes_read += rv;
+            // SAFETY: We're passing a mutable pointer to the memory manager. We should not have
+            // any other mutable references to the memory manager at this point.
+            let rv = Worker::with_active_host(|host| unsafe {
+                c::tcp_receiveUserData(
+                    tcp,
+                    host,
+                    iovs.as_ptr(),
+                    iovs.len().try_into().unwrap(),
+                    mem,
+                )
+            })
+            .unwrap();
 
-                if usize::try_from(rv).unwrap() < iov.len {
-                    // stop if we didn't receive all of the data in the iov
-                    break;
-                }
+            if rv < 0 {
+                return Err(Errno::try_from(-rv).unwrap());
             }
 
+            let bytes_read = rv;
+
             Ok(RecvmsgReturn {
                 return_val: bytes_read.try_into().unwrap(),
                 addr: None,
@@ -927,7 +903,10 @@ impl LegacyTcpSocket {
                 panic!("Expected this to be a LegacyTcpSocket");
             };
 
-            let new_socket = new_socket.borrow();
+            let mut new_socket = new_socket.borrow_mut();
+
+            // the accepted socket inherits the listening socket's priority, as in linux
+            new_socket.send_priority = self.send_priority;
 
             let mut ip: libc::in_addr_t = 0;
             let mut port: libc::in_port_t = 0;
@@ -1106,6 +1085,15 @@ impl LegacyTcpSocket {
 
                 Ok(bytes_written as libc::socklen_t)
             }
+            (libc::SOL_SOCKET, libc::SO_PRIORITY) => {
+                let priority: libc::c_int = self.send_priority.try_into().unwrap();
+
+                let optval_ptr = optval_ptr.cast::<libc::c_int>();
+                let bytes_written =
+                    write_partial(memory_manager, &priority, optval_ptr, optlen as usize)?;
+
+                Ok(bytes_written as libc::socklen_t)
+            }
             _ => {
                 log_once_per_value_at_level!(
                     (level, optname),
@@ -1174,13 +1162,20 @@ impl LegacyTcpSocket {
                     .unwrap_or(name);
 
                 let reno = unsafe { CStr::from_ptr(c::TCP_CONG_RENO_NAME) }.to_bytes();
+                let cubic = unsafe { CStr::from_ptr(c::TCP_CONG_CUBIC_NAME) }.to_bytes();
 
-                if name != reno {
-                    log::warn!("Shadow sockets only support '{reno:?}' for TCP_CONGESTION");
+                let congestion_type = if name == reno {
+                    c::_TCPCongestionType_TCP_CC_RENO
+                } else if name == cubic {
+                    c::_TCPCongestionType_TCP_CC_CUBIC
+                } else {
+                    log::warn!(
+                        "Shadow sockets only support '{reno:?}' and '{cubic:?}' for TCP_CONGESTION"
+                    );
                     return Err(Errno::ENOENT.into());
-                }
+                };
 
-                // shadow doesn't support other congestion types, so do nothing
+                unsafe { c::tcp_setCongestionType(self.as_legacy_tcp(), congestion_type) };
             }
             (libc::SOL_SOCKET, libc::SO_SNDBUF) => {
                 type OptType = libc::c_int;
@@ -1240,6 +1235,23 @@ impl LegacyTcpSocket {
                 unsafe { c::legacysocket_setInputBufferSize(self.as_legacy_socket(), val) };
                 unsafe { c::tcp_disableReceiveBufferAutotuning(self.as_legacy_tcp()) };
             }
+            (libc::SOL_SOCKET, libc::SO_PRIORITY) => {
+                type OptType = libc::c_int;
+
+                if usize::try_from(optlen).unwrap() < std::mem::size_of::<OptType>() {
+                    return Err(Errno::EINVAL.into());
+                }
+
+                let optval_ptr = optval_ptr.cast::<OptType>();
+                let val = memory_manager.read(optval_ptr)?;
+
+                // linux requires CAP_NET_ADMIN to set a priority outside of this range
+                if !(0..=6).contains(&val) {
+                    return Err(Errno::EPERM.into());
+                }
+
+                self.send_priority = val.try_into().unwrap();
+            }
             (libc::SOL_SOCKET, libc::SO_REUSEADDR) => {
                 // TODO: implement this, tor and tgen use it
                 log::trace!("setsockopt SO_REUSEADDR not yet implemented");
@@ -1310,3 +1322,13 @@ impl std::ops::Drop for LegacyTcpSocket {
         unsafe { c::legacyfile_unref(self.socket.ptr() as *mut libc::c_void) };
     }
 }
+
+/// Convert the iovs to the type used by the C TCP code.
+fn to_c_iovs(iovs: &[IoVec]) -> Vec<c::ForeignIoVec> {
+    iovs.iter()
+        .map(|iov| c::ForeignIoVec {
+            base: iov.base.cast::<()>(),
+            len: iov.len.try_into().unwrap(),
+        })
+        .collect()
+}
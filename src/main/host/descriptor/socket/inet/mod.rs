@@ -308,6 +308,9 @@ impl InetSocketRef<'_> {
     enum_passthrough!(self, (), LegacyTcp, Tcp, Udp;
         pub fn has_data_to_send(&self) -> bool
     );
+    enum_passthrough!(self, (), LegacyTcp, Tcp, Udp;
+        pub fn send_priority(&self) -> u32
+    );
 }
 
 // file functions
@@ -422,7 +425,10 @@ impl InetSocketRefMut<'_> {
 // inet socket-specific functions
 impl InetSocketRefMut<'_> {
     enum_passthrough!(self, (packet, cb_queue, recv_time), LegacyTcp, Tcp, Udp;
-        pub fn push_in_packet(&mut self, packet: PacketRc, cb_queue: &mut CallbackQueue, recv_time: EmulatedTime)
+        pub fn push_in_packet(&mut self, packet: &mut PacketRc, cb_queue: &mut CallbackQueue, recv_time: EmulatedTime)
+    );
+    enum_passthrough!(self, (packets, cb_queue, recv_time), LegacyTcp, Tcp, Udp;
+        pub fn push_in_packets(&mut self, packets: &mut dyn Iterator<Item = &mut PacketRc>, cb_queue: &mut CallbackQueue, recv_time: EmulatedTime) -> usize
     );
     enum_passthrough!(self, (cb_queue), LegacyTcp, Tcp, Udp;
         pub fn pull_out_packet(&mut self, cb_queue: &mut CallbackQueue) -> Option<PacketRc>
@@ -433,6 +439,9 @@ impl InetSocketRefMut<'_> {
     enum_passthrough!(self, (), LegacyTcp, Tcp, Udp;
         pub fn has_data_to_send(&self) -> bool
     );
+    enum_passthrough!(self, (), LegacyTcp, Tcp, Udp;
+        pub fn send_priority(&self) -> u32
+    );
 }
 
 impl std::fmt::Debug for InetSocketRef<'_> {
@@ -646,6 +655,22 @@ mod export {
         socket.canonical_handle()
     }
 
+    /// Returns the handle of the socket's stats in the host's tracker, or
+    /// `TRACKER_SOCKET_HANDLE_NONE` if the socket isn't tracked. Only legacy TCP sockets are
+    /// tracked.
+    #[no_mangle]
+    pub extern "C-unwind" fn inetsocket_getTrackerHandle(
+        socket: *const InetSocket,
+    ) -> c::TrackerSocketHandle {
+        let socket = unsafe { socket.as_ref() }.unwrap();
+        match socket {
+            InetSocket::LegacyTcp(socket) => unsafe {
+                c::legacysocket_getTrackerHandle(socket.borrow().as_legacy_socket())
+            },
+            InetSocket::Tcp(_) | InetSocket::Udp(_) => c::TRACKER_SOCKET_HANDLE_NONE.into(),
+        }
+    }
+
     #[no_mangle]
     pub extern "C-unwind" fn inetsocket_pushInPacket(
         socket: *const InetSocket,
@@ -655,17 +680,48 @@ mod export {
         let socket = unsafe { socket.as_ref() }.unwrap();
         let recv_time = EmulatedTime::from_c_emutime(recv_time).unwrap();
 
-        // we don't own the reference to the packet, so we need our own reference
-        unsafe { c::packet_ref(packet) };
-        let packet = PacketRc::from_raw(packet);
+        // the socket only uses the packet while handling it (and takes its own reference if it
+        // keeps it), so we can use the caller's reference
+        let mut packet = unsafe { PacketRc::borrow_raw(packet) };
 
         CallbackQueue::queue_and_run_with_legacy(|cb_queue| {
             socket
                 .borrow_mut()
-                .push_in_packet(packet, cb_queue, recv_time);
+                .push_in_packet(&mut packet, cb_queue, recv_time);
         });
     }
 
+    /// Push the first `num_packets` packets of the `packets` array to the socket, and return the
+    /// number of them that it accepted. The socket may stop accepting packets early (but always
+    /// accepts at least one) if it may have changed its associations with the network interface,
+    /// in which case the remaining packets should be looked up again.
+    #[no_mangle]
+    pub extern "C-unwind" fn inetsocket_pushInPackets(
+        socket: *const InetSocket,
+        packets: *const *mut c::Packet,
+        num_packets: usize,
+        recv_time: CEmulatedTime,
+    ) -> usize {
+        let socket = unsafe { socket.as_ref() }.unwrap();
+        let recv_time = EmulatedTime::from_c_emutime(recv_time).unwrap();
+        assert!(!packets.is_null());
+        let packets = unsafe { std::slice::from_raw_parts(packets, num_packets) };
+
+        // as in `inetsocket_pushInPacket`, we can use the caller's references
+        let mut packets: Vec<_> = packets
+            .iter()
+            .map(|packet| unsafe { PacketRc::borrow_raw(*packet) })
+            .collect();
+
+        CallbackQueue::queue_and_run_with_legacy(|cb_queue| {
+            socket.borrow_mut().push_in_packets(
+                &mut packets.iter_mut().map(|packet| &mut **packet),
+                cb_queue,
+                recv_time,
+            )
+        })
+    }
+
     #[no_mangle]
     pub extern "C-unwind" fn inetsocket_pullOutPacket(socket: *const InetSocket) -> *mut c::Packet {
         let socket = unsafe { socket.as_ref() }.unwrap();
@@ -700,6 +756,13 @@ mod export {
         socket.borrow().has_data_to_send()
     }
 
+    /// Returns the socket's `SO_PRIORITY` option.
+    #[no_mangle]
+    pub extern "C-unwind" fn inetsocket_getSendPriority(socket: *const InetSocket) -> u32 {
+        let socket = unsafe { socket.as_ref() }.unwrap();
+        socket.borrow().send_priority()
+    }
+
     /// Get a legacy C [`TCP`](c::TCP) pointer for the socket. Will panic if `socket` is not a
     /// legacy TCP socket or if `socket` is already mutably borrowed. Will never return `NULL`.
     #[no_mangle]
@@ -727,6 +790,22 @@ mod export {
         drop(unsafe { Box::from_raw(socket) });
     }
 
+    /// Helper for GLib functions that take a `TaskObjectFreeFunc`. See [`inetsocketweak_drop`].
+    #[no_mangle]
+    pub extern "C-unwind" fn inetsocketweak_dropVoid(socket: *mut libc::c_void) {
+        inetsocketweak_drop(socket.cast())
+    }
+
+    /// Increment the weak count of the `InetSocketWeak` object. The returned pointer is a distinct
+    /// reference, and both must be dropped with `inetsocketweak_drop` separately later.
+    #[no_mangle]
+    pub extern "C-unwind" fn inetsocketweak_cloneRef(
+        socket: *const InetSocketWeak,
+    ) -> *mut InetSocketWeak {
+        let socket = unsafe { socket.as_ref() }.unwrap();
+        Box::into_raw(Box::new(socket.clone()))
+    }
+
     /// Upgrade the weak reference. May return `NULL` if the socket has no remaining strong
     /// references and has been dropped. Returns an owned `InetSocket` that must be dropped as a
     /// `Box` later (for example using `inetsocket_drop`).
@@ -2,7 +2,7 @@ use std::net::{Ipv4Addr, SocketAddrV4};
 use std::sync::{Arc, Weak};
 
 use atomic_refcell::AtomicRefCell;
-use bytes::BytesMut;
+use bytes::Bytes;
 use linux_api::errno::Errno;
 use linux_api::ioctls::IoctlRequest;
 use linux_api::socket::Shutdown;
@@ -29,7 +29,7 @@ use crate::host::syscall::types::SyscallError;
 use crate::network::packet::{PacketRc, PacketStatus};
 use crate::utility::callback_queue::CallbackQueue;
 use crate::utility::sockaddr::SockaddrStorage;
-use crate::utility::{HostTreePointer, ObjectCounter};
+use crate::utility::{HostTreePointer, ObjectCounter, ObjectType};
 
 pub struct TcpSocket {
     tcp_state: tcp::TcpState<TcpDeps>,
@@ -40,6 +40,8 @@ pub struct TcpSocket {
     association: Option<AssociationHandle>,
     connect_result_is_pending: bool,
     shutdown_status: Option<Shutdown>,
+    /// The `SO_PRIORITY` socket option, used by the network interface's queuing discipline.
+    send_priority: u32,
     // should only be used by `OpenFile` to make sure there is only ever one `OpenFile` instance for
     // this file
     has_open_file: bool,
@@ -47,7 +49,15 @@ pub struct TcpSocket {
 }
 
 impl TcpSocket {
-    pub fn new(status: FileStatus) -> Arc<AtomicRefCell<Self>> {
+    pub fn new(
+        status: FileStatus,
+        send_buf_size: usize,
+        recv_buf_size: usize,
+    ) -> Arc<AtomicRefCell<Self>> {
+        let mut config = tcp::TcpConfig::default();
+        config.send_buffer_size(send_buf_size);
+        config.recv_buffer_size(recv_buf_size.try_into().unwrap());
+
         let rv = Arc::new_cyclic(|weak: &Weak<AtomicRefCell<Self>>| {
             let tcp_dependencies = TcpDeps {
                 timer_state: Arc::new(AtomicRefCell::new(TcpDepsTimerState {
@@ -57,7 +67,7 @@ impl TcpSocket {
             };
 
             AtomicRefCell::new(Self {
-                tcp_state: tcp::TcpState::new(tcp_dependencies, tcp::TcpConfig::default()),
+                tcp_state: tcp::TcpState::new(tcp_dependencies, config),
                 socket_weak: weak.clone(),
                 event_source: StateEventSource::new(),
                 status,
@@ -67,8 +77,9 @@ impl TcpSocket {
                 association: None,
                 connect_result_is_pending: false,
                 shutdown_status: None,
+                send_priority: 0,
                 has_open_file: false,
-                _counter: ObjectCounter::new("TcpSocket"),
+                _counter: ObjectCounter::new(ObjectType::TcpSocket),
             })
         });
 
@@ -197,10 +208,43 @@ impl TcpSocket {
 
     pub fn push_in_packet(
         &mut self,
-        mut packet: PacketRc,
+        packet: &mut PacketRc,
         cb_queue: &mut CallbackQueue,
         _recv_time: EmulatedTime,
     ) {
+        self.with_tcp_state_and_signal(cb_queue, |s| ((), Self::push_packet_to_state(s, packet)));
+    }
+
+    /// Like [`push_in_packet`](Self::push_in_packet) for each of the packets, but the socket's
+    /// state is only refreshed (and its listeners notified) once. Returns the number of packets
+    /// that were pushed. Once the tcp state is closed it stops accepting packets, since the socket
+    /// will no longer be associated with the network interface and the remaining packets may
+    /// belong to a different socket.
+    pub fn push_in_packets(
+        &mut self,
+        packets: &mut dyn Iterator<Item = &mut PacketRc>,
+        cb_queue: &mut CallbackQueue,
+        _recv_time: EmulatedTime,
+    ) -> usize {
+        self.with_tcp_state_and_signal(cb_queue, |s| {
+            let mut signals = FileSignals::empty();
+            let mut num_pushed = 0;
+
+            // check the state before taking the next packet so that it isn't consumed
+            while num_pushed == 0 || !s.poll().contains(tcp::PollState::CLOSED) {
+                let Some(packet) = packets.next() else {
+                    break;
+                };
+                signals |= Self::push_packet_to_state(s, packet);
+                num_pushed += 1;
+            }
+
+            (num_pushed, signals)
+        })
+    }
+
+    /// Push the packet to the tcp state, and return the signals that the socket should emit.
+    fn push_packet_to_state(s: &mut tcp::TcpState<TcpDeps>, packet: &mut PacketRc) -> FileSignals {
         packet.add_status(PacketStatus::RcvSocketProcessed);
 
         // TODO: don't bother copying the bytes if we know the push will fail
@@ -216,22 +260,17 @@ impl TcpSocket {
         // transfer the `Bytes` objects directly from the payload to the tcp state without copying
         // the bytes themselves
 
-        let mut payload = BytesMut::zeroed(packet.payload_size());
-        let num_bytes_copied = packet.get_payload(&mut payload);
-        assert_eq!(num_bytes_copied, packet.payload_size());
-        let payload = tcp::Payload(vec![payload.freeze()]);
+        let payload = tcp::Payload(vec![Bytes::copy_from_slice(packet.payload())]);
 
-        self.with_tcp_state_and_signal(cb_queue, |s| {
-            let pushed_len = s.push_packet(&header, payload).unwrap();
-            let signals = if pushed_len > 0 {
-                FileSignals::READ_BUFFER_GREW
-            } else {
-                FileSignals::empty()
-            };
-            ((), signals)
-        });
+        let pushed_len = s.push_packet(&header, payload).unwrap();
 
         packet.add_status(PacketStatus::RcvSocketBuffered);
+
+        if pushed_len > 0 {
+            FileSignals::READ_BUFFER_GREW
+        } else {
+            FileSignals::empty()
+        }
     }
 
     pub fn pull_out_packet(&mut self, cb_queue: &mut CallbackQueue) -> Option<PacketRc> {
@@ -264,16 +303,13 @@ impl TcpSocket {
 
         let mut packet = PacketRc::new();
 
-        // TODO: This is expensive. Here we allocate a new buffer, copy all of the payload bytes to
-        // this new buffer, and then copy the bytes in this new buffer to the packet's buffer. In
-        // the future, the packet could contain an array of `Bytes` objects and we could simply
-        // transfer the `Bytes` objects directly from the tcp state's `Payload` object to the packet
-        // without copying the bytes themselves.
-        let payload = payload.concat();
-
+        // The bytes of each chunk are copied directly into the packet's buffer. In the future, the
+        // packet could contain an array of `Bytes` objects and we could simply transfer the `Bytes`
+        // objects directly from the tcp state's `Payload` object to the packet without copying the
+        // bytes themselves.
         packet.set_tcp(&header);
         // TODO: set packet priority?
-        packet.set_payload(&payload, /* priority= */ 0);
+        packet.set_payload_chunks(&payload.0, /* priority= */ 0);
         packet.add_status(PacketStatus::SndCreated);
 
         Some(packet)
@@ -288,6 +324,11 @@ impl TcpSocket {
         self.tcp_state.wants_to_send()
     }
 
+    /// The socket's `SO_PRIORITY` option.
+    pub fn send_priority(&self) -> u32 {
+        self.send_priority
+    }
+
     pub fn getsockname(&self) -> Result<Option<SockaddrIn>, Errno> {
         // The socket state won't always have the local address. For example if the socket was bound
         // but connect() hasn't yet been called, the socket state will not have a local or remote
@@ -769,6 +810,9 @@ impl TcpSocket {
         let local_addr = accepted_state.local_addr();
         let remote_addr = accepted_state.remote_addr();
 
+        // the accepted socket inherits the listening socket's priority, as in linux
+        let send_priority = self.send_priority;
+
         // convert the accepted tcp state to a full tcp socket
         let new_socket = Arc::new_cyclic(|weak: &Weak<AtomicRefCell<Self>>| {
             let accepted_state = accepted_state.finalize(|deps| {
@@ -790,8 +834,9 @@ impl TcpSocket {
                 association: None,
                 connect_result_is_pending: false,
                 shutdown_status: None,
+                send_priority,
                 has_open_file: false,
-                _counter: ObjectCounter::new("TcpSocket"),
+                _counter: ObjectCounter::new(ObjectType::TcpSocket),
             })
         });
 
@@ -886,6 +931,14 @@ impl TcpSocket {
         cb_queue: &mut CallbackQueue,
     ) -> Result<libc::socklen_t, SyscallError> {
         match (level, optname) {
+            (libc::SOL_TCP, libc::TCP_INFO) => {
+                let info = tcp_info(&self.tcp_state.info());
+
+                let optval_ptr = optval_ptr.cast::<c::tcp_info>();
+                let bytes_written = write_partial(mem, &info, optval_ptr, optlen as usize)?;
+
+                Ok(bytes_written as libc::socklen_t)
+            }
             (libc::SOL_SOCKET, libc::SO_ERROR) => {
                 // may update the socket's state (for example, reading `SO_ERROR` will make `poll()`
                 // stop returning `POLLERR` for the socket)
@@ -930,6 +983,14 @@ impl TcpSocket {
 
                 Ok(bytes_written as libc::socklen_t)
             }
+            (libc::SOL_SOCKET, libc::SO_PRIORITY) => {
+                let priority: libc::c_int = self.send_priority.try_into().unwrap();
+
+                let optval_ptr = optval_ptr.cast::<libc::c_int>();
+                let bytes_written = write_partial(mem, &priority, optval_ptr, optlen as usize)?;
+
+                Ok(bytes_written as libc::socklen_t)
+            }
             _ => {
                 log_once_per_value_at_level!(
                     (level, optname),
@@ -947,11 +1008,28 @@ impl TcpSocket {
         &mut self,
         level: libc::c_int,
         optname: libc::c_int,
-        _optval_ptr: ForeignPtr<()>,
-        _optlen: libc::socklen_t,
-        _mem: &MemoryManager,
+        optval_ptr: ForeignPtr<()>,
+        optlen: libc::socklen_t,
+        mem: &MemoryManager,
     ) -> Result<(), SyscallError> {
         match (level, optname) {
+            (libc::SOL_SOCKET, libc::SO_PRIORITY) => {
+                type OptType = libc::c_int;
+
+                if usize::try_from(optlen).unwrap() < std::mem::size_of::<OptType>() {
+                    return Err(Errno::EINVAL.into());
+                }
+
+                let optval_ptr = optval_ptr.cast::<OptType>();
+                let val = mem.read(optval_ptr)?;
+
+                // linux requires CAP_NET_ADMIN to set a priority outside of this range
+                if !(0..=6).contains(&val) {
+                    return Err(Errno::EPERM.into());
+                }
+
+                self.send_priority = val.try_into().unwrap();
+            }
             (libc::SOL_SOCKET, libc::SO_REUSEADDR) => {
                 // TODO: implement this, tor and tgen use it
                 log::trace!("setsockopt SO_REUSEADDR not yet implemented");
@@ -1053,6 +1131,39 @@ fn tcp_error_to_errno(error: tcp::TcpError) -> Errno {
     }
 }
 
+/// Convert the tcp library's socket information to a linux `tcp_info`. Fields that the tcp library
+/// doesn't track (for example RTT estimates and congestion state) are left as 0.
+fn tcp_info(info: &tcp::TcpInfo) -> c::tcp_info {
+    // from linux's include/net/tcp_states.h
+    let state = match info.state {
+        tcp::TcpStateKind::Established => 1,
+        tcp::TcpStateKind::SynSent => 2,
+        tcp::TcpStateKind::SynReceived => 3,
+        tcp::TcpStateKind::FinWaitOne => 4,
+        tcp::TcpStateKind::FinWaitTwo => 5,
+        tcp::TcpStateKind::TimeWait => 6,
+        tcp::TcpStateKind::Init | tcp::TcpStateKind::Rst | tcp::TcpStateKind::Closed => 7,
+        tcp::TcpStateKind::CloseWait => 8,
+        tcp::TcpStateKind::LastAck => 9,
+        tcp::TcpStateKind::Listen => 10,
+        tcp::TcpStateKind::Closing => 11,
+    };
+
+    let mut rv: c::tcp_info = shadow_pod::zeroed();
+
+    rv.tcpi_state = state;
+    rv.set_tcpi_snd_wscale(info.send_window_scale);
+    rv.set_tcpi_rcv_wscale(info.recv_window_scale);
+    rv.tcpi_snd_mss = c::CONFIG_TCP_MAX_SEGMENT_SIZE;
+    rv.tcpi_rcv_mss = c::CONFIG_TCP_MAX_SEGMENT_SIZE;
+    rv.tcpi_advmss = c::CONFIG_TCP_MAX_SEGMENT_SIZE;
+    rv.tcpi_pmtu = c::CONFIG_MTU;
+    rv.tcpi_unacked = info.unacked;
+    rv.tcpi_rcv_space = info.recv_window;
+
+    rv
+}
+
 /// Shared state stored in timers. This allows us to update existing timers when a child `TcpState`
 /// is accept()ed and becomes owned by a new `TcpSocket` object.
 #[derive(Debug)]
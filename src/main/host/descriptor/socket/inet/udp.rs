@@ -24,16 +24,22 @@ use crate::host::memory_manager::MemoryManager;
 use crate::host::network::interface::FifoPacketPriority;
 use crate::host::network::namespace::{AssociationHandle, NetworkNamespace};
 use crate::host::syscall::io::{write_partial, IoVec, IoVecReader, IoVecWriter};
-use crate::host::syscall::types::SyscallError;
+use crate::host::syscall::types::{ForeignArrayPtr, SyscallError};
 use crate::network::packet::{PacketRc, PacketStatus};
 use crate::utility::callback_queue::CallbackQueue;
 use crate::utility::sockaddr::SockaddrStorage;
-use crate::utility::{HostTreePointer, ObjectCounter};
+use crate::utility::{HostTreePointer, ObjectCounter, ObjectType};
 
 /// Maximum size of a datagram we are allowed to send out over the network.
 // 65,535 (2^16 - 1) - 20 (ip header) - 8 (udp header)
 const CONFIG_DATAGRAM_MAX_SIZE: usize = 65507;
 
+/// The `UDP_SEGMENT` socket option and control message type (from linux/udp.h).
+const UDP_SEGMENT: libc::c_int = 103;
+
+/// Maximum number of datagrams that a single send can be split into when using `UDP_SEGMENT`.
+const UDP_MAX_SEGMENTS: usize = 64;
+
 pub struct UdpSocket {
     event_source: StateEventSource,
     status: FileStatus,
@@ -47,6 +53,11 @@ pub struct UdpSocket {
     /// The receive time of the last packet returned to the managed process during a call to
     /// `recvmsg()`. Used for `SIOCGSTAMP`.
     recv_time_of_last_read_packet: Option<EmulatedTime>,
+    /// The `SO_PRIORITY` socket option, used by the network interface's queuing discipline.
+    send_priority: u32,
+    /// The `UDP_SEGMENT` socket option. If non-zero, sends larger than this are split into
+    /// datagrams of this size. Can be overridden for each send with a control message.
+    gso_size: u16,
     // should only be used by `OpenFile` to make sure there is only ever one `OpenFile` instance for
     // this file
     has_open_file: bool,
@@ -70,8 +81,10 @@ impl UdpSocket {
             bound_addr: None,
             association: None,
             recv_time_of_last_read_packet: None,
+            send_priority: 0,
+            gso_size: 0,
             has_open_file: false,
-            _counter: ObjectCounter::new("UdpSocket"),
+            _counter: ObjectCounter::new(ObjectType::UdpSocket),
         };
 
         CallbackQueue::queue_and_run_with_legacy(|cb_queue| {
@@ -107,10 +120,41 @@ impl UdpSocket {
 
     pub fn push_in_packet(
         &mut self,
-        mut packet: PacketRc,
+        packet: &mut PacketRc,
         cb_queue: &mut CallbackQueue,
         recv_time: EmulatedTime,
     ) {
+        if self.buffer_in_packet(packet, recv_time) {
+            self.refresh_readable_writable(FileSignals::READ_BUFFER_GREW, cb_queue);
+        }
+    }
+
+    /// Like [`push_in_packet`](Self::push_in_packet) for each of the packets, but the socket's
+    /// state is only refreshed (and its listeners notified) once. Receiving packets doesn't change
+    /// the socket's associations, so all of the packets are accepted.
+    pub fn push_in_packets(
+        &mut self,
+        packets: &mut dyn Iterator<Item = &mut PacketRc>,
+        cb_queue: &mut CallbackQueue,
+        recv_time: EmulatedTime,
+    ) -> usize {
+        let mut num_pushed = 0;
+        let mut buffered = false;
+        for packet in packets {
+            buffered |= self.buffer_in_packet(packet, recv_time);
+            num_pushed += 1;
+        }
+
+        if buffered {
+            self.refresh_readable_writable(FileSignals::READ_BUFFER_GREW, cb_queue);
+        }
+
+        num_pushed
+    }
+
+    /// Add the packet's payload to the receive buffer without updating the socket's state. Returns
+    /// `true` if it was added.
+    fn buffer_in_packet(&mut self, packet: &mut PacketRc, recv_time: EmulatedTime) -> bool {
         packet.add_status(PacketStatus::RcvSocketProcessed);
 
         if let Some(peer_addr) = self.peer_addr {
@@ -130,7 +174,7 @@ impl UdpSocket {
                 // should add a test, and do another check when `recvmsg()` is called if we really
                 // need to.
 
-                return;
+                return false;
             }
         };
 
@@ -139,15 +183,13 @@ impl UdpSocket {
         // don't bother copying the bytes if we know the push will fail
         if !self.recv_buffer.has_space() {
             packet.add_status(PacketStatus::RcvSocketDropped);
-            return;
+            return false;
         }
 
         // in the future, the packet could contain the `Bytes` object itself and we could simply
         // transfer the `Bytes` directly from the packet to the buffer without copying the bytes
 
-        let mut message = BytesMut::zeroed(packet.payload_size());
-        let num_bytes_copied = packet.get_payload(&mut message);
-        assert_eq!(num_bytes_copied, packet.payload_size());
+        let message = Bytes::copy_from_slice(packet.payload());
 
         let header = MessageRecvHeader {
             src: packet.src_address(),
@@ -157,14 +199,12 @@ impl UdpSocket {
 
         // push the message to the receive buffer (shouldn't fail since we checked for available
         // space above)
-        self.recv_buffer
-            .push_message(message.freeze(), header)
-            .unwrap();
+        self.recv_buffer.push_message(message, header).unwrap();
 
         log::trace!("Added a packet to the UDP socket's recv buffer");
         packet.add_status(PacketStatus::RcvSocketBuffered);
 
-        self.refresh_readable_writable(FileSignals::READ_BUFFER_GREW, cb_queue);
+        true
     }
 
     pub fn pull_out_packet(&mut self, cb_queue: &mut CallbackQueue) -> Option<PacketRc> {
@@ -202,6 +242,11 @@ impl UdpSocket {
         !self.send_buffer.is_empty()
     }
 
+    /// The socket's `SO_PRIORITY` option.
+    pub fn send_priority(&self) -> u32 {
+        self.send_priority
+    }
+
     pub fn getsockname(&self) -> Result<Option<SockaddrIn>, Errno> {
         let mut addr = self
             .bound_addr
@@ -369,6 +414,24 @@ impl UdpSocket {
             return Err(linux_api::errno::Errno::EMSGSIZE.into());
         }
 
+        let gso_size = read_udp_segment_cmsg(args.control_ptr, mem)?.unwrap_or(socket_ref.gso_size);
+        let gso_size = usize::from(gso_size);
+
+        // the size of each datagram that we'll send
+        let segment_len = if gso_size != 0 && len > gso_size {
+            // these are the same checks as linux's `udp_send_skb()`
+            let max_gso_size = c::CONFIG_MTU - c::CONFIG_HEADER_SIZE_UDPIP;
+            if gso_size > usize::try_from(max_gso_size).unwrap() {
+                return Err(Errno::EINVAL.into());
+            }
+            if len > gso_size * UDP_MAX_SEGMENTS {
+                return Err(Errno::EINVAL.into());
+            }
+            gso_size
+        } else {
+            len
+        };
+
         // make sure that we're bound
         if socket_ref.bound_addr.is_some() {
             // we must have an association since we're bound
@@ -415,10 +478,7 @@ impl UdpSocket {
             reader
                 .read_exact(&mut message[..])
                 .map_err(|e| Errno::try_from(e).unwrap())?;
-
-            // get the priority that we'll assign to the eventual packet
-            let packet_priority =
-                Worker::with_active_host(|host| host.get_next_packet_priority()).unwrap();
+            let message = message.freeze();
 
             let src_addr = socket_ref.bound_addr.unwrap();
             let src_addr = if src_addr.ip().is_unspecified() {
@@ -433,29 +493,47 @@ impl UdpSocket {
                 src_addr
             };
 
-            let header = MessageSendHeader {
-                src: src_addr,
-                dst: dst_addr,
-                packet_priority,
-            };
+            // If the send buffer already had messages, then the socket is already queued on the
+            // network interface (or a notification is already pending), so there's no need to
+            // notify the host again. This saves a notification for each message after the first
+            // when using `sendmmsg()` or `UDP_SEGMENT`.
+            let needs_notify = socket_ref.send_buffer.is_empty();
+
+            // Split the message into datagrams (a zero-length send is still one datagram). The
+            // slices share the message's allocation.
+            let segments = (0..len.max(1)).step_by(segment_len.max(1)).map(|start| {
+                // get the priority that we'll assign to the eventual packet
+                let packet_priority =
+                    Worker::with_active_host(|host| host.get_next_packet_priority()).unwrap();
+
+                let header = MessageSendHeader {
+                    src: src_addr,
+                    dst: dst_addr,
+                    packet_priority,
+                };
+
+                let end = std::cmp::min(start + segment_len, len);
+                (message.slice(start..end), header)
+            });
 
-            // push the message to the send buffer (shouldn't fail since we checked for available
+            // push the messages to the send buffer (shouldn't fail since we checked for available
             // space above)
-            socket_ref
-                .send_buffer
-                .push_message(message.freeze(), header)
-                .unwrap();
+            if socket_ref.send_buffer.push_messages(segments).is_err() {
+                panic!("No space in the UDP socket's send buffer");
+            }
 
-            // notify the host that this socket has packets to send
-            let socket = Arc::clone(socket);
-            let interface_ip = *socket_ref.bound_addr.unwrap().ip();
-            cb_queue.add(move |_cb_queue| {
-                Worker::with_active_host(|host| {
-                    let socket = InetSocket::Udp(socket);
-                    host.notify_socket_has_packets(interface_ip, &socket);
-                })
-                .unwrap();
-            });
+            if needs_notify {
+                // notify the host that this socket has packets to send
+                let socket = Arc::clone(socket);
+                let interface_ip = *socket_ref.bound_addr.unwrap().ip();
+                cb_queue.add(move |_cb_queue| {
+                    Worker::with_active_host(|host| {
+                        let socket = InetSocket::Udp(socket);
+                        host.notify_socket_has_packets(interface_ip, &socket);
+                    })
+                    .unwrap();
+                });
+            }
 
             Ok(len)
         })();
@@ -474,6 +552,52 @@ impl UdpSocket {
         Ok(result?.try_into().unwrap())
     }
 
+    /// Queue a datagram to `dst` that was generated by Shadow rather than sent by a managed process,
+    /// so there is no process memory to copy the payload from. The socket must be bound. Returns
+    /// the message as an `Err` if there isn't space in the send buffer.
+    pub fn push_out_message(
+        socket: &Arc<AtomicRefCell<Self>>,
+        message: Bytes,
+        dst: SocketAddrV4,
+        cb_queue: &mut CallbackQueue,
+    ) -> Result<(), Bytes> {
+        let mut socket_ref = socket.borrow_mut();
+
+        let src = socket_ref.bound_addr.unwrap();
+        assert!(!src.ip().is_unspecified());
+
+        // the socket only needs to be queued on the network interface if it wasn't already
+        let needs_notify = socket_ref.send_buffer.is_empty();
+
+        let header = MessageSendHeader {
+            src,
+            dst,
+            packet_priority: Worker::with_active_host(|host| host.get_next_packet_priority())
+                .unwrap(),
+        };
+        socket_ref
+            .send_buffer
+            .push_message(message, header)
+            .map_err(|(message, _header)| message)?;
+
+        if needs_notify {
+            // notify the host that this socket has packets to send
+            let socket = Arc::clone(socket);
+            let interface_ip = *src.ip();
+            cb_queue.add(move |_cb_queue| {
+                Worker::with_active_host(|host| {
+                    let socket = InetSocket::Udp(socket);
+                    host.notify_socket_has_packets(interface_ip, &socket);
+                })
+                .unwrap();
+            });
+        }
+
+        socket_ref.refresh_readable_writable(FileSignals::empty(), cb_queue);
+
+        Ok(())
+    }
+
     pub fn recvmsg(
         socket: &Arc<AtomicRefCell<Self>>,
         args: RecvmsgArgs,
@@ -856,6 +980,22 @@ impl UdpSocket {
 
                 Ok(bytes_written as libc::socklen_t)
             }
+            (libc::SOL_SOCKET, libc::SO_PRIORITY) => {
+                let priority: libc::c_int = self.send_priority.try_into().unwrap();
+
+                let optval_ptr = optval_ptr.cast::<libc::c_int>();
+                let bytes_written = write_partial(mem, &priority, optval_ptr, optlen as usize)?;
+
+                Ok(bytes_written as libc::socklen_t)
+            }
+            (libc::SOL_UDP, UDP_SEGMENT) => {
+                let gso_size = libc::c_int::from(self.gso_size);
+
+                let optval_ptr = optval_ptr.cast::<libc::c_int>();
+                let bytes_written = write_partial(mem, &gso_size, optval_ptr, optlen as usize)?;
+
+                Ok(bytes_written as libc::socklen_t)
+            }
             (libc::SOL_SOCKET, _) => {
                 log_once_per_value_at_level!(
                     (level, optname),
@@ -940,6 +1080,23 @@ impl UdpSocket {
                 self.recv_buffer
                     .set_soft_limit_bytes(val.try_into().unwrap());
             }
+            (libc::SOL_SOCKET, libc::SO_PRIORITY) => {
+                type OptType = libc::c_int;
+
+                if usize::try_from(optlen).unwrap() < std::mem::size_of::<OptType>() {
+                    return Err(Errno::EINVAL.into());
+                }
+
+                let optval_ptr = optval_ptr.cast::<OptType>();
+                let val = mem.read(optval_ptr)?;
+
+                // linux requires CAP_NET_ADMIN to set a priority outside of this range
+                if !(0..=6).contains(&val) {
+                    return Err(Errno::EPERM.into());
+                }
+
+                self.send_priority = val.try_into().unwrap();
+            }
             (libc::SOL_SOCKET, libc::SO_REUSEADDR) => {
                 // TODO: implement this
                 warn_once_then_debug!("setsockopt SO_REUSEADDR not yet implemented for udp");
@@ -955,6 +1112,18 @@ impl UdpSocket {
                 warn_once_then_debug!("setsockopt SO_KEEPALIVE not yet implemented for udp");
                 return Err(Errno::ENOPROTOOPT.into());
             }
+            (libc::SOL_UDP, UDP_SEGMENT) => {
+                type OptType = libc::c_int;
+
+                if usize::try_from(optlen).unwrap() < std::mem::size_of::<OptType>() {
+                    return Err(Errno::EINVAL.into());
+                }
+
+                let optval_ptr = optval_ptr.cast::<OptType>();
+                let val = mem.read(optval_ptr)?;
+
+                self.gso_size = val.try_into().or(Err(Errno::EINVAL))?;
+            }
             (libc::SOL_SOCKET, libc::SO_BROADCAST) => {
                 // TODO: implement this, pkg.go.dev/net uses it
                 warn_once_then_debug!(
@@ -1051,6 +1220,54 @@ impl UdpSocket {
     }
 }
 
+/// Returns the segment size from a `UDP_SEGMENT` control message, if the control buffer of a
+/// `sendmsg()` call contains one. Other control messages are ignored.
+fn read_udp_segment_cmsg(
+    control: ForeignArrayPtr<u8>,
+    mem: &MemoryManager,
+) -> Result<Option<u16>, Errno> {
+    const HDR_LEN: usize = std::mem::size_of::<libc::cmsghdr>();
+
+    if control.is_null() {
+        return Ok(None);
+    }
+
+    let mut gso_size = None;
+    let mut offset = 0;
+
+    // walk the control messages in the same way as linux's `__cmsg_nxthdr()`
+    while offset + HDR_LEN <= control.len() {
+        let hdr: libc::cmsghdr = mem.read(control.slice(offset..).ptr().cast())?;
+        let cmsg_len = hdr.cmsg_len;
+
+        if cmsg_len < HDR_LEN || cmsg_len > control.len() - offset {
+            return Err(Errno::EINVAL);
+        }
+
+        if (hdr.cmsg_level, hdr.cmsg_type) == (libc::SOL_UDP, UDP_SEGMENT) {
+            if cmsg_len - HDR_LEN != std::mem::size_of::<u16>() {
+                return Err(Errno::EINVAL);
+            }
+            gso_size = Some(mem.read(control.slice(offset + HDR_LEN..).ptr().cast())?);
+        } else {
+            log_once_per_value_at_level!(
+                (hdr.cmsg_level, hdr.cmsg_type),
+                (i32, i32),
+                log::Level::Warn,
+                log::Level::Debug,
+                "Ignoring unsupported control message with level {} and type {}",
+                hdr.cmsg_level,
+                hdr.cmsg_type
+            );
+        }
+
+        // each control message is aligned in the same way as `CMSG_ALIGN()`
+        offset += cmsg_len.next_multiple_of(std::mem::size_of::<libc::c_long>());
+    }
+
+    Ok(gso_size)
+}
+
 /// Non-payload data for a message in the send buffer.
 #[derive(Debug)]
 struct MessageSendHeader {
@@ -1115,6 +1332,25 @@ impl<Hdr> MessageBuffer<Hdr> {
         Ok(())
     }
 
+    /// Push several messages to the buffer, for example the datagrams of a single `UDP_SEGMENT`
+    /// send. Like linux, the messages are accepted together if the buffer has space for at least
+    /// one more message. Returns the messages and headers as an `Err` if there wasn't enough space.
+    pub fn push_messages<I>(&mut self, messages: I) -> Result<(), I>
+    where
+        I: Iterator<Item = (Bytes, Hdr)>,
+    {
+        if !self.has_space() {
+            return Err(messages);
+        }
+
+        for (message, header) in messages {
+            self.len_bytes += message.len();
+            self.buffer.push_back((message, header));
+        }
+
+        Ok(())
+    }
+
     /// Pop the next message from the buffer. Returns a tuple of the message bytes and message
     /// header.
     pub fn pop_message(&mut self) -> Option<(Bytes, Hdr)> {
@@ -58,29 +58,8 @@ impl NetlinkSocket {
             let buffer = SharedBuf::new(usize::MAX);
             let buffer = Arc::new(AtomicRefCell::new(buffer));
 
-            // Get the IP address of the host
-            let default_ip = Worker::with_active_host(|host| host.default_ip()).unwrap();
-            // All the interface configurations are the same as in the getifaddrs function handler
-            let interfaces = vec![
-                Interface {
-                    address: Ipv4Addr::LOCALHOST,
-                    label: String::from("lo"),
-                    prefix_len: 8,
-                    if_type: Arphrd::Loopback,
-                    mtu: c::CONFIG_MTU,
-                    scope: RtScope::Host,
-                    index: 1,
-                },
-                Interface {
-                    address: default_ip,
-                    label: String::from("eth0"),
-                    prefix_len: 24,
-                    if_type: Arphrd::Ether,
-                    mtu: c::CONFIG_MTU,
-                    scope: RtScope::Universe,
-                    index: 2,
-                },
-            ];
+            // The responses don't change during the simulation, so they're built once per host
+            let dumps = Worker::with_active_host(|host| Arc::clone(host.netlink_dumps())).unwrap();
 
             let mut common = NetlinkSocketCommon {
                 buffer,
@@ -90,7 +69,7 @@ impl NetlinkSocket {
                 state: FileState::ACTIVE,
                 status,
                 has_open_file: false,
-                interfaces,
+                dumps,
             };
             let protocol_state = ProtocolState::new(&mut common, weak);
             let mut socket = Self {
@@ -783,9 +762,170 @@ impl InitialState {
             return self.handle_error(bytes);
         }
 
+        common.dumps.addr.response(nlmsg.nl_seq)
+    }
+
+    fn handle_ifinfomsg(&self, common: &mut NetlinkSocketCommon, bytes: &[u8]) -> Vec<u8> {
+        let Ok(nlmsg) = Nlmsghdr::<Rtm, Ifinfomsg>::from_bytes(&mut Cursor::new(bytes)) else {
+            log::warn!("Failed to deserialize the message");
+            return self.handle_error(bytes);
+        };
+
+        let Ok(ifinfomsg) = nlmsg.get_payload() else {
+            log::warn!("Failed to find the payload");
+            return self.handle_error(bytes);
+        };
+
+        // The only supported interface address family is AF_INET
+        if ifinfomsg.ifi_family != RtAddrFamily::Unspecified
+            && ifinfomsg.ifi_family != RtAddrFamily::Inet
+        {
+            warn_once_then_debug!(
+                "Unsupported ifi_family (only AF_UNSPEC and AF_INET are supported)"
+            );
+            return self.handle_error(bytes);
+        }
+
+        // The rest of the fields are unsupported. We limit only the interest to the zero values
+        if ifinfomsg.ifi_type != 0.into()
+            || ifinfomsg.ifi_index != 0
+            || ifinfomsg.ifi_flags != IffFlags::empty()
+        {
+            warn_once_then_debug!(
+                "Unsupported ifi_type, ifi_index, or ifi_flags (they have to be 0)"
+            );
+            return self.handle_error(bytes);
+        }
+
+        // We don't check for ifi_change because we found that `ip addr` sets it to zero even if
+        // rtnetlink(7) recommends to set it to all 1s
+
+        common.dumps.link.response(nlmsg.nl_seq)
+    }
+}
+
+impl ClosedState {
+    fn bound_address(&self) -> Result<Option<NetlinkAddr>, Errno> {
+        Ok(None)
+    }
+
+    fn refresh_file_state(
+        &self,
+        common: &mut NetlinkSocketCommon,
+        signals: FileSignals,
+        cb_queue: &mut CallbackQueue,
+    ) {
+        common.update_state(
+            /* mask= */ FileState::all(),
+            FileState::CLOSED,
+            signals,
+            cb_queue,
+        );
+    }
+
+    fn close(
+        self,
+        _common: &mut NetlinkSocketCommon,
+        _cb_queue: &mut CallbackQueue,
+    ) -> (ProtocolState, Result<(), SyscallError>) {
+        // why are we trying to close an already closed file? we probably want a bt here...
+        panic!("Trying to close an already closed socket");
+    }
+
+    fn bind(
+        &mut self,
+        _common: &mut NetlinkSocketCommon,
+        _socket: &Arc<AtomicRefCell<NetlinkSocket>>,
+        _addr: Option<&SockaddrStorage>,
+        _rng: impl rand::Rng,
+    ) -> Result<(), SyscallError> {
+        // We follow the same approach as UnixSocket
+        log::warn!("bind() while in state {}", std::any::type_name::<Self>());
+        Err(Errno::EOPNOTSUPP.into())
+    }
+
+    fn sendmsg(
+        &mut self,
+        _common: &mut NetlinkSocketCommon,
+        _socket: &Arc<AtomicRefCell<NetlinkSocket>>,
+        _args: SendmsgArgs,
+        _mem: &mut MemoryManager,
+        _cb_queue: &mut CallbackQueue,
+    ) -> Result<libc::ssize_t, SyscallError> {
+        // We follow the same approach as UnixSocket
+        log::warn!("sendmsg() while in state {}", std::any::type_name::<Self>());
+        Err(Errno::EOPNOTSUPP.into())
+    }
+
+    fn recvmsg(
+        &mut self,
+        _common: &mut NetlinkSocketCommon,
+        _socket: &Arc<AtomicRefCell<NetlinkSocket>>,
+        _args: RecvmsgArgs,
+        _mem: &mut MemoryManager,
+        _cb_queue: &mut CallbackQueue,
+    ) -> Result<RecvmsgReturn, SyscallError> {
+        // We follow the same approach as UnixSocket
+        log::warn!("recvmsg() while in state {}", std::any::type_name::<Self>());
+        Err(Errno::EOPNOTSUPP.into())
+    }
+}
+
+// The struct used to describe the network interface
+struct Interface {
+    address: Ipv4Addr,
+    label: String,
+    prefix_len: u8,
+    if_type: Arphrd,
+    mtu: u32,
+    scope: RtScope,
+    index: libc::c_int,
+}
+
+/// The responses to the RTM_GETLINK and RTM_GETADDR requests that we support. A host's interfaces
+/// don't change during the simulation, so these are serialized once when the host is created and
+/// each request is served from a copy of the cached bytes.
+pub struct NetlinkDumps {
+    link: NetlinkDump,
+    addr: NetlinkDump,
+}
+
+impl NetlinkDumps {
+    pub fn new(default_ip: Ipv4Addr) -> Self {
+        // All the interface configurations are the same as in the getifaddrs function handler
+        let interfaces = [
+            Interface {
+                address: Ipv4Addr::LOCALHOST,
+                label: String::from("lo"),
+                prefix_len: 8,
+                if_type: Arphrd::Loopback,
+                mtu: c::CONFIG_MTU,
+                scope: RtScope::Host,
+                index: 1,
+            },
+            Interface {
+                address: default_ip,
+                label: String::from("eth0"),
+                prefix_len: 24,
+                if_type: Arphrd::Ether,
+                mtu: c::CONFIG_MTU,
+                scope: RtScope::Universe,
+                index: 2,
+            },
+        ];
+
+        Self {
+            link: Self::build_link(&interfaces),
+            addr: Self::build_addr(&interfaces),
+        }
+    }
+
+    /// The RTM_NEWADDR messages for each interface, followed by NLMSG_DONE.
+    fn build_addr(interfaces: &[Interface]) -> NetlinkDump {
         let mut buffer = Cursor::new(Vec::new());
+        let mut msg_offsets = Vec::new();
         // Send the interface addresses
-        for interface in &common.interfaces {
+        for interface in interfaces {
             let address = interface.address.octets();
             let broadcast = Ipv4Addr::from(
                 0xffff_ffff_u32
@@ -821,12 +961,13 @@ impl InitialState {
                 let nl_type = Rtm::Newaddr;
                 // The NLM_F_MULTI flag is used to indicate that we will send multiple messages
                 let flags = NlmFFlags::new(&[NlmF::Multi]);
-                // Use the same sequence number as the request
-                let seq = Some(nlmsg.nl_seq);
+                // The sequence number is set to the request's when the response is sent
+                let seq = Some(0);
                 let pid = None;
                 let payload = NlPayload::Payload(ifaddrmsg);
                 Nlmsghdr::new(len, nl_type, flags, seq, pid, payload)
             };
+            msg_offsets.push(buffer.position());
             nlmsg.to_bytes(&mut buffer).unwrap();
         }
         // After sending the messages with the NLM_F_MULTI flag set, we need to send the NLMSG_DONE message
@@ -834,8 +975,8 @@ impl InitialState {
             let len = None;
             let nl_type = Nlmsg::Done;
             let flags = NlmFFlags::new(&[NlmF::Multi]);
-            // Use the same sequence number as the request
-            let seq = Some(nlmsg.nl_seq);
+            // The sequence number is set to the request's when the response is sent
+            let seq = Some(0);
             let pid = None;
             // Linux also emits the errno of zero after the header. See `strace ip addr`
             // For documentation reference, see https://git.kernel.org/pub/scm/linux/kernel/git/torvalds/linux.git/tree/Documentation/userspace-api/netlink/intro.rst?h=v6.2#n232
@@ -843,49 +984,18 @@ impl InitialState {
             let payload: NlPayload<Nlmsg, u32> = NlPayload::Payload(0);
             Nlmsghdr::new(len, nl_type, flags, seq, pid, payload)
         };
+        msg_offsets.push(buffer.position());
         done_msg.to_bytes(&mut buffer).unwrap();
 
-        buffer.into_inner()
+        NetlinkDump::new(buffer.into_inner(), msg_offsets)
     }
 
-    fn handle_ifinfomsg(&self, common: &mut NetlinkSocketCommon, bytes: &[u8]) -> Vec<u8> {
-        let Ok(nlmsg) = Nlmsghdr::<Rtm, Ifinfomsg>::from_bytes(&mut Cursor::new(bytes)) else {
-            log::warn!("Failed to deserialize the message");
-            return self.handle_error(bytes);
-        };
-
-        let Ok(ifinfomsg) = nlmsg.get_payload() else {
-            log::warn!("Failed to find the payload");
-            return self.handle_error(bytes);
-        };
-
-        // The only supported interface address family is AF_INET
-        if ifinfomsg.ifi_family != RtAddrFamily::Unspecified
-            && ifinfomsg.ifi_family != RtAddrFamily::Inet
-        {
-            warn_once_then_debug!(
-                "Unsupported ifi_family (only AF_UNSPEC and AF_INET are supported)"
-            );
-            return self.handle_error(bytes);
-        }
-
-        // The rest of the fields are unsupported. We limit only the interest to the zero values
-        if ifinfomsg.ifi_type != 0.into()
-            || ifinfomsg.ifi_index != 0
-            || ifinfomsg.ifi_flags != IffFlags::empty()
-        {
-            warn_once_then_debug!(
-                "Unsupported ifi_type, ifi_index, or ifi_flags (they have to be 0)"
-            );
-            return self.handle_error(bytes);
-        }
-
-        // We don't check for ifi_change because we found that `ip addr` sets it to zero even if
-        // rtnetlink(7) recommends to set it to all 1s
-
+    /// The RTM_NEWLINK messages for each interface, followed by NLMSG_DONE.
+    fn build_link(interfaces: &[Interface]) -> NetlinkDump {
         let mut buffer = Cursor::new(Vec::new());
+        let mut msg_offsets = Vec::new();
         // Send the interface addresses
-        for interface in &common.interfaces {
+        for interface in interfaces {
             let mut label = Vec::from(interface.label.as_bytes());
             label.push(0); // Null-terminate
 
@@ -923,12 +1033,13 @@ impl InitialState {
                 let nl_type = Rtm::Newlink;
                 // The NLM_F_MULTI flag is used to indicate that we will send multiple messages
                 let flags = NlmFFlags::new(&[NlmF::Multi]);
-                // Use the same sequence number as the request
-                let seq = Some(nlmsg.nl_seq);
+                // The sequence number is set to the request's when the response is sent
+                let seq = Some(0);
                 let pid = None;
                 let payload = NlPayload::Payload(ifinfomsg);
                 Nlmsghdr::new(len, nl_type, flags, seq, pid, payload)
             };
+            msg_offsets.push(buffer.position());
             nlmsg.to_bytes(&mut buffer).unwrap();
         }
         // After sending the messages with the NLM_F_MULTI flag set, we need to send the NLMSG_DONE message
@@ -936,8 +1047,8 @@ impl InitialState {
             let len = None;
             let nl_type = Nlmsg::Done;
             let flags = NlmFFlags::new(&[NlmF::Multi]);
-            // Use the same sequence number as the request
-            let seq = Some(nlmsg.nl_seq);
+            // The sequence number is set to the request's when the response is sent
+            let seq = Some(0);
             let pid = None;
             // Linux also emits the errno of zero after the header. See `strace ip addr`
             // For documentation reference, see https://git.kernel.org/pub/scm/linux/kernel/git/torvalds/linux.git/tree/Documentation/userspace-api/netlink/intro.rst?h=v6.2#n232
@@ -945,90 +1056,40 @@ impl InitialState {
             let payload: NlPayload<Nlmsg, u32> = NlPayload::Payload(0);
             Nlmsghdr::new(len, nl_type, flags, seq, pid, payload)
         };
+        msg_offsets.push(buffer.position());
         done_msg.to_bytes(&mut buffer).unwrap();
 
-        buffer.into_inner()
+        NetlinkDump::new(buffer.into_inner(), msg_offsets)
     }
 }
 
-impl ClosedState {
-    fn bound_address(&self) -> Result<Option<NetlinkAddr>, Errno> {
-        Ok(None)
-    }
-
-    fn refresh_file_state(
-        &self,
-        common: &mut NetlinkSocketCommon,
-        signals: FileSignals,
-        cb_queue: &mut CallbackQueue,
-    ) {
-        common.update_state(
-            /* mask= */ FileState::all(),
-            FileState::CLOSED,
-            signals,
-            cb_queue,
-        );
-    }
-
-    fn close(
-        self,
-        _common: &mut NetlinkSocketCommon,
-        _cb_queue: &mut CallbackQueue,
-    ) -> (ProtocolState, Result<(), SyscallError>) {
-        // why are we trying to close an already closed file? we probably want a bt here...
-        panic!("Trying to close an already closed socket");
-    }
+/// A serialized multipart response.
+struct NetlinkDump {
+    bytes: Vec<u8>,
+    /// The offsets of the `nlmsg_seq` field of each message in `bytes`.
+    seq_offsets: Vec<usize>,
+}
 
-    fn bind(
-        &mut self,
-        _common: &mut NetlinkSocketCommon,
-        _socket: &Arc<AtomicRefCell<NetlinkSocket>>,
-        _addr: Option<&SockaddrStorage>,
-        _rng: impl rand::Rng,
-    ) -> Result<(), SyscallError> {
-        // We follow the same approach as UnixSocket
-        log::warn!("bind() while in state {}", std::any::type_name::<Self>());
-        Err(Errno::EOPNOTSUPP.into())
+impl NetlinkDump {
+    /// `msg_offsets` are the offsets of the start of each message in `bytes`.
+    fn new(bytes: Vec<u8>, msg_offsets: Vec<u64>) -> Self {
+        let seq_offsets = msg_offsets
+            .into_iter()
+            .map(|x| usize::try_from(x).unwrap() + memoffset::offset_of!(nlmsghdr, nlmsg_seq))
+            .collect();
+        Self { bytes, seq_offsets }
     }
 
-    fn sendmsg(
-        &mut self,
-        _common: &mut NetlinkSocketCommon,
-        _socket: &Arc<AtomicRefCell<NetlinkSocket>>,
-        _args: SendmsgArgs,
-        _mem: &mut MemoryManager,
-        _cb_queue: &mut CallbackQueue,
-    ) -> Result<libc::ssize_t, SyscallError> {
-        // We follow the same approach as UnixSocket
-        log::warn!("sendmsg() while in state {}", std::any::type_name::<Self>());
-        Err(Errno::EOPNOTSUPP.into())
-    }
-
-    fn recvmsg(
-        &mut self,
-        _common: &mut NetlinkSocketCommon,
-        _socket: &Arc<AtomicRefCell<NetlinkSocket>>,
-        _args: RecvmsgArgs,
-        _mem: &mut MemoryManager,
-        _cb_queue: &mut CallbackQueue,
-    ) -> Result<RecvmsgReturn, SyscallError> {
-        // We follow the same approach as UnixSocket
-        log::warn!("recvmsg() while in state {}", std::any::type_name::<Self>());
-        Err(Errno::EOPNOTSUPP.into())
+    /// A copy of the response with the sequence number of each message set to `seq`.
+    fn response(&self, seq: u32) -> Vec<u8> {
+        let mut bytes = self.bytes.clone();
+        for offset in &self.seq_offsets {
+            bytes[*offset..][..std::mem::size_of::<u32>()].copy_from_slice(&seq.to_ne_bytes());
+        }
+        bytes
     }
 }
 
-// The struct used to describe the network interface
-struct Interface {
-    address: Ipv4Addr,
-    label: String,
-    prefix_len: u8,
-    if_type: Arphrd,
-    mtu: u32,
-    scope: RtScope,
-    index: libc::c_int,
-}
-
 /// Common data and functionality that is useful for all states.
 struct NetlinkSocketCommon {
     buffer: Arc<AtomicRefCell<SharedBuf>>,
@@ -1042,8 +1103,8 @@ struct NetlinkSocketCommon {
     // should only be used by `OpenFile` to make sure there is only ever one `OpenFile` instance for
     // this file
     has_open_file: bool,
-    /// Interfaces
-    interfaces: Vec<Interface>,
+    /// The host's RTM_GETLINK and RTM_GETADDR responses.
+    dumps: Arc<NetlinkDumps>,
 }
 
 impl NetlinkSocketCommon {
@@ -0,0 +1,279 @@
+/*
+ * The Shadow Simulator
+ * See LICENSE for licensing information
+ */
+
+#include "main/host/descriptor/stat_cache.h"
+
+#include <errno.h>
+#include <glib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include "lib/logger/logger.h"
+#include "main/utility/utility.h"
+
+typedef enum _StatCacheOp {
+    STAT_CACHE_OP_STAT = 's',
+    STAT_CACHE_OP_STATX = 'x',
+    STAT_CACHE_OP_ACCESS = 'a',
+    STAT_CACHE_OP_READLINK = 'l',
+} StatCacheOp;
+
+typedef struct _StatCacheEntry {
+    /* 0 or a negative errno, or the length of the link target for readlink. */
+    ssize_t result;
+    /* Only valid if result is non-negative. */
+    union {
+        struct stat st;
+#ifdef SYS_statx
+        struct statx stx;
+#endif
+        char* target;
+    };
+    StatCacheOp op;
+} StatCacheEntry;
+
+struct _StatCache {
+    /* Absolute paths of the trees, without a trailing '/'. The root is the
+     * empty string. */
+    char** prefixes;
+    size_t numPrefixes;
+    /* Entries are only ever added, so lookups only need a read lock. */
+    GRWLock lock;
+    /* Maps a key string of the operation, its arguments, and the path to a
+     * StatCacheEntry. */
+    GHashTable* entries;
+    MAGIC_DECLARE;
+};
+
+static void _statcacheentry_free(StatCacheEntry* entry) {
+    if (entry->op == STAT_CACHE_OP_READLINK && entry->result >= 0) {
+        g_free(entry->target);
+    }
+    g_free(entry);
+}
+
+StatCache* statcache_new(const char* const* prefixes, size_t numPrefixes) {
+    StatCache* cache = g_new0(StatCache, 1);
+    MAGIC_INIT(cache);
+
+    cache->prefixes = g_new0(char*, numPrefixes);
+    cache->numPrefixes = numPrefixes;
+    for (size_t i = 0; i < numPrefixes; i++) {
+        utility_alwaysAssert(prefixes[i][0] == '/');
+        size_t len = strlen(prefixes[i]);
+        while (len > 0 && prefixes[i][len - 1] == '/') {
+            len--;
+        }
+        cache->prefixes[i] = g_strndup(prefixes[i], len);
+    }
+
+    g_rw_lock_init(&cache->lock);
+    cache->entries = g_hash_table_new_full(
+        g_str_hash, g_str_equal, g_free, (GDestroyNotify)_statcacheentry_free);
+
+    return cache;
+}
+
+void statcache_free(StatCache* cache) {
+    MAGIC_ASSERT(cache);
+
+    g_hash_table_destroy(cache->entries);
+    g_rw_lock_clear(&cache->lock);
+    for (size_t i = 0; i < cache->numPrefixes; i++) {
+        g_free(cache->prefixes[i]);
+    }
+    g_free(cache->prefixes);
+
+    MAGIC_CLEAR(cache);
+    g_free(cache);
+}
+
+bool statcache_isCacheable(const StatCache* cache, const char* path) {
+    MAGIC_ASSERT(cache);
+
+    if (path[0] != '/') {
+        return false;
+    }
+
+    /* Reject "." and ".." components, but not names that only start with a dot. */
+    for (const char* c = strstr(path, "/."); c != NULL; c = strstr(c + 1, "/.")) {
+        if (c[2] == '\0' || c[2] == '/' || (c[2] == '.' && (c[3] == '\0' || c[3] == '/'))) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < cache->numPrefixes; i++) {
+        const char* prefix = cache->prefixes[i];
+        size_t len = strlen(prefix);
+        if (strncmp(path, prefix, len) == 0 && (path[len] == '\0' || path[len] == '/')) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Errors that depend only on the tree, and so are the same for every lookup. */
+static bool _statcache_isCacheableResult(ssize_t result) {
+    switch (result) {
+        case -ENOENT:
+        case -ENOTDIR:
+        case -EACCES:
+        case -ELOOP:
+        case -ENAMETOOLONG:
+        case -EINVAL: return true;
+        default: return result >= 0;
+    }
+}
+
+static char* _statcache_getKey(StatCacheOp op, const char* path, int arg1, unsigned int arg2) {
+    return g_strdup_printf("%c%x.%x:%s", (char)op, (unsigned int)arg1, arg2, path);
+}
+
+/* Returns a copy of the entry for the key, with the lock released. Returns
+ * false if there's no entry. */
+static bool _statcache_get(StatCache* cache, StatCacheOp op, const char* path, int arg1,
+                           unsigned int arg2, StatCacheEntry* entryOut, char* buf,
+                           size_t bufSize) {
+    MAGIC_ASSERT(cache);
+
+    char* key = _statcache_getKey(op, path, arg1, arg2);
+
+    g_rw_lock_reader_lock(&cache->lock);
+
+    const StatCacheEntry* entry = g_hash_table_lookup(cache->entries, key);
+    if (entry != NULL) {
+        *entryOut = *entry;
+        if (op == STAT_CACHE_OP_READLINK && entry->result >= 0) {
+            /* The target may be freed once the lock is released. */
+            entryOut->result = MIN((size_t)entry->result, bufSize);
+            memcpy(buf, entry->target, entryOut->result);
+            entryOut->target = NULL;
+        }
+    }
+
+    g_rw_lock_reader_unlock(&cache->lock);
+
+    g_free(key);
+    return entry != NULL;
+}
+
+/* Takes ownership of the entry. */
+static void _statcache_put(StatCache* cache, const char* path, int arg1, unsigned int arg2,
+                           StatCacheEntry* entry) {
+    MAGIC_ASSERT(cache);
+
+    if (!_statcache_isCacheableResult(entry->result)) {
+        _statcacheentry_free(entry);
+        return;
+    }
+
+    char* key = _statcache_getKey(entry->op, path, arg1, arg2);
+
+    g_rw_lock_writer_lock(&cache->lock);
+    /* Another host may have stored the same result first; keep the older
+     * entry, since readers may have copied from it. */
+    if (!g_hash_table_contains(cache->entries, key)) {
+        trace("Caching metadata lookup %s with result %zd", key, entry->result);
+        g_hash_table_insert(cache->entries, key, entry);
+        key = NULL;
+        entry = NULL;
+    }
+    g_rw_lock_writer_unlock(&cache->lock);
+
+    if (key != NULL) {
+        g_free(key);
+        _statcacheentry_free(entry);
+    }
+}
+
+bool statcache_getStat(StatCache* cache, const char* path, int flags, struct stat* statbuf,
+                       int* result) {
+    StatCacheEntry entry;
+    if (!_statcache_get(cache, STAT_CACHE_OP_STAT, path, flags, 0, &entry, NULL, 0)) {
+        return false;
+    }
+    if (entry.result == 0) {
+        *statbuf = entry.st;
+    }
+    *result = entry.result;
+    return true;
+}
+
+void statcache_putStat(StatCache* cache, const char* path, int flags, const struct stat* statbuf,
+                       int result) {
+    StatCacheEntry* entry = g_new0(StatCacheEntry, 1);
+    entry->op = STAT_CACHE_OP_STAT;
+    entry->result = result;
+    if (result == 0) {
+        entry->st = *statbuf;
+    }
+    _statcache_put(cache, path, flags, 0, entry);
+}
+
+bool statcache_getAccess(StatCache* cache, const char* path, int mode, int flags, int* result) {
+    StatCacheEntry entry;
+    if (!_statcache_get(cache, STAT_CACHE_OP_ACCESS, path, mode, flags, &entry, NULL, 0)) {
+        return false;
+    }
+    *result = entry.result;
+    return true;
+}
+
+void statcache_putAccess(StatCache* cache, const char* path, int mode, int flags, int result) {
+    StatCacheEntry* entry = g_new0(StatCacheEntry, 1);
+    entry->op = STAT_CACHE_OP_ACCESS;
+    entry->result = result;
+    _statcache_put(cache, path, mode, flags, entry);
+}
+
+bool statcache_getReadlink(StatCache* cache, const char* path, char* buf, size_t bufSize,
+                           ssize_t* result) {
+    StatCacheEntry entry;
+    if (!_statcache_get(cache, STAT_CACHE_OP_READLINK, path, 0, 0, &entry, buf, bufSize)) {
+        return false;
+    }
+    *result = entry.result;
+    return true;
+}
+
+void statcache_putReadlink(StatCache* cache, const char* path, const char* target,
+                           ssize_t result) {
+    StatCacheEntry* entry = g_new0(StatCacheEntry, 1);
+    entry->op = STAT_CACHE_OP_READLINK;
+    entry->result = result;
+    if (result >= 0) {
+        entry->target = g_strndup(target, result);
+    }
+    _statcache_put(cache, path, 0, 0, entry);
+}
+
+#ifdef SYS_statx
+bool statcache_getStatx(StatCache* cache, const char* path, int flags, unsigned int mask,
+                        struct statx* statxbuf, int* result) {
+    StatCacheEntry entry;
+    if (!_statcache_get(cache, STAT_CACHE_OP_STATX, path, flags, mask, &entry, NULL, 0)) {
+        return false;
+    }
+    if (entry.result == 0) {
+        *statxbuf = entry.stx;
+    }
+    *result = entry.result;
+    return true;
+}
+
+void statcache_putStatx(StatCache* cache, const char* path, int flags, unsigned int mask,
+                        const struct statx* statxbuf, int result) {
+    StatCacheEntry* entry = g_new0(StatCacheEntry, 1);
+    entry->op = STAT_CACHE_OP_STATX;
+    entry->result = result;
+    if (result == 0) {
+        entry->stx = *statxbuf;
+    }
+    _statcache_put(cache, path, flags, mask, entry);
+}
+#endif
@@ -0,0 +1,65 @@
+/*
+ * The Shadow Simulator
+ * See LICENSE for licensing information
+ */
+
+#ifndef SRC_MAIN_HOST_DESCRIPTOR_STAT_CACHE_H_
+#define SRC_MAIN_HOST_DESCRIPTOR_STAT_CACHE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+
+/* A cache of file metadata lookups in read-only directory trees, shared by all
+ * hosts. The first lookup of a path with a given operation and flags is made
+ * with a syscall as usual, and its result (including most errors) is stored.
+ * Later lookups of it from any host are answered from the cache.
+ *
+ * Entries are never invalidated, so the trees must not change during the
+ * simulation, and neither may anything that their symlinks point to.
+ *
+ * All functions are thread-safe. */
+typedef struct _StatCache StatCache;
+
+/* Creates a cache for the paths under the `numPrefixes` absolute paths in
+ * `prefixes`. */
+StatCache* statcache_new(const char* const* prefixes, size_t numPrefixes);
+void statcache_free(StatCache* cache);
+
+/* Whether lookups of the absolute path `path` can be cached: the path is in
+ * one of the cache's trees, and has no "." or ".." components that could make
+ * it leave the tree. */
+bool statcache_isCacheable(const StatCache* cache, const char* path);
+
+/* Each lookup function returns true if the result of the lookup is cached, and
+ * writes the result (0 or a negative errno, or the length of the link target
+ * for readlink) to `result`. The result of a lookup that isn't cached should
+ * be passed to the corresponding store function. A store of a result that
+ * shouldn't be cached, such as EINTR, is ignored. */
+
+bool statcache_getStat(StatCache* cache, const char* path, int flags, struct stat* statbuf,
+                       int* result);
+void statcache_putStat(StatCache* cache, const char* path, int flags, const struct stat* statbuf,
+                       int result);
+
+bool statcache_getAccess(StatCache* cache, const char* path, int mode, int flags, int* result);
+void statcache_putAccess(StatCache* cache, const char* path, int mode, int flags, int result);
+
+/* Copies up to `bufSize` bytes of the link target to `buf`. The result is the
+ * number of bytes copied, like for readlink. */
+bool statcache_getReadlink(StatCache* cache, const char* path, char* buf, size_t bufSize,
+                           ssize_t* result);
+/* `target` is the complete link target if `result` is non-negative. */
+void statcache_putReadlink(StatCache* cache, const char* path, const char* target,
+                           ssize_t result);
+
+#ifdef SYS_statx
+bool statcache_getStatx(StatCache* cache, const char* path, int flags, unsigned int mask,
+                        struct statx* statxbuf, int* result);
+void statcache_putStatx(StatCache* cache, const char* path, int flags, unsigned int mask,
+                        const struct statx* statxbuf, int result);
+#endif
+
+#endif /* SRC_MAIN_HOST_DESCRIPTOR_STAT_CACHE_H_ */
@@ -26,6 +26,7 @@
 #include "main/host/descriptor/descriptor.h"
 #include "main/host/descriptor/socket.h"
 #include "main/host/descriptor/tcp_cong.h"
+#include "main/host/descriptor/tcp_cong_cubic.h"
 #include "main/host/descriptor/tcp_cong_reno.h"
 #include "main/host/descriptor/tcp_retransmit_tally.h"
 #include "main/host/protocol.h"
@@ -84,13 +85,36 @@ enum TCPReceiveState {
     TCPRS_LOSS = 2,
 };
 
+/* Packets indexed by their sequence number, used both for sent packets that have yet to be
+ * acknowledged and for received packets that are waiting for earlier ones. Legacy TCP sequence
+ * numbers count packets rather than bytes, so each sequence number maps to at most one packet and
+ * the queue is a ring of slots starting at the lowest queued sequence number. */
+typedef struct _TCPSequenceQueue TCPSequenceQueue;
+struct _TCPSequenceQueue {
+    /* owned packet references, or NULL for sequence numbers that aren't queued; not allocated
+     * until the first packet is queued */
+    Packet** slots;
+    /* always 0 or a power of two */
+    gsize capacity;
+    /* the slot holding sequence number `first` */
+    gsize head;
+    /* the lowest queued sequence number; only meaningful if `span` > 0 */
+    guint32 first;
+    /* the number of sequence numbers from `first` through the highest queued sequence number */
+    guint32 span;
+    /* the number of queued packets */
+    gsize length;
+};
+
 typedef struct _TCPChild TCPChild;
 struct _TCPChild {
     enum TCPChildState state;
-    guint key; /* hash(peerIP, peerPort) */
+    guint64 key; /* _ipPortKey(peerIP, peerPort) */
     TCP* parent;
     /* the handle to return when the socket is accepted */
     int handle;
+    /* our node in the parent's pending queue, so that queuing us doesn't allocate */
+    GList pendingLink;
     MAGIC_DECLARE;
 };
 
@@ -100,8 +124,8 @@ struct _TCPServer {
     pid_t processForChildren;
     /* all children of this server */
     GHashTable* children;
-    /* pending children to accept in order. */
-    GQueue *pending;
+    /* pending children to accept in order, linked through their pendingLink */
+    GQueue pending;
     /* maximum number of pending connections (capped at SHADOW_SOMAXCONN) */
     guint pendingMax;
     guint pendingCount;
@@ -113,6 +137,17 @@ struct _TCPServer {
     MAGIC_DECLARE;
 };
 
+/* The most blocks of out-of-order data we remember for selective ACKs. Only the lowest
+ * PACKET_TCP_MAX_SACK_BLOCKS of them are sent. */
+#define TCP_SACK_SCOREBOARD_MAX_BLOCKS 16
+
+typedef struct _TCPSackScoreboard TCPSackScoreboard;
+struct _TCPSackScoreboard {
+    /* sorted, disjoint, and non-adjacent blocks of received sequence numbers */
+    PacketTCPSackBlock blocks[TCP_SACK_SCOREBOARD_MAX_BLOCKS];
+    guint numBlocks;
+};
+
 static void _tcp_logCongestionInfo(TCP* tcp);
 
 struct _TCP {
@@ -173,20 +208,23 @@ struct _TCP {
         guint32 numQuickACKsSent;
         gboolean delayedACKIsScheduled;
         guint32 delayedACKCounter;
-        /* list of selective ACKs, packets received after a missing packet */
-        GList* selectiveACKs;
+        /* the task that sends a delayed ACK, created once and rescheduled for each delayed ACK */
+        TaskRef* delayedACKTask;
+        /* selective ACKs, packets received after a missing packet */
+        TCPSackScoreboard selectiveACKs;
     } send;
 
     struct {
         /* TCP provides reliable transport, keep track of packets until they are acked */
-        GHashTable* queue;
+        TCPSequenceQueue queue;
         /* track amount of queued application data */
         gsize queueLength;
         /* retransmission timeout value (rto), in milliseconds */
         gint timeout;
-        /* when the scheduled timer events will expire; empty if no retransmit is scheduled */
-        PriorityQueue* scheduledTimerExpirations;
-        /* our updated expiration time, to determine if previous events are still valid */
+        /* when our timer task will run; 0 if none is scheduled. stale tasks that were scheduled
+         * before an earlier one replaced it run at a different time, and are ignored */
+        CSimulationTime scheduledTimerExpiration;
+        /* our updated expiration time, to determine if the scheduled task is still valid */
         CSimulationTime desiredTimerExpiration;
         /* number of times we backed off due to congestion */
         guint backoffCount;
@@ -203,16 +241,42 @@ struct _TCP {
         gsize bytesCopied;
         CEmulatedTime lastAdjustment;
         gsize space;
+        /* the host's bandwidth, which doesn't change during the simulation */
+        gsize bandwidthDownBytes;
+        gsize bandwidthUpBytes;
     } autotune;
 
     /* congestion object for implementing different types of congestion control (aimd, reno, cubic) */
     TCPCong cong;
+    TCPCongestionType congestionType;
 
     struct {
       gint rttSmoothed;
       gint rttVariance;
     } timing;
 
+    /* paces data packets from a bottleneck bandwidth and min rtt model, as in BBR */
+    struct {
+        gboolean isEnabled;
+        /* the most recent delivery rate samples, in bytes per second; btlbw is their max */
+        gdouble deliveryRates[CONFIG_TCP_PACING_RATE_SAMPLES];
+        guint nextDeliveryRate;
+        /* bytes acked since the current delivery rate sample started */
+        gsize sampleDelivered;
+        gboolean sampleIsStarted;
+        CSimulationTime sampleStart;
+        /* smallest rtt seen within the last CONFIG_TCP_PACING_MIN_RTT_WINDOW */
+        CSimulationTime minRTT;
+        CSimulationTime minRTTStamp;
+        /* the earliest time the next data packet may be sent */
+        CSimulationTime nextSendTime;
+        gboolean flushIsScheduled;
+    } pacing;
+
+    /* the number of MSS-sized segments of data that may be sent in a single packet; packets are
+     * still the unit of sequence numbers, windows, and acks */
+    guint segmentsPerPacket;
+
     /* TODO: these should probably be stamped when the network interface sends
      * instead of when the tcp layer sends down to the socket layer */
     struct {
@@ -230,7 +294,7 @@ struct _TCP {
     gsize throttledOutputLength;
 
     /* TCP ensures that the user receives data in-order */
-    PriorityQueue* unorderedInput;
+    TCPSequenceQueue unorderedInput;
     /* track amount of queued application data */
     gsize unorderedInputLength;
 
@@ -260,19 +324,9 @@ static void _rswlog(const TCP *tcp, const char *format, ...) {
 #endif // RSWLOG
 }
 
-static guint _ipPortHash(in_addr_t ip, in_port_t port) {
-    GString* buffer = g_string_new(NULL);
-    g_string_printf(buffer, "%u:%u", ip, port);
-    guint hash_value = g_str_hash(buffer->str);
-    g_string_free(buffer, TRUE);
-    return hash_value;
-}
-
-static gint _simulationTimeCompare(const CSimulationTime* value1, const CSimulationTime* value2,
-                                   gpointer userData) {
-    utility_debugAssert(value1 && value2);
-    /* return neg if first before second, pos if second before first, 0 if equal */
-    return (*value1) == (*value2) ? 0 : (*value1) < (*value2) ? -1 : +1;
+/* Returns a key that is unique for each ip and port, for looking up children. */
+static guint64 _ipPortKey(in_addr_t ip, in_port_t port) {
+    return ((guint64)ip << 16) | port;
 }
 
 static void _tcp_flush(TCP* tcp, const Host* host);
@@ -292,7 +346,7 @@ static TCPChild* _tcpchild_new(TCP* tcp, TCP* parent, int handle, in_addr_t peer
     MAGIC_INIT(child);
 
     /* my parent can find me by my key */
-    child->key = _ipPortHash(peerIP, peerPort);
+    child->key = _ipPortKey(peerIP, peerPort);
 
     legacyfile_ref(parent);
     child->parent = parent;
@@ -301,6 +355,7 @@ static TCPChild* _tcpchild_new(TCP* tcp, TCP* parent, int handle, in_addr_t peer
     legacysocket_setPeerName(&(tcp->super), peerIP, peerPort);
 
     child->handle = handle;
+    child->pendingLink.data = tcp;
 
     /* the child is bound to the parent server's address, because all packets
      * coming from the child should appear to be coming from the server itself */
@@ -320,6 +375,14 @@ static void _tcpchild_free(TCPChild* child) {
     MAGIC_ASSERT(child->parent);
     MAGIC_ASSERT(child->parent->server);
 
+    /* a child that was never accepted no longer counts towards the backlog */
+    if (child->state == TCPCS_PENDING) {
+        g_queue_unlink(&child->parent->server->pending, &child->pendingLink);
+    }
+    if (child->state == TCPCS_INCOMPLETE || child->state == TCPCS_PENDING) {
+        child->parent->server->pendingCount -= 1;
+    }
+
     /* remove parents reference to child, if it exists */
     if (child->parent->server->children) {
         g_hash_table_remove(child->parent->server->children, &(child->key));
@@ -355,9 +418,9 @@ static TCPServer* _tcpserver_new(gint backlog, pid_t processForChildren) {
     MAGIC_INIT(server);
 
     // store weak references to children
-    server->children =
-        g_hash_table_new_full(g_int_hash, g_int_equal, NULL, (GDestroyNotify)legacyfile_unrefWeak);
-    server->pending = g_queue_new();
+    server->children = g_hash_table_new_full(
+        g_int64_hash, g_int64_equal, NULL, (GDestroyNotify)legacyfile_unrefWeak);
+    g_queue_init(&server->pending);
     server->pendingMax = 0;
 
     server->processForChildren = processForChildren;
@@ -370,8 +433,8 @@ static TCPServer* _tcpserver_new(gint backlog, pid_t processForChildren) {
 static void _tcpserver_free(TCPServer* server) {
     MAGIC_ASSERT(server);
 
-    /* no need to destroy children in this queue */
-    g_queue_free(server->pending);
+    /* children hold a reference to us, so none can still be pending */
+    utility_debugAssert(g_queue_is_empty(&server->pending));
     /* this will unref all children */
     if(server->children) {
         g_hash_table_destroy(server->children);
@@ -390,6 +453,46 @@ struct TCPCong_ *tcp_cong(TCP *tcp) {
     return &tcp->cong;
 }
 
+static void _tcp_initCongestion(TCP* tcp, TCPCongestionType congestionType) {
+    MAGIC_ASSERT(tcp);
+
+    switch (congestionType) {
+        case TCP_CC_RENO: tcp_cong_reno_init(tcp); break;
+        case TCP_CC_CUBIC: tcp_cong_cubic_init(tcp); break;
+        default: utility_panic("Unsupported TCP congestion type %d", congestionType);
+    }
+
+    tcp->congestionType = congestionType;
+}
+
+void tcp_setCongestionType(TCP* tcp, TCPCongestionType congestionType) {
+    MAGIC_ASSERT(tcp);
+
+    if (congestionType == tcp->congestionType) {
+        return;
+    }
+
+    /* Like Linux, keep the current window and slow start threshold, so that a
+     * connection that's under way only changes how its window grows from here
+     * on instead of starting over. */
+    guint32 cwnd = tcp->cong.cwnd;
+    guint32 ssthresh = tcp->cong.hooks->tcp_cong_ssthresh(tcp);
+
+    tcp->cong.hooks->tcp_cong_delete(tcp);
+    _tcp_initCongestion(tcp, congestionType);
+
+    switch (congestionType) {
+        case TCP_CC_RENO: tcp_cong_reno_resume(tcp, cwnd, ssthresh); break;
+        case TCP_CC_CUBIC: tcp_cong_cubic_resume(tcp, cwnd, ssthresh); break;
+        default: utility_panic("Unsupported TCP congestion type %d", congestionType);
+    }
+}
+
+gint tcp_getSmoothedRTT(TCP* tcp) {
+    MAGIC_ASSERT(tcp);
+    return tcp->timing.rttSmoothed;
+}
+
 void tcp_clearAllChildrenIfServer(TCP* tcp) {
     MAGIC_ASSERT(tcp);
     if(tcp->server && tcp->server->children) {
@@ -468,29 +571,24 @@ static guint _tcp_calculateRTT(TCP* tcp, const Host* host) {
     return rtt;
 }
 
-static gsize _tcp_computeRTTMEM(TCP* tcp, const Host* host, gboolean isRMEM) {
-    gsize bw_KiBps = 0;
-    if(isRMEM) {
-        bw_KiBps = (gsize)host_get_bw_down_kiBps(host);
-    } else {
-        bw_KiBps = (gsize)host_get_bw_up_kiBps(host);
-    }
+static gsize _tcp_computeRTTMEM(TCP* tcp, gboolean isRMEM) {
+    gsize bw_Bps = isRMEM ? tcp->autotune.bandwidthDownBytes : tcp->autotune.bandwidthUpBytes;
 
-    gsize bw_Bps = bw_KiBps * 1024;
-    gdouble rttSeconds = ((gdouble)tcp->timing.rttSmoothed) / ((gdouble)1000);
+    /* the smoothed rtt is in milliseconds */
+    gsize rttMillis = (gsize)MAX(tcp->timing.rttSmoothed, 0);
 
-    gsize mem = (gsize)(bw_Bps * rttSeconds);
+    gsize mem = bw_Bps * rttMillis / 1000;
     return mem;
 }
 
-static gsize _tcp_computeMaxRMEM(TCP* tcp, const Host* host) {
-    gsize mem = _tcp_computeRTTMEM(tcp, host, TRUE);
+static gsize _tcp_computeMaxRMEM(TCP* tcp) {
+    gsize mem = _tcp_computeRTTMEM(tcp, TRUE);
     mem = CLAMP(mem, CONFIG_TCP_RMEM_MAX, CONFIG_TCP_RMEM_MAX*10);
     return mem;
 }
 
-static gsize _tcp_computeMaxWMEM(TCP* tcp, const Host* host) {
-    gsize mem = _tcp_computeRTTMEM(tcp, host, FALSE);
+static gsize _tcp_computeMaxWMEM(TCP* tcp) {
+    gsize mem = _tcp_computeRTTMEM(tcp, FALSE);
     mem = CLAMP(mem, CONFIG_TCP_WMEM_MAX, CONFIG_TCP_WMEM_MAX*10);
     return mem;
 }
@@ -584,10 +682,28 @@ static void _tcp_tuneInitialBufferSizes(TCP* tcp, const Host* host) {
           legacysocket_getInputBufferSize(&(tcp->super)));
 }
 
-static void _tcp_autotuneReceiveBuffer(TCP* tcp, const Host* host, guint bytesCopied) {
+static void _tcp_autotuneReceiveBuffer(TCP* tcp, guint bytesCopied) {
     MAGIC_ASSERT(tcp);
 
     tcp->autotune.bytesCopied += (gsize)bytesCopied;
+
+    CEmulatedTime now = worker_getCurrentEmulatedTime();
+    if(tcp->autotune.lastAdjustment == 0) {
+        tcp->autotune.lastAdjustment = now;
+        return;
+    }
+
+    /* like linux's tcp_rcv_space_adjust(), we measure how much the user read over the last rtt
+     * and only adjust the buffer size once per rtt */
+    if (tcp->timing.rttSmoothed <= 0) {
+        return;
+    }
+    CSimulationTime threshold =
+        ((CSimulationTime)tcp->timing.rttSmoothed) * ((CSimulationTime)SIMTIME_ONE_MILLISECOND);
+    if ((now - tcp->autotune.lastAdjustment) <= threshold) {
+        return;
+    }
+
     gsize space = 2 * tcp->autotune.bytesCopied;
     space = MAX(space, tcp->autotune.space);
 
@@ -595,7 +711,7 @@ static void _tcp_autotuneReceiveBuffer(TCP* tcp, const Host* host, guint bytesCo
     if(space > currentSize) {
         tcp->autotune.space = space;
 
-        gsize newSize = (gsize)MIN(space, _tcp_computeMaxRMEM(tcp, host));
+        gsize newSize = (gsize)MIN(space, _tcp_computeMaxRMEM(tcp));
         if(newSize > currentSize) {
             legacysocket_setInputBufferSize(&tcp->super, newSize);
             trace("[autotune] input buffer size adjusted from %"G_GSIZE_FORMAT" to %"G_GSIZE_FORMAT,
@@ -603,20 +719,17 @@ static void _tcp_autotuneReceiveBuffer(TCP* tcp, const Host* host, guint bytesCo
         }
     }
 
-    CEmulatedTime now = worker_getCurrentEmulatedTime();
-    if(tcp->autotune.lastAdjustment == 0) {
-        tcp->autotune.lastAdjustment = now;
-    } else if(tcp->timing.rttSmoothed > 0) {
-        CSimulationTime threshold =
-            ((CSimulationTime)tcp->timing.rttSmoothed) * ((CSimulationTime)SIMTIME_ONE_MILLISECOND);
-        if((now - tcp->autotune.lastAdjustment) > threshold) {
-            tcp->autotune.lastAdjustment = now;
-            tcp->autotune.bytesCopied = 0;
-        }
-    }
+    tcp->autotune.lastAdjustment = now;
+    tcp->autotune.bytesCopied = 0;
 }
 
-static void _tcp_autotuneSendBuffer(TCP* tcp, const Host* host) {
+/* The largest payload we put in a single data packet. */
+static gsize _tcp_getMaxPacketPayload(TCP* tcp) {
+    MAGIC_ASSERT(tcp);
+    return (gsize)CONFIG_TCP_MAX_SEGMENT_SIZE * tcp->segmentsPerPacket;
+}
+
+static void _tcp_autotuneSendBuffer(TCP* tcp) {
     MAGIC_ASSERT(tcp);
 
     /* Linux Kernel 3.11.6:
@@ -631,9 +744,10 @@ static void _tcp_autotuneSendBuffer(TCP* tcp, const Host* host) {
      * or sample from a distribution. */
 
     gsize sndmem = 2404;
-    gsize demanded = (gsize)tcp->cong.cwnd;
+    /* the cwnd counts packets, which may each hold several segments */
+    gsize demanded = (gsize)tcp->cong.cwnd * tcp->segmentsPerPacket;
 
-    gsize newSize = (gsize)MIN((gsize)(sndmem * 2 * demanded), _tcp_computeMaxWMEM(tcp, host));
+    gsize newSize = (gsize)MIN((gsize)(sndmem * 2 * demanded), _tcp_computeMaxWMEM(tcp));
 
     gsize currentSize = legacysocket_getOutputBufferSize(&tcp->super);
     if(newSize > currentSize) {
@@ -656,6 +770,7 @@ void tcp_disableReceiveBufferAutotuning(TCP* tcp) {
 // XXX declaration
 static void _tcp_runCloseTimerExpiredTask(const Host* host, gpointer tcp, gpointer userData);
 static void _tcp_clearRetransmit(TCP* tcp, guint sequence);
+static void _tcpsequencequeue_shrinkIfEmpty(TCPSequenceQueue* queue);
 
 static void _tcp_setState(TCP* tcp, const Host* host, enum TCPState state) {
     MAGIC_ASSERT(tcp);
@@ -745,6 +860,11 @@ static void _tcp_setState(TCP* tcp, const Host* host, enum TCPState state) {
             break;
         }
         case TCPS_TIMEWAIT: {
+            /* the connection may linger in this state for a long time, but won't send or receive
+             * any more data in the usual case, so don't hold on to the queues' memory */
+            _tcpsequencequeue_shrinkIfEmpty(&tcp->retransmit.queue);
+            _tcpsequencequeue_shrinkIfEmpty(&tcp->unorderedInput);
+
             /* schedule a close timer self-event to finish out the closing process */
             utility_alwaysAssert(tcp->rustSocket != NULL);
             const InetSocket* inetSocket = inetsocketweak_upgrade(tcp->rustSocket);
@@ -833,6 +953,156 @@ static void _tcp_bufferPacketOut(TCP* tcp, Packet* packet) {
     }
 }
 
+static const gsize TCP_SEQUENCE_QUEUE_INITIAL_CAPACITY = 64;
+
+static void _tcpsequencequeue_init(TCPSequenceQueue* queue) {
+    queue->capacity = 0;
+    queue->slots = NULL;
+    queue->head = 0;
+    queue->first = 0;
+    queue->span = 0;
+    queue->length = 0;
+}
+
+static inline Packet** _tcpsequencequeue_slot(TCPSequenceQueue* queue, guint32 sequence) {
+    utility_debugAssert(sequence - queue->first < queue->span);
+    return &queue->slots[(queue->head + (sequence - queue->first)) & (queue->capacity - 1)];
+}
+
+static inline bool _tcpsequencequeue_contains(const TCPSequenceQueue* queue,
+                                                guint32 sequence) {
+    return queue->span > 0 && sequence >= queue->first && sequence - queue->first < queue->span;
+}
+
+/* Make sure the ring can hold `span` consecutive sequence numbers. */
+static void _tcpsequencequeue_reserve(TCPSequenceQueue* queue, gsize span) {
+    if (span <= queue->capacity) {
+        return;
+    }
+
+    gsize newCapacity = MAX(queue->capacity, TCP_SEQUENCE_QUEUE_INITIAL_CAPACITY);
+    while (newCapacity < span) {
+        newCapacity *= 2;
+    }
+
+    Packet** newSlots = g_new0(Packet*, newCapacity);
+    for (guint32 i = 0; i < queue->span; i++) {
+        newSlots[i] = queue->slots[(queue->head + i) & (queue->capacity - 1)];
+    }
+
+    g_free(queue->slots);
+    queue->slots = newSlots;
+    queue->capacity = newCapacity;
+    queue->head = 0;
+}
+
+/* Takes ownership of the packet reference. Returns false (without taking ownership) if there is
+ * already a packet queued with this sequence number. */
+static bool _tcpsequencequeue_insert(TCPSequenceQueue* queue, guint32 sequence,
+                                       Packet* packet) {
+    utility_debugAssert(packet != NULL);
+
+    if (queue->span == 0) {
+        _tcpsequencequeue_reserve(queue, 1);
+        queue->head = 0;
+        queue->first = sequence;
+        queue->span = 1;
+    } else if (sequence < queue->first) {
+        /* extend the ring backwards */
+        guint32 extra = queue->first - sequence;
+        _tcpsequencequeue_reserve(queue, (gsize)queue->span + extra);
+        queue->head = (queue->head - extra) & (queue->capacity - 1);
+        queue->first = sequence;
+        queue->span += extra;
+    } else if (sequence - queue->first >= queue->span) {
+        /* extend the ring forwards */
+        _tcpsequencequeue_reserve(queue, (gsize)(sequence - queue->first) + 1);
+        queue->span = sequence - queue->first + 1;
+    }
+
+    Packet** slot = _tcpsequencequeue_slot(queue, sequence);
+    if (*slot != NULL) {
+        return false;
+    }
+
+    *slot = packet;
+    queue->length++;
+    return true;
+}
+
+/* Removes and returns the packet with this sequence number (the caller takes ownership of the
+ * reference), or returns NULL if it wasn't queued. */
+static Packet* _tcpsequencequeue_steal(TCPSequenceQueue* queue, guint32 sequence) {
+    if (!_tcpsequencequeue_contains(queue, sequence)) {
+        return NULL;
+    }
+
+    Packet** slot = _tcpsequencequeue_slot(queue, sequence);
+    Packet* packet = *slot;
+    if (packet == NULL) {
+        return NULL;
+    }
+
+    *slot = NULL;
+    queue->length--;
+
+    if (queue->length == 0) {
+        queue->span = 0;
+        return packet;
+    }
+
+    /* keep both ends of the ring on a queued packet */
+    while (queue->slots[queue->head] == NULL) {
+        queue->head = (queue->head + 1) & (queue->capacity - 1);
+        queue->first++;
+        queue->span--;
+    }
+    while (*_tcpsequencequeue_slot(queue, queue->first + queue->span - 1) == NULL) {
+        queue->span--;
+    }
+
+    return packet;
+}
+
+/* Returns the queued packet with the lowest sequence number without removing it, or NULL if the
+ * queue is empty. */
+static Packet* _tcpsequencequeue_peekFirst(TCPSequenceQueue* queue) {
+    if (queue->span == 0) {
+        return NULL;
+    }
+    /* the head is always on a queued packet */
+    return queue->slots[queue->head];
+}
+
+/* Frees the slots of an empty queue, which may have grown to the size of a large window. They're
+ * allocated again if another packet is queued. */
+static void _tcpsequencequeue_shrinkIfEmpty(TCPSequenceQueue* queue) {
+    if (queue->length > 0) {
+        return;
+    }
+
+    g_free(queue->slots);
+    queue->slots = NULL;
+    queue->capacity = 0;
+    queue->head = 0;
+    queue->span = 0;
+}
+
+static void _tcpsequencequeue_destroy(TCPSequenceQueue* queue) {
+    for (guint32 i = 0; i < queue->span; i++) {
+        Packet* packet = queue->slots[(queue->head + i) & (queue->capacity - 1)];
+        if (packet != NULL) {
+            packet_unref(packet);
+        }
+    }
+
+    g_free(queue->slots);
+    queue->slots = NULL;
+    queue->capacity = 0;
+    queue->span = 0;
+    queue->length = 0;
+}
+
 static void _tcp_bufferPacketIn(TCP* tcp, Packet* packet) {
     MAGIC_ASSERT(tcp);
 
@@ -840,9 +1110,10 @@ static void _tcp_bufferPacketIn(TCP* tcp, Packet* packet) {
     PacketTCPHeader* hdr = packet_getTCPHeader(packet);
     bool already_received = hdr->sequence < tcp->receive.next;
 
-    if (!already_received && !priorityqueue_find(tcp->unorderedInput, packet)) {
-        /* TCP wants in-order data */
-        priorityqueue_push(tcp->unorderedInput, packet);
+    /* TCP wants in-order data; the insert fails if we already have this sequence number */
+    if (!already_received &&
+        _tcpsequencequeue_insert(&tcp->unorderedInput, hdr->sequence, packet)) {
+        /* the queue holds a reference */
         packet_ref(packet);
 
         /* account for the packet length */
@@ -858,8 +1129,13 @@ static void _tcp_updateReceiveWindow(TCP* tcp) {
     /* the receive window is how much we are willing to accept to our input buffer.
      * unordered input packets should count against buffer space, so use the _tcp version. */
     //gsize space = _tcp_getBufferSpaceIn(tcp); // causes throughput problems
+    gsize maxPacketPayload = _tcp_getMaxPacketPayload(tcp);
+    if (legacysocket_getInputBufferSize(&(tcp->super)) < maxPacketPayload) {
+        /* a packet that doesn't fit in an empty input buffer could never be delivered */
+        legacysocket_setInputBufferSize(&(tcp->super), maxPacketPayload);
+    }
     gsize space = legacysocket_getInputBufferSpace(&(tcp->super));
-    gsize nPackets = space / CONFIG_TCP_MAX_SEGMENT_SIZE;
+    gsize nPackets = space / maxPacketPayload;
     tcp->receive.window = nPackets;
 
     /* handle window updates */
@@ -930,20 +1206,104 @@ static Packet* _tcp_createPacketWithoutPayload(TCP* tcp, const Host* host,
     return packet;
 }
 
+/* A position in an array of plugin buffers, which are treated as a single contiguous buffer. */
+typedef struct _ForeignIoVecCursor {
+    const ForeignIoVec* iov;
+    gsize iovcnt;
+    /* the current buffer, and the offset into it */
+    gsize index;
+    gsize offset;
+} ForeignIoVecCursor;
+
+static ForeignIoVecCursor _foreigniovcursor_new(const ForeignIoVec* iov, gsize iovcnt) {
+    return (ForeignIoVecCursor){.iov = iov, .iovcnt = iovcnt, .index = 0, .offset = 0};
+}
+
+/* Returns the next contiguous plugin range of at most `maxLength` bytes, and advances the cursor
+ * past it. The range is empty once the end of the buffers is reached. */
+static ForeignIoVec _foreigniovcursor_next(ForeignIoVecCursor* cursor, gsize maxLength) {
+    while (cursor->index < cursor->iovcnt) {
+        const ForeignIoVec* current = &cursor->iov[cursor->index];
+        gsize length = MIN(maxLength, current->len - cursor->offset);
+        ForeignIoVec range = {
+            .base = (UntypedForeignPtr){.val = current->base.val + cursor->offset},
+            .len = length,
+        };
+
+        cursor->offset += length;
+        if (cursor->offset == current->len) {
+            cursor->index++;
+            cursor->offset = 0;
+        }
+
+        if (length > 0) {
+            return range;
+        }
+    }
+
+    return (ForeignIoVec){.base = (UntypedForeignPtr){.val = 0}, .len = 0};
+}
+
+static gsize _foreigniovec_totalLength(const ForeignIoVec* iov, gsize iovcnt) {
+    gsize total = 0;
+    for (gsize i = 0; i < iovcnt; i++) {
+        total += iov[i].len;
+    }
+    return total;
+}
+
+/* Returns true if a non-empty buffer has a NULL pointer. */
+static bool _foreigniovec_hasNull(const ForeignIoVec* iov, gsize iovcnt) {
+    for (gsize i = 0; i < iovcnt; i++) {
+        if (iov[i].base.val == 0 && iov[i].len > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Creates a packet with the next `payloadLength` bytes of plugin data at the cursor, which may span
+ * several plugin buffers. */
+/* Creates a packet whose payload is the `payloadLength` bytes of `buffer` starting at `offset`. */
 static Packet* _tcp_createDataPacket(TCP* tcp, const Host* host, enum ProtocolTCPFlags flags,
-                                     UntypedForeignPtr payload, gsize payloadLength,
-                                     const MemoryManager* mem) {
+                                     Payload* buffer, gsize offset, gsize payloadLength) {
     MAGIC_ASSERT(tcp);
 
     bool isEmpty = payloadLength == 0;
     Packet* packet = _tcp_createPacketWithoutPayload(tcp, host, flags, isEmpty);
     if (!isEmpty) {
         uint64_t priority = host_getNextPacketPriority(host);
-        packet_setPayloadWithMemoryManager(packet, payload, payloadLength, mem, priority);
+        packet_setPayloadSlice(packet, buffer, offset, payloadLength, priority);
     }
     return packet;
 }
 
+/* Reads `length` bytes from the plugin buffers into a new payload, which the caller owns a
+ * reference to. Returns NULL and sets `errorOut` to a negative errno if the buffers couldn't be
+ * read. */
+static Payload* _tcp_readUserData(const ForeignIoVec* iov, gsize iovcnt, gsize length,
+                                  const MemoryManager* mem, int* errorOut) {
+    void* data = NULL;
+    Payload* buffer = payload_newUninitFromShadow(length, &data);
+
+    ForeignIoVecCursor cursor = _foreigniovcursor_new(iov, iovcnt);
+    gsize copied = 0;
+    while (copied < length) {
+        ForeignIoVec range = _foreigniovcursor_next(&cursor, length - copied);
+        utility_alwaysAssert(range.len > 0);
+
+        int rv = memorymanager_readPtr(mem, (char*)data + copied, range.base, range.len);
+        if (rv != 0) {
+            payload_unref(buffer);
+            *errorOut = rv;
+            return NULL;
+        }
+        copied += range.len;
+    }
+
+    return buffer;
+}
+
 static Packet* _tcp_createControlPacket(TCP* tcp, const Host* host, enum ProtocolTCPFlags flags) {
     MAGIC_ASSERT(tcp);
 
@@ -974,12 +1334,16 @@ static void _tcp_addRetransmit(TCP* tcp, Packet* packet) {
     MAGIC_ASSERT(tcp);
 
     PacketTCPHeader* header = packet_getTCPHeader(packet);
-    gpointer key = GINT_TO_POINTER(header->sequence);
+
+    /* a retransmitted packet may have been acknowledged while it was waiting to be sent again,
+     * in which case we'll never need to retransmit it */
+    if (header->sequence < tcp->receive.lastAcknowledgment) {
+        return;
+    }
 
     /* if it is already in the queue, it won't consume another packet reference */
-    if(g_hash_table_lookup(tcp->retransmit.queue, key) == NULL) {
+    if (_tcpsequencequeue_insert(&tcp->retransmit.queue, header->sequence, packet)) {
         /* its not in the queue yet */
-        g_hash_table_insert(tcp->retransmit.queue, key, packet);
         packet_ref(packet);
 
         packet_addDeliveryStatus(packet, PDS_SND_TCP_ENQUEUE_RETRANSMIT);
@@ -991,66 +1355,23 @@ static void _tcp_addRetransmit(TCP* tcp, Packet* packet) {
     }
 }
 
-static gint _tcp_compare_sequence(gconstpointer ptr_1, gconstpointer ptr_2, gpointer user_data) {
-    const guint seq_1 = GPOINTER_TO_INT(ptr_1);
-    const guint seq_2 = GPOINTER_TO_INT(ptr_2);
-    return (seq_1 < seq_2) ? -1 : (seq_1 > seq_2) ? 1 : 0;
-}
-
-/* remove all packets with a sequence number less than the sequence parameter */
-static void _tcp_clearRetransmit(TCP* tcp, guint sequence) {
-    MAGIC_ASSERT(tcp);
-
-    // Clear the retrans packets in a deterministic order
-    GQueue* keys_sorted = g_queue_new();
-    GHashTableIter iter;
-    gpointer key;
-
-    // First get the keys that need to be removed
-    g_hash_table_iter_init(&iter, tcp->retransmit.queue);
-
-    while (g_hash_table_iter_next(&iter, &key, NULL)) {
-        guint ackedSequence = GPOINTER_TO_INT(key);
-        if(ackedSequence < sequence) {
-            g_queue_insert_sorted(keys_sorted, key, _tcp_compare_sequence, NULL);
-        }
-    }
-
-    // Now remove the packets in order
-    while (g_queue_get_length(keys_sorted) > 0) {
-        key = g_queue_pop_head(keys_sorted);
-        Packet* ackedPacket = g_hash_table_lookup(tcp->retransmit.queue, key);
-        if (ackedPacket) {
-            tcp->retransmit.queueLength -= packet_getPayloadSize(ackedPacket);
-            packet_addDeliveryStatus(ackedPacket, PDS_SND_TCP_DEQUEUE_RETRANSMIT);
-            g_hash_table_remove(tcp->retransmit.queue, key);
-        }
-    }
-
-    // Cleanup
-    g_queue_free(keys_sorted);
-
-    if (_tcp_getBufferSpaceOut(tcp) > 0 &&
-        (legacyfile_getStatus((LegacyFile*)tcp) & FileState_ACTIVE)) {
-        legacyfile_adjustStatus((LegacyFile*)tcp, FileState_WRITABLE, TRUE, 0);
-    }
-}
-
 /* Remove packets in the half-open interval [begin, end) */
 static void _tcp_clearRetransmitRange(TCP* tcp, guint begin, guint end) {
     MAGIC_ASSERT(tcp);
 
+    TCPSequenceQueue* queue = &tcp->retransmit.queue;
 
-    for (uint32_t seq = begin; seq < end; ++seq) {
-        Packet *packet = g_hash_table_lookup(tcp->retransmit.queue,
-                                             GINT_TO_POINTER(seq));
+    /* packets are removed in sequence order; removing the first queued packet moves the front
+     * of the ring to the next queued packet, so acked prefixes are popped without scanning */
+    guint32 seq = MAX(begin, queue->first);
+    while (queue->span > 0 && seq < end && _tcpsequencequeue_contains(queue, seq)) {
+        Packet* packet = _tcpsequencequeue_steal(queue, seq);
+        seq = MAX(seq + 1, queue->first);
 
         if (packet != NULL) {
             tcp->retransmit.queueLength -= packet_getPayloadSize(packet);
             packet_addDeliveryStatus(packet, PDS_SND_TCP_DEQUEUE_RETRANSMIT);
-            bool success = g_hash_table_remove(tcp->retransmit.queue,
-                                               GINT_TO_POINTER(seq));
-            utility_debugAssert(success);
+            packet_unref(packet);
         }
     }
 
@@ -1060,7 +1381,12 @@ static void _tcp_clearRetransmitRange(TCP* tcp, guint begin, guint end) {
     }
 }
 
-// XXX forward declaration
+/* remove all packets with a sequence number less than the sequence parameter */
+static void _tcp_clearRetransmit(TCP* tcp, guint sequence) {
+    MAGIC_ASSERT(tcp);
+    _tcp_clearRetransmitRange(tcp, 0, sequence);
+}
+
 static void _tcp_runRetransmitTimerExpiredTask(const Host* host, gpointer /*TCP*/ tcp,
                                                gpointer /*Thread*/ thread);
 
@@ -1068,35 +1394,28 @@ static void _tcp_scheduleRetransmitTimer(TCP* tcp, const Host* host, CSimulation
                                          CSimulationTime delay) {
     MAGIC_ASSERT(tcp);
 
-    CSimulationTime* expireTimePtr = g_new0(CSimulationTime, 1);
-    *expireTimePtr = now + delay;
-    gboolean success = priorityqueue_push(tcp->retransmit.scheduledTimerExpirations, expireTimePtr);
+    /* any task that's already scheduled will now be ignored when it runs */
+    tcp->retransmit.scheduledTimerExpiration = now + delay;
 
-    if(success) {
-        utility_alwaysAssert(tcp->rustSocket != NULL);
-        const InetSocket* inetSocket = inetsocketweak_upgrade(tcp->rustSocket);
-        utility_alwaysAssert(inetSocket != NULL);
-        TaskRef* retexpTask =
-            taskref_new_bound(host_getID(host), _tcp_runRetransmitTimerExpiredTask,
-                              (void*)inetSocket, NULL, inetsocket_dropVoid, NULL);
-        host_scheduleTaskWithDelay(host, retexpTask, delay);
-        taskref_drop(retexpTask);
-
-        trace("%s retransmit timer scheduled for %"G_GUINT64_FORMAT" ns",
-                tcp->super.boundString, *expireTimePtr);
-    } else {
-        warning("%s could not schedule a retransmit timer for %"G_GUINT64_FORMAT" ns",
-                tcp->super.boundString, *expireTimePtr);
-        g_free(expireTimePtr);
-    }
+    utility_alwaysAssert(tcp->rustSocket != NULL);
+    const InetSocket* inetSocket = inetsocketweak_upgrade(tcp->rustSocket);
+    utility_alwaysAssert(inetSocket != NULL);
+    TaskRef* retexpTask = taskref_new_bound(host_getID(host), _tcp_runRetransmitTimerExpiredTask,
+                                            (void*)inetSocket, NULL, inetsocket_dropVoid, NULL);
+    host_scheduleTaskWithDelay(host, retexpTask, delay);
+    taskref_drop(retexpTask);
+
+    trace("%s retransmit timer scheduled for %" G_GUINT64_FORMAT " ns", tcp->super.boundString,
+          tcp->retransmit.scheduledTimerExpiration);
 }
 
 static void _tcp_scheduleRetransmitTimerIfNeeded(TCP* tcp, const Host* host, CSimulationTime now) {
-    /* logic for scheduling retransmission events. we only need to schedule one if
-     * we have no events that will allow us to schedule one later. */
-    CSimulationTime* nextTimePtr = priorityqueue_peek(tcp->retransmit.scheduledTimerExpirations);
-    if(nextTimePtr && *nextTimePtr <= tcp->retransmit.desiredTimerExpiration) {
-        /* another event will fire before the RTO expires, check again then */
+    /* logic for scheduling retransmission events. rearming the timer usually only moves the
+     * desired expiration later, so we only need to schedule a task if the scheduled one won't
+     * run before the RTO expires. */
+    CSimulationTime scheduled = tcp->retransmit.scheduledTimerExpiration;
+    if (scheduled != 0 && scheduled <= tcp->retransmit.desiredTimerExpiration) {
+        /* our task will run before the RTO expires, check again then */
         return;
     }
 
@@ -1134,6 +1453,124 @@ static void _tcp_setRetransmitTimeout(TCP* tcp, gint newTimeout) {
     tcp->retransmit.timeout = MAX(tcp->retransmit.timeout, CONFIG_TCP_RTO_MIN);
 }
 
+/* pacing gains from BBR: 2/ln(2) while probing for bandwidth in slow start, then a smaller
+ * gain that still lets the connection discover more bandwidth */
+static const gdouble TCP_PACING_STARTUP_GAIN = 2.885;
+static const gdouble TCP_PACING_STEADY_GAIN = 1.25;
+
+static void _tcp_pacingUpdateMinRTT(TCP* tcp, CSimulationTime rtt, CSimulationTime now) {
+    MAGIC_ASSERT(tcp);
+
+    gboolean isExpired = (now - tcp->pacing.minRTTStamp) > CONFIG_TCP_PACING_MIN_RTT_WINDOW;
+    if(tcp->pacing.minRTT == 0 || rtt <= tcp->pacing.minRTT || isExpired) {
+        tcp->pacing.minRTT = rtt;
+        tcp->pacing.minRTTStamp = now;
+    }
+}
+
+/* track how fast acked data reaches the receiver; each sample spans at least one min rtt */
+static void _tcp_pacingOnDelivered(TCP* tcp, gsize bytesDelivered, CSimulationTime now) {
+    MAGIC_ASSERT(tcp);
+
+    if(!tcp->pacing.sampleIsStarted) {
+        /* the bytes in this ack were delivered over an interval we didn't observe */
+        tcp->pacing.sampleIsStarted = TRUE;
+        tcp->pacing.sampleStart = now;
+        tcp->pacing.sampleDelivered = 0;
+        return;
+    }
+
+    tcp->pacing.sampleDelivered += bytesDelivered;
+
+    CSimulationTime elapsed = now - tcp->pacing.sampleStart;
+    if(elapsed < MAX(tcp->pacing.minRTT, SIMTIME_ONE_MILLISECOND)) {
+        return;
+    }
+
+    gdouble rate = (gdouble)tcp->pacing.sampleDelivered * SIMTIME_ONE_SECOND / (gdouble)elapsed;
+    tcp->pacing.deliveryRates[tcp->pacing.nextDeliveryRate] = rate;
+    tcp->pacing.nextDeliveryRate =
+        (tcp->pacing.nextDeliveryRate + 1) % CONFIG_TCP_PACING_RATE_SAMPLES;
+
+    trace("%s delivery rate sample of %f bytes/s", tcp->super.boundString, rate);
+
+    tcp->pacing.sampleStart = now;
+    tcp->pacing.sampleDelivered = 0;
+}
+
+/* returns the pacing rate in bytes per second, or 0 if we have no bandwidth estimate yet */
+static gdouble _tcp_pacingGetRate(TCP* tcp) {
+    MAGIC_ASSERT(tcp);
+
+    gdouble btlbw = 0;
+    for(guint i = 0; i < CONFIG_TCP_PACING_RATE_SAMPLES; i++) {
+        btlbw = MAX(btlbw, tcp->pacing.deliveryRates[i]);
+    }
+
+    gboolean inSlowStart = tcp->cong.cwnd < tcp->cong.hooks->tcp_cong_ssthresh(tcp);
+    return btlbw * (inSlowStart ? TCP_PACING_STARTUP_GAIN : TCP_PACING_STEADY_GAIN);
+}
+
+static void _tcp_pacingFlushTaskCallback(const Host* host, gpointer voidInetSocket,
+                                         gpointer userData) {
+    const InetSocket* inetSocket = voidInetSocket;
+    utility_alwaysAssert(inetSocket != NULL);
+    TCP* tcp = inetsocket_asLegacyTcp(inetSocket);
+    MAGIC_ASSERT(tcp);
+
+    tcp->pacing.flushIsScheduled = FALSE;
+
+    /* if we are closed, we don't care */
+    if(tcp->state == TCPS_CLOSED) {
+        return;
+    }
+
+    trace("%s pacing delay expired, flushing", tcp->super.boundString);
+    _tcp_flush(tcp, host);
+}
+
+/* returns TRUE if the pacing rate allows sending a data packet now; otherwise makes sure a
+ * flush is scheduled for when it will */
+static gboolean _tcp_pacingCanSend(TCP* tcp, const Host* host, CSimulationTime now) {
+    MAGIC_ASSERT(tcp);
+
+    if(!tcp->pacing.isEnabled || now >= tcp->pacing.nextSendTime) {
+        return TRUE;
+    }
+
+    if(!tcp->pacing.flushIsScheduled) {
+        utility_alwaysAssert(tcp->rustSocket != NULL);
+        const InetSocket* inetSocket = inetsocketweak_upgrade(tcp->rustSocket);
+        utility_alwaysAssert(inetSocket != NULL);
+        TaskRef* flushTask =
+            taskref_new_bound(host_getID(host), _tcp_pacingFlushTaskCallback, (void*)inetSocket,
+                              NULL, inetsocket_dropVoid, NULL);
+        host_scheduleTaskWithDelay(host, flushTask, tcp->pacing.nextSendTime - now);
+        taskref_drop(flushTask);
+
+        tcp->pacing.flushIsScheduled = TRUE;
+    }
+
+    return FALSE;
+}
+
+static void _tcp_pacingOnSend(TCP* tcp, gsize length, CSimulationTime now) {
+    MAGIC_ASSERT(tcp);
+
+    if(!tcp->pacing.isEnabled) {
+        return;
+    }
+
+    gdouble rate = _tcp_pacingGetRate(tcp);
+    if(rate <= 0) {
+        /* no estimate yet, so only the congestion window limits us */
+        return;
+    }
+
+    CSimulationTime gap = (CSimulationTime)((gdouble)length * SIMTIME_ONE_SECOND / rate);
+    tcp->pacing.nextSendTime = MAX(now, tcp->pacing.nextSendTime) + gap;
+}
+
 static void _tcp_updateRTTEstimate(TCP* tcp, const Host* host, CSimulationTime timestamp) {
     MAGIC_ASSERT(tcp);
 
@@ -1168,40 +1605,34 @@ static void _tcp_updateRTTEstimate(TCP* tcp, const Host* host, CSimulationTime t
 
     trace("srtt=%d rttvar=%d rto=%d", tcp->timing.rttSmoothed,
             tcp->timing.rttVariance, tcp->retransmit.timeout);
+
+    if(tcp->pacing.isEnabled) {
+        _tcp_pacingUpdateMinRTT(tcp, MAX(now - timestamp, 1), now);
+    }
 }
 
-static void _tcp_retransmitPacket(TCP* tcp, const Host* host, gint sequence) {
+/* Moves the packet with the given sequence from the retransmit queue back into
+ * the throttled output queue. Returns FALSE if the packet was not queued for
+ * retransmission. The caller is responsible for updating the writable status
+ * and the retransmit timer once it is done retransmitting. */
+static gboolean _tcp_retransmitPacket(TCP* tcp, gint sequence) {
     MAGIC_ASSERT(tcp);
 
-    Packet* packet = g_hash_table_lookup(tcp->retransmit.queue, GINT_TO_POINTER(sequence));
+    /* remove from queue; we take over the queue's packet reference */
+    Packet* packet = _tcpsequencequeue_steal(&tcp->retransmit.queue, sequence);
     /* if packet wasn't found is was most likely retransmitted from a previous SACK
      * but has yet to be received/acknowledged by the receiver */
     if(!packet) {
         _rswlog(tcp, "Packet %d not in ReTX queue\n", sequence);
-        return;
+        return FALSE;
     }
 
-    PacketTCPHeader* hdr = packet_getTCPHeader(packet);
-
     trace("retransmitting packet %d", sequence);
-    // fprintf(stderr, "R- retransmitting packet %d with ts %llu\n", sequence, hdr.timestampValue);
-
-    /* remove from queue and update length and status.
-     * calling steal means that the packet ref count is not decremented */
-    g_hash_table_steal(tcp->retransmit.queue, GINT_TO_POINTER(sequence));
 
     /* update queue length and status */
     tcp->retransmit.queueLength -= packet_getPayloadSize(packet);
     packet_addDeliveryStatus(packet, PDS_SND_TCP_DEQUEUE_RETRANSMIT);
 
-    if (_tcp_getBufferSpaceOut(tcp) > 0 &&
-        (legacyfile_getStatus((LegacyFile*)tcp) & FileState_ACTIVE)) {
-        legacyfile_adjustStatus((LegacyFile*)tcp, FileState_WRITABLE, TRUE, 0);
-    }
-
-    /* reset retransmit timer since we are resending it now */
-    _tcp_setRetransmitTimer(tcp, host, worker_getCurrentSimulationTime());
-
     /* queue it for sending */
     _tcp_bufferPacketOut(tcp, packet);
     packet_addDeliveryStatus(packet, PDS_SND_TCP_RETRANSMITTED);
@@ -1209,6 +1640,47 @@ static void _tcp_retransmitPacket(TCP* tcp, const Host* host, gint sequence) {
 
     /* free the ref that we stole */
     packet_unref(packet);
+    return TRUE;
+}
+
+typedef struct _TCPRetransmitBatch TCPRetransmitBatch;
+struct _TCPRetransmitBatch {
+    TCP* tcp;
+    gsize numRetransmitted;
+};
+
+static void _tcp_retransmitLostRange(uint32_t begin, uint32_t end, void* data) {
+    TCPRetransmitBatch* batch = data;
+
+    _rswlog(batch->tcp, "Retransmitting [%d, %d)\n", begin, end);
+
+    for (uint32_t sequence = begin; sequence < end; ++sequence) {
+        if (_tcp_retransmitPacket(batch->tcp, sequence)) {
+            batch->numRetransmitted++;
+        }
+    }
+}
+
+/* Requeues every packet in the tally's lost ranges as one batch, so that the
+ * writable status and the retransmit timer are only updated once. */
+static void _tcp_retransmitLost(TCP* tcp, const Host* host) {
+    MAGIC_ASSERT(tcp);
+
+    TCPRetransmitBatch batch = {.tcp = tcp, .numRetransmitted = 0};
+    retransmit_tally_for_each_lost_range(tcp->retransmit.tally, _tcp_retransmitLostRange, &batch);
+    retransmit_tally_mark_lost_retransmitted(tcp->retransmit.tally);
+
+    if (batch.numRetransmitted == 0) {
+        return;
+    }
+
+    if (_tcp_getBufferSpaceOut(tcp) > 0 &&
+        (legacyfile_getStatus((LegacyFile*)tcp) & FileState_ACTIVE)) {
+        legacyfile_adjustStatus((LegacyFile*)tcp, FileState_WRITABLE, TRUE, 0);
+    }
+
+    /* reset retransmit timer since we are resending now */
+    _tcp_setRetransmitTimer(tcp, host, worker_getCurrentSimulationTime());
 }
 
 static void _tcp_sendShutdownFin(TCP* tcp, const Host* host) {
@@ -1239,9 +1711,13 @@ void tcp_networkInterfaceIsAboutToSendPacket(TCP* tcp, const Host* host, Packet*
 
     CSimulationTime now = worker_getCurrentSimulationTime();
 
+    /* the lowest blocks are the ones that the sender will retransmit around first */
+    const TCPSackScoreboard* sacks = &tcp->send.selectiveACKs;
+    gsize numSelectiveACKs = MIN(sacks->numBlocks, PACKET_TCP_MAX_SACK_BLOCKS);
+
     /* update TCP header to our current advertised window and acknowledgment and timestamps */
-    packet_updateTCP(packet, tcp->receive.next, tcp->send.selectiveACKs, tcp->receive.window, 0,
-                     false, now, tcp->receive.lastTimestamp);
+    packet_updateTCP(packet, tcp->receive.next, sacks->blocks, numSelectiveACKs,
+                     tcp->receive.window, 0, false, now, tcp->receive.lastTimestamp);
 
     /* keep track of the last things we sent them */
     tcp->send.lastAcknowledgment = tcp->receive.next;
@@ -1276,32 +1752,7 @@ static void _tcp_flush(TCP* tcp, const Host* host) {
     CSimulationTime now = worker_getCurrentSimulationTime();
     double dtime = (double)(now) / (1.0E9);
 
-    size_t num_lost_ranges =
-       retransmit_tally_num_lost_ranges(tcp->retransmit.tally);
-
-    if (num_lost_ranges > 0) {
-        uint32_t *lost_ranges = malloc(2 * num_lost_ranges * sizeof(uint32_t));
-        retransmit_tally_populate_lost_ranges(tcp->retransmit.tally,
-                                              lost_ranges);
-
-        for (size_t idx = 0; idx < num_lost_ranges; ++idx) {
-           uint32_t begin = lost_ranges[2*idx];
-           uint32_t end = lost_ranges[2*idx + 1];
-
-           _rswlog(tcp, "Retransmitting [%d, %d)\n", begin, end);
-
-           for (uint32_t jdx = begin; jdx < end; ++jdx) {
-               // fprintf(stderr, "CW - %s Retransmitting %d @ %f, %zu lost ranges\n", tcp->super.boundString, jdx, dtime, num_lost_ranges);
-               _tcp_retransmitPacket(tcp, host, jdx);
-           }
-
-           retransmit_tally_mark_retransmitted(tcp->retransmit.tally,
-                                               begin, end);
-
-        }
-
-        free(lost_ranges);
-    }
+    _tcp_retransmitLost(tcp, host);
 
     /* find all packets to retransmit and add them throttled output */
 
@@ -1332,9 +1783,13 @@ static void _tcp_flush(TCP* tcp, const Host* host) {
                 _rswlog(tcp, "Can't retransmit %d, inWindow=%d, inBuffer=%d\n", header->sequence, fitsInWindow, fitsInBuffer);
                 /* we cant send the packet yet */
                 break;
+            } else if(!_tcp_pacingCanSend(tcp, host, now)) {
+                /* a scheduled flush will send it once the pacing rate allows */
+                break;
             } else {
                 /* we will send the data packet */
                 tcp->info.lastDataSent = now;
+                _tcp_pacingOnSend(tcp, length, now);
             }
         }
 
@@ -1364,9 +1819,8 @@ static void _tcp_flush(TCP* tcp, const Host* host) {
     }
 
     /* any packets now in order can be pushed to our user input buffer */
-    while(!priorityqueue_isEmpty(tcp->unorderedInput)) {
-        Packet* packet = priorityqueue_peek(tcp->unorderedInput);
-
+    Packet* packet = NULL;
+    while ((packet = _tcpsequencequeue_peekFirst(&tcp->unorderedInput)) != NULL) {
         PacketTCPHeader* header = packet_getTCPHeader(packet);
 
         _rswlog(tcp, "I just received packet %d\n", header->sequence);
@@ -1374,7 +1828,7 @@ static void _tcp_flush(TCP* tcp, const Host* host) {
             // This is a (probably retransmitted) copy of a packet we already stored
             // and delivered to the plugin.
             trace("Removing packet %u with duplicate data", header->sequence);
-            priorityqueue_pop(tcp->unorderedInput);
+            _tcpsequencequeue_steal(&tcp->unorderedInput, header->sequence);
             tcp->unorderedInputLength -= packet_getPayloadSize(packet);
             packet_unref(packet);
         } else if (header->sequence == tcp->receive.next) {
@@ -1393,7 +1847,7 @@ static void _tcp_flush(TCP* tcp, const Host* host) {
             if(fitInBuffer) {
                 // fprintf(stderr, "SND/RCV Recv %s %s %d @ %f\n", tcp->super.boundString, tcp->super.peerString, header.sequence, dtime);
                 tcp->receive.lastSequence = header->sequence;
-                priorityqueue_pop(tcp->unorderedInput);
+                _tcpsequencequeue_steal(&tcp->unorderedInput, header->sequence);
                 tcp->unorderedInputLength -= packet_getPayloadSize(packet);
                 packet_unref(packet);
                 (tcp->receive.next)++;
@@ -1463,10 +1917,11 @@ static void _tcp_runRetransmitTimerExpiredTask(const Host* host, gpointer voidIn
 
     /* a timer expired, update our timer tracking state */
     CSimulationTime now = worker_getCurrentSimulationTime();
-    CSimulationTime* scheduledTimerExpirationPtr =
-        priorityqueue_pop(tcp->retransmit.scheduledTimerExpirations);
-    utility_debugAssert(scheduledTimerExpirationPtr);
-    g_free(scheduledTimerExpirationPtr);
+    if (now != tcp->retransmit.scheduledTimerExpiration) {
+        /* an earlier task replaced this one */
+        return;
+    }
+    tcp->retransmit.scheduledTimerExpiration = 0;
 
     trace("%s a scheduled retransmit timer expired", tcp->super.boundString);
 
@@ -1477,7 +1932,7 @@ static void _tcp_runRetransmitTimerExpiredTask(const Host* host, gpointer voidIn
         return;
     }
 
-    if(g_hash_table_size(tcp->retransmit.queue) == 0) {
+    if(tcp->retransmit.queue.length == 0) {
         _tcp_stopRetransmitTimer(tcp);
         return;
     }
@@ -1486,8 +1941,8 @@ static void _tcp_runRetransmitTimerExpiredTask(const Host* host, gpointer voidIn
     if(tcp->retransmit.desiredTimerExpiration == 0) {
         return;
     } else if(tcp->retransmit.desiredTimerExpiration > now) {
-        /* the timer was reset after this event was scheduled, check if we need to
-         * schedule another event, or if we can do it when the next event fires instead */
+        /* the timer was reset after this task was scheduled, so reschedule it for the new
+         * expiration */
         _tcp_scheduleRetransmitTimerIfNeeded(tcp, host, now);
         return;
     }
@@ -1723,22 +2178,22 @@ gint tcp_acceptServerPeer(TCP* tcp, const Host* host, in_addr_t* ip, in_port_t*
     }
 
     /* if there are no pending connection ready to accept, dont block waiting */
-    if(g_queue_get_length(tcp->server->pending) <= 0) {
+    if (g_queue_is_empty(&tcp->server->pending)) {
         /* listen sockets should have no data, and should not be readable if no pending conns */
         utility_debugAssert(legacysocket_getInputBufferLength(&tcp->super) == 0);
         legacyfile_adjustStatus(&(tcp->super.super), FileState_READABLE, FALSE, 0);
         return -EWOULDBLOCK;
     }
 
-    /* double check the pending child before its accepted */
-    TCP* tcpChild = g_queue_pop_head(tcp->server->pending);
-    if(!tcpChild) {
-        return -ECONNABORTED;
-    }
-
+    TCP* tcpChild = g_queue_pop_head_link(&tcp->server->pending)->data;
     tcp->server->pendingCount -= 1;
 
+    /* child now gets "accepted", even if we abort it below */
     MAGIC_ASSERT(tcpChild);
+    MAGIC_ASSERT(tcpChild->child);
+    tcpChild->child->state = TCPCS_ACCEPTED;
+
+    /* double check the pending child before its accepted */
     if(tcpChild->error == TCPE_CONNECTION_RESET) {
         return -ECONNABORTED;
     }
@@ -1746,16 +2201,12 @@ gint tcp_acceptServerPeer(TCP* tcp, const Host* host, in_addr_t* ip, in_port_t*
     /* better have a peer if we are established */
     utility_debugAssert(tcpChild->super.peerIP && tcpChild->super.peerPort);
 
-    /* child now gets "accepted" */
-    MAGIC_ASSERT(tcpChild->child);
-    tcpChild->child->state = TCPCS_ACCEPTED;
-
     /* update child descriptor status */
     legacyfile_adjustStatus(
         &(tcpChild->super.super), FileState_ACTIVE | FileState_WRITABLE, TRUE, 0);
 
     /* update server descriptor status */
-    if(g_queue_get_length(tcp->server->pending) > 0) {
+    if (!g_queue_is_empty(&tcp->server->pending)) {
         legacyfile_adjustStatus(&(tcp->super.super), FileState_READABLE, TRUE, 0);
     } else {
         legacyfile_adjustStatus(&(tcp->super.super), FileState_READABLE, FALSE, 0);
@@ -1794,7 +2245,7 @@ static TCP* _tcp_getSourceTCP(TCP* tcp, in_addr_t ip, in_port_t port) {
         MAGIC_ASSERT(tcp->server);
 
         /* children are multiplexed based on remote ip and port */
-        guint childKey = _ipPortHash(ip, port);
+        guint64 childKey = _ipPortKey(ip, port);
         TCP* tcpChild = g_hash_table_lookup(tcp->server->children, &childKey);
 
         if(tcpChild) {
@@ -1805,22 +2256,71 @@ static TCP* _tcp_getSourceTCP(TCP* tcp, in_addr_t ip, in_port_t port) {
     return tcp;
 }
 
-static GList* _tcp_removeSacks(GList* selectiveACKs, gint sequence) {
-    GList *unacked = NULL;
-    if(selectiveACKs) {
-        GList *iter = selectiveACKs;
-        while(iter) {
-            gint sackSequence = GPOINTER_TO_INT(iter->data);
+/* Adds the sequence number to the scoreboard, merging it with adjacent blocks. If the scoreboard
+ * is full, the highest block is forgotten. */
+static void _tcpsackscoreboard_add(TCPSackScoreboard* sacks, guint sequence) {
+    PacketTCPSackBlock* blocks = sacks->blocks;
 
-            if(sackSequence > sequence) {
-                unacked = g_list_append(unacked, iter->data);
-            }
+    /* find the first block that ends at or after the sequence number */
+    guint i = 0;
+    while (i < sacks->numBlocks && blocks[i].end < sequence) {
+        i++;
+    }
+
+    if (i < sacks->numBlocks && blocks[i].begin <= sequence) {
+        if (sequence < blocks[i].end) {
+            /* already selectively acked */
+            return;
+        }
+
+        /* extend the block, and merge with the next one if they now touch */
+        blocks[i].end = sequence + 1;
+        if (i + 1 < sacks->numBlocks && blocks[i + 1].begin == blocks[i].end) {
+            blocks[i].end = blocks[i + 1].end;
+            memmove(&blocks[i + 1], &blocks[i + 2],
+                    (sacks->numBlocks - i - 2) * sizeof(PacketTCPSackBlock));
+            sacks->numBlocks--;
+        }
+        return;
+    }
+
+    if (i < sacks->numBlocks && blocks[i].begin == sequence + 1) {
+        /* extend the next block down; the previous block ends before the sequence number */
+        blocks[i].begin = sequence;
+        return;
+    }
 
-            iter = g_list_next(iter);
+    /* we need a new block at index i */
+    if (sacks->numBlocks == TCP_SACK_SCOREBOARD_MAX_BLOCKS) {
+        if (i == sacks->numBlocks) {
+            /* it would be the highest block */
+            return;
         }
-        g_list_free(selectiveACKs);
+        sacks->numBlocks--;
+    }
+
+    memmove(&blocks[i + 1], &blocks[i], (sacks->numBlocks - i) * sizeof(PacketTCPSackBlock));
+    blocks[i].begin = sequence;
+    blocks[i].end = sequence + 1;
+    sacks->numBlocks++;
+}
+
+/* Removes all sequence numbers below `sequence` from the scoreboard. */
+static void _tcpsackscoreboard_removeBelow(TCPSackScoreboard* sacks, guint sequence) {
+    PacketTCPSackBlock* blocks = sacks->blocks;
+
+    guint numRemoved = 0;
+    while (numRemoved < sacks->numBlocks && blocks[numRemoved].end <= sequence) {
+        numRemoved++;
+    }
+
+    memmove(&blocks[0], &blocks[numRemoved],
+            (sacks->numBlocks - numRemoved) * sizeof(PacketTCPSackBlock));
+    sacks->numBlocks -= numRemoved;
+
+    if (sacks->numBlocks > 0 && blocks[0].begin < sequence) {
+        blocks[0].begin = sequence;
     }
-    return unacked;
 }
 
 TCPProcessFlags _tcp_dataProcessing(TCP* tcp, Packet* packet, PacketTCPHeader *header) {
@@ -1849,28 +2349,16 @@ TCPProcessFlags _tcp_dataProcessing(TCP* tcp, Packet* packet, PacketTCPHeader *h
         gboolean packetFits = (packetLength <= _tcp_getBufferSpaceIn(tcp)) ? TRUE : FALSE;
 
         /* SACK: if not next packet, one was dropped and we need to include this in the selective ACKs */
+        TCPSackScoreboard* sacks = &tcp->send.selectiveACKs;
         if(!isNextPacket && packetFits) {
-            tcp->send.selectiveACKs = g_list_append(tcp->send.selectiveACKs, GINT_TO_POINTER(header->sequence));
-        } else if(tcp->send.selectiveACKs && g_list_length(tcp->send.selectiveACKs) > 0) {
-            /* find the first gap in SACKs and remove everything before it */
-            GList *iter = g_list_first(tcp->send.selectiveACKs);
-            GList *next = g_list_next(iter);
-
-            gint firstSequence = GPOINTER_TO_INT(iter->data);
-            if(firstSequence <= header->sequence + 1) {
-                while(next) {
-                    gint currSequence = GPOINTER_TO_INT(iter->data);
-                    gint nextSequence = GPOINTER_TO_INT(next->data);
-                    /* check for a gap in sequences */
-                    if(currSequence + 1 < nextSequence && currSequence > header->sequence) {
-                        break;
-                    }
-                    iter = next;
-                    next = g_list_next(iter);
-                }
-
-                tcp->send.selectiveACKs = _tcp_removeSacks(tcp->send.selectiveACKs, GPOINTER_TO_INT(iter->data));
+            _tcpsackscoreboard_add(sacks, header->sequence);
+        } else if(sacks->numBlocks > 0) {
+            /* find the first gap in SACKs after this packet and remove everything before it */
+            guint firstGap = header->sequence + 1;
+            for (guint i = 0; i < sacks->numBlocks && sacks->blocks[i].begin <= firstGap; i++) {
+                firstGap = MAX(firstGap, sacks->blocks[i].end);
             }
+            _tcpsackscoreboard_removeBelow(sacks, firstGap);
         }
 
         FileState s = legacyfile_getStatus((LegacyFile*)tcp);
@@ -1931,10 +2419,16 @@ TCPProcessFlags _tcp_ackProcessing(TCP* tcp, const Host* host, Packet* packet,
 
     gint nPacketsAcked = 0;
     if(isValidAck) {
+        gsize queueLengthBefore = tcp->retransmit.queueLength;
+
         /* the packets just acked are 'released' from retransmit queue */
         _tcp_clearRetransmitRange(tcp, tcp->receive.lastAcknowledgment,
                                   header->acknowledgment);
 
+        if(tcp->pacing.isEnabled && tcp->retransmit.queueLength < queueLengthBefore) {
+            _tcp_pacingOnDelivered(tcp, queueLengthBefore - tcp->retransmit.queueLength, now);
+        }
+
         _rswlog(tcp, "The ReTX is now %zu\n", tcp->retransmit.queueLength);
 
         /* update their advertisements */
@@ -1953,7 +2447,7 @@ TCPProcessFlags _tcp_ackProcessing(TCP* tcp, const Host* host, Packet* packet,
             /* increase send buffer size with autotuning */
             if (tcp->autotune.isEnabled && !tcp->autotune.userDisabledSend &&
                 host_autotuneSendBuffer(host)) {
-                _tcp_autotuneSendBuffer(tcp, host);
+                _tcp_autotuneSendBuffer(tcp);
             }
         }
 
@@ -2003,9 +2497,18 @@ static void _tcp_logCongestionInfo(TCP* tcp) {
           &tcp->super.super);
 }
 
-static void _tcp_sendACKTaskCallback(const Host* host, gpointer voidInetSocket, gpointer userData) {
-    const InetSocket* inetSocket = voidInetSocket;
-    utility_alwaysAssert(inetSocket != NULL);
+static void _tcp_sendACKTaskCallback(const Host* host, gpointer voidInetSocketWeak,
+                                     gpointer userData) {
+    const InetSocketWeak* inetSocketWeak = voidInetSocketWeak;
+    utility_alwaysAssert(inetSocketWeak != NULL);
+
+    /* the task holds a weak reference since the socket holds the task */
+    InetSocket* inetSocket = inetsocketweak_upgrade(inetSocketWeak);
+    if (inetSocket == NULL) {
+        /* the socket was freed */
+        return;
+    }
+
     TCP* tcp = inetsocket_asLegacyTcp(inetSocket);
     MAGIC_ASSERT(tcp);
 
@@ -2017,6 +2520,34 @@ static void _tcp_sendACKTaskCallback(const Host* host, gpointer voidInetSocket,
     } else {
         trace("delayed ACK was cancelled");
     }
+
+    inetsocket_drop(inetSocket);
+}
+
+static void _tcp_scheduleDelayedACK(TCP* tcp, const Host* host) {
+    MAGIC_ASSERT(tcp);
+
+    if (tcp->send.delayedACKTask == NULL) {
+        utility_alwaysAssert(tcp->rustSocket != NULL);
+        tcp->send.delayedACKTask = taskref_new_bound(
+            host_getID(host), _tcp_sendACKTaskCallback, inetsocketweak_cloneRef(tcp->rustSocket),
+            NULL, inetsocketweak_dropVoid, NULL);
+    }
+
+    /* figure out what we should use as delay */
+    CSimulationTime delay = 0;
+    /* "quick acknowledgments" happen at the beginning of a connection */
+    if(tcp->send.numQuickACKsSent < 1000) {
+        /* we want the other side to get the ACKs sooner so we don't throttle its sending rate */
+        delay = 1*SIMTIME_ONE_MILLISECOND;
+        tcp->send.numQuickACKsSent++;
+    } else {
+        delay = 5*SIMTIME_ONE_MILLISECOND;
+    }
+
+    host_scheduleTaskWithDelay(host, tcp->send.delayedACKTask, delay);
+
+    tcp->send.delayedACKIsScheduled = TRUE;
 }
 
 /* return TRUE if the packet should be retransmitted */
@@ -2108,7 +2639,8 @@ static void _tcp_processPacket(LegacySocket* socket, const Host* host, Packet* p
                 utility_alwaysAssert(registerInThread != NULL);
 
                 /* we need to multiplex a new child */
-                TCP* multiplexed = tcp_new(host, recvBufSize, sendBufSize);
+                TCP* multiplexed =
+                    tcp_new(host, recvBufSize, sendBufSize, tcp->congestionType);
                 Descriptor* desc = descriptor_fromLegacyTcp(multiplexed, /* flags= */ 0);
                 int handle = thread_registerDescriptor(registerInThread, desc);
 
@@ -2174,7 +2706,8 @@ static void _tcp_processPacket(LegacySocket* socket, const Host* host, Packet* p
                 /* if this is a child, mark it accordingly */
                 if(tcp->child) {
                     tcp->child->state = TCPCS_PENDING;
-                    g_queue_push_tail(tcp->child->parent->server->pending, tcp);
+                    g_queue_push_tail_link(
+                        &tcp->child->parent->server->pending, &tcp->child->pendingLink);
                     /* user should accept new child from parent */
                     legacyfile_adjustStatus(
                         &(tcp->child->parent->super.super), FileState_READABLE, TRUE, 0);
@@ -2300,14 +2833,9 @@ static void _tcp_processPacket(LegacySocket* socket, const Host* host, Packet* p
         return;
     }
 
-    GList* selectiveACKs = packet_copyTCPSelectiveACKs(packet);
-
-    if (selectiveACKs) {
-       retransmit_tally_mark_sacked(tcp->retransmit.tally, selectiveACKs);
-    }
-
-    if(selectiveACKs) {
-        g_list_free(selectiveACKs);
+    for (guint i = 0; i < header->numSelectiveACKs; i++) {
+        retransmit_tally_mark_sacked(
+            tcp->retransmit.tally, header->selectiveACKs[i].begin, header->selectiveACKs[i].end);
     }
 
     /* update the last time stamp value (RFC 1323) */
@@ -2357,29 +2885,8 @@ static void _tcp_processPacket(LegacySocket* socket, const Host* host, Packet* p
             trace("waiting for delayed ACK control packet");
             if(tcp->send.delayedACKIsScheduled == FALSE) {
                 /* we need to send an ACK, lets schedule a task so we don't send an ACK
-                 * for all packets that are received during this same simtime receiving round. */
-                utility_alwaysAssert(tcp->rustSocket != NULL);
-                const InetSocket* inetSocket = inetsocketweak_upgrade(tcp->rustSocket);
-                utility_alwaysAssert(inetSocket != NULL);
-                TaskRef* sendACKTask =
-                    taskref_new_bound(host_getID(host), _tcp_sendACKTaskCallback, (void*)inetSocket,
-                                      NULL, inetsocket_dropVoid, NULL);
-
-                /* figure out what we should use as delay */
-                CSimulationTime delay = 0;
-                /* "quick acknowledgments" happen at the beginning of a connection */
-                if(tcp->send.numQuickACKsSent < 1000) {
-                    /* we want the other side to get the ACKs sooner so we don't throttle its sending rate */
-                    delay = 1*SIMTIME_ONE_MILLISECOND;
-                    tcp->send.numQuickACKsSent++;
-                } else {
-                    delay = 5*SIMTIME_ONE_MILLISECOND;
-                }
-
-                host_scheduleTaskWithDelay(host, sendACKTask, delay);
-                taskref_drop(sendACKTask);
-
-                tcp->send.delayedACKIsScheduled = TRUE;
+                 * for all packets that are received before the delayed ACK timer fires. */
+                _tcp_scheduleDelayedACK(tcp, host);
             }
             tcp->send.delayedACKCounter++;
         }
@@ -2421,9 +2928,8 @@ static void _tcp_endOfFileSignalled(TCP* tcp, enum TCPFlags flags) {
     }
 }
 
-/* Address and port must be in network byte order. */
-gssize tcp_sendUserData(TCP* tcp, const Host* host, UntypedForeignPtr buffer, gsize nBytes,
-                        in_addr_t ip, in_port_t port, const MemoryManager* mem) {
+gssize tcp_sendUserData(TCP* tcp, const Host* host, const ForeignIoVec* iov, gsize iovcnt,
+                        const MemoryManager* mem) {
     MAGIC_ASSERT(tcp);
 
     /* return 0 to signal close, if necessary */
@@ -2438,34 +2944,41 @@ gssize tcp_sendUserData(TCP* tcp, const Host* host, UntypedForeignPtr buffer, gs
         }
     }
 
+    gsize nBytes = _foreigniovec_totalLength(iov, iovcnt);
+
     /* maximum data we can send network, o/w tcp truncates and only sends 65536*/
     gsize acceptable = MIN(nBytes, 65535);
     gsize space = _tcp_getBufferSpaceOut(tcp);
     gsize remaining = MIN(acceptable, space);
 
-    /* break data into segments and send each in a packet */
-    gsize maxPacketLength = CONFIG_TCP_MAX_SEGMENT_SIZE;
+    /* break data into segments and send each in a packet, or several in a packet when sending
+     * multi-segment packets */
+    gsize maxPacketLength = _tcp_getMaxPacketPayload(tcp);
     gsize bytesCopied = 0;
 
-    /* Need non-NULL buffer. */
-    /* FIXME: should push this check to the point the data is actually read, to correctly handle
-     * non-NULL pointers that aren't accessible. This is currently in the Payload code; need to
-     * bubble up errors from there. If we do bubble up from the payload code, we also need to undo
-     * the TCP state changes made earlier, for example the sequence number increment in the
-     * _tcp_createPacketWithoutPayload code.
-     */
-    if (buffer.val == 0) {
+    /* Need non-NULL buffers. */
+    if (_foreigniovec_hasNull(iov, iovcnt)) {
         return -EFAULT;
     }
 
-    /* create as many packets as needed */
+    /* All of the data is read at once, before any TCP state changes, so that a buffer that can't
+     * be read fails the send. Each packet's payload is then a slice of it. */
+    Payload* buffer = NULL;
+    if (remaining > 0) {
+        int error = 0;
+        buffer = _tcp_readUserData(iov, iovcnt, remaining, mem, &error);
+        if (buffer == NULL) {
+            return error;
+        }
+    }
+
+    /* create as many packets as needed; a packet may contain data from several buffers */
     while(remaining > 0) {
         gsize copyLength = MIN(maxPacketLength, remaining);
 
         /* use helper to create the packet */
-        Packet* packet = _tcp_createDataPacket(tcp, host, PTCP_ACK,
-                                               (UntypedForeignPtr){.val = buffer.val + bytesCopied},
-                                               copyLength, mem);
+        Packet* packet =
+            _tcp_createDataPacket(tcp, host, PTCP_ACK, buffer, bytesCopied, copyLength);
 
         if(copyLength > 0) {
             /* we are sending more user data */
@@ -2482,7 +2995,13 @@ gssize tcp_sendUserData(TCP* tcp, const Host* host, UntypedForeignPtr buffer, gs
         bytesCopied += copyLength;
     }
 
-    trace("%s <-> %s: sending %"G_GSIZE_FORMAT" user bytes", tcp->super.boundString, tcp->super.peerString, bytesCopied);
+    if (buffer != NULL) {
+        /* the packets hold refs to their slices of the buffer now */
+        payload_unref(buffer);
+    }
+
+    trace("%s <-> %s: sending %"G_GSIZE_FORMAT" user bytes from %"G_GSIZE_FORMAT" buffers",
+          tcp->super.boundString, tcp->super.peerString, bytesCopied, iovcnt);
 
     /* now flush as much as possible out to socket */
     _tcp_flush(tcp, host);
@@ -2506,9 +3025,29 @@ static void _tcp_sendWindowUpdate(const Host* host, gpointer voidInetSocket, gpo
     tcp->receive.windowUpdatePending = FALSE;
 }
 
-/* Address and port must be in network byte order. */
-gssize tcp_receiveUserData(TCP* tcp, const Host* host, UntypedForeignPtr buffer, gsize nBytes,
-                           in_addr_t* ip, in_port_t* port, MemoryManager* mem) {
+/* Copies `length` bytes of the packet's payload starting at `payloadOffset` into the plugin
+ * buffers at the cursor, which may span several plugin buffers. Returns the number of bytes copied,
+ * or a negative errno. */
+static gssize _tcp_copyPayloadToIoVec(const Packet* packet, gsize payloadOffset, gsize length,
+                                      ForeignIoVecCursor* cursor, MemoryManager* mem) {
+    gsize copied = 0;
+    while (copied < length) {
+        ForeignIoVec range = _foreigniovcursor_next(cursor, length - copied);
+        utility_alwaysAssert(range.len > 0);
+
+        gssize rv = packet_copyPayloadWithMemoryManager(packet, payloadOffset + copied, range.base,
+                                                        range.len, mem);
+        if (rv < 0) {
+            return rv;
+        }
+        utility_debugAssert((gsize)rv == range.len);
+        copied += rv;
+    }
+    return copied;
+}
+
+gssize tcp_receiveUserData(TCP* tcp, const Host* host, const ForeignIoVec* iov, gsize iovcnt,
+                           MemoryManager* mem) {
     MAGIC_ASSERT(tcp);
 
     /*
@@ -2522,10 +3061,11 @@ gssize tcp_receiveUserData(TCP* tcp, const Host* host, UntypedForeignPtr buffer,
     /* make sure we pull in all readable user data */
     _tcp_flush(tcp, host);
 
+    gsize nBytes = _foreigniovec_totalLength(iov, iovcnt);
     gsize remaining = nBytes;
     gsize totalCopied = 0;
-    gsize offset = 0;
     gsize copyLength = 0;
+    ForeignIoVecCursor cursor = _foreigniovcursor_new(iov, iovcnt);
 
     if ((legacysocket_getInputBufferLength(&tcp->super) == 0) &&
         (tcp->partialUserDataPacket == NULL) && !(tcp->error & TCPE_RECEIVE_EOF)) {
@@ -2533,7 +3073,7 @@ gssize tcp_receiveUserData(TCP* tcp, const Host* host, UntypedForeignPtr buffer,
         return -EWOULDBLOCK;
     }
 
-    if (buffer.val == 0 && nBytes > 0) {
+    if (_foreigniovec_hasNull(iov, iovcnt)) {
         debug("Can't recv >0 bytes into NULL buffer on socket");
         return -EFAULT;
     }
@@ -2545,15 +3085,14 @@ gssize tcp_receiveUserData(TCP* tcp, const Host* host, UntypedForeignPtr buffer,
         utility_debugAssert(partialBytes > 0);
 
         copyLength = MIN(partialBytes, remaining);
-        gssize bytesCopied = packet_copyPayloadWithMemoryManager(
-            tcp->partialUserDataPacket, tcp->partialOffset, buffer, copyLength, mem);
+        gssize bytesCopied = _tcp_copyPayloadToIoVec(
+            tcp->partialUserDataPacket, tcp->partialOffset, copyLength, &cursor, mem);
         if (bytesCopied < 0) {
             // Error writing to UntypedForeignPtr
             return bytesCopied;
         }
         totalCopied += bytesCopied;
         remaining -= bytesCopied;
-        offset += bytesCopied;
 
         if(bytesCopied >= partialBytes) {
             /* we finished off the partial packet */
@@ -2584,8 +3123,7 @@ gssize tcp_receiveUserData(TCP* tcp, const Host* host, UntypedForeignPtr buffer,
 
         gsize packetLength = packet_getPayloadSize(nextPacket);
         copyLength = MIN(packetLength, remaining);
-        gssize bytesCopied = packet_copyPayloadWithMemoryManager(
-            nextPacket, 0, (UntypedForeignPtr){.val = buffer.val + offset}, copyLength, mem);
+        gssize bytesCopied = _tcp_copyPayloadToIoVec(nextPacket, 0, copyLength, &cursor, mem);
         if (bytesCopied < 0) {
             // Error writing to UntypedForeignPtr
             if (totalCopied > 0) {
@@ -2596,7 +3134,6 @@ gssize tcp_receiveUserData(TCP* tcp, const Host* host, UntypedForeignPtr buffer,
         }
         totalCopied += bytesCopied;
         remaining -= bytesCopied;
-        offset += bytesCopied;
 
         Packet* packet = legacysocket_removeFromInputBuffer((LegacySocket*)tcp, host);
         /* we update `FileState_READABLE` below */
@@ -2647,7 +3184,7 @@ gssize tcp_receiveUserData(TCP* tcp, const Host* host, UntypedForeignPtr buffer,
     /* update the receive buffer size based on new packets received */
     if(tcp->autotune.isEnabled && !tcp->autotune.userDisabledReceive) {
         if(host_autotuneReceiveBuffer(host)) {
-            _tcp_autotuneReceiveBuffer(tcp, host, totalCopied);
+            _tcp_autotuneReceiveBuffer(tcp, totalCopied);
         }
     }
 
@@ -2698,9 +3235,8 @@ static void _tcp_free(LegacyFile* descriptor) {
     MAGIC_ASSERT(tcp);
 
     priorityqueue_free(tcp->throttledOutput);
-    priorityqueue_free(tcp->unorderedInput);
-    g_hash_table_destroy(tcp->retransmit.queue);
-    priorityqueue_free(tcp->retransmit.scheduledTimerExpirations);
+    _tcpsequencequeue_destroy(&tcp->unorderedInput);
+    _tcpsequencequeue_destroy(&tcp->retransmit.queue);
 
     if (tcp->partialUserDataPacket != NULL) {
         packet_unref(tcp->partialUserDataPacket);
@@ -2720,6 +3256,12 @@ static void _tcp_free(LegacyFile* descriptor) {
     tcp->cong.hooks->tcp_cong_delete(tcp);
     retransmit_tally_destroy(tcp->retransmit.tally);
 
+    if (tcp->send.delayedACKTask != NULL) {
+        /* a scheduled copy of the task may still run, but will see that the socket was freed */
+        taskref_drop(tcp->send.delayedACKTask);
+        tcp->send.delayedACKTask = NULL;
+    }
+
     if (tcp->rustSocket != NULL) {
         inetsocketweak_drop(tcp->rustSocket);
         tcp->rustSocket = NULL;
@@ -2846,7 +3388,8 @@ void tcp_setRustSocket(TCP* tcp, InetSocketWeak* rustSocket) {
     tcp->rustSocket = rustSocket;
 }
 
-TCP* tcp_new(const Host* host, guint receiveBufferSize, guint sendBufferSize) {
+TCP* tcp_new(const Host* host, guint receiveBufferSize, guint sendBufferSize,
+             TCPCongestionType congestionType) {
     TCP* tcp = g_new0(TCP, 1);
     MAGIC_INIT(tcp);
 
@@ -2856,9 +3399,7 @@ TCP* tcp_new(const Host* host, guint receiveBufferSize, guint sendBufferSize) {
     guint32 initial_window = 10;
     gint tcpSSThresh = 0;
 
-    /* in the future we'd like to support more congestion control types
-     * and allow it to be set as a host option */
-    tcp_cong_reno_init(tcp);
+    _tcp_initCongestion(tcp, congestionType);
 
     tcp->send.window = initial_window;
     tcp->send.lastWindow = initial_window;
@@ -2879,19 +3420,21 @@ TCP* tcp_new(const Host* host, guint receiveBufferSize, guint sendBufferSize) {
     tcp->receive.lastAcknowledgment = initialSequenceNumber;
 
     tcp->autotune.isEnabled = TRUE;
-
-    tcp->throttledOutput = priorityqueue_new((GCompareDataFunc)packet_compareTCPSequence, NULL,
-                                             (GDestroyNotify)packet_unref, NULL, NULL);
-    tcp->unorderedInput = priorityqueue_new((GCompareDataFunc)packet_compareTCPSequence, NULL,
-                                            (GDestroyNotify)packet_unref, NULL, NULL);
-    tcp->retransmit.queue =
-            g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)packet_unref);
+    tcp->autotune.bandwidthDownBytes = (gsize)host_get_bw_down_kiBps(host) * 1024;
+    tcp->autotune.bandwidthUpBytes = (gsize)host_get_bw_up_kiBps(host) * 1024;
+    tcp->pacing.isEnabled = host_tcpPacingEnabled(host);
+    tcp->segmentsPerPacket = host_tcpSegmentsPerPacket(host);
+    utility_alwaysAssert(tcp->segmentsPerPacket >= 1 &&
+                         tcp->segmentsPerPacket <= CONFIG_TCP_MAX_SEGMENTS_PER_PACKET);
+
+    tcp->throttledOutput = priorityqueue_newIntrusive(
+        (GCompareDataFunc)packet_compareTCPSequence, NULL, (GDestroyNotify)packet_unref,
+        (PriorityQueueIndexFunc)packet_getTCPOutputQueueIndex);
+    _tcpsequencequeue_init(&tcp->unorderedInput);
+    _tcpsequencequeue_init(&tcp->retransmit.queue);
 
     retransmit_tally_init(&tcp->retransmit.tally);
 
-    tcp->retransmit.scheduledTimerExpirations =
-        priorityqueue_new((GCompareDataFunc)_simulationTimeCompare, NULL, g_free, NULL, NULL);
-
     /* initialize tcp retransmission timeout */
     _tcp_setRetransmitTimeout(tcp, CONFIG_TCP_RTO_INIT);
 
@@ -21,6 +21,12 @@
 typedef struct _TCP TCP;
 struct TCPCong_;
 
+/* A buffer in plugin memory. */
+typedef struct _ForeignIoVec {
+    UntypedForeignPtr base;
+    gsize len;
+} ForeignIoVec;
+
 /* these were redefined in shd-tcp-retransmit-tally.h
  * if they change here, they must also change there!! (-RSW)
  */
@@ -40,7 +46,8 @@ enum _TCPCongestionType {
     TCP_CC_UNKNOWN, TCP_CC_AIMD, TCP_CC_RENO, TCP_CC_CUBIC,
 };
 
-TCP* tcp_new(const Host* host, guint receiveBufferSize, guint sendBufferSize);
+TCP* tcp_new(const Host* host, guint receiveBufferSize, guint sendBufferSize,
+             TCPCongestionType congestionType);
 
 void tcp_setRustSocket(TCP* tcp, InetSocketWeak* rustSocket);
 
@@ -72,6 +79,12 @@ gint tcp_acceptServerPeer(TCP* tcp, const Host* host, in_addr_t* ip, in_port_t*
                           gint* acceptedHandle);
 
 struct TCPCong_ *tcp_cong(TCP *tcp);
+/* Replaces the congestion control algorithm, resetting its state. Only reno
+ * and cubic are supported. */
+void tcp_setCongestionType(TCP* tcp, TCPCongestionType congestionType);
+/* Returns the smoothed round trip time estimate in milliseconds, or 0 if we
+ * don't have one yet. */
+gint tcp_getSmoothedRTT(TCP* tcp);
 
 void tcp_clearAllChildrenIfServer(TCP* tcp);
 
@@ -85,10 +98,13 @@ void tcp_disableReceiveBufferAutotuning(TCP* tcp);
 gboolean tcp_isValidListener(TCP* tcp);
 gboolean tcp_isListeningAllowed(TCP* tcp);
 
-gssize tcp_sendUserData(TCP* tcp, const Host* host, UntypedForeignPtr buffer, gsize nBytes,
-                        in_addr_t ip, in_port_t port, const MemoryManager* mem);
-gssize tcp_receiveUserData(TCP* tcp, const Host* host, UntypedForeignPtr buffer, gsize nBytes,
-                           in_addr_t* ip, in_port_t* port, MemoryManager* mem);
+/* Sends data from the `iovcnt` plugin buffers in order, as if they were a single buffer. The data
+ * is split into MSS-sized packets regardless of the buffer boundaries, and is flushed once. */
+gssize tcp_sendUserData(TCP* tcp, const Host* host, const ForeignIoVec* iov, gsize iovcnt,
+                        const MemoryManager* mem);
+/* Receives data into the `iovcnt` plugin buffers in order, as if they were a single buffer. */
+gssize tcp_receiveUserData(TCP* tcp, const Host* host, const ForeignIoVec* iov, gsize iovcnt,
+                           MemoryManager* mem);
 
 gint tcp_shutdown(TCP* tcp, const Host* host, gint how);
 
@@ -0,0 +1,324 @@
+#include "main/host/descriptor/tcp_cong_cubic.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "lib/logger/logger.h"
+#include "main/core/definitions.h"
+#include "main/core/worker.h"
+#include "main/host/descriptor/descriptor.h"
+#include "main/host/descriptor/tcp.h"
+#include "main/host/descriptor/tcp_cong.h"
+
+const char* TCP_CONG_CUBIC_NAME = "cubic";
+
+/* RFC 8312 constants: the cubic scaling factor and the multiplicative
+ * decrease factor. */
+#define CUBIC_C 0.4
+#define CUBIC_BETA 0.7
+
+typedef struct CACubic_ {
+
+    const TCPCongHooks *state_hooks;
+
+    size_t duplicate_ack_n;
+
+    guint32 ssthresh;
+
+    /* window size just before the last reduction, and the one before that
+     * (used for fast convergence) */
+    gdouble w_max;
+    gdouble w_last_max;
+
+    /* start of the current congestion avoidance epoch */
+    bool epoch_started;
+    CSimulationTime epoch_start;
+
+    /* time (in seconds) that the cubic function takes to grow back to the
+     * origin point, which is w_max unless we were already above it */
+    gdouble k;
+    gdouble origin_point;
+
+    /* the window a standard (reno) flow would have, for tcp friendliness */
+    gdouble w_tcp;
+
+    /* acked packets not yet counted towards a cwnd increase */
+    gdouble cong_avoid_nacked;
+
+} CACubic;
+
+/*
+ * Prototype these to avoid circular refs.
+ */
+static inline const struct TCPCongHooks_ *slow_start_hooks_();
+static inline const struct TCPCongHooks_ *fast_recovery_hooks_();
+static inline const struct TCPCongHooks_ *cong_avoid_hooks_();
+
+/* HELPERS *******************************************************/
+
+/* Remember where the window was when the loss happened, and shrink the
+ * slow start threshold by beta instead of reno's half. */
+static inline void on_loss(TCP *tcp, CACubic *cubic) {
+    gdouble cwnd = tcp_cong(tcp)->cwnd;
+
+    cubic->epoch_started = false;
+
+    // fast convergence: release bandwidth sooner if the window keeps
+    // shrinking, since a new flow is probably competing with us
+    if (cwnd < cubic->w_last_max) {
+        cubic->w_last_max = cwnd;
+        cubic->w_max = cwnd * (1.0 + CUBIC_BETA) / 2.0;
+    } else {
+        cubic->w_last_max = cwnd;
+        cubic->w_max = cwnd;
+    }
+
+    cubic->ssthresh = MAX((guint32)(cwnd * CUBIC_BETA), 2);
+}
+
+/*
+ * Pass in a non-zero value for n to ack n packets during the transition.
+ */
+static inline void transition_to_cong_avoid(TCP *tcp, CACubic *cubic, guint32 n) {
+    cubic->cong_avoid_nacked = 0;
+    cubic->epoch_started = false;
+    cubic->state_hooks = cong_avoid_hooks_();
+    cubic->state_hooks->tcp_cong_new_ack_ev(tcp, n);
+    debug("[CONG] desc=%p transition_to_cong_avoid", (LegacyFile*)tcp);
+}
+
+/* SLOW START *******************************************************/
+
+static void ca_cubic_slow_start_duplicate_ack_ev_(TCP *tcp) {
+    CACubic *cubic = tcp_cong(tcp)->ca;
+    cubic->duplicate_ack_n++;
+
+    if (cubic->duplicate_ack_n == 3) { // transition to fast recovery
+
+        trace("[CONG-AVOID] three duplicate acks");
+        debug("[CONG] desc %p three duplicate acks transition_to_fast_recovery", (LegacyFile*)tcp);
+
+        on_loss(tcp, cubic);
+        tcp_cong(tcp)->cwnd = cubic->ssthresh + 3;
+
+        cubic->state_hooks = fast_recovery_hooks_();
+    }
+}
+
+static void ca_cubic_slow_start_new_ack_ev_(TCP *tcp, guint32 n) {
+    CACubic *cubic = tcp_cong(tcp)->ca;
+
+    cubic->duplicate_ack_n = 0;
+
+    guint32 new_cwnd = tcp_cong(tcp)->cwnd;
+    new_cwnd += n;
+
+    if (new_cwnd >= cubic->ssthresh) { // transition to cong avoid
+        guint32 nleft = new_cwnd - cubic->ssthresh;
+        tcp_cong(tcp)->cwnd = cubic->ssthresh;
+        transition_to_cong_avoid(tcp, cubic, nleft);
+    } else {
+        tcp_cong(tcp)->cwnd = new_cwnd;
+    }
+}
+
+/* FAST RECOVERY *******************************************************/
+
+static void ca_cubic_fast_recovery_duplicate_ack_ev_(TCP *tcp) {
+    tcp_cong(tcp)->cwnd += 1;
+}
+
+static void ca_cubic_fast_recovery_new_ack_ev_(TCP *tcp, guint32 n) {
+    CACubic *cubic = tcp_cong(tcp)->ca;
+
+    cubic->duplicate_ack_n = 0;
+    tcp_cong(tcp)->cwnd = cubic->ssthresh;
+
+    transition_to_cong_avoid(tcp, cubic, n);
+}
+
+/* CONG AVOID *******************************************************/
+
+static void ca_cubic_cong_avoid_new_ack_ev_(TCP *tcp, guint32 n) {
+    CACubic *cubic = tcp_cong(tcp)->ca;
+
+    cubic->duplicate_ack_n = 0;
+
+    if (n == 0) {
+        return;
+    }
+
+    CSimulationTime now = worker_getCurrentSimulationTime();
+    gdouble cwnd = tcp_cong(tcp)->cwnd;
+
+    if (!cubic->epoch_started) {
+        cubic->epoch_started = true;
+        cubic->epoch_start = now;
+        cubic->cong_avoid_nacked = 0;
+        cubic->w_tcp = cwnd;
+
+        if (cwnd < cubic->w_max) {
+            cubic->k = cbrt((cubic->w_max - cwnd) / CUBIC_C);
+            cubic->origin_point = cubic->w_max;
+        } else {
+            cubic->k = 0;
+            cubic->origin_point = cwnd;
+        }
+    }
+
+    // aim for where the cubic function will be one rtt from now
+    gdouble rtt = ((gdouble)tcp_getSmoothedRTT(tcp)) / 1000.0;
+    gdouble t = ((gdouble)(now - cubic->epoch_start)) / ((gdouble)SIMTIME_ONE_SECOND) + rtt;
+    gdouble offset = t - cubic->k;
+    gdouble target = cubic->origin_point + CUBIC_C * offset * offset * offset;
+
+    // number of acked packets needed to grow the window by one
+    gdouble cnt = (target > cwnd) ? cwnd / (target - cwnd) : 100.0 * cwnd;
+
+    // never grow slower than a reno flow would in the same conditions
+    cubic->w_tcp += (3.0 * (1.0 - CUBIC_BETA) / (1.0 + CUBIC_BETA)) * n / cwnd;
+    if (cubic->w_tcp > cwnd) {
+        cnt = MIN(cnt, cwnd / (cubic->w_tcp - cwnd));
+    }
+
+    // and never grow by more than half of the window per rtt
+    cnt = MAX(cnt, 2.0);
+
+    cubic->cong_avoid_nacked += n;
+    while (cubic->cong_avoid_nacked >= cnt) {
+        cubic->cong_avoid_nacked -= cnt;
+        tcp_cong(tcp)->cwnd += 1;
+    }
+}
+
+/*******************************************************************/
+
+static void ca_cubic_init_(TCP *tcp, CACubic *cubic) {
+    tcp_cong(tcp)->cwnd = 10;
+    cubic->ssthresh = INT32_MAX;
+    cubic->duplicate_ack_n = 0;
+    cubic->w_max = 0;
+    cubic->w_last_max = 0;
+    cubic->epoch_started = false;
+    cubic->epoch_start = 0;
+    cubic->k = 0;
+    cubic->origin_point = 0;
+    cubic->w_tcp = 0;
+    cubic->cong_avoid_nacked = 0;
+    cubic->state_hooks = slow_start_hooks_();
+}
+
+static void tcp_cong_cubic_delete_(TCP *tcp) {
+    free(tcp_cong(tcp)->ca);
+}
+
+static void tcp_cong_cubic_duplicate_ack_ev_(TCP *tcp) {
+    CACubic *cubic = tcp_cong(tcp)->ca;
+    cubic->state_hooks->tcp_cong_duplicate_ack_ev(tcp);
+}
+
+static bool tcp_cong_cubic_fast_recovery_(TCP *tcp) {
+    CACubic *cubic = tcp_cong(tcp)->ca;
+    return cubic->state_hooks == fast_recovery_hooks_();
+}
+
+static void tcp_cong_cubic_new_ack_ev_(TCP *tcp, guint32 n) {
+    CACubic *cubic = tcp_cong(tcp)->ca;
+    cubic->state_hooks->tcp_cong_new_ack_ev(tcp, n);
+}
+
+/* All timeouts have the same behavior! */
+static void tcp_cong_cubic_timeout_ev_(TCP *tcp) {
+
+    CACubic *cubic = tcp_cong(tcp)->ca;
+
+    cubic->duplicate_ack_n = 0;
+    on_loss(tcp, cubic);
+    tcp_cong(tcp)->cwnd = 10;
+
+    // transition to slow start
+    cubic->state_hooks = slow_start_hooks_();
+    debug("[CONG] desc %p transition_to_slow_start", (LegacyFile*)tcp);
+}
+
+static guint32 tcp_cong_cubic_ssthresh_(TCP *tcp) {
+    CACubic *cubic = tcp_cong(tcp)->ca;
+    return cubic->ssthresh;
+}
+
+static const char* tcp_cong_cubic_name_str_() {
+    return TCP_CONG_CUBIC_NAME;
+}
+
+static const struct TCPCongHooks_ cubic_hooks_ = {
+    .tcp_cong_delete = tcp_cong_cubic_delete_,
+    .tcp_cong_duplicate_ack_ev = tcp_cong_cubic_duplicate_ack_ev_,
+    .tcp_cong_fast_recovery = tcp_cong_cubic_fast_recovery_,
+    .tcp_cong_new_ack_ev = tcp_cong_cubic_new_ack_ev_,
+    .tcp_cong_timeout_ev = tcp_cong_cubic_timeout_ev_,
+    .tcp_cong_ssthresh = tcp_cong_cubic_ssthresh_,
+    .tcp_cong_name_str = tcp_cong_cubic_name_str_,
+};
+
+void tcp_cong_cubic_init(TCP *tcp) {
+    CACubic *cubic = malloc(sizeof(CACubic));
+    ca_cubic_init_(tcp, cubic);
+
+    tcp_cong(tcp)->cwnd = 1;
+    tcp_cong(tcp)->hooks = (TCPCongHooks*)&cubic_hooks_;
+    tcp_cong(tcp)->ca = cubic;
+}
+
+void tcp_cong_cubic_resume(TCP *tcp, guint32 cwnd, guint32 ssthresh) {
+    CACubic *cubic = tcp_cong(tcp)->ca;
+
+    tcp_cong(tcp)->cwnd = cwnd;
+    cubic->ssthresh = ssthresh;
+    cubic->state_hooks = (cwnd < ssthresh) ? slow_start_hooks_() : cong_avoid_hooks_();
+}
+
+static const struct TCPCongHooks_ slow_start_hooks__ = {
+    .tcp_cong_delete = NULL,
+    .tcp_cong_duplicate_ack_ev = ca_cubic_slow_start_duplicate_ack_ev_,
+    .tcp_cong_fast_recovery = NULL,
+    .tcp_cong_new_ack_ev = ca_cubic_slow_start_new_ack_ev_,
+    .tcp_cong_timeout_ev = NULL,
+    .tcp_cong_ssthresh = NULL,
+    .tcp_cong_name_str = NULL,
+};
+
+static const struct TCPCongHooks_ fast_recovery_hooks__ = {
+    .tcp_cong_delete = NULL,
+    .tcp_cong_duplicate_ack_ev = ca_cubic_fast_recovery_duplicate_ack_ev_,
+    .tcp_cong_fast_recovery = NULL,
+    .tcp_cong_new_ack_ev = ca_cubic_fast_recovery_new_ack_ev_,
+    .tcp_cong_timeout_ev = NULL,
+    .tcp_cong_ssthresh = NULL,
+    .tcp_cong_name_str = NULL,
+};
+
+/* slow start and cong avoidance have the same dupl act behavior */
+static const struct TCPCongHooks_ cong_avoid_hooks__ = {
+    .tcp_cong_delete = NULL,
+    .tcp_cong_duplicate_ack_ev = ca_cubic_slow_start_duplicate_ack_ev_,
+    .tcp_cong_fast_recovery = NULL,
+    .tcp_cong_new_ack_ev = ca_cubic_cong_avoid_new_ack_ev_,
+    .tcp_cong_timeout_ev = NULL,
+    .tcp_cong_ssthresh = NULL,
+    .tcp_cong_name_str = NULL,
+};
+
+static inline const struct TCPCongHooks_ *slow_start_hooks_() {
+    return &slow_start_hooks__;
+}
+
+static inline const struct TCPCongHooks_ *fast_recovery_hooks_() {
+    return &fast_recovery_hooks__;
+}
+
+static inline const struct TCPCongHooks_ *cong_avoid_hooks_() {
+    return &cong_avoid_hooks__;
+}
@@ -0,0 +1,16 @@
+#ifndef SHD_TCP_CONG_CUBIC_H_
+#define SHD_TCP_CONG_CUBIC_H_
+
+#include "main/host/descriptor/tcp.h"
+#include "main/host/descriptor/tcp_cong.h"
+
+// the name linux gives for this congestion control algorithm
+extern const char* TCP_CONG_CUBIC_NAME;
+
+void tcp_cong_cubic_init(TCP *tcp);
+
+// Continue from the window of a connection whose congestion control was just
+// switched to this algorithm, in slow start if the window is below ssthresh.
+void tcp_cong_cubic_resume(TCP *tcp, guint32 cwnd, guint32 ssthresh);
+
+#endif // SHD_TCP_CONG_CUBIC_H_
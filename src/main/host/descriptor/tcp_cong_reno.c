@@ -190,6 +190,14 @@ void tcp_cong_reno_init(TCP *tcp) {
     tcp_cong(tcp)->ca = reno;
 }
 
+void tcp_cong_reno_resume(TCP *tcp, guint32 cwnd, guint32 ssthresh) {
+    CAReno *reno = tcp_cong(tcp)->ca;
+
+    tcp_cong(tcp)->cwnd = cwnd;
+    reno->ssthresh = ssthresh;
+    reno->state_hooks = (cwnd < ssthresh) ? slow_start_hooks_() : cong_avoid_hooks_();
+}
+
 static const struct TCPCongHooks_ slow_start_hooks__ = {
     .tcp_cong_delete = NULL,
     .tcp_cong_duplicate_ack_ev = ca_reno_slow_start_duplicate_ack_ev_,
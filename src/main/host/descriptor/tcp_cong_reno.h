@@ -9,4 +9,8 @@ extern const char* TCP_CONG_RENO_NAME;
 
 void tcp_cong_reno_init(TCP *tcp);
 
+// Continue from the window of a connection whose congestion control was just
+// switched to this algorithm, in slow start if the window is below ssthresh.
+void tcp_cong_reno_resume(TCP *tcp, guint32 cwnd, guint32 ssthresh);
+
 #endif // SHD_TCP_CONG_RENO_H_
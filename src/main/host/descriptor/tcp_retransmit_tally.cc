@@ -1,20 +1,19 @@
 #include "main/host/descriptor/tcp_retransmit_tally.h"
 #include <algorithm>
 #include <cassert>
-#include <gmodule.h>
-#include <iostream>
-#include <random>
-#include <string>
+#include <iterator>
 #include <utility>
 
 static bool still_sorted_(const Ranges &r) {
    bool sorted = true;
-
-   if (r.size() > 0) {
-      for (std::size_t idx = 0; sorted && idx < r.size() - 1; ++idx) {
-         sorted = r[idx].first < r[idx].second;
-         sorted = sorted && (r[idx].second < r[idx + 1].first);
-      }
+   SeqNum prev_end = 0;
+   bool first = true;
+
+   for (auto itr = r.begin(); sorted && itr != r.end(); ++itr) {
+      sorted = itr->first < itr->second;
+      sorted = sorted && (first || prev_end < itr->first);
+      prev_end = itr->second;
+      first = false;
    }
 
    return sorted;
@@ -32,146 +31,104 @@ static const RetransmitTally *cast_and_assert(const void *p) {
    return rt;
 }
 
-static bool range_contains(const SeqRange &range, SeqNum value) {
-   return (value >= range.first && value < range.second);
-}
-
-static bool range_overlap(const SeqRange &lhs, const SeqRange &rhs) {
-   return lhs.first < rhs.second && rhs.first < lhs.second;
-}
-
-static bool range_adj(const SeqRange &lhs, const SeqRange &rhs) {
-   return (lhs.second == rhs.first || rhs.second == lhs.first);
-}
-
-static bool ranges_contains(const Ranges &ranges, SeqNum value) {
-  for (const auto &range : ranges) {
-    if (range_contains(range, value)) {
-      return true;
-    }
-  }
-
-  return false;
-}
-
-static std::pair<Ranges::iterator, Ranges::iterator>
-ranges_mergable(Ranges &ranges, const SeqRange &value) {
-   assert(still_sorted_(ranges));
-   std::pair<Ranges::iterator, Ranges::iterator> mergable;
-
-   mergable.first = ranges.end();
+void Ranges::insert(const SeqRange &value) {
+   assert(value.first < value.second);
+   SeqRange merged = value;
 
-   auto itr = ranges.begin();
-   for (; itr != ranges.end() && value.second >= itr->first; ++itr) {
-      if (mergable.first == ranges.cend()
-          && (range_overlap(*itr, value) || range_adj(*itr, value)))
-      {
-         mergable.first = itr;
-      }
+   // The first range that could overlap or touch `value` is the last one
+   // starting at or before it, if that one reaches up to `value.first`.
+   auto itr = ranges_.upper_bound(value.first);
+   if (itr != ranges_.begin()) {
+      auto prev = std::prev(itr);
+      if (prev->second >= value.first) { itr = prev; }
    }
 
-   mergable.second = itr;
+   while (itr != ranges_.end() && itr->first <= merged.second) {
+      merged.first = std::min(merged.first, itr->first);
+      merged.second = std::max(merged.second, itr->second);
+      itr = ranges_.erase(itr);
+   }
 
-   assert(still_sorted_(ranges));
+   ranges_.emplace_hint(itr, merged.first, merged.second);
 
-   return mergable;
+   assert(still_sorted_(*this));
 }
 
-static void range_merge(SeqRange *x, const SeqRange &y) {
-   x->first = std::min(x->first, y.first);
-   x->second = std::max(x->second, y.second);
+bool Ranges::contains(SeqNum value) const {
+   auto itr = ranges_.upper_bound(value);
+   if (itr == ranges_.begin()) { return false; }
+   return value < std::prev(itr)->second;
 }
 
-static void ranges_insert(Ranges *ranges, const SeqRange &value) {
-   assert(still_sorted_(*ranges));
-   auto original = *ranges;
-   auto mergable = ranges_mergable(*ranges, value);
+void Ranges::tidy(SeqNum last_ack) {
+   if (ranges_.empty()) { return; }
 
-   if (mergable.first == ranges->end()) {
-      ranges->insert(mergable.second, value);
-   } else {
-      auto itr = mergable.first;
-      range_merge(&(*itr), value);
-      for (auto jtr = itr + 1; jtr != mergable.second; ++jtr) {
-         range_merge(&(*itr), *jtr);
+   auto front = ranges_.begin();
+
+   if (last_ack >= front->first && last_ack < front->second - 1) {
+      SeqNum right = front->second;
+      ranges_.erase(front);
+      ranges_.emplace(last_ack, right);
+   } else if (last_ack >= front->second - 1) {
+      // Ranges are ordered and disjoint, so the fully acked ones are a prefix.
+      while (front != ranges_.end() && last_ack >= front->second) {
+         front = ranges_.erase(front);
       }
-      ranges->erase(mergable.first + 1, mergable.second);
    }
 
-   assert(still_sorted_(*ranges));
+   assert(still_sorted_(*this));
 }
 
-static Ranges range_subtract(const SeqRange &lhs, const SeqRange &rhs) {
-   // Can produce two ranges in the case that rhs \in lhs.
-   // Returning a std::vector makes checking for this case easy.
-   Ranges result;
-   result.reserve(2);
-
-   if (range_overlap(lhs, rhs)) {
-      if (lhs.first < rhs.first) {
-         result.emplace_back(lhs.first, rhs.first);
+// Writes lhs - rhs to `out`, where both inputs are ordered, disjoint ranges.
+template <typename LhsItr, typename RhsItr>
+static void ranges_subtract(LhsItr lhs_begin, LhsItr lhs_end, RhsItr rhs_begin, RhsItr rhs_end,
+                            RangeVec *out) {
+   out->clear();
+   auto jtr = rhs_begin;
+
+   for (auto itr = lhs_begin; itr != lhs_end; ++itr) {
+      SeqNum left = itr->first;
+
+      // Skip subtrahends lying entirely left of what remains of this range.
+      while (jtr != rhs_end && jtr->second <= left) { ++jtr; }
+
+      // Carve out every subtrahend that overlaps this range; the last one may
+      // extend past it and overlap the next range too, so don't consume it.
+      for (auto ktr = jtr; ktr != rhs_end && ktr->first < itr->second; ++ktr) {
+         if (left < ktr->first) { out->emplace_back(left, ktr->first); }
+         left = std::max(left, ktr->second);
+         if (left >= itr->second) { break; }
       }
 
-      if (rhs.second < lhs.second) {
-         result.emplace_back(rhs.second, lhs.second);
-      }
-   } else {
-      result.push_back(lhs);
+      if (left < itr->second) { out->emplace_back(left, itr->second); }
    }
-
-   assert(still_sorted_(result));
-
-   return result;
 }
 
-static Ranges ranges_subtract(const Ranges &lhs, const Ranges &rhs) {
-   Ranges result;
-
-   if (rhs.size() == 0) {
-      result = lhs; // Assignment here to encourage RVO
-   } else if (lhs.size() > 0) {
-
-      std::size_t idx = 0;
-      auto jtr = rhs.cbegin();
-      SeqRange lhs_to_consider = lhs[0];
-
-      while (idx < lhs.size() && jtr != rhs.cend()) {
-         if (jtr->second <= lhs_to_consider.first) {
-            ++jtr;
-         }
-         else if (lhs_to_consider.second <= jtr->first) {
-            result.push_back(lhs_to_consider);
-            ++idx;
-            if (idx < lhs.size()) { lhs_to_consider = lhs[idx]; }
-         } else {
-            Ranges sub = range_subtract(lhs_to_consider, *jtr);
-            if (sub.size() == 2) { result.push_back(sub.front()); }
-            if (sub.size() >= 1) { lhs_to_consider = sub.back(); }
-            else {
-               ++idx;
-               if (idx < lhs.size()) { lhs_to_consider = lhs[idx]; }
-            }
-         }
-      }
+// Removes `value` from the ordered, disjoint ranges in `ranges`.
+static void range_vec_remove(RangeVec *ranges, const SeqRange &value) {
+   auto by_end = [](const SeqRange &range, SeqNum seq) { return range.second <= seq; };
+   auto itr = std::lower_bound(ranges->begin(), ranges->end(), value.first, by_end);
 
-      if (jtr == rhs.cend()) {
-         result.push_back(lhs_to_consider);
-         ++idx;
-
-         while (idx < lhs.size()) {
-            result.push_back(lhs[idx++]);
-         }
-      }
+   if (itr == ranges->end() || itr->first >= value.second) { return; }
 
+   // Splitting a range is the only way the number of ranges can grow.
+   if (itr->first < value.first && value.second < itr->second) {
+      SeqRange left{itr->first, value.first};
+      itr->first = value.second;
+      ranges->insert(itr, left);
+      return;
    }
 
-   for (const auto &range : result) {
-      assert(range.first < range.second);
+   if (itr->first < value.first) {
+      itr->second = value.first;
+      ++itr;
    }
 
-   assert(still_sorted_(result));
+   auto jtr = itr;
+   while (jtr != ranges->end() && jtr->second <= value.second) { ++jtr; }
+   if (jtr != ranges->end() && jtr->first < value.second) { jtr->first = value.second; }
 
-   return result;
+   ranges->erase(itr, jtr);
 }
 
 extern "C" {
@@ -200,48 +157,35 @@ enum TCPProcessFlags_ retransmit_tally_update(void *p, uint32_t last_ack, uint32
    } else if (last_ack > rt->last_ack_) { // new ack branch
       rt->last_ack_ = last_ack;
       rt->num_dupl_ack_ = 0;
-      rt->tidy_ranges(&rt->marked_lost_);
-      rt->tidy_ranges(&rt->sacked_);
-      rt->tidy_ranges(&rt->retransmitted_);
+      rt->settle_lost();
+      rt->marked_lost_.tidy(rt->last_ack_);
+      rt->sacked_.tidy(rt->last_ack_);
+      rt->retransmitted_.tidy(rt->last_ack_);
+      rt->lost_exact_ = false;
    }
 
    if (rt->num_dupl_ack_ >= RetransmitTally::kDuplAckLostThresh
-       && !ranges_contains(rt->retransmitted_, rt->last_ack_)) {
+       && !rt->retransmitted_.contains(rt->last_ack_)) {
       // std::cerr << "3 dupl acks!" << std::endl;
       // std::cerr << last_ack << std::endl;
       //uint32_t right_edge_exclusive = MAX(max_ack, rt->last_ack_ + 1);
       uint32_t right_edge_exclusive = rt->last_ack_ + 1;
-      ranges_insert(&rt->marked_lost_, {rt->last_ack_, right_edge_exclusive});
-      rt->compute_lost(); // sacked packets are removed from lost list here
-      if (rt->lost_.size() > 0) { ret |= TCP_PF_DATA_LOST_; }
+      rt->marked_lost_.insert({rt->last_ack_, right_edge_exclusive});
+      rt->lost_pending_ = true;
+      // sacked packets are removed from lost list here
+      if (!rt->lost().empty()) { ret |= TCP_PF_DATA_LOST_; }
    }
 
    return static_cast<TCPProcessFlags_>(ret);
 }
 
-/* We have to do an awful linear scan here because sacks use GList and there
- * is no efficient way to get the last element. */
-void retransmit_tally_mark_sacked(void *p, GList *sacked) {
+void retransmit_tally_mark_sacked(void *p, uint32_t begin, uint32_t end) {
    auto rt = cast_and_assert(p);
-   SeqRange sacked_block{-1, -1};
-
-   GList *n = g_list_first(sacked);
-
-   while (n != nullptr) {
-      int s = GPOINTER_TO_INT(n->data);
-      if (sacked_block.first == -1) { sacked_block.first = s; }
-
-      if (g_list_next(n) == nullptr
-          || GPOINTER_TO_INT(g_list_next(n)->data) != s + 1)
-      {
-         sacked_block.second = s + 1;
-         ranges_insert(&rt->sacked_, sacked_block);
-         sacked_block.first = -1;
-         sacked_block.second = -1;
-      }
-
-      n = g_list_next(n);
-   }
+   if (begin >= end) { return; }
+   SeqRange sacked_block{begin, end};
+   rt->settle_lost();
+   rt->sacked_.insert(sacked_block);
+   rt->lost_exact_ = false;
 }
 
 void retransmit_tally_mark_lost(void *p, uint32_t begin, uint32_t end) {
@@ -250,35 +194,55 @@ void retransmit_tally_mark_lost(void *p, uint32_t begin, uint32_t end) {
    if (begin == end) { end += 1; }
    assert(begin < end);
    SeqRange lost_block{begin, end};
-   ranges_insert(&rt->marked_lost_, lost_block);
-   rt->compute_lost();
+   rt->marked_lost_.insert(lost_block);
+   rt->lost_pending_ = true;
 }
 
 void retransmit_tally_mark_retransmitted(void *p, uint32_t begin, uint32_t end)
 {
    auto rt = cast_and_assert(p);
+   if (begin >= end) { return; }
    SeqRange retransmitted_block{begin, end};
-   ranges_insert(&rt->retransmitted_, retransmitted_block);
-   rt->compute_lost();
+   rt->retransmitted_.insert(retransmitted_block);
+   if (!rt->lost_pending_ && rt->lost_exact_) {
+      range_vec_remove(&rt->lost_, retransmitted_block);
+   } else {
+      rt->lost_pending_ = true;
+   }
 }
 
 void retransmit_tally_clear_retransmitted(void *p) {
    auto rt = cast_and_assert(p);
+   rt->settle_lost();
    rt->retransmitted_.clear();
+   rt->lost_exact_ = false;
 }
 
-size_t retransmit_tally_num_lost_ranges(const void *p) {
+void retransmit_tally_for_each_lost_range(const void *p, RetransmitTallyLostRangeFn visit,
+                                          void *data) {
    auto rt = cast_and_assert(p);
-   return rt->lost_.size();
+
+   for (const auto &range : rt->lost()) {
+      visit(range.first, range.second, data);
+   }
 }
 
-void retransmit_tally_populate_lost_ranges(const void *p, uint32_t *lost) {
+void retransmit_tally_mark_lost_retransmitted(void *p) {
    auto rt = cast_and_assert(p);
 
-   for (std::size_t idx = 0; idx < rt->lost_.size(); ++idx) {
-      const auto &range = rt->lost_[idx];
-      lost[2*idx] = range.first;
-      lost[2*idx + 1] = range.second;
+   if (rt->lost().empty()) { return; }
+
+   for (const auto &range : rt->lost_) {
+      rt->retransmitted_.insert(range);
+   }
+
+   // If the lost ranges were exact, everything that was lost is now
+   // retransmitted and nothing is left over. Otherwise they're recomputed, as
+   // retransmitting each range one at a time would have done.
+   if (rt->lost_exact_) {
+      rt->lost_.clear();
+   } else {
+      rt->lost_pending_ = true;
    }
 }
 
@@ -288,7 +252,8 @@ RetransmitTally::RetransmitTally()
    : last_ack_(-1),
      num_dupl_ack_(0),
      magic_num_(kMagicNum),
-     marked_lost_{}, sacked_{}, retransmitted_{}, lost_{}
+     marked_lost_{}, sacked_{}, retransmitted_{}, lost_{}, scratch_{},
+     lost_pending_(false), lost_exact_(true)
 {
 }
 
@@ -300,31 +265,21 @@ RetransmitTally &RetransmitTally::operator=(RetransmitTally &&rhs) {
    sacked_ = std::move(rhs.sacked_);
    retransmitted_ = std::move(rhs.retransmitted_);
    lost_ = std::move(rhs.lost_);
+   lost_pending_ = rhs.lost_pending_;
+   lost_exact_ = rhs.lost_exact_;
    return *this;
 }
 
-void RetransmitTally::compute_lost() {
-   lost_ = ranges_subtract(marked_lost_, sacked_);
-   lost_ = ranges_subtract(lost_, retransmitted_);
-}
-
-void RetransmitTally::tidy_ranges(Ranges *ranges) {
-   assert(still_sorted_(*ranges));
-   auto original = *ranges;
-
-   auto pred = [=] (const SeqRange range) -> bool {
-      return last_ack_ >= range.second;
-   };
-
-   if (ranges->size() > 0 && last_ack_ >= ranges->front().first
-       && last_ack_ < ranges->front().second - 1)
-   {
-      ranges->front().first = last_ack_;
-   }
-   else if (ranges->size() > 0 && last_ack_ >= ranges->front().second - 1) {
-      auto new_end = std::remove_if(ranges->begin(), ranges->end(), pred);
-      ranges->erase(new_end, ranges->end());
+const RangeVec &RetransmitTally::lost() const {
+   if (lost_pending_) {
+      ranges_subtract(marked_lost_.begin(), marked_lost_.end(), sacked_.begin(), sacked_.end(),
+                      &scratch_);
+      ranges_subtract(scratch_.cbegin(), scratch_.cend(), retransmitted_.begin(),
+                      retransmitted_.end(), &lost_);
+      lost_pending_ = false;
+      lost_exact_ = true;
    }
-
-   assert(still_sorted_(*ranges));
+   return lost_;
 }
+
+void RetransmitTally::settle_lost() const { lost(); }
@@ -7,12 +7,11 @@
 #ifdef __cplusplus
 #include <cstddef>
 #include <cstdint>
+#include <map>
 #include <utility>
 #include <vector>
 #endif // __cplusplus
 
-struct _GList;
-
 /* Really hacky and brittle.  Only doing an explicit copy because #including
  * shd-tcp.h and shadow.h is not working. */
 enum TCPProcessFlags_ {
@@ -36,13 +35,19 @@ size_t retransmit_tally_size_bytes();
 
 enum TCPProcessFlags_ retransmit_tally_update(void *p, uint32_t last_ack, uint32_t max_ack, bool is_dup);
 void retransmit_tally_cleanup_sacked(void *p);
-void retransmit_tally_mark_sacked(void *p, struct _GList *sacked);
+/* Marks the block [begin, end) as selectively acknowledged. */
+void retransmit_tally_mark_sacked(void *p, uint32_t begin, uint32_t end);
 /* Marks the block [begin, end) as lost. */
 void retransmit_tally_mark_lost(void *p, uint32_t begin, uint32_t end);
 void retransmit_tally_mark_retransmitted(void *p, uint32_t begin, uint32_t end);
 void retransmit_tally_clear_retransmitted(void *p);
-size_t retransmit_tally_num_lost_ranges(const void *p);
-void retransmit_tally_populate_lost_ranges(const void *p, uint32_t *lost);
+/* Calls `visit` on each lost block [begin, end), in sequence order. `visit`
+ * must not modify the tally. */
+typedef void (*RetransmitTallyLostRangeFn)(uint32_t begin, uint32_t end, void *data);
+void retransmit_tally_for_each_lost_range(const void *p, RetransmitTallyLostRangeFn visit,
+                                          void *data);
+/* Marks every currently lost block as retransmitted, leaving none lost. */
+void retransmit_tally_mark_lost_retransmitted(void *p);
 
 #ifdef __cplusplus
 } // extern "C"
@@ -52,7 +57,34 @@ void retransmit_tally_populate_lost_ranges(const void *p, uint32_t *lost);
 using SeqNum = std::int64_t;
 // Using standard left-closed, right-open (i.e. half-open) semantics
 using SeqRange = std::pair<SeqNum, SeqNum>;
-using Ranges = std::vector<SeqRange>;
+
+// A set of disjoint, non-adjacent ranges kept ordered by their left edge.
+// Inserting, merging, and membership tests are O(log n) in the number of
+// ranges (plus the number of ranges absorbed by a merge).
+class Ranges {
+ public:
+   using Map = std::map<SeqNum, SeqNum>;
+   using const_iterator = Map::const_iterator;
+
+   void insert(const SeqRange &value);
+   bool contains(SeqNum value) const;
+   // Drops everything left of `last_ack`, keeping the legacy rule that a
+   // range whose last sequence number is `last_ack` is left untouched.
+   void tidy(SeqNum last_ack);
+
+   void clear() { ranges_.clear(); }
+   std::size_t size() const { return ranges_.size(); }
+   bool empty() const { return ranges_.empty(); }
+   const_iterator begin() const { return ranges_.cbegin(); }
+   const_iterator end() const { return ranges_.cend(); }
+
+ private:
+   Map ranges_;
+};
+
+// Flat, ordered output of a range computation; rebuilt in place so that its
+// storage is reused across recomputations.
+using RangeVec = std::vector<SeqRange>;
 
 struct RetransmitTally {
    RetransmitTally();
@@ -61,8 +93,10 @@ struct RetransmitTally {
    RetransmitTally(const RetransmitTally &rhs) = delete;
    RetransmitTally &operator=(const RetransmitTally &rhs) = delete;
 
-   void compute_lost();
-   void tidy_ranges(Ranges *ranges);
+   const RangeVec &lost() const;
+   // Performs a pending recomputation of lost_ before an input it must not
+   // see changes.
+   void settle_lost() const;
 
    enum : std::uint64_t { kMagicNum = 0xBEEEEEEF,
                           kDuplAckLostThresh = 3 };
@@ -70,7 +104,16 @@ struct RetransmitTally {
    SeqNum last_ack_;
    std::size_t num_dupl_ack_;
    std::uint64_t magic_num_;
-   Ranges marked_lost_, sacked_, retransmitted_, lost_;
+   Ranges marked_lost_, sacked_, retransmitted_;
+
+   // lost_ = marked_lost_ - sacked_ - retransmitted_, as of the last time a
+   // loss or retransmission was marked. Like the sorted-vector tally this
+   // replaced, later acks, sacks, and cleared retransmissions don't change it
+   // until then. The recomputation is deferred while lost_pending_ is set,
+   // and a retransmission is subtracted from lost_ directly while it is still
+   // exactly the difference of the current ranges (lost_exact_).
+   mutable RangeVec lost_, scratch_;
+   mutable bool lost_pending_, lost_exact_;
 };
 #endif // __cplusplus
 
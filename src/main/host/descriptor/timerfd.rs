@@ -43,7 +43,9 @@ impl TimerFd {
         Arc::new_cyclic(|weak| {
             let weak_cloned = weak.clone();
             AtomicRefCell::new(Self {
-                timer: Timer::new(move |_host| Self::timer_expired(&weak_cloned)),
+                // An expiration only matters to the TimerFd when it makes the TimerFd readable, so
+                // periodic expirations after that are counted lazily when the TimerFd is read.
+                timer: Timer::new_lazy(move |_host| Self::timer_expired(&weak_cloned)),
                 event_source: StateEventSource::new(),
                 state: FileState::ACTIVE,
                 status,
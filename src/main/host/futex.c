@@ -10,32 +10,60 @@
 #include <stdbool.h>
 
 #include "lib/logger/logger.h"
-#include "main/bindings/c/bindings-opaque.h"
+#include "main/bindings/c/bindings.h"
 #include "main/core/definitions.h"
 #include "main/core/worker.h"
 #include "main/utility/utility.h"
 
+// A listener added to a futex. A requeued listener stays in the futex it was originally added to,
+// where it's removed from, and gets a second waiter in the futex it was moved to.
+typedef struct _FutexWaiter FutexWaiter;
+struct _FutexWaiter {
+    // Our node in the futex's `waiters` queue, while we are in it.
+    GList link;
+    StatusListener* listener;
+    // The futex whose `listeners` hold this waiter.
+    Futex* futex;
+    // Whether a wakeup has already been performed on the listener.
+    bool woken;
+    // For a waiter in the futex the listener was originally added to: the futex the listener was
+    // requeued to, if any. We hold a reference to it.
+    Futex* requeuedTo;
+    // For a waiter in a futex the listener was requeued to: the listener's original waiter.
+    FutexWaiter* origin;
+};
+
 struct _Futex {
     // The unique physical address that is used to refer to this futex
     ManagedPhysicalMemoryAddr word;
-    // Listeners waiting for wakups on this futex
-    // The key is a listener of type StatusListener*, the value is a boolean that indicates
-    // whether or not a wakeup has already been performed on the listener.
+    // Waiters that have not been woken up or requeued yet, in the order they started waiting.
+    GQueue waiters;
+    // All listeners that were added and not yet removed, including woken and requeued ones.
+    // The key is a listener of type StatusListener*, the value is its FutexWaiter*.
     GHashTable* listeners;
     // Manage references
     int referenceCount;
     MAGIC_DECLARE;
 };
 
+static void _futexwaiter_free(FutexWaiter* waiter) {
+    if (waiter->requeuedTo) {
+        futex_unref(waiter->requeuedTo);
+    }
+    g_free(waiter);
+}
+
 Futex* futex_new(ManagedPhysicalMemoryAddr word) {
     Futex* futex = malloc(sizeof(*futex));
     *futex = (Futex){.word = word,
-                     .listeners = g_hash_table_new_full(
-                         g_direct_hash, g_direct_equal, (GDestroyNotify)statuslistener_unref, NULL),
+                     .waiters = G_QUEUE_INIT,
+                     .listeners = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                                        (GDestroyNotify)statuslistener_unref,
+                                                        (GDestroyNotify)_futexwaiter_free),
                      .referenceCount = 1,
                      MAGIC_INITIALIZER};
 
-    worker_count_allocation(Futex);
+    worker_count_allocation(FUTEX);
 
     return futex;
 }
@@ -43,11 +71,15 @@ Futex* futex_new(ManagedPhysicalMemoryAddr word) {
 static void _futex_free(Futex* futex) {
     MAGIC_ASSERT(futex);
 
+    // Every waiter has normally been removed by now. If not, e.g. when the host is torn down,
+    // the futex stays counted in the host's shared memory; that only makes the shim pass wakes on
+    // it to us.
+
     g_hash_table_destroy(futex->listeners);
 
     MAGIC_CLEAR(futex);
     free(futex);
-    worker_count_deallocation(Futex);
+    worker_count_deallocation(FUTEX);
 }
 
 void futex_ref(Futex* futex) {
@@ -70,66 +102,126 @@ ManagedPhysicalMemoryAddr futex_getAddress(Futex* futex) {
     return futex->word;
 }
 
+// The host's shared memory records which futexes have waiters so that the shim can handle wakes
+// on the others itself. These keep that record in sync as the waiters empty and refill.
+
+static void _futex_pushWaiter(Futex* futex, FutexWaiter* waiter) {
+    if (g_queue_is_empty(&futex->waiters)) {
+        host_setFutexHasWaiters(worker_getCurrentHost(), futex->word, true);
+    }
+    g_queue_push_tail_link(&futex->waiters, &waiter->link);
+}
+
+static void _futex_unlinkWaiter(Futex* futex, FutexWaiter* waiter) {
+    g_queue_unlink(&futex->waiters, &waiter->link);
+    if (g_queue_is_empty(&futex->waiters)) {
+        host_setFutexHasWaiters(worker_getCurrentHost(), futex->word, false);
+    }
+}
+
+static FutexWaiter* _futex_popWaiter(Futex* futex) {
+    FutexWaiter* waiter = g_queue_peek_head_link(&futex->waiters)->data;
+    _futex_unlinkWaiter(futex, waiter);
+    return waiter;
+}
+
 unsigned int futex_wake(Futex* futex, unsigned int numWakeups) {
     MAGIC_ASSERT(futex);
 
-    // We cannot use an iterator here, in case the hash table is modified
-    // in the status changed callback.
-    GList* listenerList = g_hash_table_get_keys(futex->listeners);
-
-    // Iterate the listeners in deterministic order and perform the requested
-    // number of wakeups if we can. It's probably better to maintain the items
-    // in a sorted structure, e.g. a ring, to make it easier / more efficient to
-    // iterate deterministically while also moving the ring entry pointer so we
-    // don't always wake up the same listener first on every iteration and
-    // possibly starve the others.
-    GList* item = NULL;
-    if(listenerList != NULL) {
-        listenerList = g_list_sort(listenerList, status_listener_compare);
-        item = g_list_first(listenerList);
+    unsigned int numWoken = 0;
+
+    // Wake the waiters in the order they started waiting. Each one is taken off the queue before
+    // its listener runs, in case the callback modifies this futex.
+    while (numWoken < numWakeups && !g_queue_is_empty(&futex->waiters)) {
+        FutexWaiter* waiter = _futex_popWaiter(futex);
+        waiter->woken = true;
+        numWoken++;
+
+        // Tell the status listener to unblock the thread waiting on the futex. We keep tracking
+        // the listener until it's removed, so that the futex is not freed while it's in use.
+        statuslistener_onStatusChanged(
+            waiter->listener, FileState_FUTEX_WAKEUP, FileState_FUTEX_WAKEUP);
     }
 
-    unsigned int numWoken = 0;
+    return numWoken;
+}
 
-    while (item && (numWoken < numWakeups)) {
-        StatusListener* listener = item->data;
-
-        // Only call if the listener is still valid
-        if (g_hash_table_contains(futex->listeners, listener)) {
-            // If this listener was already woken up, skip it this time
-            bool did_wakeup =
-                (bool)GPOINTER_TO_UINT(g_hash_table_lookup(futex->listeners, listener));
-            if (!did_wakeup) {
-                // Tell the status listener to unblock the thread waiting on the futex
-                statuslistener_onStatusChanged(listener, FileState_FUTEX_WAKEUP, FileState_FUTEX_WAKEUP);
-
-                // Track that we did a wakeup on this listener without destroying the listener
-                g_hash_table_steal(futex->listeners, listener);
-                g_hash_table_insert(futex->listeners, listener, GUINT_TO_POINTER(true));
-
-                // Count the wake-up
-                numWoken++;
-            }
-        }
+static FutexWaiter* _futex_addWaiter(Futex* futex, StatusListener* listener) {
+    utility_debugAssert(!g_hash_table_contains(futex->listeners, listener));
+
+    FutexWaiter* waiter = g_new0(FutexWaiter, 1);
+    waiter->link.data = waiter;
+    waiter->listener = listener;
+    waiter->futex = futex;
+
+    statuslistener_ref(listener);
+    g_hash_table_insert(futex->listeners, listener, waiter);
+    _futex_pushWaiter(futex, waiter);
 
-        item = g_list_next(item);
+    return waiter;
+}
+
+unsigned int futex_requeue(Futex* futex, Futex* target, unsigned int numRequeues) {
+    MAGIC_ASSERT(futex);
+    MAGIC_ASSERT(target);
+
+    if (futex == target) {
+        // Requeueing onto the same futex leaves every waiter where it is.
+        return MIN(numRequeues, g_queue_get_length(&futex->waiters));
     }
 
-    if(listenerList != NULL) {
-        g_list_free(listenerList);
+    unsigned int numRequeued = 0;
+
+    while (numRequeued < numRequeues && !g_queue_is_empty(&futex->waiters)) {
+        FutexWaiter* waiter = _futex_popWaiter(futex);
+        FutexWaiter* origin = waiter->origin ? waiter->origin : waiter;
+
+        if (waiter->origin) {
+            // It was requeued here before; it only needs a waiter where it's moving to now.
+            g_hash_table_remove(futex->listeners, waiter->listener);
+        }
+
+        if (origin->requeuedTo) {
+            futex_unref(origin->requeuedTo);
+            origin->requeuedTo = NULL;
+        }
+
+        if (target == origin->futex) {
+            // Back to where it started waiting.
+            _futex_pushWaiter(target, origin);
+        } else {
+            futex_ref(target);
+            origin->requeuedTo = target;
+            _futex_addWaiter(target, origin->listener)->origin = origin;
+        }
+
+        numRequeued++;
     }
-    return numWoken;
+
+    return numRequeued;
 }
 
 void futex_addListener(Futex* futex, StatusListener* listener) {
     MAGIC_ASSERT(futex);
     utility_debugAssert(listener);
-    statuslistener_ref(listener);
-    g_hash_table_insert(futex->listeners, listener, GUINT_TO_POINTER(false));
+    _futex_addWaiter(futex, listener);
 }
 
 void futex_removeListener(Futex* futex, StatusListener* listener) {
     MAGIC_ASSERT(futex);
+
+    FutexWaiter* waiter = g_hash_table_lookup(futex->listeners, listener);
+    if (waiter == NULL) {
+        return;
+    }
+
+    if (waiter->requeuedTo) {
+        // The listener is really waiting on the futex we moved it to.
+        futex_removeListener(waiter->requeuedTo, listener);
+    } else if (!waiter->woken) {
+        _futex_unlinkWaiter(futex, waiter);
+    }
+
     g_hash_table_remove(futex->listeners, listener); // Will unref the listener
 }
 
@@ -137,3 +229,8 @@ unsigned int futex_getListenerCount(Futex* futex) {
     MAGIC_ASSERT(futex);
     return g_hash_table_size(futex->listeners);
 }
+
+unsigned int futex_getWaiterCount(Futex* futex) {
+    MAGIC_ASSERT(futex);
+    return g_queue_get_length(&futex->waiters);
+}
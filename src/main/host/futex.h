@@ -32,6 +32,11 @@ ManagedPhysicalMemoryAddr futex_getAddress(Futex* futex);
 // Wakeup at most the given number of listener threads waiting on this futex; return the number of
 // threads that were woken up.
 unsigned int futex_wake(Futex* futex, unsigned int numWakeups);
+// Move at most the given number of listener threads that are waiting on this futex and have not been
+// woken up to the end of `target`'s waiters, as if they had called wait on `target`; return the
+// number of threads that were requeued. A requeued listener should still be removed from this
+// futex, which then also removes it from the futex it was moved to.
+unsigned int futex_requeue(Futex* futex, Futex* target, unsigned int numRequeues);
 
 // Add a listener that will be notified when a wakup occurs
 void futex_addListener(Futex* futex, StatusListener* listener);
@@ -42,4 +47,7 @@ void futex_removeListener(Futex* futex, StatusListener* listener);
 // Return the number of listers currently awaiting a wakeup
 unsigned int futex_getListenerCount(Futex* futex);
 
+// Return the number of listeners that have not been woken up or requeued yet
+unsigned int futex_getWaiterCount(Futex* futex);
+
 #endif /* SRC_MAIN_HOST_FUTEX_H_ */
@@ -5,7 +5,7 @@ use shadow_shim_helper_rs::syscall_types::ManagedPhysicalMemoryAddr;
 use shadow_shim_helper_rs::util::SyncSendPointer;
 
 use crate::cshadow as c;
-use crate::utility::ObjectCounter;
+use crate::utility::{ObjectCounter, ObjectType};
 
 /// A map of [`ManagedPhysicalMemoryAddr`] to [`Futex`](c::Futex).
 pub struct FutexTable {
@@ -20,7 +20,7 @@ impl FutexTable {
     pub fn new() -> Self {
         Self {
             futexes: HashMap::new(),
-            _counter: ObjectCounter::new("FutexTable"),
+            _counter: ObjectCounter::new(ObjectType::FutexTable),
         }
     }
 
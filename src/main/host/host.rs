@@ -1,22 +1,22 @@
 //! An emulated Linux system.
 
 use std::cell::{Cell, Ref, RefCell, RefMut, UnsafeCell};
-use std::collections::BTreeMap;
+use std::collections::{BTreeMap, HashSet};
 use std::ffi::{CStr, CString, OsString};
 use std::net::{Ipv4Addr, SocketAddrV4};
-use std::num::NonZeroU8;
 use std::ops::{Deref, DerefMut};
 use std::os::unix::prelude::OsStringExt;
 use std::path::{Path, PathBuf};
-use std::sync::{Arc, Mutex};
+use std::sync::Arc;
 
 use atomic_refcell::AtomicRefCell;
+use linux_api::errno::Errno;
 use linux_api::signal::{siginfo_t, Signal};
 use log::{debug, trace};
 use logger::LogLevel;
 use once_cell::unsync::OnceCell;
 use rand::SeedableRng;
-use rand_xoshiro::Xoshiro256PlusPlus;
+use rand_chacha::ChaCha8Rng;
 use shadow_shim_helper_rs::emulated_time::EmulatedTime;
 use shadow_shim_helper_rs::explicit_drop::ExplicitDropper;
 use shadow_shim_helper_rs::rootedcell::cell::RootedCell;
@@ -31,20 +31,27 @@ use shadow_shmem::allocator::ShMemBlock;
 use shadow_tsc::Tsc;
 use vasi_sync::scmutex::SelfContainedMutexGuard;
 
-use crate::core::configuration::{ProcessFinalState, QDiscMode};
-use crate::core::sim_config::PcapConfig;
+use crate::core::configuration::{
+    HeartbeatFormat, ProcessFinalState, QDiscMode, RouterQDiscMode, TcpCongestionControl,
+};
+use crate::core::host_profile::HostProfile;
+use crate::core::sim_config::{PcapConfig, TrafficInfo};
 use crate::core::work::event::{Event, EventData};
-use crate::core::work::event_queue::EventQueue;
+use crate::core::work::event_queue::{EventInbox, EventQueue};
 use crate::core::work::task::TaskRef;
 use crate::core::worker::Worker;
 use crate::cshadow;
 use crate::host::descriptor::socket::abstract_unix_ns::AbstractUnixNamespace;
 use crate::host::descriptor::socket::inet::InetSocket;
+use crate::host::descriptor::socket::netlink::NetlinkDumps;
 use crate::host::futex_table::FutexTable;
+use crate::host::managed_thread::IpcBlockPool;
 use crate::host::network::interface::{FifoPacketPriority, NetworkInterface, PcapOptions};
-use crate::host::network::namespace::NetworkNamespace;
-use crate::host::process::Process;
+use crate::host::network::namespace::{NamespaceAddresses, NetworkNamespace};
+use crate::host::process::{PendingProcess, Process};
 use crate::host::thread::{Thread, ThreadId};
+use crate::host::timeout_wheel::TimeoutWheel;
+use crate::host::traffic::TrafficGenerator;
 use crate::network::relay::{RateLimit, Relay};
 use crate::network::router::Router;
 use crate::network::PacketDevice;
@@ -66,31 +73,52 @@ pub struct HostParameters {
     pub cpu_frequency: u64,
     pub cpu_threshold: Option<SimulationTime>,
     pub cpu_precision: Option<SimulationTime>,
+    pub cpu_quantum: SimulationTime,
     pub heartbeat_interval: Option<SimulationTime>,
     pub heartbeat_log_level: LogLevel,
     pub heartbeat_log_info: cshadow::LogInfoFlags,
+    pub heartbeat_format: HeartbeatFormat,
+    pub heartbeat_packet_sampling: u32,
     pub log_level: LogLevel,
     pub pcap_config: Option<PcapConfig>,
+    pub tcp_congestion_control: TcpCongestionControl,
     pub qdisc: QDiscMode,
+    pub router_qdisc: RouterQDiscMode,
     pub init_sock_recv_buf_size: u64,
     pub autotune_recv_buf: bool,
     pub init_sock_send_buf_size: u64,
     pub autotune_send_buf: bool,
+    pub tcp_pacing: bool,
+    pub tcp_segments_per_packet: u32,
     pub native_tsc_frequency: u64,
     pub model_unblocked_syscall_latency: bool,
     pub max_unapplied_cpu_latency: SimulationTime,
     pub unblocked_syscall_latency: SimulationTime,
     pub unblocked_vdso_latency: SimulationTime,
-    pub strace_logging_options: Option<FmtOptions>,
+    pub native_preemption_enabled: bool,
+    pub native_preemption_native_interval: SimulationTime,
+    pub native_preemption_sim_interval: SimulationTime,
+    pub strace_logging_options: Option<StraceOptions>,
     pub shim_log_level: LogLevel,
     pub use_new_tcp: bool,
     pub use_mem_mapper: bool,
+    pub use_mem_mapper_huge_pages: bool,
     pub use_syscall_counters: bool,
+    pub use_syscall_latency_histograms: bool,
+    pub use_calendar_event_queue: bool,
+    pub use_lazy_output_files: bool,
+    pub use_missing_path_cache: bool,
+    pub use_loopback_batching: bool,
+    pub early_process_launch_lead: Option<SimulationTime>,
 }
 
 use super::cpu::Cpu;
 use super::process::ProcessId;
-use super::syscall::formatter::FmtOptions;
+use super::syscall::formatter::StraceOptions;
+
+/// The most paths that [`Host::add_missing_path`] will remember. The cache is cleared when it's
+/// full, so that a guest that probes many unique paths can't make it grow without bound.
+const MAX_MISSING_PATHS: usize = 1 << 16;
 
 /// Immutable information about the Host.
 #[derive(Debug, Clone)]
@@ -101,6 +129,66 @@ pub struct HostInfo {
     pub log_level: Option<log::LevelFilter>,
 }
 
+/// An application whose native process is launched ahead of its start time. See
+/// `experimental.use_early_process_launch`.
+enum EarlyLaunch {
+    /// The native process hasn't been launched yet.
+    Waiting,
+    /// The native process was launched, and is waiting for the application's start time.
+    Launched(Result<PendingProcess, Errno>),
+    /// The process was started and now belongs to the host's process list.
+    Started,
+}
+
+/// The host state that the scheduler reads every round, even for hosts that have nothing to run.
+/// It's kept together on its own cache line so that skipping an idle host only loads this line and
+/// the inbox's, rather than also borrowing and peeking the event queue.
+#[repr(align(64))]
+struct RoundState {
+    // A copy of the time of the next event in `Host::event_queue`. Must be updated whenever the
+    // queue changes.
+    next_event_time: Cell<Option<EmulatedTime>>,
+    // Events sent from other hosts, which haven't been moved to `Host::event_queue` yet.
+    event_inbox: Arc<EventInbox>,
+    // The time of the next tracker heartbeat, if heartbeats are enabled. Heartbeats are run by the
+    // worker at the start of a round rather than as events.
+    next_heartbeat: Cell<Option<EmulatedTime>>,
+}
+
+/// Thread wakeup tasks that run back to back in a single event. Shared with the event's task,
+/// which must be `Send` and `Sync`.
+type WakeupBatch = Arc<AtomicRefCell<Vec<TaskRef>>>;
+
+/// The generator of each of a host's [`RandomStream`]s.
+pub type HostRng = ChaCha8Rng;
+
+/// The independent streams of a host's random numbers. Each stream is a ChaCha keystream keyed by
+/// the host's seed, with the stream's id as its nonce, so its values only depend on the host and
+/// how many values were previously drawn from the same stream. Drawing from one stream doesn't
+/// change what the others produce, so for example a different packet loss doesn't change which
+/// ports the host's sockets are given.
+#[derive(Copy, Clone, Debug, PartialEq, Eq)]
+pub enum RandomStream {
+    /// Whether packets sent by the host are dropped by unreliable paths.
+    PacketLoss = 0,
+    /// Ports and names chosen by the host's sockets.
+    Sockets = 1,
+    /// Random bytes given to managed processes, for example by `getrandom` or `/dev/urandom`.
+    Bytes = 2,
+    /// Flows of the host's traffic generator.
+    Traffic = 3,
+}
+
+impl RandomStream {
+    const COUNT: usize = 4;
+
+    fn new_rng(self, seed: u64) -> HostRng {
+        let mut rng = HostRng::seed_from_u64(seed);
+        rng.set_stream(self as u64);
+        rng
+    }
+}
+
 /// A simulated Host.
 pub struct Host {
     // Store immutable info in an Arc, that we can safely clone into the
@@ -117,9 +205,16 @@ pub struct Host {
     // This makes the Host !Sync.
     root: Root,
 
-    event_queue: Arc<Mutex<EventQueue>>,
+    round_state: RoundState,
 
-    random: RefCell<Xoshiro256PlusPlus>,
+    event_queue: RefCell<EventQueue>,
+
+    // The most recent batch of thread wakeups and the time it was scheduled for, if it hasn't
+    // started running yet. See `schedule_wakeup_task`.
+    wakeup_batch: RefCell<Option<(EmulatedTime, WakeupBatch)>>,
+
+    // Indexed by `RandomStream`.
+    random: [RefCell<HostRng>; RandomStream::COUNT],
 
     // The upstream router that will queue packets until we can receive them.
     // This only applies to the internet interface; the localhost interface
@@ -139,6 +234,9 @@ pub struct Host {
     // map address to futex objects
     futex_table: RefCell<FutexTable>,
 
+    // timeouts of blocked syscall conditions
+    timeouts: RefCell<TimeoutWheel<TaskRef>>,
+
     #[cfg(feature = "perf_timers")]
     execution_timer: RefCell<PerfTimer>,
 
@@ -148,6 +246,13 @@ pub struct Host {
 
     net_ns: NetworkNamespace,
 
+    // responses to netlink RTM_GETLINK and RTM_GETADDR requests, which don't change during the
+    // simulation
+    netlink_dumps: Arc<NetlinkDumps>,
+
+    // IPC blocks of exited managed threads, reused for new threads
+    ipc_block_pool: IpcBlockPool,
+
     // Store as a CString so that we can return a borrowed pointer to C code
     // instead of having to allocate a new string.
     //
@@ -155,12 +260,17 @@ pub struct Host {
     // store it at all)
     data_dir_path: PathBuf,
     data_dir_path_cstring: CString,
+    // the data directory is created when it's first needed
+    data_dir_created: Cell<bool>,
 
     // virtual process and event id counter
     thread_id_counter: Cell<libc::pid_t>,
     event_id_counter: Cell<u64>,
     packet_id_counter: Cell<u64>,
 
+    // the costs of running this host, written to the host profile at the end of the simulation
+    profile: Cell<HostProfile>,
+
     // Enables us to sort objects deterministically based on their creation order.
     determinism_sequence_counter: Cell<u64>,
 
@@ -170,6 +280,17 @@ pub struct Host {
     // Owned pointers to processes.
     processes: RefCell<BTreeMap<ProcessId, RootedRc<RootedRefCell<Process>>>>,
 
+    // Processes that are launched ahead of their start time, indexed in the order that they were
+    // added.
+    early_launches: RefCell<Vec<EarlyLaunch>>,
+
+    // Background traffic generators, which must be stopped before the host is shut down.
+    traffic_generators: RefCell<Vec<Arc<AtomicRefCell<TrafficGenerator>>>>,
+
+    // Absolute paths that managed processes have looked up and found don't exist, or `None` if
+    // `use_missing_path_cache` is disabled.
+    missing_paths: Option<RefCell<HashSet<CString>>>,
+
     tsc: Tsc,
     // Cached lock for shim_shmem. `[Host::shmem_lock]` uses unsafe code to give it
     // a 'static lifetime.
@@ -215,14 +336,13 @@ impl std::fmt::Debug for Host {
 }
 
 impl Host {
-    /// # Safety
-    ///
-    /// `dns` must be a valid pointer, and must outlive the returned Host.
-    pub unsafe fn new(
+    /// The addresses must have been registered for the host's id, hostname, and ip address. Hosts
+    /// are built in parallel, so this must not use any global state that isn't synchronized.
+    pub fn new(
         params: HostParameters,
         host_root_path: &Path,
         raw_cpu_freq_khz: u64,
-        dns: *mut cshadow::DNS,
+        addresses: NamespaceAddresses,
         manager_shmem: &ShMemBlock<ManagerShmem>,
         preload_paths: Arc<Vec<PathBuf>>,
     ) -> Self {
@@ -230,12 +350,19 @@ impl Host {
         let execution_timer = RefCell::new(PerfTimer::new());
 
         let root = Root::new();
-        let random = RefCell::new(Xoshiro256PlusPlus::seed_from_u64(params.node_seed));
+        let random = [
+            RandomStream::PacketLoss,
+            RandomStream::Sockets,
+            RandomStream::Bytes,
+            RandomStream::Traffic,
+        ]
+        .map(|stream| RefCell::new(stream.new_rng(params.node_seed)));
         let cpu = RefCell::new(Cpu::new(
             params.cpu_frequency,
             raw_cpu_freq_khz,
             params.cpu_threshold,
             params.cpu_precision,
+            params.cpu_quantum,
         ));
         let data_dir_path = Self::make_data_dir_path(&params.hostname, host_root_path);
         let data_dir_path_cstring = utility::pathbuf_to_nul_term_cstring(data_dir_path.clone());
@@ -246,10 +373,14 @@ impl Host {
             params.max_unapplied_cpu_latency,
             params.unblocked_syscall_latency,
             params.unblocked_vdso_latency,
+            params.native_preemption_enabled,
+            params.native_preemption_native_interval,
+            params.native_preemption_sim_interval,
             nix::unistd::getpid().as_raw(),
             params.native_tsc_frequency,
             params.shim_log_level,
             manager_shmem,
+            Self::make_utsname(&params.hostname),
         );
         let shim_shmem = UnsafeCell::new(shadow_shmem::allocator::shmalloc(host_shmem));
 
@@ -262,59 +393,69 @@ impl Host {
         let packet_priority_counter = Cell::new(1);
         let tsc = Tsc::new(params.native_tsc_frequency);
 
-        std::fs::create_dir_all(&data_dir_path).unwrap();
-
-        // Register using the param hints.
-        // We already checked that the addresses are available, so fail if they are not.
-
-        let public_ip: Ipv4Addr = u32::from_be(params.ip_addr).into();
+        // the pcap files are created with the network interfaces below
+        let missing_paths = params
+            .use_missing_path_cache
+            .then(|| RefCell::new(HashSet::new()));
 
-        let hostname: Vec<NonZeroU8> = params
-            .hostname
-            .as_bytes()
-            .iter()
-            .map(|x| (*x).try_into().unwrap())
-            .collect();
+        let data_dir_created =
+            !params.use_lazy_output_files || params.pcap_config.is_some_and(|x| !x.merged);
+        if data_dir_created {
+            std::fs::create_dir_all(&data_dir_path).unwrap();
+        }
 
         let pcap_options = params.pcap_config.as_ref().map(|x| PcapOptions {
             path: data_dir_path.clone(),
             capture_size_bytes: x.capture_size.try_into().unwrap(),
+            headers_only: x.headers_only,
+            merged: x.merged,
         });
 
-        let net_ns = unsafe {
-            NetworkNamespace::new(
-                params.id,
-                hostname,
-                public_ip,
-                pcap_options,
-                params.qdisc,
-                dns,
-            )
-        };
+        let net_ns = NetworkNamespace::new(params.id, addresses, pcap_options, params.qdisc);
+        let netlink_dumps = Arc::new(NetlinkDumps::new(net_ns.default_ip()));
 
         // Packets that are not for localhost or our public ip go to the router.
         // Use `Ipv4Addr::UNSPECIFIED` for the router to encode this for our
         // routing table logic inside of `Host::get_packet_device()`.
-        let router = Router::new(Ipv4Addr::UNSPECIFIED);
+        let router = Router::new(Ipv4Addr::UNSPECIFIED, params.router_qdisc);
+        // the largest packet is a full TCP data packet
+        let max_packet_size = u64::from(cshadow::CONFIG_MTU)
+            + u64::from(params.tcp_segments_per_packet - 1)
+                * u64::from(cshadow::CONFIG_TCP_MAX_SEGMENT_SIZE);
         let relay_inet_out = Relay::new(
             RateLimit::BytesPerSecond(params.requested_bw_up_bits / 8),
             net_ns.internet.borrow().get_address(),
+            max_packet_size,
         );
         let relay_inet_in = Relay::new(
             RateLimit::BytesPerSecond(params.requested_bw_down_bits / 8),
             router.get_address(),
+            max_packet_size,
         );
         let relay_loopback = Relay::new(
             RateLimit::Unlimited,
             net_ns.localhost.borrow().get_address(),
+            max_packet_size,
         );
 
         let in_notify_socket_has_packets = RootedCell::new(&root, false);
 
+        let event_queue = if params.use_calendar_event_queue {
+            EventQueue::new_calendar()
+        } else {
+            EventQueue::new()
+        };
+
         let res = Self {
             info: OnceCell::new(),
             root,
-            event_queue: Arc::new(Mutex::new(EventQueue::new())),
+            round_state: RoundState {
+                next_event_time: Cell::new(None),
+                event_inbox: Arc::new(EventInbox::new()),
+                next_heartbeat: Cell::new(None),
+            },
+            event_queue: RefCell::new(event_queue),
+            wakeup_batch: RefCell::new(None),
             params,
             router: RefCell::new(router),
             relay_inet_out: Arc::new(relay_inet_out),
@@ -322,20 +463,28 @@ impl Host {
             relay_loopback: Arc::new(relay_loopback),
             tracker: RefCell::new(None),
             futex_table: RefCell::new(FutexTable::new()),
+            timeouts: RefCell::new(TimeoutWheel::new()),
             random,
             shim_shmem,
             shim_shmem_lock: RefCell::new(None),
             cpu,
             net_ns,
+            netlink_dumps,
+            ipc_block_pool: IpcBlockPool::new(),
             data_dir_path,
             data_dir_path_cstring,
+            data_dir_created: Cell::new(data_dir_created),
             thread_id_counter,
             event_id_counter,
             packet_id_counter,
+            profile: Cell::new(HostProfile::default()),
             packet_priority_counter,
             determinism_sequence_counter,
             tsc,
             processes: RefCell::new(BTreeMap::new()),
+            early_launches: RefCell::new(Vec::new()),
+            traffic_generators: RefCell::new(Vec::new()),
+            missing_paths,
             #[cfg(feature = "perf_timers")]
             execution_timer,
             in_notify_socket_has_packets,
@@ -355,7 +504,8 @@ impl Host {
                 " {init_sock_recv_buf_size} initSockRecvBufSize, ",
                 " {cpu_frequency:?} cpuFrequency, ",
                 " {cpu_threshold:?} cpuThreshold, ",
-                " {cpu_precision:?} cpuPrecision"
+                " {cpu_precision:?} cpuPrecision,",
+                " {cpu_quantum:?} cpuQuantum"
             ),
             res.id(),
             name = res.info().name,
@@ -367,6 +517,7 @@ impl Host {
             cpu_frequency = res.params.cpu_frequency,
             cpu_threshold = res.params.cpu_threshold,
             cpu_precision = res.params.cpu_precision,
+            cpu_quantum = res.params.cpu_quantum,
         );
 
         res
@@ -385,7 +536,36 @@ impl Host {
         data_dir_path
     }
 
+    /// What `uname` reports on a host named `hostname`. Hostnames longer than
+    /// Linux allows are truncated.
+    fn make_utsname(hostname: &CStr) -> linux_api::utsname::new_utsname {
+        let mut name: linux_api::utsname::new_utsname = shadow_pod::zeroed();
+
+        let nodename = utility::u8_to_i8_slice(hostname.to_bytes());
+        let nodename = &nodename[..nodename.len().min(name.nodename.len() - 1)];
+
+        // Currently hardcoded with values reported in Debian 12
+        let sysname = utility::u8_to_i8_slice(&b"Linux"[..]);
+        let release = utility::u8_to_i8_slice(&b"6.1.0-25-amd64"[..]);
+        let version =
+            utility::u8_to_i8_slice(&b"#1 SMP PREEMPT_DYNAMIC Debian 6.1.106-3 (2024-08-26)"[..]);
+        let machine = utility::u8_to_i8_slice(&b"x86_64"[..]);
+
+        name.sysname[..sysname.len()].copy_from_slice(sysname);
+        name.nodename[..nodename.len()].copy_from_slice(nodename);
+        name.release[..release.len()].copy_from_slice(release);
+        name.version[..version.len()].copy_from_slice(version);
+        name.machine[..machine.len()].copy_from_slice(machine);
+
+        name
+    }
+
+    /// The host's data directory, which is created if it doesn't exist yet.
     pub fn data_dir_path(&self) -> &Path {
+        if !self.data_dir_created.get() {
+            std::fs::create_dir_all(&self.data_dir_path).unwrap();
+            self.data_dir_created.set(true);
+        }
         &self.data_dir_path
     }
 
@@ -403,6 +583,38 @@ impl Host {
     ) {
         debug_assert!(shutdown_time.is_none() || shutdown_time.unwrap() > start_time);
 
+        // Launch the native process shortly before its start time, so that it can exec and load
+        // its libraries in the background while the simulation runs.
+        let early_launch = self.params.early_process_launch_lead.map(|lead| {
+            let index = {
+                let mut early_launches = self.early_launches.borrow_mut();
+                early_launches.push(EarlyLaunch::Waiting);
+                early_launches.len() - 1
+            };
+
+            let plugin_name = plugin_name.clone();
+            let plugin_path = plugin_path.clone();
+            let argv = argv.clone();
+            let envv = envv.clone();
+            let task = TaskRef::new(move |host| {
+                let pending = Process::launch(
+                    host,
+                    plugin_name.clone(),
+                    &plugin_path,
+                    argv.clone(),
+                    envv.clone(),
+                    host.params.strace_logging_options,
+                );
+                host.early_launches.borrow_mut()[index] = EarlyLaunch::Launched(pending);
+            });
+            self.schedule_task_at_emulated_time(
+                task,
+                EmulatedTime::SIMULATION_START + start_time.saturating_sub(lead),
+            );
+
+            index
+        });
+
         // Schedule spawning the process.
         let task = TaskRef::new(move |host| {
             // We can't move out of these captured variables, since TaskRef takes
@@ -411,16 +623,21 @@ impl Host {
             let envv = envv.clone();
             let argv = argv.clone();
 
-            let process = Process::spawn(
-                host,
-                plugin_name.clone(),
-                &plugin_path,
-                argv,
-                envv,
-                pause_for_debugging,
-                host.params.strace_logging_options,
-                expected_final_state,
-            )
+            let process = match early_launch {
+                Some(index) => host.take_early_launch(index).and_then(|pending| {
+                    pending.start(host, pause_for_debugging, expected_final_state)
+                }),
+                None => Process::spawn(
+                    host,
+                    plugin_name.clone(),
+                    &plugin_path,
+                    argv,
+                    envv,
+                    pause_for_debugging,
+                    host.params.strace_logging_options,
+                    expected_final_state,
+                ),
+            }
             .unwrap_or_else(|e| panic!("Failed to initialize application {plugin_name:?}: {e:?}"));
             let (process_id, thread_id) = {
                 let process = process.borrow(host.root());
@@ -453,6 +670,20 @@ impl Host {
         self.schedule_task_at_emulated_time(task, EmulatedTime::SIMULATION_START + start_time);
     }
 
+    /// Take the pending process launched for the application added at `index`.
+    fn take_early_launch(&self, index: usize) -> Result<PendingProcess, Errno> {
+        let launch = std::mem::replace(
+            &mut self.early_launches.borrow_mut()[index],
+            EarlyLaunch::Started,
+        );
+        match launch {
+            EarlyLaunch::Launched(pending) => pending,
+            EarlyLaunch::Waiting | EarlyLaunch::Started => {
+                panic!("Application {index} wasn't launched early")
+            }
+        }
+    }
+
     pub fn add_and_schedule_forked_process(
         &self,
         host: &Host,
@@ -604,9 +835,16 @@ impl Host {
     }
 
     pub fn default_ip(&self) -> Ipv4Addr {
-        let addr = self.net_ns.default_address.ptr();
-        let addr = unsafe { cshadow::address_toNetworkIP(addr) };
-        u32::from_be(addr).into()
+        self.net_ns.default_ip()
+    }
+
+    /// The cached responses to netlink interface requests.
+    pub fn netlink_dumps(&self) -> &Arc<NetlinkDumps> {
+        &self.netlink_dumps
+    }
+
+    pub fn ipc_block_pool(&self) -> &IpcBlockPool {
+        &self.ipc_block_pool
     }
 
     pub fn abstract_unix_namespace(
@@ -652,6 +890,11 @@ impl Host {
         self.futex_table.borrow_mut()
     }
 
+    #[track_caller]
+    pub fn timeouts_borrow_mut(&self) -> impl DerefMut<Target = TimeoutWheel<TaskRef>> + '_ {
+        self.timeouts.borrow_mut()
+    }
+
     #[allow(non_snake_case)]
     pub fn bw_up_kiBps(&self) -> u64 {
         self.params.requested_bw_up_bits / (8 * 1024)
@@ -682,9 +925,10 @@ impl Host {
         self.net_ns.interface_borrow(addr)
     }
 
+    /// The generator of the host's random `stream`.
     #[track_caller]
-    pub fn random_mut(&self) -> impl DerefMut<Target = Xoshiro256PlusPlus> + '_ {
-        self.random.borrow_mut()
+    pub fn random_mut(&self, stream: RandomStream) -> impl DerefMut<Target = HostRng> + '_ {
+        self.random[stream as usize].borrow_mut()
     }
 
     pub fn get_new_event_id(&self) -> u64 {
@@ -705,6 +949,37 @@ impl Host {
         res
     }
 
+    /// Add to the wall-clock time spent running this host's events.
+    pub fn add_execution_time(&self, duration: std::time::Duration) {
+        let mut profile = self.profile.get();
+        profile.execution_ns = profile
+            .execution_ns
+            .saturating_add(duration.as_nanos().try_into().unwrap_or(u64::MAX));
+        self.profile.set(profile);
+    }
+
+    /// Count a syscall that Shadow handled for one of this host's processes.
+    pub fn count_syscall(&self) {
+        let mut profile = self.profile.get();
+        profile.syscalls += 1;
+        self.profile.set(profile);
+    }
+
+    /// Add the peak resident memory of one of this host's processes after it exited.
+    pub fn add_process_max_rss(&self, bytes: u64) {
+        let mut profile = self.profile.get();
+        profile.process_rss_bytes = profile.process_rss_bytes.saturating_add(bytes);
+        self.profile.set(profile);
+    }
+
+    /// The costs of running this host so far.
+    pub fn profile(&self) -> HostProfile {
+        HostProfile {
+            packets: self.packet_id_counter.get(),
+            ..self.profile.get()
+        }
+    }
+
     pub fn get_next_deterministic_sequence_value(&self) -> u64 {
         let res = self.determinism_sequence_counter.get();
         self.determinism_sequence_counter.set(res + 1);
@@ -737,15 +1012,66 @@ impl Host {
         self.schedule_task_at_emulated_time(task, Worker::current_time().unwrap() + t)
     }
 
-    pub fn event_queue(&self) -> &Arc<Mutex<EventQueue>> {
-        &self.event_queue
+    /// Schedule `task`, which wakes up a blocked thread, to run at the current time. Wakeups that
+    /// are scheduled for the same time, such as for each waiter of a futex or epoll file, are run
+    /// back to back in a single event in the order that they were scheduled, rather than each
+    /// being pushed to and popped from the event queue.
+    pub fn schedule_wakeup_task(&self, task: TaskRef) -> bool {
+        let now = Worker::current_time().unwrap();
+
+        let mut wakeup_batch = self.wakeup_batch.borrow_mut();
+        if let Some((time, batch)) = wakeup_batch.as_ref() {
+            if *time == now {
+                batch.borrow_mut().push(task);
+                return true;
+            }
+        }
+
+        let batch = WakeupBatch::new(AtomicRefCell::new(vec![task]));
+        let batch_task = {
+            let batch = WakeupBatch::clone(&batch);
+            TaskRef::new(move |host| host.run_wakeup_batch(&batch))
+        };
+        if !self.schedule_task_at_emulated_time(batch_task, now) {
+            return false;
+        }
+
+        *wakeup_batch = Some((now, batch));
+        true
+    }
+
+    fn run_wakeup_batch(&self, batch: &WakeupBatch) {
+        // wakeups scheduled by these tasks go in a new batch
+        {
+            let mut wakeup_batch = self.wakeup_batch.borrow_mut();
+            if wakeup_batch
+                .as_ref()
+                .is_some_and(|(_, x)| Arc::ptr_eq(x, batch))
+            {
+                *wakeup_batch = None;
+            }
+        }
+
+        let tasks = std::mem::take(&mut *batch.borrow_mut());
+        for task in tasks {
+            task.execute(self);
+        }
+    }
+
+    /// The inbox that other hosts push events to.
+    pub fn event_inbox(&self) -> &Arc<EventInbox> {
+        &self.round_state.event_inbox
     }
 
     pub fn push_local_event(&self, event: Event) -> bool {
         if event.time() >= self.params.sim_end_time {
             return false;
         }
-        self.event_queue.lock().unwrap().push(event);
+        let mut event_queue = self.event_queue.borrow_mut();
+        event_queue.push(event);
+        self.round_state
+            .next_event_time
+            .set(event_queue.next_event_time());
         true
     }
 
@@ -759,12 +1085,46 @@ impl Host {
                     heartbeat_interval,
                     self.params.heartbeat_log_level,
                     self.params.heartbeat_log_info,
+                    self.params.heartbeat_format == HeartbeatFormat::Binary,
+                    self.params.heartbeat_packet_sampling,
                 )
             };
             // SAFETY: we synchronize access to the Host's tracker using a RefCell.
             self.tracker
                 .borrow_mut()
                 .replace(unsafe { SyncSendPointer::new(tracker) });
+            self.round_state.next_heartbeat.set(Some(
+                Worker::current_time().unwrap() + self.params.heartbeat_interval.unwrap(),
+            ));
+        }
+    }
+
+    /// Whether the host's tracker is due for a heartbeat at time `now`.
+    #[inline]
+    pub fn heartbeat_due(&self, now: EmulatedTime) -> bool {
+        self.round_state
+            .next_heartbeat
+            .get()
+            .is_some_and(|t| t <= now)
+    }
+
+    /// Log the tracker's heartbeat at the current time and schedule the next one. If the
+    /// simulation skipped over several heartbeat times (no host had any events), only one
+    /// heartbeat is logged. This should be called while `Worker` has the active host set.
+    pub fn heartbeat(&self) {
+        let now = Worker::current_time().unwrap();
+        let interval = self.params.heartbeat_interval.unwrap();
+
+        let mut next = self.round_state.next_heartbeat.get().unwrap();
+        while next <= now {
+            next += interval;
+        }
+        self.round_state.next_heartbeat.set(Some(next));
+
+        // don't hold the borrow while the tracker calls back into the host
+        let tracker = self.tracker.borrow().as_ref().map(|x| x.ptr());
+        if let Some(tracker) = tracker {
+            unsafe { cshadow::tracker_heartbeat(tracker, self) };
         }
     }
 
@@ -774,9 +1134,17 @@ impl Host {
 
         debug!("shutting down host {}", self.name());
 
+        // close the traffic generators' sockets while we're still the active host
+        for generator in self.traffic_generators.take() {
+            generator.borrow_mut().stop();
+        }
+
         // the network namespace object needs to be cleaned up before it's dropped
         Worker::with_dns(|dns| self.net_ns.cleanup(dns));
 
+        // kill any processes that were launched early but never reached their start time
+        self.early_launches.borrow_mut().clear();
+
         assert!(self.processes.borrow().is_empty());
 
         self.stop_execution_timer();
@@ -788,6 +1156,46 @@ impl Host {
         );
     }
 
+    /// Add background traffic that the host will send, starting at the traffic's start time.
+    pub fn add_traffic(&self, info: TrafficInfo) {
+        let generator = TrafficGenerator::start(self, info);
+        self.traffic_generators.borrow_mut().push(generator);
+    }
+
+    /// Whether lookups of paths that don't exist are cached with [`Host::add_missing_path`].
+    pub fn uses_missing_path_cache(&self) -> bool {
+        self.missing_paths.is_some()
+    }
+
+    /// Whether a previous lookup of the absolute path `path` found that it doesn't exist, and
+    /// nothing has been created on the host since.
+    pub fn is_missing_path(&self, path: &CStr) -> bool {
+        self.missing_paths
+            .as_ref()
+            .is_some_and(|paths| paths.borrow().contains(path))
+    }
+
+    /// Remember that a lookup of the absolute path `path` found that it doesn't exist.
+    pub fn add_missing_path(&self, path: &CStr) {
+        let Some(paths) = &self.missing_paths else {
+            return;
+        };
+
+        let mut paths = paths.borrow_mut();
+        if paths.len() >= MAX_MISSING_PATHS {
+            paths.clear();
+        }
+        paths.insert(path.to_owned());
+    }
+
+    /// Forget all missing paths. Must be called whenever a managed process may have created a
+    /// path, for example by creating a file or directory, or by renaming or linking one.
+    pub fn clear_missing_paths(&self) {
+        if let Some(paths) = &self.missing_paths {
+            paths.borrow_mut().clear();
+        }
+    }
+
     pub fn free_all_applications(&self) {
         trace!("start freeing applications for host '{}'", self.name());
         let processes = std::mem::take(&mut *self.processes.borrow_mut());
@@ -806,15 +1214,33 @@ impl Host {
         trace!("done freeing application for host '{}'", self.name());
     }
 
-    pub fn execute(&self, until: EmulatedTime) {
+    /// Run the host's events that are before `until`. Returns the number of events run, not
+    /// including events that were delayed by the host's CPU.
+    pub fn execute(&self, until: EmulatedTime) -> u64 {
+        // events from other hosts are sent with times after the end of the round that they were
+        // sent in, so all events that we need for this round were sent in earlier rounds and are
+        // already in the inbox
+        {
+            let mut event_queue = self.event_queue.borrow_mut();
+            self.round_state.event_inbox.drain_into(&mut event_queue);
+            self.round_state
+                .next_event_time
+                .set(event_queue.next_event_time());
+        }
+
+        let mut num_events = 0;
         loop {
             let mut event = {
-                let mut event_queue = self.event_queue.lock().unwrap();
+                let mut event_queue = self.event_queue.borrow_mut();
                 match event_queue.next_event_time() {
                     Some(t) if t < until => {}
                     _ => break,
                 };
-                event_queue.pop().unwrap()
+                let event = event_queue.pop().unwrap();
+                self.round_state
+                    .next_event_time
+                    .set(event_queue.next_event_time());
+                event
             };
 
             {
@@ -860,11 +1286,25 @@ impl Host {
             }
             self.stop_execution_timer();
             Worker::clear_current_time();
+            num_events += 1;
+        }
+
+        num_events
+    }
+
+    /// Returns true if [`Host::execute`] may have any events to run before `until`. This doesn't
+    /// look at the times of events in the inbox, so it's true whenever the inbox isn't empty.
+    pub fn has_events_before(&self, until: EmulatedTime) -> bool {
+        if !self.round_state.event_inbox.is_empty() {
+            return true;
         }
+        self.next_event_time().is_some_and(|t| t < until)
     }
 
+    /// The time of the next event in the host's event queue. This does not include events that
+    /// other hosts sent during the current round, since they are still in the host's inbox.
     pub fn next_event_time(&self) -> Option<EmulatedTime> {
-        self.event_queue.lock().unwrap().next_event_time()
+        self.round_state.next_event_time.get()
     }
 
     /// The unprotected part of the Host's shared memory.
@@ -1052,8 +1492,9 @@ mod export {
     use std::{os::raw::c_char, time::Duration};
 
     use libc::{in_addr_t, in_port_t};
-    use rand::{Rng, RngCore};
+    use rand::RngCore;
     use shadow_shim_helper_rs::shim_shmem;
+    use shadow_shim_helper_rs::syscall_types::ManagedPhysicalMemoryAddr;
 
     use super::*;
     use crate::cshadow::{CEmulatedTime, CSimulationTime};
@@ -1062,7 +1503,7 @@ mod export {
     pub unsafe extern "C-unwind" fn host_execute(hostrc: *const Host, until: CEmulatedTime) {
         let hostrc = unsafe { hostrc.as_ref().unwrap() };
         let until = EmulatedTime::from_c_emutime(until).unwrap();
-        hostrc.execute(until)
+        hostrc.execute(until);
     }
 
     #[no_mangle]
@@ -1097,6 +1538,20 @@ mod export {
         hostrc.tsc()
     }
 
+    /// Records in the host's shared memory whether the futex with its word at
+    /// the physical address `word` has waiters, so that the shim can handle
+    /// wakes on futexes without waiters itself. See
+    /// `HostShmem::set_futex_has_waiters`.
+    #[no_mangle]
+    pub unsafe extern "C-unwind" fn host_setFutexHasWaiters(
+        hostrc: *const Host,
+        word: ManagedPhysicalMemoryAddr,
+        has_waiters: bool,
+    ) {
+        let hostrc = unsafe { hostrc.as_ref().unwrap() };
+        hostrc.shim_shmem().set_futex_has_waiters(word, has_waiters)
+    }
+
     #[no_mangle]
     pub unsafe extern "C-unwind" fn host_getName(hostrc: *const Host) -> *const c_char {
         let hostrc = unsafe { hostrc.as_ref().unwrap() };
@@ -1140,6 +1595,18 @@ mod export {
         hostrc.params.autotune_send_buf
     }
 
+    #[no_mangle]
+    pub unsafe extern "C-unwind" fn host_tcpPacingEnabled(hostrc: *const Host) -> bool {
+        let hostrc = unsafe { hostrc.as_ref().unwrap() };
+        hostrc.params.tcp_pacing
+    }
+
+    #[no_mangle]
+    pub unsafe extern "C-unwind" fn host_tcpSegmentsPerPacket(hostrc: *const Host) -> u32 {
+        let hostrc = unsafe { hostrc.as_ref().unwrap() };
+        hostrc.params.tcp_segments_per_packet
+    }
+
     #[no_mangle]
     pub unsafe extern "C-unwind" fn host_getConfiguredRecvBufSize(hostrc: *const Host) -> u64 {
         let hostrc = unsafe { hostrc.as_ref().unwrap() };
@@ -1191,9 +1658,40 @@ mod export {
     #[no_mangle]
     pub unsafe extern "C-unwind" fn host_getDataPath(hostrc: *const Host) -> *const c_char {
         let hostrc = unsafe { hostrc.as_ref().unwrap() };
+        // make sure that the directory exists
+        hostrc.data_dir_path();
         hostrc.data_dir_path_cstring.as_ptr()
     }
 
+    #[no_mangle]
+    pub unsafe extern "C-unwind" fn host_usesMissingPathCache(hostrc: *const Host) -> bool {
+        let hostrc = unsafe { hostrc.as_ref().unwrap() };
+        hostrc.uses_missing_path_cache()
+    }
+
+    #[no_mangle]
+    pub unsafe extern "C-unwind" fn host_isMissingPath(
+        hostrc: *const Host,
+        path: *const c_char,
+    ) -> bool {
+        let hostrc = unsafe { hostrc.as_ref().unwrap() };
+        let path = unsafe { CStr::from_ptr(path) };
+        hostrc.is_missing_path(path)
+    }
+
+    #[no_mangle]
+    pub unsafe extern "C-unwind" fn host_addMissingPath(hostrc: *const Host, path: *const c_char) {
+        let hostrc = unsafe { hostrc.as_ref().unwrap() };
+        let path = unsafe { CStr::from_ptr(path) };
+        hostrc.add_missing_path(path)
+    }
+
+    #[no_mangle]
+    pub unsafe extern "C-unwind" fn host_clearMissingPaths(hostrc: *const Host) {
+        let hostrc = unsafe { hostrc.as_ref().unwrap() };
+        hostrc.clear_missing_paths()
+    }
+
     #[no_mangle]
     pub unsafe extern "C-unwind" fn host_disassociateInterface(
         hostrc: *const Host,
@@ -1368,6 +1866,18 @@ mod export {
         hostrc.schedule_task_at_emulated_time(task, time)
     }
 
+    /// Schedule a task that wakes up a blocked thread for this host at the current time. See
+    /// [`Host::schedule_wakeup_task`].
+    #[no_mangle]
+    pub unsafe extern "C-unwind" fn host_scheduleWakeupTask(
+        hostrc: *const Host,
+        task: *mut TaskRef,
+    ) -> bool {
+        let hostrc = unsafe { hostrc.as_ref().unwrap() };
+        let task = unsafe { task.as_ref().unwrap().clone() };
+        hostrc.schedule_wakeup_task(task)
+    }
+
     /// Schedule a task for this host at a time 'nanoDelay' from now,.
     #[no_mangle]
     pub unsafe extern "C-unwind" fn host_scheduleTaskWithDelay(
@@ -1381,18 +1891,12 @@ mod export {
         hostrc.schedule_task_with_delay(task, delay)
     }
 
-    #[no_mangle]
-    pub unsafe extern "C-unwind" fn host_rngDouble(host: *const Host) -> f64 {
-        let host = unsafe { host.as_ref().unwrap() };
-        host.random_mut().gen()
-    }
-
-    /// Fills the buffer with pseudo-random bytes.
+    /// Fills the buffer with pseudo-random bytes for a managed process.
     #[no_mangle]
     pub extern "C-unwind" fn host_rngNextNBytes(host: *const Host, buf: *mut u8, len: usize) {
         let host = unsafe { host.as_ref().unwrap() };
         let buf = unsafe { std::slice::from_raw_parts_mut(buf, len) };
-        host.random_mut().fill_bytes(buf);
+        host.random_mut(RandomStream::Bytes).fill_bytes(buf);
     }
 
     #[no_mangle]
@@ -19,11 +19,12 @@ use rustix::pipe::PipeFlags;
 use rustix::process::WaitOptions;
 use shadow_shim_helper_rs::ipc::IPCData;
 use shadow_shim_helper_rs::shim_event::{
-    ShimEventAddThreadReq, ShimEventAddThreadRes, ShimEventSyscall, ShimEventSyscallComplete,
-    ShimEventToShadow, ShimEventToShim,
+    ShimEventAddThreadReq, ShimEventAddThreadRes, ShimEventSyscall, ShimEventSyscallBatch,
+    ShimEventSyscallComplete, ShimEventToShadow, ShimEventToShim, SYSCALL_BATCH_MAX,
 };
 use shadow_shim_helper_rs::syscall_types::{ForeignPtr, SyscallArgs, SyscallReg};
 use shadow_shmem::allocator::ShMemBlock;
+use vasi_sync::adaptive_spin::AdaptiveSpinner;
 use vasi_sync::scchannel::SelfContainedChannelError;
 
 use super::context::ThreadContext;
@@ -33,6 +34,8 @@ use crate::core::worker::{Worker, WORKER_SHARED};
 use crate::cshadow;
 use crate::host::syscall::handler::SyscallHandler;
 use crate::host::syscall::types::{ForeignArrayPtr, SyscallReturn};
+use crate::utility::childpid_watcher::WatchHandle;
+use crate::utility::counter::Counter;
 use crate::utility::{inject_preloads, syscall, verify_plugin_path, VerifyPluginPathError};
 
 /// The ManagedThread's state after having been allowed to execute some code.
@@ -47,8 +50,54 @@ pub enum ResumeResult {
     ExitedProcess,
 }
 
+/// The maximum number of IPC blocks that each [`IpcBlockPool`] keeps for reuse.
+const IPC_BLOCK_POOL_CAPACITY: usize = 64;
+
+/// IPC blocks of exited threads, to be reused for new threads instead of allocating a new block
+/// from the global shared memory allocator on each `clone`.
+pub struct IpcBlockPool {
+    blocks: RefCell<Vec<Arc<ShMemBlock<'static, IPCData>>>>,
+}
+
+impl IpcBlockPool {
+    pub fn new() -> Self {
+        Self {
+            blocks: RefCell::new(Vec::new()),
+        }
+    }
+
+    /// Returns an unused IPC block.
+    fn take(&self) -> Arc<ShMemBlock<'static, IPCData>> {
+        self.blocks
+            .borrow_mut()
+            .pop()
+            .unwrap_or_else(|| Arc::new(shadow_shmem::allocator::shmalloc(IPCData::new())))
+    }
+
+    /// Keeps `block` for reuse if it's only referenced by the caller (which is about to drop its
+    /// reference) and it's in the same state as a new block. The native thread that used it must
+    /// have exited.
+    fn give(&self, block: &Arc<ShMemBlock<'static, IPCData>>) {
+        if Arc::strong_count(block) != 1 || !block.is_idle() {
+            return;
+        }
+        let mut blocks = self.blocks.borrow_mut();
+        if blocks.len() < IPC_BLOCK_POOL_CAPACITY {
+            blocks.push(Arc::clone(block));
+        }
+    }
+}
+
+impl Default for IpcBlockPool {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
 pub struct ManagedThread {
     ipc_shmem: Arc<ShMemBlock<'static, IPCData>>,
+    // The `ChildPidWatcher` callback that closes our IPC channel when the native process exits.
+    ipc_watch_handle: WatchHandle,
     is_running: Cell<bool>,
     return_code: Cell<Option<i32>>,
 
@@ -63,6 +112,13 @@ pub struct ManagedThread {
     // to AFFINITY_UNINIT if CPU pinning is not enabled or if the thread has
     // not yet been pinned to a CPU.
     affinity: Cell<i32>,
+
+    // Decides how long to spin waiting for the plugin before sleeping.
+    ipc_spinner: Cell<AdaptiveSpinner>,
+
+    // Where the log output that the shim buffers in `ipc_shmem` is written. The native thread's
+    // stdout and stderr are also redirected here.
+    shimlog_file: Arc<std::fs::File>,
 }
 
 impl ManagedThread {
@@ -79,11 +135,7 @@ impl ManagedThread {
     /// Panics if the native thread is dead or dies during the syscall,
     /// including if the syscall itself is SYS_exit or SYS_exit_group.
     pub fn native_syscall(&self, ctx: &ThreadContext, n: i64, args: &[SyscallReg]) -> SyscallReg {
-        let mut syscall_args = SyscallArgs {
-            number: n,
-            args: [SyscallReg::from(0u64); 6],
-        };
-        syscall_args.args[..args.len()].copy_from_slice(args);
+        let syscall_args = SyscallArgs::new(n, args);
         match self.continue_plugin(
             ctx.host,
             &ShimEventToShim::Syscall(ShimEventSyscall { syscall_args }),
@@ -93,14 +145,68 @@ impl ManagedThread {
         }
     }
 
+    /// Make the specified syscalls on the native thread, in order, and return the result of each.
+    /// The syscalls are sent to the shim in batches of up to [`SYSCALL_BATCH_MAX`], so this takes
+    /// fewer round trips than calling [`Self::native_syscall`] for each. Every syscall is made
+    /// even if an earlier one fails.
+    ///
+    /// Panics if the native thread is dead or dies during the syscalls, including if a syscall
+    /// is SYS_exit or SYS_exit_group.
+    pub fn native_syscalls(
+        &self,
+        ctx: &ThreadContext,
+        syscalls: &[SyscallArgs],
+    ) -> Vec<SyscallReg> {
+        let mut retvals = Vec::with_capacity(syscalls.len());
+
+        for chunk in syscalls.chunks(SYSCALL_BATCH_MAX) {
+            let mut batch = ShimEventSyscallBatch {
+                len: chunk.len(),
+                syscall_args: [SyscallArgs::new(0, &[]); SYSCALL_BATCH_MAX],
+            };
+            batch.syscall_args[..chunk.len()].copy_from_slice(chunk);
+
+            match self.continue_plugin(ctx.host, &ShimEventToShim::SyscallBatch(batch)) {
+                ShimEventToShadow::SyscallBatchComplete(res) => {
+                    retvals.extend_from_slice(&res.retvals[..chunk.len()])
+                }
+                other => panic!("Unexpected response from plugin: {other:?}"),
+            }
+        }
+
+        retvals
+    }
+
     pub fn spawn(
         plugin_path: &CStr,
         argv: Vec<CString>,
         envv: Vec<CString>,
         strace_file: Option<&std::fs::File>,
-        log_file: &std::fs::File,
+        log_file: &Arc<std::fs::File>,
         injected_preloads: &[PathBuf],
     ) -> Result<Self, Errno> {
+        Self::launch(
+            plugin_path,
+            argv,
+            envv,
+            strace_file,
+            log_file,
+            injected_preloads,
+        )?
+        .wait_for_start()
+    }
+
+    /// Start the native process, but don't wait for its shim to initialize. The native process
+    /// execs and loads its libraries in the background until [`PendingManagedThread::wait_for_start`]
+    /// is called.
+    pub fn launch(
+        plugin_path: &CStr,
+        argv: Vec<CString>,
+        envv: Vec<CString>,
+        strace_file: Option<&std::fs::File>,
+        log_file: &Arc<std::fs::File>,
+        injected_preloads: &[PathBuf],
+    ) -> Result<PendingManagedThread, Errno> {
         debug!("spawning new mthread '{plugin_path:?}' with environment '{envv:?}', arguments '{argv:?}'");
 
         let envv = inject_preloads(envv, injected_preloads);
@@ -112,22 +218,62 @@ impl ManagedThread {
         let child_pid =
             Self::spawn_native(plugin_path, argv, envv, strace_file, log_file, &ipc_shmem)?;
 
-        // In Linux, the PID is equal to the TID of its first thread.
-        let native_pid = child_pid;
-        let native_tid = child_pid;
-
         // Configure the child_pid_watcher to close the IPC channel when the child dies.
-        {
+        let ipc_watch_handle = {
             let worker = WORKER_SHARED.borrow();
-            let watcher = worker.as_ref().unwrap().child_pid_watcher();
+            let worker = worker.as_ref().unwrap();
+            let watcher = worker.child_pid_watcher();
 
             watcher.register_pid(child_pid);
             let ipc = ipc_shmem.clone();
-            watcher.register_callback(child_pid, move |_pid| {
+            let ipc_watch_handle = watcher.register_callback(child_pid, move |_pid| {
                 ipc.from_plugin().close_writer();
-            })
+            });
+
+            worker.add_pending_process(child_pid);
+            ipc_watch_handle
         };
 
+        Ok(PendingManagedThread {
+            ipc_shmem: Some(ipc_shmem),
+            ipc_watch_handle,
+            native_pid: child_pid,
+            shimlog_file: Arc::clone(log_file),
+        })
+    }
+}
+
+/// A native process that has been started by [`ManagedThread::launch`], but whose shim might not
+/// have initialized yet.
+///
+/// The native process is killed if this is dropped without waiting for it to start.
+pub struct PendingManagedThread {
+    /// Always `Some` until the thread starts.
+    ipc_shmem: Option<Arc<ShMemBlock<'static, IPCData>>>,
+    ipc_watch_handle: WatchHandle,
+    native_pid: linux_api::posix_types::Pid,
+    shimlog_file: Arc<std::fs::File>,
+}
+
+impl PendingManagedThread {
+    pub fn native_pid(&self) -> linux_api::posix_types::Pid {
+        self.native_pid
+    }
+
+    /// Block until the shim of the native process has initialized and is ready to run.
+    pub fn wait_for_start(mut self) -> Result<ManagedThread, Errno> {
+        let ipc_shmem = self.ipc_shmem.take().unwrap();
+
+        WORKER_SHARED
+            .borrow()
+            .as_ref()
+            .unwrap()
+            .remove_pending_process(self.native_pid);
+
+        // In Linux, the PID is equal to the TID of its first thread.
+        let native_pid = self.native_pid;
+        let native_tid = self.native_pid;
+
         trace!(
             "waiting for start event from shim with native pid {:?}",
             native_pid
@@ -173,17 +319,49 @@ impl ManagedThread {
             other => panic!("Unexpected result from shim: {other:?}"),
         };
 
-        Ok(Self {
+        Ok(ManagedThread {
             ipc_shmem,
+            ipc_watch_handle: self.ipc_watch_handle,
             is_running: Cell::new(true),
             return_code: Cell::new(None),
             current_event: RefCell::new(start_req),
             native_pid,
             native_tid,
             affinity: Cell::new(cshadow::AFFINITY_UNINIT),
+            ipc_spinner: Cell::new(AdaptiveSpinner::new()),
+            shimlog_file: self.shimlog_file.clone(),
         })
     }
+}
+
+impl Drop for PendingManagedThread {
+    fn drop(&mut self) {
+        if self.ipc_shmem.is_none() {
+            // the thread was started
+            return;
+        }
+
+        debug!(
+            "killing managed process {:?} that was never started",
+            self.native_pid
+        );
+        if let Err(err) =
+            rustix::process::kill_process(self.native_pid.into(), rustix::process::Signal::Kill)
+        {
+            log::warn!(
+                "Couldn't kill managed process {:?}. kill: {:?}",
+                self.native_pid,
+                err
+            );
+        }
+        let worker = WORKER_SHARED.borrow();
+        let worker = worker.as_ref().unwrap();
+        worker.remove_pending_process(self.native_pid);
+        worker.child_pid_watcher().unregister_pid(self.native_pid);
+    }
+}
 
+impl ManagedThread {
     pub fn resume(
         &self,
         ctx: &ThreadContext,
@@ -290,13 +468,16 @@ impl ManagedThread {
                                 SyscallCondition::consume_from_c(b.cond)
                             })
                         }
-                        SyscallReturn::Done(d) => self.continue_plugin(
-                            ctx.host,
-                            &ShimEventToShim::SyscallComplete(ShimEventSyscallComplete {
-                                retval: d.retval,
-                                restartable: d.restartable,
-                            }),
-                        ),
+                        SyscallReturn::Done(d) => {
+                            Self::publish_unblocked_signal_pending(ctx);
+                            self.continue_plugin(
+                                ctx.host,
+                                &ShimEventToShim::SyscallComplete(ShimEventSyscallComplete {
+                                    retval: d.retval,
+                                    restartable: d.restartable,
+                                }),
+                            )
+                        }
                         SyscallReturn::Native => {
                             self.continue_plugin(ctx.host, &ShimEventToShim::SyscallDoNative)
                         }
@@ -309,6 +490,7 @@ impl ManagedThread {
                     assert_eq!(res.clone_res, 0);
 
                     // Complete the virtualized clone syscall.
+                    Self::publish_unblocked_signal_pending(ctx);
                     self.continue_plugin(
                         ctx.host,
                         &ShimEventToShim::SyscallComplete(ShimEventSyscallComplete {
@@ -317,7 +499,10 @@ impl ManagedThread {
                         }),
                     )
                 }
-                e @ ShimEventToShadow::SyscallComplete(_) => panic!("Unexpected event: {e:?}"),
+                e @ (ShimEventToShadow::SyscallComplete(_)
+                | ShimEventToShadow::SyscallBatchComplete(_)) => {
+                    panic!("Unexpected event: {e:?}")
+                }
             };
             assert!(self.is_running());
         }
@@ -357,7 +542,7 @@ impl ManagedThread {
         ctid: ForeignPtr<libc::pid_t>,
         newtls: libc::c_ulong,
     ) -> Result<ManagedThread, linux_api::errno::Errno> {
-        let child_ipc_shmem = Arc::new(shadow_shmem::allocator::shmalloc(IPCData::new()));
+        let child_ipc_shmem = ctx.host.ipc_block_pool().take();
 
         // Send the IPC block for the new mthread to use.
         let clone_res: i64 = match self.continue_plugin(
@@ -405,7 +590,7 @@ impl ManagedThread {
         }
 
         // Register the child thread's IPC block with the ChildPidWatcher.
-        {
+        let ipc_watch_handle = {
             let child_ipc_shmem = child_ipc_shmem.clone();
             WORKER_SHARED
                 .borrow()
@@ -419,6 +604,7 @@ impl ManagedThread {
 
         Ok(Self {
             ipc_shmem: child_ipc_shmem,
+            ipc_watch_handle,
             is_running: Cell::new(true),
             return_code: Cell::new(None),
             current_event: RefCell::new(start_req),
@@ -426,14 +612,30 @@ impl ManagedThread {
             native_tid: child_native_tid,
             // TODO: can we assume it's inherited from the current thread affinity?
             affinity: Cell::new(cshadow::AFFINITY_UNINIT),
+            ipc_spinner: Cell::new(AdaptiveSpinner::new()),
+            shimlog_file: self.shimlog_file.clone(),
         })
     }
 
+    /// Let the shim know whether it has a signal to process after the syscall we're about to
+    /// complete, so that it doesn't need to take the host lock to check.
+    fn publish_unblocked_signal_pending(ctx: &ThreadContext) {
+        let pending = ctx
+            .thread
+            .unblocked_signal_pending(ctx.process, &ctx.host.shim_shmem_lock_borrow().unwrap());
+        ctx.thread
+            .shmem()
+            .unblocked_signal_pending
+            .store(pending, atomic::Ordering::Relaxed);
+    }
+
     #[must_use]
     fn continue_plugin(&self, host: &Host, event: &ShimEventToShim) -> ShimEventToShadow {
         // Update shared state before transferring control.
-        host.shim_shmem_lock_borrow_mut().unwrap().max_runahead_time =
-            Worker::max_event_runahead_time(host);
+        host.shim_shmem().max_runahead_time.store(
+            Worker::max_event_runahead_time(host),
+            atomic::Ordering::Relaxed,
+        );
         host.shim_shmem()
             .sim_time
             .store(Worker::current_time().unwrap(), atomic::Ordering::Relaxed);
@@ -443,11 +645,19 @@ impl ManagedThread {
 
         self.ipc_shmem.to_plugin().send(*event);
 
-        let event = match self.ipc_shmem.from_plugin().receive() {
+        let mut spinner = self.ipc_spinner.get();
+        let res = self
+            .ipc_shmem
+            .from_plugin()
+            .receive_with_spinner(&mut spinner);
+        self.ipc_spinner.set(spinner);
+        let event = match res {
             Ok(e) => e,
             Err(SelfContainedChannelError::WriterIsClosed) => ShimEventToShadow::ProcessDeath,
         };
 
+        self.write_shim_log();
+
         // Reacquire the shared memory lock, now that the shim has yielded control
         // back to us.
         host.lock_shmem();
@@ -468,6 +678,20 @@ impl ManagedThread {
         event
     }
 
+    /// Write out the log output that the shim buffered while the thread was running.
+    fn write_shim_log(&self) {
+        // SAFETY: The shim has passed control back to us (or is dead), and doesn't append to the
+        // buffer again until we send it the next event.
+        let res = unsafe {
+            self.ipc_shmem
+                .shim_log()
+                .drain(|bytes| (&*self.shimlog_file).write_all(bytes))
+        };
+        if let Err(e) = res {
+            log::warn!("Couldn't write to the shim log: {e}");
+        }
+    }
+
     /// To be called after we expect the native thread to have exited, or to
     /// exit imminently.
     fn cleanup_after_exit_initiated(&self) {
@@ -536,6 +760,8 @@ impl ManagedThread {
         let current_affinity = scheduler::core_affinity()
             .map(|x| i32::try_from(x).unwrap())
             .unwrap_or(cshadow::AFFINITY_UNINIT);
+        // the worker's cpu, or its hyperthread sibling if `use_smt_sibling_pinning` is enabled
+        let current_affinity = unsafe { cshadow::affinity_getProcessAffinity(current_affinity) };
         self.affinity.set(unsafe {
             cshadow::affinity_setProcessAffinity(
                 self.native_tid().as_raw_nonzero().get(),
@@ -782,5 +1008,28 @@ impl Drop for ManagedThread {
         // running thread accessing a deallocated or repurposed memory region
         // can cause numerous problems.
         assert!(!self.is_running());
+
+        // Anything the thread logged after its last event, e.g. just before being killed.
+        self.write_shim_log();
+
+        let stats = self.ipc_spinner.get().stats();
+        debug!(
+            "IPC waits for thread {:?}: {} spun, {} parked",
+            self.native_tid, stats.spun, stats.parked
+        );
+        let mut counts = Counter::new();
+        counts.add_value("spun", stats.spun.try_into().unwrap());
+        counts.add_value("parked", stats.parked.try_into().unwrap());
+        Worker::add_ipc_wait_counts(&counts);
+
+        // The native thread has exited, so once the ChildPidWatcher no longer references our IPC
+        // block it can be reused for a new thread. If the whole process has exited the block's
+        // writer was closed, and it won't be reused.
+        if let Some(worker) = WORKER_SHARED.borrow().as_ref() {
+            worker
+                .child_pid_watcher()
+                .unregister_callback(self.native_pid, self.ipc_watch_handle);
+        }
+        Worker::with_active_host(|host| host.ipc_block_pool().give(&self.ipc_shmem));
     }
 }
@@ -125,6 +125,21 @@ impl MemoryCopier {
         Ok(())
     }
 
+    /// Read the `srcs` into consecutive parts of `dst` using a single syscall. Returns the number
+    /// of bytes read, which is less than the total length of `srcs` if one of the `srcs` can't be
+    /// read; the `srcs` before it were read completely. Returns an error if the first of the `srcs`
+    /// can't be read. `dst` must be at least as long as the total length of `srcs`, and there must
+    /// be at most `UIO_MAXIOV` srcs.
+    /// SAFETY: A mutable reference to the process memory must not exist.
+    pub unsafe fn copy_from_ptrs(
+        &self,
+        dst: &mut [u8],
+        srcs: &[ForeignArrayPtr<u8>],
+    ) -> Result<usize, Errno> {
+        let len = srcs.iter().map(|src| src.len()).sum::<usize>();
+        unsafe { self.readv_ptrs(&mut [&mut dst[..len]], srcs) }
+    }
+
     // Low level helper for reading directly from `srcs` to `dsts`.
     // Returns the number of bytes read. Panics if the
     // MemoryManager's process isn't currently active.
@@ -220,6 +235,46 @@ impl MemoryCopier {
             len: towrite,
         }];
 
+        let nwritten = unsafe { self.writev_iovecs(&local, &remote)? };
+        // There shouldn't be any partial writes with a single remote iovec.
+        assert_eq!(nwritten, towrite);
+        Ok(())
+    }
+
+    /// Write consecutive parts of `src` to the `dsts` using a single syscall. Returns the number
+    /// of bytes written, which is less than the total length of `dsts` if one of the `dsts` can't
+    /// be written; the `dsts` before it were written completely. Returns an error if the first of
+    /// the `dsts` can't be written. `src` must be at least as long as the total length of `dsts`,
+    /// and there must be at most `UIO_MAXIOV` dsts.
+    /// SAFETY: A reference to the process memory must not exist.
+    pub unsafe fn copy_to_ptrs(
+        &self,
+        dsts: &[ForeignArrayPtr<u8>],
+        src: &[u8],
+    ) -> Result<usize, Errno> {
+        let remote: Vec<_> = dsts
+            .iter()
+            .map(|dst| nix::sys::uio::RemoteIoVec {
+                base: usize::from(dst.ptr()),
+                len: dst.len(),
+            })
+            .collect();
+        let len = remote.iter().map(|x| x.len).sum::<usize>();
+        trace!("write_ptrs writing {} bytes to {} dsts", len, dsts.len());
+        let local = [std::io::IoSlice::new(&src[..len])];
+
+        unsafe { self.writev_iovecs(&local, &remote) }
+    }
+
+    // Low level helper for writing directly from `local` to `remote`.
+    // Returns the number of bytes written. Panics if the
+    // MemoryManager's process isn't currently active.
+    /// SAFETY: A reference to the process memory must not exist.
+    unsafe fn writev_iovecs(
+        &self,
+        local: &[std::io::IoSlice],
+        remote: &[nix::sys::uio::RemoteIoVec],
+    ) -> Result<usize, Errno> {
         // While the documentation for process_vm_writev says to use the pid, in
         // practice it needs to be the tid of a still-running thread. i.e. using the
         // pid after the thread group leader has exited will fail.
@@ -249,12 +304,11 @@ impl MemoryCopier {
 
         let nwritten = nix::sys::uio::process_vm_writev(
             nix::unistd::Pid::from_raw(tid.as_raw_nonzero().get()),
-            &local,
-            &remote,
+            local,
+            remote,
         )
         .map_err(|e| Errno::try_from(e as i32).unwrap())?;
-        // There shouldn't be any partial writes with a single remote iovec.
-        assert_eq!(nwritten, towrite);
-        Ok(())
+
+        Ok(nwritten)
     }
 }
@@ -1,4 +1,4 @@
-use std::cell::RefCell;
+use std::cell::{Cell, RefCell};
 use std::collections::HashMap;
 use std::ffi::CString;
 use std::fmt::Debug;
@@ -17,12 +17,14 @@ use rustix::fs::FallocateFlags;
 use rustix::fs::MemfdFlags;
 use shadow_pod::Pod;
 use shadow_shim_helper_rs::notnull::*;
-use shadow_shim_helper_rs::syscall_types::ForeignPtr;
+use shadow_shim_helper_rs::syscall_types::{ForeignPtr, SyscallArgs, SyscallReg};
 
 use crate::host::context::ProcessContext;
 use crate::host::context::ThreadContext;
 use crate::host::memory_manager::{page_size, MemoryManager};
 use crate::host::syscall::types::ForeignArrayPtr;
+use crate::utility::counter::Counter;
+use crate::utility::deferred_cleanup;
 use crate::utility::interval_map::{Interval, IntervalMap, Mutation};
 use crate::utility::proc_maps;
 use crate::utility::proc_maps::{MappingPath, Sharing};
@@ -51,6 +53,49 @@ struct Region {
 // lot of boiler-plate in this case, though.
 unsafe impl Send for Region {}
 
+/// The number of recently translated regions that [`MemoryMapper`] remembers.
+const TRANSLATION_CACHE_SIZE: usize = 4;
+
+/// A region that is mapped into shadow's address space, as remembered by [`TranslationCache`].
+#[derive(Copy, Clone, Debug)]
+struct Translation {
+    start: usize,
+    end: usize,
+    // Stored as an integer so that the cache doesn't need its own `Send` implementation. The
+    // region in `MemoryMapper::regions` still owns the mapping.
+    shadow_base: usize,
+}
+
+/// The last few regions that `MemoryMapper::get_mapped_ptr` found, so that repeated accesses to
+/// the same few regions (typically the stack and heap) don't each need to search the regions.
+/// Must be cleared whenever the regions change.
+#[derive(Debug, Default)]
+struct TranslationCache {
+    entries: [Option<Translation>; TRANSLATION_CACHE_SIZE],
+    // The entry to replace on the next insert.
+    next: usize,
+}
+
+impl TranslationCache {
+    /// Get the cached region that contains all of `start..=last`, if any.
+    fn get(&self, start: usize, last: usize) -> Option<Translation> {
+        self.entries
+            .iter()
+            .flatten()
+            .find(|t| t.start <= start && last < t.end)
+            .copied()
+    }
+
+    fn insert(&mut self, translation: Translation) {
+        self.entries[self.next] = Some(translation);
+        self.next = (self.next + 1) % TRANSLATION_CACHE_SIZE;
+    }
+
+    fn clear(&mut self) {
+        *self = Self::default();
+    }
+}
+
 #[allow(dead_code)]
 fn log_regions<It: Iterator<Item = (Interval, Region)>>(level: log::Level, regions: It) {
     if log::log_enabled!(level) {
@@ -84,6 +129,9 @@ fn log_regions<It: Iterator<Item = (Interval, Region)>>(level: log::Level, regio
 pub struct MemoryMapper {
     shm_file: ShmFile,
     regions: IntervalMap<Region>,
+    translations: RefCell<TranslationCache>,
+    translation_hits: Cell<u64>,
+    translation_misses: Cell<u64>,
 
     misses_by_path: RefCell<HashMap<String, u32>>,
 
@@ -99,6 +147,10 @@ struct ShmFile {
     shm_file: File,
     shm_plugin_fd: i32,
     len: usize,
+    /// Whether to ask for Shadow's mappings of the file to be backed by transparent huge pages.
+    huge_pages: bool,
+    /// The number of Shadow's mappings of the file for which the kernel accepted that request.
+    huge_page_mappings: Cell<u64>,
 }
 
 impl ShmFile {
@@ -128,17 +180,52 @@ impl ShmFile {
 
     /// Map the given interval of the file into shadow's address space.
     fn mmap_into_shadow(&self, interval: &Interval, prot: ProtFlags) -> *mut c_void {
-        unsafe {
+        self.mmap_into_shadow_with_flags(interval, prot, MapFlags::empty())
+    }
+
+    /// Like `mmap_into_shadow`, but also fills in the mapping's page tables. Only worthwhile for
+    /// regions that are about to be written in full anyway, such as the initial heap.
+    fn mmap_into_shadow_populated(&self, interval: &Interval, prot: ProtFlags) -> *mut c_void {
+        let flags = if self.huge_pages {
+            MapFlags::MAP_POPULATE
+        } else {
+            MapFlags::empty()
+        };
+        self.mmap_into_shadow_with_flags(interval, prot, flags)
+    }
+
+    fn mmap_into_shadow_with_flags(
+        &self,
+        interval: &Interval,
+        prot: ProtFlags,
+        flags: MapFlags,
+    ) -> *mut c_void {
+        let ptr = unsafe {
             linux_api::mman::mmap(
                 std::ptr::null_mut(),
                 interval.len(),
                 prot,
-                MapFlags::MAP_SHARED,
+                MapFlags::MAP_SHARED | flags,
                 self.shm_file.as_raw_fd(),
                 interval.start,
             )
         }
-        .unwrap()
+        .unwrap();
+
+        if self.huge_pages {
+            // The kernel only uses huge pages for the parts of the mapping that are aligned to
+            // them, and only if shmem huge pages are allowed in
+            // /sys/kernel/mm/transparent_hugepage/shmem_enabled. Otherwise this has no effect.
+            let advice = rustix::mm::Advice::LinuxHugepage;
+            match unsafe { rustix::mm::madvise(ptr, interval.len(), advice) } {
+                Ok(()) => self
+                    .huge_page_mappings
+                    .set(self.huge_page_mappings.get() + 1),
+                Err(e) => trace!("Couldn't advise huge pages for {:?}: {}", interval, e),
+            }
+        }
+
+        ptr
     }
 
     /// Copy data from the plugin's address space into the file. `interval` must be contained within
@@ -190,6 +277,32 @@ impl ShmFile {
             )
             .unwrap();
     }
+
+    /// Map each of the given ranges of the file into the plugin's address space, using as few
+    /// round trips to the plugin as possible.
+    fn mmap_all_into_plugin(&self, ctx: &ThreadContext, mappings: &[(Interval, ProtFlags)]) {
+        let syscalls: Vec<SyscallArgs> = mappings
+            .iter()
+            .map(|(interval, prot)| {
+                SyscallArgs::new(
+                    libc::SYS_mmap,
+                    &[
+                        SyscallReg::from(interval.start),
+                        SyscallReg::from(interval.len()),
+                        SyscallReg::from(prot.bits()),
+                        SyscallReg::from((MapFlags::MAP_SHARED | MapFlags::MAP_FIXED).bits()),
+                        SyscallReg::from(self.shm_plugin_fd),
+                        SyscallReg::from(interval.start as i64),
+                    ],
+                )
+            })
+            .collect();
+
+        let (ctx, thread) = ctx.split_thread();
+        for res in thread.native_syscalls(&ctx, &syscalls) {
+            res.unwrap();
+        }
+    }
 }
 
 /// Get the current mapped regions of the process.
@@ -221,12 +334,14 @@ fn get_regions(pid: Pid) -> IntervalMap<Region> {
     regions
 }
 
-/// Find the heap range, and map it if non-empty.
+/// Find the heap range, and map it into shadow if non-empty. The range that should be mapped into
+/// the plugin is added to `plugin_mappings`.
 fn get_heap(
     ctx: &ThreadContext,
     shm_file: &mut ShmFile,
     memory_manager: &MemoryManager,
     regions: &mut IntervalMap<Region>,
+    plugin_mappings: &mut Vec<(Interval, ProtFlags)>,
 ) -> Interval {
     // If there's already a region labeled heap, we use those bounds.
     let heap_mapping = {
@@ -248,9 +363,9 @@ fn get_heap(
 
     shm_file.alloc(&heap_interval);
     let mut heap_region = heap_region.clone();
-    heap_region.shadow_base = shm_file.mmap_into_shadow(&heap_interval, HEAP_PROT);
+    heap_region.shadow_base = shm_file.mmap_into_shadow_populated(&heap_interval, HEAP_PROT);
     shm_file.copy_into_file(memory_manager, &heap_interval, &heap_region, &heap_interval);
-    shm_file.mmap_into_plugin(ctx, &heap_interval, HEAP_PROT);
+    plugin_mappings.push((heap_interval.clone(), HEAP_PROT));
 
     {
         let mutations = regions.insert(heap_interval.clone(), heap_region);
@@ -262,12 +377,13 @@ fn get_heap(
 }
 
 /// Finds where the stack is located and maps the region bounding the maximum
-/// stack size.
+/// stack size into shadow. The region that should be mapped into the plugin is
+/// added to `plugin_mappings`.
 fn map_stack(
     memory_manager: &mut MemoryManager,
-    ctx: &ThreadContext,
     shm_file: &mut ShmFile,
     regions: &mut IntervalMap<Region>,
+    plugin_mappings: &mut Vec<(Interval, ProtFlags)>,
 ) {
     // Find the current stack region. There should be exactly one.
     let mut iter = regions
@@ -307,7 +423,7 @@ fn map_stack(
         );
     }
 
-    shm_file.mmap_into_plugin(ctx, &remapped_stack_bounds, STACK_PROT);
+    plugin_mappings.push((remapped_stack_bounds.clone(), STACK_PROT));
 
     let mutations = regions.insert(remapped_stack_bounds, region);
     if remapped_overlaps_current {
@@ -332,14 +448,28 @@ impl Drop for MemoryMapper {
         // Mappings are no longer valid. Clear out our map, and unmap those regions from Shadow's
         // address space.
         let mutations = self.regions.clear(usize::MIN..usize::MAX);
-        for m in mutations {
-            if let Mutation::Removed(interval, region) = m {
-                if !region.shadow_base.is_null() {
-                    unsafe { linux_api::mman::munmap(region.shadow_base, interval.len()) }
-                        .unwrap_or_else(|e| warn!("munmap: {}", e));
+        let unmaps: Vec<(usize, usize)> = mutations
+            .into_iter()
+            .filter_map(|m| match m {
+                Mutation::Removed(interval, region) if !region.shadow_base.is_null() => {
+                    Some((region.shadow_base as usize, interval.len()))
                 }
-            }
+                _ => None,
+            })
+            .collect();
+        if unmaps.is_empty() {
+            return;
         }
+
+        // Unmapping the regions, which also frees the plugin's memory once our shared memory file
+        // is closed, can take a while for a large process. Nothing else refers to these regions of
+        // Shadow's address space, so leave it to the cleanup thread.
+        deferred_cleanup::defer(move || {
+            for (base, len) in unmaps {
+                unsafe { linux_api::mman::munmap(base as *mut c_void, len) }
+                    .unwrap_or_else(|e| warn!("munmap: {}", e));
+            }
+        });
     }
 }
 
@@ -401,33 +531,66 @@ impl MemoryMapper {
             memory_manager
                 .copy_to_ptr(path_buf_foreign_ptr, shm_path.as_bytes())
                 .unwrap();
-            let shm_plugin_fd = thread
-                .native_open(
-                    &ctx,
-                    path_buf_foreign_ptr.ptr(),
-                    libc::O_RDWR | libc::O_CLOEXEC,
-                    0,
-                )
-                .unwrap();
-            thread
-                .free_foreign_ptr(&ctx, path_buf_foreign_ptr.ptr(), path_buf_foreign_ptr.len())
-                .unwrap();
-            shm_plugin_fd
+            // open the file and free the path in a single round trip
+            let results = thread.native_syscalls(
+                &ctx,
+                &[
+                    SyscallArgs::new(
+                        libc::SYS_open,
+                        &[
+                            SyscallReg::from(path_buf_foreign_ptr.ptr()),
+                            SyscallReg::from(libc::O_RDWR | libc::O_CLOEXEC),
+                            SyscallReg::from(0i32),
+                        ],
+                    ),
+                    SyscallArgs::new(
+                        libc::SYS_munmap,
+                        &[
+                            SyscallReg::from(path_buf_foreign_ptr.ptr()),
+                            SyscallReg::from(path_buf_foreign_ptr.len()),
+                        ],
+                    ),
+                ],
+            );
+            let [open_res, munmap_res] = results[..] else {
+                unreachable!();
+            };
+            munmap_res.unwrap();
+            i32::from(open_res.unwrap())
         };
 
         let mut shm_file = ShmFile {
             shm_file,
             shm_plugin_fd,
             len: 0,
+            huge_pages: ctx.host.params.use_mem_mapper_huge_pages,
+            huge_page_mappings: Cell::new(0),
         };
         let regions = get_regions(memory_manager.pid);
         let mut regions = coalesce_regions(regions);
-        let heap = get_heap(ctx, &mut shm_file, memory_manager, &mut regions);
-        map_stack(memory_manager, ctx, &mut shm_file, &mut regions);
+        // the heap and stack are mapped into the plugin together once they're both copied
+        let mut plugin_mappings = Vec::new();
+        let heap = get_heap(
+            ctx,
+            &mut shm_file,
+            memory_manager,
+            &mut regions,
+            &mut plugin_mappings,
+        );
+        map_stack(
+            memory_manager,
+            &mut shm_file,
+            &mut regions,
+            &mut plugin_mappings,
+        );
+        shm_file.mmap_all_into_plugin(ctx, &plugin_mappings);
 
         MemoryMapper {
             shm_file,
             regions,
+            translations: RefCell::new(TranslationCache::default()),
+            translation_hits: Cell::new(0),
+            translation_misses: Cell::new(0),
             misses_by_path: RefCell::new(HashMap::new()),
             heap,
         }
@@ -541,6 +704,7 @@ impl MemoryMapper {
         flags: MapFlags,
         fd: i32,
     ) {
+        self.translations.get_mut().clear();
         trace!(
             "Handling mmap result for {:x}..+{}",
             usize::from(ptr.ptr()),
@@ -609,6 +773,7 @@ impl MemoryMapper {
     /// the plugin's address space, and unmaps the affected memory from Shadow if it was mapped in.
     pub fn handle_munmap_result(&mut self, addr: ForeignPtr<u8>, length: usize) {
         trace!("handle_munmap_result({:?}, {})", addr, length);
+        self.translations.get_mut().clear();
         if length == 0 {
             return;
         }
@@ -634,6 +799,7 @@ impl MemoryMapper {
         flags: i32,
         new_address: ForeignPtr<u8>,
     ) -> Result<ForeignPtr<u8>, Errno> {
+        self.translations.get_mut().clear();
         let new_address = {
             let (ctx, thread) = ctx.split_thread();
             thread.native_mremap(&ctx, old_address, old_size, new_size, flags, new_address)?
@@ -760,6 +926,7 @@ impl MemoryMapper {
         ctx: &ThreadContext,
         ptr: ForeignPtr<u8>,
     ) -> Result<ForeignPtr<u8>, Errno> {
+        self.translations.get_mut().clear();
         let requested_brk = usize::from(ptr);
 
         // On error, brk syscall returns current brk (end of heap). The only errors we specifically
@@ -891,6 +1058,7 @@ impl MemoryMapper {
     ) -> Result<(), Errno> {
         let (ctx, thread) = ctx.split_thread();
         trace!("mprotect({:?}, {}, {:?})", addr, size, prot);
+        self.translations.get_mut().clear();
         thread.native_mprotect(&ctx, addr, size, prot)?;
 
         // Update protections. We remove the affected range, and then update and re-insert affected
@@ -1007,6 +1175,24 @@ impl MemoryMapper {
         Ok(())
     }
 
+    /// Add the mapper's statistics for `sim-stats.json` to `counts`.
+    pub fn add_stats(&self, counts: &mut Counter) {
+        counts.add_value(
+            "translation_cache_hits",
+            self.translation_hits.get().try_into().unwrap(),
+        );
+        counts.add_value(
+            "translation_cache_misses",
+            self.translation_misses.get().try_into().unwrap(),
+        );
+        if self.shm_file.huge_pages {
+            counts.add_value(
+                "huge_page_mappings",
+                self.shm_file.huge_page_mappings.get().try_into().unwrap(),
+            );
+        }
+    }
+
     // Get a raw pointer to the plugin's memory, if it's been remapped into Shadow.
     // Panics if called with zero-length `src`.
     fn get_mapped_ptr<T: Pod + Debug>(&self, src: ForeignArrayPtr<T>) -> Option<*mut T> {
@@ -1021,7 +1207,21 @@ impl MemoryMapper {
             return None;
         }
 
-        let (interval, region) = match self.regions.get(usize::from(src.ptr())) {
+        let start = usize::from(src.ptr());
+        let last = usize::from(src.slice(src.len()..src.len()).ptr()) - 1;
+
+        if let Some(translation) = self.translations.borrow().get(start, last) {
+            self.translation_hits.set(self.translation_hits.get() + 1);
+            let offset = start - translation.start;
+            // Base pointer + offset won't wrap around, by construction.
+            let ptr = unsafe { (translation.shadow_base as *mut c_void).add(offset) } as *mut T;
+            return Some(ptr);
+        }
+
+        self.translation_misses
+            .set(self.translation_misses.get() + 1);
+
+        let (interval, region) = match self.regions.get(start) {
             Some((i, r)) => (i, r),
             None => {
                 if !src.ptr().is_null() {
@@ -1037,7 +1237,7 @@ impl MemoryMapper {
             region.shadow_base
         };
 
-        if !interval.contains(&(usize::from(src.slice(src.len()..src.len()).ptr()) - 1)) {
+        if !interval.contains(&last) {
             // End isn't in the region.
             trace!(
                 "src {:?} mapped into Shadow, but extends beyond mapped region.",
@@ -1046,7 +1246,13 @@ impl MemoryMapper {
             return None;
         }
 
-        let offset = usize::from(src.ptr()) - interval.start;
+        self.translations.borrow_mut().insert(Translation {
+            start: interval.start,
+            end: interval.end,
+            shadow_base: shadow_base as usize,
+        });
+
+        let offset = start - interval.start;
         // Base pointer + offset won't wrap around, by construction.
         let ptr = unsafe { shadow_base.add(offset) } as *mut T;
 
@@ -1097,3 +1303,29 @@ impl MemoryMapper {
 fn test_validate_void_size() {
     assert_eq!(std::mem::size_of::<c_void>(), 1);
 }
+
+#[cfg(test)]
+#[test]
+fn test_translation_cache() {
+    let mut cache = TranslationCache::default();
+    let translation = |start| Translation {
+        start,
+        end: start + 0x1000,
+        shadow_base: start * 2,
+    };
+
+    cache.insert(translation(0x1000));
+    assert_eq!(cache.get(0x1000, 0x1fff).unwrap().start, 0x1000);
+    assert!(cache.get(0x1000, 0x2000).is_none());
+    assert!(cache.get(0xfff, 0x1000).is_none());
+
+    // The oldest entry is replaced once the cache is full.
+    for i in 1..=TRANSLATION_CACHE_SIZE {
+        cache.insert(translation(0x1000 * (i + 1)));
+    }
+    assert!(cache.get(0x1000, 0x1000).is_none());
+    assert!(cache.get(0x2000, 0x2000).is_some());
+
+    cache.clear();
+    assert!(cache.get(0x2000, 0x2000).is_none());
+}
@@ -15,6 +15,7 @@
 //! all access to process memory must go through it. This includes servicing syscalls that
 //! modify the process address space (such as `mmap`).
 
+use std::cell::Cell;
 use std::fmt::Debug;
 use std::mem::MaybeUninit;
 use std::ops::{Deref, DerefMut};
@@ -30,7 +31,9 @@ use shadow_pod::Pod;
 use shadow_shim_helper_rs::syscall_types::ForeignPtr;
 
 use super::context::ThreadContext;
+use crate::core::worker::Worker;
 use crate::host::syscall::types::{ForeignArrayPtr, SyscallError};
+use crate::utility::counter::Counter;
 
 mod memory_copier;
 mod memory_mapper;
@@ -270,6 +273,11 @@ where
     }
 }
 
+/// The largest scratch memory that a process keeps mapped between `AllocdMem`s. Larger
+/// allocations get a mapping of their own, so that e.g. a large sendfile buffer doesn't stay
+/// mapped for the rest of the process's life.
+const SCRATCH_MAX_LEN: usize = 16 * 1024;
+
 fn page_size() -> usize {
     nix::unistd::sysconf(nix::unistd::SysconfVar::PAGE_SIZE)
         .unwrap()
@@ -303,6 +311,21 @@ pub struct MemoryManager {
 
     // Native pid of the plugin process.
     pid: Pid,
+
+    // How many accesses were handled by the `memory_mapper`, and how many fell back to the
+    // `memory_copier`. Reported in the sim stats when dropped.
+    mapped_reads: Cell<u64>,
+    copied_reads: Cell<u64>,
+    mapped_writes: u64,
+    copied_writes: u64,
+
+    // Memory that Shadow allocated in the process for `AllocdMem`s. It's kept mapped after each
+    // use and grown geometrically up to `SCRATCH_MAX_LEN`, so that repeated uses don't each need
+    // an mmap and munmap in the process. It's forgotten if the process unmaps or replaces any of
+    // it.
+    scratch: Option<ForeignArrayPtr<u8>>,
+    // Whether `scratch` is currently used by an `AllocdMem`.
+    scratch_in_use: bool,
 }
 
 impl MemoryManager {
@@ -325,6 +348,12 @@ impl MemoryManager {
             pid,
             memory_copier: MemoryCopier::new(pid),
             memory_mapper: None,
+            mapped_reads: Cell::new(0),
+            copied_reads: Cell::new(0),
+            mapped_writes: 0,
+            copied_writes: 0,
+            scratch: None,
+            scratch_in_use: false,
         }
     }
 
@@ -332,20 +361,50 @@ impl MemoryManager {
     // `memory_mapper`.  Calling methods should fall back to the `memory_copier`
     // on failure.
     fn mapped_ref<T: Pod + Debug>(&self, ptr: ForeignArrayPtr<T>) -> Option<&[T]> {
-        let mm = self.memory_mapper.as_ref()?;
         // SAFETY: No mutable refs to process memory exist by preconditions of
         // MemoryManager::new + we have a reference.
-        unsafe { mm.get_ref(ptr) }
+        let mref = self
+            .memory_mapper
+            .as_ref()
+            .and_then(|mm| unsafe { mm.get_ref(ptr) });
+
+        let count = if mref.is_some() {
+            &self.mapped_reads
+        } else {
+            &self.copied_reads
+        };
+        count.set(count.get() + 1);
+
+        mref
     }
 
     // Internal helper for getting a reference to memory via the
     // `memory_mapper`.  Calling methods should fall back to the `memory_copier`
     // on failure.
     fn mapped_mut<T: Pod + Debug>(&mut self, ptr: ForeignArrayPtr<T>) -> Option<&mut [T]> {
-        let mm = self.memory_mapper.as_ref()?;
         // SAFETY: No other refs to process memory exist by preconditions of
         // MemoryManager::new + we have an exclusive reference.
-        unsafe { mm.get_mut(ptr) }
+        let mref = self
+            .memory_mapper
+            .as_ref()
+            .and_then(|mm| unsafe { mm.get_mut(ptr) });
+
+        if mref.is_some() {
+            self.mapped_writes += 1;
+        } else {
+            self.copied_writes += 1;
+        }
+
+        mref
+    }
+
+    /// Whether the given memory is mapped into Shadow, in which case
+    /// references to it don't need to copy it.
+    pub fn is_mapped<T: Pod + Debug>(&self, ptr: ForeignArrayPtr<T>) -> bool {
+        // SAFETY: The reference is dropped immediately.
+        self.memory_mapper
+            .as_ref()
+            .is_some_and(|mm| unsafe { mm.get_ref(ptr) }.is_some())
     }
 
     /// Returns a reference to the given memory, copying to a local buffer if
@@ -470,6 +529,38 @@ impl MemoryManager {
         unsafe { self.memory_copier.copy_from_ptr(dst, src) }
     }
 
+    /// Copies the `srcs` into consecutive parts of `dst`, with at most one syscall. Returns the
+    /// number of bytes copied, which is less than the total length of `srcs` if one of them isn't
+    /// readable; the `srcs` before it were copied completely. Returns an error if the first of the
+    /// `srcs` isn't readable. `dst` must be at least as long as the total length of `srcs`, and
+    /// there must be at most `UIO_MAXIOV` srcs.
+    pub fn copy_from_ptrs(
+        &self,
+        dst: &mut [u8],
+        srcs: &[ForeignArrayPtr<u8>],
+    ) -> Result<usize, Errno> {
+        let mut offset = 0;
+
+        // copy directly from the mapped srcs, and then copy the rest in one batch
+        for (i, src) in srcs.iter().enumerate() {
+            let Some(mapped) = self.mapped_ref(*src) else {
+                let rv = unsafe {
+                    self.memory_copier
+                        .copy_from_ptrs(&mut dst[offset..], &srcs[i..])
+                };
+                return match rv {
+                    Ok(copied) => Ok(offset + copied),
+                    Err(_) if offset > 0 => Ok(offset),
+                    Err(e) => Err(e),
+                };
+            };
+            dst[offset..][..mapped.len()].copy_from_slice(mapped);
+            offset += mapped.len();
+        }
+
+        Ok(offset)
+    }
+
     // Copies memory from the beginning of the given pointer to the last address
     // in the pointer that's accessible. Not exposed as a public interface
     // because this is generally only useful for strings, and
@@ -588,6 +679,37 @@ impl MemoryManager {
         unsafe { self.memory_copier.copy_to_ptr(dst, src) }
     }
 
+    /// Writes consecutive parts of `src` to the `dsts`, with at most one syscall. Returns the
+    /// number of bytes written, which is less than the total length of `dsts` if one of them isn't
+    /// writable; the `dsts` before it were written completely. Returns an error if the first of
+    /// the `dsts` isn't writable. `src` must be at least as long as the total length of `dsts`, and
+    /// there must be at most `UIO_MAXIOV` dsts.
+    pub fn copy_to_ptrs(
+        &mut self,
+        dsts: &[ForeignArrayPtr<u8>],
+        src: &[u8],
+    ) -> Result<usize, Errno> {
+        let mut offset = 0;
+
+        // write directly to the mapped dsts, and then write the rest in one batch
+        for (i, dst) in dsts.iter().enumerate() {
+            let Some(mapped) = self.mapped_mut(*dst) else {
+                // SAFETY: No other refs to process memory exist by preconditions of
+                // MemoryManager::new + we have an exclusive reference.
+                let rv = unsafe { self.memory_copier.copy_to_ptrs(&dsts[i..], &src[offset..]) };
+                return match rv {
+                    Ok(written) => Ok(offset + written),
+                    Err(_) if offset > 0 => Ok(offset),
+                    Err(e) => Err(e),
+                };
+            };
+            mapped.copy_from_slice(&src[offset..][..mapped.len()]);
+            offset += mapped.len();
+        }
+
+        Ok(offset)
+    }
+
     /// Which process's address space this MemoryManager manages.
     pub fn pid(&self) -> Pid {
         self.pid
@@ -639,6 +761,9 @@ impl MemoryManager {
             let (ctx, thread) = ctx.split_thread();
             thread.native_mmap(&ctx, addr, length, prot, flags, fd, offset)?
         };
+        if flags.contains(MapFlags::MAP_FIXED) {
+            self.forget_overlapping_scratch(addr, length);
+        }
         if let Some(mm) = &mut self.memory_mapper {
             mm.handle_mmap_result(ctx, ForeignArrayPtr::new(addr, length), prot, flags, fd);
         }
@@ -651,6 +776,8 @@ impl MemoryManager {
         addr: ForeignPtr<u8>,
         length: usize,
     ) -> Result<(), SyscallError> {
+        self.forget_overlapping_scratch(addr, length);
+
         if self.memory_mapper.is_some() {
             // Do it ourselves so that we can update our mappings based on
             // whether it succeeded.
@@ -677,6 +804,78 @@ impl MemoryManager {
         Ok(())
     }
 
+    /// Take the process's scratch memory for use by an `AllocdMem` of `len` bytes, first growing
+    /// it if it's smaller. Returns `None` if the scratch memory is already in use. Must be returned
+    /// with `return_scratch`.
+    fn take_scratch(
+        &mut self,
+        ctx: &ThreadContext,
+        len: usize,
+    ) -> Result<Option<ForeignArrayPtr<u8>>, Errno> {
+        if self.scratch_in_use || len > SCRATCH_MAX_LEN {
+            return Ok(None);
+        }
+
+        let scratch = match self.scratch {
+            Some(scratch) if scratch.len() >= len => scratch,
+            prev => {
+                let prev_len = prev.map(|x| x.len()).unwrap_or(0);
+                let new_len = std::cmp::max(len, 2 * prev_len)
+                    .min(SCRATCH_MAX_LEN)
+                    .next_multiple_of(page_size());
+
+                // map the new memory first, so that a failure leaves the previous memory usable
+                let ptr = self.do_mmap(
+                    ctx,
+                    ForeignPtr::null(),
+                    new_len,
+                    ProtFlags::PROT_READ | ProtFlags::PROT_WRITE,
+                    MapFlags::MAP_ANONYMOUS | MapFlags::MAP_PRIVATE,
+                    -1,
+                    0,
+                )?;
+                if let Some(prev) = prev {
+                    self.do_munmap(ctx, prev.ptr(), prev.len())?;
+                }
+
+                let scratch = ForeignArrayPtr::new(ptr, new_len);
+                self.scratch = Some(scratch);
+                scratch
+            }
+        };
+
+        self.scratch_in_use = true;
+        Ok(Some(scratch))
+    }
+
+    /// Return the scratch memory from `take_scratch`.
+    fn return_scratch(&mut self, scratch: ForeignArrayPtr<u8>) {
+        assert!(self.scratch_in_use);
+        // the scratch memory may have been forgotten while it was in use
+        if let Some(current) = self.scratch {
+            assert!(current.ptr() == scratch.ptr());
+        }
+        self.scratch_in_use = false;
+    }
+
+    /// Forget the scratch memory if the process is unmapping or replacing any of `addr..addr+len`
+    /// that overlaps it, so that it isn't handed out again. We don't unmap what's left of it;
+    /// that's bounded by `SCRATCH_MAX_LEN`.
+    fn forget_overlapping_scratch(&mut self, addr: ForeignPtr<u8>, len: usize) {
+        let Some(scratch) = self.scratch else {
+            return;
+        };
+
+        let start = usize::from(addr);
+        let end = start.saturating_add(len);
+        let scratch_start = usize::from(scratch.ptr());
+        let scratch_end = scratch_start + scratch.len();
+
+        if start < scratch_end && scratch_start < end {
+            self.scratch = None;
+        }
+    }
+
     pub fn handle_mremap(
         &mut self,
         ctx: &ThreadContext,
@@ -686,6 +885,11 @@ impl MemoryManager {
         flags: i32,
         new_address: ForeignPtr<u8>,
     ) -> Result<ForeignPtr<u8>, SyscallError> {
+        self.forget_overlapping_scratch(old_address, old_size);
+        if (flags & libc::MREMAP_FIXED) != 0 {
+            self.forget_overlapping_scratch(new_address, new_size);
+        }
+
         match &mut self.memory_mapper {
             Some(mm) => {
                 Ok(mm.handle_mremap(ctx, old_address, old_size, new_size, flags, new_address)?)
@@ -708,12 +912,29 @@ impl MemoryManager {
     }
 }
 
+impl Drop for MemoryManager {
+    fn drop(&mut self) {
+        let mut counts = Counter::new();
+        counts.add_value("mapped_reads", self.mapped_reads.get().try_into().unwrap());
+        counts.add_value("copied_reads", self.copied_reads.get().try_into().unwrap());
+        counts.add_value("mapped_writes", self.mapped_writes.try_into().unwrap());
+        counts.add_value("copied_writes", self.copied_writes.try_into().unwrap());
+        if let Some(mm) = &self.memory_mapper {
+            mm.add_stats(&mut counts);
+        }
+        Worker::add_memory_access_counts(&counts);
+    }
+}
+
 /// Memory allocated by Shadow, in a remote address space.
 pub struct AllocdMem<T>
 where
     T: Pod,
 {
     ptr: ForeignArrayPtr<T>,
+    // The process's scratch memory that `ptr` is in, if any. Otherwise `ptr` was mapped for only
+    // this object.
+    scratch: Option<ForeignArrayPtr<u8>>,
     // Whether the pointer has been freed.
     freed: bool,
 }
@@ -722,28 +943,36 @@ impl<T> AllocdMem<T>
 where
     T: Pod,
 {
-    /// Allocate memory in the current active process.
+    /// Allocate memory in the current active process. The memory is usually
+    /// reused from a previous `AllocdMem`, so its contents are unspecified.
     /// Must be freed explicitly via `free`.
     pub fn new(ctx: &ThreadContext, len: usize) -> Self {
         let prot = ProtFlags::PROT_READ | ProtFlags::PROT_WRITE;
+        let nbytes = len * std::mem::size_of::<T>();
 
         // Allocate through the MemoryManager, so that it knows about this region.
-        let ptr = ctx
-            .process
-            .memory_borrow_mut()
-            .do_mmap(
-                ctx,
-                ForeignPtr::null(),
-                len * std::mem::size_of::<T>(),
-                prot,
-                MapFlags::MAP_ANONYMOUS | MapFlags::MAP_PRIVATE,
-                -1,
-                0,
-            )
-            .unwrap();
+        let mut mem = ctx.process.memory_borrow_mut();
+
+        // use the process's scratch memory, unless another `AllocdMem` is using it
+        let scratch = mem.take_scratch(ctx, nbytes).unwrap();
+        let ptr = match scratch {
+            Some(scratch) => scratch.ptr(),
+            None => mem
+                .do_mmap(
+                    ctx,
+                    ForeignPtr::null(),
+                    nbytes,
+                    prot,
+                    MapFlags::MAP_ANONYMOUS | MapFlags::MAP_PRIVATE,
+                    -1,
+                    0,
+                )
+                .unwrap(),
+        };
 
         Self {
             ptr: ForeignArrayPtr::new(ptr.cast::<T>(), len),
+            scratch,
             freed: false,
         }
     }
@@ -754,14 +983,18 @@ where
     }
 
     pub fn free(mut self, ctx: &ThreadContext) {
-        ctx.process
-            .memory_borrow_mut()
-            .do_munmap(
-                ctx,
-                self.ptr.ptr().cast::<u8>(),
-                self.ptr.len() * std::mem::size_of::<T>(),
-            )
-            .unwrap();
+        let mut mem = ctx.process.memory_borrow_mut();
+        match self.scratch {
+            // keep the scratch memory mapped for the next `AllocdMem`
+            Some(scratch) => mem.return_scratch(scratch),
+            None => mem
+                .do_munmap(
+                    ctx,
+                    self.ptr.ptr().cast::<u8>(),
+                    self.ptr.len() * std::mem::size_of::<T>(),
+                )
+                .unwrap(),
+        }
         self.freed = true;
     }
 }
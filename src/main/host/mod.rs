@@ -17,4 +17,6 @@ pub mod process;
 pub mod status_listener;
 pub mod syscall;
 pub mod thread;
+pub mod timeout_wheel;
 pub mod timer;
+pub mod traffic;
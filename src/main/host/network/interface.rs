@@ -21,6 +21,10 @@ pub type FifoPacketPriority = u64;
 pub struct PcapOptions {
     pub path: PathBuf,
     pub capture_size_bytes: u32,
+    /// Only capture the packet headers, not the payloads.
+    pub headers_only: bool,
+    /// Write the packets to the simulation's merged pcapng file rather than to a file in `path`.
+    pub merged: bool,
 }
 
 /// Represents a network device that can send and receive packets. All accesses
@@ -57,13 +61,23 @@ impl NetworkInterface {
             .as_ref()
             .map(|x| x.capture_size_bytes)
             .unwrap_or(0);
+        let pcap_headers_only = pcap_options.as_ref().is_some_and(|x| x.headers_only);
+        let pcap_merged = pcap_options.as_ref().is_some_and(|x| x.merged);
 
         let mut name = name.as_bytes().to_vec();
         name.push(0);
         let name = CString::from_vec_with_nul(name).unwrap();
 
         let c_ptr = unsafe {
-            c::networkinterface_new(addr, name.as_ptr(), pcap_dir_cptr, pcap_capture_size, qdisc)
+            c::networkinterface_new(
+                addr,
+                name.as_ptr(),
+                pcap_dir_cptr,
+                pcap_capture_size,
+                pcap_headers_only,
+                pcap_merged,
+                qdisc,
+            )
         };
 
         let ipv4_addr: Ipv4Addr = {
@@ -169,4 +183,21 @@ impl PacketDevice for NetworkInterface {
         };
         unsafe { c::packet_unref(packet_ptr) };
     }
+
+    fn push_batch(&self, packets: Vec<PacketRc>) {
+        let packet_ptrs: Vec<*mut c::Packet> =
+            packets.into_iter().map(|p| p.into_inner()).collect();
+        let current_time = Worker::current_time().unwrap();
+        unsafe {
+            c::networkinterface_pushBatch(
+                self.c_ptr.ptr(),
+                packet_ptrs.as_ptr(),
+                packet_ptrs.len(),
+                EmulatedTime::to_c_emutime(Some(current_time)),
+            )
+        };
+        for packet_ptr in packet_ptrs {
+            unsafe { c::packet_unref(packet_ptr) };
+        }
+    }
 }
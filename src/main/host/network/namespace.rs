@@ -1,7 +1,6 @@
 use std::cell::{Cell, RefCell};
-use std::ffi::{CString, OsStr};
+use std::ffi::{CStr, OsStr};
 use std::net::{Ipv4Addr, SocketAddrV4};
-use std::num::NonZeroU8;
 use std::ops::{Deref, DerefMut};
 use std::sync::Arc;
 
@@ -20,6 +19,10 @@ use crate::host::network::interface::{NetworkInterface, PcapOptions};
 // specify the port it wants to bind to, and for client connections.
 const MIN_RANDOM_PORT: u16 = 10000;
 
+// The number of ephemeral port search hints, which are shared by peers with the same hash.
+const NUM_PORT_HINTS: usize = 256;
+const _: () = assert!(NUM_PORT_HINTS.is_power_of_two());
+
 /// Represents a network namespace.
 ///
 /// Can be thought of as roughly equivalent to a Linux `struct net`. Shadow doesn't support multiple
@@ -37,49 +40,52 @@ pub struct NetworkNamespace {
     pub default_address: SyncSendPointer<cshadow::Address>,
     pub default_ip: Ipv4Addr,
 
+    // where to continue searching for a free ephemeral port for peers with a given hash, or 0 if
+    // we haven't needed to search for these peers yet
+    port_hints: RefCell<[u16; NUM_PORT_HINTS]>,
+
     // used for debugging to make sure we've cleaned up before being dropped
     has_run_cleanup: Cell<bool>,
 }
 
 impl NetworkNamespace {
-    /// # Safety
-    ///
-    /// `dns` must be a valid pointer.
-    pub unsafe fn new(
+    /// Build the namespace's network interfaces using addresses that were previously registered
+    /// with [`NamespaceAddresses::register`].
+    pub fn new(
         host_id: HostId,
-        hostname: Vec<NonZeroU8>,
-        public_ip: Ipv4Addr,
+        addresses: NamespaceAddresses,
         pcap: Option<PcapOptions>,
         qdisc: QDiscMode,
-        dns: *mut cshadow::DNS,
     ) -> Self {
-        let (localhost, local_addr) = unsafe {
+        let NamespaceAddresses {
+            localhost: local_addr,
+            public: public_addr,
+            public_ip,
+        } = addresses;
+
+        let localhost = unsafe {
             Self::setup_net_interface(
                 OsStr::new("lo"),
+                local_addr.ptr(),
                 &InterfaceOptions {
                     host_id,
-                    hostname: hostname.clone(),
-                    ip: Ipv4Addr::LOCALHOST,
                     pcap: pcap.clone(),
                     qdisc,
                 },
-                dns,
             )
         };
 
-        unsafe { cshadow::address_unref(local_addr) };
+        unsafe { cshadow::address_unref(local_addr.ptr()) };
 
-        let (internet, public_addr) = unsafe {
+        let internet = unsafe {
             Self::setup_net_interface(
                 OsStr::new("eth0"),
+                public_addr.ptr(),
                 &InterfaceOptions {
                     host_id,
-                    hostname,
-                    ip: public_ip,
                     pcap,
                     qdisc,
                 },
-                dns,
             )
         };
 
@@ -87,29 +93,20 @@ impl NetworkNamespace {
             unix: Arc::new(AtomicRefCell::new(AbstractUnixNamespace::new())),
             localhost: RefCell::new(localhost),
             internet: RefCell::new(internet),
-            default_address: unsafe { SyncSendPointer::new(public_addr) },
+            default_address: public_addr,
             default_ip: public_ip,
+            port_hints: RefCell::new([0; NUM_PORT_HINTS]),
             has_run_cleanup: Cell::new(false),
         }
     }
 
-    /// Must free the returned `*mut cshadow::Address` using [`cshadow::address_unref`].
+    /// `addr` must be a valid pointer.
     unsafe fn setup_net_interface(
         name: &OsStr,
+        addr: *mut cshadow::Address,
         options: &InterfaceOptions,
-        dns: *mut cshadow::DNS,
-    ) -> (NetworkInterface, *mut cshadow::Address) {
-        let ip = u32::from(options.ip).to_be();
-
-        // hostname is shadowed so that we can't accidentally drop the CString before the end of the
-        // scope
-        let hostname: CString = options.hostname.clone().into();
-        let hostname = hostname.as_ptr();
-
-        let addr = unsafe { cshadow::dns_register(dns, options.host_id, hostname, ip) };
-        assert!(!addr.is_null());
-
-        let interface = unsafe {
+    ) -> NetworkInterface {
+        unsafe {
             NetworkInterface::new(
                 options.host_id,
                 addr,
@@ -117,14 +114,19 @@ impl NetworkNamespace {
                 options.pcap.clone(),
                 options.qdisc,
             )
-        };
+        }
+    }
 
-        (interface, addr)
+    /// The namespace's public (non-localhost) address.
+    pub fn default_ip(&self) -> Ipv4Addr {
+        let addr = self.default_address.ptr();
+        let addr = unsafe { cshadow::address_toNetworkIP(addr) };
+        u32::from_be(addr).into()
     }
 
     /// Clean up the network namespace. This should be called while `Worker` has the active host
     /// set. The `dns` object should be the same object that was originally provided to
-    /// [`Self::new`].
+    /// [`NamespaceAddresses::register`].
     pub fn cleanup(&self, dns: &cshadow::DNS) {
         assert!(!self.has_run_cleanup.get());
 
@@ -247,10 +249,16 @@ impl NetworkNamespace {
             }
         }
 
-        // now if we tried too many times and still don't have a port, fall back
-        // to a linear search to make sure we get a free port if we have one.
-        // but start from a random port instead of the min.
-        let start = rng.gen_range(MIN_RANDOM_PORT..=u16::MAX);
+        // now if we tried too many times and still don't have a port, fall back to a linear search
+        // to make sure we get a free port if we have one. a host that makes many connections to the
+        // same peer will end up here for most of them, so rather than starting from a random port
+        // each time, continue from where the previous search for this peer stopped (similar to
+        // Linux's `table_perturb`). the ports before that are likely still in use.
+        let hint_index = Self::port_hint_index(peer);
+        let mut start = self.port_hints.borrow()[hint_index];
+        if start == 0 {
+            start = rng.gen_range(MIN_RANDOM_PORT..=u16::MAX);
+        }
         for port in (start..=u16::MAX).chain(MIN_RANDOM_PORT..start) {
             let specific_in_use = self
                 .is_addr_in_use(protocol_type, SocketAddrV4::new(interface_ip, port), peer)
@@ -263,6 +271,8 @@ impl NetworkNamespace {
                 )
                 .unwrap_or(true);
             if !specific_in_use && !generic_in_use {
+                self.port_hints.borrow_mut()[hint_index] =
+                    port.checked_add(1).unwrap_or(MIN_RANDOM_PORT);
                 return Some(port);
             }
         }
@@ -271,6 +281,13 @@ impl NetworkNamespace {
         None
     }
 
+    fn port_hint_index(peer: SocketAddrV4) -> usize {
+        let key = u32::from(*peer.ip()) ^ u32::from(peer.port()).rotate_left(16);
+        // fibonacci hashing; the top bits are the best mixed
+        let hash = key.wrapping_mul(0x9e37_79b9);
+        (hash >> (u32::BITS - NUM_PORT_HINTS.trailing_zeros())) as usize
+    }
+
     /// Associate the socket with any applicable network interfaces. The socket will be
     /// automatically disassociated when the returned handle is dropped.
     ///
@@ -347,12 +364,49 @@ impl std::ops::Drop for NetworkNamespace {
 
 struct InterfaceOptions {
     pub host_id: HostId,
-    pub hostname: Vec<NonZeroU8>,
-    pub ip: Ipv4Addr,
     pub pcap: Option<PcapOptions>,
     pub qdisc: QDiscMode,
 }
 
+/// The addresses of a host's network interfaces. These are registered with the DNS before the host
+/// is built so that every host's addresses can be registered in a fixed order, even if the hosts
+/// themselves are built in parallel.
+pub struct NamespaceAddresses {
+    localhost: SyncSendPointer<cshadow::Address>,
+    public: SyncSendPointer<cshadow::Address>,
+    public_ip: Ipv4Addr,
+}
+
+impl NamespaceAddresses {
+    /// Register the host's localhost and public addresses with the DNS. The addresses must be
+    /// passed to [`NetworkNamespace::new`], which takes ownership of them.
+    ///
+    /// # Safety
+    ///
+    /// `dns` must be a valid pointer.
+    pub unsafe fn register(
+        dns: *mut cshadow::DNS,
+        host_id: HostId,
+        hostname: &CStr,
+        public_ip: Ipv4Addr,
+    ) -> Self {
+        let register = |ip: Ipv4Addr| {
+            let addr = unsafe {
+                cshadow::dns_register(dns, host_id, hostname.as_ptr(), u32::from(ip).to_be())
+            };
+            assert!(!addr.is_null());
+            // the address isn't used by any other thread until the host is built
+            unsafe { SyncSendPointer::new(addr) }
+        };
+
+        Self {
+            localhost: register(Ipv4Addr::LOCALHOST),
+            public: register(public_ip),
+            public_ip,
+        }
+    }
+}
+
 #[derive(Copy, Clone, Debug, PartialEq, Eq)]
 pub struct NoInterface;
 
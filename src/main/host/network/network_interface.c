@@ -25,6 +25,33 @@
 #include "main/utility/priority_queue.h"
 #include "main/utility/utility.h"
 
+/* Identifies a (protocol,port,peer)-to-socket association. The address and ports are in
+ * network byte order. The local address is not part of the key since it is fixed for the
+ * interface. */
+typedef struct _AssociationKey {
+    in_addr_t peerIP;
+    in_port_t port;
+    in_port_t peerPort;
+    ProtocolType protocol;
+} AssociationKey;
+
+typedef struct _BoundSocketEntry {
+    AssociationKey key;
+    /* An owned reference to the socket, or NULL if the slot is empty. */
+    const InetSocket* socket;
+} BoundSocketEntry;
+
+/* An open-addressing (linear probing) hash table from association keys to sockets, so that
+ * the per-packet lookups don't need to allocate, format, or compare strings. */
+typedef struct _BoundSocketTable {
+    BoundSocketEntry* entries;
+    /* Always a power of two. */
+    gsize capacity;
+    gsize length;
+} BoundSocketTable;
+
+static const gsize BOUND_SOCKET_TABLE_INITIAL_CAPACITY = 16;
+
 struct _NetworkInterface {
     /* The queuing discipline used by this interface to schedule the
      * sending of packets from sockets. */
@@ -32,32 +59,170 @@ struct _NetworkInterface {
     /* The address associated with this interface */
     Address* address;
 
-    /* (protocol,port)-to-socket bindings. Stores pointers to InetSocket objects. */
-    GHashTable* boundSockets;
+    /* (protocol,port)-to-socket bindings. Stores owned references to InetSocket objects. */
+    BoundSocketTable boundSockets;
 
     /* Transports wanting to send data out. */
     RrSocketQueue rrQueue;
+    DrrSocketQueue drrQueue;
     FifoSocketQueue fifoQueue;
 
     /* To support capturing incoming and outgoing packets */
-    PcapWriter_BufWriter_File* pcap;
+    PcapWriter_BackgroundFileWriter* pcap;
+    /* Only capture the packet headers, so that the payloads don't need to be copied */
+    bool pcapHeadersOnly;
 
     MAGIC_DECLARE;
 };
 
 /* The address and ports must be in network byte order. */
-static gchar* _networkinterface_getAssociationKey(NetworkInterface* interface,
-        ProtocolType type, in_port_t port, in_addr_t peerAddr, in_port_t peerPort) {
-    MAGIC_ASSERT(interface);
+static inline AssociationKey _associationkey_new(ProtocolType type, in_port_t port,
+                                                 in_addr_t peerAddr, in_port_t peerPort) {
+    return (AssociationKey){
+        .peerIP = peerAddr, .port = port, .peerPort = peerPort, .protocol = type};
+}
+
+static inline bool _associationkey_equals(const AssociationKey* a, const AssociationKey* b) {
+    return a->peerIP == b->peerIP && a->port == b->port && a->peerPort == b->peerPort &&
+           a->protocol == b->protocol;
+}
+
+static inline guint64 _associationkey_hash(const AssociationKey* key) {
+    guint64 packed = ((guint64)key->peerIP << 32) | ((guint64)key->port << 16) | key->peerPort;
+    /* mix in the protocol and then use fibonacci hashing to spread the bits; the table takes
+     * the high bits */
+    packed ^= (guint64)key->protocol << 61;
+    return packed * UINT64_C(0x9E3779B97F4A7C15);
+}
+
+static inline gsize _boundsockettable_home(const BoundSocketTable* table,
+                                           const AssociationKey* key) {
+    /* capacity is a power of two, so this is the top log2(capacity) bits of the hash */
+    guint shift = 64 - g_bit_storage(table->capacity - 1);
+    return (gsize)(_associationkey_hash(key) >> shift) & (table->capacity - 1);
+}
+
+static void _boundsockettable_init(BoundSocketTable* table) {
+    table->capacity = BOUND_SOCKET_TABLE_INITIAL_CAPACITY;
+    table->entries = g_new0(BoundSocketEntry, table->capacity);
+    table->length = 0;
+}
+
+/* Returns the index of the slot holding `key`, or of the empty slot where it would be
+ * inserted. */
+static gsize _boundsockettable_probe(const BoundSocketTable* table, const AssociationKey* key) {
+    gsize mask = table->capacity - 1;
+    gsize i = _boundsockettable_home(table, key);
+    while (table->entries[i].socket != NULL &&
+           !_associationkey_equals(&table->entries[i].key, key)) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+static const InetSocket* _boundsockettable_lookup(const BoundSocketTable* table,
+                                                  const AssociationKey* key) {
+    return table->entries[_boundsockettable_probe(table, key)].socket;
+}
+
+static void _boundsockettable_grow(BoundSocketTable* table) {
+    BoundSocketEntry* oldEntries = table->entries;
+    gsize oldCapacity = table->capacity;
 
-    GString* strBuffer = g_string_new(NULL);
-    g_string_printf(strBuffer,
-            "%s|%"G_GUINT32_FORMAT":%"G_GUINT16_FORMAT"|%"G_GUINT32_FORMAT":%"G_GUINT16_FORMAT,
-            protocol_toString(type),
-            (guint)address_toNetworkIP(interface->address),
-            port, peerAddr, peerPort);
+    table->capacity = oldCapacity * 2;
+    table->entries = g_new0(BoundSocketEntry, table->capacity);
+
+    for (gsize i = 0; i < oldCapacity; i++) {
+        if (oldEntries[i].socket != NULL) {
+            gsize j = _boundsockettable_probe(table, &oldEntries[i].key);
+            table->entries[j] = oldEntries[i];
+        }
+    }
 
-    return g_string_free(strBuffer, FALSE);
+    g_free(oldEntries);
+}
+
+/* Takes ownership of the socket reference. Returns false if the key was already present, in
+ * which case the previous socket reference is dropped and replaced. */
+static bool _boundsockettable_insert(BoundSocketTable* table, const AssociationKey* key,
+                                     const InetSocket* socket) {
+    utility_debugAssert(socket != NULL);
+
+    /* keep the load factor at or below 1/2 so that probe sequences stay short */
+    if ((table->length + 1) * 2 > table->capacity) {
+        _boundsockettable_grow(table);
+    }
+
+    BoundSocketEntry* entry = &table->entries[_boundsockettable_probe(table, key)];
+
+    if (entry->socket != NULL) {
+        inetsocket_drop(entry->socket);
+        entry->socket = socket;
+        return false;
+    }
+
+    entry->key = *key;
+    entry->socket = socket;
+    table->length++;
+    return true;
+}
+
+/* Drops the socket reference for `key` if present. Returns false if the key was not present. */
+static bool _boundsockettable_remove(BoundSocketTable* table, const AssociationKey* key) {
+    gsize mask = table->capacity - 1;
+    gsize i = _boundsockettable_probe(table, key);
+
+    if (table->entries[i].socket == NULL) {
+        return false;
+    }
+
+    const InetSocket* socket = table->entries[i].socket;
+    table->entries[i].socket = NULL;
+    table->length--;
+
+    /* backward-shift deletion: move any later entries in this probe run that can't be reached
+     * from their home slot anymore, so that we never need tombstones */
+    gsize hole = i;
+    gsize j = (i + 1) & mask;
+    while (table->entries[j].socket != NULL) {
+        gsize home = _boundsockettable_home(table, &table->entries[j].key);
+        /* distance from the home slot to the current slot vs. to the hole */
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            table->entries[hole] = table->entries[j];
+            table->entries[j].socket = NULL;
+            hole = j;
+        }
+        j = (j + 1) & mask;
+    }
+
+    /* drop last, since dropping the socket may re-enter the interface */
+    inetsocket_drop(socket);
+    return true;
+}
+
+/* Drops all socket references, leaving the table empty but usable. */
+static void _boundsockettable_clear(BoundSocketTable* table) {
+    /* detach the entries first, since dropping a socket may re-enter the interface */
+    BoundSocketEntry* entries = table->entries;
+    gsize capacity = table->capacity;
+
+    table->entries = g_new0(BoundSocketEntry, capacity);
+    table->length = 0;
+
+    for (gsize i = 0; i < capacity; i++) {
+        if (entries[i].socket != NULL) {
+            inetsocket_drop(entries[i].socket);
+        }
+    }
+
+    g_free(entries);
+}
+
+static void _boundsockettable_destroy(BoundSocketTable* table) {
+    _boundsockettable_clear(table);
+    g_free(table->entries);
+    table->entries = NULL;
+    table->capacity = 0;
 }
 
 /* The address and ports must be in network byte order. */
@@ -65,13 +230,8 @@ gboolean networkinterface_isAssociated(NetworkInterface* interface, ProtocolType
                                        in_port_t port, in_addr_t peerAddr, in_port_t peerPort) {
     MAGIC_ASSERT(interface);
 
-    gboolean isFound = FALSE;
-
-    gchar* key = _networkinterface_getAssociationKey(interface, type, port, peerAddr, peerPort);
-    isFound = g_hash_table_contains(interface->boundSockets, key);
-    g_free(key);
-
-    return isFound;
+    AssociationKey key = _associationkey_new(type, port, peerAddr, peerPort);
+    return _boundsockettable_lookup(&interface->boundSockets, &key) != NULL;
 }
 
 void networkinterface_associate(NetworkInterface* interface, const InetSocket* socket,
@@ -79,28 +239,28 @@ void networkinterface_associate(NetworkInterface* interface, const InetSocket* s
                                 in_port_t peerPort) {
     MAGIC_ASSERT(interface);
 
-    gchar* key = _networkinterface_getAssociationKey(interface, type, port, peerIP, peerPort);
+    AssociationKey key = _associationkey_new(type, port, peerIP, peerPort);
 
     /* make sure there is no collision */
-    utility_debugAssert(!g_hash_table_contains(interface->boundSockets, key));
+    utility_debugAssert(_boundsockettable_lookup(&interface->boundSockets, &key) == NULL);
 
     /* need to store our own reference to the socket object */
     const InetSocket* newSocketRef = inetsocket_cloneRef(socket);
 
-    /* insert to our storage, key is now owned by table */
-    bool key_did_not_exist =
-        g_hash_table_replace(interface->boundSockets, key, (void*)newSocketRef);
+    /* insert to our storage, reference is now owned by table */
+    bool key_did_not_exist = _boundsockettable_insert(&interface->boundSockets, &key, newSocketRef);
 
     utility_debugAssert(key_did_not_exist);
 
-    trace("associated socket key %s", key);
+    trace("associated socket key %s|%" G_GUINT16_FORMAT "|%" G_GUINT32_FORMAT ":%" G_GUINT16_FORMAT,
+          protocol_toString(type), port, peerIP, peerPort);
 }
 
 void networkinterface_disassociate(NetworkInterface* interface, ProtocolType type, in_port_t port,
                                    in_addr_t peerIP, in_port_t peerPort) {
     MAGIC_ASSERT(interface);
 
-    gchar* key = _networkinterface_getAssociationKey(interface, type, port, peerIP, peerPort);
+    AssociationKey key = _associationkey_new(type, port, peerIP, peerPort);
 
     /* we will no longer receive packets for this port, this unrefs descriptor */
     /* TODO: Return an error if the disassociation fails. Generally the
@@ -110,10 +270,11 @@ void networkinterface_disassociate(NetworkInterface* interface, ProtocolType typ
      * (including ones that have never been associated) and will try to
      * disassociate the same socket multiple times, so we can't just add an assert
      * here. */
-    g_hash_table_remove(interface->boundSockets, key);
+    _boundsockettable_remove(&interface->boundSockets, &key);
 
-    trace("disassociated socket key %s", key);
-    g_free(key);
+    trace("disassociated socket key %s|%" G_GUINT16_FORMAT "|%" G_GUINT32_FORMAT
+          ":%" G_GUINT16_FORMAT,
+          protocol_toString(type), port, peerIP, peerPort);
 }
 
 static void _networkinterface_capturePacket(NetworkInterface* interface, Packet* packet) {
@@ -124,7 +285,9 @@ static void _networkinterface_capturePacket(NetworkInterface* interface, Packet*
     guint32 ts_sec = now / SIMTIME_ONE_SECOND;
     guint32 ts_usec = (now % SIMTIME_ONE_SECOND) / SIMTIME_ONE_MICROSECOND;
 
-    int error = pcapwriter_writePacket(interface->pcap, ts_sec, ts_usec, packet);
+    int error = interface->pcapHeadersOnly
+                    ? pcapwriter_writePacketHeaders(interface->pcap, ts_sec, ts_usec, packet)
+                    : pcapwriter_writePacket(interface->pcap, ts_sec, ts_usec, packet);
     if (error) {
         /* if there was a non-recoverable error */
         warning("Fatal pcap logging error; stopping pcap logging for current interface");
@@ -133,71 +296,118 @@ static void _networkinterface_capturePacket(NetworkInterface* interface, Packet*
     }
 }
 
-static const InetSocket* _boundsockets_lookup(GHashTable* table, gchar* key) {
-    return g_hash_table_lookup(table, key);
-}
-
-void networkinterface_push(NetworkInterface* interface, Packet* packet, CEmulatedTime recvTime) {
-    MAGIC_ASSERT(interface);
-
-    const Host* host = worker_getCurrentHost();
-
-    /* get the next packet */
-    utility_debugAssert(packet);
-
-    /* successfully received */
-    packet_addDeliveryStatus(packet, PDS_RCV_INTERFACE_RECEIVED);
-
-    /* hand it off to the correct socket layer */
+/* Returns the key of the specific association that the packet is addressed to. */
+static AssociationKey _networkinterface_getPacketKey(Packet* packet) {
     ProtocolType ptype = packet_getProtocol(packet);
     in_port_t bindPort = packet_getDestinationPort(packet);
     in_addr_t peerIP = packet_getSourceIP(packet);
     in_port_t peerPort = packet_getSourcePort(packet);
 
-    /* first check for a socket with the specific association */
-    gchar* key = _networkinterface_getAssociationKey(interface, ptype, bindPort, peerIP, peerPort);
-    trace("looking for socket associated with specific key %s", key);
+    return _associationkey_new(ptype, bindPort, peerIP, peerPort);
+}
+
+/* Marks the packets as received by the interface, and records them before we process them,
+ * otherwise we may send more packets before we record these ones and the order will be
+ * incorrect. */
+static void _networkinterface_receivePackets(NetworkInterface* interface, Packet* const* packets,
+                                             size_t numPackets) {
+    for (size_t i = 0; i < numPackets; i++) {
+        /* successfully received */
+        packet_addDeliveryStatus(packets[i], PDS_RCV_INTERFACE_RECEIVED);
+
+        if (interface->pcap) {
+            _networkinterface_capturePacket(interface, packets[i]);
+        }
+    }
+}
 
-    const InetSocket* socket = _boundsockets_lookup(interface->boundSockets, key);
-    g_free(key);
+/* Hands off packets that are all addressed to the association `key` to the socket layer, and
+ * returns how many of them were handled. The socket may stop accepting them early if handling one
+ * may have changed our associations, in which case the rest need to be looked up again. */
+static size_t _networkinterface_pushToSocket(NetworkInterface* interface,
+                                             const AssociationKey* key, Packet* const* packets,
+                                             size_t numPackets, CEmulatedTime recvTime) {
+    const Host* host = worker_getCurrentHost();
+
+    /* first check for a socket with the specific association */
+    const InetSocket* socket = _boundsockettable_lookup(&interface->boundSockets, key);
 
     if (socket == NULL) {
         /* then check for a socket with a wildcard association */
-        key = _networkinterface_getAssociationKey(interface, ptype, bindPort, 0, 0);
-        trace("looking for socket associated with general key %s", key);
-        socket = _boundsockets_lookup(interface->boundSockets, key);
-        g_free(key);
+        AssociationKey wildcardKey = _associationkey_new(key->protocol, key->port, 0, 0);
+        socket = _boundsockettable_lookup(&interface->boundSockets, &wildcardKey);
     }
 
-    /* record the packet before we process it, otherwise we may send more packets before we
-       record this one and the order will be incorrect */
-    if (interface->pcap) {
-        _networkinterface_capturePacket(interface, packet);
+    /* if the socket closed, just drop the packets */
+    if (socket == NULL) {
+        for (size_t i = 0; i < numPackets; i++) {
+            packet_addDeliveryStatus(packets[i], PDS_RCV_INTERFACE_DROPPED);
+        }
+        return numPackets;
     }
 
     /* pushing a packet to the socket may cause the socket to be disassociated and freed and cause
      * our socket pointer to become dangling while we're using it, so we need to increase its ref
      * count */
-    if (socket != NULL) {
-        socket = inetsocket_cloneRef(socket);
-    }
+    socket = inetsocket_cloneRef(socket);
 
-    /* if the socket closed, just drop the packet */
-    if (socket != NULL) {
-        inetsocket_pushInPacket(socket, packet, recvTime);
+    size_t numPushed = 1;
+    if (numPackets == 1) {
+        inetsocket_pushInPacket(socket, packets[0], recvTime);
     } else {
-        packet_addDeliveryStatus(packet, PDS_RCV_INTERFACE_DROPPED);
+        numPushed = inetsocket_pushInPackets(socket, packets, numPackets, recvTime);
+        utility_debugAssert(numPushed >= 1 && numPushed <= numPackets);
     }
 
     /* count our bandwidth usage by interface, and by socket if possible */
     Tracker* tracker = host_getTracker(host);
-    if (tracker != NULL && socket != NULL) {
+    if (tracker != NULL) {
         CompatSocket compatSocket = compatsocket_fromInetSocket(socket);
-        tracker_addInputBytes(tracker, packet, &compatSocket);
+        for (size_t i = 0; i < numPushed; i++) {
+            tracker_addInputBytes(tracker, packets[i], &compatSocket);
+        }
     }
 
-    if (socket != NULL) {
-        inetsocket_drop(socket);
+    inetsocket_drop(socket);
+
+    return numPushed;
+}
+
+void networkinterface_push(NetworkInterface* interface, Packet* packet, CEmulatedTime recvTime) {
+    MAGIC_ASSERT(interface);
+
+    /* get the next packet */
+    utility_debugAssert(packet);
+
+    _networkinterface_receivePackets(interface, &packet, 1);
+
+    /* hand it off to the correct socket layer */
+    AssociationKey key = _networkinterface_getPacketKey(packet);
+    _networkinterface_pushToSocket(interface, &key, &packet, 1, recvTime);
+}
+
+void networkinterface_pushBatch(NetworkInterface* interface, Packet* const* packets,
+                                size_t numPackets, CEmulatedTime recvTime) {
+    MAGIC_ASSERT(interface);
+    utility_debugAssert(packets || numPackets == 0);
+
+    _networkinterface_receivePackets(interface, packets, numPackets);
+
+    size_t start = 0;
+    while (start < numPackets) {
+        /* consecutive packets for the same association are handed off to the socket together */
+        AssociationKey key = _networkinterface_getPacketKey(packets[start]);
+        size_t end = start + 1;
+        while (end < numPackets) {
+            AssociationKey nextKey = _networkinterface_getPacketKey(packets[end]);
+            if (!_associationkey_equals(&key, &nextKey)) {
+                break;
+            }
+            end++;
+        }
+
+        start +=
+            _networkinterface_pushToSocket(interface, &key, &packets[start], end - start, recvTime);
     }
 }
 
@@ -293,6 +503,48 @@ static Packet* _networkinterface_selectFirstInFirstOut(NetworkInterface* interfa
     return NULL;
 }
 
+/* The number of bytes a socket may send each round with the deficit round robin queuing
+ * discipline. Higher priority sockets get a larger share of the interface. */
+static gsize _networkinterface_getQuantum(const InetSocket* socket) {
+    return CONFIG_MTU * (1 + (gsize)inetsocket_getSendPriority(socket));
+}
+
+/* deficit round robin queuing discipline ($ man tc-drr)*/
+static Packet* _networkinterface_selectDeficitRoundRobin(NetworkInterface* interface,
+                                                         const InetSocket** socketOut) {
+    while (!drrsocketqueue_isEmpty(&interface->drrQueue)) {
+        /* the queue keeps its reference while the socket is at the front, so that the socket is
+         * still found in the queue if `inetsocket_pullOutPacket` wants to send again */
+        const InetSocket* socket = drrsocketqueue_peek(&interface->drrQueue);
+        Packet* packet = inetsocket_pullOutPacket(socket);
+
+        if (packet == NULL || !inetsocket_hasDataToSend(socket)) {
+            /* socket has no more packets, unref it from the sendable queue; sockets that send
+             * again later start a new round */
+            InetSocket* popped = NULL;
+            drrsocketqueue_pop(&interface->drrQueue, &popped);
+            utility_debugAssert(popped == socket);
+
+            if (packet == NULL) {
+                inetsocket_drop(popped);
+                continue;
+            }
+
+            /* we're returning the socket, so we pass on the queue's reference */
+            *socketOut = popped;
+            return packet;
+        }
+
+        drrsocketqueue_charge(&interface->drrQueue, packet_getTotalSize(packet));
+
+        /* we're returning the socket, so we must ref it */
+        *socketOut = inetsocket_cloneRef(socket);
+        return packet;
+    }
+
+    return NULL;
+}
+
 static Packet* _networkinterface_pop_next_packet_out(NetworkInterface* interface,
                                                      const InetSocket** socketOut) {
     MAGIC_ASSERT(interface);
@@ -300,6 +552,9 @@ static Packet* _networkinterface_pop_next_packet_out(NetworkInterface* interface
         case Q_DISC_MODE_ROUND_ROBIN: {
             return _networkinterface_selectRoundRobin(interface, socketOut);
         }
+        case Q_DISC_MODE_DEFICIT_ROUND_ROBIN: {
+            return _networkinterface_selectDeficitRoundRobin(interface, socketOut);
+        }
         case Q_DISC_MODE_FIFO:
         default: {
             return _networkinterface_selectFirstInFirstOut(interface, socketOut);
@@ -358,6 +613,14 @@ void networkinterface_wantsSend(NetworkInterface* interface, const InetSocket* s
             }
             break;
         }
+        case Q_DISC_MODE_DEFICIT_ROUND_ROBIN: {
+            if (!drrsocketqueue_find(&interface->drrQueue, socket)) {
+                const InetSocket* newSocketRef = inetsocket_cloneRef(socket);
+                drrsocketqueue_push(
+                    &interface->drrQueue, newSocketRef, _networkinterface_getQuantum(socket));
+            }
+            break;
+        }
         case Q_DISC_MODE_FIFO:
         default: {
             if (!fifosocketqueue_find(&interface->fifoQueue, socket)) {
@@ -373,16 +636,29 @@ void networkinterface_removeAllSockets(NetworkInterface* interface) {
     /* we want to unref all sockets, but also want to keep the network interface in a valid state */
 
     rrsocketqueue_destroy(&interface->rrQueue, inetsocket_drop);
+    drrsocketqueue_destroy(&interface->drrQueue, inetsocket_drop);
     fifosocketqueue_destroy(&interface->fifoQueue, inetsocket_drop);
 
     rrsocketqueue_init(&interface->rrQueue);
+    drrsocketqueue_init(&interface->drrQueue);
     fifosocketqueue_init(&interface->fifoQueue);
 
-    g_hash_table_remove_all(interface->boundSockets);
+    _boundsockettable_clear(&interface->boundSockets);
+}
+
+static const char* _networkinterface_qdiscName(QDiscMode qdisc) {
+    switch (qdisc) {
+        case Q_DISC_MODE_ROUND_ROBIN: return "rr";
+        case Q_DISC_MODE_DEFICIT_ROUND_ROBIN: return "drr";
+        case Q_DISC_MODE_FIFO:
+        default: return "fifo";
+    }
 }
 
 NetworkInterface* networkinterface_new(Address* address, const char* name, const gchar* pcapDir,
-                                       guint32 pcapCaptureSize, QDiscMode qdisc) {
+                                       guint32 pcapCaptureSize, bool pcapHeadersOnly,
+                                       bool pcapMerged,
+                                       QDiscMode qdisc) {
     NetworkInterface* interface = g_new0(NetworkInterface, 1);
     MAGIC_INIT(interface);
 
@@ -390,17 +666,23 @@ NetworkInterface* networkinterface_new(Address* address, const char* name, const
     address_ref(interface->address);
 
     /* incoming packets get passed along to sockets */
-    interface->boundSockets =
-        g_hash_table_new_full(g_str_hash, g_str_equal, g_free, inetsocket_dropVoid);
+    _boundsockettable_init(&interface->boundSockets);
 
     /* sockets tell us when they want to start sending */
     rrsocketqueue_init(&interface->rrQueue);
+    drrsocketqueue_init(&interface->drrQueue);
     fifosocketqueue_init(&interface->fifoQueue);
 
     /* parse queuing discipline */
     interface->qdisc = qdisc;
 
-    if (pcapDir != NULL) {
+    if (pcapDir != NULL && pcapMerged) {
+        /* the capture size was set when the merged file was created */
+        gchar* pcapName = g_strdup_printf("%s:%s", address_toHostName(address), name);
+        interface->pcap = pcapwriter_newMerged(pcapName);
+        interface->pcapHeadersOnly = pcapHeadersOnly;
+        g_free(pcapName);
+    } else if (pcapDir != NULL) {
         GString* filename = g_string_new(NULL);
         g_string_append(filename, pcapDir);
 
@@ -412,14 +694,15 @@ NetworkInterface* networkinterface_new(Address* address, const char* name, const
         g_string_append_printf(filename, "%s.pcap", name);
 
         interface->pcap = pcapwriter_new(filename->str, pcapCaptureSize);
+        interface->pcapHeadersOnly = pcapHeadersOnly;
         g_string_free(filename, TRUE);
     }
 
     debug("bringing up network interface '%s' for host '%s' at '%s' using queuing discipline %s",
           name, address_toHostName(interface->address), address_toHostIPString(interface->address),
-          interface->qdisc == Q_DISC_MODE_ROUND_ROBIN ? "rr" : "fifo");
+          _networkinterface_qdiscName(interface->qdisc));
 
-    worker_count_allocation(NetworkInterface);
+    worker_count_allocation(NETWORK_INTERFACE);
     return interface;
 }
 
@@ -428,9 +711,10 @@ void networkinterface_free(NetworkInterface* interface) {
 
     /* unref all sockets wanting to send */
     rrsocketqueue_destroy(&interface->rrQueue, inetsocket_drop);
+    drrsocketqueue_destroy(&interface->drrQueue, inetsocket_drop);
     fifosocketqueue_destroy(&interface->fifoQueue, inetsocket_drop);
 
-    g_hash_table_destroy(interface->boundSockets);
+    _boundsockettable_destroy(&interface->boundSockets);
 
     address_unref(interface->address);
 
@@ -441,5 +725,5 @@ void networkinterface_free(NetworkInterface* interface) {
     MAGIC_CLEAR(interface);
     g_free(interface);
 
-    worker_count_deallocation(NetworkInterface);
+    worker_count_deallocation(NETWORK_INTERFACE);
 }
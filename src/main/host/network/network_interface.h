@@ -9,6 +9,7 @@
 
 #include <glib.h>
 #include <netinet/in.h>
+#include <stddef.h>
 
 typedef struct _NetworkInterface NetworkInterface;
 
@@ -20,7 +21,9 @@ typedef struct _NetworkInterface NetworkInterface;
 #include "main/routing/packet.minimal.h"
 
 NetworkInterface* networkinterface_new(Address* address, const char* name, const gchar* pcapDir,
-                                       guint32 pcapCaptureSize, QDiscMode qdisc);
+                                       guint32 pcapCaptureSize, bool pcapHeadersOnly,
+                                       bool pcapMerged,
+                                       QDiscMode qdisc);
 void networkinterface_free(NetworkInterface* interface);
 
 /* The address and ports must be in network byte order. */
@@ -37,6 +40,10 @@ void networkinterface_wantsSend(NetworkInterface* interface, const InetSocket* s
 
 Packet* networkinterface_pop(NetworkInterface* interface);
 void networkinterface_push(NetworkInterface* interface, Packet* packet, CEmulatedTime recvTime);
+/* Like `networkinterface_push` for each packet, but consecutive packets for the same socket are
+ * handed off to it together. */
+void networkinterface_pushBatch(NetworkInterface* interface, Packet* const* packets,
+                                size_t numPackets, CEmulatedTime recvTime);
 
 /* Disassociate all bound sockets and remove sockets from the sending queue. */
 void networkinterface_removeAllSockets(NetworkInterface* interface);
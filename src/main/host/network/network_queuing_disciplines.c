@@ -9,25 +9,30 @@
 #include <stdbool.h>
 
 #include "main/bindings/c/bindings.h"
+#include "main/core/definitions.h"
 #include "main/host/descriptor/compat_socket.h"
 #include "main/routing/packet.h"
 #include "main/utility/priority_queue.h"
 #include "main/utility/utility.h"
 
-// returns 0 if `a` and `b` represent the same object, otherwise returns 1
-static gint _compareInetSocket(gconstpointer a, gconstpointer b) {
-    return inetsocket_eqVoid(a, b) == false;
-}
+// casts the return value from a bool to an int
+static int _inetsocket_eqVoid(gconstpointer a, gconstpointer b) { return inetsocket_eqVoid(a, b); }
+
+static const gsize RR_INITIAL_CAPACITY = 16;
 
 void rrsocketqueue_init(RrSocketQueue* self) {
     utility_debugAssert(self != NULL);
-    utility_debugAssert(self->queue == NULL);
-    self->queue = g_queue_new();
+    utility_debugAssert(self->ring == NULL);
+    self->ring = g_new(const InetSocket*, RR_INITIAL_CAPACITY);
+    self->capacity = RR_INITIAL_CAPACITY;
+    self->head = 0;
+    self->len = 0;
+    self->members = g_hash_table_new(inetsocket_hashVoid, _inetsocket_eqVoid);
 }
 
 void rrsocketqueue_destroy(RrSocketQueue* self, void (*fn_processItem)(const InetSocket*)) {
     utility_debugAssert(self != NULL);
-    utility_debugAssert(self->queue != NULL);
+    utility_debugAssert(self->ring != NULL);
 
     if (fn_processItem != NULL) {
         while (!rrsocketqueue_isEmpty(self)) {
@@ -43,40 +48,192 @@ void rrsocketqueue_destroy(RrSocketQueue* self, void (*fn_processItem)(const Ine
         }
     }
 
-    g_queue_free(self->queue);
-    self->queue = NULL;
+    g_hash_table_destroy(self->members);
+    self->members = NULL;
+    g_free(self->ring);
+    self->ring = NULL;
 }
 
 bool rrsocketqueue_isEmpty(RrSocketQueue* self) {
     utility_debugAssert(self != NULL);
-    utility_debugAssert(self->queue != NULL);
-    return g_queue_is_empty(self->queue);
+    utility_debugAssert(self->ring != NULL);
+    return self->len == 0;
 }
 
 bool rrsocketqueue_pop(RrSocketQueue* self, InetSocket** socket) {
     utility_debugAssert(self != NULL);
-    utility_debugAssert(self->queue != NULL);
-
-    *socket = g_queue_pop_head(self->queue);
+    utility_debugAssert(self->ring != NULL);
 
-    if (*socket == NULL) {
+    if (self->len == 0) {
+        *socket = NULL;
         return false;
     }
 
+    *socket = (InetSocket*)self->ring[self->head];
+    self->head = (self->head + 1) % self->capacity;
+    self->len--;
+
+    gboolean removed = g_hash_table_remove(self->members, *socket);
+    utility_debugAssert(removed);
+
     return true;
 }
 
 void rrsocketqueue_push(RrSocketQueue* self, const InetSocket* socket) {
     utility_debugAssert(self != NULL);
-    utility_debugAssert(self->queue != NULL);
+    utility_debugAssert(self->ring != NULL);
     utility_debugAssert(socket != NULL);
-    g_queue_push_tail(self->queue, (void*)socket);
+
+    if (self->len == self->capacity) {
+        // grow the ring, moving the sockets to the start of the new buffer
+        gsize newCapacity = self->capacity * 2;
+        const InetSocket** newRing = g_new(const InetSocket*, newCapacity);
+        for (gsize i = 0; i < self->len; i++) {
+            newRing[i] = self->ring[(self->head + i) % self->capacity];
+        }
+        g_free(self->ring);
+        self->ring = newRing;
+        self->capacity = newCapacity;
+        self->head = 0;
+    }
+
+    self->ring[(self->head + self->len) % self->capacity] = socket;
+    self->len++;
+
+    gboolean added = g_hash_table_add(self->members, (void*)socket);
+    // if this returned FALSE, it would mean that the socket was already in the queue
+    utility_debugAssert(added);
 }
 
 bool rrsocketqueue_find(RrSocketQueue* self, const InetSocket* socket) {
     utility_debugAssert(self != NULL);
-    utility_debugAssert(self->queue != NULL);
-    return g_queue_find_custom(self->queue, (void*)socket, _compareInetSocket);
+    utility_debugAssert(self->ring != NULL);
+    return g_hash_table_contains(self->members, socket);
+}
+
+void drrsocketqueue_init(DrrSocketQueue* self) {
+    utility_debugAssert(self != NULL);
+    utility_debugAssert(self->ring == NULL);
+    self->ring = g_new(DrrSocketEntry, RR_INITIAL_CAPACITY);
+    self->capacity = RR_INITIAL_CAPACITY;
+    self->head = 0;
+    self->len = 0;
+    self->members = g_hash_table_new(inetsocket_hashVoid, _inetsocket_eqVoid);
+}
+
+void drrsocketqueue_destroy(DrrSocketQueue* self, void (*fn_processItem)(const InetSocket*)) {
+    utility_debugAssert(self != NULL);
+    utility_debugAssert(self->ring != NULL);
+
+    if (fn_processItem != NULL) {
+        while (!drrsocketqueue_isEmpty(self)) {
+            InetSocket* socket = NULL;
+            bool found = drrsocketqueue_pop(self, &socket);
+
+            utility_debugAssert(found);
+            if (!found) {
+                continue;
+            }
+
+            fn_processItem(socket);
+        }
+    }
+
+    g_hash_table_destroy(self->members);
+    self->members = NULL;
+    g_free(self->ring);
+    self->ring = NULL;
+}
+
+bool drrsocketqueue_isEmpty(DrrSocketQueue* self) {
+    utility_debugAssert(self != NULL);
+    utility_debugAssert(self->ring != NULL);
+    return self->len == 0;
+}
+
+const InetSocket* drrsocketqueue_peek(DrrSocketQueue* self) {
+    utility_debugAssert(self != NULL);
+    utility_debugAssert(self->ring != NULL);
+
+    if (self->len == 0) {
+        return NULL;
+    }
+
+    // move sockets that used up their deficit to the back of the queue for the next round; each
+    // move adds a quantum of at least one MTU, so this usually stops at the next socket
+    DrrSocketEntry* front = &self->ring[self->head];
+    while (front->deficit <= 0) {
+        DrrSocketEntry entry = *front;
+        entry.deficit += entry.quantum;
+
+        self->head = (self->head + 1) % self->capacity;
+        self->ring[(self->head + self->len - 1) % self->capacity] = entry;
+
+        front = &self->ring[self->head];
+    }
+
+    return front->socket;
+}
+
+void drrsocketqueue_charge(DrrSocketQueue* self, gsize bytes) {
+    utility_debugAssert(self != NULL);
+    utility_debugAssert(self->ring != NULL);
+    utility_debugAssert(self->len > 0);
+    self->ring[self->head].deficit -= (gint64)bytes;
+}
+
+bool drrsocketqueue_pop(DrrSocketQueue* self, InetSocket** socket) {
+    utility_debugAssert(self != NULL);
+    utility_debugAssert(self->ring != NULL);
+
+    if (self->len == 0) {
+        *socket = NULL;
+        return false;
+    }
+
+    *socket = (InetSocket*)self->ring[self->head].socket;
+    self->head = (self->head + 1) % self->capacity;
+    self->len--;
+
+    gboolean removed = g_hash_table_remove(self->members, *socket);
+    utility_debugAssert(removed);
+
+    return true;
+}
+
+void drrsocketqueue_push(DrrSocketQueue* self, const InetSocket* socket, gsize quantum) {
+    utility_debugAssert(self != NULL);
+    utility_debugAssert(self->ring != NULL);
+    utility_debugAssert(socket != NULL);
+    utility_debugAssert(quantum >= CONFIG_MTU);
+
+    if (self->len == self->capacity) {
+        // grow the ring, moving the sockets to the start of the new buffer
+        gsize newCapacity = self->capacity * 2;
+        DrrSocketEntry* newRing = g_new(DrrSocketEntry, newCapacity);
+        for (gsize i = 0; i < self->len; i++) {
+            newRing[i] = self->ring[(self->head + i) % self->capacity];
+        }
+        g_free(self->ring);
+        self->ring = newRing;
+        self->capacity = newCapacity;
+        self->head = 0;
+    }
+
+    // a newly active socket starts with a full quantum
+    self->ring[(self->head + self->len) % self->capacity] = (DrrSocketEntry){
+        .socket = socket, .quantum = (gint64)quantum, .deficit = (gint64)quantum};
+    self->len++;
+
+    gboolean added = g_hash_table_add(self->members, (void*)socket);
+    // if this returned FALSE, it would mean that the socket was already in the queue
+    utility_debugAssert(added);
+}
+
+bool drrsocketqueue_find(DrrSocketQueue* self, const InetSocket* socket) {
+    utility_debugAssert(self != NULL);
+    utility_debugAssert(self->ring != NULL);
+    return g_hash_table_contains(self->members, socket);
 }
 
 static gint _compareSocket(const InetSocket* sa, const InetSocket* sb) {
@@ -93,9 +250,6 @@ static gint _compareSocket(const InetSocket* sa, const InetSocket* sb) {
     return pa > pb ? +1 : -1;
 }
 
-// casts the return value from a bool to an int
-static int _inetsocket_eqVoid(gconstpointer a, gconstpointer b) { return inetsocket_eqVoid(a, b); }
-
 void fifosocketqueue_init(FifoSocketQueue* self) {
     utility_debugAssert(self != NULL);
     utility_debugAssert(self->queue == NULL);
@@ -15,7 +15,36 @@
 /* A round-robin socket queue. */
 typedef struct _RrSocketQueue RrSocketQueue;
 struct _RrSocketQueue {
-    GQueue* queue;
+    /* a ring buffer of the queued sockets, starting at `head` */
+    const InetSocket** ring;
+    gsize capacity;
+    gsize head;
+    gsize len;
+    /* the queued sockets, so that they can be found without scanning the ring */
+    GHashTable* members;
+};
+
+/* A queued socket and its deficit round robin state. */
+typedef struct _DrrSocketEntry DrrSocketEntry;
+struct _DrrSocketEntry {
+    const InetSocket* socket;
+    /* the number of bytes the socket may add to each round */
+    gint64 quantum;
+    /* the number of bytes the socket may still send in the current round */
+    gint64 deficit;
+};
+
+/* A deficit round robin socket queue. The socket at the front of the queue is served until it
+ * has used up its deficit, and then moves to the back of the queue. */
+typedef struct _DrrSocketQueue DrrSocketQueue;
+struct _DrrSocketQueue {
+    /* a ring buffer of the queued sockets, starting at `head` */
+    DrrSocketEntry* ring;
+    gsize capacity;
+    gsize head;
+    gsize len;
+    /* the queued sockets, so that they can be found without scanning the ring */
+    GHashTable* members;
 };
 
 /* A first-in-first-out socket queue. */
@@ -32,6 +61,19 @@ bool rrsocketqueue_pop(RrSocketQueue* self, InetSocket** socket);
 void rrsocketqueue_push(RrSocketQueue* self, const InetSocket* socket);
 bool rrsocketqueue_find(RrSocketQueue* self, const InetSocket* socket);
 
+void drrsocketqueue_init(DrrSocketQueue* self);
+void drrsocketqueue_destroy(DrrSocketQueue* self, void (*fn_processItem)(const InetSocket*));
+
+bool drrsocketqueue_isEmpty(DrrSocketQueue* self);
+/* Returns the socket that should send next without removing it from the queue, or NULL if the
+ * queue is empty. The queue keeps its reference to the socket. */
+const InetSocket* drrsocketqueue_peek(DrrSocketQueue* self);
+/* Charges `bytes` to the deficit of the socket at the front of the queue. */
+void drrsocketqueue_charge(DrrSocketQueue* self, gsize bytes);
+bool drrsocketqueue_pop(DrrSocketQueue* self, InetSocket** socket);
+void drrsocketqueue_push(DrrSocketQueue* self, const InetSocket* socket, gsize quantum);
+bool drrsocketqueue_find(DrrSocketQueue* self, const InetSocket* socket);
+
 void fifosocketqueue_init(FifoSocketQueue* self);
 void fifosocketqueue_destroy(FifoSocketQueue* self, void (*fn_processItem)(const InetSocket*));
 
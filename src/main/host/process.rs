@@ -4,6 +4,7 @@ use std::cell::{Cell, Ref, RefCell, RefMut};
 use std::collections::BTreeMap;
 use std::ffi::{c_char, c_void, CStr, CString};
 use std::fmt::Write;
+use std::hash::{Hash, Hasher};
 use std::num::TryFromIntError;
 use std::ops::{Deref, DerefMut};
 use std::os::fd::AsRawFd;
@@ -22,7 +23,7 @@ use linux_api::signal::{
     SignalFromI32Error,
 };
 use log::{debug, trace, warn};
-use rustix::process::{WaitOptions, WaitStatus};
+use rustix::process::WaitOptions;
 use shadow_shim_helper_rs::explicit_drop::{ExplicitDrop, ExplicitDropper};
 use shadow_shim_helper_rs::rootedcell::rc::RootedRc;
 use shadow_shim_helper_rs::rootedcell::refcell::RootedRefCell;
@@ -38,6 +39,7 @@ use super::descriptor::listener::StateEventSource;
 use super::descriptor::{FileSignals, FileState};
 use super::host::Host;
 use super::memory_manager::{MemoryManager, ProcessMemoryRef, ProcessMemoryRefMut};
+use super::syscall::binary_strace::BinaryStraceWriter;
 use super::syscall::formatter::StraceFmtMode;
 use super::syscall::types::ForeignArrayPtr;
 use super::thread::{Thread, ThreadId};
@@ -48,11 +50,12 @@ use crate::core::worker::Worker;
 use crate::cshadow;
 use crate::host::context::ProcessContext;
 use crate::host::descriptor::Descriptor;
-use crate::host::managed_thread::ManagedThread;
-use crate::host::syscall::formatter::FmtOptions;
+use crate::host::managed_thread::{ManagedThread, PendingManagedThread};
+use crate::host::syscall::formatter::{FmtOptions, StraceOptions};
 use crate::utility::callback_queue::CallbackQueue;
 #[cfg(feature = "perf_timers")]
 use crate::utility::perf_timer::PerfTimer;
+use crate::utility::proc_maps;
 use crate::utility::{self, debug_assert_cloexec};
 
 /// Virtual pid of a shadow process
@@ -131,9 +134,24 @@ pub enum ExitStatus {
 }
 
 #[derive(Debug)]
-struct StraceLogging {
-    file: RootedRefCell<std::fs::File>,
-    options: FmtOptions,
+enum StraceLogging {
+    /// Syscalls are formatted as text. The shim also writes to this file.
+    Text {
+        file: RootedRefCell<std::fs::File>,
+        options: FmtOptions,
+    },
+    /// Syscalls are written as binary records, which only shadow writes.
+    Binary(RootedRefCell<BinaryStraceWriter>),
+}
+
+impl StraceLogging {
+    /// The file that the shim writes its strace logs to, if any.
+    fn text_file(&self) -> Option<&RootedRefCell<std::fs::File>> {
+        match self {
+            Self::Text { file, .. } => Some(file),
+            Self::Binary(_) => None,
+        }
+    }
 }
 
 /// Parts of the process that are present in all states.
@@ -172,41 +190,50 @@ impl Common {
     }
 
     fn physical_address(&self, vptr: ForeignPtr<()>) -> ManagedPhysicalMemoryAddr {
-        // We currently don't keep a true system-wide virtual <-> physical address
-        // mapping. Instead we simply assume that no shadow processes map the same
-        // underlying physical memory, and that therefore (pid, virtual address)
-        // uniquely defines a physical address.
-        //
-        // If we ever want to support futexes in memory shared between processes,
-        // we'll need to change this.  The most foolproof way to do so is probably
-        // to change ManagedPhysicalMemoryAddr to be a bigger struct that identifies where
-        // the mapped region came from (e.g. what file), and the offset into that
-        // region. Such "fat" physical pointers might make memory management a
-        // little more cumbersome though, e.g. when using them as keys in the futex
-        // table.
-        //
-        // Alternatively we could hash the region+offset to a 64-bit value, but
-        // then we'd need to deal with potential collisions. On average we'd expect
-        // a collision after 2**32 physical addresses; i.e. they *probably*
-        // wouldn't happen in practice for realistic simulations.
-
-        // Linux uses the bottom 48-bits for user-space virtual addresses, giving
-        // us 16 bits for the pid.
-        const PADDR_BITS: i32 = 64;
-        const VADDR_BITS: i32 = 48;
-        const PID_BITS: i32 = 16;
-        assert_eq!(PADDR_BITS, PID_BITS + VADDR_BITS);
-
-        let high_part: u64 = u64::from(u32::from(self.id())) << VADDR_BITS;
-        assert_eq!(
-            ProcessId::try_from((high_part >> VADDR_BITS) as u32),
-            Ok(self.id())
-        );
-
-        let low_part = u64::from(vptr);
-        assert_eq!(low_part >> VADDR_BITS, 0);
+        // We don't keep a true system-wide virtual <-> physical address mapping.
+        // Instead we assume that memory that isn't shared between mappings (see
+        // `shared_physical_address`) belongs to a single process, and that
+        // therefore (pid, virtual address) uniquely defines a physical address.
+        ManagedPhysicalMemoryAddr::new_private(u32::from(self.id()), u64::from(vptr))
+    }
+
+    /// The physical address of the futex word at `vptr` for a futex operation on a shared
+    /// futex (one without `FUTEX_PRIVATE_FLAG`). Like in Linux, a word in a shared mapping is
+    /// identified by the object that's mapped and the word's offset in it, so that processes that
+    /// map the object at different addresses agree on it. Other words are identified like in
+    /// `physical_address`.
+    fn shared_physical_address(
+        &self,
+        native_pid: Option<Pid>,
+        vptr: ForeignPtr<()>,
+    ) -> ManagedPhysicalMemoryAddr {
+        let vaddr = usize::from(vptr);
+        let mapping = native_pid
+            .and_then(|pid| proc_maps::mappings_for_pid(pid.as_raw_nonzero().get()).ok())
+            .and_then(|mappings| {
+                mappings
+                    .into_iter()
+                    .find(|m| m.begin <= vaddr && vaddr < m.end)
+            });
+
+        let Some(mapping) = mapping else {
+            return self.physical_address(vptr);
+        };
+        if mapping.sharing != proc_maps::Sharing::Shared || mapping.inode == 0 {
+            return self.physical_address(vptr);
+        }
 
-        ManagedPhysicalMemoryAddr::from(high_part | low_part)
+        // The hash is only used to tell futexes apart, so a collision (which we don't expect in
+        // practice) only merges the waiters of two shared futexes.
+        let mut hasher = std::collections::hash_map::DefaultHasher::new();
+        (
+            mapping.device_major,
+            mapping.device_minor,
+            mapping.inode,
+            mapping.offset + (vaddr - mapping.begin),
+        )
+            .hash(&mut hasher);
+        ManagedPhysicalMemoryAddr::new_shared(hasher.finish())
     }
 
     fn name(&self) -> &str {
@@ -307,7 +334,8 @@ impl RunnableProcess {
             envv,
             self.strace_logging
                 .as_ref()
-                .map(|s| s.file.borrow(host.root()))
+                .and_then(|s| s.text_file())
+                .map(|file| file.borrow(host.root()))
                 .as_deref(),
             &self.shimlog_file,
             host.preload_paths(),
@@ -334,11 +362,11 @@ impl RunnableProcess {
                 .write(clear_child_tid_pvp, &0)
                 .unwrap();
 
-            // Wake the corresponding futex.
+            // Wake the corresponding futex. Like Linux, this wakes it as a shared futex.
             let futexes = host.futextable_borrow();
             let addr = self
                 .common
-                .physical_address(clear_child_tid_pvp.cast::<()>());
+                .shared_physical_address(Some(self.native_pid), clear_child_tid_pvp.cast::<()>());
 
             if let Some(futex) = futexes.get(addr) {
                 futex.wake(1);
@@ -385,21 +413,37 @@ impl RunnableProcess {
         self.memory_manager.borrow_mut()
     }
 
+    /// The format options for text strace logging, or `None` if syscalls aren't logged as text.
     pub fn strace_logging_options(&self) -> Option<FmtOptions> {
-        self.strace_logging.as_ref().map(|x| x.options)
+        match self.strace_logging.as_deref()? {
+            StraceLogging::Text { options, .. } => Some(*options),
+            StraceLogging::Binary(_) => None,
+        }
     }
 
-    /// If strace logging is disabled, this function will do nothing and return `None`.
+    /// If text strace logging is disabled, this function will do nothing and return `None`.
     pub fn with_strace_file<T>(&self, f: impl FnOnce(&mut std::fs::File) -> T) -> Option<T> {
         // TODO: get Host from caller. Would need t update syscall-logger.
         Worker::with_active_host(|host| {
-            let strace_logging = self.strace_logging.as_ref()?;
-            let mut file = strace_logging.file.borrow_mut(host.root());
+            let file = self.strace_logging.as_ref()?.text_file()?;
+            let mut file = file.borrow_mut(host.root());
             Some(f(&mut file))
         })
         .unwrap()
     }
 
+    /// If binary strace logging is disabled, this function will do nothing and return `None`.
+    pub fn with_binary_strace<T>(&self, f: impl FnOnce(&mut BinaryStraceWriter) -> T) -> Option<T> {
+        Worker::with_active_host(|host| {
+            let StraceLogging::Binary(writer) = self.strace_logging.as_deref()? else {
+                return None;
+            };
+            let mut writer = writer.borrow_mut(host.root());
+            Some(f(&mut writer))
+        })
+        .unwrap()
+    }
+
     pub fn native_pid(&self) -> Pid {
         self.native_pid
     }
@@ -474,8 +518,8 @@ impl RunnableProcess {
                     delta.as_nanos().try_into().unwrap(),
                 )
             };
-            host.cpu_borrow_mut().add_delay(delta);
         }
+        host.cpu_borrow_mut().add_delay(delta);
         delta
     }
 
@@ -646,9 +690,12 @@ impl RunnableProcess {
             &host.shim_shmem_lock_borrow().unwrap().root,
             host.shim_shmem().serialize(),
             host.id(),
+            pid.into(),
+            parent_pid.into(),
             strace_logging
                 .as_ref()
-                .map(|x| x.file.borrow(host.root()).as_raw_fd()),
+                .and_then(|x| x.text_file())
+                .map(|file| file.borrow(host.root()).as_raw_fd()),
         );
         let shim_shared_mem_block = shadow_shmem::allocator::shmalloc(shim_shared_mem);
 
@@ -951,24 +998,36 @@ impl Process {
         argv: Vec<CString>,
         envv: Vec<CString>,
         pause_for_debugging: bool,
-        strace_logging_options: Option<FmtOptions>,
+        strace_logging_options: Option<StraceOptions>,
         expected_final_state: ProcessFinalState,
     ) -> Result<RootedRc<RootedRefCell<Process>>, Errno> {
-        debug!("starting process '{:?}'", plugin_name);
+        Self::launch(
+            host,
+            plugin_name,
+            plugin_path,
+            argv,
+            envv,
+            strace_logging_options,
+        )?
+        .start(host, pause_for_debugging, expected_final_state)
+    }
+
+    /// Start the native process of a new process, without waiting for it to initialize. This lets
+    /// the native process exec and load its libraries in the background until
+    /// [`PendingProcess::start`] is called.
+    pub fn launch(
+        host: &Host,
+        plugin_name: CString,
+        plugin_path: &CStr,
+        argv: Vec<CString>,
+        envv: Vec<CString>,
+        strace_logging_options: Option<StraceOptions>,
+    ) -> Result<PendingProcess, Errno> {
+        debug!("launching process '{:?}'", plugin_name);
 
         let main_thread_id = host.get_new_thread_id();
         let process_id = ProcessId::from(main_thread_id);
 
-        let desc_table = RootedRc::new(
-            host.root(),
-            RootedRefCell::new(host.root(), DescriptorTable::new()),
-        );
-        let itimer_real = RefCell::new(Timer::new(move |host| {
-            itimer_real_expiration(host, process_id)
-        }));
-
-        let name = make_name(host, plugin_name.to_str().unwrap(), process_id);
-
         let mut file_basename = PathBuf::new();
         file_basename.push(host.data_dir_path());
         file_basename.push(format!(
@@ -978,164 +1037,56 @@ impl Process {
         ));
 
         let strace_logging = strace_logging_options.map(|options| {
+            let extension = match options {
+                StraceOptions::Text(_) => "strace",
+                StraceOptions::Binary { .. } => "strace.bin",
+            };
             let file =
-                std::fs::File::create(Self::static_output_file_name(&file_basename, "strace"))
+                std::fs::File::create(Self::static_output_file_name(&file_basename, extension))
                     .unwrap();
             debug_assert_cloexec(&file);
-            Arc::new(StraceLogging {
-                file: RootedRefCell::new(host.root(), file),
-                options,
+            Arc::new(match options {
+                StraceOptions::Text(options) => StraceLogging::Text {
+                    file: RootedRefCell::new(host.root(), file),
+                    options,
+                },
+                StraceOptions::Binary { buffer_prefix } => {
+                    StraceLogging::Binary(RootedRefCell::new(
+                        host.root(),
+                        BinaryStraceWriter::new(file, buffer_prefix).unwrap(),
+                    ))
+                }
             })
         });
 
-        let shim_shared_mem = ProcessShmem::new(
-            &host.shim_shmem_lock_borrow().unwrap().root,
-            host.shim_shmem().serialize(),
-            host.id(),
-            strace_logging
-                .as_ref()
-                .map(|x| x.file.borrow(host.root()).as_raw_fd()),
-        );
-        let shim_shared_mem_block = shadow_shmem::allocator::shmalloc(shim_shared_mem);
-
-        let working_dir = utility::pathbuf_to_nul_term_cstring(
-            std::fs::canonicalize(host.data_dir_path()).unwrap(),
-        );
-
-        #[cfg(feature = "perf_timers")]
-        let cpu_delay_timer = {
-            let mut t = PerfTimer::new();
-            t.stop();
-            RefCell::new(t)
-        };
-
-        // TODO: measure execution time of creating the main_thread with
-        // cpu_delay_timer? We previously did, but it's a little complex to do so,
-        // and it shouldn't matter much.
-
-        {
-            let mut descriptor_table = desc_table.borrow_mut(host.root());
-            Self::open_stdio_file_helper(
-                &mut descriptor_table,
-                libc::STDIN_FILENO.try_into().unwrap(),
-                "/dev/null".into(),
-                OFlag::O_RDONLY,
-            );
-
-            let name = Self::static_output_file_name(&file_basename, "stdout");
-            Self::open_stdio_file_helper(
-                &mut descriptor_table,
-                libc::STDOUT_FILENO.try_into().unwrap(),
-                name,
-                OFlag::O_WRONLY,
-            );
-
-            let name = Self::static_output_file_name(&file_basename, "stderr");
-            Self::open_stdio_file_helper(
-                &mut descriptor_table,
-                libc::STDERR_FILENO.try_into().unwrap(),
-                name,
-                OFlag::O_WRONLY,
-            );
-        }
-
         let shimlog_file = Arc::new(
             std::fs::File::create(Self::static_output_file_name(&file_basename, "shimlog"))
                 .unwrap(),
         );
         debug_assert_cloexec(&shimlog_file);
 
-        let mthread = ManagedThread::spawn(
+        let mthread = ManagedThread::launch(
             plugin_path,
             argv,
             envv,
             strace_logging
                 .as_ref()
-                .map(|s| s.file.borrow(host.root()))
+                .and_then(|s| s.text_file())
+                .map(|file| file.borrow(host.root()))
                 .as_deref(),
             &shimlog_file,
             host.preload_paths(),
         )?;
-        let native_pid = mthread.native_pid();
-        let main_thread =
-            Thread::wrap_mthread(host, mthread, desc_table, process_id, main_thread_id).unwrap();
-
-        debug!("process '{:?}' started", plugin_name);
-
-        if pause_for_debugging {
-            // will block until logger output has been flushed
-            // there is a race condition where other threads may log between the
-            // `eprintln` and `raise` below, but it should be rare
-            log::logger().flush();
-
-            // Use a single `eprintln` to ensure we hold the lock for the whole message.
-            // Defensively pre-construct a single string so that `eprintln` is
-            // more likely to use a single `write` call, to minimize the chance
-            // of more lines being written to stdout in the meantime, and in
-            // case of C code writing to `STDERR` directly without taking Rust's
-            // lock.
-            let msg = format!(
-                "\
-              \n** Pausing with SIGTSTP to enable debugger attachment to managed process\
-              \n** '{plugin_name:?}' (pid {native_pid:?}).\
-              \n** If running Shadow under Bash, resume Shadow by pressing Ctrl-Z to background\
-              \n** this task, and then typing \"fg\".\
-              \n** If running GDB, resume Shadow by typing \"signal SIGCONT\"."
-            );
-            eprintln!("{}", msg);
-
-            rustix::process::kill_process(rustix::process::getpid(), rustix::process::Signal::Tstp)
-                .unwrap();
-        }
 
-        let memory_manager = unsafe { MemoryManager::new(native_pid) };
-        let threads = RefCell::new(BTreeMap::from([(
-            main_thread_id,
-            RootedRc::new(host.root(), RootedRefCell::new(host.root(), main_thread)),
-        )]));
-
-        let common = Common {
-            id: process_id,
-            host_id: host.id(),
-            working_dir,
-            name,
+        Ok(PendingProcess {
             plugin_name,
-            parent_pid: Cell::new(ProcessId::INIT),
-            group_id: Cell::new(ProcessId::INIT),
-            session_id: Cell::new(ProcessId::INIT),
-            // Exit signal is moot; since parent is INIT there will never
-            // be a valid target for it.
-            exit_signal: None,
-        };
-        Ok(RootedRc::new(
-            host.root(),
-            RootedRefCell::new(
-                host.root(),
-                Self {
-                    state: RefCell::new(Some(ProcessState::Runnable(RunnableProcess {
-                        common,
-                        expected_final_state: Some(expected_final_state),
-                        shim_shared_mem_block,
-                        memory_manager: Box::new(RefCell::new(memory_manager)),
-                        itimer_real,
-                        strace_logging,
-                        dumpable: Cell::new(SuidDump::SUID_DUMP_USER),
-                        native_pid,
-                        unsafe_borrow_mut: RefCell::new(None),
-                        unsafe_borrows: RefCell::new(Vec::new()),
-                        threads,
-                        #[cfg(feature = "perf_timers")]
-                        cpu_delay_timer,
-                        #[cfg(feature = "perf_timers")]
-                        total_run_time: Cell::new(Duration::ZERO),
-                        child_process_event_listeners: Default::default(),
-                        shimlog_file,
-                    }))),
-                },
-            ),
-        ))
+            main_thread_id,
+            file_basename,
+            strace_logging,
+            shimlog_file,
+            mthread,
+        })
     }
-
     pub fn id(&self) -> ProcessId {
         self.common().id
     }
@@ -1145,7 +1096,10 @@ impl Process {
     }
 
     pub fn set_parent_id(&self, pid: ProcessId) {
-        self.common().parent_pid.set(pid)
+        self.common().parent_pid.set(pid);
+        if let Some(runnable) = self.as_runnable() {
+            runnable.shmem().ppid.store(pid.into(), Ordering::Relaxed);
+        }
     }
 
     pub fn group_id(&self) -> ProcessId {
@@ -1331,11 +1285,13 @@ impl Process {
         }
     }
 
+    /// If `deferred` is true, the file isn't created until it's first used.
     fn open_stdio_file_helper(
         descriptor_table: &mut DescriptorTable,
         fd: DescriptorHandle,
         path: PathBuf,
         access_mode: OFlag,
+        deferred: bool,
     ) {
         let stdfile = unsafe { cshadow::regularfile_new() };
         let cwd = rustix::process::getcwd(Vec::new()).unwrap();
@@ -1347,15 +1303,15 @@ impl Process {
         // TODO: We probably ought to change `regularfile_open` and friends to
         // use a direct syscall instead of libc's wrappers, and explicitly take
         // the kernel version of flags, mode, etc.
-        let access_mode = access_mode.bits();
-        let errorcode = unsafe {
-            cshadow::regularfile_open(
-                stdfile,
-                path.as_ptr(),
-                access_mode | libc::O_CREAT | libc::O_TRUNC,
-                libc::S_IRUSR | libc::S_IWUSR | libc::S_IRGRP | libc::S_IROTH,
-                cwd.as_ptr(),
-            )
+        let flags = access_mode.bits() | libc::O_CREAT | libc::O_TRUNC;
+        let mode = libc::S_IRUSR | libc::S_IWUSR | libc::S_IRGRP | libc::S_IROTH;
+        let errorcode = if deferred {
+            unsafe {
+                cshadow::regularfile_openDeferred(stdfile, path.as_ptr(), flags, mode, cwd.as_ptr())
+            };
+            0
+        } else {
+            unsafe { cshadow::regularfile_open(stdfile, path.as_ptr(), flags, mode, cwd.as_ptr()) }
         };
         if errorcode != 0 {
             panic!(
@@ -1421,6 +1377,11 @@ impl Process {
         self.as_runnable().unwrap().with_strace_file(f)
     }
 
+    /// Deprecated wrapper for `RunnableProcess::with_binary_strace`
+    pub fn with_binary_strace<T>(&self, f: impl FnOnce(&mut BinaryStraceWriter) -> T) -> Option<T> {
+        self.as_runnable().unwrap().with_binary_strace(f)
+    }
+
     /// Deprecated wrapper for `RunnableProcess::native_pid`
     pub fn native_pid(&self) -> Pid {
         self.as_runnable().unwrap().native_pid()
@@ -1477,6 +1438,13 @@ impl Process {
         self.common().physical_address(vptr)
     }
 
+    /// The physical address of the futex word at `vptr` for operations on a shared futex. See
+    /// `Common::shared_physical_address`.
+    pub fn shared_physical_address(&self, vptr: ForeignPtr<()>) -> ManagedPhysicalMemoryAddr {
+        let native_pid = self.as_runnable().map(|r| r.native_pid());
+        self.common().shared_physical_address(native_pid, vptr)
+    }
+
     pub fn is_running(&self) -> bool {
         self.as_runnable().is_some()
     }
@@ -1517,26 +1485,42 @@ impl Process {
             runnable.total_run_time.get()
         );
 
-        let wait_res: Option<WaitStatus> =
-            rustix::process::waitpid(Some(runnable.native_pid().into()), WaitOptions::empty())
-                .unwrap_or_else(|e| {
-                    panic!("Error waiting for {:?}: {:?}", runnable.native_pid(), e)
-                });
-        let wait_status = wait_res.unwrap();
+        // use `wait4` rather than `waitpid` so that we also get the process's peak memory usage
+        let mut wait_status: libc::c_int = 0;
+        let mut rusage: libc::rusage = unsafe { std::mem::zeroed() };
+        let rv = unsafe {
+            libc::wait4(
+                runnable.native_pid().as_raw_nonzero().get(),
+                &mut wait_status,
+                0,
+                &mut rusage,
+            )
+        };
+        if rv == -1 {
+            panic!(
+                "Error waiting for {:?}: {:?}",
+                runnable.native_pid(),
+                std::io::Error::last_os_error()
+            );
+        }
+
+        // 'ru_maxrss' is in KiB
+        host.add_process_max_rss(u64::try_from(rusage.ru_maxrss).unwrap_or(0) * 1024);
+
         let exit_status = if killed_by_shadow {
-            if wait_status.terminating_signal()
-                != Some(Signal::SIGKILL.as_i32().try_into().unwrap())
+            if !libc::WIFSIGNALED(wait_status)
+                || libc::WTERMSIG(wait_status) != Signal::SIGKILL.as_i32()
             {
-                warn!("Unexpected waitstatus after killed by shadow: {wait_status:?}");
+                warn!("Unexpected waitstatus after killed by shadow: {wait_status:#x}");
             }
             ExitStatus::StoppedByShadow
-        } else if let Some(code) = wait_status.exit_status() {
-            ExitStatus::Normal(code.try_into().unwrap())
-        } else if let Some(signal) = wait_status.terminating_signal() {
-            ExitStatus::Signaled(Signal::try_from(i32::try_from(signal).unwrap()).unwrap())
+        } else if libc::WIFEXITED(wait_status) {
+            ExitStatus::Normal(libc::WEXITSTATUS(wait_status))
+        } else if libc::WIFSIGNALED(wait_status) {
+            ExitStatus::Signaled(Signal::try_from(libc::WTERMSIG(wait_status)).unwrap())
         } else {
             panic!(
-                "Unexpected status: {wait_status:?} for pid {:?}",
+                "Unexpected status: {wait_status:#x} for pid {:?}",
                 runnable.native_pid()
             );
         };
@@ -1587,9 +1571,11 @@ impl Process {
     /// FIXME: still needed? Time is now updated more granularly in the Thread code
     /// when xferring control to/from shim.
     fn set_shared_time(host: &Host) {
-        let mut host_shmem = host.shim_shmem_lock_borrow_mut().unwrap();
-        host_shmem.max_runahead_time = Worker::max_event_runahead_time(host);
-        host.shim_shmem()
+        let host_shmem = host.shim_shmem();
+        host_shmem
+            .max_runahead_time
+            .store(Worker::max_event_runahead_time(host), Ordering::Relaxed);
+        host_shmem
             .sim_time
             .store(Worker::current_time().unwrap(), Ordering::Relaxed);
     }
@@ -1775,6 +1761,192 @@ impl ExplicitDrop for Process {
     }
 }
 
+/// A process whose native process has been launched by [`Process::launch`], but which hasn't been
+/// started yet.
+///
+/// The native process is killed if this is dropped without being started.
+pub struct PendingProcess {
+    plugin_name: CString,
+    main_thread_id: ThreadId,
+    file_basename: PathBuf,
+    strace_logging: Option<Arc<StraceLogging>>,
+    shimlog_file: Arc<std::fs::File>,
+    mthread: PendingManagedThread,
+}
+
+impl PendingProcess {
+    /// Wait for the native process to initialize, and create the process. The process will be
+    /// runnable via [`Process::resume`] once it has been added to the `Host`'s process list.
+    pub fn start(
+        self,
+        host: &Host,
+        pause_for_debugging: bool,
+        expected_final_state: ProcessFinalState,
+    ) -> Result<RootedRc<RootedRefCell<Process>>, Errno> {
+        let PendingProcess {
+            plugin_name,
+            main_thread_id,
+            file_basename,
+            strace_logging,
+            shimlog_file,
+            mthread,
+        } = self;
+        let process_id = ProcessId::from(main_thread_id);
+
+        debug!("starting process '{:?}'", plugin_name);
+
+        let desc_table = RootedRc::new(
+            host.root(),
+            RootedRefCell::new(host.root(), DescriptorTable::new()),
+        );
+        let itimer_real = RefCell::new(Timer::new(move |host| {
+            itimer_real_expiration(host, process_id)
+        }));
+
+        let name = make_name(host, plugin_name.to_str().unwrap(), process_id);
+
+        let shim_shared_mem = ProcessShmem::new(
+            &host.shim_shmem_lock_borrow().unwrap().root,
+            host.shim_shmem().serialize(),
+            host.id(),
+            process_id.into(),
+            ProcessId::INIT.into(),
+            strace_logging
+                .as_ref()
+                .and_then(|x| x.text_file())
+                .map(|file| file.borrow(host.root()).as_raw_fd()),
+        );
+        let shim_shared_mem_block = shadow_shmem::allocator::shmalloc(shim_shared_mem);
+
+        let working_dir = utility::pathbuf_to_nul_term_cstring(
+            std::fs::canonicalize(host.data_dir_path()).unwrap(),
+        );
+
+        #[cfg(feature = "perf_timers")]
+        let cpu_delay_timer = {
+            let mut t = PerfTimer::new();
+            t.stop();
+            RefCell::new(t)
+        };
+
+        // TODO: measure execution time of creating the main_thread with
+        // cpu_delay_timer? We previously did, but it's a little complex to do so,
+        // and it shouldn't matter much.
+
+        {
+            let mut descriptor_table = desc_table.borrow_mut(host.root());
+            Process::open_stdio_file_helper(
+                &mut descriptor_table,
+                libc::STDIN_FILENO.try_into().unwrap(),
+                "/dev/null".into(),
+                OFlag::O_RDONLY,
+                false,
+            );
+
+            // many processes never write to these, so don't create them until they're used
+            let deferred = host.params.use_lazy_output_files;
+
+            let name = Process::static_output_file_name(&file_basename, "stdout");
+            Process::open_stdio_file_helper(
+                &mut descriptor_table,
+                libc::STDOUT_FILENO.try_into().unwrap(),
+                name,
+                OFlag::O_WRONLY,
+                deferred,
+            );
+
+            let name = Process::static_output_file_name(&file_basename, "stderr");
+            Process::open_stdio_file_helper(
+                &mut descriptor_table,
+                libc::STDERR_FILENO.try_into().unwrap(),
+                name,
+                OFlag::O_WRONLY,
+                deferred,
+            );
+        }
+
+        let mthread = mthread.wait_for_start()?;
+        let native_pid = mthread.native_pid();
+        let main_thread =
+            Thread::wrap_mthread(host, mthread, desc_table, process_id, main_thread_id).unwrap();
+
+        debug!("process '{:?}' started", plugin_name);
+
+        if pause_for_debugging {
+            // will block until logger output has been flushed
+            // there is a race condition where other threads may log between the
+            // `eprintln` and `raise` below, but it should be rare
+            log::logger().flush();
+
+            // Use a single `eprintln` to ensure we hold the lock for the whole message.
+            // Defensively pre-construct a single string so that `eprintln` is
+            // more likely to use a single `write` call, to minimize the chance
+            // of more lines being written to stdout in the meantime, and in
+            // case of C code writing to `STDERR` directly without taking Rust's
+            // lock.
+            let msg = format!(
+                "\
+              \n** Pausing with SIGTSTP to enable debugger attachment to managed process\
+              \n** '{plugin_name:?}' (pid {native_pid:?}).\
+              \n** If running Shadow under Bash, resume Shadow by pressing Ctrl-Z to background\
+              \n** this task, and then typing \"fg\".\
+              \n** If running GDB, resume Shadow by typing \"signal SIGCONT\"."
+            );
+            eprintln!("{}", msg);
+
+            rustix::process::kill_process(rustix::process::getpid(), rustix::process::Signal::Tstp)
+                .unwrap();
+        }
+
+        let memory_manager = unsafe { MemoryManager::new(native_pid) };
+        let threads = RefCell::new(BTreeMap::from([(
+            main_thread_id,
+            RootedRc::new(host.root(), RootedRefCell::new(host.root(), main_thread)),
+        )]));
+
+        let common = Common {
+            id: process_id,
+            host_id: host.id(),
+            working_dir,
+            name,
+            plugin_name,
+            parent_pid: Cell::new(ProcessId::INIT),
+            group_id: Cell::new(ProcessId::INIT),
+            session_id: Cell::new(ProcessId::INIT),
+            // Exit signal is moot; since parent is INIT there will never
+            // be a valid target for it.
+            exit_signal: None,
+        };
+        Ok(RootedRc::new(
+            host.root(),
+            RootedRefCell::new(
+                host.root(),
+                Process {
+                    state: RefCell::new(Some(ProcessState::Runnable(RunnableProcess {
+                        common,
+                        expected_final_state: Some(expected_final_state),
+                        shim_shared_mem_block,
+                        memory_manager: Box::new(RefCell::new(memory_manager)),
+                        itimer_real,
+                        strace_logging,
+                        dumpable: Cell::new(SuidDump::SUID_DUMP_USER),
+                        native_pid,
+                        unsafe_borrow_mut: RefCell::new(None),
+                        unsafe_borrows: RefCell::new(Vec::new()),
+                        threads,
+                        #[cfg(feature = "perf_timers")]
+                        cpu_delay_timer,
+                        #[cfg(feature = "perf_timers")]
+                        total_run_time: Cell::new(Duration::ZERO),
+                        child_process_event_listeners: Default::default(),
+                        shimlog_file,
+                    }))),
+                },
+            ),
+        ))
+    }
+}
+
 /// Tracks a memory reference made by a legacy C memory-read API.
 struct UnsafeBorrow {
     // Must come before `manager`, so that it's dropped first, since it's
@@ -2025,6 +2197,52 @@ mod export {
         }
     }
 
+    /// Copy consecutive parts of `src` to the `n` ranges `dsts`, where `lens` are the ranges'
+    /// lengths, with at most one syscall. Returns 0 on success or -EFAULT if any of the ranges
+    /// couldn't be accessed. `n` must be at most `UIO_MAXIOV`. The writes are flushed
+    /// immediately.
+    #[no_mangle]
+    pub unsafe extern "C-unwind" fn process_writePtrs(
+        proc: *const Process,
+        dsts: *const UntypedForeignPtr,
+        lens: *const usize,
+        n: usize,
+        src: *const c_void,
+    ) -> i32 {
+        let proc = unsafe { proc.as_ref().unwrap() };
+        let dsts = unsafe { std::slice::from_raw_parts(notnull_debug(dsts), n) };
+        let lens = unsafe { std::slice::from_raw_parts(notnull_debug(lens), n) };
+        let dsts: Vec<ForeignArrayPtr<u8>> = dsts
+            .iter()
+            .zip(lens)
+            .map(|(dst, len)| ForeignArrayPtr::new(dst.cast::<u8>(), *len))
+            .collect();
+        let total: usize = lens.iter().sum();
+        let src = unsafe { std::slice::from_raw_parts(notnull_debug(src) as *const u8, total) };
+        match proc.memory_borrow_mut().copy_to_ptrs(&dsts, src) {
+            Ok(written) if written == total => 0,
+            Ok(_) => Errno::EFAULT.to_negated_i32(),
+            Err(e) => {
+                trace!("Couldn't write {:?} into {:?}: {:?}", src, dsts, e);
+                e.to_negated_i32()
+            }
+        }
+    }
+
+    /// Whether the `n` bytes at `ptr` are mapped into shadow's address space, so that pointers
+    /// from `process_getMutablePtr` etc. refer to the process's memory directly rather than to a
+    /// copy.
+    #[no_mangle]
+    pub unsafe extern "C-unwind" fn process_isMemoryMapped(
+        proc: *const Process,
+        ptr: UntypedForeignPtr,
+        n: usize,
+    ) -> bool {
+        let proc = unsafe { proc.as_ref().unwrap() };
+        let ptr = ForeignArrayPtr::new(ptr.cast::<u8>(), n);
+        proc.memory_borrow().is_mapped(ptr)
+    }
+
     /// Make the data at plugin_src available in shadow's address space.
     ///
     /// The returned pointer is invalidated when one of the process memory flush
@@ -2255,6 +2473,22 @@ mod export {
         proc.physical_address(vptr)
     }
 
+    /// The physical address of the futex word at `vptr` for a futex operation, which depends on
+    /// whether the operation has `FUTEX_PRIVATE_FLAG`.
+    #[no_mangle]
+    pub unsafe extern "C-unwind" fn process_getFutexAddress(
+        proc: *const Process,
+        vptr: UntypedForeignPtr,
+        is_private: bool,
+    ) -> ManagedPhysicalMemoryAddr {
+        let proc = unsafe { proc.as_ref().unwrap() };
+        if is_private {
+            proc.physical_address(vptr)
+        } else {
+            proc.shared_physical_address(vptr)
+        }
+    }
+
     #[no_mangle]
     pub unsafe extern "C-unwind" fn process_addChildEventListener(
         host: *const Host,
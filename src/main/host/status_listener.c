@@ -11,6 +11,7 @@
 
 #include "lib/logger/logger.h"
 #include "main/core/worker.h"
+#include "main/utility/freelist.h"
 #include "main/utility/utility.h"
 
 struct _StatusListener {
@@ -50,10 +51,31 @@ int status_listener_compare(const void* ptr_1, const void* ptr_2) {
     return (listener_1->deterministicSequenceValue < listener_2->deterministicSequenceValue) ? -1 : 1;
 }
 
+/* Blocking syscalls create a listener every time they wait on a file, futex, or child, so we
+ * recycle listeners through a freelist. */
+#define STATUSLISTENER_MAX_FREE 256
+
+static __thread FreeList _statuslistenerFreeList = FREELIST_INIT(STATUSLISTENER_MAX_FREE, free);
+
+static StatusListener* _statuslistener_alloc() {
+    StatusListener* listener = freelist_pop(&_statuslistenerFreeList);
+    if (listener != NULL) {
+        return listener;
+    }
+
+    return malloc(sizeof(StatusListener));
+}
+
+static void _statuslistener_dealloc(StatusListener* listener) {
+    if (!freelist_push(&_statuslistenerFreeList, listener)) {
+        free(listener);
+    }
+}
+
 StatusListener* statuslistener_new(StatusCallbackFunc notifyFunc, void* callbackObject,
                                    StatusObjectFreeFunc objectFreeFunc, void* callbackArgument,
                                    StatusArgumentFreeFunc argumentFreeFunc, const Host* host) {
-    StatusListener* listener = malloc(sizeof(StatusListener));
+    StatusListener* listener = _statuslistener_alloc();
 
     *listener =
         (StatusListener){.notifyFunc = notifyFunc,
@@ -66,7 +88,7 @@ StatusListener* statuslistener_new(StatusCallbackFunc notifyFunc, void* callback
 
     MAGIC_INIT(listener);
 
-    worker_count_allocation(StatusListener);
+    worker_count_allocation(STATUS_LISTENER);
     return listener;
 }
 
@@ -82,8 +104,8 @@ static void _statuslistener_free(StatusListener* listener) {
     }
 
     MAGIC_CLEAR(listener);
-    free(listener);
-    worker_count_deallocation(StatusListener);
+    _statuslistener_dealloc(listener);
+    worker_count_deallocation(STATUS_LISTENER);
 }
 
 void statuslistener_ref(StatusListener* listener) {
@@ -142,6 +164,11 @@ void statuslistener_onStatusChanged(StatusListener* listener, FileState currentS
     }
 }
 
+bool statuslistener_wouldNotify(StatusListener* listener, FileState currentStatus,
+                                FileState transitions) {
+    return _statuslistener_shouldNotify(listener, currentStatus, transitions);
+}
+
 void statuslistener_setMonitorStatus(StatusListener* listener, FileState status,
                                      StatusListenerFilter filter) {
     MAGIC_ASSERT(listener);
@@ -9,6 +9,8 @@
 /* Opaque object to store the state needed to implement the module. */
 typedef struct _StatusListener StatusListener;
 
+#include <stdbool.h>
+
 #include "main/bindings/c/bindings-opaque.h"
 
 /* Indicates when the listener should trigger a callback, i.e.,
@@ -50,6 +52,11 @@ void statuslistener_unref(StatusListener* listener);
 void statuslistener_onStatusChanged(StatusListener* listener, FileState currentStatus,
                                     FileState transitions);
 
+/* Returns true if `statuslistener_onStatusChanged` would trigger a notification for these
+ * arguments, without triggering it. */
+bool statuslistener_wouldNotify(StatusListener* listener, FileState currentStatus,
+                                FileState transitions);
+
 /* Set the status bits that we should monitor for transitions (flips),
  * and a filter that specifies which flips should cause the callback
  * to be invoked. */
@@ -0,0 +1,391 @@
+//! A compact binary format for strace logging.
+//!
+//! Formatting every syscall as text while the simulation runs is expensive, so the "binary"
+//! strace logging mode instead appends a fixed-size record for each syscall to a large buffer,
+//! which is written to the strace file in blocks. The records are formatted later with
+//! `shadow --decode-strace`.
+//!
+//! The file starts with [`MAGIC`], and is followed by the records. All fields are little-endian.
+//!
+//! | bytes | field                                                               |
+//! |-------|---------------------------------------------------------------------|
+//! | 4     | length of the record in bytes, including this field                 |
+//! | 4     | thread id                                                           |
+//! | 8     | simulated time since the start of the simulation, in nanoseconds    |
+//! | 8     | wall-clock time since the file was created, in nanoseconds          |
+//! | 8     | syscall number                                                      |
+//! | 48    | the six syscall argument registers                                  |
+//! | 4     | result kind (see [`ResultKind`])                                    |
+//! | 4     | length of the captured buffer                                       |
+//! | 8     | return value, or the negated errno if the syscall failed            |
+//! | n     | captured buffer, padded with zeros to a multiple of 8 bytes         |
+
+use std::io::{BufWriter, Read, Write};
+use std::time::Instant;
+
+use linux_api::errno::Errno;
+use linux_api::syscall::SyscallNum;
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+use shadow_shim_helper_rs::simulation_time::SimulationTime;
+use shadow_shim_helper_rs::syscall_types::{ForeignPtr, SyscallArgs};
+
+use crate::host::memory_manager::MemoryManager;
+use crate::host::syscall::formatter::write_syscall;
+use crate::host::syscall::types::{ForeignArrayPtr, SyscallError, SyscallResult};
+use crate::host::thread::ThreadId;
+
+/// The first bytes of a binary strace file. The last byte is the format version.
+pub const MAGIC: &[u8; 8] = b"SHDWSTR\x01";
+
+/// The length of a record without its captured buffer.
+const RECORD_HEADER_LEN: usize = 96;
+
+/// Records are written to the file in blocks of this size.
+const WRITE_BUFFER_LEN: usize = 1 << 20;
+
+#[derive(Copy, Clone, Debug, PartialEq, Eq)]
+#[repr(u32)]
+enum ResultKind {
+    Returned = 0,
+    Failed = 1,
+    Native = 2,
+    Blocked = 3,
+}
+
+impl TryFrom<u32> for ResultKind {
+    type Error = u32;
+
+    fn try_from(x: u32) -> Result<Self, Self::Error> {
+        Ok(match x {
+            0 => Self::Returned,
+            1 => Self::Failed,
+            2 => Self::Native,
+            3 => Self::Blocked,
+            x => return Err(x),
+        })
+    }
+}
+
+/// The buffer of the syscall that is worth capturing, if any: the data written by a successful
+/// read, the data to be written by a write, or the socket address of a connect or bind. With the
+/// addresses and data sizes, a log describes the process's network behaviour without needing to
+/// re-run it.
+fn buffer_to_capture(args: &SyscallArgs, rv: &SyscallResult) -> Option<(ForeignPtr<u8>, usize)> {
+    let syscall = SyscallNum::new(args.number.try_into().ok()?);
+    let len = match syscall {
+        SyscallNum::NR_read | SyscallNum::NR_pread64 | SyscallNum::NR_recvfrom => {
+            usize::try_from(i64::from(*rv.as_ref().ok()?)).ok()?
+        }
+        SyscallNum::NR_write
+        | SyscallNum::NR_pwrite64
+        | SyscallNum::NR_sendto
+        | SyscallNum::NR_connect
+        | SyscallNum::NR_bind => usize::from(args.get(2)),
+        _ => return None,
+    };
+    Some((ForeignPtr::from(args.get(1)), len))
+}
+
+/// Writes binary strace records for a process.
+#[derive(Debug)]
+pub struct BinaryStraceWriter {
+    writer: BufWriter<std::fs::File>,
+    /// The maximum number of bytes of each buffer to capture.
+    buffer_prefix: usize,
+    start: Instant,
+    record: Vec<u8>,
+}
+
+impl BinaryStraceWriter {
+    pub fn new(file: std::fs::File, buffer_prefix: usize) -> std::io::Result<Self> {
+        let mut writer = BufWriter::with_capacity(WRITE_BUFFER_LEN, file);
+        writer.write_all(MAGIC)?;
+
+        Ok(Self {
+            writer,
+            buffer_prefix,
+            start: Instant::now(),
+            record: Vec::with_capacity(RECORD_HEADER_LEN + buffer_prefix.next_multiple_of(8)),
+        })
+    }
+
+    pub fn write_record(
+        &mut self,
+        sim_time: EmulatedTime,
+        tid: ThreadId,
+        args: &SyscallArgs,
+        rv: &SyscallResult,
+        mem: &MemoryManager,
+    ) -> std::io::Result<()> {
+        let (kind, rv_val) = match rv {
+            Ok(x) => (ResultKind::Returned, i64::from(*x)),
+            Err(SyscallError::Failed(failed)) => {
+                (ResultKind::Failed, failed.errno.to_negated_i64())
+            }
+            Err(SyscallError::Native) => (ResultKind::Native, 0),
+            Err(SyscallError::Blocked(_)) => (ResultKind::Blocked, 0),
+        };
+
+        let sim_time = sim_time.duration_since(&EmulatedTime::SIMULATION_START);
+        let wall_time = self.start.elapsed();
+
+        let record = &mut self.record;
+        record.clear();
+        // the length is filled in below
+        record.extend_from_slice(&0u32.to_le_bytes());
+        record.extend_from_slice(&libc::pid_t::from(tid).to_le_bytes());
+        record.extend_from_slice(&u64::try_from(sim_time.as_nanos()).unwrap().to_le_bytes());
+        record.extend_from_slice(&u64::try_from(wall_time.as_nanos()).unwrap().to_le_bytes());
+        record.extend_from_slice(&args.number.to_le_bytes());
+        for arg in args.args {
+            record.extend_from_slice(&u64::from(arg).to_le_bytes());
+        }
+        record.extend_from_slice(&(kind as u32).to_le_bytes());
+        // the captured buffer length is filled in below
+        record.extend_from_slice(&0u32.to_le_bytes());
+        record.extend_from_slice(&rv_val.to_le_bytes());
+        debug_assert_eq!(record.len(), RECORD_HEADER_LEN);
+
+        if self.buffer_prefix > 0 {
+            if let Some((ptr, len)) = buffer_to_capture(args, rv) {
+                let len = std::cmp::min(len, self.buffer_prefix);
+                // the pointer may be invalid, in which case we don't capture anything
+                if let Ok(mem_ref) = mem.memory_ref_prefix(ForeignArrayPtr::new(ptr, len)) {
+                    record.extend_from_slice(&mem_ref);
+                }
+            }
+        }
+
+        let captured_len = u32::try_from(record.len() - RECORD_HEADER_LEN).unwrap();
+        record.resize(record.len().next_multiple_of(8), 0);
+
+        let record_len = u32::try_from(record.len()).unwrap();
+        record[0..4].copy_from_slice(&record_len.to_le_bytes());
+        record[84..88].copy_from_slice(&captured_len.to_le_bytes());
+
+        self.writer.write_all(record)
+    }
+}
+
+/// A decoded record.
+struct Record {
+    tid: ThreadId,
+    sim_time: EmulatedTime,
+    number: u64,
+    args: [u64; 6],
+    kind: ResultKind,
+    rv: i64,
+    captured: Vec<u8>,
+}
+
+impl Record {
+    fn parse(bytes: &[u8]) -> anyhow::Result<Self> {
+        let u32_at = |i: usize| u32::from_le_bytes(bytes[i..i + 4].try_into().unwrap());
+        let u64_at = |i: usize| u64::from_le_bytes(bytes[i..i + 8].try_into().unwrap());
+
+        let tid = libc::pid_t::from_le_bytes(bytes[4..8].try_into().unwrap());
+        let tid =
+            ThreadId::try_from(tid).map_err(|_| anyhow::anyhow!("Invalid thread id {tid}"))?;
+        let sim_time = EmulatedTime::SIMULATION_START + SimulationTime::from_nanos(u64_at(8));
+        let kind = ResultKind::try_from(u32_at(80))
+            .map_err(|x| anyhow::anyhow!("Invalid result kind {x}"))?;
+
+        let captured_len = usize::try_from(u32_at(84)).unwrap();
+        let Some(captured) = bytes.get(RECORD_HEADER_LEN..RECORD_HEADER_LEN + captured_len) else {
+            anyhow::bail!("Captured buffer of {captured_len} bytes is longer than the record");
+        };
+
+        Ok(Self {
+            tid,
+            sim_time,
+            number: u64_at(24),
+            args: std::array::from_fn(|i| u64_at(32 + 8 * i)),
+            kind,
+            rv: i64::from_le_bytes(bytes[88..96].try_into().unwrap()),
+            captured: captured.to_vec(),
+        })
+    }
+
+    /// The index of the argument that the captured buffer was read from.
+    const CAPTURED_ARG: usize = 1;
+
+    fn write(&self, writer: impl Write) -> std::io::Result<()> {
+        let syscall = u32::try_from(self.number).ok().map(SyscallNum::new);
+        let name = syscall.and_then(|x| x.to_str());
+
+        let mut args = Vec::new();
+        if name.is_none() {
+            // log it in the form "syscall(X, ...)", like the text logs
+            args.push(self.number.to_string());
+        }
+        for (i, arg) in self.args.iter().enumerate() {
+            if i == Self::CAPTURED_ARG && !self.captured.is_empty() {
+                let escaped: String = self
+                    .captured
+                    .iter()
+                    .flat_map(|c| std::ascii::escape_default(*c))
+                    .map(char::from)
+                    .collect();
+                args.push(format!("\"{escaped}\"..."));
+            } else {
+                args.push(format!("{arg:#x}"));
+            }
+        }
+
+        let rv = match self.kind {
+            ResultKind::Returned => self.rv.to_string(),
+            ResultKind::Failed => {
+                let errno = u16::try_from(-self.rv).ok().and_then(Errno::from_u16);
+                match errno {
+                    Some(errno) => format!("{} ({errno})", self.rv),
+                    None => self.rv.to_string(),
+                }
+            }
+            ResultKind::Native => "<native>".to_string(),
+            ResultKind::Blocked => "<blocked>".to_string(),
+        };
+
+        write_syscall(
+            writer,
+            &self.sim_time,
+            self.tid,
+            name.unwrap_or("syscall"),
+            args.join(", "),
+            rv,
+        )
+    }
+}
+
+/// Format the records of a binary strace file as text, in the same format as the "standard" mode
+/// but with the raw argument registers, and any captured buffers in place of their pointers.
+pub fn decode(mut reader: impl Read, mut writer: impl Write) -> anyhow::Result<()> {
+    let mut magic = [0u8; MAGIC.len()];
+    reader.read_exact(&mut magic)?;
+    if &magic != MAGIC {
+        anyhow::bail!("Not a binary strace file, or an unsupported version");
+    }
+
+    let mut record = Vec::new();
+    loop {
+        let mut len_bytes = [0u8; 4];
+        match reader.read_exact(&mut len_bytes) {
+            Ok(()) => {}
+            Err(e) if e.kind() == std::io::ErrorKind::UnexpectedEof => break,
+            Err(e) => return Err(e.into()),
+        }
+
+        let len = usize::try_from(u32::from_le_bytes(len_bytes)).unwrap();
+        if len < RECORD_HEADER_LEN {
+            anyhow::bail!("Invalid record length {len}");
+        }
+
+        record.clear();
+        record.extend_from_slice(&len_bytes);
+        record.resize(len, 0);
+        // the last record may be truncated if shadow didn't exit cleanly
+        if let Err(e) = reader.read_exact(&mut record[4..]) {
+            if e.kind() == std::io::ErrorKind::UnexpectedEof {
+                log::warn!("Ignoring a truncated record at the end of the file");
+                break;
+            }
+            return Err(e.into());
+        }
+
+        Record::parse(&record)?.write(&mut writer)?;
+    }
+
+    writer.flush()?;
+    Ok(())
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    fn encode_header(number: u64, kind: ResultKind, rv: i64, captured: &[u8]) -> Vec<u8> {
+        let mut record = Vec::new();
+        let len = (RECORD_HEADER_LEN + captured.len()).next_multiple_of(8);
+        record.extend_from_slice(&u32::try_from(len).unwrap().to_le_bytes());
+        record.extend_from_slice(&1000i32.to_le_bytes());
+        record.extend_from_slice(&1_500_000_000u64.to_le_bytes());
+        record.extend_from_slice(&0u64.to_le_bytes());
+        record.extend_from_slice(&number.to_le_bytes());
+        for i in 0..6u64 {
+            record.extend_from_slice(&(i + 1).to_le_bytes());
+        }
+        record.extend_from_slice(&(kind as u32).to_le_bytes());
+        record.extend_from_slice(&u32::try_from(captured.len()).unwrap().to_le_bytes());
+        record.extend_from_slice(&rv.to_le_bytes());
+        record.extend_from_slice(captured);
+        record.resize(len, 0);
+        record
+    }
+
+    fn decode_to_string(records: &[Vec<u8>]) -> String {
+        let mut file = MAGIC.to_vec();
+        for record in records {
+            file.extend_from_slice(record);
+        }
+        let mut out = Vec::new();
+        decode(&file[..], &mut out).unwrap();
+        String::from_utf8(out).unwrap()
+    }
+
+    #[test]
+    fn test_decode() {
+        let write = u64::from(u32::from(SyscallNum::NR_write));
+        let read = u64::from(u32::from(SyscallNum::NR_read));
+
+        let out = decode_to_string(&[
+            encode_header(write, ResultKind::Returned, 3, b"hi\n"),
+            encode_header(read, ResultKind::Failed, -2, &[]),
+            encode_header(read, ResultKind::Blocked, 0, &[]),
+            encode_header(100_000, ResultKind::Native, 0, &[]),
+        ]);
+
+        let lines: Vec<&str> = out.lines().collect();
+        assert_eq!(
+            lines,
+            [
+                "00:00:01.500000000 [tid 1000] write(0x1, \"hi\\n\"..., 0x3, 0x4, 0x5, 0x6) = 3",
+                "00:00:01.500000000 [tid 1000] read(0x1, 0x2, 0x3, 0x4, 0x5, 0x6) = -2 (ENOENT)",
+                "00:00:01.500000000 [tid 1000] read(0x1, 0x2, 0x3, 0x4, 0x5, 0x6) = <blocked>",
+                "00:00:01.500000000 [tid 1000] syscall(100000, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6) = <native>",
+            ]
+        );
+    }
+
+    #[test]
+    fn test_decode_truncated() {
+        let read = u64::from(u32::from(SyscallNum::NR_read));
+        let mut truncated = encode_header(read, ResultKind::Returned, 0, &[]);
+        truncated.truncate(50);
+
+        let out = decode_to_string(&[encode_header(read, ResultKind::Returned, 0, &[]), truncated]);
+        assert_eq!(out.lines().count(), 1);
+    }
+
+    #[test]
+    fn test_buffer_to_capture() {
+        let args = |number: SyscallNum, len: u64| SyscallArgs {
+            number: libc::c_long::from(u32::from(number)),
+            args: [0u64, 0x1000, len, 0, 0, 0].map(Into::into),
+        };
+        let ok = |x: i64| -> SyscallResult { Ok(x.into()) };
+        let len = |args: SyscallArgs, rv: SyscallResult| {
+            buffer_to_capture(&args, &rv).map(|(_, len)| len)
+        };
+
+        assert_eq!(len(args(SyscallNum::NR_read, 100), ok(10)), Some(10));
+        assert_eq!(len(args(SyscallNum::NR_write, 100), ok(10)), Some(100));
+        assert_eq!(len(args(SyscallNum::NR_connect, 16), ok(0)), Some(16));
+        assert_eq!(len(args(SyscallNum::NR_bind, 28), ok(0)), Some(28));
+        assert_eq!(len(args(SyscallNum::NR_getpid, 100), ok(0)), None);
+    }
+
+    #[test]
+    fn test_decode_bad_magic() {
+        let mut out = Vec::new();
+        assert!(decode(&b"notstrace"[..], &mut out).is_err());
+    }
+}
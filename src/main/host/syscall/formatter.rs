@@ -18,6 +18,16 @@ pub enum FmtOptions {
     Deterministic,
 }
 
+/// How the syscalls of a process are logged to its strace file.
+#[derive(Copy, Clone, Debug, PartialEq, Eq)]
+pub enum StraceOptions {
+    /// Each syscall is formatted as text when it's made.
+    Text(FmtOptions),
+    /// Each syscall is written as a binary record (see [`super::binary_strace`]), including up to
+    /// `buffer_prefix` bytes of the buffer read or written by the syscall.
+    Binary { buffer_prefix: usize },
+}
+
 // this type is required until we no longer need to access the format options from C
 #[derive(Copy, Clone, Debug, PartialEq, Eq)]
 #[repr(C)]
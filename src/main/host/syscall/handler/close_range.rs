@@ -58,10 +58,8 @@ impl SyscallHandler {
             // > rather than immediately closing them.
 
             // set the CLOEXEC flag on all descriptors in the range
-            for (fd, desc) in desc_table.iter_mut() {
-                if range.contains(fd) {
-                    desc.set_flags(desc.flags() | DescriptorFlags::FD_CLOEXEC);
-                }
+            for (_fd, desc) in desc_table.iter_range_mut(range) {
+                desc.set_flags(desc.flags() | DescriptorFlags::FD_CLOEXEC);
             }
         } else {
             // remove all descriptors in the range
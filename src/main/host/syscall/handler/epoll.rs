@@ -173,6 +173,27 @@ impl SyscallHandler {
                 return Err(Errno::EINVAL);
             };
 
+            if events.contains(EpollEvents::EPOLLEXCLUSIVE) {
+                // epoll_ctl(2): "EPOLLEXCLUSIVE may be used only in an EPOLL_CTL_ADD operation",
+                // it can't be used for epoll instances, and it can only be combined with a few
+                // other flags.
+                let allowed = EpollEvents::EPOLLIN
+                    | EpollEvents::EPOLLOUT
+                    | EpollEvents::EPOLLERR
+                    | EpollEvents::EPOLLHUP
+                    | EpollEvents::EPOLLWAKEUP
+                    | EpollEvents::EPOLLET
+                    | EpollEvents::EPOLLEXCLUSIVE;
+
+                if op != EpollCtlOp::EPOLL_CTL_ADD
+                    || matches!(target, File::Epoll(_))
+                    || !allowed.contains(events)
+                {
+                    log::debug!("Invalid use of EPOLLEXCLUSIVE with events {events:?}");
+                    return Err(Errno::EINVAL);
+                }
+            }
+
             // epoll_ctl(2): epoll always reports for EPOLLERR and EPOLLHUP
             events.insert(EpollEvents::EPOLLERR | EpollEvents::EPOLLHUP);
 
@@ -22,7 +22,7 @@
 // Helpers
 ///////////////////////////////////////////////////////////
 
-static SyscallReturn _syscallhandler_futexWaitHelper(SyscallHandler* sys,
+static SyscallReturn _syscallhandler_futexWaitHelper(SyscallHandler* sys, bool isPrivate,
                                                      UntypedForeignPtr futexVPtr, int expectedVal,
                                                      UntypedForeignPtr timeoutVPtr,
                                                      TimeoutType type) {
@@ -61,7 +61,7 @@ static SyscallReturn _syscallhandler_futexWaitHelper(SyscallHandler* sys,
 
     // Convert the virtual ptr to a physical ptr that can uniquely identify the futex
     ManagedPhysicalMemoryAddr futexPPtr =
-        process_getPhysicalAddress(rustsyscallhandler_getProcess(sys), futexVPtr);
+        process_getFutexAddress(rustsyscallhandler_getProcess(sys), futexVPtr, isPrivate);
 
     // Check if we already have a futex
     FutexTable* ftable = host_getFutexTable(rustsyscallhandler_getHost(sys));
@@ -127,11 +127,12 @@ static SyscallReturn _syscallhandler_futexWaitHelper(SyscallHandler* sys,
     return syscallreturn_makeBlocked(cond, true);
 }
 
-static SyscallReturn _syscallhandler_futexWakeHelper(SyscallHandler* sys,
-                                                     UntypedForeignPtr futexVPtr, int numWakeups) {
+// Wakes at most `numWakeups` threads waiting on the futex word at `futexVPtr`.
+static unsigned int _syscallhandler_futexWake(SyscallHandler* sys, bool isPrivate,
+                                              UntypedForeignPtr futexVPtr, int numWakeups) {
     // Convert the virtual ptr to a physical ptr that can uniquely identify the futex
     ManagedPhysicalMemoryAddr futexPPtr =
-        process_getPhysicalAddress(rustsyscallhandler_getProcess(sys), futexVPtr);
+        process_getFutexAddress(rustsyscallhandler_getProcess(sys), futexVPtr, isPrivate);
 
     // Lookup the futex in the futex table
     FutexTable* ftable = host_getFutexTable(rustsyscallhandler_getHost(sys));
@@ -146,6 +147,140 @@ static SyscallReturn _syscallhandler_futexWakeHelper(SyscallHandler* sys,
         trace("Futex was able to perform %i/%i wakeups", numWoken, numWakeups);
     }
 
+    return numWoken;
+}
+
+static SyscallReturn _syscallhandler_futexWakeHelper(SyscallHandler* sys, bool isPrivate,
+                                                     UntypedForeignPtr futexVPtr, int numWakeups) {
+    return syscallreturn_makeDoneU64(
+        _syscallhandler_futexWake(sys, isPrivate, futexVPtr, numWakeups));
+}
+
+static SyscallReturn _syscallhandler_futexRequeueHelper(SyscallHandler* sys, bool isPrivate,
+                                                        UntypedForeignPtr futexVPtr, int numWakeups,
+                                                        int numRequeues,
+                                                        UntypedForeignPtr futex2VPtr, bool compare,
+                                                        int expectedVal) {
+    if (numWakeups < 0 || numRequeues < 0) {
+        return syscallreturn_makeDoneErrno(EINVAL);
+    }
+
+    if (compare) {
+        // Like FUTEX_WAIT, we don't need an atomic compare since no other plugin thread runs.
+        uint32_t futexVal;
+        int result = process_readPtr(
+            rustsyscallhandler_getProcess(sys), &futexVal, futexVPtr, sizeof(futexVal));
+        if (result) {
+            warning("Couldn't read futex address %p", (void*)futexVPtr.val);
+            return syscallreturn_makeDoneErrno(-result);
+        }
+        if (futexVal != (uint32_t)expectedVal) {
+            trace("Futex values don't match, try again later");
+            return syscallreturn_makeDoneErrno(EAGAIN);
+        }
+    }
+
+    ManagedPhysicalMemoryAddr futexPPtr =
+        process_getFutexAddress(rustsyscallhandler_getProcess(sys), futexVPtr, isPrivate);
+    FutexTable* ftable = host_getFutexTable(rustsyscallhandler_getHost(sys));
+    Futex* futex = futextable_get(ftable, futexPPtr);
+
+    if (futex == NULL) {
+        // Nobody is waiting, so there is nothing to wake or requeue.
+        return syscallreturn_makeDoneU64(0);
+    }
+
+    futex_ref(futex);
+
+    unsigned int numWoken = numWakeups > 0 ? futex_wake(futex, (unsigned int)numWakeups) : 0;
+    unsigned int numRequeued = 0;
+
+    if (numRequeues > 0 && futex_getWaiterCount(futex) > 0) {
+        ManagedPhysicalMemoryAddr futex2PPtr =
+            process_getFutexAddress(rustsyscallhandler_getProcess(sys), futex2VPtr, isPrivate);
+        Futex* futex2 = futextable_get(ftable, futex2PPtr);
+
+        // The requeued threads now wait on futex2, so it needs to exist.
+        if (futex2 == NULL) {
+            trace("Dynamically created a new futex object for futex addr %p",
+                  (void*)futex2PPtr.val);
+            futex2 = futex_new(futex2PPtr);
+            bool success = futextable_add(ftable, futex2);
+            utility_debugAssert(success);
+        }
+
+        numRequeued = futex_requeue(futex, futex2, (unsigned int)numRequeues);
+    }
+
+    trace("Futex %p woke %u and requeued %u threads", (void*)futexPPtr.val, numWoken,
+          numRequeued);
+
+    futex_unref(futex);
+
+    // Only FUTEX_CMP_REQUEUE counts the requeued threads in its result.
+    return syscallreturn_makeDoneU64(compare ? numWoken + numRequeued : numWoken);
+}
+
+static SyscallReturn _syscallhandler_futexWakeOpHelper(SyscallHandler* sys, bool isPrivate,
+                                                       UntypedForeignPtr futexVPtr, int numWakeups,
+                                                       int numWakeups2,
+                                                       UntypedForeignPtr futex2VPtr,
+                                                       int encodedOp) {
+    // See FUTEX_OP in linux/futex.h for the encoding.
+    int op = (encodedOp >> 28) & 0xf;
+    int cmp = (encodedOp >> 24) & 0xf;
+    // Both args are 12-bit signed values.
+    int oparg = (int)((uint32_t)encodedOp << 8) >> 20;
+    int cmparg = (int)((uint32_t)encodedOp << 20) >> 20;
+
+    if (op & FUTEX_OP_OPARG_SHIFT) {
+        // Linux also only uses the low 5 bits of the shift.
+        oparg = (int)(1u << (oparg & 31));
+        op &= ~FUTEX_OP_OPARG_SHIFT;
+    }
+
+    // Like FUTEX_WAIT, we don't need an atomic operation since no other plugin thread runs.
+    int oldVal;
+    int result =
+        process_readPtr(rustsyscallhandler_getProcess(sys), &oldVal, futex2VPtr, sizeof(oldVal));
+    if (result) {
+        warning("Couldn't read futex address %p", (void*)futex2VPtr.val);
+        return syscallreturn_makeDoneErrno(-result);
+    }
+
+    int newVal;
+    switch (op) {
+        case FUTEX_OP_SET: newVal = oparg; break;
+        case FUTEX_OP_ADD: newVal = (int)((uint32_t)oldVal + (uint32_t)oparg); break;
+        case FUTEX_OP_OR: newVal = oldVal | oparg; break;
+        case FUTEX_OP_ANDN: newVal = oldVal & ~oparg; break;
+        case FUTEX_OP_XOR: newVal = oldVal ^ oparg; break;
+        default: return syscallreturn_makeDoneErrno(ENOSYS);
+    }
+
+    bool doWake2;
+    switch (cmp) {
+        case FUTEX_OP_CMP_EQ: doWake2 = oldVal == cmparg; break;
+        case FUTEX_OP_CMP_NE: doWake2 = oldVal != cmparg; break;
+        case FUTEX_OP_CMP_LT: doWake2 = oldVal < cmparg; break;
+        case FUTEX_OP_CMP_LE: doWake2 = oldVal <= cmparg; break;
+        case FUTEX_OP_CMP_GT: doWake2 = oldVal > cmparg; break;
+        case FUTEX_OP_CMP_GE: doWake2 = oldVal >= cmparg; break;
+        default: return syscallreturn_makeDoneErrno(ENOSYS);
+    }
+
+    result =
+        process_writePtr(rustsyscallhandler_getProcess(sys), futex2VPtr, &newVal, sizeof(newVal));
+    if (result) {
+        warning("Couldn't write futex address %p", (void*)futex2VPtr.val);
+        return syscallreturn_makeDoneErrno(-result);
+    }
+
+    unsigned int numWoken = _syscallhandler_futexWake(sys, isPrivate, futexVPtr, numWakeups);
+    if (doWake2) {
+        numWoken += _syscallhandler_futexWake(sys, isPrivate, futex2VPtr, numWakeups2);
+    }
+
     return syscallreturn_makeDoneU64(numWoken);
 }
 
@@ -153,10 +288,9 @@ static SyscallReturn _syscallhandler_futexWakeHelper(SyscallHandler* sys,
 // System Calls
 ///////////////////////////////////////////////////////////
 
-// TODO: currently only supports uaddr from the same virtual address space (i.e., threads)
-// Support across different address spaces requires us to compute a unique id from the
-// hardware address (i.e., page table and offset). This is needed, e.g., when using
-// futexes across process boundaries.
+// Like in Linux, the futexes of operations without FUTEX_PRIVATE_FLAG are identified by the memory
+// that their words are in, so processes can share a futex in a shared mapping even if they map it
+// at different addresses. See `process_getFutexAddress`.
 SyscallReturn syscallhandler_futex(SyscallHandler* sys, const SyscallArgs* args) {
     utility_debugAssert(sys && args);
 
@@ -170,6 +304,7 @@ SyscallReturn syscallhandler_futex(SyscallHandler* sys, const SyscallArgs* args)
     const int possible_options = FUTEX_PRIVATE_FLAG | FUTEX_CLOCK_REALTIME;
     int options = futex_op & possible_options;
     int operation = futex_op & ~possible_options;
+    bool isPrivate = (options & FUTEX_PRIVATE_FLAG) != 0;
 
     trace("futex called with addr=%p op=%i (operation=%i and options=%i) and val=%i",
           (void*)uaddrptr.val, futex_op, operation, options, val);
@@ -178,19 +313,19 @@ SyscallReturn syscallhandler_futex(SyscallHandler* sys, const SyscallArgs* args)
         case FUTEX_WAIT: {
             trace("Handling FUTEX_WAIT operation %i", operation);
             return _syscallhandler_futexWaitHelper(
-                sys, uaddrptr, val, timeoutptr, TIMEOUT_RELATIVE);
+                sys, isPrivate, uaddrptr, val, timeoutptr, TIMEOUT_RELATIVE);
         }
 
         case FUTEX_WAKE: {
             trace("Handling FUTEX_WAKE operation %i", operation);
-            return _syscallhandler_futexWakeHelper(sys, uaddrptr, val);
+            return _syscallhandler_futexWakeHelper(sys, isPrivate, uaddrptr, val);
         }
 
         case FUTEX_WAIT_BITSET: {
             trace("Handling FUTEX_WAIT_BITSET operation %i bitset %d", operation, val3);
             if (val3 == FUTEX_BITSET_MATCH_ANY) {
                 return _syscallhandler_futexWaitHelper(
-                    sys, uaddrptr, val, timeoutptr, TIMEOUT_ABSOLUTE);
+                    sys, isPrivate, uaddrptr, val, timeoutptr, TIMEOUT_ABSOLUTE);
             }
             // Other bitsets not yet handled.
             break;
@@ -198,15 +333,36 @@ SyscallReturn syscallhandler_futex(SyscallHandler* sys, const SyscallArgs* args)
         case FUTEX_WAKE_BITSET: {
             trace("Handling FUTEX_WAKE_BITSET operation %i bitset %d", operation, val3);
             if (val3 == FUTEX_BITSET_MATCH_ANY) {
-                return _syscallhandler_futexWakeHelper(sys, uaddrptr, val);
+                return _syscallhandler_futexWakeHelper(sys, isPrivate, uaddrptr, val);
             }
             // Other bitsets not yet handled.
             break;
         }
 
+        case FUTEX_REQUEUE: {
+            trace("Handling FUTEX_REQUEUE operation %i", operation);
+            // The requeue limit is passed in place of the timeout.
+            int numRequeues = (int)args->args[3].as_u64;
+            return _syscallhandler_futexRequeueHelper(
+                sys, isPrivate, uaddrptr, val, numRequeues, uaddr2ptr, false, 0);
+        }
+
+        case FUTEX_CMP_REQUEUE: {
+            trace("Handling FUTEX_CMP_REQUEUE operation %i", operation);
+            int numRequeues = (int)args->args[3].as_u64;
+            return _syscallhandler_futexRequeueHelper(
+                sys, isPrivate, uaddrptr, val, numRequeues, uaddr2ptr, true, val3);
+        }
+
+        case FUTEX_WAKE_OP: {
+            trace("Handling FUTEX_WAKE_OP operation %i op %d", operation, val3);
+            // The second wakeup limit is passed in place of the timeout.
+            int numWakeups2 = (int)args->args[3].as_u64;
+            return _syscallhandler_futexWakeOpHelper(
+                sys, isPrivate, uaddrptr, val, numWakeups2, uaddr2ptr, val3);
+        }
+
         case FUTEX_FD:
-        case FUTEX_REQUEUE:
-        case FUTEX_WAKE_OP:
         case FUTEX_LOCK_PI:
         case FUTEX_TRYLOCK_PI:
         case FUTEX_UNLOCK_PI:
@@ -1,28 +1,33 @@
 use std::borrow::Cow;
-
-#[cfg(feature = "perf_timers")]
-use std::time::Duration;
+use std::ffi::{CString, OsStr};
+use std::os::unix::ffi::{OsStrExt, OsStringExt};
+use std::path::Path;
+use std::time::{Duration, Instant};
 
 use linux_api::errno::Errno;
 use linux_api::syscall::SyscallNum;
 use shadow_shim_helper_rs::simulation_time::SimulationTime;
+use shadow_shim_helper_rs::syscall_types::ForeignPtr;
 use shadow_shim_helper_rs::syscall_types::SyscallArgs;
 use shadow_shim_helper_rs::syscall_types::SyscallReg;
 use shadow_shim_helper_rs::util::SendPointer;
 use shadow_shim_helper_rs::HostId;
 
 use crate::core::worker::Worker;
+use crate::core::worker_trace;
 use crate::cshadow as c;
 use crate::host::context::ThreadContext;
 use crate::host::descriptor::descriptor_table::{DescriptorHandle, DescriptorTable};
-use crate::host::descriptor::Descriptor;
+use crate::host::descriptor::{CompatFile, Descriptor, File, FileState, FileStatus};
 use crate::host::process::ProcessId;
 use crate::host::syscall::formatter::log_syscall_simple;
 use crate::host::syscall::is_shadow_syscall;
+use crate::host::syscall::types::ForeignArrayPtr;
 use crate::host::syscall::types::SyscallReturn;
 use crate::host::syscall::types::{SyscallError, SyscallResult};
 use crate::host::thread::ThreadId;
 use crate::utility::counter::Counter;
+use crate::utility::histogram::LatencyHistograms;
 
 #[cfg(feature = "perf_timers")]
 use crate::utility::perf_timer::PerfTimer;
@@ -43,6 +48,7 @@ mod random;
 mod resource;
 mod sched;
 mod select;
+mod sendfile;
 mod shadow;
 mod signal;
 mod socket;
@@ -57,6 +63,95 @@ mod wait;
 type LegacySyscallFn =
     unsafe extern "C-unwind" fn(*mut SyscallHandler, *const SyscallArgs) -> SyscallReturn;
 
+/// The syscalls in [`NATIVE_SYSCALLS`] that can create a path that a lookup
+/// previously didn't find, and so must invalidate the host's missing-path
+/// cache. They must reach Shadow while the cache is enabled, so they can't be
+/// passed through to the kernel by the shim.
+pub const NATIVE_PATH_CREATING_SYSCALLS: &[SyscallNum] = &[
+    SyscallNum::NR_link,
+    SyscallNum::NR_mkdir,
+    SyscallNum::NR_mknod,
+    SyscallNum::NR_rename,
+    SyscallNum::NR_symlink,
+];
+
+/// Syscalls that Shadow doesn't emulate, and instead has the managed process
+/// execute natively.
+pub const NATIVE_SYSCALLS: &[SyscallNum] = &[
+    SyscallNum::NR_access,
+    SyscallNum::NR_arch_prctl,
+    SyscallNum::NR_chmod,
+    SyscallNum::NR_chown,
+    SyscallNum::NR_exit,
+    SyscallNum::NR_getcwd,
+    SyscallNum::NR_geteuid,
+    SyscallNum::NR_getegid,
+    SyscallNum::NR_getgid,
+    SyscallNum::NR_getgroups,
+    SyscallNum::NR_getresgid,
+    SyscallNum::NR_getresuid,
+    SyscallNum::NR_getrlimit,
+    SyscallNum::NR_getuid,
+    SyscallNum::NR_getxattr,
+    SyscallNum::NR_lchown,
+    SyscallNum::NR_lgetxattr,
+    SyscallNum::NR_link,
+    SyscallNum::NR_listxattr,
+    SyscallNum::NR_llistxattr,
+    SyscallNum::NR_lremovexattr,
+    SyscallNum::NR_lsetxattr,
+    SyscallNum::NR_lstat,
+    SyscallNum::NR_madvise,
+    SyscallNum::NR_mkdir,
+    SyscallNum::NR_mknod,
+    SyscallNum::NR_readlink,
+    SyscallNum::NR_removexattr,
+    SyscallNum::NR_rename,
+    SyscallNum::NR_rmdir,
+    SyscallNum::NR_rt_sigreturn,
+    SyscallNum::NR_setfsgid,
+    SyscallNum::NR_setfsuid,
+    SyscallNum::NR_setgid,
+    SyscallNum::NR_setregid,
+    SyscallNum::NR_setresgid,
+    SyscallNum::NR_setresuid,
+    SyscallNum::NR_setreuid,
+    SyscallNum::NR_setrlimit,
+    SyscallNum::NR_setuid,
+    SyscallNum::NR_setxattr,
+    SyscallNum::NR_stat,
+    SyscallNum::NR_statfs,
+    SyscallNum::NR_symlink,
+    SyscallNum::NR_truncate,
+    SyscallNum::NR_unlink,
+    SyscallNum::NR_utime,
+    SyscallNum::NR_utimes,
+];
+
+/// The file cache maps files, and reading a mapping past the end of a truncated file raises
+/// SIGBUS, so its contents of the file that a native `truncate` is about to truncate must stop
+/// being read first. If the path can't be read, the syscall fails without truncating anything.
+fn invalidate_cached_file_before_truncate(ctx: &SyscallContext) {
+    let mut path_buf = [0u8; linux_api::limits::PATH_MAX];
+    let path_buf_capacity = path_buf.len();
+    let path_ptr = ForeignPtr::<u8>::from(ctx.args.get(0));
+    let Ok(path) = ctx.objs.process.memory_borrow().copy_str_from_ptr(
+        &mut path_buf,
+        ForeignArrayPtr::new(path_ptr, path_buf_capacity),
+    ) else {
+        return;
+    };
+
+    let path = Path::new(OsStr::from_bytes(path.to_bytes()));
+    let cwd = ctx.objs.process.current_working_dir();
+    let cwd = Path::new(OsStr::from_bytes(cwd.to_bytes()));
+    let Ok(abs_path) = CString::new(cwd.join(path).into_os_string().into_vec()) else {
+        return;
+    };
+
+    Worker::invalidate_cached_file(&abs_path);
+}
+
 // Will eventually contain syscall handler state once migrated from the c handler
 pub struct SyscallHandler {
     /// The host that this `SyscallHandler` belongs to. Intended to be used for logging.
@@ -69,6 +164,14 @@ pub struct SyscallHandler {
     num_syscalls: u64,
     /// A counter for individual syscalls.
     syscall_counter: Option<Counter>,
+    /// A counter for syscalls that are executed natively, keyed by plugin
+    /// and syscall name.
+    native_syscall_counter: Option<Counter>,
+    /// Histograms of the wall-clock time spent handling individual syscalls.
+    syscall_latencies: Option<LatencyHistograms>,
+    /// The wall-clock time spent handling the current syscall so far, including previous calls
+    /// that ended up blocking. Only updated if `syscall_latencies` is enabled.
+    latency_current: Duration,
     /// If we are currently blocking a specific syscall, i.e., waiting for a socket to be
     /// readable/writable or waiting for a timeout, the syscall number of that function is stored
     /// here. Will be `None` if a syscall is not currently blocked.
@@ -95,6 +198,7 @@ impl SyscallHandler {
         process_id: ProcessId,
         thread_id: ThreadId,
         count_syscalls: bool,
+        record_syscall_latencies: bool,
     ) -> SyscallHandler {
         SyscallHandler {
             host_id,
@@ -102,6 +206,9 @@ impl SyscallHandler {
             thread_id,
             num_syscalls: 0,
             syscall_counter: count_syscalls.then(Counter::new),
+            native_syscall_counter: count_syscalls.then(Counter::new),
+            syscall_latencies: record_syscall_latencies.then(LatencyHistograms::new),
+            latency_current: Duration::ZERO,
             blocked_syscall: None,
             pending_result: None,
             epoll: unsafe { SendPointer::new(c::epoll_new()) },
@@ -169,8 +276,44 @@ impl SyscallHandler {
         #[cfg(feature = "perf_timers")]
         let timer = PerfTimer::new();
 
+        let latency_start = self.syscall_latencies.is_some().then(Instant::now);
+        let trace_start = worker_trace::is_enabled().then(Instant::now);
+
         let mut rv = self.run_handler(ctx, args);
 
+        // show syscalls that took a long time to handle in the worker trace
+        if let Some(trace_start) = trace_start {
+            let trace_end = Instant::now();
+            if trace_end - trace_start >= worker_trace::LONG_SYSCALL {
+                worker_trace::span(
+                    Worker::worker_id().unwrap().0,
+                    syscall_name,
+                    trace_start,
+                    trace_end,
+                    &[("host_id", u32::from(self.host_id).into())],
+                );
+            }
+        }
+
+        Self::update_read_would_block(ctx, syscall, args, &rv);
+
+        // log the syscall if binary strace logging is enabled; text logging is done by the handler
+        ctx.process.with_binary_strace(|writer| {
+            writer
+                .write_record(
+                    Worker::current_time().unwrap(),
+                    ctx.thread.id(),
+                    args,
+                    &rv,
+                    &ctx.process.memory_borrow(),
+                )
+                .unwrap();
+        });
+
+        if let Some(latency_start) = latency_start {
+            self.latency_current += latency_start.elapsed();
+        }
+
         #[cfg(feature = "perf_timers")]
         {
             // add the cumulative elapsed seconds
@@ -187,6 +330,12 @@ impl SyscallHandler {
         if !matches!(rv, Err(SyscallError::Blocked(_))) {
             // the syscall completed, count it and the cumulative time to complete it
             self.num_syscalls += 1;
+            ctx.host.count_syscall();
+
+            if let Some(syscall_latencies) = self.syscall_latencies.as_mut() {
+                syscall_latencies.record(syscall_name, self.latency_current);
+                self.latency_current = Duration::ZERO;
+            }
 
             #[cfg(feature = "perf_timers")]
             {
@@ -247,6 +396,8 @@ impl SyscallHandler {
             if is_unblocked_signal_pending {
                 // return EINTR instead
                 rv = Err(SyscallError::new_interrupted(blocked.restartable));
+                // the interrupted syscall won't be resumed, so don't carry its time over
+                self.latency_current = Duration::ZERO;
             }
         }
 
@@ -265,7 +416,10 @@ impl SyscallHandler {
                 .expect("flushing syscall ptrs");
         }
 
-        if ctx.host.shim_shmem().model_unblocked_syscall_latency
+        // The shim's native preemption timer charges its latency directly and then yields with
+        // a shadow syscall, so we also need to apply the latency here when that's enabled.
+        let model_unblocked_syscall_latency = ctx.host.shim_shmem().model_unblocked_syscall_latency;
+        if (model_unblocked_syscall_latency || ctx.host.shim_shmem().native_preemption_enabled)
             && ctx.process.is_running()
             && !matches!(rv, Err(SyscallError::Blocked(_)))
         {
@@ -274,7 +428,7 @@ impl SyscallHandler {
             // increment unblocked syscall latency, but only for non-shadow-syscalls, since the
             // latter are part of Shadow's internal plumbing; they shouldn't necessarily "consume"
             // time
-            if !is_shadow_syscall(syscall) {
+            if model_unblocked_syscall_latency && !is_shadow_syscall(syscall) {
                 ctx.host
                     .shim_shmem_lock_borrow_mut()
                     .unwrap()
@@ -470,6 +624,7 @@ impl SyscallHandler {
             SyscallNum::NR_readlinkat => handle!(readlinkat),
             SyscallNum::NR_readv => handle!(readv),
             SyscallNum::NR_recvfrom => handle!(recvfrom),
+            SyscallNum::NR_recvmmsg => handle!(recvmmsg),
             SyscallNum::NR_recvmsg => handle!(recvmsg),
             SyscallNum::NR_renameat => handle!(renameat),
             SyscallNum::NR_renameat2 => handle!(renameat2),
@@ -479,6 +634,8 @@ impl SyscallHandler {
             SyscallNum::NR_sched_getaffinity => handle!(sched_getaffinity),
             SyscallNum::NR_sched_setaffinity => handle!(sched_setaffinity),
             SyscallNum::NR_select => handle!(select),
+            SyscallNum::NR_sendfile => handle!(sendfile),
+            SyscallNum::NR_sendmmsg => handle!(sendmmsg),
             SyscallNum::NR_sendmsg => handle!(sendmsg),
             SyscallNum::NR_sendto => handle!(sendto),
             SyscallNum::NR_set_robust_list => handle!(set_robust_list),
@@ -530,56 +687,25 @@ impl SyscallHandler {
             //
             // NATIVE LINUX-HANDLED SYSCALLS
             //
-            SyscallNum::NR_access
-            | SyscallNum::NR_arch_prctl
-            | SyscallNum::NR_chmod
-            | SyscallNum::NR_chown
-            | SyscallNum::NR_exit
-            | SyscallNum::NR_getcwd
-            | SyscallNum::NR_geteuid
-            | SyscallNum::NR_getegid
-            | SyscallNum::NR_getgid
-            | SyscallNum::NR_getgroups
-            | SyscallNum::NR_getresgid
-            | SyscallNum::NR_getresuid
-            | SyscallNum::NR_getrlimit
-            | SyscallNum::NR_getuid
-            | SyscallNum::NR_getxattr
-            | SyscallNum::NR_lchown
-            | SyscallNum::NR_lgetxattr
-            | SyscallNum::NR_link
-            | SyscallNum::NR_listxattr
-            | SyscallNum::NR_llistxattr
-            | SyscallNum::NR_lremovexattr
-            | SyscallNum::NR_lsetxattr
-            | SyscallNum::NR_lstat
-            | SyscallNum::NR_madvise
-            | SyscallNum::NR_mkdir
-            | SyscallNum::NR_mknod
-            | SyscallNum::NR_readlink
-            | SyscallNum::NR_removexattr
-            | SyscallNum::NR_rename
-            | SyscallNum::NR_rmdir
-            | SyscallNum::NR_rt_sigreturn
-            | SyscallNum::NR_setfsgid
-            | SyscallNum::NR_setfsuid
-            | SyscallNum::NR_setgid
-            | SyscallNum::NR_setregid
-            | SyscallNum::NR_setresgid
-            | SyscallNum::NR_setresuid
-            | SyscallNum::NR_setreuid
-            | SyscallNum::NR_setrlimit
-            | SyscallNum::NR_setuid
-            | SyscallNum::NR_setxattr
-            | SyscallNum::NR_stat
-            | SyscallNum::NR_statfs
-            | SyscallNum::NR_symlink
-            | SyscallNum::NR_truncate
-            | SyscallNum::NR_unlink
-            | SyscallNum::NR_utime
-            | SyscallNum::NR_utimes => {
+            syscall if NATIVE_SYSCALLS.contains(&syscall) => {
                 log::trace!("Native syscall {} ({})", syscall_name, ctx.args.number);
 
+                if let Some(native_syscall_counter) = ctx.handler.native_syscall_counter.as_mut() {
+                    native_syscall_counter.add_one(&format!(
+                        "{}:{}",
+                        &*ctx.objs.process.plugin_name(),
+                        syscall_name
+                    ));
+                }
+
+                if NATIVE_PATH_CREATING_SYSCALLS.contains(&syscall) {
+                    ctx.objs.host.clear_missing_paths();
+                }
+
+                if syscall == SyscallNum::NR_truncate {
+                    invalidate_cached_file_before_truncate(ctx);
+                }
+
                 let rv = Err(SyscallError::Native);
 
                 log_syscall_simple(
@@ -633,6 +759,95 @@ impl SyscallHandler {
         }
     }
 
+    /// Keeps the shim's record of descriptors that non-blocking reads fail on (see
+    /// `ProcessShmem::read_would_block`) up to date after handling `syscall`, so that the shim can
+    /// fail repeated reads of empty non-blocking sockets and pipes without a round trip to Shadow.
+    #[allow(non_upper_case_globals)]
+    fn update_read_would_block(
+        ctx: &ThreadContext,
+        syscall: SyscallNum,
+        args: &SyscallArgs,
+        rv: &SyscallResult,
+    ) {
+        const NR_shadow_yield: SyscallNum = SyscallNum::new(c::ShadowSyscallNum_SYS_shadow_yield);
+
+        let host_shmem = ctx.host.shim_shmem();
+
+        match syscall {
+            SyscallNum::NR_read | SyscallNum::NR_recvfrom => {}
+            // Syscalls that can't change which file a descriptor refers to, a file's status flags,
+            // or how a read of an unreadable file behaves. Any changes to the state of a file that
+            // they cause are covered by `StateEventSource::notify_listeners`.
+            SyscallNum::NR_readv
+            | SyscallNum::NR_pread64
+            | SyscallNum::NR_preadv
+            | SyscallNum::NR_preadv2
+            | SyscallNum::NR_write
+            | SyscallNum::NR_writev
+            | SyscallNum::NR_pwrite64
+            | SyscallNum::NR_pwritev
+            | SyscallNum::NR_pwritev2
+            | SyscallNum::NR_sendto
+            | SyscallNum::NR_sendmsg
+            | SyscallNum::NR_sendmmsg
+            | SyscallNum::NR_epoll_wait
+            | SyscallNum::NR_epoll_pwait
+            | SyscallNum::NR_epoll_pwait2
+            | SyscallNum::NR_poll
+            | SyscallNum::NR_ppoll
+            | SyscallNum::NR_select
+            | SyscallNum::NR_pselect6
+            | SyscallNum::NR_nanosleep
+            | SyscallNum::NR_clock_nanosleep
+            | SyscallNum::NR_clock_gettime
+            | SyscallNum::NR_gettimeofday
+            | SyscallNum::NR_time
+            | SyscallNum::NR_futex
+            | SyscallNum::NR_sched_yield
+            | NR_shadow_yield => return,
+            _ => {
+                host_shmem.file_state_changed();
+                return;
+            }
+        }
+
+        // only remember reads that the shim can answer the same way (see `shim_sys.c`)
+        let Err(SyscallError::Failed(failed)) = rv else {
+            return;
+        };
+        if failed.errno != Errno::EAGAIN || usize::from(args.get(2)) == 0 {
+            return;
+        }
+        if syscall == SyscallNum::NR_recvfrom && i32::from(args.get(3)) & !libc::MSG_DONTWAIT != 0 {
+            return;
+        }
+
+        let fd = i32::from(args.get(0));
+        let desc_table = ctx.thread.descriptor_table_borrow(ctx.host);
+        let Ok(desc) = Self::get_descriptor(&desc_table, fd) else {
+            return;
+        };
+        let CompatFile::New(file) = desc.file() else {
+            return;
+        };
+
+        // A blocking read of these waits for them to become readable, so a read that failed with
+        // `EAGAIN` while the file wasn't readable will keep failing until the file's state changes.
+        if !matches!(file.inner_file(), File::Socket(_) | File::Pipe(_)) {
+            return;
+        }
+        let file = file.inner_file().borrow();
+        if !file.status().contains(FileStatus::NONBLOCK)
+            || file.state().contains(FileState::READABLE)
+        {
+            return;
+        }
+
+        ctx.process
+            .shmem()
+            .set_read_would_block(fd, host_shmem.file_state_epoch());
+    }
+
     /// Did the last syscall result in `SyscallError::Blocked`? If called from a syscall handler and
     /// `is_blocked()` returns `true`, then the current syscall is the same syscall that previously
     /// blocked. For example, if currently running the `connect` syscall handler and `is_blocked()`
@@ -720,6 +935,14 @@ impl std::ops::Drop for SyscallHandler {
             Worker::add_syscall_counts(syscall_counter);
         }
 
+        if let Some(native_syscall_counter) = self.native_syscall_counter.as_ref() {
+            Worker::add_native_syscall_counts(native_syscall_counter);
+        }
+
+        if let Some(syscall_latencies) = self.syscall_latencies.as_ref() {
+            Worker::add_syscall_latencies(syscall_latencies);
+        }
+
         unsafe { c::legacyfile_unref(self.epoll.ptr() as *mut std::ffi::c_void) };
     }
 }
@@ -8,6 +8,9 @@
 #include <errno.h>
 #include <poll.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <sys/uio.h>
 
 #include "lib/logger/logger.h"
 #include "main/bindings/c/bindings.h"
@@ -92,8 +95,10 @@ static int _syscallhandler_getPollEvents(SyscallHandler* sys, struct pollfd* fds
 }
 
 static void _syscallhandler_registerPollFDs(SyscallHandler* sys, struct pollfd* fds, nfds_t nfds) {
-    // Epoll should already be clear, but let's make sure
-    epoll_reset(rustsyscallhandler_getEpoll(sys));
+    // The epoll still holds the watches of the previous call, and event loops usually poll the
+    // same fds every time, so we only update the watches of fds that changed.
+    Epoll* epoll = rustsyscallhandler_getEpoll(sys);
+    epoll_beginWatchSync(epoll);
 
     for (nfds_t i = 0; i < nfds; i++) {
         struct pollfd* pfd = &fds[i];
@@ -115,10 +120,11 @@ static void _syscallhandler_registerPollFDs(SyscallHandler* sys, struct pollfd*
         }
 
         if (epev.events) {
-            epoll_control(rustsyscallhandler_getEpoll(sys), EPOLL_CTL_ADD, pfd->fd, desc, &epev,
-                          rustsyscallhandler_getHost(sys));
+            epoll_syncWatch(epoll, pfd->fd, desc, &epev, rustsyscallhandler_getHost(sys));
         }
     }
+
+    epoll_endWatchSync(epoll);
 }
 
 SyscallReturn _syscallhandler_pollHelper(SyscallHandler* sys, struct pollfd* fds, nfds_t nfds,
@@ -166,25 +172,88 @@ SyscallReturn _syscallhandler_pollHelper(SyscallHandler* sys, struct pollfd* fds
     // We have events now and we've already written them to fds_ptr
     trace("poll returning %i ready events now", num_ready);
 done:
-    // Clear epoll for the next poll
-    epoll_reset(rustsyscallhandler_getEpoll(sys));
+    // Keep the watches for the next poll, but don't let them notify us until then
+    epoll_pauseWatches(rustsyscallhandler_getEpoll(sys));
     return syscallreturn_makeDoneI64(num_ready);
 }
 
+// Writes back the `revents` of the entries of `fds` that differ from `old_revents`. Returns 0 on
+// success.
+static int _syscallhandler_pollWriteRevents(const Process* proc, UntypedForeignPtr fds_ptr,
+                                            const struct pollfd* fds, const short* old_revents,
+                                            nfds_t nfds) {
+    // Event loops usually poll many fds of which few are ready, so few entries change. We write
+    // those with a single syscall, or the whole array if there are too many for that.
+    UntypedForeignPtr dsts[UIO_MAXIOV];
+    size_t lens[UIO_MAXIOV];
+    short revents[UIO_MAXIOV];
+    size_t num_changed = 0;
+
+    for (nfds_t i = 0; i < nfds; i++) {
+        if (fds[i].revents == old_revents[i]) {
+            continue;
+        }
+        if (num_changed == UIO_MAXIOV) {
+            return process_writePtr(proc, fds_ptr, fds, nfds * sizeof(*fds));
+        }
+        dsts[num_changed] = (UntypedForeignPtr){
+            .val = fds_ptr.val + i * sizeof(*fds) + offsetof(struct pollfd, revents)};
+        lens[num_changed] = sizeof(fds[i].revents);
+        revents[num_changed] = fds[i].revents;
+        num_changed++;
+    }
+
+    if (num_changed == 0) {
+        return 0;
+    }
+    return process_writePtrs(proc, dsts, lens, num_changed, revents);
+}
+
 static SyscallReturn _syscallhandler_pollHelperUntypedForeignPtr(SyscallHandler* sys,
                                                                  UntypedForeignPtr fds_ptr,
                                                                  nfds_t nfds,
                                                                  const struct timespec* timeout) {
-    // Get the pollfd struct in our memory so we can read from and write to it.
-    struct pollfd* fds = NULL;
-    if (nfds > 0) {
-        fds = process_getMutablePtr(rustsyscallhandler_getProcess(sys), fds_ptr, nfds * sizeof(*fds));
+    if (nfds == 0) {
+        return _syscallhandler_pollHelper(sys, NULL, nfds, timeout);
+    }
+
+    const Process* proc = rustsyscallhandler_getProcess(sys);
+    size_t fds_size = nfds * sizeof(struct pollfd);
+
+    // If the pollfd array is mapped into our memory, we can read from and write to it in place.
+    if (process_isMemoryMapped(proc, fds_ptr, fds_size)) {
+        struct pollfd* fds = process_getMutablePtr(proc, fds_ptr, fds_size);
         if (!fds) {
             return syscallreturn_makeDoneErrno(EFAULT);
         }
+        return _syscallhandler_pollHelper(sys, fds, nfds, timeout);
+    }
+
+    // Otherwise work on a copy, and write back only the results that changed.
+    struct pollfd* fds = malloc(fds_size);
+    short* old_revents = malloc(nfds * sizeof(*old_revents));
+    SyscallReturn scr;
+
+    if (process_readPtr(proc, fds, fds_ptr, fds_size) != 0) {
+        scr = syscallreturn_makeDoneErrno(EFAULT);
+        goto done;
     }
+    for (nfds_t i = 0; i < nfds; i++) {
+        old_revents[i] = fds[i].revents;
+    }
+
+    scr = _syscallhandler_pollHelper(sys, fds, nfds, timeout);
 
-    return _syscallhandler_pollHelper(sys, fds, nfds, timeout);
+    // Like Linux, only write the results if we're returning them.
+    if (scr.tag == SYSCALL_RETURN_DONE && syscallreturn_done(&scr)->retval.as_i64 >= 0 &&
+        _syscallhandler_pollWriteRevents(proc, fds_ptr, fds, old_revents, nfds) != 0) {
+        scr = syscallreturn_makeDoneErrno(EFAULT);
+    }
+
+done:
+    free(fds);
+    free(old_revents);
+    return scr;
 }
 
 static int _syscallhandler_checkPollArgs(UntypedForeignPtr fds_ptr, nfds_t nfds) {
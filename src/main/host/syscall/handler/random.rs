@@ -3,6 +3,7 @@ use log::*;
 use rand::RngCore;
 use shadow_shim_helper_rs::syscall_types::ForeignPtr;
 
+use crate::host::host::RandomStream;
 use crate::host::syscall::handler::{SyscallContext, SyscallHandler};
 use crate::host::syscall::types::ForeignArrayPtr;
 
@@ -37,7 +38,7 @@ impl SyscallHandler {
         };
 
         // Get random bytes using host rng to maintain determinism.
-        let mut rng = ctx.objs.host.random_mut();
+        let mut rng = ctx.objs.host.random_mut(RandomStream::Bytes);
         rng.fill_bytes(&mut mem_ref);
 
         // We must flush the memory reference to write it back.
@@ -150,7 +150,9 @@ impl SyscallHandler {
         // true preemption, in which case we'd need to do something if we ever pre-empted
         // while the user code was in a restartable sequence. As it is, Shadow only
         // reschedules threads at system calls, and system calls are disallowed inside
-        // restartable sequences.
+        // restartable sequences. The exception is `native_preemption_enabled`, where the
+        // shim can yield from a timer signal in the middle of a sequence without
+        // aborting it.
         //
         // TODO: One place where Shadow might need to implement rseq recovery is
         // if a hardware-based signal is delivered in the middle of an
@@ -7,6 +7,8 @@
 
 #include <errno.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/select.h>
 
 #include "lib/logger/logger.h"
@@ -20,6 +22,31 @@
 // Helpers
 ///////////////////////////////////////////////////////////
 
+// The kernel's fd_set layout: a bitmap in an array of longs.
+typedef unsigned long FdSetWord;
+#define FD_SET_WORD_BITS (8 * sizeof(FdSetWord))
+#define FD_SET_WORDS (FD_SETSIZE / FD_SET_WORD_BITS)
+
+// Reads the first `num_words` words of the fd set at `ptr`, if it isn't NULL, leaving the rest
+// zeroed. Returns 0 on success.
+static int _syscallhandler_select_readFdSet(SyscallHandler* sys, FdSetWord* set,
+                                            UntypedForeignPtr ptr, size_t num_words) {
+    memset(set, 0, FD_SET_WORDS * sizeof(*set));
+    if (!ptr.val || num_words == 0) {
+        return 0;
+    }
+    return process_readPtr(rustsyscallhandler_getProcess(sys), set, ptr, num_words * sizeof(*set));
+}
+
+// Writes the first `num_words` words of `set` to `ptr`, if it isn't NULL. Returns 0 on success.
+static int _syscallhandler_select_writeFdSet(SyscallHandler* sys, UntypedForeignPtr ptr,
+                                             const FdSetWord* set, size_t num_words) {
+    if (!ptr.val || num_words == 0) {
+        return 0;
+    }
+    return process_writePtr(rustsyscallhandler_getProcess(sys), ptr, set, num_words * sizeof(*set));
+}
+
 static SyscallReturn _syscallhandler_select_helper(SyscallHandler* sys, int nfds,
                                                    UntypedForeignPtr readfds_ptr,
                                                    UntypedForeignPtr writefds_ptr,
@@ -29,64 +56,77 @@ static SyscallReturn _syscallhandler_select_helper(SyscallHandler* sys, int nfds
     // in the descriptor table.
     int nfds_max = MAX(0, MIN(nfds, FD_SETSIZE));
 
-    fd_set readfds, writefds, exceptfds;
-    FD_ZERO(&readfds);
-    FD_ZERO(&writefds);
-    FD_ZERO(&exceptfds);
+    // Like Linux, only access the words of the fd sets that contain the first `nfds` bits.
+    size_t num_words = (nfds_max + FD_SET_WORD_BITS - 1) / FD_SET_WORD_BITS;
 
-    // Get the fd_set syscall args in our memory.
-    if (readfds_ptr.val &&
-        process_readPtr(rustsyscallhandler_getProcess(sys), &readfds, readfds_ptr, sizeof(readfds))) {
+    FdSetWord readfds[FD_SET_WORDS], writefds[FD_SET_WORDS], exceptfds[FD_SET_WORDS];
+
+    // Get the fd_set syscall args in our memory. If the syscall args were NULL, our local fd sets
+    // are zeroed.
+    if (_syscallhandler_select_readFdSet(sys, readfds, readfds_ptr, num_words) ||
+        _syscallhandler_select_readFdSet(sys, writefds, writefds_ptr, num_words) ||
+        _syscallhandler_select_readFdSet(sys, exceptfds, exceptfds_ptr, num_words)) {
         return syscallreturn_makeDoneErrno(EFAULT);
     }
-    if (writefds_ptr.val && process_readPtr(rustsyscallhandler_getProcess(sys), &writefds,
-                                            writefds_ptr, sizeof(writefds))) {
-        return syscallreturn_makeDoneErrno(EFAULT);
+
+    // Ignore the bits at and above `nfds` in the last word.
+    if (nfds_max % FD_SET_WORD_BITS != 0) {
+        FdSetWord mask = (1UL << (nfds_max % FD_SET_WORD_BITS)) - 1;
+        readfds[num_words - 1] &= mask;
+        writefds[num_words - 1] &= mask;
+        exceptfds[num_words - 1] &= mask;
     }
-    if (exceptfds_ptr.val && process_readPtr(rustsyscallhandler_getProcess(sys), &exceptfds,
-                                             exceptfds_ptr, sizeof(exceptfds))) {
-        return syscallreturn_makeDoneErrno(EFAULT);
+
+    // Sets are often sparse (e.g. a few fds in a large range), so only visit the set bits.
+    size_t num_pfds = 0;
+    for (size_t w = 0; w < num_words; w++) {
+        num_pfds += __builtin_popcountl(readfds[w] | writefds[w] | exceptfds[w]);
     }
 
     // Translate to pollfds so we can handle with our poll() handler. We don't use epoll here
     // because that doesn't directly call file_poll() on regular files.
-    struct pollfd* pfds = malloc(nfds_max * sizeof(*pfds));
-
-    for (int i = 0; i < nfds_max; i++) {
-        struct pollfd* pfd = &pfds[i];
-
-        pfd->fd = -1; // poll will skip over this array slot
-        pfd->events = 0;
-        pfd->revents = 0;
-
-        // If the syscall args were NULL, our local fd sets are zeroed.
-        if (FD_ISSET(i, &readfds)) {
-            trace("select wanting reads for fd %i", i);
-            pfd->fd = i; // poll will process this slot
-            pfd->events |= POLLIN;
-        }
-        if (FD_ISSET(i, &writefds)) {
-            trace("select wanting writes for fd %i", i);
-            pfd->fd = i; // poll will process this slot
-            pfd->events |= POLLOUT;
-        }
-        if (FD_ISSET(i, &exceptfds)) {
-            // We need poll to process this slot to check for EBADF
-            trace("select wanting exceptions for fd %i", i);
-            pfd->fd = i; // poll will process this slot
+    struct pollfd* pfds = malloc(num_pfds * sizeof(*pfds));
+
+    size_t pfd_idx = 0;
+    for (size_t w = 0; w < num_words; w++) {
+        FdSetWord bits = readfds[w] | writefds[w] | exceptfds[w];
+        while (bits) {
+            int bit = __builtin_ctzl(bits);
+            bits &= bits - 1;
+
+            FdSetWord mask = 1UL << bit;
+            int fd = w * FD_SET_WORD_BITS + bit;
+            struct pollfd* pfd = &pfds[pfd_idx++];
+
+            pfd->fd = fd;
+            pfd->events = 0;
+            pfd->revents = 0;
+
+            if (readfds[w] & mask) {
+                trace("select wanting reads for fd %i", fd);
+                pfd->events |= POLLIN;
+            }
+            if (writefds[w] & mask) {
+                trace("select wanting writes for fd %i", fd);
+                pfd->events |= POLLOUT;
+            }
+            if (exceptfds[w] & mask) {
+                // We need poll to process this slot to check for EBADF
+                trace("select wanting exceptions for fd %i", fd);
+            }
         }
     }
 
-    SyscallReturn scr = _syscallhandler_pollHelper(sys, pfds, (nfds_t)nfds_max, timeout);
+    SyscallReturn scr = _syscallhandler_pollHelper(sys, pfds, (nfds_t)num_pfds, timeout);
     if (scr.tag == SYSCALL_RETURN_BLOCK ||
         (scr.tag == SYSCALL_RETURN_DONE && syscallreturn_done(&scr)->retval.as_i64 < 0)) {
         goto done;
     }
 
     // Collect the pollfd results in our local fd sets
-    FD_ZERO(&readfds);
-    FD_ZERO(&writefds);
-    FD_ZERO(&exceptfds);
+    memset(readfds, 0, sizeof(readfds));
+    memset(writefds, 0, sizeof(writefds));
+    memset(exceptfds, 0, sizeof(exceptfds));
 
     // From `man select`: return "the total number of bits that are set in
     // readfds, writefds, exceptfds"
@@ -94,32 +134,31 @@ static SyscallReturn _syscallhandler_select_helper(SyscallHandler* sys, int nfds
     int num_bad_fds = 0;
 
     // Check the pollfd results.
-    for (int i = 0; i < nfds_max; i++) {
+    for (size_t i = 0; i < num_pfds; i++) {
         struct pollfd* pfd = &pfds[i];
-
-        if (pfd->fd < 0) {
-            // Select didn't ask about this fd.
-            continue;
-        }
+        size_t w = pfd->fd / FD_SET_WORD_BITS;
+        FdSetWord mask = 1UL << (pfd->fd % FD_SET_WORD_BITS);
 
         // The exceptional states listed in `man select` don't apply in Shadow,
         // but POLLNVAL corresponds to an EBADF error.
         if (pfd->revents & POLLIN) {
-            trace("select found fd %i readable", i);
-            FD_SET(i, &readfds);
-            num_set_bits++;
+            trace("select found fd %i readable", pfd->fd);
+            readfds[w] |= mask;
         }
         if (pfd->revents & POLLOUT) {
-            trace("select found fd %i writeable", i);
-            FD_SET(i, &writefds);
-            num_set_bits++;
+            trace("select found fd %i writeable", pfd->fd);
+            writefds[w] |= mask;
         }
         if (pfd->revents & POLLNVAL) {
-            trace("select found bad fd %i", i);
+            trace("select found bad fd %i", pfd->fd);
             num_bad_fds++;
         }
     }
 
+    for (size_t w = 0; w < num_words; w++) {
+        num_set_bits += __builtin_popcountl(readfds[w]) + __builtin_popcountl(writefds[w]);
+    }
+
     trace("select set %i total bits and found %i bad fds", num_set_bits, num_bad_fds);
 
     // Overwrite the return val set above by poll()
@@ -130,18 +169,9 @@ static SyscallReturn _syscallhandler_select_helper(SyscallHandler* sys, int nfds
 
     // OK now we know we have success; write back the result fd sets.
     scr = syscallreturn_makeDoneI64(num_set_bits);
-    if (readfds_ptr.val &&
-        process_writePtr(rustsyscallhandler_getProcess(sys), readfds_ptr, &readfds, sizeof(readfds))) {
-        scr = syscallreturn_makeDoneErrno(EFAULT);
-        goto done;
-    }
-    if (writefds_ptr.val && process_writePtr(rustsyscallhandler_getProcess(sys), writefds_ptr,
-                                             &writefds, sizeof(writefds))) {
-        scr = syscallreturn_makeDoneErrno(EFAULT);
-        goto done;
-    }
-    if (exceptfds_ptr.val && process_writePtr(rustsyscallhandler_getProcess(sys), exceptfds_ptr,
-                                              &exceptfds, sizeof(exceptfds))) {
+    if (_syscallhandler_select_writeFdSet(sys, readfds_ptr, readfds, num_words) ||
+        _syscallhandler_select_writeFdSet(sys, writefds_ptr, writefds, num_words) ||
+        _syscallhandler_select_writeFdSet(sys, exceptfds_ptr, exceptfds, num_words)) {
         scr = syscallreturn_makeDoneErrno(EFAULT);
         goto done;
     }
@@ -0,0 +1,282 @@
+use linux_api::errno::Errno;
+use linux_api::posix_types::kernel_off_t;
+use shadow_shim_helper_rs::syscall_types::ForeignPtr;
+
+use crate::cshadow as c;
+use crate::host::descriptor::{CompatFile, File};
+use crate::host::host::Host;
+use crate::host::memory_manager::AllocdMem;
+use crate::host::syscall::handler::{SyscallContext, SyscallHandler};
+use crate::host::syscall::io::IoVec;
+use crate::host::syscall::types::{ForeignArrayPtr, SyscallError};
+
+/// The most bytes that we read from the input file at once.
+const SENDFILE_CHUNK_SIZE: usize = 64 * 1024;
+
+/// Linux's `MAX_RW_COUNT`, the most bytes that a single read or write will transfer.
+const MAX_RW_COUNT: usize = (i32::MAX as usize) & !(4096 - 1);
+
+impl SyscallHandler {
+    log_syscall!(
+        sendfile,
+        /* rv */ isize,
+        /* out_fd */ std::ffi::c_int,
+        /* in_fd */ std::ffi::c_int,
+        /* offset */ *const kernel_off_t,
+        /* count */ usize,
+    );
+    pub fn sendfile(
+        ctx: &mut SyscallContext,
+        out_fd: std::ffi::c_int,
+        in_fd: std::ffi::c_int,
+        offset_ptr: ForeignPtr<kernel_off_t>,
+        count: usize,
+    ) -> Result<isize, SyscallError> {
+        // if we were previously blocked, get the active file from the last syscall handler
+        // invocation since it may no longer exist in the descriptor table
+        let out_file = ctx
+            .objs
+            .thread
+            .syscall_condition()
+            // if this was for a C descriptor, then there won't be an active file object
+            .and_then(|x| x.active_file().cloned());
+
+        let (in_file, out_file) = {
+            let desc_table = ctx.objs.thread.descriptor_table_borrow(ctx.objs.host);
+
+            let out_file = match out_file {
+                // we were previously blocked, so re-use the file from the previous syscall
+                // invocation
+                Some(x) => CompatFile::New(x),
+                None => Self::get_descriptor(&desc_table, out_fd)?.file().clone(),
+            };
+
+            // like linux, we only support input files that can be read at an offset, which in
+            // shadow are the regular files implemented in C
+            let in_file = match Self::get_descriptor(&desc_table, in_fd)?.file() {
+                CompatFile::Legacy(file)
+                    if unsafe { c::legacyfile_getType(file.ptr()) }
+                        == c::_LegacyFileType_DT_FILE =>
+                {
+                    file.clone()
+                }
+                _ => return Err(Errno::EINVAL.into()),
+            };
+
+            (in_file, out_file)
+        };
+
+        let in_ptr = in_file.ptr() as *mut c::RegularFile;
+
+        // the offset to read from, and whether it's the file's own offset
+        let (start, use_file_offset) = if offset_ptr.is_null() {
+            let rv = unsafe { c::regularfile_lseek(in_ptr, 0, libc::SEEK_CUR) };
+            if rv < 0 {
+                return Err(Errno::try_from(-rv).unwrap().into());
+            }
+            (rv, true)
+        } else {
+            let offset = ctx.objs.process.memory_borrow().read(offset_ptr)?;
+            if offset < 0 {
+                return Err(Errno::EINVAL.into());
+            }
+            (offset, false)
+        };
+
+        let count = std::cmp::min(count, MAX_RW_COUNT);
+
+        let mut result = match &out_file {
+            CompatFile::New(file) => {
+                Self::sendfile_to_file(ctx, file.inner_file(), in_ptr, start, count)
+            }
+            CompatFile::Legacy(file) => {
+                if unsafe { c::legacyfile_getType(file.ptr()) } != c::_LegacyFileType_DT_FILE {
+                    return Err(Errno::EINVAL.into());
+                }
+                Self::sendfile_to_regular_file(
+                    ctx,
+                    file.ptr() as *mut c::RegularFile,
+                    in_ptr,
+                    start,
+                    count,
+                )
+            }
+        };
+
+        // if the syscall will block, keep the file open until the syscall restarts
+        if let Some(err) = result.as_mut().err() {
+            if let Some(cond) = err.blocked_condition() {
+                if let CompatFile::New(file) = out_file {
+                    cond.set_active_file(file);
+                }
+            }
+        }
+
+        let num_sent = result?;
+        let end = start + kernel_off_t::try_from(num_sent).unwrap();
+
+        if use_file_offset {
+            let rv = unsafe { c::regularfile_lseek(in_ptr, end, libc::SEEK_SET) };
+            debug_assert_eq!(rv, end);
+        } else {
+            ctx.objs
+                .process
+                .memory_borrow_mut()
+                .write(offset_ptr, &end)?;
+        }
+
+        Ok(num_sent.try_into().unwrap())
+    }
+
+    /// Reads from the regular file at `offset` directly into `dst`. Returns the number of bytes
+    /// read, which is 0 at the end of the file.
+    fn sendfile_read(
+        host: &Host,
+        file: *mut c::RegularFile,
+        dst: &mut [u8],
+        offset: kernel_off_t,
+    ) -> Result<usize, Errno> {
+        let rv =
+            unsafe { c::regularfile_pread(file, host, dst.as_mut_ptr().cast(), dst.len(), offset) };
+        if rv < 0 {
+            return Err(Errno::try_from(-i64::try_from(rv).unwrap()).unwrap());
+        }
+        Ok(rv.try_into().unwrap())
+    }
+
+    /// Sends from the input file to a file implemented in rust. These files can only write from
+    /// the managed process' memory, so we read the input file directly into a temporary buffer in
+    /// the process and write the file from there. This saves the process from having to read the
+    /// file into its own buffer and then write it with separate syscalls.
+    fn sendfile_to_file(
+        ctx: &mut SyscallContext,
+        out_file: &File,
+        in_file: *mut c::RegularFile,
+        offset: kernel_off_t,
+        count: usize,
+    ) -> Result<usize, SyscallError> {
+        if count == 0 {
+            return Ok(0);
+        }
+
+        let buffer = AllocdMem::<u8>::new(ctx.objs, std::cmp::min(count, SENDFILE_CHUNK_SIZE));
+        let result =
+            Self::sendfile_through_buffer(ctx, out_file, in_file, offset, count, buffer.ptr());
+        buffer.free(ctx.objs);
+
+        result
+    }
+
+    fn sendfile_through_buffer(
+        ctx: &mut SyscallContext,
+        out_file: &File,
+        in_file: *mut c::RegularFile,
+        offset: kernel_off_t,
+        count: usize,
+        buffer: ForeignArrayPtr<u8>,
+    ) -> Result<usize, SyscallError> {
+        let mut num_sent = 0;
+
+        while num_sent < count {
+            let len = std::cmp::min(count - num_sent, buffer.len());
+            let chunk_offset = offset + kernel_off_t::try_from(num_sent).unwrap();
+
+            let num_read = {
+                let mut mem = ctx.objs.process.memory_borrow_mut();
+                let mut dst = mem.memory_ref_mut_uninit(buffer.slice(..len))?;
+
+                let num_read =
+                    match Self::sendfile_read(ctx.objs.host, in_file, &mut dst[..], chunk_offset) {
+                        Ok(x) => x,
+                        // only return an error if nothing has been sent yet
+                        Err(e) if num_sent == 0 => {
+                            dst.noflush();
+                            return Err(e.into());
+                        }
+                        Err(_) => {
+                            dst.noflush();
+                            break;
+                        }
+                    };
+
+                // the rest of the buffer is never written to the output file, but shouldn't be
+                // flushed back to the process uninitialized
+                dst[num_read..].fill(0);
+                dst.flush()?;
+
+                num_read
+            };
+
+            if num_read == 0 {
+                // end of the input file
+                break;
+            }
+
+            let iov = IoVec {
+                base: buffer.ptr(),
+                len: num_read,
+            };
+
+            let num_written = match Self::writev_helper(ctx, out_file, &[iov], None, 0) {
+                Ok(x) => usize::try_from(x).unwrap(),
+                // only return an error if nothing has been sent yet; this includes blocking
+                Err(e) if num_sent == 0 => return Err(e),
+                Err(_) => break,
+            };
+
+            num_sent += num_written;
+
+            if num_written < num_read {
+                // the output file is full
+                break;
+            }
+        }
+
+        Ok(num_sent)
+    }
+
+    /// Sends from the input file to another regular file. Both files are implemented in C and
+    /// don't need the managed process' memory, so we copy through a local buffer.
+    fn sendfile_to_regular_file(
+        ctx: &mut SyscallContext,
+        out_file: *mut c::RegularFile,
+        in_file: *mut c::RegularFile,
+        offset: kernel_off_t,
+        count: usize,
+    ) -> Result<usize, SyscallError> {
+        let mut buffer = vec![0u8; std::cmp::min(count, SENDFILE_CHUNK_SIZE)];
+        let mut num_sent = 0;
+
+        while num_sent < count {
+            let len = std::cmp::min(count - num_sent, buffer.len());
+            let chunk_offset = offset + kernel_off_t::try_from(num_sent).unwrap();
+
+            let num_read =
+                match Self::sendfile_read(ctx.objs.host, in_file, &mut buffer[..len], chunk_offset)
+                {
+                    Ok(0) => break,
+                    Ok(x) => x,
+                    // only return an error if nothing has been sent yet
+                    Err(e) if num_sent == 0 => return Err(e.into()),
+                    Err(_) => break,
+                };
+
+            let rv = unsafe { c::regularfile_write(out_file, buffer.as_ptr().cast(), num_read) };
+            let num_written = match rv {
+                x if x >= 0 => usize::try_from(x).unwrap(),
+                x if num_sent == 0 => {
+                    return Err(Errno::try_from(-i64::try_from(x).unwrap()).unwrap().into())
+                }
+                _ => break,
+            };
+
+            num_sent += num_written;
+
+            if num_written < num_read {
+                break;
+            }
+        }
+
+        Ok(num_sent)
+    }
+}
@@ -14,6 +14,9 @@ use crate::host::descriptor::socket::netlink::{NetlinkFamily, NetlinkSocket, Net
 use crate::host::descriptor::socket::unix::{UnixSocket, UnixSocketType};
 use crate::host::descriptor::socket::{RecvmsgArgs, RecvmsgReturn, SendmsgArgs, Socket};
 use crate::host::descriptor::{CompatFile, Descriptor, File, FileState, FileStatus, OpenFile};
+use crate::host::host::RandomStream;
+use crate::host::memory_manager::MemoryManager;
+use crate::host::network::namespace::NetworkNamespace;
 use crate::host::syscall::handler::{SyscallContext, SyscallHandler};
 use crate::host::syscall::io::{self, IoVec};
 use crate::host::syscall::type_formatting::{SyscallBufferArg, SyscallSockAddrArg};
@@ -84,7 +87,13 @@ impl SyscallHandler {
                     }
 
                     if ctx.objs.host.params.use_new_tcp {
-                        Socket::Inet(InetSocket::Tcp(TcpSocket::new(file_flags)))
+                        let send_buf_size = ctx.objs.host.params.init_sock_send_buf_size;
+                        let recv_buf_size = ctx.objs.host.params.init_sock_recv_buf_size;
+                        Socket::Inet(InetSocket::Tcp(TcpSocket::new(
+                            file_flags,
+                            send_buf_size.try_into().unwrap(),
+                            recv_buf_size.try_into().unwrap(),
+                        )))
                     } else {
                         Socket::Inet(InetSocket::LegacyTcp(LegacyTcpSocket::new(
                             file_flags,
@@ -176,7 +185,7 @@ impl SyscallHandler {
 
         log::trace!("Attempting to bind fd {} to {:?}", fd, addr);
 
-        let mut rng = ctx.objs.host.random_mut();
+        let mut rng = ctx.objs.host.random_mut(RandomStream::Sockets);
         let net_ns = ctx.objs.host.network_namespace_borrow();
         Socket::bind(socket, addr.as_ref(), &net_ns, &mut *rng)
     }
@@ -228,7 +237,7 @@ impl SyscallHandler {
         };
 
         let mut mem = ctx.objs.process.memory_borrow_mut();
-        let mut rng = ctx.objs.host.random_mut();
+        let mut rng = ctx.objs.host.random_mut(RandomStream::Sockets);
         let net_ns = ctx.objs.host.network_namespace_borrow();
 
         let addr = io::read_sockaddr(&mem, addr_ptr, addr_len)?;
@@ -305,7 +314,7 @@ impl SyscallHandler {
         };
 
         let mut mem = ctx.objs.process.memory_borrow_mut();
-        let mut rng = ctx.objs.host.random_mut();
+        let mut rng = ctx.objs.host.random_mut(RandomStream::Sockets);
         let net_ns = ctx.objs.host.network_namespace_borrow();
 
         let msg = io::read_msghdr(&mem, msg_ptr)?;
@@ -504,6 +513,273 @@ impl SyscallHandler {
         Ok(result.return_val)
     }
 
+    log_syscall!(
+        sendmmsg,
+        /* rv */ std::ffi::c_int,
+        /* sockfd */ std::ffi::c_int,
+        /* msgvec */ *const libc::mmsghdr,
+        /* vlen */ std::ffi::c_uint,
+        /* flags */ nix::sys::socket::MsgFlags,
+    );
+    pub fn sendmmsg(
+        ctx: &mut SyscallContext,
+        fd: std::ffi::c_int,
+        msgvec_ptr: ForeignPtr<libc::mmsghdr>,
+        vlen: std::ffi::c_uint,
+        flags: std::ffi::c_int,
+    ) -> Result<std::ffi::c_int, SyscallError> {
+        // if we were previously blocked, get the active file from the last syscall handler
+        // invocation since it may no longer exist in the descriptor table
+        let file = ctx
+            .objs
+            .thread
+            .syscall_condition()
+            // if this was for a C descriptor, then there won't be an active file object
+            .and_then(|x| x.active_file().cloned());
+
+        let file = match file {
+            // we were previously blocked, so re-use the file from the previous syscall invocation
+            Some(x) => x,
+            // get the file from the descriptor table, or return early if it doesn't exist
+            None => {
+                let desc_table = ctx.objs.thread.descriptor_table_borrow(ctx.objs.host);
+                match Self::get_descriptor(&desc_table, fd)?.file() {
+                    CompatFile::New(file) => file.clone(),
+                    CompatFile::Legacy(_file) => {
+                        return Err(Errno::ENOTSOCK.into());
+                    }
+                }
+            }
+        };
+
+        let File::Socket(ref socket) = file.inner_file() else {
+            return Err(Errno::ENOTSOCK.into());
+        };
+
+        // linux silently truncates the vector to `UIO_MAXIOV` messages
+        let vlen = std::cmp::min(vlen, libc::UIO_MAXIOV as std::ffi::c_uint);
+
+        let mut mem = ctx.objs.process.memory_borrow_mut();
+        let mut rng = ctx.objs.host.random_mut(RandomStream::Sockets);
+        let net_ns = ctx.objs.host.network_namespace_borrow();
+
+        // send all of the messages before running any resulting events
+        let mut result = CallbackQueue::queue_and_run_with_legacy(|cb_queue| {
+            let mut num_sent = 0;
+
+            while num_sent < vlen {
+                // Only the first message may block. We can't restart the syscall part way through
+                // the vector, so like a partial write we return the messages sent so far instead
+                // of blocking.
+                let msg_flags = if num_sent == 0 {
+                    flags
+                } else {
+                    flags | libc::MSG_DONTWAIT
+                };
+
+                let res = Self::sendmmsg_one(
+                    socket,
+                    msgvec_ptr.add(num_sent as usize),
+                    msg_flags,
+                    &mut mem,
+                    &net_ns,
+                    &mut *rng,
+                    cb_queue,
+                );
+
+                match res {
+                    Ok(()) => num_sent += 1,
+                    // "If an error occurs after at least one message has been sent, the call
+                    // succeeds, and returns the number of messages sent. The error code is lost."
+                    Err(_) if num_sent > 0 => break,
+                    Err(e) => return Err(e),
+                }
+            }
+
+            Ok(num_sent as std::ffi::c_int)
+        });
+
+        // if the syscall will block, keep the file open until the syscall restarts
+        if let Some(err) = result.as_mut().err() {
+            if let Some(cond) = err.blocked_condition() {
+                cond.set_active_file(file);
+            }
+        }
+
+        result
+    }
+
+    log_syscall!(
+        recvmmsg,
+        /* rv */ std::ffi::c_int,
+        /* sockfd */ std::ffi::c_int,
+        /* msgvec */ *const libc::mmsghdr,
+        /* vlen */ std::ffi::c_uint,
+        /* flags */ nix::sys::socket::MsgFlags,
+        /* timeout */ *const linux_api::time::kernel_timespec,
+    );
+    pub fn recvmmsg(
+        ctx: &mut SyscallContext,
+        fd: std::ffi::c_int,
+        msgvec_ptr: ForeignPtr<libc::mmsghdr>,
+        vlen: std::ffi::c_uint,
+        flags: std::ffi::c_int,
+        _timeout_ptr: ForeignPtr<linux_api::time::kernel_timespec>,
+    ) -> Result<std::ffi::c_int, SyscallError> {
+        // if we were previously blocked, get the active file from the last syscall handler
+        // invocation since it may no longer exist in the descriptor table
+        let file = ctx
+            .objs
+            .thread
+            .syscall_condition()
+            // if this was for a C descriptor, then there won't be an active file object
+            .and_then(|x| x.active_file().cloned());
+
+        let file = match file {
+            // we were previously blocked, so re-use the file from the previous syscall invocation
+            Some(x) => x,
+            // get the file from the descriptor table, or return early if it doesn't exist
+            None => {
+                let desc_table = ctx.objs.thread.descriptor_table_borrow(ctx.objs.host);
+                match Self::get_descriptor(&desc_table, fd)?.file() {
+                    CompatFile::New(file) => file.clone(),
+                    CompatFile::Legacy(_file) => {
+                        return Err(Errno::ENOTSOCK.into());
+                    }
+                }
+            }
+        };
+
+        let File::Socket(ref socket) = file.inner_file() else {
+            return Err(Errno::ENOTSOCK.into());
+        };
+
+        // linux silently truncates the vector to `UIO_MAXIOV` messages
+        let vlen = std::cmp::min(vlen, libc::UIO_MAXIOV as std::ffi::c_uint);
+
+        // the socket's recvmsg() doesn't understand this recvmmsg-only flag
+        let flags = flags & !libc::MSG_WAITFORONE;
+
+        let mut mem = ctx.objs.process.memory_borrow_mut();
+
+        // receive all of the messages before running any resulting events
+        let mut result = CallbackQueue::queue_and_run_with_legacy(|cb_queue| {
+            let mut num_received = 0;
+
+            while num_received < vlen {
+                // Only the first message may block. We can't restart the syscall part way through
+                // the vector, so we always behave as if `MSG_WAITFORONE` was given. This also
+                // means that the timeout, which linux only checks after each received message,
+                // can never expire.
+                let msg_flags = if num_received == 0 {
+                    flags
+                } else {
+                    flags | libc::MSG_DONTWAIT
+                };
+
+                let res = Self::recvmmsg_one(
+                    socket,
+                    msgvec_ptr.add(num_received as usize),
+                    msg_flags,
+                    &mut mem,
+                    cb_queue,
+                );
+
+                match res {
+                    Ok(()) => num_received += 1,
+                    // linux returns the messages received so far, and reports the error on the next
+                    // call to the socket
+                    Err(_) if num_received > 0 => break,
+                    Err(e) => return Err(e),
+                }
+            }
+
+            Ok(num_received as std::ffi::c_int)
+        });
+
+        // if the syscall will block, keep the file open until the syscall restarts
+        if let Some(err) = result.as_mut().err() {
+            if let Some(cond) = err.blocked_condition() {
+                cond.set_active_file(file);
+            }
+        }
+
+        result
+    }
+
+    /// Send the message at `mmsg_ptr` and write the number of bytes sent to its `msg_len`.
+    fn sendmmsg_one(
+        socket: &Socket,
+        mmsg_ptr: ForeignPtr<libc::mmsghdr>,
+        flags: std::ffi::c_int,
+        mem: &mut MemoryManager,
+        net_ns: &NetworkNamespace,
+        rng: impl rand::Rng,
+        cb_queue: &mut CallbackQueue,
+    ) -> Result<(), SyscallError> {
+        let msg = io::read_msghdr(mem, mmsg_ptr.cast::<libc::msghdr>())?;
+
+        let args = SendmsgArgs {
+            addr: io::read_sockaddr(mem, msg.name, msg.name_len)?,
+            iovs: &msg.iovs,
+            control_ptr: ForeignArrayPtr::new(msg.control, msg.control_len),
+            // note: "the msg_flags field is ignored" for sendmsg; see send(2)
+            flags,
+        };
+
+        let bytes_sent = Socket::sendmsg(socket, args, mem, net_ns, rng, cb_queue)?;
+
+        mem.write(
+            mmsghdr_msg_len_ptr(mmsg_ptr),
+            &(bytes_sent as std::ffi::c_uint),
+        )?;
+
+        Ok(())
+    }
+
+    /// Receive a message into the buffers of the message at `mmsg_ptr`, and update its header and
+    /// `msg_len` like `recvmsg()` does.
+    fn recvmmsg_one(
+        socket: &Socket,
+        mmsg_ptr: ForeignPtr<libc::mmsghdr>,
+        flags: std::ffi::c_int,
+        mem: &mut MemoryManager,
+        cb_queue: &mut CallbackQueue,
+    ) -> Result<(), SyscallError> {
+        let msg_ptr = mmsg_ptr.cast::<libc::msghdr>();
+        let mut msg = io::read_msghdr(mem, msg_ptr)?;
+
+        let args = RecvmsgArgs {
+            iovs: &msg.iovs,
+            control_ptr: ForeignArrayPtr::new(msg.control, msg.control_len),
+            flags,
+        };
+
+        let result = Socket::recvmsg(socket, args, mem, cb_queue)?;
+
+        // write the socket address to the plugin and update the length in msg
+        if !msg.name.is_null() {
+            if let Some(from_addr) = result.addr.as_ref() {
+                msg.name_len = io::write_sockaddr(mem, from_addr, msg.name, msg.name_len)?;
+            } else {
+                msg.name_len = 0;
+            }
+        }
+
+        // update the control len and flags in msg
+        msg.control_len = result.control_len;
+        msg.flags = result.msg_flags;
+
+        // write msg back to the plugin
+        io::update_msghdr(mem, msg_ptr, msg)?;
+        mem.write(
+            mmsghdr_msg_len_ptr(mmsg_ptr),
+            &(result.return_val as std::ffi::c_uint),
+        )?;
+
+        Ok(())
+    }
+
     log_syscall!(
         getsockname,
         /* rv */ std::ffi::c_int,
@@ -624,7 +900,7 @@ impl SyscallHandler {
             return Err(Errno::ENOTSOCK);
         };
 
-        let mut rng = ctx.objs.host.random_mut();
+        let mut rng = ctx.objs.host.random_mut(RandomStream::Sockets);
         let net_ns = ctx.objs.host.network_namespace_borrow();
 
         CallbackQueue::queue_and_run_with_legacy(|cb_queue| {
@@ -753,7 +1029,7 @@ impl SyscallHandler {
             }
         };
 
-        let mut rng = ctx.objs.host.random_mut();
+        let mut rng = ctx.objs.host.random_mut(RandomStream::Sockets);
         let net_ns = ctx.objs.host.network_namespace_borrow();
 
         let result = CallbackQueue::queue_and_run_with_legacy(|cb_queue| {
@@ -855,7 +1131,7 @@ impl SyscallHandler {
         let addr = io::read_sockaddr(&ctx.objs.process.memory_borrow(), addr_ptr, addr_len)?
             .ok_or(Errno::EFAULT)?;
 
-        let mut rng = ctx.objs.host.random_mut();
+        let mut rng = ctx.objs.host.random_mut(RandomStream::Sockets);
         let net_ns = ctx.objs.host.network_namespace_borrow();
 
         let mut result = CallbackQueue::queue_and_run_with_legacy(|cb_queue| {
@@ -1103,3 +1379,11 @@ impl SyscallHandler {
         Ok(())
     }
 }
+
+/// Pointer to the `msg_len` field of the plugin's [`libc::mmsghdr`] at `mmsg_ptr`.
+fn mmsghdr_msg_len_ptr(mmsg_ptr: ForeignPtr<libc::mmsghdr>) -> ForeignPtr<std::ffi::c_uint> {
+    mmsg_ptr
+        .cast::<u8>()
+        .add(memoffset::offset_of!(libc::mmsghdr, msg_len))
+        .cast::<std::ffi::c_uint>()
+}
@@ -4,6 +4,7 @@ use shadow_shim_helper_rs::syscall_types::ForeignPtr;
 use crate::cshadow as c;
 use crate::host::descriptor::socket::{RecvmsgArgs, RecvmsgReturn, SendmsgArgs, Socket};
 use crate::host::descriptor::{CompatFile, File, FileState, FileStatus};
+use crate::host::host::RandomStream;
 use crate::host::syscall::handler::{SyscallContext, SyscallHandler};
 use crate::host::syscall::io::{self, IoVec};
 use crate::host::syscall::types::{ForeignArrayPtr, SyscallError};
@@ -511,7 +512,7 @@ impl SyscallHandler {
         flags: std::ffi::c_int,
     ) -> Result<libc::ssize_t, SyscallError> {
         let mut mem = ctx.objs.process.memory_borrow_mut();
-        let mut rng = ctx.objs.host.random_mut();
+        let mut rng = ctx.objs.host.random_mut(RandomStream::Sockets);
         let net_ns = ctx.objs.host.network_namespace_borrow();
 
         // if it's a socket, call sendmsg_helper() instead
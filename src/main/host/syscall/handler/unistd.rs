@@ -25,7 +25,6 @@ use crate::host::syscall::io::{read_cstring_vec, IoVec};
 use crate::host::syscall::type_formatting::{SyscallBufferArg, SyscallStringArg};
 use crate::host::syscall::types::{ForeignArrayPtr, SyscallError};
 use crate::utility::callback_queue::CallbackQueue;
-use crate::utility::u8_to_i8_slice;
 
 impl SyscallHandler {
     log_syscall!(
@@ -929,21 +928,8 @@ impl SyscallHandler {
         //
         // Some online resources such as the chromium syscall table are incorrect.
 
-        let mut name: linux_api::utsname::new_utsname = shadow_pod::zeroed();
-
-        let nodename = u8_to_i8_slice(ctx.objs.host.info().name.as_bytes());
-
-        // Currently hardcoded with values reported in Debian 12
-        let sysname = u8_to_i8_slice(&b"Linux"[..]);
-        let release = u8_to_i8_slice(&b"6.1.0-25-amd64"[..]);
-        let version = u8_to_i8_slice(&b"#1 SMP PREEMPT_DYNAMIC Debian 6.1.106-3 (2024-08-26)"[..]);
-        let machine = u8_to_i8_slice(&b"x86_64"[..]);
-
-        name.sysname[..sysname.len()].copy_from_slice(sysname);
-        name.nodename[..nodename.len()].copy_from_slice(nodename);
-        name.release[..release.len()].copy_from_slice(release);
-        name.version[..version.len()].copy_from_slice(version);
-        name.machine[..machine.len()].copy_from_slice(machine);
+        // The shim answers this syscall itself from the same copy.
+        let name = ctx.objs.host.shim_shmem().utsname;
 
         ctx.objs
             .process
@@ -199,13 +199,17 @@ impl From<ForeignArrayPtr<u8>> for IoVec {
 /// after some bytes have already been read, the [`Read::read`](std::io::Read::read) will return how
 /// many bytes have been read.
 ///
+/// Each [`Read::read`](std::io::Read::read) reads from all of the needed `IoVec` buffers at once,
+/// so that copying from plugin memory takes at most one syscall rather than one per buffer.
+///
 /// In the future we may want to merge this with
 /// [`MemoryReaderCursor`](crate::host::memory_manager::MemoryReaderCursor).
 pub struct IoVecReader<'a, I> {
     iovs: I,
     mem: &'a MemoryManager,
-    /// A foreign pointer for the current iov.
-    current_src: Option<ForeignArrayPtr<u8>>,
+    /// Foreign pointers for the remaining parts of iovs that were partially read, with the next
+    /// one at the end.
+    pending: Vec<ForeignArrayPtr<u8>>,
 }
 
 impl<'a, I> IoVecReader<'a, I> {
@@ -216,7 +220,7 @@ impl<'a, I> IoVecReader<'a, I> {
         Self {
             iovs: iovs.into_iter(),
             mem,
-            current_src: None,
+            pending: Vec::new(),
         }
     }
 }
@@ -225,41 +229,28 @@ impl<'a, I: Iterator<Item = &'a IoVec>> std::io::Read for IoVecReader<'a, I> {
     fn read(&mut self, mut buf: &mut [u8]) -> std::io::Result<usize> {
         let mut bytes_read = 0;
 
-        loop {
-            // we filled the buffer
-            if buf.is_empty() {
+        while !buf.is_empty() {
+            let srcs = take_iovs(&mut self.iovs, &mut self.pending, buf.len());
+            if srcs.is_empty() {
+                // no iovs remaining
                 break;
             }
 
-            if let Some(ref mut src) = self.current_src {
-                let num_to_read = std::cmp::min(src.len(), buf.len());
-                let result = self
-                    .mem
-                    .copy_from_ptr(&mut buf[..num_to_read], src.slice(..num_to_read));
-
-                match (result, bytes_read) {
-                    // we successfully read the bytes
-                    (Ok(()), _) => {}
-                    // we haven't yet read any bytes, so return the error
-                    (Err(e), 0) => return Err(e.into()),
-                    // return how many bytes we've read
-                    (Err(_), _) => break,
-                }
-
-                bytes_read += num_to_read;
-                buf = &mut buf[num_to_read..];
-                *src = src.slice(num_to_read..);
-
-                if src.is_empty() {
-                    // no bytes remaining in this iov
-                    self.current_src = None;
-                }
-            } else {
-                let Some(next_iov) = self.iovs.next() else {
-                    // no iovs remaining
-                    break;
-                };
-                self.current_src = Some((*next_iov).into());
+            let num_read = match (self.mem.copy_from_ptrs(buf, &srcs), bytes_read) {
+                // we successfully read some bytes
+                (Ok(num_read), _) => num_read,
+                // we haven't yet read any bytes, so return the error
+                (Err(e), 0) => return Err(e.into()),
+                // return how many bytes we've read
+                (Err(_), _) => 0,
+            };
+
+            bytes_read += num_read;
+            buf = &mut buf[num_read..];
+
+            if return_iovs(&mut self.pending, &srcs, num_read) {
+                // couldn't read some of the iovs
+                break;
             }
         }
 
@@ -274,13 +265,17 @@ impl<'a, I: Iterator<Item = &'a IoVec>> std::io::Read for IoVecReader<'a, I> {
 /// after some bytes have already been written, the [`Write::write`](std::io::Write::write) will
 /// return how many bytes have been written.
 ///
+/// Each [`Write::write`](std::io::Write::write) writes to all of the needed `IoVec` buffers at
+/// once, so that copying to plugin memory takes at most one syscall rather than one per buffer.
+///
 /// In the future we may want to merge this with
 /// [`MemoryWriterCursor`](crate::host::memory_manager::MemoryWriterCursor).
 pub struct IoVecWriter<'a, I> {
     iovs: I,
     mem: &'a mut MemoryManager,
-    /// A foreign pointer for the current iov.
-    current_dst: Option<ForeignArrayPtr<u8>>,
+    /// Foreign pointers for the remaining parts of iovs that were partially written, with the next
+    /// one at the end.
+    pending: Vec<ForeignArrayPtr<u8>>,
 }
 
 impl<'a, I> IoVecWriter<'a, I> {
@@ -291,7 +286,7 @@ impl<'a, I> IoVecWriter<'a, I> {
         Self {
             iovs: iovs.into_iter(),
             mem,
-            current_dst: None,
+            pending: Vec::new(),
         }
     }
 }
@@ -300,41 +295,28 @@ impl<'a, I: Iterator<Item = &'a IoVec>> std::io::Write for IoVecWriter<'a, I> {
     fn write(&mut self, mut buf: &[u8]) -> std::io::Result<usize> {
         let mut bytes_written = 0;
 
-        loop {
-            // no bytes left to write
-            if buf.is_empty() {
+        while !buf.is_empty() {
+            let dsts = take_iovs(&mut self.iovs, &mut self.pending, buf.len());
+            if dsts.is_empty() {
+                // no iovs remaining
                 break;
             }
 
-            if let Some(ref mut dst) = self.current_dst {
-                let num_to_write = std::cmp::min(dst.len(), buf.len());
-                let result = self
-                    .mem
-                    .copy_to_ptr(dst.slice(..num_to_write), &buf[..num_to_write]);
-
-                match (result, bytes_written) {
-                    // we successfully wrote the bytes
-                    (Ok(()), _) => {}
-                    // we haven't yet written any bytes, so return the error
-                    (Err(e), 0) => return Err(e.into()),
-                    // return how many bytes we've written
-                    (Err(_), _) => break,
-                }
-
-                bytes_written += num_to_write;
-                buf = &buf[num_to_write..];
-                *dst = dst.slice(num_to_write..);
-
-                if dst.is_empty() {
-                    // no space remaining in this iov
-                    self.current_dst = None;
-                }
-            } else {
-                let Some(next_iov) = self.iovs.next() else {
-                    // no iovs remaining
-                    break;
-                };
-                self.current_dst = Some((*next_iov).into());
+            let num_written = match (self.mem.copy_to_ptrs(&dsts, buf), bytes_written) {
+                // we successfully wrote some bytes
+                (Ok(num_written), _) => num_written,
+                // we haven't yet written any bytes, so return the error
+                (Err(e), 0) => return Err(e.into()),
+                // return how many bytes we've written
+                (Err(_), _) => 0,
+            };
+
+            bytes_written += num_written;
+            buf = &buf[num_written..];
+
+            if return_iovs(&mut self.pending, &dsts, num_written) {
+                // couldn't write some of the iovs
+                break;
             }
         }
 
@@ -346,6 +328,61 @@ impl<'a, I: Iterator<Item = &'a IoVec>> std::io::Write for IoVecWriter<'a, I> {
     }
 }
 
+/// Take the next non-empty iov buffers from `pending` and then `iovs`, up to a total length of
+/// `max_len` and at most `UIO_MAXIOV` buffers. If the last buffer would exceed `max_len`, it's
+/// split and its remainder is pushed to `pending`.
+fn take_iovs<'a>(
+    iovs: &mut impl Iterator<Item = &'a IoVec>,
+    pending: &mut Vec<ForeignArrayPtr<u8>>,
+    max_len: usize,
+) -> Vec<ForeignArrayPtr<u8>> {
+    let max_count = usize::try_from(libc::UIO_MAXIOV).unwrap();
+    let mut ptrs = Vec::new();
+    let mut len = 0;
+
+    while len < max_len && ptrs.len() < max_count {
+        let Some(ptr) = pending.pop().or_else(|| iovs.next().map(|x| (*x).into())) else {
+            break;
+        };
+
+        if ptr.is_empty() {
+            continue;
+        }
+
+        let take = std::cmp::min(ptr.len(), max_len - len);
+        if take < ptr.len() {
+            pending.push(ptr.slice(take..));
+        }
+        ptrs.push(ptr.slice(..take));
+        len += take;
+    }
+
+    ptrs
+}
+
+/// Push the parts of `ptrs` after the first `num_used` bytes back to `pending`, so that they're
+/// taken again next. Returns `true` if any parts were pushed.
+fn return_iovs(
+    pending: &mut Vec<ForeignArrayPtr<u8>>,
+    ptrs: &[ForeignArrayPtr<u8>],
+    mut num_used: usize,
+) -> bool {
+    let mut unused = Vec::new();
+
+    for ptr in ptrs {
+        if num_used >= ptr.len() {
+            num_used -= ptr.len();
+        } else {
+            unused.push(ptr.slice(num_used..));
+            num_used = 0;
+        }
+    }
+
+    let any_unused = !unused.is_empty();
+    pending.extend(unused.into_iter().rev());
+    any_unused
+}
+
 /// Read a plugin's array of [`libc::iovec`] into a [`Vec<IoVec>`].
 pub fn read_iovecs(
     mem: &MemoryManager,
@@ -453,3 +490,58 @@ pub fn read_cstring_vec(
     }
     Ok(res)
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn iov(base: usize, len: usize) -> IoVec {
+        IoVec {
+            base: ForeignPtr::from(base).cast::<u8>(),
+            len,
+        }
+    }
+
+    fn addrs(ptrs: &[ForeignArrayPtr<u8>]) -> Vec<(usize, usize)> {
+        ptrs.iter()
+            .map(|x| (usize::from(x.ptr()), x.len()))
+            .collect()
+    }
+
+    #[test]
+    fn test_take_iovs() {
+        let iovs = [iov(100, 10), iov(200, 0), iov(300, 10), iov(400, 10)];
+        let mut iovs = iovs.iter();
+        let mut pending = Vec::new();
+
+        // the empty iov is skipped, and the last iov is split
+        let ptrs = take_iovs(&mut iovs, &mut pending, 15);
+        assert_eq!(addrs(&ptrs), [(100, 10), (300, 5)]);
+        assert_eq!(addrs(&pending), [(305, 5)]);
+
+        // the pending part is taken first
+        let ptrs = take_iovs(&mut iovs, &mut pending, 100);
+        assert_eq!(addrs(&ptrs), [(305, 5), (400, 10)]);
+        assert!(pending.is_empty());
+
+        assert!(take_iovs(&mut iovs, &mut pending, 100).is_empty());
+    }
+
+    #[test]
+    fn test_return_iovs() {
+        let iovs = [iov(100, 10), iov(200, 10), iov(300, 10)];
+        let mut iovs = iovs.iter();
+        let mut pending = Vec::new();
+
+        let ptrs = take_iovs(&mut iovs, &mut pending, 25);
+        assert_eq!(addrs(&ptrs), [(100, 10), (200, 10), (300, 5)]);
+
+        // everything was used
+        assert!(!return_iovs(&mut pending.clone(), &ptrs, 25));
+
+        // only the first iov was used, so the rest are taken again in the same order
+        assert!(return_iovs(&mut pending, &ptrs, 10));
+        let ptrs = take_iovs(&mut iovs, &mut pending, 100);
+        assert_eq!(addrs(&ptrs), [(200, 10), (300, 5), (305, 5)]);
+    }
+}
@@ -17,6 +17,7 @@
 #include "main/host/futex.h"
 #include "main/host/process.h"
 #include "main/host/status_listener.h"
+#include "main/utility/freelist.h"
 #include "main/utility/utility.h"
 
 struct _SysCallCondition {
@@ -24,8 +25,9 @@ struct _SysCallCondition {
     Trigger trigger;
     // Time at which the condition will expire, or EMUTIME_INVALID if no timeout.
     CEmulatedTime timeoutExpiration;
-    // Timeout object waiting for timeoutExpiration.
-    Timer* timeout;
+    // Id of our entry in the host's timeout wheel, or 0 if we aren't waiting for
+    // timeoutExpiration.
+    uint64_t timeoutId;
     // The active file in the blocked syscall. This is state used when resuming a blocked syscall.
     OpenFile* activeFile;
     // Non-null if we are listening for status updates on a trigger object
@@ -47,16 +49,38 @@ struct _SysCallCondition {
 static void _syscallcondition_unrefcb(void* cond_ptr);
 static void _syscallcondition_notifyTimeoutExpired(const Host* host, void* obj, void* arg);
 
+/* Nearly every blocking syscall creates and destroys a condition, and a thread typically blocks
+ * again soon after it wakes up, so we recycle conditions through a freelist. */
+#define SYSCALLCONDITION_MAX_FREE 256
+
+static __thread FreeList _syscallconditionFreeList =
+    FREELIST_INIT(SYSCALLCONDITION_MAX_FREE, free);
+
+static SysCallCondition* _syscallcondition_alloc() {
+    SysCallCondition* cond = freelist_pop(&_syscallconditionFreeList);
+    if (cond != NULL) {
+        return cond;
+    }
+
+    return malloc(sizeof(SysCallCondition));
+}
+
+static void _syscallcondition_dealloc(SysCallCondition* cond) {
+    if (!freelist_push(&_syscallconditionFreeList, cond)) {
+        free(cond);
+    }
+}
+
 SysCallCondition* syscallcondition_new(Trigger trigger) {
-    SysCallCondition* cond = malloc(sizeof(*cond));
+    SysCallCondition* cond = _syscallcondition_alloc();
 
     *cond = (SysCallCondition){.timeoutExpiration = EMUTIME_INVALID,
-                               .timeout = NULL,
+                               .timeoutId = 0,
                                .trigger = trigger,
                                .referenceCount = 1,
                                MAGIC_INITIALIZER};
 
-    worker_count_allocation(SysCallCondition);
+    worker_count_allocation(SYS_CALL_CONDITION);
 
     if (cond->trigger.object.as_pointer) {
         switch (cond->trigger.type) {
@@ -116,10 +140,12 @@ void syscallcondition_setActiveFile(SysCallCondition* cond, OpenFile* file) {
 static void _syscallcondition_cleanupListeners(SysCallCondition* cond) {
     MAGIC_ASSERT(cond);
 
-    if (cond->timeout) {
-        timer_disarm(cond->timeout);
-        timer_drop(cond->timeout);
-        cond->timeout = NULL;
+    if (cond->timeoutId) {
+        // Cancelling drops the wheel's task, which holds a reference to us; clear the id first
+        // in case that was the last one.
+        uint64_t timeoutId = cond->timeoutId;
+        cond->timeoutId = 0;
+        timeoutwheel_cancel(worker_getCurrentHost(), timeoutId);
     }
 
     if (cond->triggerListener) {
@@ -168,12 +194,8 @@ static void _syscallcondition_free(SysCallCondition* cond) {
     MAGIC_ASSERT(cond);
 
     _syscallcondition_cleanupListeners(cond);
-
-    if (cond->timeout) {
-        timer_disarm(cond->timeout);
-        timer_drop(cond->timeout);
-        cond->timeout = NULL;
-    }
+    // The wheel's task holds a reference, so we can't still be waiting for a timeout.
+    utility_debugAssert(!cond->timeoutId);
 
     if (cond->activeFile) {
         openfile_drop(cond->activeFile);
@@ -209,8 +231,8 @@ static void _syscallcondition_free(SysCallCondition* cond) {
     }
 
     MAGIC_CLEAR(cond);
-    free(cond);
-    worker_count_deallocation(SysCallCondition);
+    _syscallcondition_dealloc(cond);
+    worker_count_deallocation(SYS_CALL_CONDITION);
 }
 
 void syscallcondition_ref(SysCallCondition* cond) {
@@ -410,7 +432,7 @@ static void _syscallcondition_scheduleWakeupTask(SysCallCondition* cond, const H
      * the state of the trigger object again. */
     TaskRef* wakeupTask = taskref_new_bound(
         cond->hostId, _syscallcondition_trigger, cond, NULL, _syscallcondition_unrefcb, NULL);
-    host_scheduleTaskWithDelay(host, wakeupTask, 0); // Call without moving time forward
+    host_scheduleWakeupTask(host, wakeupTask); // Call without moving time forward
 
     syscallcondition_ref(cond);
     taskref_drop(wakeupTask);
@@ -458,15 +480,11 @@ void syscallcondition_waitNonblock(SysCallCondition* cond, const Host* host, con
     cond->threadId = thread_getID(thread);
 
     if (cond->timeoutExpiration != EMUTIME_INVALID) {
-        if (!cond->timeout) {
-            syscallcondition_ref(cond);
-            TaskRef* task = taskref_new_bound(cond->hostId, _syscallcondition_notifyTimeoutExpired,
-                                              cond, NULL, _syscallcondition_unrefcb, NULL);
-            cond->timeout = timer_new(task);
-            taskref_drop(task);
-        }
-
-        timer_arm(cond->timeout, host, cond->timeoutExpiration, 0);
+        syscallcondition_ref(cond);
+        TaskRef* task = taskref_new_bound(cond->hostId, _syscallcondition_notifyTimeoutExpired,
+                                          cond, NULL, _syscallcondition_unrefcb, NULL);
+        cond->timeoutId = timeoutwheel_add(host, cond->timeoutExpiration, task);
+        taskref_drop(task);
     }
 
     /* Now set up the listeners. */
@@ -12,7 +12,7 @@ use shadow_shim_helper_rs::explicit_drop::ExplicitDrop;
 use shadow_shim_helper_rs::rootedcell::rc::RootedRc;
 use shadow_shim_helper_rs::rootedcell::refcell::RootedRefCell;
 use shadow_shim_helper_rs::shim_shmem::{HostShmemProtected, ThreadShmem};
-use shadow_shim_helper_rs::syscall_types::{ForeignPtr, SyscallReg};
+use shadow_shim_helper_rs::syscall_types::{ForeignPtr, SyscallArgs, SyscallReg};
 use shadow_shim_helper_rs::util::SendPointer;
 use shadow_shim_helper_rs::HostId;
 use shadow_shmem::allocator::{shmalloc, ShMemBlock};
@@ -26,7 +26,7 @@ use crate::cshadow as c;
 use crate::host::syscall::condition::{SyscallConditionRef, SyscallConditionRefMut};
 use crate::host::syscall::handler::SyscallHandler;
 use crate::utility::callback_queue::CallbackQueue;
-use crate::utility::{syscall, IsSend, ObjectCounter};
+use crate::utility::{syscall, IsSend, ObjectCounter, ObjectType};
 
 /// The thread's state after having been allowed to execute some code.
 #[derive(Debug)]
@@ -119,6 +119,7 @@ impl Thread {
                 self.process_id,
                 new_tid,
                 host.params.use_syscall_counters,
+                host.params.use_syscall_latency_histograms,
             ),
         );
 
@@ -134,7 +135,7 @@ impl Thread {
                 .iter()
                 .filter_map(|(handle, descriptor)| {
                     if descriptor.flags().contains(DescriptorFlags::FD_CLOEXEC) {
-                        Some(*handle)
+                        Some(handle)
                     } else {
                         None
                     }
@@ -192,6 +193,21 @@ impl Thread {
         syscall::raw_return_value_to_result(self.native_syscall_raw(ctx, n, args))
     }
 
+    /// Have the plugin thread natively execute the given syscalls, in order, using as few round
+    /// trips to the plugin as possible. Every syscall is executed even if an earlier one fails.
+    pub fn native_syscalls(
+        &self,
+        ctx: &ProcessContext,
+        syscalls: &[SyscallArgs],
+    ) -> Vec<Result<SyscallReg, Errno>> {
+        self.mthread
+            .borrow()
+            .native_syscalls(&ctx.with_thread(self), syscalls)
+            .into_iter()
+            .map(|x| syscall::raw_return_value_to_result(x.into()))
+            .collect()
+    }
+
     pub fn process_id(&self) -> ProcessId {
         self.process_id
     }
@@ -446,7 +462,13 @@ impl Thread {
             mthread: RefCell::new(mthread),
             syscallhandler: RootedRefCell::new(
                 host.root(),
-                SyscallHandler::new(host.id(), pid, tid, host.params.use_syscall_counters),
+                SyscallHandler::new(
+                    host.id(),
+                    pid,
+                    tid,
+                    host.params.use_syscall_counters,
+                    host.params.use_syscall_latency_histograms,
+                ),
             ),
             cond: Cell::new(unsafe { SendPointer::new(std::ptr::null_mut()) }),
             id: tid,
@@ -458,7 +480,7 @@ impl Thread {
                 tid.into(),
             )),
             desc_table: Some(desc_table),
-            _counter: ObjectCounter::new("Thread"),
+            _counter: ObjectCounter::new(ObjectType::Thread),
         };
         Ok(child)
     }
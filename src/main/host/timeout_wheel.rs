@@ -0,0 +1,579 @@
+//! A hierarchical timing wheel for a host's syscall condition timeouts.
+//!
+//! Most syscall timeouts (poll, epoll_wait, futex waits, ...) are cancelled before they expire,
+//! because the thread was woken up by something else first. Scheduling one event per timeout
+//! would therefore mostly fill the host's event queue with events that end up doing nothing.
+//! Instead, timeouts wait in the wheel where cancelling one is an O(1) unlink, and the wheel
+//! keeps a single event scheduled for the next time one of its slots needs attention. Only when
+//! a timeout's level-0 slot comes due is it turned into an event at its exact expiration time.
+//!
+//! The wheel has [`NUM_LEVELS`] levels of [`SLOTS_PER_LEVEL`] slots. A level-0 slot spans one
+//! tick of `2^TICK_SHIFT` nanoseconds, and each slot on level `n` spans a whole turn of level
+//! `n - 1`. A timeout is placed on the level of the most significant group of tick bits in which
+//! its expiration differs from the wheel's current tick, and moves down ("cascades") once the
+//! wheel reaches the start of its slot.
+
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+use shadow_shim_helper_rs::simulation_time::SimulationTime;
+
+use super::host::Host;
+use crate::core::work::task::TaskRef;
+use crate::core::worker::Worker;
+use crate::utility::{ObjectCounter, ObjectType};
+
+/// Each level-0 tick spans `2^TICK_SHIFT` nanoseconds (about a millisecond).
+const TICK_SHIFT: u32 = 20;
+const SLOT_BITS: u32 = 6;
+const SLOTS_PER_LEVEL: usize = 1 << SLOT_BITS;
+/// Enough levels to cover every tick of a 64-bit nanosecond time.
+const NUM_LEVELS: usize = (64 - TICK_SHIFT).div_ceil(SLOT_BITS) as usize;
+
+/// Identifies a timeout added to a [`TimeoutWheel`]. Ids of removed timeouts are never reused
+/// for a timeout in the same entry until its generation wraps around.
+#[derive(Copy, Clone, Debug, PartialEq, Eq)]
+pub struct TimeoutId {
+    index: u32,
+    generation: u32,
+}
+
+impl TimeoutId {
+    /// An id that no timeout will ever have; used by C code to mean "no timeout".
+    pub const INVALID_RAW: u64 = 0;
+
+    pub fn to_raw(self) -> u64 {
+        (u64::from(self.generation) << 32) | u64::from(self.index)
+    }
+
+    pub fn from_raw(raw: u64) -> Option<Self> {
+        let generation = (raw >> 32) as u32;
+        // Generations start at 1, so `INVALID_RAW` never decodes to a valid id.
+        (generation != 0).then_some(Self {
+            index: raw as u32,
+            generation,
+        })
+    }
+}
+
+enum EntryState {
+    Free,
+    /// Waiting in the wheel, at position `pos` of the given slot.
+    Waiting {
+        level: u8,
+        slot: u8,
+        pos: u32,
+    },
+    /// Its level-0 slot came due, and an event is scheduled at its expiration time.
+    Due,
+}
+
+struct Entry<T> {
+    generation: u32,
+    expire: EmulatedTime,
+    expire_tick: u64,
+    state: EntryState,
+    value: Option<T>,
+}
+
+pub struct TimeoutWheel<T> {
+    entries: Vec<Entry<T>>,
+    free_entries: Vec<u32>,
+    /// Indices into `entries`, for every slot of every level.
+    slots: Vec<Vec<u32>>,
+    /// One bit per non-empty slot, for each level.
+    occupied: [u64; NUM_LEVELS],
+    /// Every timeout in a tick up to and including this one has been made due.
+    current_tick: u64,
+    /// The time of the earliest event we have scheduled to advance the wheel, if any.
+    armed: Option<EmulatedTime>,
+    _counter: ObjectCounter,
+}
+
+fn tick_of(t: EmulatedTime) -> u64 {
+    t.duration_since(&EmulatedTime::SIMULATION_START).as_nanos() as u64 >> TICK_SHIFT
+}
+
+fn tick_start(tick: u64) -> EmulatedTime {
+    EmulatedTime::SIMULATION_START + SimulationTime::from_nanos(tick << TICK_SHIFT)
+}
+
+fn slot_index(level: usize, slot: usize) -> usize {
+    level * SLOTS_PER_LEVEL + slot
+}
+
+fn slot_of(tick: u64, level: usize) -> usize {
+    ((tick >> (SLOT_BITS as usize * level)) as usize) & (SLOTS_PER_LEVEL - 1)
+}
+
+impl<T> TimeoutWheel<T> {
+    #[allow(clippy::new_without_default)]
+    pub fn new() -> Self {
+        Self {
+            entries: Vec::new(),
+            free_entries: Vec::new(),
+            slots: (0..NUM_LEVELS * SLOTS_PER_LEVEL)
+                .map(|_| Vec::new())
+                .collect(),
+            occupied: [0; NUM_LEVELS],
+            current_tick: 0,
+            armed: None,
+            _counter: ObjectCounter::new(ObjectType::TimeoutWheel),
+        }
+    }
+
+    /// Adds a timeout holding `value` that expires at `expire`. Timeouts that become due are
+    /// appended to `due`; note that these may include other timeouts that were waiting for the
+    /// wheel to advance up to `now`, and the new one if it expires in a tick the wheel has
+    /// already passed.
+    pub fn add(
+        &mut self,
+        now: EmulatedTime,
+        expire: EmulatedTime,
+        value: T,
+        due: &mut Vec<(TimeoutId, EmulatedTime)>,
+    ) -> TimeoutId {
+        // Catch up first, so that the new timeout is placed relative to the current tick.
+        self.advance(now, due);
+
+        let index = match self.free_entries.pop() {
+            Some(index) => index,
+            None => {
+                self.entries.push(Entry {
+                    generation: 0,
+                    expire: EmulatedTime::SIMULATION_START,
+                    expire_tick: 0,
+                    state: EntryState::Free,
+                    value: None,
+                });
+                u32::try_from(self.entries.len() - 1).unwrap()
+            }
+        };
+
+        let entry = &mut self.entries[index as usize];
+        entry.generation = entry.generation.wrapping_add(1).max(1);
+        entry.expire = expire;
+        entry.expire_tick = tick_of(expire);
+        entry.value = Some(value);
+        let id = TimeoutId {
+            index,
+            generation: entry.generation,
+        };
+
+        if entry.expire_tick <= self.current_tick {
+            entry.state = EntryState::Due;
+            due.push((id, std::cmp::max(expire, now)));
+        } else {
+            self.place(index);
+        }
+
+        id
+    }
+
+    /// Removes the timeout, returning its value if it was still in the wheel or due but not yet
+    /// taken with [`TimeoutWheel::take_due`].
+    pub fn cancel(&mut self, id: TimeoutId) -> Option<T> {
+        let entry = self.entries.get(id.index as usize)?;
+        if entry.generation != id.generation {
+            return None;
+        }
+
+        match entry.state {
+            EntryState::Free => return None,
+            EntryState::Waiting { level, slot, pos } => {
+                self.unlink(level as usize, slot as usize, pos as usize)
+            }
+            EntryState::Due => {}
+        }
+
+        self.release(id.index)
+    }
+
+    /// Removes a timeout that was reported due, returning its value if it hasn't been cancelled
+    /// since.
+    pub fn take_due(&mut self, id: TimeoutId) -> Option<T> {
+        let entry = self.entries.get(id.index as usize)?;
+        if entry.generation != id.generation || !matches!(entry.state, EntryState::Due) {
+            return None;
+        }
+        self.release(id.index)
+    }
+
+    /// Advances the wheel to `now`, appending every timeout that has become due to `due` along
+    /// with its expiration time (or `now`, if that is later).
+    pub fn advance(&mut self, now: EmulatedTime, due: &mut Vec<(TimeoutId, EmulatedTime)>) {
+        let target = tick_of(now);
+
+        while let Some(tick) = self.next_tick().filter(|&tick| tick <= target) {
+            self.current_tick = tick;
+
+            // Higher levels first, so that cascaded timeouts can cascade further down.
+            for level in (1..NUM_LEVELS).rev() {
+                let slot = slot_of(tick, level);
+                if self.occupied[level] & (1 << slot) != 0 {
+                    let indices = std::mem::take(&mut self.slots[slot_index(level, slot)]);
+                    self.occupied[level] &= !(1 << slot);
+                    for &index in &indices {
+                        self.place(index);
+                    }
+                    // Keep the allocation around for the next time this slot is filled.
+                    let mut indices = indices;
+                    indices.clear();
+                    self.slots[slot_index(level, slot)] = indices;
+                }
+            }
+
+            let slot = slot_of(tick, 0);
+            if self.occupied[0] & (1 << slot) != 0 {
+                self.occupied[0] &= !(1 << slot);
+                let indices = &mut self.slots[slot_index(0, slot)];
+                for index in indices.drain(..) {
+                    let entry = &mut self.entries[index as usize];
+                    debug_assert_eq!(entry.expire_tick, tick);
+                    entry.state = EntryState::Due;
+                    let id = TimeoutId {
+                        index,
+                        generation: entry.generation,
+                    };
+                    due.push((id, std::cmp::max(entry.expire, now)));
+                }
+            }
+        }
+
+        // Nothing is due before `target`, so timeouts stay valid in their slots when we skip
+        // ahead to it.
+        self.current_tick = std::cmp::max(self.current_tick, target);
+    }
+
+    /// The time at which the wheel next needs to be advanced, if it holds any timeouts.
+    pub fn next_advance_time(&self) -> Option<EmulatedTime> {
+        self.next_tick().map(tick_start)
+    }
+
+    /// Returns true if the wheel holds no timeouts, including due ones that haven't been taken.
+    pub fn is_empty(&self) -> bool {
+        self.free_entries.len() == self.entries.len()
+    }
+
+    /// The expiration tick of the earliest slot that must be processed next: either a level-0
+    /// slot that comes due or a higher level slot whose timeouts need to cascade.
+    fn next_tick(&self) -> Option<u64> {
+        (0..NUM_LEVELS)
+            .filter_map(|level| {
+                let shift = SLOT_BITS as usize * level;
+                let current_slot = slot_of(self.current_tick, level);
+                // Timeouts on each level are always in slots after the current one.
+                let later = self.occupied[level] & !(u64::MAX >> (63 - current_slot));
+                if later == 0 {
+                    return None;
+                }
+                let slot = u64::from(later.trailing_zeros());
+                let turn_shift = shift + SLOT_BITS as usize;
+                let turn = if turn_shift >= 64 {
+                    0
+                } else {
+                    (self.current_tick >> turn_shift) << turn_shift
+                };
+                Some(turn | (slot << shift))
+            })
+            .min()
+    }
+
+    /// Puts a timeout that is not yet due into the slot matching its expiration tick.
+    fn place(&mut self, index: u32) {
+        let expire_tick = self.entries[index as usize].expire_tick;
+        let diff = expire_tick ^ self.current_tick;
+        let level = if diff == 0 {
+            // We're cascading down into its tick; it's due as soon as we drain level 0.
+            0
+        } else {
+            (63 - diff.leading_zeros() as usize) / SLOT_BITS as usize
+        };
+        let slot = slot_of(expire_tick, level);
+
+        let indices = &mut self.slots[slot_index(level, slot)];
+        let pos = u32::try_from(indices.len()).unwrap();
+        indices.push(index);
+        self.occupied[level] |= 1 << slot;
+
+        self.entries[index as usize].state = EntryState::Waiting {
+            level: level as u8,
+            slot: slot as u8,
+            pos,
+        };
+    }
+
+    fn unlink(&mut self, level: usize, slot: usize, pos: usize) {
+        let indices = &mut self.slots[slot_index(level, slot)];
+        indices.swap_remove(pos);
+
+        if let Some(&moved) = indices.get(pos) {
+            let EntryState::Waiting { pos: moved_pos, .. } =
+                &mut self.entries[moved as usize].state
+            else {
+                unreachable!();
+            };
+            *moved_pos = u32::try_from(pos).unwrap();
+        }
+
+        if indices.is_empty() {
+            self.occupied[level] &= !(1 << slot);
+        }
+    }
+
+    fn release(&mut self, index: u32) -> Option<T> {
+        let entry = &mut self.entries[index as usize];
+        entry.state = EntryState::Free;
+        self.free_entries.push(index);
+        entry.value.take()
+    }
+}
+
+impl TimeoutWheel<TaskRef> {
+    /// Adds a timeout to the host's wheel that executes `task` at `expire`.
+    pub fn add_timeout(host: &Host, expire: EmulatedTime, task: TaskRef) -> TimeoutId {
+        let now = Worker::current_time().unwrap();
+        let mut due = Vec::new();
+
+        let mut wheel = host.timeouts_borrow_mut();
+        let id = wheel.add(now, expire, task, &mut due);
+        Self::schedule_due(host, &due);
+        wheel.rearm(host);
+
+        id
+    }
+
+    /// Cancels a timeout previously added with [`TimeoutWheel::add_timeout`]. Does nothing if
+    /// the timeout already expired.
+    pub fn cancel_timeout(host: &Host, id: TimeoutId) {
+        let task = host.timeouts_borrow_mut().cancel(id);
+        // Dropping the task may drop the last reference to its owner, which may in turn want to
+        // use the wheel, so only do that after we've released it.
+        drop(task);
+    }
+
+    fn rearm(&mut self, host: &Host) {
+        let Some(time) = self.next_advance_time() else {
+            return;
+        };
+        if self.armed.is_some_and(|armed| armed <= time) {
+            // An earlier event will advance the wheel and rearm it.
+            return;
+        }
+        if host.schedule_task_at_emulated_time(TaskRef::new(Self::on_advance), time) {
+            self.armed = Some(time);
+        }
+    }
+
+    fn on_advance(host: &Host) {
+        let now = Worker::current_time().unwrap();
+        let mut due = Vec::new();
+
+        let mut wheel = host.timeouts_borrow_mut();
+        if wheel.armed.is_some_and(|armed| armed <= now) {
+            wheel.armed = None;
+        }
+        wheel.advance(now, &mut due);
+        Self::schedule_due(host, &due);
+        wheel.rearm(host);
+    }
+
+    fn schedule_due(host: &Host, due: &[(TimeoutId, EmulatedTime)]) {
+        for &(id, time) in due {
+            let task = TaskRef::new(move |host| {
+                let task = host.timeouts_borrow_mut().take_due(id);
+                if let Some(task) = task {
+                    task.execute(host);
+                }
+            });
+            host.schedule_task_at_emulated_time(task, time);
+        }
+    }
+}
+
+pub mod export {
+    use shadow_shim_helper_rs::emulated_time::CEmulatedTime;
+
+    use super::*;
+
+    /// Adds a timeout to `host`'s timeout wheel that executes `task` at `expireTime`, and
+    /// returns an id that can be passed to `timeoutwheel_cancel`. The returned id is never 0.
+    ///
+    /// # Safety
+    ///
+    /// Pointer args must be safely dereferenceable.
+    #[no_mangle]
+    #[allow(non_snake_case)]
+    pub unsafe extern "C-unwind" fn timeoutwheel_add(
+        host: *const Host,
+        expireTime: CEmulatedTime,
+        task: *const TaskRef,
+    ) -> u64 {
+        let host = unsafe { host.as_ref() }.unwrap();
+        let task = unsafe { task.as_ref() }.unwrap().clone();
+        let expireTime = EmulatedTime::from_c_emutime(expireTime).unwrap();
+        TimeoutWheel::add_timeout(host, expireTime, task).to_raw()
+    }
+
+    /// Cancels a timeout added with `timeoutwheel_add`, dropping its task. Cancelling a timeout
+    /// that already expired is a no-op.
+    ///
+    /// # Safety
+    ///
+    /// Pointer args must be safely dereferenceable.
+    #[no_mangle]
+    pub unsafe extern "C-unwind" fn timeoutwheel_cancel(host: *const Host, id: u64) {
+        let host = unsafe { host.as_ref() }.unwrap();
+        let Some(id) = TimeoutId::from_raw(id) else {
+            return;
+        };
+        TimeoutWheel::cancel_timeout(host, id);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn at_nanos(nanos: u64) -> EmulatedTime {
+        EmulatedTime::SIMULATION_START + SimulationTime::from_nanos(nanos)
+    }
+
+    /// Advances `wheel` through each event it asks for up to `end`, the way the host's event
+    /// loop would, and returns the due timeouts along with the number of advance events.
+    fn run_until(
+        wheel: &mut TimeoutWheel<u32>,
+        end: EmulatedTime,
+    ) -> (Vec<(u32, EmulatedTime)>, usize) {
+        let mut fired = Vec::new();
+        let mut events = 0;
+        while let Some(time) = wheel.next_advance_time().filter(|&t| t <= end) {
+            events += 1;
+            let mut due = Vec::new();
+            wheel.advance(time, &mut due);
+            for (id, time) in due {
+                fired.push((wheel.take_due(id).unwrap(), time));
+            }
+        }
+        (fired, events)
+    }
+
+    #[test]
+    fn test_expires_in_order() {
+        let mut wheel = TimeoutWheel::new();
+        let mut due = Vec::new();
+        let start = at_nanos(0);
+
+        // Spread across several levels, added out of order.
+        let expirations: Vec<u64> = vec![
+            5_000_000_000,
+            3 << TICK_SHIFT,
+            1_100_000,
+            70 << TICK_SHIFT,
+            4097 << TICK_SHIFT,
+            3_600_000_000_000,
+            (4096 << TICK_SHIFT) + 17,
+        ];
+        for (i, &nanos) in expirations.iter().enumerate() {
+            wheel.add(start, at_nanos(nanos), i as u32, &mut due);
+        }
+        assert!(due.is_empty());
+
+        let (fired, _) = run_until(&mut wheel, EmulatedTime::MAX);
+        assert!(wheel.is_empty());
+        assert_eq!(fired.len(), expirations.len());
+
+        // Each timeout is due at exactly its expiration time, and they come due in tick order.
+        for (value, time) in &fired {
+            assert_eq!(*time, at_nanos(expirations[*value as usize]));
+        }
+        let ticks: Vec<u64> = fired.iter().map(|(_, time)| tick_of(*time)).collect();
+        assert!(ticks.windows(2).all(|w| w[0] <= w[1]));
+    }
+
+    #[test]
+    fn test_cancel() {
+        let mut wheel = TimeoutWheel::new();
+        let mut due = Vec::new();
+        let start = at_nanos(0);
+
+        let ids: Vec<TimeoutId> = (0..100)
+            .map(|i| wheel.add(start, at_nanos(i * 10_000_000), i as u32, &mut due))
+            .collect();
+        // The first one expires in the current tick.
+        assert_eq!(due.len(), 1);
+        assert_eq!(wheel.take_due(due[0].0), Some(0));
+
+        for id in ids.iter().skip(1).step_by(2) {
+            assert!(wheel.cancel(*id).is_some());
+            // Cancelling twice is harmless.
+            assert!(wheel.cancel(*id).is_none());
+        }
+
+        let (fired, _) = run_until(&mut wheel, EmulatedTime::MAX);
+        let values: Vec<u32> = fired.iter().map(|(value, _)| *value).collect();
+        assert_eq!(values, (2..100).step_by(2).collect::<Vec<u32>>());
+        assert!(wheel.is_empty());
+        // Stale ids don't match reused entries.
+        assert!(wheel.cancel(ids[1]).is_none());
+    }
+
+    #[test]
+    fn test_cancel_after_due() {
+        let mut wheel = TimeoutWheel::new();
+        let mut due = Vec::new();
+        let id = wheel.add(at_nanos(0), at_nanos(1 << TICK_SHIFT), 7, &mut due);
+
+        wheel.advance(at_nanos(1 << TICK_SHIFT), &mut due);
+        assert_eq!(due, vec![(id, at_nanos(1 << TICK_SHIFT))]);
+        due.clear();
+
+        assert_eq!(wheel.cancel(id), Some(7));
+        assert_eq!(wheel.take_due(id), None);
+        assert!(wheel.is_empty());
+    }
+
+    #[test]
+    fn test_cancelled_never_become_events() {
+        let mut wheel = TimeoutWheel::new();
+        let mut due = Vec::new();
+        let mut now = at_nanos(0);
+
+        // Mimic a thread repeatedly polling with a 1 second timeout that is always cancelled
+        // after 10 ms because the fd became ready first.
+        for i in 0..10_000 {
+            let id = wheel.add(now, now + SimulationTime::SECOND, i, &mut due);
+            now = now + SimulationTime::from_millis(10);
+            wheel.advance(now, &mut due);
+            assert!(wheel.cancel(id).is_some());
+        }
+        assert!(due.is_empty());
+        assert!(wheel.is_empty());
+    }
+
+    #[test]
+    fn test_add_after_gap() {
+        let mut wheel = TimeoutWheel::new();
+        let mut due = Vec::new();
+
+        let far = at_nanos(3_600_000_000_000);
+        wheel.add(at_nanos(0), far, 0, &mut due);
+
+        // Time moved on without the wheel being advanced in between.
+        let now = at_nanos(1_000_000_000_000);
+        wheel.add(now, now + SimulationTime::from_millis(5), 1, &mut due);
+        assert!(due.is_empty());
+        assert!(wheel.next_advance_time().unwrap() >= now);
+
+        let (fired, _) = run_until(&mut wheel, EmulatedTime::MAX);
+        assert_eq!(fired.iter().map(|f| f.0).collect::<Vec<_>>(), vec![1, 0]);
+    }
+
+    #[test]
+    fn test_raw_id() {
+        let id = TimeoutId {
+            index: 12,
+            generation: 3,
+        };
+        assert_eq!(TimeoutId::from_raw(id.to_raw()), Some(id));
+        assert_eq!(TimeoutId::from_raw(TimeoutId::INVALID_RAW), None);
+    }
+}
@@ -8,7 +8,7 @@ use shadow_shim_helper_rs::simulation_time::SimulationTime;
 use super::host::Host;
 use crate::core::work::task::TaskRef;
 use crate::core::worker::Worker;
-use crate::utility::{Magic, ObjectCounter};
+use crate::utility::{Magic, ObjectCounter, ObjectType};
 
 pub struct Timer {
     magic: Magic<Self>,
@@ -27,6 +27,8 @@ struct TimerInternal {
     expiration_count: u64,
     next_expire_id: u64,
     min_valid_expire_id: u64,
+    /// See [`Timer::new_lazy`].
+    lazy: bool,
     on_expire: Box<dyn Fn(&Host) + Send + Sync>,
 }
 
@@ -41,6 +43,47 @@ impl TimerInternal {
         self.next_expire_time = next_expire_time;
         self.expire_interval = expire_interval;
     }
+
+    /// Returns true if this is a lazy periodic timer that has unconsumed expirations, in which
+    /// case additional expirations aren't scheduled and are counted by
+    /// [`apply_lazy_expirations`](Self::apply_lazy_expirations) instead.
+    fn is_lazily_expiring(&self) -> bool {
+        self.lazy && self.expire_interval.is_some() && self.expiration_count > 0
+    }
+
+    /// The number of expirations that have occurred up to `now` without having been scheduled.
+    fn num_lazy_expirations(&self, now: EmulatedTime) -> u64 {
+        if !self.is_lazily_expiring() {
+            return 0;
+        }
+
+        let next_expire_time = self.next_expire_time.unwrap();
+        if next_expire_time > now {
+            return 0;
+        }
+
+        let interval = self.expire_interval.unwrap();
+        let elapsed = now.duration_since(&next_expire_time);
+        u64::try_from(elapsed.as_nanos() / interval.as_nanos()).unwrap() + 1
+    }
+
+    /// The next expiration time after any expirations up to `now` that haven't been scheduled.
+    fn lazy_next_expire_time(&self, now: EmulatedTime) -> Option<EmulatedTime> {
+        let num_expired = self.num_lazy_expirations(now);
+        let t = self.next_expire_time?;
+        if num_expired == 0 {
+            return Some(t);
+        }
+        let interval = self.expire_interval.unwrap();
+        Some(t + interval.checked_mul(num_expired).unwrap())
+    }
+
+    /// Count any expirations that have occurred up to `now` without having been scheduled.
+    fn apply_lazy_expirations(&mut self, now: EmulatedTime) {
+        let next_expire_time = self.lazy_next_expire_time(now);
+        self.expiration_count += self.num_lazy_expirations(now);
+        self.next_expire_time = next_expire_time;
+    }
 }
 
 impl Timer {
@@ -49,15 +92,30 @@ impl Timer {
     /// of the enclosing Timer.  If it may need to call mutable methods of the
     /// Timer, it should push a new task to the scheduler to do so.
     pub fn new<F: 'static + Fn(&Host) + Send + Sync>(on_expire: F) -> Self {
+        Self::new_inner(on_expire, /* lazy= */ false)
+    }
+
+    /// Like [`Timer::new`], but a periodic timer stops scheduling expiration events once it has
+    /// expired, until the expiration count is consumed. Any expirations in the meantime are
+    /// computed from the elapsed time when they're needed, and don't execute `on_expire`. This is
+    /// useful when the only effect of an expiration is the count (for example a timerfd becoming
+    /// readable), so that a periodic timer that isn't being read doesn't cost an event each
+    /// interval.
+    pub fn new_lazy<F: 'static + Fn(&Host) + Send + Sync>(on_expire: F) -> Self {
+        Self::new_inner(on_expire, /* lazy= */ true)
+    }
+
+    fn new_inner<F: 'static + Fn(&Host) + Send + Sync>(on_expire: F, lazy: bool) -> Self {
         Self {
             magic: Magic::new(),
-            _counter: ObjectCounter::new("Timer"),
+            _counter: ObjectCounter::new(ObjectType::Timer),
             internal: Arc::new(AtomicRefCell::new(TimerInternal {
                 next_expire_time: None,
                 expire_interval: None,
                 expiration_count: 0,
                 next_expire_id: 0,
                 min_valid_expire_id: 0,
+                lazy,
                 on_expire: Box::new(on_expire),
             })),
         }
@@ -67,7 +125,8 @@ impl Timer {
     /// [`Timer::consume_expiration_count()`] was called without resetting the counter.
     pub fn expiration_count(&self) -> u64 {
         self.magic.debug_check();
-        self.internal.borrow().expiration_count
+        let internal = self.internal.borrow();
+        internal.expiration_count + internal.num_lazy_expirations(Worker::current_time().unwrap())
     }
 
     /// Returns the currently configured timer expiration interval if this timer is configured to
@@ -82,8 +141,21 @@ impl Timer {
     pub fn consume_expiration_count(&mut self) -> u64 {
         self.magic.debug_check();
         let mut internal = self.internal.borrow_mut();
+        internal.apply_lazy_expirations(Worker::current_time().unwrap());
+
+        // a lazy timer stopped scheduling expiration events, so start again
+        let reschedule = internal.is_lazily_expiring();
+
         let e = internal.expiration_count;
         internal.expiration_count = 0;
+
+        if reschedule {
+            Worker::with_active_host(|host| {
+                Self::schedule_new_expire_event(&mut internal, Arc::downgrade(&self.internal), host)
+            })
+            .unwrap();
+        }
+
         e
     }
 
@@ -91,8 +163,8 @@ impl Timer {
     /// armed, or None otherwise.
     pub fn remaining_time(&self) -> Option<SimulationTime> {
         self.magic.debug_check();
-        let t = self.internal.borrow().next_expire_time?;
         let now = Worker::current_time().unwrap();
+        let t = self.internal.borrow().lazy_next_expire_time(now)?;
         Some(t.saturating_duration_since(&now))
     }
 
@@ -140,7 +212,10 @@ impl Timer {
             // The interval must be positive.
             debug_assert!(interval.is_positive());
             internal_brw.next_expire_time = Some(next_expire_time + interval);
-            Self::schedule_new_expire_event(&mut internal_brw, internal_weak.clone(), host);
+            // a lazy timer will count later expirations once they're needed
+            if !internal_brw.is_lazily_expiring() {
+                Self::schedule_new_expire_event(&mut internal_brw, internal_weak.clone(), host);
+            }
         } else {
             // Reset next expire time to None, so that `remaining_time`
             // correctly returns `None`, instead of `Some(0)`. (i.e. `Some(0)`
@@ -160,19 +235,10 @@ impl Timer {
         internal_ptr: Weak<AtomicRefCell<TimerInternal>>,
         host: &Host,
     ) {
-        let now = Worker::current_time().unwrap();
-
-        // have the timer expire between (1,2] seconds from now, but on a 1-second edge so that all
-        // timer events for all hosts will expire at the same times (and therefore in the same
-        // scheduling rounds, hopefully improving scheduling parallelization)
-        let since_start = now.duration_since(&EmulatedTime::SIMULATION_START);
-        let early_expire_time_since_start =
-            SimulationTime::from_secs(since_start.as_secs()) + SimulationTime::SECOND * 2;
-
-        let time = std::cmp::min(
-            internal_ref.next_expire_time.unwrap(),
-            EmulatedTime::SIMULATION_START + early_expire_time_since_start,
-        );
+        // Schedule the event at the expiration time itself. The controller jumps the next round
+        // straight to the earliest event of any host, so a timer that expires far in the future
+        // doesn't cost any rounds before it expires.
+        let time = internal_ref.next_expire_time.unwrap();
         let expire_id = internal_ref.next_expire_id;
         internal_ref.next_expire_id += 1;
         let task = TaskRef::new(move |host| Self::timer_expire(&internal_ptr, host, expire_id));
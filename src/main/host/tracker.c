@@ -7,6 +7,7 @@
 /* a packet is a 'data' packet if it has a payload attached, and a 'control' packet otherwise.
  * each packet is either a 'normal' packet or a 'retransmitted' packet. */
 #include <glib.h>
+#include <math.h>
 #include <netinet/in.h>
 #include <string.h>
 
@@ -47,11 +48,81 @@ typedef struct {
     Counters outCounters;
 } IFaceCounters;
 
+/* Binary heartbeat records, written with the heartbeat writer when the binary format is
+ * configured. The layouts must match src/tools/convert-heartbeats.py, and the version in
+ * heartbeat_writer.rs must be bumped when they change. */
+typedef enum {
+    HEARTBEAT_RECORD_HOST = 0, /* the host's name, not NUL-terminated */
+    HEARTBEAT_RECORD_NODE = 1,
+    HEARTBEAT_RECORD_SOCKET = 2,
+    HEARTBEAT_RECORD_RAM = 3,
+} HeartbeatRecordKind;
+
+typedef struct {
+    uint64_t packetsControl;
+    uint64_t packetsControlRetransmit;
+    uint64_t packetsData;
+    uint64_t packetsDataRetransmit;
+    uint64_t bytesControlHeader;
+    uint64_t bytesControlHeaderRetransmit;
+    uint64_t bytesDataHeader;
+    uint64_t bytesDataHeaderRetransmit;
+    uint64_t bytesDataPayload;
+    uint64_t bytesDataPayloadRetransmit;
+} HeartbeatCounters;
+
+typedef struct {
+    HeartbeatCounters inLocal;
+    HeartbeatCounters outLocal;
+    HeartbeatCounters inRemote;
+    HeartbeatCounters outRemote;
+} HeartbeatIFaceCounters;
+
+typedef struct {
+    uint64_t intervalNanos;
+    uint64_t processingTimeNanos;
+    uint64_t delayedCount;
+    uint64_t delayTimeNanos;
+    HeartbeatIFaceCounters counters;
+} HeartbeatNodeRecord;
+
+typedef struct {
+    uint64_t socket;
+    uint32_t protocol; /* ProtocolType */
+    uint32_t peerIP;   /* network byte order */
+    uint32_t peerPort; /* host byte order */
+    uint32_t reserved;
+    uint64_t inputBufferLength;
+    uint64_t inputBufferSize;
+    uint64_t outputBufferLength;
+    uint64_t outputBufferSize;
+    HeartbeatIFaceCounters counters;
+} HeartbeatSocketRecord;
+
+typedef struct {
+    uint64_t intervalNanos;
+    uint64_t allocatedBytes;
+    uint64_t deallocatedBytes;
+    uint64_t allocatedBytesTotal;
+    uint64_t pointersCount;
+    uint64_t failedFreesCount;
+} HeartbeatRAMRecord;
+
 struct _Tracker {
     /* our personal settings as configured in the shadow xml config file */
     CSimulationTime interval;
     LogLevel loglevel;
     LogInfoFlags loginfo;
+    /* write binary records with the heartbeat writer instead of log messages */
+    bool binaryFormat;
+    /* account for only about one in this many packets in the packet and byte counters, or for
+     * every packet if 0 or 1 */
+    guint packetSampleInterval;
+    /* xorshift state for choosing the sampled packets. we don't use the host's random source, so
+     * that sampling doesn't change the simulation */
+    guint64 sampleRngState;
+    guint inputPacketsUntilSample;
+    guint outputPacketsUntilSample;
 
     gboolean didLogNodeHeader;
     gboolean didLogRAMHeader;
@@ -74,7 +145,13 @@ struct _Tracker {
     gsize deallocatedBytesLastInterval;
     guint numFailedFrees;
 
-    GHashTable* socketStats;
+    /* socket stats indexed by the slot number in their handle, with NULL for unused slots */
+    GPtrArray* socketStats;
+    /* slot numbers of the unused slots in socketStats */
+    GArray* freeSocketSlots;
+    /* generation of the most recently added socket, so that a stale handle doesn't match a
+     * socket that later reused its slot */
+    guint32 socketGeneration;
 
     CEmulatedTime lastHeartbeat;
 
@@ -85,6 +162,11 @@ typedef struct _SocketStats SocketStats;
 struct _SocketStats {
     /* use the socket's pointer as a unique id/handle */
     guintptr socket;
+    /* must match the generation in the socket's tracker handle */
+    guint32 generation;
+
+    guint inputPacketsUntilSample;
+    guint outputPacketsUntilSample;
     ProtocolType type;
 
     in_addr_t peerIP;
@@ -126,23 +208,106 @@ static void _socketstats_free(SocketStats* ss) {
     }
 }
 
-static guintptr _tracker_socketHandle(const CompatSocket* sock) {
-    return compatsocket_getCanonicalHandle(sock);
+/* a handle is the socket's generation in the upper 32 bits, and its slot in the lower 32 bits */
+static guint _tracker_handleSlot(TrackerSocketHandle handle) {
+    return (guint)(handle & G_MAXUINT32);
+}
+
+static guint32 _tracker_handleGeneration(TrackerSocketHandle handle) {
+    return (guint32)(handle >> 32);
+}
+
+/* returns NULL if the handle is unset or refers to a socket whose stats were already freed */
+static SocketStats* _tracker_getSocketStats(Tracker* tracker, const CompatSocket* socket) {
+    TrackerSocketHandle handle = compatsocket_getTrackerHandle(socket);
+    if (handle == TRACKER_SOCKET_HANDLE_NONE) {
+        return NULL;
+    }
+
+    guint slot = _tracker_handleSlot(handle);
+    if (slot >= tracker->socketStats->len) {
+        return NULL;
+    }
+
+    SocketStats* ss = g_ptr_array_index(tracker->socketStats, slot);
+    if (!ss || ss->generation != _tracker_handleGeneration(handle)) {
+        return NULL;
+    }
+
+    return ss;
+}
+
+/* The number of packets to skip before the next sampled one. The gaps are geometrically
+ * distributed, which is the same as sampling each packet independently with probability 1/N, so
+ * that weighting each sampled packet by N gives unbiased estimates and periodic traffic patterns
+ * can't alias with the sampling. */
+static guint _tracker_nextSampleGap(Tracker* tracker) {
+    if (tracker->packetSampleInterval <= 1) {
+        return 0;
+    }
+
+    /* xorshift64* */
+    guint64 x = tracker->sampleRngState;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    tracker->sampleRngState = x;
+    guint64 r = x * G_GUINT64_CONSTANT(0x2545F4914F6CDD1D);
+
+    /* uniform in (0, 1) */
+    gdouble u = ((gdouble)(r >> 11) + 0.5) / (gdouble)(G_GUINT64_CONSTANT(1) << 53);
+    gdouble gap = floor(log(u) / log1p(-1.0 / tracker->packetSampleInterval));
+
+    return gap < (gdouble)G_MAXUINT ? (guint)gap : G_MAXUINT;
+}
+
+/* Returns the weight with which to account for the next packet, or 0 if it isn't sampled. */
+static guint _tracker_samplePacket(Tracker* tracker, guint* packetsUntilSample) {
+    if (tracker->packetSampleInterval <= 1) {
+        return 1;
+    }
+
+    if (*packetsUntilSample > 0) {
+        (*packetsUntilSample)--;
+        return 0;
+    }
+
+    *packetsUntilSample = _tracker_nextSampleGap(tracker);
+    return tracker->packetSampleInterval;
+}
+
+static void _tracker_freeSocketSlot(Tracker* tracker, guint slot) {
+    _socketstats_free(g_ptr_array_index(tracker->socketStats, slot));
+    g_ptr_array_index(tracker->socketStats, slot) = NULL;
+    g_array_append_val(tracker->freeSocketSlots, slot);
 }
 
 Tracker* tracker_new(const Host* host, CSimulationTime interval, LogLevel loglevel,
-                     LogInfoFlags loginfo) {
+                     LogInfoFlags loginfo, bool binaryFormat, guint packetSampleInterval) {
     Tracker* tracker = g_new0(Tracker, 1);
     MAGIC_INIT(tracker);
 
     tracker->interval = interval;
     tracker->loglevel = loglevel;
     tracker->loginfo = loginfo;
+    tracker->binaryFormat = binaryFormat;
+    tracker->packetSampleInterval = packetSampleInterval;
+    /* any non-zero seed works, but it should differ between hosts */
+    tracker->sampleRngState = G_GUINT64_CONSTANT(0x9E3779B97F4A7C15) ^ host_getID(host);
+    tracker->inputPacketsUntilSample = _tracker_nextSampleGap(tracker);
+    tracker->outputPacketsUntilSample = _tracker_nextSampleGap(tracker);
 
     tracker->allocatedLocations = g_hash_table_new(g_direct_hash, g_direct_equal);
-    tracker->socketStats = g_hash_table_new_full(g_int_hash, g_int_equal, NULL, (GDestroyNotify)_socketstats_free);
+    tracker->socketStats = g_ptr_array_new_with_free_func((GDestroyNotify)_socketstats_free);
+    tracker->freeSocketSlots = g_array_new(FALSE, FALSE, sizeof(guint));
+
+    /* the binary records only carry the host id, so record the name that goes with it */
+    if (tracker->binaryFormat) {
+        const char* name = host_getName(host);
+        heartbeatwriter_writeRecord(host, HEARTBEAT_RECORD_HOST, name, strlen(name));
+    }
 
-    /* send an alive message, and start periodic heartbeats */
+    /* send an alive message; the host runs the periodic heartbeats */
     tracker_heartbeat(tracker, host);
 
     return tracker;
@@ -159,7 +324,8 @@ void tracker_free(Tracker* tracker) {
 
     g_hash_table_foreach(tracker->allocatedLocations, _tracker_freeAllocatedLocations, NULL);
     g_hash_table_destroy(tracker->allocatedLocations);
-    g_hash_table_destroy(tracker->socketStats);
+    g_ptr_array_free(tracker->socketStats, TRUE);
+    g_array_free(tracker->freeSocketSlots, TRUE);
 
     MAGIC_CLEAR(tracker);
     g_free(tracker);
@@ -185,22 +351,26 @@ void tracker_addVirtualProcessingDelay(Tracker* tracker, CSimulationTime delay)
     }
 }
 
+/* account for 'weight' packets like this one */
 static void _tracker_updateCounters(Counters* c, gsize header, gsize payload,
-        PacketDeliveryStatusFlags status) {
+        PacketDeliveryStatusFlags status, guint weight) {
     if(!c) {
         return;
     }
 
+    header *= weight;
+    payload *= weight;
+
     if(payload > 0) {
         /* this is a 'data' packet */
         if(status & PDS_SND_TCP_RETRANSMITTED) {
             /* this is a retransmitted 'data' packet */
-            c->packets.dataRetransmit++;
+            c->packets.dataRetransmit += weight;
             c->bytes.dataHeaderRetransmit += header;
             c->bytes.dataPayloadRetransmit += payload;
         } else {
             /* this is a first-transmitted 'data' packet */
-            c->packets.data++;
+            c->packets.data += weight;
             c->bytes.dataHeader += header;
             c->bytes.dataPayload += payload;
         }
@@ -208,11 +378,11 @@ static void _tracker_updateCounters(Counters* c, gsize header, gsize payload,
         /* this is a 'control' packet */
         if(status & PDS_SND_TCP_RETRANSMITTED) {
             /* this is a retransmitted 'control' packet */
-            c->packets.controlRetransmit++;
+            c->packets.controlRetransmit += weight;
             c->bytes.controlHeaderRetransmit += header;
         } else {
             /* this is a first-transmitted 'control' packet */
-            c->packets.control++;
+            c->packets.control += weight;
             c->bytes.controlHeader += header;
         }
     }
@@ -220,9 +390,23 @@ static void _tracker_updateCounters(Counters* c, gsize header, gsize payload,
 
 void tracker_addInputBytes(Tracker* tracker, Packet* packet, const CompatSocket* socket) {
     MAGIC_ASSERT(tracker);
-    guintptr handle = _tracker_socketHandle(socket);
 
-    if(!(tracker->loginfo & LOG_INFO_FLAGS_NODE) && !(tracker->loginfo & LOG_INFO_FLAGS_SOCKET)) {
+    guint nodeWeight = 0;
+    if(tracker->loginfo & LOG_INFO_FLAGS_NODE) {
+        nodeWeight = _tracker_samplePacket(tracker, &tracker->inputPacketsUntilSample);
+    }
+
+    SocketStats* ss = NULL;
+    guint socketWeight = 0;
+    if(tracker->loginfo & LOG_INFO_FLAGS_SOCKET) {
+        ss = _tracker_getSocketStats(tracker, socket);
+        if(ss) {
+            socketWeight = _tracker_samplePacket(tracker, &ss->inputPacketsUntilSample);
+        }
+    }
+
+    /* skip looking at the packet if it isn't sampled for any counters */
+    if(nodeWeight == 0 && socketWeight == 0) {
         return;
     }
 
@@ -231,31 +415,36 @@ void tracker_addInputBytes(Tracker* tracker, Packet* packet, const CompatSocket*
     gsize payload = packet_getPayloadSize(packet);
     PacketDeliveryStatusFlags status = packet_getDeliveryStatus(packet);
 
-    if(tracker->loginfo & LOG_INFO_FLAGS_NODE) {
-        if(isLocal) {
-            _tracker_updateCounters(&tracker->local.inCounters, header, payload, status);
-        } else {
-            _tracker_updateCounters(&tracker->remote.inCounters, header, payload, status);
-        }
+    if(nodeWeight > 0) {
+        Counters* c = isLocal ? &tracker->local.inCounters : &tracker->remote.inCounters;
+        _tracker_updateCounters(c, header, payload, status, nodeWeight);
     }
 
-    if(tracker->loginfo & LOG_INFO_FLAGS_SOCKET) {
-        SocketStats* ss = g_hash_table_lookup(tracker->socketStats, &handle);
-        if(ss) {
-            if(isLocal) {
-                _tracker_updateCounters(&ss->local.inCounters, header, payload, status);
-            } else {
-                _tracker_updateCounters(&ss->remote.inCounters, header, payload, status);
-            }
-        }
+    if(socketWeight > 0) {
+        Counters* c = isLocal ? &ss->local.inCounters : &ss->remote.inCounters;
+        _tracker_updateCounters(c, header, payload, status, socketWeight);
     }
 }
 
 void tracker_addOutputBytes(Tracker* tracker, Packet* packet, const CompatSocket* socket) {
     MAGIC_ASSERT(tracker);
-    guintptr handle = _tracker_socketHandle(socket);
 
-    if(!(tracker->loginfo & LOG_INFO_FLAGS_NODE) && !(tracker->loginfo & LOG_INFO_FLAGS_SOCKET)) {
+    guint nodeWeight = 0;
+    if(tracker->loginfo & LOG_INFO_FLAGS_NODE) {
+        nodeWeight = _tracker_samplePacket(tracker, &tracker->outputPacketsUntilSample);
+    }
+
+    SocketStats* ss = NULL;
+    guint socketWeight = 0;
+    if(tracker->loginfo & LOG_INFO_FLAGS_SOCKET) {
+        ss = _tracker_getSocketStats(tracker, socket);
+        if(ss) {
+            socketWeight = _tracker_samplePacket(tracker, &ss->outputPacketsUntilSample);
+        }
+    }
+
+    /* skip looking at the packet if it isn't sampled for any counters */
+    if(nodeWeight == 0 && socketWeight == 0) {
         return;
     }
 
@@ -264,23 +453,14 @@ void tracker_addOutputBytes(Tracker* tracker, Packet* packet, const CompatSocket
     gsize payload = packet_getPayloadSize(packet);
     PacketDeliveryStatusFlags status = packet_getDeliveryStatus(packet);
 
-    if(tracker->loginfo & LOG_INFO_FLAGS_NODE) {
-        if(isLocal) {
-            _tracker_updateCounters(&tracker->local.outCounters, header, payload, status);
-        } else {
-            _tracker_updateCounters(&tracker->remote.outCounters, header, payload, status);
-        }
+    if(nodeWeight > 0) {
+        Counters* c = isLocal ? &tracker->local.outCounters : &tracker->remote.outCounters;
+        _tracker_updateCounters(c, header, payload, status, nodeWeight);
     }
 
-    if(tracker->loginfo & LOG_INFO_FLAGS_SOCKET) {
-        SocketStats* ss = g_hash_table_lookup(tracker->socketStats, &handle);
-        if(ss) {
-            if(isLocal) {
-                _tracker_updateCounters(&ss->local.outCounters, header, payload, status);
-            } else {
-                _tracker_updateCounters(&ss->remote.outCounters, header, payload, status);
-            }
-        }
+    if(socketWeight > 0) {
+        Counters* c = isLocal ? &ss->local.outCounters : &ss->remote.outCounters;
+        _tracker_updateCounters(c, header, payload, status, socketWeight);
     }
 }
 
@@ -312,27 +492,49 @@ void tracker_removeAllocatedBytes(Tracker* tracker, gpointer location) {
     }
 }
 
-void tracker_addSocket(Tracker* tracker, const CompatSocket* socket, ProtocolType type,
-                       gsize inputBufferSize, gsize outputBufferSize) {
+TrackerSocketHandle tracker_addSocket(Tracker* tracker, const CompatSocket* socket,
+                                      ProtocolType type, gsize inputBufferSize,
+                                      gsize outputBufferSize) {
     MAGIC_ASSERT(tracker);
-    guintptr handle = _tracker_socketHandle(socket);
 
-    if(tracker->loginfo & LOG_INFO_FLAGS_SOCKET) {
-        SocketStats* ss = _socketstats_new(handle, type, inputBufferSize, outputBufferSize);
-        g_hash_table_insert(tracker->socketStats, &(ss->socket), ss);
+    if (!(tracker->loginfo & LOG_INFO_FLAGS_SOCKET)) {
+        return TRACKER_SOCKET_HANDLE_NONE;
     }
+
+    SocketStats* ss = _socketstats_new(
+        compatsocket_getCanonicalHandle(socket), type, inputBufferSize, outputBufferSize);
+
+    /* generation 0 is reserved so that no handle equals TRACKER_SOCKET_HANDLE_NONE */
+    tracker->socketGeneration++;
+    if (tracker->socketGeneration == 0) {
+        tracker->socketGeneration++;
+    }
+    ss->generation = tracker->socketGeneration;
+    ss->inputPacketsUntilSample = _tracker_nextSampleGap(tracker);
+    ss->outputPacketsUntilSample = _tracker_nextSampleGap(tracker);
+
+    guint slot;
+    if (tracker->freeSocketSlots->len > 0) {
+        slot = g_array_index(tracker->freeSocketSlots, guint, tracker->freeSocketSlots->len - 1);
+        g_array_set_size(tracker->freeSocketSlots, tracker->freeSocketSlots->len - 1);
+        g_ptr_array_index(tracker->socketStats, slot) = ss;
+    } else {
+        slot = tracker->socketStats->len;
+        g_ptr_array_add(tracker->socketStats, ss);
+    }
+
+    return ((TrackerSocketHandle)ss->generation << 32) | slot;
 }
 
 void tracker_updateSocketPeer(Tracker* tracker, const CompatSocket* socket, in_addr_t peerIP,
                               in_port_t peerPort) {
     MAGIC_ASSERT(tracker);
-    guintptr handle = _tracker_socketHandle(socket);
 
     if(tracker->loginfo & LOG_INFO_FLAGS_SOCKET) {
-        SocketStats* socket = g_hash_table_lookup(tracker->socketStats, &handle);
-        if(socket) {
-            socket->peerIP = peerIP;
-            socket->peerPort = peerPort;
+        SocketStats* ss = _tracker_getSocketStats(tracker, socket);
+        if(ss) {
+            ss->peerIP = peerIP;
+            ss->peerPort = peerPort;
 
             GString* hostnameBuffer = g_string_new(NULL);
 
@@ -347,11 +549,11 @@ void tracker_updateSocketPeer(Tracker* tracker, const CompatSocket* socket, in_a
             }
 
             /* free the old string if we already have one */
-            if(socket->peerHostname) {
-                g_free(socket->peerHostname);
+            if(ss->peerHostname) {
+                g_free(ss->peerHostname);
             }
 
-            socket->peerHostname = g_string_free(hostnameBuffer, FALSE);
+            ss->peerHostname = g_string_free(hostnameBuffer, FALSE);
         }
     }
 }
@@ -359,10 +561,9 @@ void tracker_updateSocketPeer(Tracker* tracker, const CompatSocket* socket, in_a
 void tracker_updateSocketInputBuffer(Tracker* tracker, const CompatSocket* socket,
                                      gsize inputBufferLength, gsize inputBufferSize) {
     MAGIC_ASSERT(tracker);
-    guintptr handle = _tracker_socketHandle(socket);
 
     if(tracker->loginfo & LOG_INFO_FLAGS_SOCKET) {
-        SocketStats* ss = g_hash_table_lookup(tracker->socketStats, &handle);
+        SocketStats* ss = _tracker_getSocketStats(tracker, socket);
         if(ss) {
             ss->inputBufferLength = inputBufferLength;
             ss->inputBufferSize = inputBufferSize;
@@ -373,10 +574,9 @@ void tracker_updateSocketInputBuffer(Tracker* tracker, const CompatSocket* socke
 void tracker_updateSocketOutputBuffer(Tracker* tracker, const CompatSocket* socket,
                                       gsize outputBufferLength, gsize outputBufferSize) {
     MAGIC_ASSERT(tracker);
-    guintptr handle = _tracker_socketHandle(socket);
 
     if(tracker->loginfo & LOG_INFO_FLAGS_SOCKET) {
-        SocketStats* ss = g_hash_table_lookup(tracker->socketStats, &handle);
+        SocketStats* ss = _tracker_getSocketStats(tracker, socket);
         if(ss) {
             ss->outputBufferLength = outputBufferLength;
             ss->outputBufferSize = outputBufferSize;
@@ -386,10 +586,9 @@ void tracker_updateSocketOutputBuffer(Tracker* tracker, const CompatSocket* sock
 
 void tracker_removeSocket(Tracker* tracker, const CompatSocket* socket) {
     MAGIC_ASSERT(tracker);
-    guintptr handle = _tracker_socketHandle(socket);
 
     if(tracker->loginfo & LOG_INFO_FLAGS_SOCKET) {
-        SocketStats* ss = g_hash_table_lookup(tracker->socketStats, &handle);
+        SocketStats* ss = _tracker_getSocketStats(tracker, socket);
         if(ss) {
             /* remove after we log the stats we have */
             ss->removeAfterNextLog = TRUE;
@@ -432,6 +631,79 @@ static gchar* _tracker_getCounterString(Counters* c) {
     return g_string_free(buffer, FALSE);
 }
 
+static void _tracker_copyCounters(HeartbeatCounters* dst, const Counters* src) {
+    *dst = (HeartbeatCounters){
+        .packetsControl = src->packets.control,
+        .packetsControlRetransmit = src->packets.controlRetransmit,
+        .packetsData = src->packets.data,
+        .packetsDataRetransmit = src->packets.dataRetransmit,
+        .bytesControlHeader = src->bytes.controlHeader,
+        .bytesControlHeaderRetransmit = src->bytes.controlHeaderRetransmit,
+        .bytesDataHeader = src->bytes.dataHeader,
+        .bytesDataHeaderRetransmit = src->bytes.dataHeaderRetransmit,
+        .bytesDataPayload = src->bytes.dataPayload,
+        .bytesDataPayloadRetransmit = src->bytes.dataPayloadRetransmit,
+    };
+}
+
+static void _tracker_copyIFaceCounters(HeartbeatIFaceCounters* dst, const IFaceCounters* local,
+                                       const IFaceCounters* remote) {
+    _tracker_copyCounters(&dst->inLocal, &local->inCounters);
+    _tracker_copyCounters(&dst->outLocal, &local->outCounters);
+    _tracker_copyCounters(&dst->inRemote, &remote->inCounters);
+    _tracker_copyCounters(&dst->outRemote, &remote->outCounters);
+}
+
+static void _tracker_writeNode(Tracker* tracker, const Host* host) {
+    HeartbeatNodeRecord record = {
+        .intervalNanos = tracker->interval / SIMTIME_ONE_NANOSECOND,
+        .processingTimeNanos = tracker->processingTimeLastIntervalNanos,
+        .delayedCount = tracker->numDelayedLastInterval,
+        .delayTimeNanos = tracker->delayTimeLastInterval / SIMTIME_ONE_NANOSECOND,
+    };
+    _tracker_copyIFaceCounters(&record.counters, &tracker->local, &tracker->remote);
+
+    heartbeatwriter_writeRecord(host, HEARTBEAT_RECORD_NODE, &record, sizeof(record));
+}
+
+static void _tracker_writeSocket(Tracker* tracker, const Host* host) {
+    for (guint slot = 0; slot < tracker->socketStats->len; slot++) {
+        SocketStats* ss = g_ptr_array_index(tracker->socketStats, slot);
+
+        /* like the log format, skip tcp sockets that don't have peer IP/port set */
+        if (!ss || (ss->type == PTCP && !ss->peerIP)) {
+            continue;
+        }
+
+        HeartbeatSocketRecord record = {
+            .socket = ss->socket,
+            .protocol = ss->type,
+            .peerIP = ss->peerIP,
+            .peerPort = ss->peerPort,
+            .inputBufferLength = ss->inputBufferLength,
+            .inputBufferSize = ss->inputBufferSize,
+            .outputBufferLength = ss->outputBufferLength,
+            .outputBufferSize = ss->outputBufferSize,
+        };
+        _tracker_copyIFaceCounters(&record.counters, &ss->local, &ss->remote);
+
+        heartbeatwriter_writeRecord(host, HEARTBEAT_RECORD_SOCKET, &record, sizeof(record));
+    }
+}
+
+static void _tracker_writeRAM(Tracker* tracker, const Host* host) {
+    HeartbeatRAMRecord record = {
+        .intervalNanos = tracker->interval / SIMTIME_ONE_NANOSECOND,
+        .allocatedBytes = tracker->allocatedBytesLastInterval,
+        .deallocatedBytes = tracker->deallocatedBytesLastInterval,
+        .allocatedBytesTotal = tracker->allocatedBytesTotal,
+        .pointersCount = g_hash_table_size(tracker->allocatedLocations),
+        .failedFreesCount = tracker->numFailedFrees,
+    };
+
+    heartbeatwriter_writeRecord(host, HEARTBEAT_RECORD_RAM, &record, sizeof(record));
+}
+
 static void _tracker_logNode(Tracker* tracker, LogLevel level, CSimulationTime interval) {
     guint seconds = (guint) (interval / SIMTIME_ONE_SECOND);
     gdouble cpuutil =
@@ -495,16 +767,11 @@ static void _tracker_logSocket(Tracker* tracker, LogLevel level, CSimulationTime
     /* construct the log message from all sockets we have in the hash table */
     GString* msg = g_string_new("[shadow-heartbeat] [socket] ");
 
-    SocketStats* ss = NULL;
-    GHashTableIter socketIterator;
-    g_hash_table_iter_init(&socketIterator, tracker->socketStats);
-
-    /* as we iterate, keep track of sockets that we should remove. we cant remove them
-     * during the iteration because it will invalidate the iterator */
-    GQueue* socketsToRemove = g_queue_new();
     gint socketLogCount = 0;
 
-    while(g_hash_table_iter_next(&socketIterator, NULL, (gpointer*)&ss)) {
+    for (guint slot = 0; slot < tracker->socketStats->len; slot++) {
+        SocketStats* ss = g_ptr_array_index(tracker->socketStats, slot);
+
         /* don't log tcp sockets that don't have peer IP/port set */
         if(!ss || (ss->type == PTCP && !ss->peerIP)) {
             continue;
@@ -542,24 +809,12 @@ static void _tracker_logSocket(Tracker* tracker, LogLevel level, CSimulationTime
         g_free(outLocal);
         g_free(inRemote);
         g_free(outRemote);
-
-        /* check if we should remove the socket after iterating */
-        if(ss->removeAfterNextLog) {
-            g_queue_push_tail(socketsToRemove, GINT_TO_POINTER(ss->socket));
-        }
     }
 
     if(socketLogCount > 0) {
         logger_log(logger_getDefault(), level, __FILE__, __FUNCTION__, __LINE__, "%s", msg->str);
     }
 
-    /* free all the tracker instances of the sockets that were closed, now that we logged the info */
-    while (!g_queue_is_empty(socketsToRemove)) {
-        guintptr socket = (guintptr)g_queue_pop_head(socketsToRemove);
-        g_hash_table_remove(tracker->socketStats, &socket);
-    }
-    g_queue_free(socketsToRemove);
-
     g_string_free(msg, TRUE);
 }
 
@@ -582,19 +837,31 @@ static void _tracker_logRAM(Tracker* tracker, LogLevel level, CSimulationTime in
 void tracker_heartbeat(Tracker* tracker, const Host* host) {
     MAGIC_ASSERT(tracker);
 
-    /* check to see if node info is being logged */
-    if(tracker->loginfo & LOG_INFO_FLAGS_NODE) {
-        _tracker_logNode(tracker, tracker->loglevel, tracker->interval);
-    }
+    if (tracker->binaryFormat) {
+        if (tracker->loginfo & LOG_INFO_FLAGS_NODE) {
+            _tracker_writeNode(tracker, host);
+        }
+        if (tracker->loginfo & LOG_INFO_FLAGS_SOCKET) {
+            _tracker_writeSocket(tracker, host);
+        }
+        if (tracker->loginfo & LOG_INFO_FLAGS_RAM) {
+            _tracker_writeRAM(tracker, host);
+        }
+    } else {
+        /* check to see if node info is being logged */
+        if (tracker->loginfo & LOG_INFO_FLAGS_NODE) {
+            _tracker_logNode(tracker, tracker->loglevel, tracker->interval);
+        }
 
-    /* check to see if socket buffer info is being logged */
-    if(tracker->loginfo & LOG_INFO_FLAGS_SOCKET) {
-        _tracker_logSocket(tracker, tracker->loglevel, tracker->interval);
-    }
+        /* check to see if socket buffer info is being logged */
+        if (tracker->loginfo & LOG_INFO_FLAGS_SOCKET) {
+            _tracker_logSocket(tracker, tracker->loglevel, tracker->interval);
+        }
 
-    /* check to see if ram info is being logged */
-    if(tracker->loginfo & LOG_INFO_FLAGS_RAM) {
-        _tracker_logRAM(tracker, tracker->loglevel, tracker->interval);
+        /* check to see if ram info is being logged */
+        if (tracker->loginfo & LOG_INFO_FLAGS_RAM) {
+            _tracker_logRAM(tracker, tracker->loglevel, tracker->interval);
+        }
     }
 
     /* clear interval stats */
@@ -608,20 +875,21 @@ void tracker_heartbeat(Tracker* tracker, const Host* host) {
     memset(&tracker->local, 0, sizeof(IFaceCounters));
     memset(&tracker->remote, 0, sizeof(IFaceCounters));
 
-    SocketStats* ss = NULL;
-    GHashTableIter socketIterator;
-    g_hash_table_iter_init(&socketIterator, tracker->socketStats);
-    while (g_hash_table_iter_next(&socketIterator, NULL, (gpointer*)&ss)) {
-        if(ss) {
+    /* clear the socket counters, and free the stats of sockets that were closed now that we
+     * logged them */
+    for (guint slot = 0; slot < tracker->socketStats->len; slot++) {
+        SocketStats* ss = g_ptr_array_index(tracker->socketStats, slot);
+        if (!ss) {
+            continue;
+        }
+        if (ss->removeAfterNextLog) {
+            _tracker_freeSocketSlot(tracker, slot);
+        } else {
             memset(&ss->local, 0, sizeof(IFaceCounters));
             memset(&ss->remote, 0, sizeof(IFaceCounters));
         }
     }
 
-    /* schedule the next heartbeat */
+    /* the host's worker calls us again at the next interval */
     tracker->lastHeartbeat = worker_getCurrentEmulatedTime();
-    TaskRef* heartbeatTask =
-        taskref_new_bound(host_getID(host), tracker_heartbeatTask, tracker, NULL, NULL, NULL);
-    host_scheduleTaskWithDelay(host, heartbeatTask, tracker->interval);
-    taskref_drop(heartbeatTask);
 }
@@ -9,6 +9,7 @@
 
 #include <glib.h>
 #include <netinet/in.h>
+#include <stdbool.h>
 
 #include "lib/logger/log_level.h"
 #include "main/core/definitions.h"
@@ -18,7 +19,7 @@
 #include "main/routing/packet.minimal.h"
 
 Tracker* tracker_new(const Host* host, CSimulationTime interval, LogLevel loglevel,
-                     LogInfoFlags loginfo);
+                     LogInfoFlags loginfo, bool binaryFormat, guint packetSampleInterval);
 void tracker_free(Tracker* tracker);
 
 void tracker_addProcessingTimeNanos(Tracker* tracker, CSimulationTime processingTime);
@@ -27,14 +28,13 @@ void tracker_addInputBytes(Tracker* tracker, Packet* packet, const CompatSocket*
 void tracker_addOutputBytes(Tracker* tracker, Packet* packet, const CompatSocket* socket);
 void tracker_addAllocatedBytes(Tracker* tracker, gpointer location, gsize allocatedBytes);
 void tracker_removeAllocatedBytes(Tracker* tracker, gpointer location);
-void tracker_addSocket(Tracker* tracker, const CompatSocket* socket, ProtocolType type, gsize inputBufferSize, gsize outputBufferSize);
+TrackerSocketHandle tracker_addSocket(Tracker* tracker, const CompatSocket* socket, ProtocolType type, gsize inputBufferSize, gsize outputBufferSize);
 void tracker_updateSocketPeer(Tracker* tracker, const CompatSocket* socket, in_addr_t peerIP, in_port_t peerPort);
 void tracker_updateSocketInputBuffer(Tracker* tracker, const CompatSocket* socket, gsize inputBufferLength, gsize inputBufferSize);
 void tracker_updateSocketOutputBuffer(Tracker* tracker, const CompatSocket* socket, gsize outputBufferLength, gsize outputBufferSize);
 void tracker_removeSocket(Tracker* tracker, const CompatSocket* socket);
+/* Logs the heartbeat statistics and clears the interval counters. Called by the host each
+ * heartbeat interval. */
 void tracker_heartbeat(Tracker* tracker, const Host* host);
-static inline void tracker_heartbeatTask(const Host* host, gpointer tracker, gpointer userData) {
-    tracker_heartbeat(tracker, host);
-}
 
 #endif /* SHD_TRACKER_H_ */
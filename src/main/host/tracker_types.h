@@ -7,8 +7,15 @@
 #ifndef SHD_TRACKER_TYPES_H_
 #define SHD_TRACKER_TYPES_H_
 
+#include <stdint.h>
+
 typedef struct _Tracker Tracker;
 
+/* Identifies a socket's stats in its host's tracker. Assigned by tracker_addSocket and cached
+ * on the socket, so that updating the stats doesn't need a lookup. */
+typedef uint64_t TrackerSocketHandle;
+#define TRACKER_SOCKET_HANDLE_NONE 0
+
 typedef enum _LogInfoFlags LogInfoFlags;
 enum _LogInfoFlags {
     LOG_INFO_FLAGS_NONE = 0,
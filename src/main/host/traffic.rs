@@ -0,0 +1,227 @@
+//! Background traffic that Shadow generates for a host, for `hosts.<hostname>.traffic`.
+//!
+//! A generator starts flows to its peer as a Poisson process, with flow sizes that follow a Pareto
+//! distribution. Each flow is sent as a burst of full-sized UDP datagrams from a socket that is
+//! owned by Shadow rather than by a managed process. The datagrams go through the host's network
+//! interface and uplink, the network graph, and the peer's downlink like any other packets, so
+//! they compete for bandwidth with the simulated applications, but they don't need a process, a
+//! shim, or any syscalls. The peer doesn't need to listen on the port; datagrams for a port without
+//! a socket are dropped by its network interface.
+
+use std::net::SocketAddrV4;
+use std::sync::Arc;
+
+use atomic_refcell::AtomicRefCell;
+use bytes::Bytes;
+use rand::Rng;
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+use shadow_shim_helper_rs::simulation_time::SimulationTime;
+
+use crate::core::sim_config::TrafficInfo;
+use crate::core::work::task::TaskRef;
+use crate::core::worker::Worker;
+use crate::cshadow as c;
+use crate::host::descriptor::socket::inet::udp::UdpSocket;
+use crate::host::descriptor::FileStatus;
+use crate::host::host::{Host, RandomStream};
+use crate::utility::callback_queue::CallbackQueue;
+use crate::utility::sockaddr::SockaddrStorage;
+
+/// The payload size of each datagram, so that each datagram fills a packet.
+const DATAGRAM_SIZE: usize = (c::CONFIG_MTU - c::CONFIG_HEADER_SIZE_UDPIP) as usize;
+
+/// The payload of every datagram. Datagrams share it rather than allocating their own.
+static PAYLOAD: [u8; DATAGRAM_SIZE] = [0; DATAGRAM_SIZE];
+
+pub struct TrafficGenerator {
+    info: TrafficInfo,
+    peer: SocketAddrV4,
+    socket: Option<Arc<AtomicRefCell<UdpSocket>>>,
+    /// Bytes of the started flows that haven't been queued in the socket yet.
+    remaining_bytes: u64,
+    /// Whether a task is scheduled to queue more datagrams once the send buffer has drained.
+    send_pending: bool,
+}
+
+impl TrafficGenerator {
+    /// Schedule a generator for the traffic described by `info` to start on `host`. The generator
+    /// must be stopped with [`TrafficGenerator::stop`] before the host is shut down.
+    pub fn start(host: &Host, info: TrafficInfo) -> Arc<AtomicRefCell<Self>> {
+        let generator = Arc::new(AtomicRefCell::new(Self {
+            peer: SocketAddrV4::new(info.peer_ip.unwrap(), info.port),
+            info,
+            socket: None,
+            remaining_bytes: 0,
+            send_pending: false,
+        }));
+
+        let start_time = EmulatedTime::SIMULATION_START + generator.borrow().info.start_time;
+        let task = {
+            let generator = Arc::clone(&generator);
+            TaskRef::new(move |host| {
+                let socket = Self::bind(host);
+                generator.borrow_mut().socket = Some(socket);
+                Self::start_flow(&generator, host);
+            })
+        };
+        host.schedule_task_at_emulated_time(task, start_time);
+
+        generator
+    }
+
+    /// Close the generator's socket. It won't send any more datagrams.
+    pub fn stop(&mut self) {
+        if let Some(socket) = self.socket.take() {
+            CallbackQueue::queue_and_run_with_legacy(|cb_queue| {
+                socket.borrow_mut().close(cb_queue).unwrap();
+            });
+        }
+    }
+
+    /// Create a socket that is bound to an ephemeral port of the host's public address.
+    fn bind(host: &Host) -> Arc<AtomicRefCell<UdpSocket>> {
+        let send_buf_size = host.params.init_sock_send_buf_size.try_into().unwrap();
+        let socket = UdpSocket::new(FileStatus::empty(), send_buf_size, 0);
+
+        let addr = SockaddrStorage::from(SocketAddrV4::new(host.default_ip(), 0));
+        UdpSocket::bind(
+            &socket,
+            Some(&addr),
+            &host.network_namespace_borrow(),
+            &mut *host.random_mut(RandomStream::Sockets),
+        )
+        .unwrap();
+
+        socket
+    }
+
+    /// Start a flow, and schedule the start of the next one.
+    fn start_flow(generator: &Arc<AtomicRefCell<Self>>, host: &Host) {
+        let (flow_size, interval) = {
+            let info = &generator.borrow().info;
+            let mut rng = host.random_mut(RandomStream::Traffic);
+            (
+                pareto(&mut *rng, info.flow_size_min as f64, info.flow_size_shape),
+                exponential(&mut *rng, info.flow_rate),
+            )
+        };
+
+        let mut generator_ref = generator.borrow_mut();
+        generator_ref.remaining_bytes = generator_ref
+            .remaining_bytes
+            .saturating_add(flow_size as u64);
+        drop(generator_ref);
+        Self::send(generator, host);
+
+        let next_flow_time = Worker::current_time().unwrap() + interval;
+        let stop_time = generator
+            .borrow()
+            .info
+            .stop_time
+            .map(|x| EmulatedTime::SIMULATION_START + x);
+        if stop_time.is_some_and(|stop_time| next_flow_time >= stop_time) {
+            return;
+        }
+
+        let task = {
+            let generator = Arc::clone(generator);
+            TaskRef::new(move |host| Self::start_flow(&generator, host))
+        };
+        host.schedule_task_at_emulated_time(task, next_flow_time);
+    }
+
+    /// Queue datagrams in the socket until the flows have been sent or the send buffer is full. If
+    /// it's full, try again once the uplink has had time to send half of the buffer.
+    fn send(generator: &Arc<AtomicRefCell<Self>>, host: &Host) {
+        let mut generator_ref = generator.borrow_mut();
+        let Some(socket) = generator_ref.socket.clone() else {
+            // the generator was stopped
+            return;
+        };
+
+        CallbackQueue::queue_and_run_with_legacy(|cb_queue| {
+            while generator_ref.remaining_bytes > 0 {
+                let len = std::cmp::min(generator_ref.remaining_bytes, DATAGRAM_SIZE as u64);
+                let message = Bytes::from_static(&PAYLOAD[..len as usize]);
+                if UdpSocket::push_out_message(&socket, message, generator_ref.peer, cb_queue)
+                    .is_err()
+                {
+                    break;
+                }
+                generator_ref.remaining_bytes -= len;
+            }
+        });
+
+        if generator_ref.remaining_bytes == 0 || generator_ref.send_pending {
+            return;
+        }
+
+        let bw_up_bits = std::cmp::max(host.params.requested_bw_up_bits, 1);
+        let drain_bits = host.params.init_sock_send_buf_size * 8 / 2;
+        let delay =
+            SimulationTime::from_nanos(drain_bits.saturating_mul(1_000_000_000) / bw_up_bits)
+                .max(SimulationTime::NANOSECOND);
+
+        generator_ref.send_pending = true;
+        drop(generator_ref);
+
+        let task = {
+            let generator = Arc::clone(generator);
+            TaskRef::new(move |host| {
+                generator.borrow_mut().send_pending = false;
+                Self::send(&generator, host);
+            })
+        };
+        host.schedule_task_with_delay(task, delay);
+    }
+}
+
+/// A sample from the Pareto distribution with scale `min` and shape `shape`.
+fn pareto(rng: &mut impl Rng, min: f64, shape: f64) -> f64 {
+    // 1 - U is in (0, 1], so this never divides by zero
+    let u: f64 = rng.gen();
+    min / (1.0 - u).powf(1.0 / shape)
+}
+
+/// A sample from the exponential distribution with `rate`, which is the time between events of a
+/// Poisson process. Rounded up to at least a nanosecond so that flows always make progress.
+fn exponential(rng: &mut impl Rng, rate: f64) -> SimulationTime {
+    let u: f64 = rng.gen();
+    let secs = -(1.0 - u).ln() / rate;
+    let nanos = (secs * 1e9).clamp(1.0, SimulationTime::MAX.as_nanos_f64());
+    SimulationTime::from_nanos(nanos as u64)
+}
+
+#[cfg(test)]
+mod tests {
+    use rand::SeedableRng;
+    use rand_xoshiro::Xoshiro256PlusPlus;
+
+    use super::*;
+
+    #[test]
+    fn test_pareto() {
+        let mut rng = Xoshiro256PlusPlus::seed_from_u64(1);
+        let samples: Vec<f64> = (0..10_000).map(|_| pareto(&mut rng, 1000.0, 2.0)).collect();
+
+        assert!(samples.iter().all(|x| *x >= 1000.0));
+
+        // the mean of a Pareto distribution is min * shape / (shape - 1)
+        let mean = samples.iter().sum::<f64>() / samples.len() as f64;
+        assert!((1800.0..2200.0).contains(&mean), "{mean}");
+    }
+
+    #[test]
+    fn test_exponential() {
+        let mut rng = Xoshiro256PlusPlus::seed_from_u64(1);
+        let samples: Vec<SimulationTime> =
+            (0..10_000).map(|_| exponential(&mut rng, 10.0)).collect();
+
+        assert!(samples.iter().all(|x| *x >= SimulationTime::NANOSECOND));
+
+        // the mean time between events is 1 / rate
+        let mean =
+            samples.iter().map(|x| x.as_nanos_f64()).sum::<f64>() / samples.len() as f64 / 1e9;
+        assert!((0.09..0.11).contains(&mean), "{mean}");
+    }
+}
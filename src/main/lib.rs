@@ -42,6 +42,13 @@ pub mod shadow;
 extern crate shadow_shmem;
 extern crate shadow_tsc;
 
+// Rust allocations go directly to mimalloc. The crate's "override" feature also replaces malloc and
+// free, so allocations from our C code and from glib (which has ignored `g_mem_set_vtable` since
+// 2.46 and uses malloc for `g_slice` since 2.76) go to mimalloc as well.
+#[cfg(feature = "mimalloc")]
+#[global_allocator]
+static GLOBAL_ALLOCATOR: mimalloc::MiMalloc = mimalloc::MiMalloc;
+
 // shadow re-exports this definition from /usr/include/linux/tcp.h
 // TODO: Provide this via the linux-api crate instead.
 unsafe impl shadow_pod::Pod for crate::cshadow::tcp_info {}
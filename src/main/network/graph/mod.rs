@@ -4,11 +4,13 @@ use std::collections::hash_map::Entry;
 use std::collections::HashMap;
 use std::error::Error;
 use std::hash::Hash;
+use std::sync::atomic::{AtomicU64, Ordering};
 
 use anyhow::Context;
 use log::*;
 use petgraph::graph::NodeIndex;
-use rayon::iter::{IntoParallelIterator, ParallelIterator};
+use rayon::iter::{IndexedParallelIterator, IntoParallelRefIterator, ParallelIterator};
+use rayon::slice::ParallelSliceMut;
 
 use crate::core::configuration::{self, Compression, FileSource, GraphOptions, GraphSource};
 use crate::network::graph::petgraph_wrapper::GraphWrapper;
@@ -132,20 +134,45 @@ impl NetworkGraph {
     }
 
     pub fn parse(graph_text: &str) -> Result<Self, NetGraphError> {
-        let gml_graph = gml_parser::parse(graph_text)?;
+        // convert each node and edge as it's parsed, so that the parser's intermediate key-value
+        // maps don't need to be kept for the whole graph
+        let mut nodes = Ok(Vec::new());
+        let mut edges = Ok(Vec::new());
+
+        let gml_graph = gml_parser::parse_with(
+            graph_text,
+            |x| {
+                if let Ok(list) = &mut nodes {
+                    match ShadowNode::try_from(x) {
+                        Ok(x) => list.push(x),
+                        Err(e) => nodes = Err(e),
+                    }
+                }
+            },
+            |x| {
+                if let Ok(list) = &mut edges {
+                    match ShadowEdge::try_from(x) {
+                        Ok(x) => list.push(x),
+                        Err(e) => edges = Err(e),
+                    }
+                }
+            },
+        )?;
+        let nodes: Vec<ShadowNode> = nodes?;
+        let edges: Vec<ShadowEdge> = edges?;
 
         let mut g = match gml_graph.directed {
             true => GraphWrapper::Directed(
                 petgraph::graph::Graph::<_, _, petgraph::Directed, _>::with_capacity(
-                    gml_graph.nodes.len(),
-                    gml_graph.edges.len(),
+                    nodes.len(),
+                    edges.len(),
                 ),
             ),
             false => {
                 GraphWrapper::Undirected(
                     petgraph::graph::Graph::<_, _, petgraph::Undirected, _>::with_capacity(
-                        gml_graph.nodes.len(),
-                        gml_graph.edges.len(),
+                        nodes.len(),
+                        edges.len(),
                     ),
                 )
             }
@@ -154,16 +181,13 @@ impl NetworkGraph {
         // map from GML id to petgraph id
         let mut id_map = HashMap::new();
 
-        for x in gml_graph.nodes.into_iter() {
-            let x: ShadowNode = x.try_into()?;
+        for x in nodes.into_iter() {
             let gml_id = x.id;
             let petgraph_id = g.add_node(x);
             id_map.insert(gml_id, petgraph_id);
         }
 
-        for x in gml_graph.edges.into_iter() {
-            let x: ShadowEdge = x.try_into()?;
-
+        for x in edges.into_iter() {
             let source = *id_map
                 .get(&x.source)
                 .ok_or(format!("Edge source {} doesn't exist", x.source))?;
@@ -180,44 +204,25 @@ impl NetworkGraph {
         })
     }
 
+    /// Compute the shortest paths between each pair of `nodes`. The path from `nodes[i]` to
+    /// `nodes[j]` is at index `i * nodes.len() + j`.
     pub fn compute_shortest_paths(
         &self,
         nodes: &[NodeIndex],
-    ) -> Result<HashMap<(NodeIndex, NodeIndex), PathProperties>, NetGraphError> {
+    ) -> Result<Vec<PathProperties>, NetGraphError> {
         let start = std::time::Instant::now();
 
-        // calculate shortest paths
-        let mut paths: HashMap<(_, _), PathProperties> = nodes
-            .into_par_iter()
-            .flat_map(|src| {
-                match &self.graph {
-                    GraphWrapper::Directed(graph) => {
-                        petgraph::algo::dijkstra(&graph, *src, None, |e| e.weight().into())
-                    }
-                    GraphWrapper::Undirected(graph) => {
-                        petgraph::algo::dijkstra(&graph, *src, None, |e| e.weight().into())
-                    }
-                }
-                .into_iter()
-                // ignore nodes that aren't in use
-                .filter(|(dst, _)| nodes.contains(dst))
-                // include the src node
-                .map(|(dst, path)| ((*src, dst), path))
-                .collect::<HashMap<(_, _), _>>()
-            })
-            .collect();
-
-        // use the self-loop for paths from a node to itself
-        for node in nodes {
-            // the dijkstra shortest path from node -> node will always be 0
-            assert_eq!(paths[&(*node, *node)], PathProperties::default());
+        self.check_shortest_paths(nodes)?;
 
-            // there must be a single self-loop for each node
-            paths.insert((*node, *node), self.get_edge_weight(node, node)?.into());
+        // calculate shortest paths from each source node in parallel, each writing to its own row
+        let mut paths = vec![PathProperties::default(); nodes.len().pow(2)];
+        if !nodes.is_empty() {
+            paths
+                .par_chunks_mut(nodes.len())
+                .zip(nodes.par_iter())
+                .for_each(|(row, src)| row.copy_from_slice(&self.shortest_paths_from(*src, nodes)));
         }
 
-        assert_eq!(paths.len(), nodes.len().pow(2));
-
         debug!(
             "Finished computing shortest paths: {} seconds, {} entries",
             (std::time::Instant::now() - start).as_secs(),
@@ -227,17 +232,99 @@ impl NetworkGraph {
         Ok(paths)
     }
 
+    /// Compute the shortest paths from `src` to each node in `nodes`, in the same order as
+    /// `nodes`. The path from `src` to itself is its self-loop. Panics if a node is unreachable
+    /// or `src` has no self-loop, which [`Self::check_shortest_paths`] can check ahead of time.
+    pub fn shortest_paths_from(&self, src: NodeIndex, nodes: &[NodeIndex]) -> Vec<PathProperties> {
+        let mut paths = match &self.graph {
+            GraphWrapper::Directed(graph) => {
+                petgraph::algo::dijkstra(&graph, src, None, |e| e.weight().into())
+            }
+            GraphWrapper::Undirected(graph) => {
+                petgraph::algo::dijkstra(&graph, src, None, |e| e.weight().into())
+            }
+        };
+
+        // use the self-loop for the path from the node to itself
+        paths.insert(src, self.get_edge_weight(&src, &src).unwrap().into());
+
+        nodes.iter().map(|dst| paths[dst]).collect()
+    }
+
+    /// Check that [`Self::shortest_paths_from`] will succeed for any pair of `nodes`: every node
+    /// must have a self-loop and be reachable from every other node.
+    pub fn check_shortest_paths(&self, nodes: &[NodeIndex]) -> Result<(), NetGraphError> {
+        for node in nodes {
+            self.get_edge_weight(node, node)?;
+        }
+
+        // for undirected graphs, the strongly connected components are the connected components
+        let components = match &self.graph {
+            GraphWrapper::Directed(graph) => petgraph::algo::tarjan_scc(graph),
+            GraphWrapper::Undirected(graph) => petgraph::algo::tarjan_scc(graph),
+        };
+
+        let mut component_of = HashMap::new();
+        for (i, component) in components.iter().enumerate() {
+            for node in component {
+                component_of.insert(*node, i);
+            }
+        }
+
+        if let Some((first, rest)) = nodes.split_first() {
+            for node in rest {
+                if component_of[node] != component_of[first] {
+                    return Err(format!(
+                        "No path between nodes {} and {}",
+                        self.node_index_to_id(*first).unwrap(),
+                        self.node_index_to_id(*node).unwrap(),
+                    )
+                    .into());
+                }
+            }
+        }
+
+        Ok(())
+    }
+
+    /// Get the smallest latency of any edge that ends at each of `nodes`, including their
+    /// self-loops. This is a lower bound of the latency of any path to the node.
+    pub fn get_smallest_edge_latencies_to_ns(
+        &self,
+        nodes: &[NodeIndex],
+    ) -> HashMap<NodeIndex, u64> {
+        let latency = |e: &ShadowEdge| PathProperties::from(e).latency_ns;
+
+        nodes
+            .iter()
+            .filter_map(|node| {
+                let min = match &self.graph {
+                    GraphWrapper::Directed(graph) => graph
+                        .edges_directed(*node, petgraph::Direction::Incoming)
+                        .map(|e| latency(e.weight()))
+                        .min(),
+                    GraphWrapper::Undirected(graph) => {
+                        graph.edges(*node).map(|e| latency(e.weight())).min()
+                    }
+                };
+                Some((*node, min?))
+            })
+            .collect()
+    }
+
+    /// Get the edges between each pair of `nodes`, in the same layout as
+    /// [`Self::compute_shortest_paths`].
     pub fn get_direct_paths(
         &self,
         nodes: &[NodeIndex],
-    ) -> Result<HashMap<(NodeIndex, NodeIndex), PathProperties>, NetGraphError> {
+    ) -> Result<Vec<PathProperties>, NetGraphError> {
         let start = std::time::Instant::now();
 
-        let paths: HashMap<_, _> = nodes
+        let paths: Vec<_> = nodes
             .iter()
             .flat_map(|src| nodes.iter().map(move |dst| (*src, *dst)))
             // we require the graph to be connected with exactly one edge between any two nodes
-            .map(|(src, dst)| Ok(((src, dst), self.get_edge_weight(&src, &dst)?.into())))
+            .map(|(src, dst)| Ok(self.get_edge_weight(&src, &dst)?.into()))
             .collect::<Result<_, NetGraphError>>()?;
 
         assert_eq!(paths.len(), nodes.len().pow(2));
@@ -349,6 +436,66 @@ impl std::fmt::Display for IpPreviouslyAssignedError {
     }
 }
 
+/// The most unused addresses that a [`DenseIpMap`] stores for each address that it has a value
+/// for. Addresses that Shadow assigns itself are nearly consecutive, so this is only exceeded
+/// when hosts are configured with IP addresses that are far apart.
+const DENSE_IP_MAP_MAX_SPAN_PER_ENTRY: usize = 4;
+
+/// An immutable map from IP addresses to values. If the addresses are dense enough, as they are
+/// when Shadow assigns them, it's stored as an array indexed by the address so that lookups don't
+/// need to hash the address. Otherwise it's stored as a hash map.
+#[derive(Debug, Clone)]
+pub enum DenseIpMap<T> {
+    Dense {
+        /// The lowest address in the map.
+        base: u32,
+        /// The value for the address `base + i` at index `i`.
+        values: Vec<Option<T>>,
+    },
+    Sparse(HashMap<std::net::IpAddr, T>),
+}
+
+impl<T: Copy> DenseIpMap<T> {
+    pub fn new(entries: impl IntoIterator<Item = (std::net::IpAddr, T)>) -> Self {
+        let map: HashMap<std::net::IpAddr, T> = entries.into_iter().collect();
+
+        let ipv4 = |ip: &std::net::IpAddr| match ip {
+            std::net::IpAddr::V4(ip) => Some(u32::from(*ip)),
+            std::net::IpAddr::V6(_) => None,
+        };
+
+        // only IPv4 addresses can be stored as an array
+        let addrs: Option<Vec<u32>> = map.keys().map(ipv4).collect();
+        let bounds = addrs.and_then(|x| Some((*x.iter().min()?, *x.iter().max()?)));
+
+        if let Some((min, max)) = bounds {
+            let span = usize::try_from(max - min).unwrap() + 1;
+            if span <= map.len() * DENSE_IP_MAP_MAX_SPAN_PER_ENTRY {
+                let mut values = vec![None; span];
+                for (ip, value) in &map {
+                    values[usize::try_from(ipv4(ip).unwrap() - min).unwrap()] = Some(*value);
+                }
+                return Self::Dense { base: min, values };
+            }
+        }
+
+        Self::Sparse(map)
+    }
+
+    pub fn get(&self, ip: std::net::IpAddr) -> Option<T> {
+        match self {
+            Self::Dense { base, values } => {
+                let std::net::IpAddr::V4(ip) = ip else {
+                    return None;
+                };
+                let index = u32::from(ip).checked_sub(*base)?;
+                values.get(usize::try_from(index).ok()?).copied().flatten()
+            }
+            Self::Sparse(map) => map.get(&ip).copied(),
+        }
+    }
+}
+
 /// Tool for assigning IP addresses to graph nodes.
 #[derive(Debug)]
 pub struct IpAssignment<T: Copy + Eq + Hash + std::fmt::Display> {
@@ -356,6 +503,9 @@ pub struct IpAssignment<T: Copy + Eq + Hash + std::fmt::Display> {
     map: HashMap<std::net::IpAddr, T>,
     /// The last dynamically assigned address.
     last_assigned_addr: std::net::IpAddr,
+    /// A copy of `map` for faster lookups, built by [`IpAssignment::build_index`] once all
+    /// addresses have been assigned.
+    index: Option<DenseIpMap<T>>,
 }
 
 impl<T: Copy + Eq + Hash + std::fmt::Display> IpAssignment<T> {
@@ -363,11 +513,13 @@ impl<T: Copy + Eq + Hash + std::fmt::Display> IpAssignment<T> {
         Self {
             map: HashMap::new(),
             last_assigned_addr: std::net::IpAddr::V4(std::net::Ipv4Addr::new(11, 0, 0, 0)),
+            index: None,
         }
     }
 
     /// Get an unused address and assign it to a node.
     pub fn assign(&mut self, node_id: T) -> std::net::IpAddr {
+        self.index = None;
         // loop until we find an unused address
         loop {
             let ip_addr = Self::increment_address(&self.last_assigned_addr);
@@ -385,6 +537,7 @@ impl<T: Copy + Eq + Hash + std::fmt::Display> IpAssignment<T> {
         node_id: T,
         ip_addr: std::net::IpAddr,
     ) -> Result<(), IpPreviouslyAssignedError> {
+        self.index = None;
         let entry = self.map.entry(ip_addr);
         if let Entry::Occupied(_) = &entry {
             return Err(IpPreviouslyAssignedError);
@@ -393,9 +546,21 @@ impl<T: Copy + Eq + Hash + std::fmt::Display> IpAssignment<T> {
         Ok(())
     }
 
+    /// Build an index of the assigned addresses that makes [`IpAssignment::get_node`] faster. Should
+    /// be called once all addresses have been assigned, since assigning another address discards
+    /// the index.
+    pub fn build_index(&mut self) {
+        self.index = Some(DenseIpMap::new(
+            self.map.iter().map(|(ip, node)| (*ip, *node)),
+        ));
+    }
+
     /// Get the node that an address is assigned to.
     pub fn get_node(&self, ip_addr: std::net::IpAddr) -> Option<T> {
-        self.map.get(&ip_addr).copied()
+        match &self.index {
+            Some(index) => index.get(ip_addr),
+            None => self.map.get(&ip_addr).copied(),
+        }
     }
 
     /// Get all nodes with assigned addresses.
@@ -428,38 +593,163 @@ impl<T: Copy + Eq + Hash + std::fmt::Display> Default for IpAssignment<T> {
 /// Routing information for paths between nodes.
 #[derive(Debug)]
 pub struct RoutingInfo<T: Eq + Hash + std::fmt::Display + Clone + Copy> {
-    paths: HashMap<(T, T), PathProperties>,
-    packet_counters: std::sync::RwLock<HashMap<(T, T), u64>>,
+    paths: Paths<T>,
+}
+
+#[derive(Debug)]
+enum Paths<T: Eq + Hash> {
+    /// Paths between every pair of nodes. The path from the node at index `i` to the node at
+    /// index `j` is at `paths[i * indexes.len() + j]`.
+    All {
+        indexes: HashMap<T, usize>,
+        paths: Vec<PathProperties>,
+    },
+    /// Paths from recently used nodes, computed when first needed.
+    OnDemand(OnDemandPaths<T>),
+}
+
+/// A function that computes the paths from the node at an index to the nodes at every index.
+type ComputePathsFn = dyn Fn(usize) -> Vec<PathProperties> + Send + Sync;
+
+/// Paths that are computed for one source node at a time, and cached for the most recently used
+/// source nodes.
+struct OnDemandPaths<T: Eq + Hash> {
+    /// The index of each node in the arrays of paths.
+    indexes: HashMap<T, usize>,
+    smallest_latencies_to_ns: HashMap<T, u64>,
+    compute: Box<ComputePathsFn>,
+    /// The paths from each cached source node, indexed by the destination node.
+    cache: std::sync::RwLock<HashMap<usize, CachedPaths>>,
+    cache_size: usize,
+    /// The number of cache misses, used as a coarse clock to find the least recently used entry.
+    misses: AtomicU64,
+}
+
+struct CachedPaths {
+    paths: Vec<PathProperties>,
+    /// The value of `OnDemandPaths::misses` when these paths were last used.
+    last_used: AtomicU64,
+}
+
+impl<T: Eq + Hash> OnDemandPaths<T> {
+    fn path(&self, start: T, end: T) -> Option<PathProperties> {
+        let start = *self.indexes.get(&start)?;
+        let end = *self.indexes.get(&end)?;
+
+        if let Some(cached) = self.cache.read().unwrap().get(&start) {
+            // only write when the value changes, so that paths that are used often by many
+            // threads aren't always being written to
+            let now = self.misses.load(Ordering::Relaxed);
+            if cached.last_used.load(Ordering::Relaxed) != now {
+                cached.last_used.store(now, Ordering::Relaxed);
+            }
+            return Some(cached.paths[end]);
+        }
+
+        // compute the paths without holding the lock; other threads might compute the same paths
+        // at the same time, but the results will be the same
+        let paths = (self.compute)(start);
+        let path = paths[end];
+
+        let now = self.misses.fetch_add(1, Ordering::Relaxed) + 1;
+        let mut cache = self.cache.write().unwrap();
+
+        if !cache.contains_key(&start) && cache.len() >= self.cache_size {
+            let lru = cache
+                .iter()
+                .min_by_key(|(_, cached)| cached.last_used.load(Ordering::Relaxed))
+                .map(|(index, _)| *index)
+                .unwrap();
+            cache.remove(&lru);
+        }
+
+        cache.insert(
+            start,
+            CachedPaths {
+                paths,
+                last_used: AtomicU64::new(now),
+            },
+        );
+
+        Some(path)
+    }
+}
+
+impl<T: Eq + Hash> std::fmt::Debug for OnDemandPaths<T> {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("OnDemandPaths")
+            .field("nodes", &self.indexes.len())
+            .field("cached", &self.cache.read().unwrap().len())
+            .field("cache_size", &self.cache_size)
+            .field("misses", &self.misses)
+            .finish_non_exhaustive()
+    }
 }
 
 impl<T: Eq + Hash + std::fmt::Display + Clone + Copy> RoutingInfo<T> {
-    pub fn new(paths: HashMap<(T, T), PathProperties>) -> Self {
+    /// Routing information with the path from `nodes[i]` to `nodes[j]` at
+    /// `paths[i * nodes.len() + j]`.
+    pub fn new(nodes: &[T], paths: Vec<PathProperties>) -> Self {
+        assert_eq!(paths.len(), nodes.len().pow(2));
+
         Self {
-            paths,
-            packet_counters: std::sync::RwLock::new(HashMap::new()),
+            paths: Paths::All {
+                indexes: Self::indexes(nodes),
+                paths,
+            },
         }
     }
 
-    /// Get properties for the path from one node to another.
-    pub fn path(&self, start: T, end: T) -> Option<PathProperties> {
-        self.paths.get(&(start, end)).copied()
+    /// A map from each node to its index in `nodes`.
+    fn indexes(nodes: &[T]) -> HashMap<T, usize> {
+        let indexes: HashMap<_, _> = nodes.iter().enumerate().map(|(i, x)| (*x, i)).collect();
+        assert_eq!(indexes.len(), nodes.len(), "Duplicate nodes");
+        indexes
     }
 
-    /// Increment the number of packets sent from one node to another.
-    pub fn increment_packet_count(&self, start: T, end: T) {
-        let key = (start, end);
-        let mut packet_counters = self.packet_counters.write().unwrap();
-        match packet_counters.get_mut(&key) {
-            Some(x) => *x = x.saturating_add(1),
-            None => assert!(packet_counters.insert(key, 1).is_none()),
+    /// Routing information that computes the paths from a node to every node in `nodes` when
+    /// first needed, using `compute` with the index of the source node in `nodes`. The paths from
+    /// at most `cache_size` source nodes are kept, evicting those that were least recently used.
+    ///
+    /// Since the paths aren't known ahead of time, `smallest_latencies_to_ns` are lower bounds of
+    /// the latencies of the paths to each node.
+    pub fn new_on_demand(
+        nodes: &[T],
+        smallest_latencies_to_ns: HashMap<T, u64>,
+        compute: impl Fn(usize) -> Vec<PathProperties> + Send + Sync + 'static,
+        cache_size: usize,
+    ) -> Self {
+        assert!(cache_size > 0);
+
+        Self {
+            paths: Paths::OnDemand(OnDemandPaths {
+                indexes: Self::indexes(nodes),
+                smallest_latencies_to_ns,
+                compute: Box::new(compute),
+                cache: std::sync::RwLock::new(HashMap::new()),
+                cache_size,
+                misses: AtomicU64::new(0),
+            }),
         }
     }
 
-    /// Log the number of packets sent between nodes.
-    pub fn log_packet_counts(&self) {
+    /// Get properties for the path from one node to another.
+    pub fn path(&self, start: T, end: T) -> Option<PathProperties> {
+        match &self.paths {
+            Paths::All { indexes, paths } => {
+                let start = indexes.get(&start)?;
+                let end = indexes.get(&end)?;
+                Some(paths[start * indexes.len() + end])
+            }
+            Paths::OnDemand(paths) => paths.path(start, end),
+        }
+    }
+
+    /// Log the number of packets sent between nodes, as counted by the workers.
+    pub fn log_packet_counts(&self, packet_counts: &HashMap<(T, T), u64>) {
         // only logs paths that have transmitted at least one packet
-        for ((start, end), count) in self.packet_counters.read().unwrap().iter() {
-            let path = self.paths.get(&(*start, *end)).unwrap();
+        for ((start, end), count) in packet_counts.iter() {
+            let path = self.path(*start, *end).unwrap();
             log::debug!(
                 "Found path {}->{}: latency={}ns, packet_loss={}, packet_count={}",
                 start,
@@ -471,8 +761,36 @@ impl<T: Eq + Hash + std::fmt::Display + Clone + Copy> RoutingInfo<T> {
         }
     }
 
+    /// Get the smallest latency of any path. If paths are computed on demand, this is a lower
+    /// bound.
     pub fn get_smallest_latency_ns(&self) -> Option<u64> {
-        self.paths.values().map(|x| x.latency_ns).min()
+        match &self.paths {
+            Paths::All { paths, .. } => paths.iter().map(|x| x.latency_ns).min(),
+            Paths::OnDemand(paths) => paths.smallest_latencies_to_ns.values().copied().min(),
+        }
+    }
+
+    /// Get the smallest latency of any path that ends at each node. If paths are computed on
+    /// demand, these are lower bounds.
+    pub fn get_smallest_latencies_to_ns(&self) -> HashMap<T, u64> {
+        let (indexes, paths) = match &self.paths {
+            Paths::All { indexes, paths } => (indexes, paths),
+            Paths::OnDemand(paths) => return paths.smallest_latencies_to_ns.clone(),
+        };
+
+        indexes
+            .iter()
+            .map(|(node, end)| {
+                let latency = paths
+                    .iter()
+                    .skip(*end)
+                    .step_by(indexes.len())
+                    .map(|x| x.latency_ns)
+                    .min()
+                    .unwrap();
+                (*node, latency)
+            })
+            .collect()
     }
 }
 
@@ -491,20 +809,109 @@ fn read_xz<P: AsRef<std::path::Path>>(path: P) -> Result<String, NetGraphError>
     Ok(String::from_utf8(decomp)?)
 }
 
-/// Get the network graph as a string.
-pub fn load_network_graph(graph_options: &GraphOptions) -> Result<String, NetGraphError> {
+/// The text of a network graph.
+#[derive(Debug)]
+pub enum GraphText {
+    Owned(String),
+    Mapped(MappedGraphFile),
+}
+
+impl std::ops::Deref for GraphText {
+    type Target = str;
+
+    fn deref(&self) -> &str {
+        match self {
+            Self::Owned(s) => s,
+            Self::Mapped(m) => m.as_str(),
+        }
+    }
+}
+
+/// A read-only memory mapping of an uncompressed graph file, so that the file's text doesn't need
+/// to be copied to the heap. Large graph files stay in the page cache instead.
+#[derive(Debug)]
+pub struct MappedGraphFile {
+    ptr: std::ptr::NonNull<u8>,
+    len: usize,
+}
+
+impl MappedGraphFile {
+    fn map<P: AsRef<std::path::Path>>(path: P) -> Result<GraphText, NetGraphError> {
+        let path = path.as_ref();
+
+        let f =
+            std::fs::File::open(path).with_context(|| format!("Failed to open file: {path:?}"))?;
+        let len = f
+            .metadata()
+            .with_context(|| format!("Failed to read file metadata: {path:?}"))?
+            .len();
+        let len = usize::try_from(len)?;
+
+        // can't map an empty file
+        if len == 0 {
+            return Ok(GraphText::Owned(String::new()));
+        }
+
+        // SAFETY: we don't hold any references to the memory yet; the graph file must not be
+        // modified while shadow is running
+        let ptr = unsafe {
+            rustix::mm::mmap(
+                std::ptr::null_mut(),
+                len,
+                rustix::mm::ProtFlags::READ,
+                rustix::mm::MapFlags::PRIVATE,
+                &f,
+                0,
+            )
+        }
+        .with_context(|| format!("Failed to map file: {path:?}"))?;
+
+        let mapped = Self {
+            ptr: std::ptr::NonNull::new(ptr.cast()).unwrap(),
+            len,
+        };
+
+        std::str::from_utf8(mapped.as_bytes())
+            .with_context(|| format!("File is not valid UTF-8: {path:?}"))?;
+
+        Ok(GraphText::Mapped(mapped))
+    }
+
+    fn as_bytes(&self) -> &[u8] {
+        // SAFETY: the mapping is readable and lives as long as `self`
+        unsafe { std::slice::from_raw_parts(self.ptr.as_ptr(), self.len) }
+    }
+
+    fn as_str(&self) -> &str {
+        // SAFETY: we checked that the text is valid UTF-8 when mapping it
+        unsafe { std::str::from_utf8_unchecked(self.as_bytes()) }
+    }
+}
+
+impl Drop for MappedGraphFile {
+    fn drop(&mut self) {
+        // SAFETY: nothing borrows the mapping after it's dropped
+        if let Err(e) = unsafe { rustix::mm::munmap(self.ptr.as_ptr().cast(), self.len) } {
+            warn!("Failed to unmap the graph file: {e}");
+        }
+    }
+}
+
+/// Get the network graph's text. Uncompressed graph files are memory-mapped rather than read.
+pub fn load_network_graph(graph_options: &GraphOptions) -> Result<GraphText, NetGraphError> {
     Ok(match graph_options {
         GraphOptions::Gml(GraphSource::File(FileSource {
             compression: None,
             path: f,
-        })) => std::fs::read_to_string(tilde_expansion(f))
-            .with_context(|| format!("Failed to read file: {f}"))?,
+        })) => MappedGraphFile::map(tilde_expansion(f))?,
         GraphOptions::Gml(GraphSource::File(FileSource {
             compression: Some(Compression::Xz),
             path: f,
-        })) => read_xz(tilde_expansion(f))?,
-        GraphOptions::Gml(GraphSource::Inline(s)) => s.clone(),
-        GraphOptions::OneGbitSwitch => configuration::ONE_GBIT_SWITCH_GRAPH.to_string(),
+        })) => GraphText::Owned(read_xz(tilde_expansion(f))?),
+        GraphOptions::Gml(GraphSource::Inline(s)) => GraphText::Owned(s.clone()),
+        GraphOptions::OneGbitSwitch => {
+            GraphText::Owned(configuration::ONE_GBIT_SWITCH_GRAPH.to_string())
+        }
     })
 }
 
@@ -512,6 +919,41 @@ pub fn load_network_graph(graph_options: &GraphOptions) -> Result<String, NetGra
 mod tests {
     use super::*;
 
+    #[test]
+    fn test_ip_assignment_index() {
+        let mut assignment = IpAssignment::new();
+        let explicit = std::net::IpAddr::V4(std::net::Ipv4Addr::new(11, 0, 0, 3));
+        assignment.assign_ip(7u32, explicit).unwrap();
+        let assigned: Vec<_> = (0..1000u32).map(|x| assignment.assign(x)).collect();
+
+        assignment.build_index();
+        assert!(matches!(assignment.index, Some(DenseIpMap::Dense { .. })));
+
+        assert_eq!(assignment.get_node(explicit), Some(7));
+        for (node, ip) in assigned.iter().enumerate() {
+            assert_eq!(assignment.get_node(*ip), Some(node as u32));
+        }
+        for ip in [
+            [11, 0, 0, 0],
+            [11, 0, 0, 255],
+            [10, 255, 255, 254],
+            [12, 0, 0, 1],
+        ] {
+            assert_eq!(
+                assignment.get_node(std::net::Ipv4Addr::from(ip).into()),
+                None
+            );
+        }
+
+        // addresses that are far apart are stored in a hash map
+        let far = std::net::IpAddr::V4(std::net::Ipv4Addr::new(200, 0, 0, 1));
+        assignment.assign_ip(8, far).unwrap();
+        assignment.build_index();
+        assert!(matches!(assignment.index, Some(DenseIpMap::Sparse(_))));
+        assert_eq!(assignment.get_node(far), Some(8));
+        assert_eq!(assignment.get_node(explicit), Some(7));
+    }
+
     #[test]
     fn test_path_add() {
         let p1 = PathProperties {
@@ -620,7 +1062,10 @@ mod tests {
                 .compute_shortest_paths(&[node_0, node_1, node_2])
                 .unwrap();
 
-            let lookup_latency = |a, b| shortest_paths.get(&(a, b)).unwrap().latency_ns;
+            let nodes = [node_0, node_1, node_2];
+            let index = |x| nodes.iter().position(|y| *y == x).unwrap();
+            let lookup_latency =
+                |a, b| shortest_paths[index(a) * nodes.len() + index(b)].latency_ns;
 
             if *directed {
                 assert_eq!(lookup_latency(node_0, node_0), 3333);
@@ -645,4 +1090,152 @@ mod tests {
             }
         }
     }
+
+    #[test]
+    fn test_on_demand_cache() {
+        let nodes = [10u32, 20, 30];
+        let computed = std::sync::Arc::new(std::sync::Mutex::new(Vec::new()));
+
+        let compute = {
+            let computed = computed.clone();
+            move |src: usize| {
+                computed.lock().unwrap().push(src);
+                (0..3)
+                    .map(|dst| PathProperties {
+                        latency_ns: (src * 10 + dst) as u64,
+                        packet_loss: 0.0,
+                    })
+                    .collect()
+            }
+        };
+
+        let latencies = HashMap::from([(10, 1), (20, 2), (30, 3)]);
+        let routing = RoutingInfo::new_on_demand(&nodes, latencies.clone(), compute, 2);
+
+        let latency = |a, b| routing.path(a, b).unwrap().latency_ns;
+        assert_eq!(latency(10, 30), 2);
+        assert_eq!(latency(20, 10), 10);
+        // evicts the paths from 10, which were used least recently
+        assert_eq!(latency(30, 30), 22);
+        assert_eq!(latency(20, 20), 11);
+        assert_eq!(*computed.lock().unwrap(), [0, 1, 2]);
+        assert_eq!(latency(10, 20), 1);
+        assert_eq!(*computed.lock().unwrap(), [0, 1, 2, 0]);
+
+        assert_eq!(routing.path(10, 40), None);
+        assert_eq!(routing.get_smallest_latency_ns(), Some(1));
+        assert_eq!(routing.get_smallest_latencies_to_ns(), latencies);
+    }
+
+    // disabled under miri due to https://github.com/rayon-rs/rayon/issues/952
+    #[test]
+    #[cfg_attr(miri, ignore)]
+    fn test_on_demand_shortest_paths() {
+        for directed in [true, false] {
+            let graph = format!(
+                r#"graph [
+                  directed {}
+                  node [
+                    id 0
+                  ]
+                  node [
+                    id 1
+                  ]
+                  node [
+                    id 2
+                  ]
+                  edge [
+                    source 0
+                    target 0
+                    latency "3333 ns"
+                  ]
+                  edge [
+                    source 1
+                    target 1
+                    latency "5555 ns"
+                  ]
+                  edge [
+                    source 2
+                    target 2
+                    latency "7777 ns"
+                  ]
+                  edge [
+                    source 0
+                    target 1
+                    latency "3 ns"
+                  ]
+                  edge [
+                    source 2
+                    target 0
+                    latency "5 ns"
+                  ]
+                  edge [
+                    source 1
+                    target 2
+                    latency "11 ns"
+                  ]
+                ]"#,
+                if directed { 1 } else { 0 }
+            );
+            let graph = NetworkGraph::parse(&graph).unwrap();
+            let nodes: Vec<_> = (0..3)
+                .map(|x| *graph.node_id_to_index(x).unwrap())
+                .collect();
+
+            graph.check_shortest_paths(&nodes).unwrap();
+
+            let all_paths = graph.compute_shortest_paths(&nodes).unwrap();
+            for (i, src) in nodes.iter().enumerate() {
+                let paths = graph.shortest_paths_from(*src, &nodes);
+                assert_eq!(paths, all_paths[i * nodes.len()..][..nodes.len()]);
+            }
+
+            let smallest = graph.get_smallest_edge_latencies_to_ns(&nodes);
+            if directed {
+                assert_eq!(smallest[&nodes[0]], 5);
+                assert_eq!(smallest[&nodes[1]], 3);
+                assert_eq!(smallest[&nodes[2]], 11);
+            } else {
+                assert_eq!(smallest[&nodes[0]], 3);
+                assert_eq!(smallest[&nodes[1]], 3);
+                assert_eq!(smallest[&nodes[2]], 5);
+            }
+        }
+    }
+
+    #[test]
+    fn test_on_demand_disconnected() {
+        let graph = r#"graph [
+          directed 1
+          node [
+            id 0
+          ]
+          node [
+            id 1
+          ]
+          edge [
+            source 0
+            target 0
+            latency "1 ns"
+          ]
+          edge [
+            source 1
+            target 1
+            latency "1 ns"
+          ]
+          edge [
+            source 0
+            target 1
+            latency "1 ns"
+          ]
+        ]"#;
+        let graph = NetworkGraph::parse(graph).unwrap();
+        let nodes: Vec<_> = (0..2)
+            .map(|x| *graph.node_id_to_index(x).unwrap())
+            .collect();
+
+        // there's no path from 1 to 0
+        graph.check_shortest_paths(&nodes).unwrap_err();
+        graph.check_shortest_paths(&nodes[..1]).unwrap();
+    }
 }
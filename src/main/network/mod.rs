@@ -16,6 +16,14 @@ pub trait PacketDevice {
     fn get_address(&self) -> Ipv4Addr;
     fn pop(&self) -> Option<PacketRc>;
     fn push(&self, packet: PacketRc);
+
+    /// Push packets that are all being delivered at the same time, in order. Devices that can
+    /// handle several packets more efficiently than one at a time should override this.
+    fn push_batch(&self, packets: Vec<PacketRc>) {
+        for packet in packets {
+            self.push(packet);
+        }
+    }
 }
 
 #[cfg(test)]
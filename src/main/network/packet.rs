@@ -1,4 +1,5 @@
 use std::io::Write;
+use std::mem::ManuallyDrop;
 use std::net::{Ipv4Addr, SocketAddrV4};
 
 use crate::core::worker::Worker;
@@ -90,18 +91,17 @@ impl PacketRc {
             .unwrap_or(&[]);
 
         // the tcp header allows for a max of 4 begin/end pairs
-        assert!(selective_acks.len() <= 4);
+        let mut sack_blocks =
+            [c::PacketTCPSackBlock { begin: 0, end: 0 }; c::PACKET_TCP_MAX_SACK_BLOCKS as usize];
+        assert!(selective_acks.len() <= sack_blocks.len());
 
-        let mut selective_acks_glist = std::ptr::null_mut();
-
-        for sack in selective_acks {
-            for val in [sack.0, sack.1] {
-                // integer to pointer cast
-                let val = val as *mut libc::c_void;
-                selective_acks_glist = unsafe { c::g_list_append(selective_acks_glist, val) };
-            }
+        for (block, sack) in sack_blocks.iter_mut().zip(selective_acks) {
+            block.begin = sack.0;
+            block.end = sack.1;
         }
 
+        let sack_blocks = &sack_blocks[..selective_acks.len()];
+
         // TODO: not sure if linux uses milliseconds, but it probably doesn't matter as long as we
         // convert it back to a u32 the same way when receiving packets
         let timestamp = SimulationTime::from_millis(header.timestamp.unwrap_or(0).into());
@@ -121,7 +121,8 @@ impl PacketRc {
             c::packet_updateTCP(
                 self.c_ptr.ptr(),
                 header.ack,
-                selective_acks_glist,
+                sack_blocks.as_ptr(),
+                sack_blocks.len(),
                 header.window_size.into(),
                 header.window_scale.unwrap_or(0),
                 header.window_scale.is_some(),
@@ -129,9 +130,6 @@ impl PacketRc {
                 timestamp_echo.into(),
             );
         }
-
-        // the C packet should make a copy of the glist, so we can free ours
-        unsafe { c::g_list_free(selective_acks_glist) };
     }
 
     pub fn get_tcp(&self) -> Option<tcp::TcpHeader> {
@@ -147,32 +145,13 @@ impl PacketRc {
             .unwrap()
             .as_millis();
 
-        // need to get the selective acks from a glist, so we'll panic a lot here to simplify things
-
-        let mut selective_acks = header.selectiveACKs;
-
-        // TODO: this selective ack code is untested until the new tcp code uses sacks, so it has
-        // not been checked for memory safety issues and there are probably bugs
-        let mut sack_iter = std::iter::from_fn(move || {
-            if selective_acks.is_null() {
-                return None;
-            }
-
-            let rv = unsafe { (*selective_acks).data } as u64;
-            selective_acks = unsafe { (*selective_acks).next };
-            Some(u32::try_from(rv).unwrap())
-        });
-
-        let sack_iter = std::iter::from_fn(move || {
-            // we expect the packet sack list to have a length divisible by 2
-            let begin = sack_iter.next()?;
-            let end = sack_iter.next().unwrap();
-
-            Some((begin, end))
-        });
-
-        let selective_acks: Vec<_> = sack_iter.collect();
-        let selective_acks = tcp::util::SmallArrayBackedSlice::new(&selective_acks).unwrap();
+        let sack_blocks = &header.selectiveACKs[..header.numSelectiveACKs as usize];
+        let mut selective_acks = [(0, 0); c::PACKET_TCP_MAX_SACK_BLOCKS as usize];
+        for (sack, block) in selective_acks.iter_mut().zip(sack_blocks) {
+            *sack = (block.begin, block.end);
+        }
+        let selective_acks = &selective_acks[..sack_blocks.len()];
+        let selective_acks = tcp::util::SmallArrayBackedSlice::new(selective_acks).unwrap();
 
         // the C packet doesn't have the distinction between no sack option or a sack option of
         // length 0, so we'll assume that an empty list is the same as no list
@@ -234,18 +213,47 @@ impl PacketRc {
         }
     }
 
-    /// Copy the packet payload to a buffer. Will truncate if the buffer is not large enough.
-    pub fn get_payload(&self, buffer: &mut [u8]) -> usize {
-        unsafe {
-            c::packet_copyPayloadShadow(
+    /// Set the packet payload from a sequence of byte chunks. Each chunk is copied directly into
+    /// the packet's payload buffer, so the chunks don't need to be concatenated first. Will panic
+    /// if the packet already has a payload.
+    pub fn set_payload_chunks(
+        &mut self,
+        chunks: &[impl AsRef<[u8]>],
+        priority: FifoPacketPriority,
+    ) {
+        let len: usize = chunks.iter().map(|x| x.as_ref().len()).sum();
+
+        let dst = unsafe {
+            c::packet_setPayloadUninitFromShadow(
                 self.c_ptr.ptr(),
-                0,
-                buffer.as_mut_ptr().cast(),
-                buffer.len().try_into().unwrap(),
+                len.try_into().unwrap(),
+                priority,
             )
-            .try_into()
-            .unwrap()
+        };
+        let dst = dst as *mut u8;
+
+        let mut offset = 0;
+        for chunk in chunks {
+            let chunk = chunk.as_ref();
+            // SAFETY: the payload buffer has room for `len` bytes, and nothing else can access the
+            // payload until we've initialized it
+            unsafe { std::ptr::copy_nonoverlapping(chunk.as_ptr(), dst.add(offset), chunk.len()) };
+            offset += chunk.len();
         }
+
+        debug_assert_eq!(offset, len);
+    }
+
+    /// Get a reference to the packet payload bytes.
+    pub fn payload(&self) -> &[u8] {
+        let ptr = unsafe { c::packet_getPayloadPtrShadow(self.c_ptr.ptr()) };
+
+        if ptr.is_null() {
+            return &[];
+        }
+
+        // SAFETY: the payload is immutable and lives at least as long as our packet reference
+        unsafe { std::slice::from_raw_parts(ptr as *const u8, self.payload_size()) }
     }
 
     /// Copy the payload to the managed process. Even if this returns an error, some unspecified
@@ -341,6 +349,18 @@ impl PacketRc {
         }
     }
 
+    /// Use a packet that the caller holds a reference to, without taking our own reference. Since
+    /// the returned object doesn't own a reference, it won't drop one either. Code that only
+    /// needs the packet while it's being handled (rather than storing it) can use this to avoid
+    /// the ref and unref.
+    ///
+    /// # Safety
+    ///
+    /// The caller's reference must remain valid while the returned object is used.
+    pub unsafe fn borrow_raw(c_ptr: *mut c::Packet) -> ManuallyDrop<Self> {
+        ManuallyDrop::new(Self::from_raw(c_ptr))
+    }
+
     /// Transfers ownership of the inner c_ptr reference to the caller while
     /// dropping the rust packet object.
     pub fn into_inner(mut self) -> *mut c::Packet {
@@ -369,10 +389,49 @@ impl PacketDisplay for PacketRc {
     fn display_bytes(&self, writer: impl Write) -> std::io::Result<()> {
         self.borrow_inner().cast_const().display_bytes(writer)
     }
+
+    fn display_header_bytes(&self, writer: impl Write) -> std::io::Result<()> {
+        self.borrow_inner()
+            .cast_const()
+            .display_header_bytes(writer)
+    }
 }
 
 impl PacketDisplay for *const c::Packet {
     fn display_bytes(&self, mut writer: impl Write) -> std::io::Result<()> {
+        self.display_header_bytes(&mut writer)?;
+
+        let payload_len: u16 = unsafe { c::packet_getPayloadSize(*self) }
+            .try_into()
+            .unwrap();
+
+        // write payload data
+
+        if payload_len > 0 {
+            // shadow's packet payloads are guarded by a mutex, so it's easiest to make a copy of them
+            let mut payload_buf = vec![0u8; payload_len.into()];
+            let count = unsafe {
+                c::packet_copyPayloadShadow(
+                    *self,
+                    0,
+                    payload_buf.as_mut_ptr() as *mut libc::c_void,
+                    payload_len.into(),
+                )
+            };
+            assert_eq!(
+                count,
+                u32::from(payload_len),
+                "Packet payload somehow changed size"
+            );
+
+            // packet payload: `payload_len` bytes
+            writer.write_all(&payload_buf)?;
+        }
+
+        Ok(())
+    }
+
+    fn display_header_bytes(&self, mut writer: impl Write) -> std::io::Result<()> {
         assert!(!self.is_null());
 
         let header_len: u16 = unsafe { c::packet_getHeaderSize(*self) }
@@ -429,29 +488,6 @@ impl PacketDisplay for *const c::Packet {
             _ => panic!("Unexpected packet protocol"),
         }
 
-        // write payload data
-
-        if payload_len > 0 {
-            // shadow's packet payloads are guarded by a mutex, so it's easiest to make a copy of them
-            let mut payload_buf = vec![0u8; payload_len.into()];
-            let count = unsafe {
-                c::packet_copyPayloadShadow(
-                    *self,
-                    0,
-                    payload_buf.as_mut_ptr() as *mut libc::c_void,
-                    payload_len.into(),
-                )
-            };
-            assert_eq!(
-                count,
-                u32::from(payload_len),
-                "Packet payload somehow changed size"
-            );
-
-            // packet payload: `payload_len` bytes
-            writer.write_all(&payload_buf)?;
-        }
-
         Ok(())
     }
 }
@@ -12,7 +12,7 @@ use crate::host::host::Host;
 use crate::network::packet::PacketStatus;
 use crate::network::relay::token_bucket::TokenBucket;
 use crate::network::PacketRc;
-use crate::utility::ObjectCounter;
+use crate::utility::{ObjectCounter, ObjectType};
 
 mod token_bucket;
 
@@ -88,15 +88,17 @@ impl Relay {
     /// the given `src_dev_address` to `Host::get_packet_device()`. The `Relay`
     /// internally schedules tasks as needed to ensure packets continue to be
     /// forwarded over time without exceeding the configured `RateLimit`.
-    pub fn new(rate: RateLimit, src_dev_address: Ipv4Addr) -> Self {
+    /// `max_packet_size` is the size of the largest packet that will be
+    /// forwarded, which must always fit within the token bucket.
+    pub fn new(rate: RateLimit, src_dev_address: Ipv4Addr, max_packet_size: u64) -> Self {
         let rate_limiter = match rate {
-            RateLimit::BytesPerSecond(bytes) => Some(create_token_bucket(bytes)),
+            RateLimit::BytesPerSecond(bytes) => Some(create_token_bucket(bytes, max_packet_size)),
             RateLimit::Unlimited => None,
         };
 
         Self {
             internal: AtomicRefCell::new(RelayInternal {
-                _counter: ObjectCounter::new("Relay"),
+                _counter: ObjectCounter::new(ObjectType::Relay),
                 rate_limiter,
                 src_dev_address,
                 state: RelayState::Idle,
@@ -211,11 +213,47 @@ impl Relay {
         // The source device supplies us with the stream of packets to forward.
         let src = host.get_packet_device(internal.src_dev_address);
 
+        // Time doesn't advance while we're forwarding, so we refill the token
+        // bucket once and forward packets until they would exceed the balance.
+        // The tokens are removed from the bucket all at once when we stop.
+        let available_tokens = internal.rate_limiter.as_mut().map(|tb| tb.refill());
+        let mut used_tokens = 0;
+
+        // Packets for another device are forwarded in batches of consecutive packets for the same
+        // device, so that a device receiving many packets at once (such as a host's network
+        // interface receiving them from its router) can handle them together. They all arrive at
+        // the same time since time doesn't advance while we're forwarding. Local packets are only
+        // batched with `use_loopback_batching`.
+        let batch_local = host.params.use_loopback_batching;
+        let mut batch = Vec::new();
+        let mut batch_dst = None;
+        let flush = |batch: &mut Vec<PacketRc>, batch_dst: &mut Option<Ipv4Addr>| {
+            if let Some(dst) = batch_dst.take() {
+                let batch = std::mem::take(batch);
+                if dst == src.get_address() {
+                    src.push_batch(batch);
+                } else {
+                    host.get_packet_device(dst).push_batch(batch);
+                }
+            }
+        };
+
         // Continue forwarding until we run out of either packets or tokens.
         loop {
             // Get next packet from our local cache, or from the source device.
             let Some(mut packet) = internal.next_packet.take().or_else(|| src.pop()) else {
+                if batch_dst == Some(src.get_address()) {
+                    // Handling local packets can add packets to the source device that this loop
+                    // should forward, so check again afterwards.
+                    flush(&mut batch, &mut batch_dst);
+                    continue;
+                }
+
                 // Ran out of packets to forward.
+                flush(&mut batch, &mut batch_dst);
+                if let Some(tb) = internal.rate_limiter.as_mut() {
+                    tb.remove(used_tokens);
+                }
                 internal.state = RelayState::Idle;
                 return None;
             };
@@ -230,22 +268,27 @@ impl Relay {
             // destination are the same device.
             if !is_bootstrapping && !is_local {
                 // Rate limit applies only if we have a token bucket.
-                if let Some(tb) = internal.rate_limiter.as_mut() {
-                    // Try to remove tokens for this packet.
-                    if let Err(blocking_dur) = tb.comforming_remove(packet.total_size() as u64) {
+                if let Some(available_tokens) = available_tokens {
+                    let packet_size = packet.total_size() as u64;
+
+                    if used_tokens + packet_size > available_tokens {
                         // Too few tokens, need to block.
+                        let tb = internal.rate_limiter.as_mut().unwrap();
+                        tb.remove(used_tokens);
+                        let blocking_dur = tb.comforming_remove(packet_size).unwrap_err();
+
                         log::trace!(
                             "Relay src={} dst={} exceeded rate limit, need {} more tokens \
                             for packet of size {}, blocking for {:?}",
                             src.get_address(),
                             packet.dst_address().ip(),
-                            packet
-                                .total_size()
-                                .saturating_sub(tb.comforming_remove(0).unwrap() as usize),
-                            packet.total_size(),
+                            packet_size.saturating_sub(available_tokens - used_tokens),
+                            packet_size,
                             blocking_dur
                         );
 
+                        flush(&mut batch, &mut batch_dst);
+
                         // Cache the packet until we can forward it later.
                         packet.add_status(PacketStatus::RelayCached);
                         assert!(internal.next_packet.is_none());
@@ -255,19 +298,28 @@ impl Relay {
                         // Call Relay::forward_later() after dropping the mutable borrow.
                         return Some(blocking_dur);
                     }
+
+                    used_tokens += packet_size;
                 }
             }
 
             // Forward the packet to the destination device now.
             packet.add_status(PacketStatus::RelayForwarded);
-            if is_local {
+            if is_local && !batch_local {
                 // The source and destination are the same. Avoid a double
-                // mutable borrow of the packet device.
+                // mutable borrow of the packet device. Local packets are pushed
+                // immediately, since handling them can add packets to the source
+                // device that this loop should forward.
+                flush(&mut batch, &mut batch_dst);
                 src.push(packet);
             } else {
-                // The source and destination are different.
-                let dst = host.get_packet_device(*packet.dst_address().ip());
-                dst.push(packet);
+                // The source and destination are different, or local packets are batched.
+                let dst = *packet.dst_address().ip();
+                if batch_dst != Some(dst) {
+                    flush(&mut batch, &mut batch_dst);
+                    batch_dst = Some(dst);
+                }
+                batch.push(packet);
             }
         }
     }
@@ -275,14 +327,14 @@ impl Relay {
 
 /// Configures a token bucket according the the given bytes_per_second rate
 /// limit. We always refill at least 1 byte per millisecond.
-fn create_token_bucket(bytes_per_second: u64) -> TokenBucket {
+fn create_token_bucket(bytes_per_second: u64, max_packet_size: u64) -> TokenBucket {
     let refill_interval = SimulationTime::from_millis(1);
     let refill_size = std::cmp::max(1, bytes_per_second / 1000);
 
     // Only the `capacity` of the bucket is increased by the burst allowance,
     // not the `refill_size`. Therefore, the long term rate limit enforced by
     // the token bucket (configured by `refill_size`) is not affected much.
-    let capacity = refill_size + get_burst_allowance();
+    let capacity = refill_size + get_burst_allowance(max_packet_size);
 
     TokenBucket::new(capacity, refill_size, refill_interval).unwrap()
 }
@@ -314,6 +366,10 @@ fn create_token_bucket(bytes_per_second: u64) -> TokenBucket {
 /// So it could become less smooth and more "bursty" even though the long term
 /// average is maintained. But I don't think this would happen much in practice,
 /// and we are batching sends for performance reasons.
-fn get_burst_allowance() -> u64 {
-    c::CONFIG_MTU.into()
+///
+/// If packets larger than `CONFIG_MTU` may be sent (for example multi-segment
+/// TCP packets), the allowance is the largest packet size instead, since
+/// otherwise such a packet could never be forwarded.
+fn get_burst_allowance(max_packet_size: u64) -> u64 {
+    std::cmp::max(c::CONFIG_MTU.into(), max_packet_size)
 }
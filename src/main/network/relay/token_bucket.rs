@@ -85,6 +85,29 @@ impl TokenBucket {
         Ok(self.balance)
     }
 
+    /// Applies any refills that are due and returns the updated token balance.
+    /// This allows a caller to check many decrements against a single refill
+    /// and then remove them all at once with `remove()`, rather than calling
+    /// `comforming_remove()` for each of them.
+    pub fn refill(&mut self) -> u64 {
+        let now = Worker::current_time().unwrap();
+        self.refill_inner(&now)
+    }
+
+    /// Implements the functionality of `refill()` without calling into the
+    /// `Worker` module. Useful for testing.
+    fn refill_inner(&mut self, now: &EmulatedTime) -> u64 {
+        self.lazy_refill(now);
+        self.balance
+    }
+
+    /// Remove `decrement` tokens from the bucket without first applying any
+    /// refills. Panics if the bucket contains fewer than `decrement` tokens, so
+    /// `decrement` should not exceed the balance returned by `refill()`.
+    pub fn remove(&mut self, decrement: u64) {
+        self.balance = self.balance.checked_sub(decrement).unwrap();
+    }
+
     /// Computes the duration required to refill enough tokens such that our
     /// balance can be decremented by the given `decrement`. Returned durations
     /// always align with this `TokenBucket`'s discrete refill interval
@@ -274,4 +297,29 @@ mod tests {
         let dur_until_conforming = SimulationTime::from_millis(125 * 5 - inc);
         assert_eq!(result.unwrap_err(), dur_until_conforming);
     }
+
+    #[test]
+    fn test_refill_and_remove() {
+        let now = mock_time_millis(1000);
+        let mut tb = TokenBucket::new_inner(100, 10, SimulationTime::from_millis(10), now).unwrap();
+
+        // Remove tokens in several steps after a single refill
+        assert_eq!(tb.refill_inner(&now), 100);
+        tb.remove(60);
+        tb.remove(40);
+        assert_eq!(tb.refill_inner(&now), 0);
+
+        // Refilling again within the same interval doesn't add tokens
+        let later = now + SimulationTime::from_millis(5);
+        assert_eq!(tb.refill_inner(&later), 0);
+
+        // 3 refill intervals have passed
+        let later = now + SimulationTime::from_millis(30);
+        assert_eq!(tb.refill_inner(&later), 30);
+        tb.remove(30);
+
+        // The removals are reflected when removing with a conforming check
+        let result = tb.conforming_remove_inner(10, &later);
+        assert_eq!(result.unwrap_err(), SimulationTime::from_millis(10));
+    }
 }
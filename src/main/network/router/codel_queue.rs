@@ -1,7 +1,7 @@
 //! An active queue management (AQM) algorithm implementing CoDel.
 //! <https://tools.ietf.org/html/rfc8289>
 //!
-//!  The "Flow Queue" variant is not implemented.
+//!  The "Flow Queue" variant is implemented in the `fq_codel_queue` module.
 //!  <https://tools.ietf.org/html/rfc8290>
 //!
 //!  More info:
@@ -12,6 +12,7 @@
 
 use std::{collections::VecDeque, time::Duration};
 
+use once_cell::sync::Lazy;
 use shadow_shim_helper_rs::{emulated_time::EmulatedTime, simulation_time::SimulationTime};
 
 use crate::cshadow as c;
@@ -32,6 +33,17 @@ const INTERVAL: SimulationTime = SimulationTime::from_duration(Duration::from_mi
 /// routers, but in Shadow we don't enforce a limit due to our batched sending.
 const LIMIT: usize = usize::MAX;
 
+/// The number of drop counts for which the control law increment is
+/// precomputed. The drop count rarely grows this large before CoDel returns to
+/// Store mode.
+const CONTROL_LAW_TABLE_SIZE: usize = 256;
+
+/// The control law increments `INTERVAL / sqrt(count)` indexed by the drop
+/// count, so that most drop decisions don't need to compute a square root.
+/// Linux similarly caches the inverse square root of the drop count.
+static CONTROL_LAW_INCREMENTS: Lazy<[SimulationTime; CONTROL_LAW_TABLE_SIZE]> =
+    Lazy::new(|| std::array::from_fn(CoDelQueue::control_law_increment));
+
 /// Encodes if CoDel determines that the next available packet can be dropped.
 struct CoDelPopItem {
     packet: PacketRc,
@@ -285,20 +297,26 @@ impl CoDelQueue {
     /// Apply the CoDel control law using the inverse sqrt of the drop count,
     /// i.e., `time + (INTERVAL / sqrt(count));`.
     fn apply_control_law(time: &EmulatedTime, count: usize) -> EmulatedTime {
-        let increment = {
-            let interval = INTERVAL.as_nanos_f64();
-            let sqrt_count = match count {
-                0 => 1f64,
-                _ => (count as f64).sqrt(),
-            };
-            let div = interval / sqrt_count;
-            SimulationTime::from_nanos(div.round() as u64)
+        let increment = match CONTROL_LAW_INCREMENTS.get(count) {
+            Some(increment) => *increment,
+            None => CoDelQueue::control_law_increment(count),
         };
         let original = time.to_abs_simtime();
         let adjusted = original.saturating_add(increment);
         EmulatedTime::from_abs_simtime(adjusted)
     }
 
+    /// Computes the control law increment `INTERVAL / sqrt(count)`.
+    fn control_law_increment(count: usize) -> SimulationTime {
+        let interval = INTERVAL.as_nanos_f64();
+        let sqrt_count = match count {
+            0 => 1f64,
+            _ => (count as f64).sqrt(),
+        };
+        let div = interval / sqrt_count;
+        SimulationTime::from_nanos(div.round() as u64)
+    }
+
     /// Append a packet to the end of the queue.
     /// Requires the current time as an argument to avoid calling into the
     /// worker module internally.
@@ -376,8 +394,9 @@ mod tests {
             );
         }
 
-        // The increment should reduce exponentially.
-        for i in 2..20 {
+        // The increment should reduce exponentially, including for counts
+        // beyond the precomputed table.
+        for i in (2..20).chain(CONTROL_LAW_TABLE_SIZE - 2..CONTROL_LAW_TABLE_SIZE + 2) {
             assert_eq!(
                 CoDelQueue::apply_control_law(&now, i).duration_since(&now),
                 SimulationTime::from_nanos(
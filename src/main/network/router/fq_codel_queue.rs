@@ -0,0 +1,281 @@
+//! An active queue management (AQM) algorithm implementing FQ-CoDel, which
+//! schedules packets from per-flow CoDel queues using deficit round robin.
+//! <https://tools.ietf.org/html/rfc8290>
+//!
+//!  More info:
+//!   - <http://man7.org/linux/man-pages/man8/tc-fq_codel.8.html>
+
+use std::collections::VecDeque;
+use std::hash::{Hash, Hasher};
+
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+
+use crate::cshadow as c;
+use crate::network::packet::PacketRc;
+use crate::network::router::codel_queue::CoDelQueue;
+
+/// The number of flow queues, corresponding to the "flows" parameter in the
+/// fq_codel man page. Packets of different flows that hash to the same queue
+/// share that queue.
+const FLOWS: usize = 1024;
+
+/// The number of bytes a flow may dequeue each round, corresponding to the
+/// "quantum" parameter in the fq_codel man page.
+const QUANTUM: i64 = c::CONFIG_MTU as i64;
+
+/// Which list of active flows a flow queue is in.
+#[derive(PartialEq, Copy, Clone, Debug)]
+enum FlowList {
+    /// The flow is empty and not scheduled.
+    None,
+    /// The flow recently became active.
+    New,
+    /// The flow has used up its quantum at least once since becoming active.
+    Old,
+}
+
+/// A flow's CoDel queue and scheduling state.
+struct Flow {
+    queue: CoDelQueue,
+    /// The number of bytes the flow may still dequeue in the current round.
+    deficit: i64,
+    list: FlowList,
+}
+
+/// A packet queue implementing the FQ-CoDel active queue management (AQM)
+/// algorithm, suitable for use in network routers. Packets are assigned to
+/// flows by their source and destination addresses, and each flow has its own
+/// CoDel state so that a flow with a standing queue doesn't cause drops for
+/// the others.
+///
+/// The flow queues and the lists of active flows are allocated once when the
+/// queue is created, and only grow their capacity as needed, so enqueuing a
+/// packet doesn't usually allocate.
+pub struct FqCoDelQueue {
+    flows: Vec<Flow>,
+    /// Flows that became active recently, which are served before `old_flows`.
+    new_flows: VecDeque<usize>,
+    /// Flows that have been active for at least one full quantum.
+    old_flows: VecDeque<usize>,
+}
+
+impl FqCoDelQueue {
+    /// Creates a new empty packet queue.
+    pub fn new() -> FqCoDelQueue {
+        FqCoDelQueue {
+            flows: std::iter::repeat_with(|| Flow {
+                queue: CoDelQueue::new(),
+                deficit: 0,
+                list: FlowList::None,
+            })
+            .take(FLOWS)
+            .collect(),
+            new_flows: VecDeque::with_capacity(FLOWS),
+            old_flows: VecDeque::with_capacity(FLOWS),
+        }
+    }
+
+    /// Returns the total number of packets stored in the queue.
+    #[cfg(test)]
+    pub fn len(&self) -> usize {
+        self.flows.iter().map(|x| x.queue.len()).sum()
+    }
+
+    /// Returns true if the queue is holding zero packets, false otherwise.
+    #[cfg(test)]
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// Returns the packet at the front of the next flow to be served, or None
+    /// if the queue is empty. As with `CoDelQueue::peek()`, a subsequent
+    /// `pop()` operation may return a different packet.
+    #[cfg(test)]
+    pub fn peek(&self) -> Option<&PacketRc> {
+        self.new_flows
+            .iter()
+            .chain(self.old_flows.iter())
+            .find_map(|index| self.flows[*index].queue.peek())
+    }
+
+    /// The index of the flow queue for the packet. The hash isn't randomized,
+    /// so that simulations are deterministic.
+    fn flow_index(packet: &PacketRc) -> usize {
+        let mut hasher = std::collections::hash_map::DefaultHasher::new();
+        packet.src_address().hash(&mut hasher);
+        packet.dst_address().hash(&mut hasher);
+        (hasher.finish() % FLOWS as u64) as usize
+    }
+
+    /// Append a packet to the end of its flow's queue.
+    /// Requires the current time as an argument to avoid calling into the
+    /// worker module internally.
+    pub fn push(&mut self, packet: PacketRc, now: EmulatedTime) {
+        let index = Self::flow_index(&packet);
+        let flow = &mut self.flows[index];
+
+        flow.queue.push(packet, now);
+
+        // Newly active flows get priority over flows that were already active.
+        if flow.list == FlowList::None {
+            flow.list = FlowList::New;
+            flow.deficit = QUANTUM;
+            self.new_flows.push_back(index);
+        }
+    }
+
+    /// Returns the next packet from the active flows in deficit round robin
+    /// order that conforms to the flow's CoDel standing delay requirements, or
+    /// None if the queue is empty. The CoDel packet dropping logic is applied
+    /// during this operation, which could result in packets being dropped
+    /// before a packet is returned.
+    /// Requires the current time as an argument to avoid calling into the
+    /// worker module internally.
+    pub fn pop(&mut self, now: EmulatedTime) -> Option<PacketRc> {
+        loop {
+            let (index, list) = match self.new_flows.front() {
+                Some(index) => (*index, FlowList::New),
+                None => match self.old_flows.front() {
+                    Some(index) => (*index, FlowList::Old),
+                    None => return None,
+                },
+            };
+
+            let flow = &mut self.flows[index];
+            debug_assert_eq!(flow.list, list);
+
+            if flow.deficit <= 0 {
+                // The flow used up its quantum, so move it to the end of the
+                // old flows for the next round.
+                flow.deficit += QUANTUM;
+                flow.list = FlowList::Old;
+                self.pop_front(list);
+                self.old_flows.push_back(index);
+                continue;
+            }
+
+            let Some(packet) = flow.queue.pop(now) else {
+                // The flow is empty. To avoid starving the old flows, a new
+                // flow is moved to the old flows rather than becoming inactive
+                // if there are any old flows.
+                let to_old_flows = list == FlowList::New && !self.old_flows.is_empty();
+                flow.list = match to_old_flows {
+                    true => FlowList::Old,
+                    false => FlowList::None,
+                };
+                self.pop_front(list);
+                if to_old_flows {
+                    self.old_flows.push_back(index);
+                }
+                continue;
+            };
+
+            flow.deficit -= packet.total_size() as i64;
+            return Some(packet);
+        }
+    }
+
+    fn pop_front(&mut self, list: FlowList) {
+        match list {
+            FlowList::New => self.new_flows.pop_front(),
+            FlowList::Old => self.old_flows.pop_front(),
+            FlowList::None => unreachable!(),
+        };
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::net::{Ipv4Addr, SocketAddrV4};
+
+    use super::*;
+    use crate::network::tests::mock_time_millis;
+
+    // Some of the tests here don't run in miri because they cause c::packet*
+    // functions to be called during the test.
+
+    /// A packet for the flow with the given source port. Mock packets don't
+    /// have addresses, so this uses a UDP packet without a payload.
+    fn udp_packet(src_port: u16) -> PacketRc {
+        let mut packet = PacketRc::from_raw(unsafe { c::packet_new_inner(1, 1) });
+        packet.set_udp(
+            SocketAddrV4::new(Ipv4Addr::new(1, 2, 3, 4), src_port),
+            SocketAddrV4::new(Ipv4Addr::new(5, 6, 7, 8), 80),
+        );
+        packet
+    }
+
+    #[test]
+    fn empty() {
+        let now = mock_time_millis(1000);
+        let mut fq = FqCoDelQueue::new();
+        assert_eq!(fq.len(), 0);
+        assert!(fq.is_empty());
+        assert!(fq.peek().is_none());
+        assert!(fq.pop(now).is_none());
+    }
+
+    #[test]
+    #[cfg_attr(miri, ignore)]
+    fn push_pop_simple() {
+        let now = mock_time_millis(1000);
+        let mut fq = FqCoDelQueue::new();
+
+        const N: usize = 10;
+
+        for i in 1..=N {
+            assert_eq!(fq.len(), i - 1);
+            fq.push(udp_packet(1000 + i as u16), now);
+            assert_eq!(fq.len(), i);
+        }
+        for i in 1..=N {
+            assert_eq!(fq.len(), N - i + 1);
+            assert!(fq.peek().is_some());
+            assert!(fq.pop(now).is_some());
+            assert_eq!(fq.len(), N - i);
+        }
+        assert!(fq.is_empty());
+        assert!(fq.pop(now).is_none());
+
+        // All flows become inactive once they're found to be empty.
+        assert!(fq.new_flows.is_empty());
+        assert!(fq.old_flows.is_empty());
+        assert!(fq.flows.iter().all(|x| x.list == FlowList::None));
+    }
+
+    #[test]
+    #[cfg_attr(miri, ignore)]
+    fn new_flow_served_after_quantum() {
+        let now = mock_time_millis(1000);
+        let mut fq = FqCoDelQueue::new();
+
+        let size = udp_packet(1000).total_size() as i64;
+        let busy = FqCoDelQueue::flow_index(&udp_packet(1000));
+        let quiet = FqCoDelQueue::flow_index(&udp_packet(2000));
+        assert_ne!(busy, quiet);
+
+        // Number of packets the busy flow can send with one quantum.
+        let per_quantum = (QUANTUM + size - 1) / size;
+
+        for _ in 0..(2 * per_quantum) {
+            fq.push(udp_packet(1000), now);
+        }
+        fq.push(udp_packet(2000), now);
+        assert_eq!(fq.new_flows, [busy, quiet]);
+
+        // The busy flow uses its quantum.
+        for _ in 0..per_quantum {
+            assert_eq!(fq.pop(now).unwrap().src_address().port(), 1000);
+        }
+
+        // Then the new flow is served before the busy flow's next round.
+        assert_eq!(fq.pop(now).unwrap().src_address().port(), 2000);
+        assert_eq!(fq.flows[busy].list, FlowList::Old);
+        assert_eq!(fq.pop(now).unwrap().src_address().port(), 1000);
+
+        // The quiet flow became empty while old flows existed, so it moved to
+        // the old flows before becoming inactive.
+        assert_eq!(fq.flows[quiet].list, FlowList::Old);
+        assert_eq!(fq.old_flows, [busy, quiet]);
+    }
+}
@@ -2,12 +2,15 @@ use std::cell::RefCell;
 use std::net::Ipv4Addr;
 
 use self::codel_queue::CoDelQueue;
+use self::fq_codel_queue::FqCoDelQueue;
+use crate::core::configuration::RouterQDiscMode;
 use crate::core::worker::Worker;
 use crate::cshadow as c;
 use crate::network::packet::PacketRc;
 use crate::network::PacketDevice;
-use crate::utility::{Magic, ObjectCounter};
+use crate::utility::{Magic, ObjectCounter, ObjectType};
 mod codel_queue;
+mod fq_codel_queue;
 
 use shadow_shim_helper_rs::emulated_time::EmulatedTime;
 
@@ -18,19 +21,54 @@ pub struct Router {
     _counter: ObjectCounter,
     address: Ipv4Addr,
     /// Packets inbound to the host from the simulated network.
-    inbound_packets: RefCell<CoDelQueue>,
+    inbound_packets: RefCell<RouterQueue>,
+}
+
+/// The queue holding packets that the router delivers to the host.
+enum RouterQueue {
+    CoDel(CoDelQueue),
+    FqCoDel(FqCoDelQueue),
+}
+
+impl RouterQueue {
+    fn push(&mut self, packet: PacketRc, now: EmulatedTime) {
+        match self {
+            Self::CoDel(queue) => queue.push(packet, now),
+            Self::FqCoDel(queue) => queue.push(packet, now),
+        }
+    }
+
+    fn pop(&mut self, now: EmulatedTime) -> Option<PacketRc> {
+        match self {
+            Self::CoDel(queue) => queue.pop(now),
+            Self::FqCoDel(queue) => queue.pop(now),
+        }
+    }
+
+    #[cfg(test)]
+    fn peek(&self) -> Option<&PacketRc> {
+        match self {
+            Self::CoDel(queue) => queue.peek(),
+            Self::FqCoDel(queue) => queue.peek(),
+        }
+    }
 }
 
 impl Router {
     /// Create a new router for a host that will help route packets between it
     /// and other hosts. The `address` must uniquely identify this router to the
-    /// host that owns it.
-    pub fn new(address: Ipv4Addr) -> Router {
+    /// host that owns it. Inbound packets are queued using the `qdisc`.
+    pub fn new(address: Ipv4Addr, qdisc: RouterQDiscMode) -> Router {
+        let inbound_packets = match qdisc {
+            RouterQDiscMode::Codel => RouterQueue::CoDel(CoDelQueue::new()),
+            RouterQDiscMode::FqCodel => RouterQueue::FqCoDel(FqCoDelQueue::new()),
+        };
+
         Router {
             magic: Magic::new(),
             address,
-            _counter: ObjectCounter::new("Router"),
-            inbound_packets: RefCell::new(CoDelQueue::new()),
+            _counter: ObjectCounter::new(ObjectType::Router),
+            inbound_packets: RefCell::new(inbound_packets),
         }
     }
 
@@ -54,7 +92,7 @@ impl Router {
         unsafe { c::packet_unref(cpacket) };
     }
 
-    /// Routes the packet from the virtual internet into our CoDel queue, which
+    /// Routes the packet from the virtual internet into our inbound queue, which
     /// can then be received by the destiantion host by calling pop().
     pub fn route_incoming_packet(&self, packet: PacketRc) {
         self.push_inner(packet, Worker::current_time().unwrap())
@@ -67,7 +105,7 @@ impl PacketDevice for Router {
     }
 
     fn pop(&self) -> Option<PacketRc> {
-        // When the host calls pop, we provide the next packet from the CoDel queue.
+        // When the host calls pop, we provide the next packet from the inbound queue.
         self.pop_inner(Worker::current_time().unwrap())
     }
 
@@ -85,7 +123,7 @@ mod tests {
     #[test]
     fn empty() {
         let now = mock_time_millis(1000);
-        let router = Router::new(Ipv4Addr::UNSPECIFIED);
+        let router = Router::new(Ipv4Addr::UNSPECIFIED, RouterQDiscMode::Codel);
         assert!(router.inbound_packets.borrow().peek().is_none());
         assert!(router.pop_inner(now).is_none());
     }
@@ -95,7 +133,7 @@ mod tests {
     #[cfg_attr(miri, ignore)]
     fn push_pop_simple() {
         let now = mock_time_millis(1000);
-        let router = Router::new(Ipv4Addr::UNSPECIFIED);
+        let router = Router::new(Ipv4Addr::UNSPECIFIED, RouterQDiscMode::Codel);
 
         const N: usize = 10;
 
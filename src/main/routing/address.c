@@ -27,12 +27,14 @@ struct _Address {
     /* globally unique mac address */
     guint mac;
 
-    /* the host-order IP in dots-and-decimals format */
-    gchar* ipString;
+    /* The host-order IP in dots-and-decimals format. Built on first use and
+     * interned, since many addresses (e.g. each host's localhost) share an IP. */
+    const gchar* ipString;
 
     /* the hostname */
     gchar* name;
 
+    /* Built on first use, since it's mostly used for logging. */
     gchar* idString;
 
     gint referenceCount;
@@ -50,23 +52,17 @@ Address* address_new(HostId hostID, guint mac, guint32 ip, const gchar* name, gb
     address->hostID = hostID;
     address->mac = mac;
     address->ip = ip;
-    address->ipString = address_ipToNewString((in_addr_t)ip);
     address->isLocal = isLocal;
     address->name = g_strdup(name);
     address->referenceCount = 1;
 
-    GString* stringBuffer = g_string_new(NULL);
-    g_string_printf(stringBuffer, "%s-%s (%s,mac=%i)", address->name, address->ipString,
-            address->isLocal ? "lo" : "eth", address->mac);
-    address->idString = g_string_free(stringBuffer, FALSE);
-
     return address;
 }
 
 static void _address_free(Address* address) {
     MAGIC_ASSERT(address);
 
-    g_free(address->ipString);
+    /* the ipString is interned, so isn't freed */
     g_free(address->name);
     g_free(address->idString);
 
@@ -116,6 +112,16 @@ guint32 address_toHostIP(const Address* address) {
 
 const gchar* address_toHostIPString(const Address* address) {
     MAGIC_ASSERT(address);
+
+    /* Addresses are shared between worker threads through the DNS, so the
+     * string must only be built by one of them. */
+    Address* mutableAddress = (Address*)address;
+    if (g_once_init_enter(&mutableAddress->ipString)) {
+        gchar* ipString = address_ipToNewString((in_addr_t)address->ip);
+        g_once_init_leave(&mutableAddress->ipString, g_intern_string(ipString));
+        g_free(ipString);
+    }
+
     return address->ipString;
 }
 
@@ -131,6 +137,16 @@ const gchar* address_toHostName(const Address* address) {
 
 const gchar* address_toString(const Address* address) {
     MAGIC_ASSERT(address);
+
+    /* See address_toHostIPString(). */
+    Address* mutableAddress = (Address*)address;
+    if (g_once_init_enter(&mutableAddress->idString)) {
+        gchar* idString =
+            g_strdup_printf("%s-%s (%s,mac=%i)", address->name, address_toHostIPString(address),
+                            address->isLocal ? "lo" : "eth", address->mac);
+        g_once_init_leave(&mutableAddress->idString, idString);
+    }
+
     return address->idString;
 }
 
@@ -5,6 +5,7 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <glib.h>
 #include <netinet/in.h>
 #include <stdbool.h>
@@ -33,6 +34,13 @@ struct _DNS {
 
     int hosts_file_fd;
 
+    /* Set by dns_freeze() once all hosts have registered. The address mappings
+     * and hosts file do not change while frozen, so they can be read without
+     * holding the lock. */
+    bool frozen;
+    /* The path of the hosts file, created when the DNS is frozen. */
+    char* hosts_file_path;
+
     MAGIC_DECLARE;
 };
 
@@ -47,6 +55,10 @@ Address* dns_register(DNS* dns, HostId id, const gchar* name, in_addr_t requeste
     MAGIC_ASSERT(dns);
     utility_debugAssert(name);
 
+    if (dns->frozen) {
+        utility_panic("Cannot register '%s' after the DNS was frozen", name);
+    }
+
     g_mutex_lock(&dns->lock);
 
     gboolean isLocal = FALSE;
@@ -89,6 +101,13 @@ Address* dns_register(DNS* dns, HostId id, const gchar* name, in_addr_t requeste
 
 void dns_deregister(DNS* dns, Address* address) {
     MAGIC_ASSERT(dns);
+
+    /* Other threads may be reading the mappings without holding the lock. The
+     * address will be unreferenced when the DNS is freed instead. */
+    if (dns->frozen) {
+        return;
+    }
+
     if(!address_isLocal(address)) {
         g_mutex_lock(&dns->lock);
 
@@ -127,26 +146,51 @@ Address* dns_resolveNameToAddress(DNS* dns, const gchar* name) {
     return result;
 }
 
-static void _dns_writeHostLine(gpointer key, gpointer value, gpointer data) {
-    const gchar* name = key;
-    const Address* address = value;
-    GString* buf = data;
-    g_string_append_printf(buf, "%s %s\n", address_toHostIPString(address), name);
+static int _dns_compareHostNames(const void* a, const void* b) {
+    const Address* address_a = *(const Address* const*)a;
+    const Address* address_b = *(const Address* const*)b;
+    return strcmp(address_toHostName(address_a), address_toHostName(address_b));
 }
 
-static bool _dns_writeNewHostsFile(DNS* dns) {
+/* If `seal` is true, the file is sealed so that it can't be modified, and
+ * processes can safely map it. */
+static bool _dns_writeNewHostsFile(DNS* dns, bool seal) {
     MAGIC_ASSERT(dns);
     utility_debugAssert(dns->hosts_file_fd < 0);
 
-    dns->hosts_file_fd = memfd_create("shadow hosts file", MFD_CLOEXEC);
+    dns->hosts_file_fd = memfd_create("shadow hosts file", MFD_CLOEXEC | MFD_ALLOW_SEALING);
     if (dns->hosts_file_fd < 0) {
         warning(
             "Unable create temp hosts file, memfd_create() error %i: %s", errno, strerror(errno));
         return false;
     }
 
-    GString* buf = g_string_new("127.0.0.1 localhost\n");
-    g_hash_table_foreach(dns->addressByName, _dns_writeHostLine, buf);
+    /* Sort the addresses by name so that the file contents don't depend on the
+     * hash table order. */
+    guint num_addresses = g_hash_table_size(dns->addressByName);
+    const Address** addresses = g_new(const Address*, num_addresses);
+
+    GHashTableIter iter;
+    gpointer value = NULL;
+    guint i = 0;
+    g_hash_table_iter_init(&iter, dns->addressByName);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        addresses[i++] = value;
+    }
+    utility_debugAssert(i == num_addresses);
+
+    qsort(addresses, num_addresses, sizeof(*addresses), _dns_compareHostNames);
+
+    /* Build the whole file in one buffer so that it can be written at once. An
+     * IP address and a short host name take roughly 32 bytes. */
+    GString* buf = g_string_sized_new(32 * (gsize)(num_addresses + 1));
+    g_string_append(buf, "127.0.0.1 localhost\n");
+    for (i = 0; i < num_addresses; i++) {
+        g_string_append_printf(buf, "%s %s\n", address_toHostIPString(addresses[i]),
+                               address_toHostName(addresses[i]));
+    }
+
+    g_free(addresses);
 
     trace("Hosts file string buffer is %zu bytes.", buf->len);
 
@@ -165,16 +209,42 @@ static bool _dns_writeNewHostsFile(DNS* dns) {
     }
 
     g_string_free(buf, TRUE);
+
+    if (seal && fcntl(dns->hosts_file_fd, F_ADD_SEALS,
+                      F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0) {
+        /* The file is still usable, it just isn't protected from writes. */
+        warning("Unable to seal temp hosts file, fcntl() error %i: %s", errno, strerror(errno));
+    }
+
     return true;
 }
 
+static char* _dns_newHostsFilePath(int fd) {
+    char* path = NULL;
+    if (asprintf(&path, "/proc/%ld/fd/%i", (long)getpid(), fd) < 0) {
+        utility_panic("asprintf could not allocate string for hosts file path");
+        abort();
+    }
+    return path;
+}
+
 gchar* dns_getHostsFilePath(DNS* dns) {
     MAGIC_ASSERT(dns);
 
+    if (dns->frozen) {
+        /* The hosts file can't be invalidated while frozen. */
+        if (dns->hosts_file_path == NULL) {
+            warning("Unable to create hosts file; expect networking errors.");
+            return NULL;
+        }
+        return strdup(dns->hosts_file_path);
+    }
+
     g_mutex_lock(&dns->lock);
 
     if(dns->hosts_file_fd < 0) {
-        if(!_dns_writeNewHostsFile(dns)) {
+        if(!_dns_writeNewHostsFile(dns, false)) {
+            g_mutex_unlock(&dns->lock);
             warning("Unable to create hosts file; expect networking errors.");
             return NULL;
         }
@@ -184,15 +254,30 @@ gchar* dns_getHostsFilePath(DNS* dns) {
 
     g_mutex_unlock(&dns->lock);
 
-    char* path = NULL;
-    if (asprintf(&path, "/proc/%ld/fd/%i", (long)getpid(), fd) < 0) {
-        utility_panic("asprintf could not allocate string for hosts file path");
-        abort();
-    }
-
     // TODO: there's a race condition here where another thread could close and
     // invalidate this hosts file before the calling code can use this path
-    return path;
+    return _dns_newHostsFilePath(fd);
+}
+
+void dns_freeze(DNS* dns) {
+    MAGIC_ASSERT(dns);
+    utility_debugAssert(!dns->frozen);
+
+    g_mutex_lock(&dns->lock);
+
+    /* Write the final hosts file now, since it can't change after this. Any
+     * existing file isn't sealed, so it's replaced. */
+    if (dns->hosts_file_fd >= 0) {
+        close(dns->hosts_file_fd);
+        dns->hosts_file_fd = -1;
+    }
+    if (_dns_writeNewHostsFile(dns, true)) {
+        dns->hosts_file_path = _dns_newHostsFilePath(dns->hosts_file_fd);
+    }
+
+    dns->frozen = true;
+
+    g_mutex_unlock(&dns->lock);
 }
 
 DNS* dns_new() {
@@ -220,6 +305,8 @@ void dns_free(DNS* dns) {
         dns->hosts_file_fd = -1;
     }
 
+    free(dns->hosts_file_path);
+
     g_hash_table_destroy(dns->addressByIP);
     g_hash_table_destroy(dns->addressByName);
 
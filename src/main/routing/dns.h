@@ -33,7 +33,15 @@ Address* dns_resolveNameToAddress(DNS* dns, const gchar* name);
  *
  * The file is created lazily when this function is called and becomes invalid
  * if dns_register() is called after this function returns; once it becomes
- * invalid, a new file is created upon a subsequent call to this function. */
+ * invalid, a new file is created upon a subsequent call to this function.
+ * Once the DNS is frozen, the file is sealed and no longer changes, so it
+ * can be safely memory-mapped. The hosts are listed in order of their names. */
 gchar* dns_getHostsFilePath(DNS* dns);
 
+/* Freeze the DNS once all hosts have registered, before the simulation starts.
+ * After this, lookups and dns_getHostsFilePath() can run concurrently without
+ * locking, registering an address is an error, and deregistering an address
+ * has no effect (the addresses are released by dns_free()). */
+void dns_freeze(DNS* dns);
+
 #endif /* SHD_DNS_H_ */
@@ -8,6 +8,7 @@
 #include <netinet/in.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "lib/logger/log_level.h"
 #include "lib/logger/logger.h"
@@ -16,31 +17,9 @@
 #include "main/routing/address.h"
 #include "main/routing/packet.h"
 #include "main/routing/payload.h"
+#include "main/utility/freelist.h"
 #include "main/utility/utility.h"
 
-/* g_memdup() is deprecated due to a security issue and has been replaced
- * by g_memdup2(), but not all of our supported platforms support this yet.
- * https://gitlab.gnome.org/GNOME/glib/-/issues/2319
- *
- * Instead we'll use our own version.
- *
- * https://docs.gtk.org/glib/func.memdup2.html
- * > Allocates byte_size bytes of memory, and copies byte_size bytes into it
- * > from mem. If mem is NULL it returns NULL.
- */
-
-void* memdup(const void* ptr, size_t byteSize) {
-    if (ptr == NULL) {
-        return NULL;
-    }
-
-    void* newPtr = malloc(byteSize);
-    utility_alwaysAssert(newPtr != NULL);
-
-    memcpy(newPtr, ptr, byteSize);
-    return newPtr;
-}
-
 /* thread-safe structure representing a data/network packet */
 
 typedef struct _PacketUDPHeader PacketUDPHeader;
@@ -58,17 +37,19 @@ struct _PacketUDPHeader {
     in_port_t destinationPort;
 };
 
-/* packets are guaranteed not to be shared across hosts */
+/* packets are guaranteed not to be shared across hosts
+ *
+ * The fields that are used as the packet moves through the sockets, interfaces, and router come
+ * first, with the addresses and ports at the start of the header, so that they share the first
+ * cache line. */
 struct _Packet {
     guint referenceCount;
+    ProtocolType protocol;
+    PacketDeliveryStatusFlags allStatus;
 
     /* id of the host that created the packet */
     guint hostID;
-    /* id of the packet created on the host given by hostID */
-    guint64 packetID;
 
-    ProtocolType protocol;
-    gpointer header;
     Payload* payload;
 
     /* tracks application priority so we flush packets from the interface to
@@ -78,7 +59,19 @@ struct _Packet {
      */
     uint64_t priority;
 
-    PacketDeliveryStatusFlags allStatus;
+    /* heap slot for TCP's intrusive queue of packets waiting to be sent */
+    gsize tcpOutputQueueIndex;
+
+    /* which header is valid is determined by `protocol` */
+    union {
+        PacketUDPHeader udp;
+        PacketTCPHeader tcp;
+    } header;
+
+    /* id of the packet created on the host given by hostID */
+    guint64 packetID;
+
+    /* the history of statuses, which is only kept (and allocated) when trace logging is enabled */
     GQueue* orderedStatus;
 
     MAGIC_DECLARE;
@@ -93,9 +86,31 @@ const gchar* protocol_toString(ProtocolType type) {
     }
 }
 
+/* Packets are created and destroyed for every segment, so we recycle them through a freelist. */
+#define PACKET_MAX_FREE 1024
+
+static __thread FreeList _packetFreeList = FREELIST_INIT(PACKET_MAX_FREE, g_free);
+
+/* Returns a zeroed packet. */
+static Packet* _packet_alloc() {
+    Packet* packet = freelist_pop(&_packetFreeList);
+    if (packet != NULL) {
+        memset(packet, 0, sizeof(*packet));
+        return packet;
+    }
+
+    return g_new0(Packet, 1);
+}
+
+static void _packet_dealloc(Packet* packet) {
+    if (!freelist_push(&_packetFreeList, packet)) {
+        g_free(packet);
+    }
+}
+
 // Exposed for unit testing only. Use `packet_new` outside of tests.
 Packet* packet_new_inner(guint hostID, guint64 packetID) {
-    Packet* packet = g_new0(Packet, 1);
+    Packet* packet = _packet_alloc();
     MAGIC_INIT(packet);
 
     packet->referenceCount = 1;
@@ -103,8 +118,6 @@ Packet* packet_new_inner(guint hostID, guint64 packetID) {
     packet->hostID = hostID;
     packet->packetID = packetID;
 
-    packet->orderedStatus = g_queue_new();
-
     return packet;
 }
 
@@ -112,7 +125,7 @@ Packet* packet_new(const Host* host) {
     guint hostID = host_getID(host);
     guint64 packetID = host_getNewPacketID(host);
     Packet* packet = packet_new_inner(hostID, packetID);
-    worker_count_allocation(Packet);
+    worker_count_allocation(PACKET);
     return packet;
 }
 
@@ -162,13 +175,41 @@ void packet_setPayloadFromShadow(Packet* packet, const void* payload, gsize payl
     packet->priority = packetPriority;
 }
 
+void* packet_setPayloadUninitFromShadow(Packet* packet, gsize payloadLength,
+                                        uint64_t packetPriority) {
+    MAGIC_ASSERT(packet);
+    utility_debugAssert(!packet->payload);
+
+    void* data = NULL;
+
+    /* the payload starts with 1 ref, which we hold */
+    packet->payload = payload_newUninitFromShadow(payloadLength, &data);
+    utility_alwaysAssert(packet->payload != NULL);
+    /* application data needs a priority ordering for FIFO onto the wire */
+    packet->priority = packetPriority;
+
+    return data;
+}
+
+void packet_setPayloadSlice(Packet* packet, Payload* buffer, gsize offset, gsize payloadLength,
+                            uint64_t packetPriority) {
+    MAGIC_ASSERT(packet);
+    utility_debugAssert(buffer);
+    utility_debugAssert(!packet->payload);
+
+    /* the payload starts with 1 ref, which we hold */
+    packet->payload = payload_newSlice(buffer, offset, payloadLength);
+    /* application data needs a priority ordering for FIFO onto the wire */
+    packet->priority = packetPriority;
+}
+
 /* copy everything except the payload.
  * the payload will point to the same payload as the original packet.
  * the payload is protected so it is safe to send the copied packet to a different host. */
 Packet* packet_copy(Packet* packet) {
     MAGIC_ASSERT(packet);
 
-    Packet* copy = g_new0(Packet, 1);
+    Packet* copy = _packet_alloc();
     MAGIC_INIT(copy);
 
     copy->referenceCount = 1;
@@ -189,53 +230,17 @@ Packet* packet_copy(Packet* packet) {
         copy->orderedStatus = g_queue_copy(packet->orderedStatus);
     }
 
+    /* the headers are stored inline and don't contain any pointers, so a shallow copy is ok */
     copy->protocol = packet->protocol;
-    if(packet->header) {
-        switch (packet->protocol) {
-            case PUDP: {
-                copy->header = memdup(packet->header, sizeof(PacketUDPHeader));
-                break;
-            }
-
-            case PTCP: {
-                copy->header = memdup(packet->header, sizeof(PacketTCPHeader));
-
-                PacketTCPHeader* packetHeader = (PacketTCPHeader*)packet->header;
-                PacketTCPHeader* copyHeader = (PacketTCPHeader*)copy->header;
-
-                copyHeader->selectiveACKs = NULL;
-
-                if(packetHeader->selectiveACKs) {
-                    /* g_list_copy is shallow, but we store integers in the data pointers, so its OK here */
-                    copyHeader->selectiveACKs = g_list_copy(packetHeader->selectiveACKs);
-                }
-                break;
-            }
-
-            default: {
-                utility_panic("unrecognized protocol");
-                break;
-            }
-        }
-    }
+    copy->header = packet->header;
 
-    worker_count_allocation(Packet);
+    worker_count_allocation(PACKET);
     return copy;
 }
 
 static void _packet_free(Packet* packet) {
     MAGIC_ASSERT(packet);
 
-    if(packet->protocol == PTCP) {
-        PacketTCPHeader* header = (PacketTCPHeader*)packet->header;
-        if(header->selectiveACKs) {
-            g_list_free(header->selectiveACKs);
-        }
-    }
-
-    if(packet->header) {
-        g_free(packet->header);
-    }
     if(packet->payload) {
         payload_unref(packet->payload);
     }
@@ -244,9 +249,9 @@ static void _packet_free(Packet* packet) {
     }
 
     MAGIC_CLEAR(packet);
-    g_free(packet);
+    _packet_dealloc(packet);
 
-    worker_count_deallocation(Packet);
+    worker_count_deallocation(PACKET);
 }
 
 void packet_ref(Packet* packet) {
@@ -276,14 +281,19 @@ gint packet_compareTCPSequence(Packet* packet1, Packet* packet2, gpointer user_d
     guint sequence1 = 0, sequence2 = 0;
 
     utility_debugAssert(packet1->protocol == PTCP);
-    sequence1 = ((PacketTCPHeader*)(packet1->header))->sequence;
+    sequence1 = packet1->header.tcp.sequence;
 
     utility_debugAssert(packet2->protocol == PTCP);
-    sequence2 = ((PacketTCPHeader*)(packet2->header))->sequence;
+    sequence2 = packet2->header.tcp.sequence;
 
     return sequence1 < sequence2 ? -1 : sequence1 > sequence2 ? 1 : 0;
 }
 
+gsize* packet_getTCPOutputQueueIndex(Packet* packet) {
+    MAGIC_ASSERT(packet);
+    return &packet->tcpOutputQueueIndex;
+}
+
 // Enables non-zero size for mock packets for testing. Do not use outside of testing.
 void packet_setMock(Packet* packet) {
     MAGIC_ASSERT(packet);
@@ -295,10 +305,11 @@ void packet_setUDP(Packet* packet, enum ProtocolUDPFlags flags,
         in_addr_t sourceIP, in_port_t sourcePort,
         in_addr_t destinationIP, in_port_t destinationPort) {
     MAGIC_ASSERT(packet);
-    utility_debugAssert(!(packet->header) && packet->protocol == PNONE);
+    utility_debugAssert(packet->protocol == PNONE);
     utility_debugAssert(sourceIP && sourcePort && destinationIP && destinationPort);
 
-    PacketUDPHeader* header = g_new0(PacketUDPHeader, 1);
+    PacketUDPHeader* header = &packet->header.udp;
+    *header = (PacketUDPHeader){0};
 
     header->flags = flags;
     header->sourceIP = sourceIP;
@@ -306,7 +317,6 @@ void packet_setUDP(Packet* packet, enum ProtocolUDPFlags flags,
     header->destinationIP = destinationIP;
     header->destinationPort = destinationPort;
 
-    packet->header = header;
     packet->protocol = PUDP;
 }
 
@@ -315,10 +325,11 @@ void packet_setTCP(Packet* packet, enum ProtocolTCPFlags flags,
         in_addr_t sourceIP, in_port_t sourcePort,
         in_addr_t destinationIP, in_port_t destinationPort, guint sequence) {
     MAGIC_ASSERT(packet);
-    utility_debugAssert(!(packet->header) && packet->protocol == PNONE);
+    utility_debugAssert(packet->protocol == PNONE);
     utility_debugAssert(sourceIP && sourcePort && destinationIP && destinationPort);
 
-    PacketTCPHeader* header = g_new0(PacketTCPHeader, 1);
+    PacketTCPHeader* header = &packet->header.tcp;
+    *header = (PacketTCPHeader){0};
 
     header->flags = flags;
     header->sourceIP = sourceIP;
@@ -327,28 +338,24 @@ void packet_setTCP(Packet* packet, enum ProtocolTCPFlags flags,
     header->destinationPort = destinationPort;
     header->sequence = sequence;
 
-    packet->header = header;
     packet->protocol = PTCP;
 }
 
-void packet_updateTCP(Packet* packet, guint acknowledgement, GList* selectiveACKs, guint window,
-                      unsigned char windowScale, bool windowScaleSet,
+void packet_updateTCP(Packet* packet, guint acknowledgement,
+                      const PacketTCPSackBlock* selectiveACKs, gsize numSelectiveACKs,
+                      guint window, unsigned char windowScale, bool windowScaleSet,
                       CSimulationTime timestampValue, CSimulationTime timestampEcho) {
     MAGIC_ASSERT(packet);
-    utility_debugAssert(packet->header && (packet->protocol == PTCP));
-
-    PacketTCPHeader* header = (PacketTCPHeader*) packet->header;
+    utility_debugAssert(packet->protocol == PTCP);
+    utility_alwaysAssert(numSelectiveACKs <= PACKET_TCP_MAX_SACK_BLOCKS);
 
-    if(selectiveACKs && g_list_length(selectiveACKs) > 0) {
-        /* free the old ack list if it exists */
-        if(header->selectiveACKs != NULL) {
-            g_list_free(header->selectiveACKs);
-            header->selectiveACKs = NULL;
-        }
+    PacketTCPHeader* header = &packet->header.tcp;
 
-        /* set the new sacks */
+    if (selectiveACKs && numSelectiveACKs > 0) {
+        /* replace the old sacks */
         header->flags |= PTCP_SACK;
-        header->selectiveACKs = g_list_copy(selectiveACKs);
+        memcpy(header->selectiveACKs, selectiveACKs, numSelectiveACKs * sizeof(*selectiveACKs));
+        header->numSelectiveACKs = numSelectiveACKs;
     }
 
     header->acknowledgment = acknowledgement;
@@ -414,13 +421,13 @@ in_addr_t packet_getDestinationIP(const Packet* packet) {
 
     switch (packet->protocol) {
         case PUDP: {
-            PacketUDPHeader* header = packet->header;
+            const PacketUDPHeader* header = &packet->header.udp;
             ip = header->destinationIP;
             break;
         }
 
         case PTCP: {
-            PacketTCPHeader* header = packet->header;
+            const PacketTCPHeader* header = &packet->header.tcp;
             ip = header->destinationIP;
             break;
         }
@@ -442,13 +449,13 @@ in_port_t packet_getDestinationPort(const Packet* packet) {
 
     switch (packet->protocol) {
         case PUDP: {
-            PacketUDPHeader* header = packet->header;
+            const PacketUDPHeader* header = &packet->header.udp;
             port = header->destinationPort;
             break;
         }
 
         case PTCP: {
-            PacketTCPHeader* header = packet->header;
+            const PacketTCPHeader* header = &packet->header.tcp;
             port = header->destinationPort;
             break;
         }
@@ -470,13 +477,13 @@ in_addr_t packet_getSourceIP(const Packet* packet) {
 
     switch (packet->protocol) {
         case PUDP: {
-            PacketUDPHeader* header = packet->header;
+            const PacketUDPHeader* header = &packet->header.udp;
             ip = header->sourceIP;
             break;
         }
 
         case PTCP: {
-            PacketTCPHeader* header = packet->header;
+            const PacketTCPHeader* header = &packet->header.tcp;
             ip = header->sourceIP;
             break;
         }
@@ -498,13 +505,13 @@ in_port_t packet_getSourcePort(const Packet* packet) {
 
     switch (packet->protocol) {
         case PUDP: {
-            PacketUDPHeader* header = packet->header;
+            const PacketUDPHeader* header = &packet->header.udp;
             port = header->sourcePort;
             break;
         }
 
         case PTCP: {
-            PacketTCPHeader* header = packet->header;
+            const PacketTCPHeader* header = &packet->header.tcp;
             port = header->sourcePort;
             break;
         }
@@ -563,26 +570,20 @@ guint packet_copyPayloadShadow(const Packet* packet, gsize payloadOffset, void*
     }
 }
 
-GList* packet_copyTCPSelectiveACKs(Packet* packet) {
+const void* packet_getPayloadPtrShadow(const Packet* packet) {
     MAGIC_ASSERT(packet);
-    utility_debugAssert(packet->protocol == PTCP);
-
-    PacketTCPHeader* packetHeader = (PacketTCPHeader*)packet->header;
 
-    /* make sure to do a deep copy of all pointers to avoid concurrency issues */
-    GList* selectiveACKsCopy = NULL;
-    if(packetHeader->selectiveACKs) {
-        /* g_list_copy is shallow, but we store integers in the data pointers, so its OK here */
-        selectiveACKsCopy = g_list_copy(packetHeader->selectiveACKs);
+    if (packet->payload) {
+        return payload_getDataPtrShadow(packet->payload);
+    } else {
+        return NULL;
     }
-
-    return selectiveACKsCopy;
 }
 
 PacketTCPHeader* packet_getTCPHeader(const Packet* packet) {
     MAGIC_ASSERT(packet);
     utility_alwaysAssert(packet->protocol == PTCP);
-    return (PacketTCPHeader*)packet->header;
+    return (PacketTCPHeader*)&packet->header.tcp;
 }
 
 static const gchar* _packet_deliveryStatusToAscii(PacketDeliveryStatusFlags status) {
@@ -625,7 +626,7 @@ gchar* packet_toString(Packet* packet) {
 
     switch (packet->protocol) {
         case PUDP: {
-            PacketUDPHeader* header = packet->header;
+            const PacketUDPHeader* header = &packet->header.udp;
             gchar* sourceIPString = address_ipToNewString(header->sourceIP);
             gchar* destinationIPString = address_ipToNewString(header->destinationIP);
 
@@ -641,7 +642,7 @@ gchar* packet_toString(Packet* packet) {
         }
 
         case PTCP: {
-            PacketTCPHeader* header = packet->header;
+            const PacketTCPHeader* header = &packet->header.tcp;
             gchar* sourceIPString = address_ipToNewString(header->sourceIP);
             gchar* destinationIPString = address_ipToNewString(header->destinationIP);
 
@@ -651,26 +652,17 @@ gchar* packet_toString(Packet* packet) {
                     destinationIPString, ntohs(header->destinationPort),
                     header->sequence, header->acknowledgment);
 
-            // Instead of printing out entire list of SACK, print out ranges to save space
-            gint firstSack = -1;
-            gint lastSack = -1;
-            for(GList *iter = header->selectiveACKs; iter; iter = g_list_next(iter)) {
-                gint seq = GPOINTER_TO_INT(iter->data);
-                if(firstSack == -1) {
-                    firstSack = seq;
-                } else if(lastSack == -1 || seq == lastSack + 1) {
-                    lastSack = seq;
-                } else {
-                    g_string_append_printf(packetString, "%d-%d ", firstSack, lastSack);
-                    firstSack = seq;
-                    lastSack = -1;
-                }
-            }
-
-            if(firstSack != -1) {
-                g_string_append_printf(packetString, "%d", firstSack);
-                if(lastSack != -1) {
-                    g_string_append_printf(packetString,"-%d", lastSack);
+            if (header->numSelectiveACKs > 0) {
+                for (guint i = 0; i < header->numSelectiveACKs; i++) {
+                    const PacketTCPSackBlock* block = &header->selectiveACKs[i];
+                    if (i > 0) {
+                        g_string_append_printf(packetString, " ");
+                    }
+                    if (block->end == block->begin + 1) {
+                        g_string_append_printf(packetString, "%u", block->begin);
+                    } else {
+                        g_string_append_printf(packetString, "%u-%u", block->begin, block->end - 1);
+                    }
                 }
             } else {
                 g_string_append_printf(packetString, "NA");
@@ -747,7 +739,10 @@ void packet_addDeliveryStatus(Packet* packet, PacketDeliveryStatusFlags status)
 
     packet->allStatus |= status;
 
-    if (logger_isEnabled(logger_getDefault(), LOGLEVEL_TRACE)) {
+    if (logger_isCompiledAndEnabled(logger_getDefault(), LOGLEVEL_TRACE)) {
+        if (packet->orderedStatus == NULL) {
+            packet->orderedStatus = g_queue_new();
+        }
         g_queue_push_tail(packet->orderedStatus, GUINT_TO_POINTER(status));
         gchar* packetStr = packet_toString(packet);
         trace("[%s] %s", _packet_deliveryStatusToAscii(status), packetStr);
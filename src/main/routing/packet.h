@@ -15,6 +15,18 @@
 #include "main/bindings/c/bindings-opaque.h"
 #include "main/core/definitions.h"
 #include "main/host/protocol.h"
+#include "main/routing/payload.h"
+
+/* The TCP SACK option has room for at most 4 blocks. */
+#define PACKET_TCP_MAX_SACK_BLOCKS 4
+
+typedef struct _PacketTCPSackBlock PacketTCPSackBlock;
+struct _PacketTCPSackBlock {
+    /* the first selectively acknowledged sequence number */
+    guint begin;
+    /* one past the last selectively acknowledged sequence number */
+    guint end;
+};
 
 typedef struct _PacketTCPHeader PacketTCPHeader;
 struct _PacketTCPHeader {
@@ -32,7 +44,8 @@ struct _PacketTCPHeader {
 
     guint sequence;
     guint acknowledgment;
-    GList* selectiveACKs;
+    PacketTCPSackBlock selectiveACKs[PACKET_TCP_MAX_SACK_BLOCKS];
+    guint numSelectiveACKs;
     guint window;
     unsigned char windowScale;
     bool windowScaleSet;
@@ -50,6 +63,14 @@ void packet_setPayloadWithMemoryManager(Packet* packet, UntypedForeignPtr payloa
                                         uint64_t packetPriority);
 void packet_setPayloadFromShadow(Packet* packet, const void* payload, gsize payloadLength,
                                  uint64_t packetPriority);
+// Sets a payload of `payloadLength` bytes with unspecified contents and returns a pointer to those
+// bytes. The caller must initialize all of the bytes before the packet is used or shared.
+void* packet_setPayloadUninitFromShadow(Packet* packet, gsize payloadLength,
+                                        uint64_t packetPriority);
+// Sets the payload to the `payloadLength` bytes of `buffer` starting at `offset`, which are shared
+// with `buffer` rather than copied.
+void packet_setPayloadSlice(Packet* packet, Payload* buffer, gsize offset, gsize payloadLength,
+                            uint64_t packetPriority);
 Packet* packet_copy(Packet* packet);
 
 // Exposed for unit testing only. Use `packet_new` outside of tests.
@@ -74,8 +95,11 @@ void packet_setTCP(Packet* packet, enum ProtocolTCPFlags flags,
         in_addr_t sourceIP, in_port_t sourcePort,
         in_addr_t destinationIP, in_port_t destinationPort, guint sequence);
 
-void packet_updateTCP(Packet* packet, guint acknowledgement, GList* selectiveACKs, guint window,
-                      unsigned char windowScale, bool windowScaleSet,
+// At most PACKET_TCP_MAX_SACK_BLOCKS selective ack blocks may be given. If no blocks are given, any
+// existing blocks are kept.
+void packet_updateTCP(Packet* packet, guint acknowledgement,
+                      const PacketTCPSackBlock* selectiveACKs, gsize numSelectiveACKs,
+                      guint window, unsigned char windowScale, bool windowScaleSet,
                       CSimulationTime timestampValue, CSimulationTime timestampEcho);
 
 gsize packet_getTotalSize(const Packet* packet);
@@ -101,9 +125,14 @@ gssize packet_copyPayloadWithMemoryManager(const Packet* packet, gsize payloadOf
                                            MemoryManager* mem);
 guint packet_copyPayloadShadow(const Packet* packet, gsize payloadOffset, void* buffer,
                                gsize bufferLength);
-GList* packet_copyTCPSelectiveACKs(Packet* packet);
+// Returns a pointer to the payload bytes (of length `packet_getPayloadSize`), or NULL if the packet
+// has no payload. The bytes are valid for as long as a reference to the packet is held.
+const void* packet_getPayloadPtrShadow(const Packet* packet);
 PacketTCPHeader* packet_getTCPHeader(const Packet* packet);
 gint packet_compareTCPSequence(Packet* packet1, Packet* packet2, gpointer user_data);
+// Index slot for `priorityqueue_newIntrusive`, for the queue of packets a TCP socket is waiting
+// to send.
+gsize* packet_getTCPOutputQueueIndex(Packet* packet);
 
 void packet_addDeliveryStatus(Packet* packet, PacketDeliveryStatusFlags status);
 PacketDeliveryStatusFlags packet_getDeliveryStatus(Packet* packet);
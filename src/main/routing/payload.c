@@ -11,37 +11,101 @@
 #include "lib/logger/logger.h"
 #include "main/core/definitions.h"
 #include "main/core/worker.h"
+#include "main/utility/freelist.h"
 #include "main/utility/utility.h"
 
-/* packet payloads may be shared across hosts, so we must lock access to them */
+/* Packet payloads may be shared across hosts (and therefore across worker threads). The data
+ * is immutable after creation, so only the reference count needs to be synchronized. */
 struct _Payload {
-    GMutex lock;
-    guint referenceCount;
-    gpointer data;
+    gint referenceCount;
     gsize length;
+    /* The size class of this allocation, or PAYLOAD_NUM_SIZE_CLASSES if it was allocated
+     * directly with the system allocator. */
+    guint sizeClass;
+    /* The payload that this payload is a slice of, or NULL if it has its own bytes. */
+    Payload* parent;
+    /* The payload's bytes: either `data`, or a slice of the parent's bytes. */
+    const guint8* bytes;
     MAGIC_DECLARE;
+    /* The payload bytes are stored in the same allocation as the header, unless it's a slice. */
+    guint8 data[];
 };
 
+/* Payload allocations (header and data) are rounded up to a power of two and recycled through
+ * a freelist for each size class. */
+#define PAYLOAD_MIN_SIZE_CLASS_SHIFT 7
+#define PAYLOAD_NUM_SIZE_CLASSES 8
+#define PAYLOAD_MAX_FREE_PER_SIZE_CLASS 256
+
+static __thread FreeList _payloadFreeLists[PAYLOAD_NUM_SIZE_CLASSES] = {
+    [0 ... PAYLOAD_NUM_SIZE_CLASSES - 1] = FREELIST_INIT(PAYLOAD_MAX_FREE_PER_SIZE_CLASS, g_free),
+};
+
+static inline gsize _payload_sizeClassBytes(guint sizeClass) {
+    return ((gsize)1) << (sizeClass + PAYLOAD_MIN_SIZE_CLASS_SHIFT);
+}
+
+static guint _payload_sizeClass(gsize allocLength) {
+    guint sizeClass = 0;
+    while (sizeClass < PAYLOAD_NUM_SIZE_CLASSES &&
+           _payload_sizeClassBytes(sizeClass) < allocLength) {
+        sizeClass++;
+    }
+    return sizeClass;
+}
+
+/* Returns an uninitialized payload with room for `dataLength` bytes. */
+static Payload* _payload_alloc(gsize dataLength) {
+    gsize allocLength = sizeof(Payload) + dataLength;
+    guint sizeClass = _payload_sizeClass(allocLength);
+    Payload* payload = NULL;
+
+    if (sizeClass < PAYLOAD_NUM_SIZE_CLASSES) {
+        payload = freelist_pop(&_payloadFreeLists[sizeClass]);
+        if (payload == NULL) {
+            payload = g_malloc(_payload_sizeClassBytes(sizeClass));
+        }
+    } else {
+        payload = g_malloc(allocLength);
+    }
+
+    payload->sizeClass = sizeClass;
+    payload->length = 0;
+    payload->parent = NULL;
+    payload->bytes = payload->data;
+    MAGIC_INIT(payload);
+    g_atomic_int_set(&payload->referenceCount, 1);
+
+    return payload;
+}
+
+static void _payload_dealloc(Payload* payload) {
+    guint sizeClass = payload->sizeClass;
+    MAGIC_CLEAR(payload);
+
+    if (sizeClass < PAYLOAD_NUM_SIZE_CLASSES &&
+        freelist_push(&_payloadFreeLists[sizeClass], payload)) {
+        return;
+    }
+
+    g_free(payload);
+}
+
 /* If modifying this function, you should also modify `payload_newWithMemoryManager` below. */
 Payload* payload_new(const Thread* thread, UntypedForeignPtr data, gsize dataLength) {
-    Payload* payload = g_new0(Payload, 1);
-    MAGIC_INIT(payload);
+    gsize length = (data.val && dataLength > 0) ? dataLength : 0;
+    Payload* payload = _payload_alloc(length);
 
-    if (data.val && dataLength > 0) {
-        payload->data = g_malloc0(dataLength);
-        if (process_readPtr(thread_getProcess(thread), payload->data, data, dataLength) != 0) {
+    if (length > 0) {
+        if (process_readPtr(thread_getProcess(thread), payload->data, data, length) != 0) {
             warning("Couldn't read data for packet");
-            g_free(payload);
+            _payload_dealloc(payload);
             return NULL;
         }
-        utility_debugAssert(payload->data != NULL);
-        payload->length = dataLength;
+        payload->length = length;
     }
 
-    g_mutex_init(&(payload->lock));
-    payload->referenceCount = 1;
-
-    worker_count_allocation(Payload);
+    worker_count_allocation(PAYLOAD);
 
     return payload;
 }
@@ -51,96 +115,100 @@ Payload* payload_new(const Thread* thread, UntypedForeignPtr data, gsize dataLen
  * `payload_new`. */
 Payload* payload_newWithMemoryManager(UntypedForeignPtr data, gsize dataLength,
                                       const MemoryManager* mem) {
-    Payload* payload = g_new0(Payload, 1);
-    MAGIC_INIT(payload);
+    gsize length = (data.val && dataLength > 0) ? dataLength : 0;
+    Payload* payload = _payload_alloc(length);
 
-    if (data.val && dataLength > 0) {
-        payload->data = g_malloc0(dataLength);
-        if (memorymanager_readPtr(mem, payload->data, data, dataLength) != 0) {
+    if (length > 0) {
+        if (memorymanager_readPtr(mem, payload->data, data, length) != 0) {
             warning("Couldn't read data for packet");
-            g_free(payload);
+            _payload_dealloc(payload);
             return NULL;
         }
-        utility_debugAssert(payload->data != NULL);
-        payload->length = dataLength;
+        payload->length = length;
     }
 
-    g_mutex_init(&(payload->lock));
-    payload->referenceCount = 1;
-
-    worker_count_allocation(Payload);
+    worker_count_allocation(PAYLOAD);
 
     return payload;
 }
 
 Payload* payload_newFromShadow(const void* data, gsize dataLength) {
-    Payload* payload = g_new0(Payload, 1);
-    MAGIC_INIT(payload);
+    gsize length = (data && dataLength > 0) ? dataLength : 0;
+    Payload* payload = _payload_alloc(length);
 
-    if (data && dataLength > 0) {
-        payload->data = g_malloc0(dataLength);
-        utility_debugAssert(payload->data != NULL);
-        memcpy(payload->data, data, dataLength);
-        payload->length = dataLength;
+    if (length > 0) {
+        memcpy(payload->data, data, length);
+        payload->length = length;
     }
 
-    g_mutex_init(&(payload->lock));
-    payload->referenceCount = 1;
+    worker_count_allocation(PAYLOAD);
+
+    return payload;
+}
 
-    worker_count_allocation(Payload);
+Payload* payload_newUninitFromShadow(gsize dataLength, void** dataOut) {
+    utility_debugAssert(dataOut != NULL);
+
+    Payload* payload = _payload_alloc(dataLength);
+    payload->length = dataLength;
+    *dataOut = payload->data;
+
+    worker_count_allocation(PAYLOAD);
 
     return payload;
 }
 
-static void _payload_free(Payload* payload) {
-    MAGIC_ASSERT(payload);
+Payload* payload_newSlice(Payload* parent, gsize offset, gsize length) {
+    MAGIC_ASSERT(parent);
+    utility_debugAssert(offset + length <= parent->length);
 
-    g_mutex_clear(&(payload->lock));
+    /* a slice of a slice refers to the original payload, so that slices never nest */
+    Payload* root = parent->parent != NULL ? parent->parent : parent;
+    payload_ref(root);
 
-    if(payload->data) {
-        g_free(payload->data);
-    }
+    Payload* payload = _payload_alloc(0);
+    payload->parent = root;
+    payload->bytes = parent->bytes + offset;
+    payload->length = length;
 
-    MAGIC_CLEAR(payload);
-    g_free(payload);
+    worker_count_allocation(PAYLOAD);
 
-    worker_count_deallocation(Payload);
+    return payload;
 }
 
-static void _payload_lock(Payload* payload) {
+static void _payload_free(Payload* payload) {
     MAGIC_ASSERT(payload);
-    g_mutex_lock(&(payload->lock));
-}
 
-static void _payload_unlock(Payload* payload) {
-    MAGIC_ASSERT(payload);
-    g_mutex_unlock(&(payload->lock));
+    Payload* parent = payload->parent;
+    _payload_dealloc(payload);
+
+    worker_count_deallocation(PAYLOAD);
+
+    if (parent != NULL) {
+        payload_unref(parent);
+    }
 }
 
 void payload_ref(Payload* payload) {
     MAGIC_ASSERT(payload);
-    _payload_lock(payload);
-    (payload->referenceCount)++;
-    _payload_unlock(payload);
+    g_atomic_int_inc(&payload->referenceCount);
 }
 
 void payload_unref(Payload* payload) {
     MAGIC_ASSERT(payload);
-    _payload_lock(payload);
-    (payload->referenceCount)--;
-    gboolean needsFree = (payload->referenceCount == 0) ? TRUE : FALSE;
-    _payload_unlock(payload);
-    if(needsFree) {
+    if (g_atomic_int_dec_and_test(&payload->referenceCount)) {
         _payload_free(payload);
     }
 }
 
 gsize payload_getLength(Payload* payload) {
     MAGIC_ASSERT(payload);
-    _payload_lock(payload);
-    gsize length = payload->length;
-    _payload_unlock(payload);
-    return length;
+    return payload->length;
+}
+
+const void* payload_getDataPtrShadow(const Payload* payload) {
+    MAGIC_ASSERT(payload);
+    return payload->bytes;
 }
 
 /* If modifying this function, you should also modify `payload_getDataWithMemoryManager` below. */
@@ -148,8 +216,6 @@ gssize payload_getData(Payload* payload, const Thread* thread, gsize offset,
                        UntypedForeignPtr destBuffer, gsize destBufferLength) {
     MAGIC_ASSERT(payload);
 
-    _payload_lock(payload);
-
     utility_debugAssert(offset <= payload->length);
 
     gssize targetLength = payload->length - offset;
@@ -157,15 +223,12 @@ gssize payload_getData(Payload* payload, const Thread* thread, gsize offset,
 
     if (copyLength > 0) {
         int err = process_writePtr(
-            thread_getProcess(thread), destBuffer, payload->data + offset, copyLength);
+            thread_getProcess(thread), destBuffer, payload->bytes + offset, copyLength);
         if (err) {
-            _payload_unlock(payload);
             return err;
         }
     }
 
-    _payload_unlock(payload);
-
     return copyLength;
 }
 
@@ -177,8 +240,6 @@ gssize payload_getDataWithMemoryManager(Payload* payload, gsize offset,
                                         MemoryManager* mem) {
     MAGIC_ASSERT(payload);
 
-    _payload_lock(payload);
-
     utility_debugAssert(offset <= payload->length);
 
     gssize targetLength = payload->length - offset;
@@ -186,15 +247,12 @@ gssize payload_getDataWithMemoryManager(Payload* payload, gsize offset,
 
     if (copyLength > 0) {
         int err =
-            memorymanager_writePtr(mem, destBuffer, payload->data + offset, copyLength);
+            memorymanager_writePtr(mem, destBuffer, payload->bytes + offset, copyLength);
         if (err) {
-            _payload_unlock(payload);
             return err;
         }
     }
 
-    _payload_unlock(payload);
-
     return copyLength;
 }
 
@@ -202,18 +260,14 @@ gsize payload_getDataShadow(Payload* payload, gsize offset, void* destBuffer,
                             gsize destBufferLength) {
     MAGIC_ASSERT(payload);
 
-    _payload_lock(payload);
-
     utility_debugAssert(offset <= payload->length);
 
     gsize targetLength = payload->length - offset;
     gsize copyLength = MIN(targetLength, destBufferLength);
 
     if(copyLength > 0) {
-        memcpy(destBuffer, payload->data + offset, copyLength);
+        memcpy(destBuffer, payload->bytes + offset, copyLength);
     }
 
-    _payload_unlock(payload);
-
     return copyLength;
 }
@@ -17,6 +17,13 @@ Payload* payload_new(const Thread* thread, UntypedForeignPtr data, gsize dataLen
 Payload* payload_newWithMemoryManager(UntypedForeignPtr data, gsize dataLength,
                                       const MemoryManager* mem);
 Payload* payload_newFromShadow(const void* data, gsize dataLength);
+/* Allocates a payload of `dataLength` bytes with unspecified contents, and returns a pointer to
+ * those bytes in `dataOut`. The caller must initialize all of the bytes before the payload is
+ * read or shared, and must not modify them after. */
+Payload* payload_newUninitFromShadow(gsize dataLength, void** dataOut);
+/* Returns a payload of the `length` bytes of `parent` starting at `offset`, without copying them.
+ * The slice holds a reference to `parent`'s bytes until it's freed. */
+Payload* payload_newSlice(Payload* parent, gsize offset, gsize length);
 
 void payload_ref(Payload* payload);
 void payload_unref(Payload* payload);
@@ -28,6 +35,9 @@ gssize payload_getDataWithMemoryManager(Payload* payload, gsize offset,
                                         UntypedForeignPtr destBuffer, gsize destBufferLength,
                                         MemoryManager* mem);
 
+/* Returns a pointer to the payload's bytes, which stay valid and unchanged for as long as a
+ * reference to the payload is held. */
+const void* payload_getDataPtrShadow(const Payload* payload);
 gsize payload_getDataShadow(Payload* payload, gsize offset, void* destBuffer,
                             gsize destBufferLength);
 
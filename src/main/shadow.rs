@@ -34,6 +34,16 @@ pub fn run_shadow(args: Vec<&OsStr>) -> anyhow::Result<()> {
 
     verify_glib_version().context("Unsupported GLib version")?;
 
+    // back mimalloc's heaps with transparent huge pages to reduce TLB misses, unless the
+    // `MIMALLOC_LARGE_OS_PAGES` environment variable says otherwise
+    #[cfg(feature = "mimalloc")]
+    unsafe {
+        libmimalloc_sys::mi_option_set_enabled_default(
+            libmimalloc_sys::mi_option_large_os_pages,
+            true,
+        )
+    };
+
     let mut signals_list = Signals::new([consts::signal::SIGINT, consts::signal::SIGTERM])?;
     thread::spawn(move || {
         // `next()` should block until we've received a signal, or `signals_list` is closed and
@@ -83,6 +93,16 @@ pub fn run_shadow(args: Vec<&OsStr>) -> anyhow::Result<()> {
         std::process::exit(0);
     }
 
+    if let Some(path) = &options.decode_strace {
+        let file = std::fs::File::open(path)
+            .with_context(|| format!("Failed to open strace file '{path}'"))?;
+        let reader = std::io::BufReader::new(file);
+        let writer = std::io::BufWriter::new(std::io::stdout().lock());
+        crate::host::syscall::binary_strace::decode(reader, writer)
+            .with_context(|| format!("Failed to decode strace file '{path}'"))?;
+        std::process::exit(0);
+    }
+
     // read from stdin if the config filename is given as '-'
     let config_filename: String = match options.config.as_ref().unwrap().as_str() {
         "-" => "/dev/stdin",
@@ -156,7 +176,8 @@ pub fn run_shadow(args: Vec<&OsStr>) -> anyhow::Result<()> {
     // save the platform data required for CPU pinning
     if shadow_config.experimental.use_cpu_pinning.unwrap() {
         #[allow(clippy::collapsible_if)]
-        if unsafe { c::affinity_initPlatformInfo() } != 0 {
+        let use_sibling_cpus = shadow_config.experimental.use_smt_sibling_pinning.unwrap();
+        if unsafe { c::affinity_initPlatformInfo(use_sibling_cpus) } != 0 {
             return Err(anyhow::anyhow!("Unable to initialize platform info"));
         }
     }
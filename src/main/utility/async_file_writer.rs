@@ -0,0 +1,469 @@
+//! Writes to os-backed files from a background I/O thread, so that a worker thread doesn't block
+//! on disk while a host writes to a file.
+
+use std::collections::HashMap;
+use std::ffi::CStr;
+use std::os::fd::RawFd;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::mpsc::{Receiver, Sender, SyncSender};
+use std::sync::{Arc, Condvar, Mutex};
+
+use once_cell::sync::Lazy;
+
+/// Channel used to send commands to the I/O thread. The thread is started the first time an
+/// [`AsyncFileWriter`] is created. All commands are processed in order, so writes to a file are
+/// made in the order they were queued even if the host moves to a different worker thread.
+///
+/// The Sender half of a channel isn't Sync, so we must protect it with a Mutex. This is only
+/// locked once per file, to clone a sender for the writer.
+static IO_THREAD_SENDER: Lazy<Mutex<Sender<IoCommand>>> = Lazy::new(|| {
+    let (sender, receiver) = std::sync::mpsc::channel();
+
+    std::thread::Builder::new()
+        .name("shadow-file-io".to_string())
+        .spawn(move || io_thread_fn(receiver))
+        .unwrap();
+
+    Mutex::new(sender)
+});
+
+/// Identifies a file by its device and inode, so that writes queued through one descriptor can be
+/// waited for through any other descriptor or path of the same file.
+pub type FileId = (libc::dev_t, libc::ino_t);
+
+/// The number of queued commands for each file that has any.
+static QUEUED_BY_FILE: Lazy<Mutex<HashMap<FileId, usize>>> = Lazy::new(Default::default);
+/// Notified when a file is removed from `QUEUED_BY_FILE`.
+static FILE_IDLE: Condvar = Condvar::new();
+/// The number of queued commands for all files, so that we don't need to look up the file when
+/// nothing is queued.
+static NUM_QUEUED: AtomicUsize = AtomicUsize::new(0);
+
+fn file_queued(file: FileId) {
+    NUM_QUEUED.fetch_add(1, Ordering::SeqCst);
+    *QUEUED_BY_FILE.lock().unwrap().entry(file).or_default() += 1;
+}
+
+fn file_completed(file: FileId) {
+    let mut queued = QUEUED_BY_FILE.lock().unwrap();
+    let count = queued.get_mut(&file).unwrap();
+    *count -= 1;
+    if *count == 0 {
+        queued.remove(&file);
+        FILE_IDLE.notify_all();
+    }
+    NUM_QUEUED.fetch_sub(1, Ordering::SeqCst);
+}
+
+/// Wait for the queued commands of the file, made through any writer.
+pub fn wait_for_file(file: FileId) {
+    if NUM_QUEUED.load(Ordering::SeqCst) == 0 {
+        return;
+    }
+    let queued = QUEUED_BY_FILE.lock().unwrap();
+    let _queued = FILE_IDLE
+        .wait_while(queued, |x| x.contains_key(&file))
+        .unwrap();
+}
+
+fn file_id(st: &libc::stat) -> FileId {
+    (st.st_dev, st.st_ino)
+}
+
+/// Wait for the queued commands of the file open at the fd, made through any writer.
+pub fn wait_for_fd(fd: RawFd) {
+    if NUM_QUEUED.load(Ordering::SeqCst) == 0 {
+        return;
+    }
+    let mut st = std::mem::MaybeUninit::<libc::stat>::uninit();
+    if unsafe { libc::fstat(fd, st.as_mut_ptr()) } == 0 {
+        wait_for_file(file_id(unsafe { st.assume_init_ref() }));
+    }
+}
+
+/// Wait for the queued commands of the file at the path, as looked up by `fstatat()` with the
+/// `AT_EMPTY_PATH` and `AT_SYMLINK_NOFOLLOW` flags in `flags`. Nothing is waited for if the path
+/// can't be looked up.
+pub fn wait_for_path(dirfd: RawFd, path: &CStr, flags: libc::c_int) {
+    if NUM_QUEUED.load(Ordering::SeqCst) == 0 {
+        return;
+    }
+    let flags = flags & (libc::AT_EMPTY_PATH | libc::AT_SYMLINK_NOFOLLOW);
+    let mut st = std::mem::MaybeUninit::<libc::stat>::uninit();
+    if unsafe { libc::fstatat(dirfd, path.as_ptr(), st.as_mut_ptr(), flags) } == 0 {
+        wait_for_file(file_id(unsafe { st.assume_init_ref() }));
+    }
+}
+
+enum IoCommand {
+    /// Write the data at the file offset, or at the fd's current offset if `None`.
+    Write(Arc<WriterState>, Vec<u8>, Option<libc::off_t>),
+    Fsync(Arc<WriterState>),
+    /// Notify the sender once all previous commands have been processed.
+    Sync(SyncSender<()>),
+}
+
+fn io_thread_fn(receiver: Receiver<IoCommand>) {
+    for command in receiver {
+        match command {
+            IoCommand::Write(state, data, offset) => {
+                let rv = write_all(state.fd, &data, offset);
+                state.complete(rv);
+            }
+            IoCommand::Fsync(state) => {
+                let rv = match unsafe { libc::fsync(state.fd) } {
+                    0 => Ok(()),
+                    _ => Err(nix::errno::Errno::last() as i32),
+                };
+                state.complete(rv);
+            }
+            IoCommand::Sync(done) => {
+                // the caller may have given up waiting
+                done.send(()).ok();
+            }
+        }
+    }
+}
+
+/// Write all of `data`, retrying short writes. Returns the errno on failure.
+fn write_all(fd: RawFd, mut data: &[u8], mut offset: Option<libc::off_t>) -> Result<(), i32> {
+    while !data.is_empty() {
+        let rv = match offset {
+            Some(offset) => unsafe { libc::pwrite(fd, data.as_ptr().cast(), data.len(), offset) },
+            None => unsafe { libc::write(fd, data.as_ptr().cast(), data.len()) },
+        };
+        if rv < 0 {
+            let errno = nix::errno::Errno::last();
+            if errno == nix::errno::Errno::EINTR {
+                continue;
+            }
+            return Err(errno as i32);
+        }
+        let written = usize::try_from(rv).unwrap();
+        data = &data[written..];
+        if let Some(offset) = offset.as_mut() {
+            *offset += libc::off_t::try_from(written).unwrap();
+        }
+    }
+    Ok(())
+}
+
+/// State shared between a writer and the I/O thread.
+struct WriterState {
+    fd: RawFd,
+    file: FileId,
+    pending: Mutex<Pending>,
+    /// Notified when `pending.count` reaches 0.
+    idle: Condvar,
+}
+
+#[derive(Default)]
+struct Pending {
+    /// The number of queued commands that haven't completed.
+    count: usize,
+    /// The errno of the first command that failed and hasn't been reported yet.
+    error: Option<i32>,
+}
+
+impl WriterState {
+    fn complete(&self, rv: Result<(), i32>) {
+        file_completed(self.file);
+        let mut pending = self.pending.lock().unwrap();
+        pending.count -= 1;
+        if let Err(errno) = rv {
+            pending.error.get_or_insert(errno);
+        }
+        if pending.count == 0 {
+            self.idle.notify_all();
+        }
+    }
+}
+
+/// Queues writes and fsyncs of a file descriptor to be made by a background I/O thread. The
+/// results of the queued operations aren't known when they're queued, so the first error is
+/// instead returned by a later call to [`take_error`](Self::take_error), similar to how the kernel
+/// reports writeback errors from a later `write` or `fsync`.
+pub struct AsyncFileWriter {
+    state: Arc<WriterState>,
+    sender: Sender<IoCommand>,
+}
+
+impl AsyncFileWriter {
+    /// The fd must stay open until the writer is dropped, and `file` must identify the file it's
+    /// open at.
+    pub fn new(fd: RawFd, file: FileId) -> Self {
+        Self {
+            state: Arc::new(WriterState {
+                fd,
+                file,
+                pending: Mutex::new(Pending::default()),
+                idle: Condvar::new(),
+            }),
+            sender: IO_THREAD_SENDER.lock().unwrap().clone(),
+        }
+    }
+
+    fn send(&self, command: IoCommand) {
+        self.state.pending.lock().unwrap().count += 1;
+        file_queued(self.state.file);
+        self.sender
+            .send(command)
+            .expect("The file I/O thread has stopped");
+    }
+
+    /// Queue a write of the data at the fd's current offset, which the write will advance.
+    pub fn write(&self, data: Vec<u8>) {
+        self.send(IoCommand::Write(Arc::clone(&self.state), data, None));
+    }
+
+    /// Queue a write of the data at the file offset.
+    pub fn pwrite(&self, data: Vec<u8>, offset: libc::off_t) {
+        self.send(IoCommand::Write(
+            Arc::clone(&self.state),
+            data,
+            Some(offset),
+        ));
+    }
+
+    /// Queue an fsync of the file, after the previously queued writes.
+    pub fn fsync(&self) {
+        self.send(IoCommand::Fsync(Arc::clone(&self.state)));
+    }
+
+    /// Wait for the queued operations to complete.
+    pub fn wait(&self) {
+        let pending = self.state.pending.lock().unwrap();
+        let _pending = self
+            .state
+            .idle
+            .wait_while(pending, |x| x.count > 0)
+            .unwrap();
+    }
+
+    /// Return the first error from a completed operation that hasn't been returned yet. This
+    /// doesn't wait for the queued operations.
+    pub fn take_error(&self) -> Result<(), i32> {
+        let mut pending = self.state.pending.lock().unwrap();
+        pending.error.take().map_or(Ok(()), Err)
+    }
+}
+
+impl Drop for AsyncFileWriter {
+    fn drop(&mut self) {
+        // the fd may be closed once we return
+        self.wait();
+        if let Err(errno) = self.take_error() {
+            log::warn!(
+                "An asynchronous write to a file failed: {}",
+                nix::errno::Errno::from_raw(errno)
+            );
+        }
+    }
+}
+
+/// Wait until the I/O thread has completed all operations queued before this call.
+pub fn wait_for_all() {
+    let sender = IO_THREAD_SENDER.lock().unwrap().clone();
+    let (done_sender, done_receiver) = std::sync::mpsc::sync_channel(1);
+    sender
+        .send(IoCommand::Sync(done_sender))
+        .expect("The file I/O thread has stopped");
+    done_receiver
+        .recv()
+        .expect("The file I/O thread has stopped");
+}
+
+mod export {
+    use super::*;
+
+    /// Create a writer for the fd, which must stay open until the writer is freed. `dev` and
+    /// `ino` are the fd's `st_dev` and `st_ino`.
+    #[no_mangle]
+    pub extern "C-unwind" fn asyncfilewriter_new(
+        fd: libc::c_int,
+        dev: libc::dev_t,
+        ino: libc::ino_t,
+    ) -> *mut AsyncFileWriter {
+        Box::into_raw(Box::new(AsyncFileWriter::new(fd, (dev, ino))))
+    }
+
+    /// Waits for all queued operations before freeing the writer.
+    #[no_mangle]
+    pub extern "C-unwind" fn asyncfilewriter_free(writer: *mut AsyncFileWriter) {
+        if writer.is_null() {
+            return;
+        }
+        drop(unsafe { Box::from_raw(writer) });
+    }
+
+    /// Queue a write of a copy of the buffer. If `offset` is negative, the data is written at the
+    /// fd's current offset.
+    #[no_mangle]
+    pub extern "C-unwind" fn asyncfilewriter_write(
+        writer: *const AsyncFileWriter,
+        buf: *const libc::c_void,
+        len: libc::size_t,
+        offset: libc::off_t,
+    ) {
+        let writer = unsafe { writer.as_ref() }.unwrap();
+        let data = unsafe { std::slice::from_raw_parts(buf.cast::<u8>(), len) }.to_vec();
+        match offset {
+            x if x < 0 => writer.write(data),
+            x => writer.pwrite(data, x),
+        }
+    }
+
+    /// Queue a write of a copy of the buffers at the file offset.
+    #[no_mangle]
+    pub extern "C-unwind" fn asyncfilewriter_writev(
+        writer: *const AsyncFileWriter,
+        iov: *const libc::iovec,
+        iovcnt: libc::c_int,
+        offset: libc::off_t,
+    ) {
+        let writer = unsafe { writer.as_ref() }.unwrap();
+        let iov = unsafe { std::slice::from_raw_parts(iov, iovcnt.try_into().unwrap()) };
+
+        let mut data = Vec::with_capacity(iov.iter().map(|x| x.iov_len).sum());
+        for x in iov.iter().filter(|x| x.iov_len > 0) {
+            data.extend_from_slice(unsafe {
+                std::slice::from_raw_parts(x.iov_base.cast::<u8>(), x.iov_len)
+            });
+        }
+
+        match offset {
+            x if x < 0 => writer.write(data),
+            x => writer.pwrite(data, x),
+        }
+    }
+
+    #[no_mangle]
+    pub extern "C-unwind" fn asyncfilewriter_fsync(writer: *const AsyncFileWriter) {
+        let writer = unsafe { writer.as_ref() }.unwrap();
+        writer.fsync();
+    }
+
+    /// Wait for all queued operations to complete, so that the fd can be used directly.
+    #[no_mangle]
+    pub extern "C-unwind" fn asyncfilewriter_wait(writer: *const AsyncFileWriter) {
+        let writer = unsafe { writer.as_ref() }.unwrap();
+        writer.wait();
+    }
+
+    /// Wait for the queued operations of the file open at the fd, made through any writer.
+    #[no_mangle]
+    pub extern "C-unwind" fn asyncfilewriter_waitForFd(fd: libc::c_int) {
+        wait_for_fd(fd);
+    }
+
+    /// Wait for the queued operations of the file at the path relative to `dirfd`, made through
+    /// any writer. Only the `AT_EMPTY_PATH` and `AT_SYMLINK_NOFOLLOW` flags are used.
+    #[no_mangle]
+    pub extern "C-unwind" fn asyncfilewriter_waitForPath(
+        dirfd: libc::c_int,
+        path: *const libc::c_char,
+        flags: libc::c_int,
+    ) {
+        let path = unsafe { CStr::from_ptr(path) };
+        wait_for_path(dirfd, path, flags);
+    }
+
+    /// Returns 0, or the positive errno of the first completed operation that failed since the
+    /// last time an error was returned. This doesn't wait for the queued operations.
+    #[no_mangle]
+    pub extern "C-unwind" fn asyncfilewriter_takeError(
+        writer: *const AsyncFileWriter,
+    ) -> libc::c_int {
+        let writer = unsafe { writer.as_ref() }.unwrap();
+        writer.take_error().err().unwrap_or(0)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::io::{Read, Seek};
+    use std::os::fd::AsRawFd;
+    use std::os::unix::ffi::OsStrExt;
+    use std::os::unix::fs::MetadataExt;
+
+    use super::*;
+
+    fn new_writer(file: &std::fs::File) -> AsyncFileWriter {
+        let metadata = file.metadata().unwrap();
+        AsyncFileWriter::new(file.as_raw_fd(), (metadata.dev(), metadata.ino()))
+    }
+
+    #[test]
+    fn test_async_file_writer() {
+        let mut file = tempfile::tempfile().unwrap();
+
+        let writer = new_writer(&file);
+        for i in 0..100u8 {
+            writer.write(vec![i; 1000]);
+        }
+        writer.pwrite(b"shadow".to_vec(), 10);
+        writer.fsync();
+        writer.wait();
+        assert_eq!(writer.take_error(), Ok(()));
+        drop(writer);
+
+        let mut contents = Vec::new();
+        file.rewind().unwrap();
+        file.read_to_end(&mut contents).unwrap();
+
+        assert_eq!(contents.len(), 100 * 1000);
+        assert_eq!(&contents[..10], &[0; 10]);
+        assert_eq!(&contents[10..16], b"shadow");
+        assert!(contents[1000..]
+            .chunks(1000)
+            .zip(1..)
+            .all(|(x, i)| x == [i; 1000]));
+    }
+
+    #[test]
+    fn test_async_file_writer_error() {
+        let file = std::fs::File::open("/dev/null").unwrap();
+
+        // writing to a read-only fd fails
+        let writer = new_writer(&file);
+        writer.write(vec![0; 10]);
+        writer.write(vec![0; 10]);
+        writer.wait();
+        assert_eq!(writer.take_error(), Err(libc::EBADF));
+        // the error is only returned once
+        assert_eq!(writer.take_error(), Ok(()));
+    }
+
+    #[test]
+    fn test_async_file_writer_other_fd() {
+        let file = tempfile::NamedTempFile::new().unwrap();
+
+        let writer = new_writer(file.as_file());
+        for i in 0..100u8 {
+            writer.write(vec![i; 1000]);
+        }
+
+        // the writes are visible through a different fd once we wait for it
+        let mut other = std::fs::File::open(file.path()).unwrap();
+        wait_for_fd(other.as_raw_fd());
+        let mut contents = Vec::new();
+        other.read_to_end(&mut contents).unwrap();
+        assert_eq!(contents.len(), 100 * 1000);
+
+        // and through the path
+        writer.pwrite(b"shadow".to_vec(), 100 * 1000);
+        let path = std::ffi::CString::new(file.path().as_os_str().as_bytes()).unwrap();
+        wait_for_path(libc::AT_FDCWD, &path, 0);
+        assert_eq!(
+            std::fs::metadata(file.path()).unwrap().len(),
+            100 * 1000 + 6
+        );
+
+        let metadata = file.as_file().metadata().unwrap();
+        drop(writer);
+        assert!(!QUEUED_BY_FILE
+            .lock()
+            .unwrap()
+            .contains_key(&(metadata.dev(), metadata.ino())));
+    }
+}
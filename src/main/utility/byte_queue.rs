@@ -67,14 +67,47 @@ impl ByteQueue {
             self.total_allocations += 1;
         }
 
-        BytesMut::from_iter(std::iter::repeat(0).take(size))
+        // this uses a zeroed allocation (calloc) rather than writing the zeroes ourselves, so large
+        // buffers can use memory that the allocator or kernel has already zeroed
+        BytesMut::zeroed(size)
     }
 
     /// Push stream data onto the queue. The data may be merged into the previous stream chunk.
-    pub fn push_stream<R: Read>(&mut self, mut src: R) -> std::io::Result<usize> {
+    pub fn push_stream<R: Read>(&mut self, src: R) -> std::io::Result<usize> {
+        self.push_stream_inner(src, None)
+    }
+
+    /// Push stream data onto the queue, where `len` is the number of bytes that `src` is expected
+    /// to provide. If `len` is larger than the default chunk capacity, the data is read into a
+    /// single chunk of `len` bytes rather than many default-sized chunks. This is useful for large
+    /// writes from managed memory, which can then be read from the source and later written to
+    /// the destination with a single (vectored) copy each rather than one per chunk.
+    pub fn push_stream_sized<R: Read>(&mut self, src: R, len: usize) -> std::io::Result<usize> {
+        if len > self.default_chunk_capacity
+            && !matches!(&self.unused_buffer, Some(buf) if buf.len() >= len)
+        {
+            // this will drop any smaller unused buffer, which is okay since we'd likely only be
+            // able to store a small part of the data in it
+            self.unused_buffer = Some(self.alloc_zeroed_buffer(len));
+        }
+
+        self.push_stream_inner(src, Some(len))
+    }
+
+    /// Push stream data onto the queue. If `len` is given, stop once that many bytes have been
+    /// read rather than allocating a new buffer only to find that `src` has no more data.
+    fn push_stream_inner<R: Read>(
+        &mut self,
+        mut src: R,
+        len: Option<usize>,
+    ) -> std::io::Result<usize> {
         let mut total_copied = 0;
 
         loop {
+            if len.is_some_and(|len| total_copied >= len) {
+                break;
+            }
+
             let mut unused = match self.unused_buffer.take() {
                 // we already have an allocated buffer
                 Some(x) => x,
@@ -544,6 +577,46 @@ mod tests {
         assert_eq!(bq.num_bytes(), 0);
     }
 
+    #[test]
+    fn test_bytequeue_stream_sized() {
+        let mut bq = ByteQueue::new(5);
+
+        let src1: Vec<u8> = (0..23).collect();
+        let src2 = [51, 52, 53];
+
+        // a large write is stored in a single chunk
+        assert_eq!(
+            bq.push_stream_sized(&src1[..], src1.len()).unwrap(),
+            src1.len()
+        );
+        assert_eq!(bq.bytes.len(), 1);
+        assert_eq!(bq.total_allocations, 1);
+
+        // a small write uses the default chunk capacity
+        assert_eq!(
+            bq.push_stream_sized(&src2[..], src2.len()).unwrap(),
+            src2.len()
+        );
+        assert_eq!(bq.bytes.len(), 2);
+        assert_eq!(bq.total_allocations, 2);
+
+        // if the source provides fewer bytes than expected, the remaining space is used by the
+        // next write
+        assert_eq!(bq.push_stream_sized(&src1[..10], 20).unwrap(), 10);
+        assert_eq!(bq.total_allocations, 3);
+        bq.push_stream(&src2[..]).unwrap();
+        assert_eq!(bq.total_allocations, 3);
+        assert_eq!(bq.bytes.len(), 3);
+
+        let mut dst = [0; 64];
+        assert_eq!(bq.pop(&mut dst[..]).unwrap().unwrap().0, 39);
+        assert_eq!(&dst[..23], &src1[..]);
+        assert_eq!(&dst[23..26], &src2[..]);
+        assert_eq!(&dst[26..36], &src1[..10]);
+        assert_eq!(&dst[36..39], &src2[..]);
+        assert_eq!(bq.num_bytes(), 0);
+    }
+
     #[test]
     fn test_bytequeue_packet() {
         let mut bq = ByteQueue::new(5);
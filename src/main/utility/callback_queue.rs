@@ -4,16 +4,25 @@
 //! attempting to mutate the same state simultaneously, an event queue is used to defer new events
 //! until the current event has finished running.
 
+use std::cell::RefCell;
 use std::collections::VecDeque;
+use std::mem::{ManuallyDrop, MaybeUninit};
 use std::num::Wrapping;
 use std::sync::{Arc, Weak};
 
 use atomic_refcell::AtomicRefCell;
 
+/// The most empty queues that each thread keeps for reuse by [`CallbackQueue::queue_and_run`].
+/// Queues can be nested, so there may be more than one in use at a time.
+const SPARE_QUEUES_MAX_LEN: usize = 8;
+
+thread_local! {
+    static SPARE_QUEUES: RefCell<Vec<VecDeque<Callback>>> = const { RefCell::new(Vec::new()) };
+}
+
 /// A queue of events (functions/closures) which when run can add their own events to the queue.
 /// This allows events to be deferred and run later.
-#[allow(clippy::type_complexity)]
-pub struct CallbackQueue(VecDeque<Box<dyn FnOnce(&mut Self)>>);
+pub struct CallbackQueue(VecDeque<Callback>);
 
 impl CallbackQueue {
     /// Create an empty event queue.
@@ -29,9 +38,10 @@ impl CallbackQueue {
         self.len() == 0
     }
 
-    /// Add an event to the queue.
+    /// Add an event to the queue. Small closures, such as the ones added by
+    /// [`EventSource::notify_listeners`], are stored in the queue without allocating.
     pub fn add(&mut self, f: impl FnOnce(&mut Self) + 'static) {
-        self.0.push_back(Box::new(f));
+        self.0.push_back(Callback::new(f));
     }
 
     /// Process all of the events in the queue (and any new events that are generated).
@@ -40,7 +50,7 @@ impl CallbackQueue {
         let mut count = 0;
         while let Some(f) = self.0.pop_front() {
             // run the event and allow it to add new events
-            (f)(self);
+            f.run(self);
 
             count += 1;
             if count == 10_000 {
@@ -57,9 +67,24 @@ impl CallbackQueue {
     where
         F: FnOnce(&mut Self) -> U,
     {
-        let mut cb_queue = Self::new();
+        // reuse a queue that has already allocated space for events, if there is one
+        let spare = SPARE_QUEUES
+            .try_with(|queues| queues.borrow_mut().pop())
+            .ok()
+            .flatten();
+        let mut cb_queue = Self(spare.unwrap_or_default());
+
         let rv = (f)(&mut cb_queue);
         cb_queue.run();
+
+        let queue = std::mem::take(&mut cb_queue.0);
+        let _ = SPARE_QUEUES.try_with(|queues| {
+            let mut queues = queues.borrow_mut();
+            if queues.len() < SPARE_QUEUES_MAX_LEN {
+                queues.push(queue);
+            }
+        });
+
         rv
     }
 
@@ -103,6 +128,72 @@ impl Drop for CallbackQueue {
     }
 }
 
+/// The storage for a closure in a [`Callback`]. Large enough for the closures added by
+/// [`EventSource::notify_listeners`], which hold a listener and a copy of the message.
+type CallbackStorage = MaybeUninit<[usize; 4]>;
+
+/// A `FnOnce(&mut CallbackQueue)` that is stored inline if it fits in a [`CallbackStorage`], and
+/// boxed otherwise.
+struct Callback {
+    storage: CallbackStorage,
+    /// Moves the closure out of `storage` and runs it.
+    run_fn: unsafe fn(*mut CallbackStorage, &mut CallbackQueue),
+    /// Drops the closure in `storage` without running it.
+    drop_fn: unsafe fn(*mut CallbackStorage),
+}
+
+impl Callback {
+    fn new<F: FnOnce(&mut CallbackQueue) + 'static>(f: F) -> Self {
+        if Self::fits::<F>() {
+            Self::new_inline(f)
+        } else {
+            Self::new_inline(Box::new(f))
+        }
+    }
+
+    const fn fits<F>() -> bool {
+        std::mem::size_of::<F>() <= std::mem::size_of::<CallbackStorage>()
+            && std::mem::align_of::<F>() <= std::mem::align_of::<CallbackStorage>()
+    }
+
+    fn new_inline<F: FnOnce(&mut CallbackQueue) + 'static>(f: F) -> Self {
+        assert!(Self::fits::<F>());
+
+        unsafe fn run_fn<F: FnOnce(&mut CallbackQueue)>(
+            storage: *mut CallbackStorage,
+            cb_queue: &mut CallbackQueue,
+        ) {
+            let f = unsafe { storage.cast::<F>().read() };
+            (f)(cb_queue)
+        }
+
+        unsafe fn drop_fn<F>(storage: *mut CallbackStorage) {
+            unsafe { storage.cast::<F>().drop_in_place() }
+        }
+
+        let mut storage = CallbackStorage::uninit();
+        unsafe { storage.as_mut_ptr().cast::<F>().write(f) };
+
+        Self {
+            storage,
+            run_fn: run_fn::<F>,
+            drop_fn: drop_fn::<F>,
+        }
+    }
+
+    fn run(self, cb_queue: &mut CallbackQueue) {
+        // the closure is moved out of the storage when it's run, so it mustn't be dropped again
+        let mut this = ManuallyDrop::new(self);
+        unsafe { (this.run_fn)(&mut this.storage, cb_queue) }
+    }
+}
+
+impl Drop for Callback {
+    fn drop(&mut self) {
+        unsafe { (self.drop_fn)(&mut self.storage) }
+    }
+}
+
 #[derive(Clone, Copy, PartialEq, PartialOrd)]
 struct HandleId(u32);
 
@@ -238,4 +329,47 @@ mod tests {
 
         assert_eq!(*counter.borrow(), 4);
     }
+
+    #[test]
+    fn test_large_callback() {
+        let counter = Arc::new(AtomicRefCell::new(0u32));
+        let counter_clone = Arc::clone(&counter);
+
+        // too large to be stored inline
+        let values = [1u64; 16];
+        assert!(!Callback::fits::<[u64; 16]>());
+
+        CallbackQueue::queue_and_run(|queue| {
+            queue.add(move |queue| {
+                *counter_clone.borrow_mut() += values.iter().sum::<u64>() as u32;
+                queue.add(move |_| *counter_clone.borrow_mut() += 1);
+            })
+        });
+
+        assert_eq!(*counter.borrow(), 17);
+    }
+
+    #[test]
+    fn test_callback_drop() {
+        let counter = Arc::new(());
+
+        for large in [false, true] {
+            let counter_clone = Arc::clone(&counter);
+            let values = [0u64; 16];
+            let callback = if large {
+                Callback::new(move |_| {
+                    let _ = (&counter_clone, values);
+                })
+            } else {
+                Callback::new(move |_| {
+                    let _ = &counter_clone;
+                })
+            };
+            assert_eq!(Arc::strong_count(&counter), 2);
+
+            // dropping a callback that hasn't run should drop what it captured
+            drop(callback);
+            assert_eq!(Arc::strong_count(&counter), 1);
+        }
+    }
 }
@@ -22,6 +22,11 @@ pub struct ChildPidWatcher {
 
 pub type WatchHandle = u64;
 
+/// The maximum number of epoll events to handle per wakeup of the watcher thread. When many
+/// processes exit at once (e.g. at the end of a simulation), this lets the thread handle them all
+/// with a few `epoll_wait` calls and lock acquisitions.
+const MAX_EVENTS_PER_WAIT: usize = 1024;
+
 #[derive(Debug)]
 enum Command {
     RunCallbacks(Pid),
@@ -55,8 +60,14 @@ struct Inner {
 
 impl Inner {
     fn send_command(&mut self, cmd: Command) {
+        // The watcher thread takes all pending commands at once, and resets the notifier at the
+        // same time while holding the lock. If there are already pending commands then it's
+        // already been notified, and will also handle this one.
+        let notify = self.commands.is_empty();
         self.commands.push(cmd);
-        rustix::io::write(&self.command_notifier, &1u64.to_ne_bytes()).unwrap();
+        if notify {
+            rustix::io::write(&self.command_notifier, &1u64.to_ne_bytes()).unwrap();
+        }
     }
 
     fn unwatch_pid(&mut self, epoll: impl AsFd, pid: Pid) {
@@ -140,9 +151,9 @@ impl ChildPidWatcher {
 
     fn thread_loop(inner: &Mutex<Inner>, epoll: impl AsFd) {
         let mut commands = Vec::new();
+        let mut events = epoll::EventVec::with_capacity(MAX_EVENTS_PER_WAIT);
         let mut done = false;
         while !done {
-            let mut events = epoll::EventVec::with_capacity(10);
             match epoll::wait(epoll.as_fd(), &mut events, -1) {
                 Ok(()) => (),
                 Err(rustix::io::Errno::INTR) => {
@@ -159,10 +170,12 @@ impl ChildPidWatcher {
             // caller unregisters it.
             let mut inner = inner.lock().unwrap();
 
-            for event in events.into_iter() {
+            let mut notified = false;
+            for event in events.iter() {
                 if event.data.u64() == 0 {
                     // We get an event for pid=0 when there's a write to the
                     // command_notifier; Ignore that here and handle below.
+                    notified = true;
                     continue;
                 }
                 let pid = Pid::from_raw(i32::try_from(event.data.u64()).unwrap()).unwrap();
@@ -170,6 +183,11 @@ impl ChildPidWatcher {
                 inner.run_callbacks_for_pid(pid);
                 inner.maybe_remove_pid(epoll.as_fd(), pid);
             }
+            if !notified {
+                // Any commands sent since `epoll_wait` returned come with a
+                // notification, and will be handled after the next wait.
+                continue;
+            }
             // Reading an eventfd always returns an 8 byte integer. Do so to ensure it's
             // no longer marked 'readable'.
             let mut buf = [0; 8];
@@ -281,6 +299,17 @@ impl ChildPidWatcher {
     //     unsafe { self.fork_watchable_internal(libc::SYS_vfork, child_fn) }
     // }
 
+    /// The registered pids that haven't exited or been unregistered yet.
+    pub fn registered_pids(&self) -> Vec<Pid> {
+        let inner = self.inner.lock().unwrap();
+        inner
+            .pids
+            .iter()
+            .filter(|(_pid, data)| data.pidfd.is_some() && !data.unregistered)
+            .map(|(pid, _data)| *pid)
+            .collect()
+    }
+
     /// Unregister the pid. After unregistration, no more callbacks may be
     /// registered for the given pid. Already-registered callbacks will still be
     /// called if and when the pid exits unless individually unregistered.
@@ -547,6 +576,69 @@ mod tests {
         );
     }
 
+    #[test]
+    // can't call foreign functions
+    #[cfg_attr(miri, ignore)]
+    fn register_many_exit_together() {
+        // More children than a single `epoll_wait` returns, so that the
+        // watcher thread has to handle the exits over multiple wakeups.
+        let num_children = MAX_EVENTS_PER_WAIT + 10;
+        let notifier =
+            EventFd::from_value_and_flags(0, nix::sys::eventfd::EfdFlags::EFD_SEMAPHORE).unwrap();
+
+        let watcher = ChildPidWatcher::new();
+        let children: Vec<Pid> = (0..num_children)
+            .map(|_| {
+                unsafe {
+                    watcher.fork_watchable(|| {
+                        let mut buf = [0; 8];
+                        // Wait for parent to register its callback.
+                        nix::unistd::read(notifier.as_raw_fd(), &mut buf).unwrap();
+                        libc::_exit(42);
+                    })
+                }
+                .unwrap()
+            })
+            .collect();
+
+        let callbacks_ran = Arc::new((Mutex::new(0), Condvar::new()));
+        for child in &children {
+            let callbacks_ran = callbacks_ran.clone();
+            watcher.register_callback(
+                *child,
+                Box::new(move |_pid| {
+                    *callbacks_ran.0.lock().unwrap() += 1;
+                    callbacks_ran.1.notify_all();
+                }),
+            );
+            watcher.unregister_pid(*child);
+        }
+
+        // Let all of the children exit.
+        nix::unistd::write(
+            &notifier,
+            &u64::try_from(num_children).unwrap().to_ne_bytes(),
+        )
+        .unwrap();
+
+        let mut callbacks_ran_lock = callbacks_ran.0.lock().unwrap();
+        while *callbacks_ran_lock < num_children {
+            callbacks_ran_lock = callbacks_ran.1.wait(callbacks_ran_lock).unwrap();
+        }
+        assert_eq!(*callbacks_ran_lock, num_children);
+        drop(callbacks_ran_lock);
+
+        for child in children {
+            let status = waitpid(Some(child.into()), WaitOptions::empty())
+                .unwrap()
+                .unwrap();
+            assert_eq!(status.exit_status(), Some(42));
+        }
+
+        // All of the pids were unregistered and their callbacks have run.
+        assert!(watcher.inner.lock().unwrap().pids.is_empty());
+    }
+
     #[test]
     // can't call foreign function
     #[cfg_attr(miri, ignore)]
@@ -614,4 +706,53 @@ mod tests {
             Some(42)
         );
     }
+
+    #[test]
+    // can't call foreign function
+    #[cfg_attr(miri, ignore)]
+    fn registered_pids() {
+        let notifier = EventFd::new().unwrap();
+
+        let watcher = ChildPidWatcher::new();
+        let child = unsafe {
+            watcher.fork_watchable(|| {
+                let mut buf = [0; 8];
+                // Wait for parent to check the registered pids.
+                nix::unistd::read(notifier.as_raw_fd(), &mut buf).unwrap();
+                libc::_exit(42);
+            })
+        }
+        .unwrap();
+
+        let callback_ran = Arc::new((Mutex::new(false), Condvar::new()));
+        {
+            let callback_ran = callback_ran.clone();
+            watcher.register_callback(
+                child,
+                Box::new(move |_pid| {
+                    *callback_ran.0.lock().unwrap() = true;
+                    callback_ran.1.notify_all();
+                }),
+            );
+        }
+
+        assert_eq!(watcher.registered_pids(), [child]);
+
+        // Let the child exit.
+        nix::unistd::write(&notifier, &1u64.to_ne_bytes()).unwrap();
+
+        // Wait for our callback to run.
+        let mut callback_ran_lock = callback_ran.0.lock().unwrap();
+        while !*callback_ran_lock {
+            callback_ran_lock = callback_ran.1.wait(callback_ran_lock).unwrap();
+        }
+        drop(callback_ran_lock);
+
+        // The child has exited, so shouldn't be listed anymore.
+        assert!(watcher.registered_pids().is_empty());
+
+        waitpid(Some(child.into()), WaitOptions::empty())
+            .unwrap()
+            .unwrap();
+    }
 }
@@ -0,0 +1,44 @@
+//! Runs cleanup work that has no effect on the simulation, such as unmapping an exited process's
+//! memory, on a background thread so that the worker thread can return to running hosts.
+
+use std::sync::mpsc::{Receiver, Sender};
+use std::sync::Mutex;
+
+use once_cell::sync::Lazy;
+
+type CleanupFn = Box<dyn FnOnce() + Send>;
+
+/// Channel used to send work to the cleanup thread. The thread is started the first time work is
+/// deferred.
+///
+/// The Sender half of a channel isn't Sync, so we must protect it with a Mutex. Work is only
+/// deferred when a process exits, so this isn't locked often.
+static CLEANUP_THREAD_SENDER: Lazy<Mutex<Sender<CleanupFn>>> = Lazy::new(|| {
+    let (sender, receiver) = std::sync::mpsc::channel();
+
+    std::thread::Builder::new()
+        .name("shadow-cleanup".to_string())
+        .spawn(move || cleanup_thread_fn(receiver))
+        .unwrap();
+
+    Mutex::new(sender)
+});
+
+fn cleanup_thread_fn(receiver: Receiver<CleanupFn>) {
+    for f in receiver {
+        f();
+    }
+}
+
+/// Run `f` on the cleanup thread. `f` mustn't access any simulation state (it runs outside of any
+/// worker, and may run after the current host has moved on), and mustn't panic.
+///
+/// There's no guarantee that `f` has run before shadow exits, so it also mustn't be needed for
+/// anything other than freeing resources that the OS will free on exit anyway.
+pub fn defer(f: impl FnOnce() + Send + 'static) {
+    let sender = CLEANUP_THREAD_SENDER.lock().unwrap();
+    if let Err(e) = sender.send(Box::new(f)) {
+        // the cleanup thread has exited; do the work here instead
+        (e.0)();
+    }
+}
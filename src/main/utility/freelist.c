@@ -0,0 +1,51 @@
+/*
+ * The Shadow Simulator
+ * See LICENSE for licensing information
+ */
+
+#include "main/utility/freelist.h"
+
+#include <pthread.h>
+
+#include "lib/logger/logger.h"
+
+static pthread_once_t _freelistKeyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t _freelistKey;
+
+/* The calling thread's registered lists, linked through `nextRegistered`. */
+static __thread FreeList* _freelistThreadLists = NULL;
+
+static void _freelist_freeThreadLists(void* lists) {
+    FreeList* list = lists;
+    while (list != NULL) {
+        void* block = NULL;
+        while ((block = freelist_pop(list)) != NULL) {
+            list->freeFunc(block);
+        }
+
+        FreeList* next = list->nextRegistered;
+        list->nextRegistered = NULL;
+        list->registered = false;
+        list = next;
+    }
+    _freelistThreadLists = NULL;
+}
+
+static void _freelist_createKey() {
+    if (pthread_key_create(&_freelistKey, _freelist_freeThreadLists) != 0) {
+        panic("Couldn't create the freelist thread-exit key");
+    }
+}
+
+void freelist_registerThreadExit(FreeList* list) {
+    pthread_once(&_freelistKeyOnce, _freelist_createKey);
+
+    list->nextRegistered = _freelistThreadLists;
+    list->registered = true;
+    _freelistThreadLists = list;
+
+    /* The key's destructor only runs for threads with a non-NULL value. */
+    if (pthread_setspecific(_freelistKey, _freelistThreadLists) != 0) {
+        panic("Couldn't register a freelist for thread exit");
+    }
+}
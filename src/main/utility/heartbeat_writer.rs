@@ -0,0 +1,162 @@
+//! Writes host heartbeat statistics as binary records, for
+//! `experimental.host_heartbeat_format: binary`.
+//!
+//! Each worker thread appends the records of the hosts it runs to its own file, so that workers
+//! never contend on a shared file or on the log. A file starts with an 8-byte magic string and a
+//! `u32` version, and is followed by records that each start with a 24-byte header (record kind,
+//! payload length, host id, and simulation time in nanoseconds). The payloads are fixed-size
+//! structs defined by the tracker in `tracker.c`. All integers are written in native (little)
+//! endian. `src/tools/convert-heartbeats.py` converts these files to CSV.
+
+use std::cell::RefCell;
+use std::fs::File;
+use std::io::{BufWriter, Write};
+
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+use shadow_shim_helper_rs::HostId;
+
+use crate::core::worker::Worker;
+
+pub const MAGIC: [u8; 8] = *b"SHADOWHB";
+pub const VERSION: u32 = 1;
+
+pub struct HeartbeatWriter<W: Write> {
+    writer: W,
+}
+
+impl<W: Write> HeartbeatWriter<W> {
+    pub fn new(mut writer: W) -> std::io::Result<Self> {
+        writer.write_all(&MAGIC)?;
+        writer.write_all(&VERSION.to_ne_bytes())?;
+        Ok(Self { writer })
+    }
+
+    pub fn write_record(
+        &mut self,
+        kind: u32,
+        host_id: HostId,
+        time: EmulatedTime,
+        payload: &[u8],
+    ) -> std::io::Result<()> {
+        let payload_len = u32::try_from(payload.len()).unwrap();
+        let time_ns = time
+            .duration_since(&EmulatedTime::SIMULATION_START)
+            .as_nanos() as u64;
+
+        self.writer.write_all(&kind.to_ne_bytes())?;
+        self.writer.write_all(&payload_len.to_ne_bytes())?;
+        self.writer.write_all(&u32::from(host_id).to_ne_bytes())?;
+        // reserved
+        self.writer.write_all(&0u32.to_ne_bytes())?;
+        self.writer.write_all(&time_ns.to_ne_bytes())?;
+        self.writer.write_all(payload)
+    }
+
+    pub fn flush(&mut self) -> std::io::Result<()> {
+        self.writer.flush()
+    }
+}
+
+std::thread_local! {
+    /// This worker thread's heartbeat file, opened on first use.
+    static THREAD_WRITER: RefCell<Option<HeartbeatWriter<BufWriter<File>>>> = const { RefCell::new(None) };
+}
+
+fn open_thread_writer() -> Option<HeartbeatWriter<BufWriter<File>>> {
+    let Some(path) = Worker::heartbeat_path() else {
+        log::warn!("Binary heartbeats are not enabled for this simulation");
+        return None;
+    };
+
+    let file = match File::create(&path) {
+        Ok(f) => f,
+        Err(e) => {
+            log::warn!(
+                "Could not create heartbeat file '{}': {}",
+                path.display(),
+                e
+            );
+            return None;
+        }
+    };
+
+    match HeartbeatWriter::new(BufWriter::new(file)) {
+        Ok(w) => Some(w),
+        Err(e) => {
+            log::warn!("Unable to write heartbeat file header: {}", e);
+            None
+        }
+    }
+}
+
+/// Flush this worker thread's heartbeat file, if it has one.
+pub fn flush_thread_writer() {
+    THREAD_WRITER.with(|writer| {
+        if let Some(writer) = writer.borrow_mut().as_mut() {
+            if let Err(e) = writer.flush() {
+                log::warn!("Unable to flush heartbeat output: {}", e);
+            }
+        }
+    });
+}
+
+mod export {
+    use super::*;
+    use crate::host::host::Host;
+
+    /// Append a heartbeat record for `host` at the current time to this worker thread's heartbeat
+    /// file. If there's an error, returns 1. Otherwise returns 0.
+    #[no_mangle]
+    pub unsafe extern "C-unwind" fn heartbeatwriter_writeRecord(
+        host: *const Host,
+        kind: u32,
+        payload: *const libc::c_void,
+        payload_len: usize,
+    ) -> libc::c_int {
+        let host = unsafe { host.as_ref() }.unwrap();
+        assert!(!payload.is_null());
+        let payload = unsafe { std::slice::from_raw_parts(payload.cast::<u8>(), payload_len) };
+        let now = Worker::current_time().unwrap();
+
+        THREAD_WRITER.with(|writer| {
+            let mut writer = writer.borrow_mut();
+            if writer.is_none() {
+                *writer = open_thread_writer();
+            }
+            let Some(writer) = writer.as_mut() else {
+                return 1;
+            };
+
+            if let Err(e) = writer.write_record(kind, host.id(), now, payload) {
+                log::warn!("Unable to write heartbeat record: {}", e);
+                return 1;
+            }
+
+            0
+        })
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use shadow_shim_helper_rs::simulation_time::SimulationTime;
+
+    use super::*;
+
+    #[test]
+    fn test_write_record() {
+        let mut buf = vec![];
+        let mut writer = HeartbeatWriter::new(&mut buf).unwrap();
+        let time = EmulatedTime::SIMULATION_START + SimulationTime::from_nanos(0x0102);
+        writer
+            .write_record(3, HostId::from(7), time, &[0xAA, 0xBB])
+            .unwrap();
+
+        let mut expected = b"SHADOWHB".to_vec();
+        expected.extend_from_slice(&[1, 0, 0, 0]);
+        expected.extend_from_slice(&[3, 0, 0, 0, 2, 0, 0, 0, 7, 0, 0, 0, 0, 0, 0, 0]);
+        expected.extend_from_slice(&[0x02, 0x01, 0, 0, 0, 0, 0, 0]);
+        expected.extend_from_slice(&[0xAA, 0xBB]);
+        assert_eq!(buf, expected);
+    }
+}
@@ -0,0 +1,254 @@
+/*
+ * The Shadow Simulator
+ * See LICENSE for licensing information
+ */
+
+/*!
+Histograms of durations with bounded relative error, in the style of HdrHistogram. Values are
+placed in log-linear buckets: each power of two is split into [`SUB_BUCKETS`] equally sized
+buckets, so a quantile read from the histogram is within about 1/16th (6%) of the recorded value,
+regardless of its magnitude. Recording is a few arithmetic operations and an array increment, and
+histograms from different threads can be merged by adding their buckets.
+*/
+
+use std::collections::BTreeMap;
+use std::time::Duration;
+
+use serde::Serialize;
+
+const SUB_BUCKET_BITS: u32 = 4;
+const SUB_BUCKETS: u64 = 1 << SUB_BUCKET_BITS;
+
+/// A histogram of nanosecond durations.
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub struct LatencyHistogram {
+    // Only as long as the highest non-empty bucket.
+    buckets: Vec<u64>,
+    count: u64,
+    total_ns: u64,
+    min_ns: u64,
+    max_ns: u64,
+}
+
+impl LatencyHistogram {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    fn bucket_index(value: u64) -> usize {
+        if value < SUB_BUCKETS {
+            return value as usize;
+        }
+        // position of the highest set bit, which is at least `SUB_BUCKET_BITS`
+        let exp = u64::BITS - 1 - value.leading_zeros();
+        let shift = exp - SUB_BUCKET_BITS;
+        let sub_bucket = (value >> shift) - SUB_BUCKETS;
+        ((shift as u64 + 1) * SUB_BUCKETS + sub_bucket) as usize
+    }
+
+    /// The largest value that is placed in the bucket at `index`.
+    fn bucket_upper_bound(index: usize) -> u64 {
+        let index = index as u64;
+        if index < SUB_BUCKETS {
+            return index;
+        }
+        let shift = index / SUB_BUCKETS - 1;
+        let sub_bucket = index % SUB_BUCKETS;
+        (((SUB_BUCKETS + sub_bucket + 1) as u128) << shift).saturating_sub(1) as u64
+    }
+
+    pub fn record(&mut self, duration: Duration) {
+        let value = u64::try_from(duration.as_nanos()).unwrap_or(u64::MAX);
+
+        let index = Self::bucket_index(value);
+        if index >= self.buckets.len() {
+            self.buckets.resize(index + 1, 0);
+        }
+        self.buckets[index] += 1;
+
+        if self.count == 0 || value < self.min_ns {
+            self.min_ns = value;
+        }
+        self.max_ns = self.max_ns.max(value);
+        self.count += 1;
+        self.total_ns = self.total_ns.saturating_add(value);
+    }
+
+    /// Add the values recorded in `other` to this histogram.
+    pub fn merge(&mut self, other: &Self) {
+        if other.count == 0 {
+            return;
+        }
+        if other.buckets.len() > self.buckets.len() {
+            self.buckets.resize(other.buckets.len(), 0);
+        }
+        for (x, y) in self.buckets.iter_mut().zip(&other.buckets) {
+            *x += y;
+        }
+
+        if self.count == 0 || other.min_ns < self.min_ns {
+            self.min_ns = other.min_ns;
+        }
+        self.max_ns = self.max_ns.max(other.max_ns);
+        self.count += other.count;
+        self.total_ns = self.total_ns.saturating_add(other.total_ns);
+    }
+
+    pub fn count(&self) -> u64 {
+        self.count
+    }
+
+    /// An upper bound of the smallest value that at least a fraction `quantile` of the recorded
+    /// values are lower than or equal to. Returns 0 if the histogram is empty.
+    pub fn value_at_quantile(&self, quantile: f64) -> u64 {
+        assert!((0.0..=1.0).contains(&quantile));
+        if self.count == 0 {
+            return 0;
+        }
+
+        let rank = ((quantile * self.count as f64).ceil() as u64).clamp(1, self.count);
+        let mut seen = 0;
+        for (index, count) in self.buckets.iter().enumerate() {
+            seen += count;
+            if seen >= rank {
+                return Self::bucket_upper_bound(index).clamp(self.min_ns, self.max_ns);
+            }
+        }
+        unreachable!()
+    }
+
+    pub fn summary(&self) -> LatencySummary {
+        LatencySummary {
+            count: self.count,
+            total_ns: self.total_ns,
+            mean_ns: self.total_ns.checked_div(self.count).unwrap_or(0),
+            min_ns: self.min_ns,
+            p50_ns: self.value_at_quantile(0.5),
+            p90_ns: self.value_at_quantile(0.9),
+            p99_ns: self.value_at_quantile(0.99),
+            p999_ns: self.value_at_quantile(0.999),
+            max_ns: self.max_ns,
+        }
+    }
+}
+
+/// Summary statistics of a [`LatencyHistogram`], in nanoseconds.
+#[derive(Serialize, Debug, Clone, Copy, PartialEq, Eq)]
+pub struct LatencySummary {
+    pub count: u64,
+    pub total_ns: u64,
+    pub mean_ns: u64,
+    pub min_ns: u64,
+    pub p50_ns: u64,
+    pub p90_ns: u64,
+    pub p99_ns: u64,
+    pub p999_ns: u64,
+    pub max_ns: u64,
+}
+
+/// Latency histograms keyed by name.
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub struct LatencyHistograms {
+    items: BTreeMap<String, LatencyHistogram>,
+}
+
+impl LatencyHistograms {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    pub fn record(&mut self, id: &str, duration: Duration) {
+        // avoid allocating a key for names we've already seen
+        if let Some(histogram) = self.items.get_mut(id) {
+            histogram.record(duration);
+        } else {
+            self.items
+                .entry(id.to_string())
+                .or_default()
+                .record(duration);
+        }
+    }
+
+    pub fn merge(&mut self, other: &Self) {
+        for (id, histogram) in &other.items {
+            self.items.entry(id.clone()).or_default().merge(histogram);
+        }
+    }
+
+    pub fn summaries(&self) -> BTreeMap<String, LatencySummary> {
+        self.items
+            .iter()
+            .map(|(id, histogram)| (id.clone(), histogram.summary()))
+            .collect()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_bucket_bounds() {
+        let mut prev_upper = None;
+        for index in 0..(60 * SUB_BUCKETS as usize) {
+            let upper = LatencyHistogram::bucket_upper_bound(index);
+            // buckets are contiguous and each value maps back to its bucket
+            let lower = prev_upper.map(|x: u64| x + 1).unwrap_or(0);
+            assert!(lower <= upper);
+            assert_eq!(LatencyHistogram::bucket_index(lower), index);
+            assert_eq!(LatencyHistogram::bucket_index(upper), index);
+            // relative bucket width is bounded
+            assert!((upper - lower) as f64 <= (lower as f64 / SUB_BUCKETS as f64).max(0.0));
+            prev_upper = Some(upper);
+        }
+        assert_eq!(
+            LatencyHistogram::bucket_upper_bound(LatencyHistogram::bucket_index(u64::MAX)),
+            u64::MAX
+        );
+    }
+
+    #[test]
+    fn test_quantiles() {
+        let mut histogram = LatencyHistogram::new();
+        assert_eq!(histogram.value_at_quantile(0.5), 0);
+
+        for ns in 1..=1000 {
+            histogram.record(Duration::from_nanos(ns));
+        }
+
+        assert_eq!(histogram.count(), 1000);
+        let summary = histogram.summary();
+        assert_eq!(summary.min_ns, 1);
+        assert_eq!(summary.max_ns, 1000);
+        assert_eq!(summary.mean_ns, 500);
+        for (quantile, value) in [(0.5, summary.p50_ns), (0.9, summary.p90_ns)] {
+            let exact = quantile * 1000.0;
+            assert!(value as f64 >= exact);
+            assert!(value as f64 <= exact * (1.0 + 1.0 / SUB_BUCKETS as f64));
+        }
+        assert_eq!(histogram.value_at_quantile(1.0), 1000);
+    }
+
+    #[test]
+    fn test_merge() {
+        let mut a = LatencyHistograms::new();
+        let mut b = LatencyHistograms::new();
+        let mut expected = LatencyHistograms::new();
+        for ns in [3, 50, 7000] {
+            a.record("read", Duration::from_nanos(ns));
+            expected.record("read", Duration::from_nanos(ns));
+        }
+        for ns in [1, 1_000_000] {
+            b.record("read", Duration::from_nanos(ns));
+            b.record("write", Duration::from_nanos(ns));
+            expected.record("read", Duration::from_nanos(ns));
+            expected.record("write", Duration::from_nanos(ns));
+        }
+
+        a.merge(&b);
+        assert_eq!(a, expected);
+        assert_eq!(a.summaries()["read"].count, 5);
+        assert_eq!(a.summaries()["read"].min_ns, 1);
+        assert_eq!(a.summaries()["write"].max_ns, 1_000_000);
+    }
+}
@@ -6,17 +6,23 @@ pub mod enum_passthrough;
 #[macro_use]
 pub mod macros;
 
+pub mod async_file_writer;
 pub mod byte_queue;
 pub mod callback_queue;
 pub mod childpid_watcher;
 pub mod counter;
+pub mod deferred_cleanup;
 pub mod give;
+pub mod heartbeat_writer;
+pub mod histogram;
 pub mod interval_map;
 pub mod legacy_callback_queue;
 pub mod once_set;
 pub mod pcap_writer;
+pub mod perf_counters;
 pub mod perf_timer;
 pub mod proc_maps;
+pub mod round_arena;
 pub mod shm_cleanup;
 pub mod sockaddr;
 pub mod status_bar;
@@ -38,6 +44,7 @@ use shadow_shim_helper_rs::HostId;
 
 use crate::core::worker::Worker;
 use crate::host::host::Host;
+use crate::utility::counter::Counter;
 
 /// A pointer to an object that is safe to dereference from any thread,
 /// *if* the Host lock for the specified host is held.
@@ -194,29 +201,171 @@ impl<T> Clone for Magic<T> {
     }
 }
 
+/// The types of objects whose allocations and deallocations are counted. Counts are stored in
+/// an array indexed by the type, so counting an object doesn't need to hash its name. From C, use
+/// the `worker_count_allocation` and `worker_count_deallocation` macros with the C name of the
+/// variant without its `OBJECT_TYPE_` prefix (for example `worker_count_allocation(PAYLOAD)`).
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+#[repr(C)]
+pub enum ObjectType {
+    // objects implemented in C
+    Epoll,
+    EpollWatch,
+    Futex,
+    LegacyDescriptor,
+    NetworkInterface,
+    Packet,
+    Payload,
+    RegularFile,
+    StatusListener,
+    SysCallCondition,
+    Tcp,
+    // objects implemented in rust
+    Descriptor,
+    DescriptorTable,
+    Event,
+    FutexTable,
+    LegacyTcpSocket,
+    OpenFile,
+    OpenFileInner,
+    Relay,
+    Router,
+    TaskRef,
+    TcpSocket,
+    Thread,
+    TimeoutWheel,
+    Timer,
+    UdpSocket,
+}
+
+impl ObjectType {
+    /// All object types, in order of their index.
+    pub const ALL: [Self; 26] = [
+        Self::Epoll,
+        Self::EpollWatch,
+        Self::Futex,
+        Self::LegacyDescriptor,
+        Self::NetworkInterface,
+        Self::Packet,
+        Self::Payload,
+        Self::RegularFile,
+        Self::StatusListener,
+        Self::SysCallCondition,
+        Self::Tcp,
+        Self::Descriptor,
+        Self::DescriptorTable,
+        Self::Event,
+        Self::FutexTable,
+        Self::LegacyTcpSocket,
+        Self::OpenFile,
+        Self::OpenFileInner,
+        Self::Relay,
+        Self::Router,
+        Self::TaskRef,
+        Self::TcpSocket,
+        Self::Thread,
+        Self::TimeoutWheel,
+        Self::Timer,
+        Self::UdpSocket,
+    ];
+
+    /// The name used for this type in the object counts that we log and write to
+    /// "sim-stats.json".
+    pub const fn name(self) -> &'static str {
+        match self {
+            Self::Epoll => "Epoll",
+            Self::EpollWatch => "EpollWatch",
+            Self::Futex => "Futex",
+            Self::LegacyDescriptor => "LegacyDescriptor",
+            Self::NetworkInterface => "NetworkInterface",
+            Self::Packet => "Packet",
+            Self::Payload => "Payload",
+            Self::RegularFile => "RegularFile",
+            Self::StatusListener => "StatusListener",
+            Self::SysCallCondition => "SysCallCondition",
+            Self::Tcp => "TCP",
+            Self::Descriptor => "Descriptor",
+            Self::DescriptorTable => "DescriptorTable",
+            Self::Event => "Event",
+            Self::FutexTable => "FutexTable",
+            Self::LegacyTcpSocket => "LegacyTcpSocket",
+            Self::OpenFile => "OpenFile",
+            Self::OpenFileInner => "OpenFileInner",
+            Self::Relay => "Relay",
+            Self::Router => "Router",
+            Self::TaskRef => "TaskRef",
+            Self::TcpSocket => "TcpSocket",
+            Self::Thread => "Thread",
+            Self::TimeoutWheel => "TimeoutWheel",
+            Self::Timer => "Timer",
+            Self::UdpSocket => "UdpSocket",
+        }
+    }
+}
+
+/// The number of allocations or deallocations of each type of object.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct ObjectCounts([u64; ObjectType::ALL.len()]);
+
+impl ObjectCounts {
+    pub const fn new() -> Self {
+        Self([0; ObjectType::ALL.len()])
+    }
+
+    pub fn add_one(&mut self, object_type: ObjectType) {
+        let count = &mut self.0[object_type as usize];
+        *count = count.saturating_add(1);
+    }
+
+    pub fn add_counts(&mut self, other: &Self) {
+        for (count, other) in self.0.iter_mut().zip(other.0.iter()) {
+            *count = count.saturating_add(*other);
+        }
+    }
+
+    /// Returns the counts keyed by the object names, leaving out types with no count.
+    pub fn to_counter(&self) -> Counter {
+        let mut counter = Counter::new();
+        for (object_type, count) in ObjectType::ALL.iter().zip(self.0.iter()) {
+            if *count > 0 {
+                counter.add_value(object_type.name(), (*count).try_into().unwrap());
+            }
+        }
+        counter
+    }
+}
+
+impl Default for ObjectCounts {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
 /// Helper for tracking the number of allocated objects.
 #[derive(Debug)]
 pub struct ObjectCounter {
-    name: &'static str,
+    object_type: ObjectType,
 }
 
 impl ObjectCounter {
-    pub fn new(name: &'static str) -> Self {
-        Worker::increment_object_alloc_counter(name);
-        Self { name }
+    pub fn new(object_type: ObjectType) -> Self {
+        Worker::increment_object_alloc_counter(object_type);
+        Self { object_type }
     }
 }
 
 impl Drop for ObjectCounter {
     fn drop(&mut self) {
-        Worker::increment_object_dealloc_counter(self.name);
+        Worker::increment_object_dealloc_counter(self.object_type);
     }
 }
 
 impl Clone for ObjectCounter {
     fn clone(&self) -> Self {
-        Worker::increment_object_alloc_counter(self.name);
-        Self { name: self.name }
+        Worker::increment_object_alloc_counter(self.object_type);
+        Self {
+            object_type: self.object_type,
+        }
     }
 }
 
@@ -600,6 +749,27 @@ pub fn debug_assert_cloexec(file: &(impl std::os::fd::AsRawFd + std::fmt::Debug)
 mod tests {
     use super::*;
 
+    #[test]
+    fn test_object_types() {
+        for (i, object_type) in ObjectType::ALL.iter().enumerate() {
+            assert_eq!(*object_type as usize, i);
+        }
+
+        let mut counts = ObjectCounts::new();
+        counts.add_one(ObjectType::Tcp);
+        counts.add_one(ObjectType::Tcp);
+        counts.add_one(ObjectType::Payload);
+
+        let mut other = ObjectCounts::new();
+        other.add_one(ObjectType::Payload);
+        counts.add_counts(&other);
+
+        let counter = counts.to_counter();
+        assert_eq!(counter.get_value("TCP"), 2);
+        assert_eq!(counter.get_value("Payload"), 2);
+        assert_eq!(counter.to_string(), "{Payload:2, TCP:2}");
+    }
+
     #[test]
     fn test_tilde_expansion() {
         if let Ok(ref home) = std::env::var("HOME") {
@@ -1,11 +1,174 @@
-use std::io::{Seek, SeekFrom, Write};
+use std::collections::HashMap;
+use std::fs::File;
+use std::io::{Cursor, Seek, SeekFrom, Write};
+use std::path::Path;
+use std::sync::mpsc::{Receiver, Sender, SyncSender};
+use std::sync::{Arc, Mutex, OnceLock};
+
+use once_cell::sync::Lazy;
 
 use crate::cshadow as c;
 use crate::utility::give::Give;
 
+/// Buffered packet data is handed off to the I/O thread in chunks of about this many bytes.
+const HAND_OFF_THRESHOLD: usize = 256 * 1024;
+
+/// Channel used to send commands to the pcap I/O thread. The thread is started the first time a
+/// [`BackgroundFileWriter`] is created.
+///
+/// The Sender half of a channel isn't Sync, so we must protect it with a Mutex. This is only
+/// locked once per file, to clone a sender for the writer.
+static IO_THREAD_SENDER: Lazy<Mutex<Sender<IoCommand>>> = Lazy::new(|| {
+    let (sender, receiver) = std::sync::mpsc::channel();
+
+    std::thread::Builder::new()
+        .name("shadow-pcap".to_string())
+        .spawn(move || io_thread_fn(receiver))
+        .unwrap();
+
+    Mutex::new(sender)
+});
+
+enum IoCommand {
+    /// Append the data to the file.
+    Write(Arc<File>, Vec<u8>),
+    /// Notify the sender once all previous commands have been processed.
+    Sync(SyncSender<()>),
+}
+
+fn io_thread_fn(receiver: Receiver<IoCommand>) {
+    for command in receiver {
+        match command {
+            IoCommand::Write(file, data) => {
+                if let Err(e) = (&*file).write_all(&data) {
+                    log::warn!("Unable to write packets to pcap output: {e}");
+                }
+            }
+            IoCommand::Sync(done) => {
+                // the writer may have given up waiting
+                done.send(()).ok();
+            }
+        }
+    }
+}
+
+/// A writer that buffers data in memory and writes it to a file from a background I/O thread,
+/// so that the caller only pays for copying the data into the buffer. Seeking is only possible
+/// within the data that hasn't been handed off to the I/O thread yet (see
+/// [`hand_off_if_full`](Self::hand_off_if_full)).
+///
+/// Errors while writing to the file are logged by the I/O thread rather than returned.
+pub struct BackgroundFileWriter {
+    file: Arc<File>,
+    buffer: Cursor<Vec<u8>>,
+    /// The number of bytes previously handed off to the I/O thread.
+    handed_off: u64,
+    sender: Sender<IoCommand>,
+}
+
+impl BackgroundFileWriter {
+    pub fn new(file: File) -> Self {
+        Self::new_shared(Arc::new(file))
+    }
+
+    /// A writer for a file that other writers also append to. Each hand-off is appended to the
+    /// file in one piece, so data written between two hand-offs is never interleaved with data
+    /// from other writers.
+    fn new_shared(file: Arc<File>) -> Self {
+        Self {
+            file,
+            buffer: Cursor::new(Vec::with_capacity(HAND_OFF_THRESHOLD)),
+            handed_off: 0,
+            sender: IO_THREAD_SENDER.lock().unwrap().clone(),
+        }
+    }
+
+    /// Hand off the buffered data to the I/O thread if there's enough of it. Positions before
+    /// the current position can't be seeked to afterwards.
+    pub fn hand_off_if_full(&mut self) {
+        if self.buffer.get_ref().len() >= HAND_OFF_THRESHOLD {
+            self.hand_off();
+        }
+    }
+
+    fn hand_off(&mut self) {
+        if self.buffer.get_ref().is_empty() {
+            return;
+        }
+
+        let data = std::mem::replace(
+            self.buffer.get_mut(),
+            Vec::with_capacity(HAND_OFF_THRESHOLD),
+        );
+        self.buffer.set_position(0);
+        self.handed_off += u64::try_from(data.len()).unwrap();
+
+        self.sender
+            .send(IoCommand::Write(Arc::clone(&self.file), data))
+            .expect("The pcap I/O thread has stopped");
+    }
+}
+
+impl Write for BackgroundFileWriter {
+    fn write(&mut self, buf: &[u8]) -> std::io::Result<usize> {
+        self.buffer.write(buf)
+    }
+
+    /// Hand off all buffered data and wait for the I/O thread to write it.
+    fn flush(&mut self) -> std::io::Result<()> {
+        self.hand_off();
+
+        let (done_sender, done_receiver) = std::sync::mpsc::sync_channel(1);
+        self.sender
+            .send(IoCommand::Sync(done_sender))
+            .expect("The pcap I/O thread has stopped");
+        done_receiver
+            .recv()
+            .expect("The pcap I/O thread has stopped");
+
+        Ok(())
+    }
+}
+
+impl Seek for BackgroundFileWriter {
+    fn seek(&mut self, pos: SeekFrom) -> std::io::Result<u64> {
+        let pos = match pos {
+            SeekFrom::Start(x) => SeekFrom::Start(
+                x.checked_sub(self.handed_off)
+                    .ok_or(std::io::ErrorKind::Unsupported)?,
+            ),
+            // the buffer always ends at the end of the file
+            x @ (SeekFrom::End(_) | SeekFrom::Current(_)) => x,
+        };
+
+        Ok(self.buffer.seek(pos)? + self.handed_off)
+    }
+}
+
+impl Drop for BackgroundFileWriter {
+    fn drop(&mut self) {
+        // make sure the file is complete before it's closed, for example before shadow exits
+        self.flush().ok();
+    }
+}
+
+/// Data link type (LINKTYPE_RAW).
+const LINK_TYPE: u16 = 101;
+
+/// The format of the packets written by a [`PcapWriter`].
+#[derive(Debug, Copy, Clone)]
+enum Format {
+    /// A pcap file, which only has the packets of a single interface.
+    Pcap,
+    /// Enhanced packet blocks for one of the interfaces of a pcapng file. The file's section
+    /// header and interface description blocks are written by [`MergedPcapFile`].
+    PcapNg { interface_id: u32 },
+}
+
 pub struct PcapWriter<W: Write> {
     writer: W,
     capture_len: u32,
+    format: Format,
 }
 
 impl<W: Write> PcapWriter<W> {
@@ -15,6 +178,7 @@ impl<W: Write> PcapWriter<W> {
         let mut rv = PcapWriter {
             writer,
             capture_len,
+            format: Format::Pcap,
         };
 
         rv.write_header()?;
@@ -22,6 +186,11 @@ impl<W: Write> PcapWriter<W> {
         Ok(rv)
     }
 
+    /// Get a mutable reference to the underlying writer.
+    pub fn get_mut(&mut self) -> &mut W {
+        &mut self.writer
+    }
+
     fn write_header(&mut self) -> std::io::Result<()> {
         // magic number to show endianness
         const MAGIC_NUMBER: u32 = 0xA1B2C3D4;
@@ -31,8 +200,8 @@ impl<W: Write> PcapWriter<W> {
         const THIS_ZONE: i32 = 0;
         // accuracy of timestamps
         const SIG_FLAGS: u32 = 0;
-        // data link type (LINKTYPE_RAW)
-        const NETWORK: u32 = 101;
+        // data link type
+        const NETWORK: u32 = LINK_TYPE as u32;
 
         // magic number: 4 bytes
         self.writer.write_all(&MAGIC_NUMBER.to_ne_bytes())?;
@@ -63,6 +232,29 @@ impl<W: Write> PcapWriter<W> {
         let packet_len = u32::try_from(packet.len()).unwrap();
         let packet_trunc_len = std::cmp::min(packet_len, self.capture_len);
 
+        if let Format::PcapNg { interface_id } = self.format {
+            let padding = pcapng_padding(packet_trunc_len);
+            let block_len = EPB_FIXED_LEN + packet_trunc_len + padding;
+
+            write_epb_header(
+                &mut self.writer,
+                block_len,
+                interface_id,
+                ts_sec,
+                ts_usec,
+                packet_trunc_len,
+                packet_len,
+            )?;
+            self.writer
+                .write_all(&packet[..(packet_trunc_len.try_into().unwrap())])?;
+            self.writer
+                .write_all(&[0; 3][..(padding.try_into().unwrap())])?;
+            // block total length: 4 bytes
+            self.writer.write_all(&block_len.to_ne_bytes())?;
+
+            return Ok(());
+        }
+
         // timestamp (seconds): 4 bytes
         self.writer.write_all(&ts_sec.to_ne_bytes())?;
         // timestamp (microseconds): 4 bytes
@@ -90,6 +282,10 @@ impl<W: Write + Seek> PcapWriter<W> {
         packet_len: u32,
         write_packet_fn: impl FnOnce(&mut Give<&mut W>) -> std::io::Result<()>,
     ) -> std::io::Result<()> {
+        if let Format::PcapNg { interface_id } = self.format {
+            return self.write_epb_fmt(interface_id, ts_sec, ts_usec, packet_len, write_packet_fn);
+        }
+
         // timestamp (seconds): 4 bytes
         self.writer.write_all(&ts_sec.to_ne_bytes())?;
         // timestamp (microseconds): 4 bytes
@@ -140,17 +336,246 @@ impl<W: Write + Seek> PcapWriter<W> {
 
         Ok(())
     }
+
+    /// Like [`Self::write_packet_fmt`], but writes a pcapng enhanced packet block.
+    fn write_epb_fmt(
+        &mut self,
+        interface_id: u32,
+        ts_sec: u32,
+        ts_usec: u32,
+        packet_len: u32,
+        write_packet_fn: impl FnOnce(&mut Give<&mut W>) -> std::io::Result<()>,
+    ) -> std::io::Result<()> {
+        // position of the block
+        let pos_of_block = self.writer.stream_position()?;
+
+        // the block and captured packet lengths are written initially as 0, and we'll update them
+        // later
+        write_epb_header(
+            &mut self.writer,
+            0,
+            interface_id,
+            ts_sec,
+            ts_usec,
+            0,
+            packet_len,
+        )?;
+
+        // position of the packet data
+        let pos_before_packet_data = self.writer.stream_position()?;
+
+        // packet data: a soft limit of `capture_len` bytes
+        match write_packet_fn(&mut Give::new(&mut self.writer, self.capture_len as u64)) {
+            Ok(()) => {}
+            // see `write_packet_fmt`
+            Err(e) if e.kind() == std::io::ErrorKind::WriteZero => {}
+            Err(e) => return Err(e),
+        }
+
+        // the number of packet data bytes written
+        let bytes_written = self.writer.stream_position()? - pos_before_packet_data;
+
+        if bytes_written > self.capture_len.into() {
+            log::warn!(
+                "Pcap writer wrote more bytes than intended: {bytes_written} > {}",
+                self.capture_len
+            );
+            return Err(std::io::ErrorKind::InvalidData.into());
+        }
+
+        let bytes_written = u32::try_from(bytes_written).unwrap();
+        let padding = pcapng_padding(bytes_written);
+        let block_len = EPB_FIXED_LEN + bytes_written + padding;
+
+        // padding to 32 bits
+        self.writer
+            .write_all(&[0; 3][..(padding.try_into().unwrap())])?;
+        // block total length: 4 bytes
+        self.writer.write_all(&block_len.to_ne_bytes())?;
+        let pos_after_block = self.writer.stream_position()?;
+
+        // go back and update the block total length
+        self.writer.seek(SeekFrom::Start(pos_of_block + 4))?;
+        self.writer.write_all(&block_len.to_ne_bytes())?;
+        // and the captured packet length
+        self.writer.seek(SeekFrom::Start(pos_of_block + 20))?;
+        self.writer.write_all(&bytes_written.to_ne_bytes())?;
+        self.writer.seek(SeekFrom::Start(pos_after_block))?;
+
+        Ok(())
+    }
+}
+
+/// The length of a pcapng enhanced packet block without its packet data and padding.
+const EPB_FIXED_LEN: u32 = 32;
+
+/// The number of bytes to pad `len` bytes of pcapng block data to a multiple of 32 bits.
+fn pcapng_padding(len: u32) -> u32 {
+    len.next_multiple_of(4) - len
+}
+
+/// Write the fields of a pcapng enhanced packet block that come before the packet data. Timestamps
+/// use the default resolution of microseconds.
+fn write_epb_header(
+    writer: &mut impl Write,
+    block_len: u32,
+    interface_id: u32,
+    ts_sec: u32,
+    ts_usec: u32,
+    captured_len: u32,
+    packet_len: u32,
+) -> std::io::Result<()> {
+    const BLOCK_TYPE: u32 = 0x00000006;
+
+    let ts = u64::from(ts_sec) * 1_000_000 + u64::from(ts_usec);
+
+    // block type: 4 bytes
+    writer.write_all(&BLOCK_TYPE.to_ne_bytes())?;
+    // block total length: 4 bytes
+    writer.write_all(&block_len.to_ne_bytes())?;
+    // interface id: 4 bytes
+    writer.write_all(&interface_id.to_ne_bytes())?;
+    // timestamp (upper 32 bits): 4 bytes
+    writer.write_all(&((ts >> 32) as u32).to_ne_bytes())?;
+    // timestamp (lower 32 bits): 4 bytes
+    writer.write_all(&(ts as u32).to_ne_bytes())?;
+    // captured packet length: 4 bytes
+    writer.write_all(&captured_len.to_ne_bytes())?;
+    // original packet length: 4 bytes
+    writer.write_all(&packet_len.to_ne_bytes())?;
+
+    Ok(())
+}
+
+/// Write a pcapng section header block, which starts the file.
+fn write_shb(writer: &mut impl Write) -> std::io::Result<()> {
+    const BLOCK_TYPE: u32 = 0x0A0D0D0A;
+    const BLOCK_LEN: u32 = 28;
+    // magic number to show endianness
+    const BYTE_ORDER_MAGIC: u32 = 0x1A2B3C4D;
+    const VERSION_MAJOR: u16 = 1;
+    const VERSION_MINOR: u16 = 0;
+    // the section length isn't specified
+    const SECTION_LEN: i64 = -1;
+
+    writer.write_all(&BLOCK_TYPE.to_ne_bytes())?;
+    writer.write_all(&BLOCK_LEN.to_ne_bytes())?;
+    writer.write_all(&BYTE_ORDER_MAGIC.to_ne_bytes())?;
+    writer.write_all(&VERSION_MAJOR.to_ne_bytes())?;
+    writer.write_all(&VERSION_MINOR.to_ne_bytes())?;
+    writer.write_all(&SECTION_LEN.to_ne_bytes())?;
+    writer.write_all(&BLOCK_LEN.to_ne_bytes())?;
+
+    Ok(())
+}
+
+/// Write a pcapng interface description block, with the interface's name as its only option.
+fn write_idb(writer: &mut impl Write, name: &str, capture_len: u32) -> std::io::Result<()> {
+    const BLOCK_TYPE: u32 = 0x00000001;
+    const OPT_ENDOFOPT: u16 = 0;
+    const OPT_IF_NAME: u16 = 2;
+
+    let name_len = u32::try_from(name.len()).unwrap();
+    let padding = pcapng_padding(name_len);
+    // the fixed fields, the name option with its padding, and the end of the options
+    let block_len = 20 + (4 + name_len + padding) + 4;
+
+    // block type: 4 bytes
+    writer.write_all(&BLOCK_TYPE.to_ne_bytes())?;
+    // block total length: 4 bytes
+    writer.write_all(&block_len.to_ne_bytes())?;
+    // link type: 2 bytes
+    writer.write_all(&LINK_TYPE.to_ne_bytes())?;
+    // reserved: 2 bytes
+    writer.write_all(&0u16.to_ne_bytes())?;
+    // snapshot length: 4 bytes
+    writer.write_all(&capture_len.to_ne_bytes())?;
+
+    // name option: 4 bytes, and the padded name
+    writer.write_all(&OPT_IF_NAME.to_ne_bytes())?;
+    writer.write_all(&u16::try_from(name_len).unwrap().to_ne_bytes())?;
+    writer.write_all(name.as_bytes())?;
+    writer.write_all(&[0; 3][..(padding.try_into().unwrap())])?;
+    // end of options: 4 bytes
+    writer.write_all(&OPT_ENDOFOPT.to_ne_bytes())?;
+    writer.write_all(&0u16.to_ne_bytes())?;
+
+    // block total length: 4 bytes
+    writer.write_all(&block_len.to_ne_bytes())?;
+
+    Ok(())
+}
+
+/// A single pcapng file for the interfaces of all hosts, so that capturing packets for many hosts
+/// doesn't need a file for each of their interfaces. The section header and the description of
+/// every interface are written when the file is created, in order, so the interface ids don't
+/// depend on the order that the hosts are built in. Each interface then appends its packets
+/// through its own [`BackgroundFileWriter`], so the packets of different interfaces are
+/// interleaved in chunks and aren't in timestamp order.
+pub struct MergedPcapFile {
+    file: Arc<File>,
+    /// The id and capture length of each interface, by name.
+    interfaces: HashMap<String, (u32, u32)>,
+}
+
+impl MergedPcapFile {
+    /// Create the file at `path` for the named interfaces, each with a capture length.
+    pub fn create(
+        path: &Path,
+        interfaces: impl IntoIterator<Item = (String, u32)>,
+    ) -> std::io::Result<Self> {
+        let mut header = Vec::new();
+        write_shb(&mut header)?;
+
+        let mut ids = HashMap::new();
+        for (name, capture_len) in interfaces {
+            let id = u32::try_from(ids.len()).unwrap();
+            write_idb(&mut header, &name, capture_len)?;
+            assert!(ids.insert(name, (id, capture_len)).is_none());
+        }
+
+        let mut file = File::create(path)?;
+        file.write_all(&header)?;
+
+        Ok(Self {
+            file: Arc::new(file),
+            interfaces: ids,
+        })
+    }
+
+    /// A writer for the packets of the interface `name`, or `None` if the file has no such
+    /// interface.
+    pub fn writer(&self, name: &str) -> Option<PcapWriter<BackgroundFileWriter>> {
+        let (interface_id, capture_len) = *self.interfaces.get(name)?;
+        Some(PcapWriter {
+            writer: BackgroundFileWriter::new_shared(Arc::clone(&self.file)),
+            capture_len,
+            format: Format::PcapNg { interface_id },
+        })
+    }
+}
+
+/// The merged pcapng file of this simulation, if enabled. See [`set_merged_pcap_file`].
+static MERGED_PCAP_FILE: OnceLock<MergedPcapFile> = OnceLock::new();
+
+/// Set the file that network interfaces created with `pcapwriter_newMerged` write to. Must be
+/// called before the hosts are built, and only once.
+pub fn set_merged_pcap_file(file: MergedPcapFile) {
+    if MERGED_PCAP_FILE.set(file).is_err() {
+        panic!("The merged pcap file was already set");
+    }
 }
 
 pub trait PacketDisplay {
     /// Write the packet bytes.
     fn display_bytes(&self, writer: impl Write) -> std::io::Result<()>;
+
+    /// Write the packet's IP and transport headers, without the payload.
+    fn display_header_bytes(&self, writer: impl Write) -> std::io::Result<()>;
 }
 
 mod export {
     use std::ffi::{CStr, OsStr};
-    use std::fs::File;
-    use std::io::BufWriter;
     use std::os::unix::ffi::OsStrExt;
 
     use super::*;
@@ -161,7 +586,7 @@ mod export {
     pub extern "C-unwind" fn pcapwriter_new(
         path: *const libc::c_char,
         capture_len: u32,
-    ) -> *mut PcapWriter<BufWriter<File>> {
+    ) -> *mut PcapWriter<BackgroundFileWriter> {
         assert!(!path.is_null());
         let path = OsStr::from_bytes(unsafe { CStr::from_ptr(path) }.to_bytes());
 
@@ -172,12 +597,30 @@ mod export {
                 return std::ptr::null_mut();
             }
         };
-        let file = BufWriter::new(file);
+        let file = BackgroundFileWriter::new(file);
         Box::into_raw(Box::new(PcapWriter::new(file, capture_len).unwrap()))
     }
 
+    /// A new packet capture writer for the interface `name` (of the form "hostname:interface") in
+    /// the merged pcapng file. The capture length is the one that the file was created with. See
+    /// [`set_merged_pcap_file`].
+    #[no_mangle]
+    pub extern "C-unwind" fn pcapwriter_newMerged(
+        name: *const libc::c_char,
+    ) -> *mut PcapWriter<BackgroundFileWriter> {
+        assert!(!name.is_null());
+        let name = unsafe { CStr::from_ptr(name) }.to_str().unwrap();
+
+        let writer = MERGED_PCAP_FILE.get().and_then(|file| file.writer(name));
+        let Some(writer) = writer else {
+            log::warn!("Interface '{name}' is not in the merged pcap file");
+            return std::ptr::null_mut();
+        };
+        Box::into_raw(Box::new(writer))
+    }
+
     #[no_mangle]
-    pub extern "C-unwind" fn pcapwriter_free(pcap: *mut PcapWriter<BufWriter<File>>) {
+    pub extern "C-unwind" fn pcapwriter_free(pcap: *mut PcapWriter<BackgroundFileWriter>) {
         if pcap.is_null() {
             return;
         }
@@ -188,7 +631,7 @@ mod export {
     /// likely to be corrupt.
     #[no_mangle]
     pub extern "C-unwind" fn pcapwriter_writePacket(
-        pcap: *mut PcapWriter<BufWriter<File>>,
+        pcap: *mut PcapWriter<BackgroundFileWriter>,
         ts_sec: u32,
         ts_usec: u32,
         packet: *const c::Packet,
@@ -207,13 +650,45 @@ mod export {
             return 1;
         }
 
+        // only hand off complete packets, since writing a packet seeks within it
+        pcap.get_mut().hand_off_if_full();
+
+        0
+    }
+
+    /// Like [`pcapwriter_writePacket`], but only writes the packet's headers. The packet's
+    /// payload isn't read, but the original packet length still includes it.
+    #[no_mangle]
+    pub extern "C-unwind" fn pcapwriter_writePacketHeaders(
+        pcap: *mut PcapWriter<BackgroundFileWriter>,
+        ts_sec: u32,
+        ts_usec: u32,
+        packet: *const c::Packet,
+    ) -> libc::c_int {
+        assert!(!pcap.is_null());
+        assert!(!packet.is_null());
+
+        let pcap = unsafe { pcap.as_mut() }.unwrap();
+
+        let packet_len: u32 = u32::try_from(unsafe { c::packet_getTotalSize(packet) }).unwrap();
+
+        if let Err(e) = pcap.write_packet_fmt(ts_sec, ts_usec, packet_len, |writer| {
+            packet.display_header_bytes(writer)
+        }) {
+            log::warn!("Unable to write packet to pcap output: {}", e);
+            return 1;
+        }
+
+        // only hand off complete packets, since writing a packet seeks within it
+        pcap.get_mut().hand_off_if_full();
+
         0
     }
 }
 
 #[cfg(test)]
 mod tests {
-    use std::io::Cursor;
+    use std::io::Read;
 
     use super::*;
 
@@ -290,4 +765,86 @@ mod tests {
             .concat()
         );
     }
+
+    #[test]
+    fn test_pcapng() {
+        let dir = tempfile::tempdir().unwrap();
+        let path = dir.path().join("packets.pcapng");
+
+        let merged = MergedPcapFile::create(
+            &path,
+            [("host:lo".to_string(), 65535), ("host:eth0".to_string(), 2)],
+        )
+        .unwrap();
+        assert!(merged.writer("other:eth0").is_none());
+
+        let mut pcap = merged.writer("host:eth0").unwrap();
+        pcap.write_packet_fmt(1, 2, 3, |writer| writer.write_all(&[0x01, 0x02, 0x03]))
+            .unwrap();
+        drop(pcap);
+
+        let expected_shb = [
+            0x0A, 0x0D, 0x0D, 0x0A, 0x1C, 0x00, 0x00, 0x00, 0x4D, 0x3C, 0x2B, 0x1A, 0x01, 0x00,
+            0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x1C, 0x00, 0x00, 0x00,
+        ];
+        let expected_idb_lo = [
+            0x01, 0x00, 0x00, 0x00, 0x24, 0x00, 0x00, 0x00, 0x65, 0x00, 0x00, 0x00, 0xFF, 0xFF,
+            0x00, 0x00, 0x02, 0x00, 0x07, 0x00, b'h', b'o', b's', b't', b':', b'l', b'o', 0x00,
+            0x00, 0x00, 0x00, 0x00, 0x24, 0x00, 0x00, 0x00,
+        ];
+        let expected_idb_eth0 = [
+            0x01, 0x00, 0x00, 0x00, 0x28, 0x00, 0x00, 0x00, 0x65, 0x00, 0x00, 0x00, 0x02, 0x00,
+            0x00, 0x00, 0x02, 0x00, 0x09, 0x00, b'h', b'o', b's', b't', b':', b'e', b't', b'h',
+            b'0', 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x28, 0x00, 0x00, 0x00,
+        ];
+        // interface 1, 1000002 us, truncated to 2 bytes (and padded to 4 bytes)
+        let expected_epb = [
+            0x06, 0x00, 0x00, 0x00, 0x24, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x42, 0x42, 0x0F, 0x00, 0x02, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00,
+            0x01, 0x02, 0x00, 0x00, 0x24, 0x00, 0x00, 0x00,
+        ];
+
+        assert_eq!(
+            std::fs::read(&path).unwrap(),
+            [
+                &expected_shb[..],
+                &expected_idb_lo[..],
+                &expected_idb_eth0[..],
+                &expected_epb[..],
+            ]
+            .concat()
+        );
+    }
+
+    #[test]
+    fn test_background_file_writer() {
+        let file = tempfile::tempfile().unwrap();
+        let mut reader = file.try_clone().unwrap();
+
+        let mut expected = Cursor::new(vec![]);
+        let mut expected_pcap = PcapWriter::new(&mut expected, 100).unwrap();
+        let mut pcap = PcapWriter::new(BackgroundFileWriter::new(file), 100).unwrap();
+
+        // enough packets that the data is handed off to the I/O thread several times, and
+        // truncated by the capture length
+        for i in 0..(4 * HAND_OFF_THRESHOLD / 100) {
+            let payload = [i as u8; 150];
+
+            expected_pcap
+                .write_packet_fmt(i as u32, 0, 150, |w| w.write_all(&payload))
+                .unwrap();
+            pcap.write_packet_fmt(i as u32, 0, 150, |w| w.write_all(&payload))
+                .unwrap();
+            pcap.get_mut().hand_off_if_full();
+        }
+
+        // dropping the writer waits for the I/O thread
+        drop(pcap);
+
+        let mut buf = vec![];
+        reader.seek(SeekFrom::Start(0)).unwrap();
+        reader.read_to_end(&mut buf).unwrap();
+
+        assert_eq!(buf, expected.into_inner());
+    }
 }
@@ -0,0 +1,247 @@
+//! Performance counters for the current thread, using `perf_event_open`.
+//!
+//! The counters only count events of the thread that opened them, so a worker's counters include
+//! Shadow's own work for a host (handling syscalls, the network stack, etc) but not the time spent
+//! running the host's managed processes.
+
+use std::os::fd::{AsRawFd, FromRawFd, OwnedFd};
+
+use crate::utility::counter::Counter;
+
+// from linux/perf_event.h
+const PERF_TYPE_HARDWARE: u32 = 0;
+const PERF_TYPE_SOFTWARE: u32 = 1;
+const PERF_COUNT_HW_CPU_CYCLES: u64 = 0;
+const PERF_COUNT_HW_INSTRUCTIONS: u64 = 1;
+const PERF_COUNT_HW_CACHE_MISSES: u64 = 3;
+const PERF_COUNT_SW_CONTEXT_SWITCHES: u64 = 3;
+const PERF_FORMAT_GROUP: u64 = 1 << 3;
+const PERF_FLAG_FD_CLOEXEC: libc::c_ulong = 1 << 3;
+const PERF_ATTR_FLAG_EXCLUDE_KERNEL: u64 = 1 << 5;
+const PERF_ATTR_FLAG_EXCLUDE_HV: u64 = 1 << 6;
+
+/// The first version (`PERF_ATTR_SIZE_VER0`) of `struct perf_event_attr`, which every kernel
+/// accepts. The bitfield flags are stored in `flags`.
+#[repr(C)]
+#[derive(Default)]
+struct PerfEventAttr {
+    type_: u32,
+    size: u32,
+    config: u64,
+    sample_period: u64,
+    sample_type: u64,
+    read_format: u64,
+    flags: u64,
+    wakeup_events: u32,
+    bp_type: u32,
+    config1: u64,
+}
+
+static_assertions::assert_eq_size!(PerfEventAttr, [u8; 64]);
+
+/// The events that are counted.
+const EVENTS: [Event; 4] = [
+    Event {
+        name: "cycles",
+        type_: PERF_TYPE_HARDWARE,
+        config: PERF_COUNT_HW_CPU_CYCLES,
+    },
+    Event {
+        name: "instructions",
+        type_: PERF_TYPE_HARDWARE,
+        config: PERF_COUNT_HW_INSTRUCTIONS,
+    },
+    // usually last-level cache misses
+    Event {
+        name: "llc_misses",
+        type_: PERF_TYPE_HARDWARE,
+        config: PERF_COUNT_HW_CACHE_MISSES,
+    },
+    Event {
+        name: "context_switches",
+        type_: PERF_TYPE_SOFTWARE,
+        config: PERF_COUNT_SW_CONTEXT_SWITCHES,
+    },
+];
+
+struct Event {
+    name: &'static str,
+    type_: u32,
+    config: u64,
+}
+
+/// Counts of each event. An event is `None` if it's not supported (for example hardware events in
+/// many VMs) or not permitted.
+#[derive(Copy, Clone, Debug, Default, PartialEq, Eq)]
+pub struct PerfCounts([Option<u64>; EVENTS.len()]);
+
+impl PerfCounts {
+    /// The counts of `self` since `earlier`.
+    pub fn since(&self, earlier: &Self) -> Self {
+        Self(std::array::from_fn(|i| {
+            Some(self.0[i]?.saturating_sub(earlier.0[i]?))
+        }))
+    }
+
+    /// Add the counts of `other`.
+    pub fn add(&mut self, other: &Self) {
+        for (x, y) in self.0.iter_mut().zip(other.0) {
+            *x = match (*x, y) {
+                (Some(x), Some(y)) => Some(x.saturating_add(y)),
+                (x, y) => x.or(y),
+            };
+        }
+    }
+
+    /// The counts of the supported events.
+    pub fn iter(&self) -> impl Iterator<Item = (&'static str, u64)> + '_ {
+        EVENTS
+            .iter()
+            .zip(self.0)
+            .filter_map(|(event, count)| Some((event.name, count?)))
+    }
+
+    pub fn to_counter(&self) -> Counter {
+        let mut counter = Counter::new();
+        for (name, count) in self.iter() {
+            counter.add_value(name, count.try_into().unwrap_or(i64::MAX));
+        }
+        counter
+    }
+}
+
+/// An open group of counters for the calling thread. All counters are read with a single syscall.
+#[derive(Debug)]
+pub struct PerfCounters {
+    /// The group leader is first.
+    fds: Vec<OwnedFd>,
+    /// The index in [`EVENTS`] of each counter in `fds`.
+    events: Vec<usize>,
+}
+
+impl PerfCounters {
+    /// Open counters for the calling thread. Events that can't be counted are skipped. Returns an
+    /// error if no events can be counted.
+    pub fn new() -> std::io::Result<Self> {
+        let mut fds: Vec<OwnedFd> = Vec::new();
+        let mut events = Vec::new();
+        let mut last_err = None;
+
+        for (i, event) in EVENTS.iter().enumerate() {
+            let mut attr = PerfEventAttr {
+                type_: event.type_,
+                size: std::mem::size_of::<PerfEventAttr>() as u32,
+                config: event.config,
+                read_format: PERF_FORMAT_GROUP,
+                ..Default::default()
+            };
+
+            // unprivileged users can usually only count user-space hardware events, but context
+            // switches only happen in the kernel
+            if event.type_ == PERF_TYPE_HARDWARE {
+                attr.flags = PERF_ATTR_FLAG_EXCLUDE_KERNEL | PERF_ATTR_FLAG_EXCLUDE_HV;
+            }
+
+            let group_fd = fds.first().map(|x| x.as_raw_fd()).unwrap_or(-1);
+
+            // count this thread on any cpu
+            let rv = unsafe {
+                libc::syscall(
+                    libc::SYS_perf_event_open,
+                    std::ptr::from_ref(&attr),
+                    0 as libc::pid_t,
+                    -1 as libc::c_int,
+                    group_fd,
+                    PERF_FLAG_FD_CLOEXEC,
+                )
+            };
+
+            if rv < 0 {
+                let err = std::io::Error::last_os_error();
+                log::debug!("Unable to count the '{}' perf event: {err}", event.name);
+                last_err = Some(err);
+                continue;
+            }
+
+            fds.push(unsafe { OwnedFd::from_raw_fd(rv.try_into().unwrap()) });
+            events.push(i);
+        }
+
+        if fds.is_empty() {
+            return Err(last_err.unwrap());
+        }
+
+        Ok(Self { fds, events })
+    }
+
+    /// The current value of each counter.
+    pub fn read(&self) -> PerfCounts {
+        // the number of counters, followed by the value of each
+        let mut buf = [0u64; EVENTS.len() + 1];
+
+        let rv = unsafe {
+            libc::read(
+                self.fds[0].as_raw_fd(),
+                buf.as_mut_ptr().cast(),
+                std::mem::size_of_val(&buf),
+            )
+        };
+        assert!(
+            rv >= 0,
+            "Unable to read perf counters: {}",
+            std::io::Error::last_os_error()
+        );
+        debug_assert_eq!(buf[0], self.events.len() as u64);
+
+        let mut counts = PerfCounts::default();
+        for (event, value) in self.events.iter().zip(&buf[1..]) {
+            counts.0[*event] = Some(*value);
+        }
+        counts
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_counts() {
+        let a = PerfCounts([Some(10), Some(20), None, Some(1)]);
+        let b = PerfCounts([Some(15), Some(20), None, Some(4)]);
+
+        let diff = b.since(&a);
+        assert_eq!(diff, PerfCounts([Some(5), Some(0), None, Some(3)]));
+
+        let mut sum = PerfCounts::default();
+        sum.add(&diff);
+        sum.add(&diff);
+        assert_eq!(sum, PerfCounts([Some(10), Some(0), None, Some(6)]));
+
+        let counter = sum.to_counter();
+        assert_eq!(counter.get_value("cycles"), 10);
+        assert_eq!(counter.get_value("context_switches"), 6);
+        assert_eq!(sum.iter().count(), 3);
+    }
+
+    #[test]
+    // perf_event_open isn't supported by miri
+    #[cfg_attr(miri, ignore)]
+    fn test_read() {
+        // perf events may not be available in the test environment
+        let Ok(counters) = PerfCounters::new() else {
+            return;
+        };
+
+        let start = counters.read();
+        let mut x = 0u64;
+        for i in 0..10_000 {
+            x = std::hint::black_box(x.wrapping_add(i));
+        }
+        let end = counters.read();
+
+        for ((_, start), (_, end)) in start.iter().zip(end.iter()) {
+            assert!(end >= start);
+        }
+    }
+}
@@ -14,46 +14,72 @@
 
 static const gsize INITIAL_SIZE = 100;
 
+/* a 4-ary heap is shallower than a binary one, and a node's children share a cache line */
+#define PRIORITYQUEUE_ARITY 4
+
 struct _PriorityQueue {
     gpointer *heap;
-    GHashTable *map;
     gsize size;
     gsize heapSize;
     GCompareDataFunc compareFunc;
     gpointer compareData;
     GDestroyNotify freeFunc;
+    /* where elements store their heap index; NULL if we track it in `map` instead */
+    PriorityQueueIndexFunc indexFunc;
+    /* element -> heap index, for queues whose elements don't store their own index */
+    GHashTable *map;
 };
 
-PriorityQueue* priorityqueue_new(GCompareDataFunc compareFunc, gpointer compareData,
-                                 GDestroyNotify freeFunc, GHashFunc hashFunc, GEqualFunc eqFunc) {
+static PriorityQueue* _priorityqueue_new(GCompareDataFunc compareFunc, gpointer compareData,
+                                         GDestroyNotify freeFunc) {
     utility_debugAssert(compareFunc);
     PriorityQueue *q = g_slice_new(PriorityQueue);
     q->heap = g_new(gpointer, INITIAL_SIZE);
-    q->map = g_hash_table_new(hashFunc, eqFunc);
     q->size = 0;
     q->heapSize = INITIAL_SIZE;
     q->compareFunc = compareFunc;
     q->compareData = compareData;
     q->freeFunc = freeFunc;
+    q->indexFunc = NULL;
+    q->map = NULL;
+    return q;
+}
+
+PriorityQueue* priorityqueue_new(GCompareDataFunc compareFunc, gpointer compareData,
+                                 GDestroyNotify freeFunc, GHashFunc hashFunc, GEqualFunc eqFunc) {
+    PriorityQueue *q = _priorityqueue_new(compareFunc, compareData, freeFunc);
+    q->map = g_hash_table_new(hashFunc, eqFunc);
+    return q;
+}
+
+PriorityQueue* priorityqueue_newIntrusive(GCompareDataFunc compareFunc, gpointer compareData,
+                                          GDestroyNotify freeFunc, PriorityQueueIndexFunc indexFunc) {
+    utility_debugAssert(indexFunc);
+    PriorityQueue *q = _priorityqueue_new(compareFunc, compareData, freeFunc);
+    q->indexFunc = indexFunc;
     return q;
 }
 
 void priorityqueue_clear(PriorityQueue *q) {
     utility_debugAssert(q);
     if(q->freeFunc) {
-        for (guint i = 0; i < q->size; i++) {
+        for (gsize i = 0; i < q->size; i++) {
             q->freeFunc(q->heap[i]);
             q->heap[i] = NULL;
         }
     }
     q->size = 0;
-    g_hash_table_remove_all(q->map);
+    if (q->map) {
+        g_hash_table_remove_all(q->map);
+    }
 }
 
 void priorityqueue_free(PriorityQueue *q) {
     utility_debugAssert(q);
     priorityqueue_clear(q);
-    g_hash_table_destroy(q->map);
+    if (q->map) {
+        g_hash_table_destroy(q->map);
+    }
     g_free(q->heap);
     g_slice_free(PriorityQueue, q);
 }
@@ -68,73 +94,92 @@ gboolean priorityqueue_isEmpty(PriorityQueue *q) {
     return q->size == 0;
 }
 
-static void _priorityqueue_refresh_map(PriorityQueue *q) {
-    g_hash_table_remove_all(q->map);
-    for (guint i = 0; i < q->size; i++) {
-        g_hash_table_insert(q->map, q->heap[i], q->heap + i);
+/* stores `data` in slot `index` and records the new index */
+static inline void _priorityqueue_place(PriorityQueue *q, gsize index, gpointer data) {
+    q->heap[index] = data;
+    if (q->indexFunc) {
+        *q->indexFunc(data) = index;
+    } else {
+        g_hash_table_insert(q->map, data, GSIZE_TO_POINTER(index));
     }
 }
 
-static void _priorityqueue_swap_entries(PriorityQueue *q, guint i, guint j) {
-    gpointer pi = q->heap[i];
-    gpointer pj = q->heap[j];
-    q->heap[i] = pj;
-    q->heap[j] = pi;
-    g_hash_table_insert(q->map, pi, q->heap + j);
-    g_hash_table_insert(q->map, pj, q->heap + i);
+static gboolean _priorityqueue_lookup(PriorityQueue *q, gpointer data, gsize *index) {
+    if (q->indexFunc) {
+        /* the stored index is stale or uninitialized unless it points back at the element */
+        gsize i = *q->indexFunc(data);
+        if (i < q->size && q->heap[i] == data) {
+            *index = i;
+            return TRUE;
+        }
+        return FALSE;
+    }
+
+    gpointer value = NULL;
+    if (g_hash_table_lookup_extended(q->map, data, NULL, &value)) {
+        *index = GPOINTER_TO_SIZE(value);
+        return TRUE;
+    }
+    return FALSE;
 }
 
-static gboolean _priorityqueue_entry_smaller(PriorityQueue *q, guint i, guint j) {
-    return q->compareFunc(q->heap[i], q->heap[j], q->compareData) < 0;
+static inline gboolean _priorityqueue_smaller(PriorityQueue *q, gpointer a, gpointer b) {
+    return q->compareFunc(a, b, q->compareData) < 0;
 }
 
-static guint _priorityqueue_heapify_up(PriorityQueue *q, guint index) {
-    while ((index > 0) && _priorityqueue_entry_smaller(q, index, (index - 1) / 2)) {
-        _priorityqueue_swap_entries(q, index, (index - 1) / 2);
-        index = (index - 1) / 2;
+/* moves the hole at `index` up until `data` fits in it, shifting larger parents down */
+static gsize _priorityqueue_sift_up(PriorityQueue *q, gsize index, gpointer data) {
+    while (index > 0) {
+        gsize parent = (index - 1) / PRIORITYQUEUE_ARITY;
+        if (!_priorityqueue_smaller(q, data, q->heap[parent])) {
+            break;
+        }
+        _priorityqueue_place(q, index, q->heap[parent]);
+        index = parent;
     }
+    _priorityqueue_place(q, index, data);
     return index;
 }
 
-static guint _priorityqueue_heapify_down(PriorityQueue *q, guint index) {
-    guint child;
-    while ((child = 2 * index + 1) < q->size) {
-        if ((child + 1 < q->size) && _priorityqueue_entry_smaller(q, child + 1, child)) {
-            child = child + 1;
+/* moves the hole at `index` down until `data` fits in it, shifting smaller children up */
+static gsize _priorityqueue_sift_down(PriorityQueue *q, gsize index, gpointer data) {
+    gsize child;
+    while ((child = PRIORITYQUEUE_ARITY * index + 1) < q->size) {
+        gsize end = MIN(child + PRIORITYQUEUE_ARITY, q->size);
+        gsize smallest = child;
+        for (child = child + 1; child < end; child++) {
+            if (_priorityqueue_smaller(q, q->heap[child], q->heap[smallest])) {
+                smallest = child;
+            }
         }
-        if (_priorityqueue_entry_smaller(q, child, index)) {
-            _priorityqueue_swap_entries(q, index, child);
-            index = child;
-        } else {
+        if (!_priorityqueue_smaller(q, q->heap[smallest], data)) {
             break;
         }
+        _priorityqueue_place(q, index, q->heap[smallest]);
+        index = smallest;
     }
+    _priorityqueue_place(q, index, data);
     return index;
 }
 
 gboolean priorityqueue_push(PriorityQueue *q, gpointer data) {
     utility_debugAssert(q);
+
+    gsize oldindex = 0;
+    if (_priorityqueue_lookup(q, data, &oldindex)) {
+        gpointer entry = q->heap[oldindex];
+        _priorityqueue_sift_up(q, _priorityqueue_sift_down(q, oldindex, entry), entry);
+        return FALSE;
+    }
+
     if (q->size >= q->heapSize) {
         q->heapSize *= 2;
-        gpointer *oldheap = q->heap;
         q->heap = g_renew(gpointer, q->heap, q->heapSize);
-        if (q->heap != oldheap) {
-            _priorityqueue_refresh_map(q);
-        }
-    }
-
-    gpointer *oldentry = g_hash_table_lookup(q->map, data);
-    if (oldentry != NULL) {
-        gint oldindex = oldentry - q->heap;
-        _priorityqueue_heapify_up(q, _priorityqueue_heapify_down(q, oldindex));
-        return FALSE;
     }
 
-    guint index = q->size;
-    q->heap[index] = data;
-    g_hash_table_insert(q->map, data, q->heap + index);
+    gsize index = q->size;
     q->size += 1;
-    _priorityqueue_heapify_up(q, index);
+    _priorityqueue_sift_up(q, index, data);
 
     return TRUE;
 }
@@ -149,25 +194,24 @@ gpointer priorityqueue_peek(PriorityQueue *q) {
 
 gpointer priorityqueue_find(PriorityQueue *q, gpointer data) {
     utility_debugAssert(q);
-    gpointer *entry = g_hash_table_lookup(q->map, data);
-    return (entry == NULL) ? NULL : *entry;
+    gsize index = 0;
+    return _priorityqueue_lookup(q, data, &index) ? q->heap[index] : NULL;
 }
 
 gpointer priorityqueue_pop(PriorityQueue *q) {
     utility_debugAssert(q);
     if (q->size > 0) {
         gpointer data = q->heap[0];
-        _priorityqueue_swap_entries(q, 0, q->size - 1);
-        g_hash_table_remove(q->map, data);
+        if (q->map) {
+            g_hash_table_remove(q->map, data);
+        }
         q->size -= 1;
-        _priorityqueue_heapify_down(q, 0);
+        if (q->size > 0) {
+            _priorityqueue_sift_down(q, 0, q->heap[q->size]);
+        }
         if ((q->heapSize > INITIAL_SIZE) && (q->size * 4 < q->heapSize)) {
             q->heapSize /= 2;
-            gpointer *oldheap = q->heap;
             q->heap = g_renew(gpointer, q->heap, q->heapSize);
-            if (q->heap != oldheap) {
-                _priorityqueue_refresh_map(q);
-            }
         }
         return data;
     }
@@ -11,8 +11,17 @@
 
 typedef struct _PriorityQueue PriorityQueue;
 
+/* Returns the location inside `data` where an intrusive queue keeps the element's heap
+ * index. It doesn't need to be initialized before the element is pushed. Intrusive queues that
+ * can hold the same element at the same time must use different locations. */
+typedef gsize* (*PriorityQueueIndexFunc)(gpointer data);
+
+/* Elements are identified using `hashFunc` and `eqFunc` (pointer identity if NULL). */
 PriorityQueue* priorityqueue_new(GCompareDataFunc compareFunc, gpointer compareData,
                                  GDestroyNotify freeFunc, GHashFunc hashFunc, GEqualFunc eqFunc);
+/* Elements are identified by pointer, and store their own heap index at `indexFunc(data)`. */
+PriorityQueue* priorityqueue_newIntrusive(GCompareDataFunc compareFunc, gpointer compareData,
+                                          GDestroyNotify freeFunc, PriorityQueueIndexFunc indexFunc);
 void priorityqueue_clear(PriorityQueue *q);
 void priorityqueue_free(PriorityQueue *q);
 
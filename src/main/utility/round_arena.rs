@@ -0,0 +1,211 @@
+//! A bump allocator for data that's only needed until the end of the current scheduling round.
+//!
+//! Each worker has a [`RoundArena`] that it resets at the start of every round (see
+//! [`crate::core::worker::Worker::round_alloc`]). Allocating is only a pointer bump, and nothing
+//! is freed individually. The memory is kept between rounds, so once the arena has grown to the
+//! worker's usual per-round usage it doesn't need to allocate from the system allocator again.
+
+use std::alloc::Layout;
+use std::ptr::NonNull;
+
+/// The size of the first chunk, and the minimum size of every chunk.
+const MIN_CHUNK_NBYTES: usize = 64 * 1024;
+
+/// The alignment of every chunk, which is also the largest alignment that an allocation can have.
+/// The same as `alignof(max_align_t)`, so that it's suitable for any C type.
+pub const MAX_ALIGN: usize = 16;
+
+/// Memory allocated from the system allocator.
+struct Chunk {
+    ptr: NonNull<u8>,
+    len: usize,
+}
+
+// SAFETY: The chunk owns its memory.
+unsafe impl Send for Chunk {}
+
+impl Chunk {
+    fn layout(len: usize) -> Layout {
+        Layout::from_size_align(len, MAX_ALIGN).unwrap()
+    }
+
+    fn new(len: usize) -> Self {
+        assert!(len > 0);
+        let layout = Self::layout(len);
+        // SAFETY: The layout has a non-zero size.
+        let ptr = unsafe { std::alloc::alloc(layout) };
+        let ptr = NonNull::new(ptr).unwrap_or_else(|| std::alloc::handle_alloc_error(layout));
+        Self { ptr, len }
+    }
+}
+
+impl Drop for Chunk {
+    fn drop(&mut self) {
+        // SAFETY: We allocated `ptr` with this layout.
+        unsafe { std::alloc::dealloc(self.ptr.as_ptr(), Self::layout(self.len)) };
+    }
+}
+
+/// A bump allocator whose allocations are all freed at once by [`RoundArena::reset`].
+pub struct RoundArena {
+    // Allocations are made from the last chunk. The others are full, and are only kept until the
+    // next reset.
+    chunks: Vec<Chunk>,
+    // The offset of the free memory in the last chunk.
+    offset: usize,
+    // The bytes allocated since the last reset, including alignment padding.
+    used: usize,
+    // The most bytes that were allocated between two resets.
+    high_water: usize,
+    num_allocs: u64,
+}
+
+impl RoundArena {
+    pub const fn new() -> Self {
+        Self {
+            chunks: Vec::new(),
+            offset: 0,
+            used: 0,
+            high_water: 0,
+            num_allocs: 0,
+        }
+    }
+
+    /// Allocate uninitialized memory for `layout`. The memory is valid until the next call to
+    /// [`Self::reset`] (or until the arena is dropped). Panics if the alignment is larger than
+    /// [`MAX_ALIGN`].
+    pub fn alloc(&mut self, layout: Layout) -> NonNull<u8> {
+        assert!(layout.align() <= MAX_ALIGN);
+
+        let fits = |chunk: &Chunk, start: usize| {
+            start
+                .checked_add(layout.size())
+                .is_some_and(|end| end <= chunk.len)
+        };
+
+        let mut start = self.offset.next_multiple_of(layout.align());
+        match self.chunks.last() {
+            Some(chunk) if fits(chunk, start) => {}
+            _ => {
+                self.grow(layout.size());
+                start = 0;
+            }
+        }
+
+        let end = start + layout.size();
+        self.used += end - self.offset;
+        self.offset = end;
+        self.num_allocs += 1;
+
+        let chunk = self.chunks.last().unwrap();
+        // SAFETY: `start..end` is within the chunk.
+        unsafe { NonNull::new_unchecked(chunk.ptr.as_ptr().add(start)) }
+    }
+
+    /// Add a chunk with room for at least `nbytes`.
+    fn grow(&mut self, nbytes: usize) {
+        let prev_len = self.chunks.last().map(|x| x.len).unwrap_or(0);
+        let len = [nbytes, MIN_CHUNK_NBYTES, prev_len.saturating_mul(2)]
+            .into_iter()
+            .max()
+            .unwrap()
+            .next_multiple_of(MAX_ALIGN);
+
+        self.chunks.push(Chunk::new(len));
+        self.offset = 0;
+    }
+
+    /// Free all allocations.
+    pub fn reset(&mut self) {
+        self.high_water = std::cmp::max(self.high_water, self.used);
+
+        // replace multiple chunks with a single chunk that could have held all of them, so that
+        // similar usage in the next round doesn't need to allocate
+        if self.chunks.len() > 1 {
+            let len = self.chunks.iter().map(|x| x.len).sum();
+            self.chunks.clear();
+            self.chunks.push(Chunk::new(len));
+        }
+
+        self.offset = 0;
+        self.used = 0;
+    }
+
+    /// The most bytes that were allocated between two resets, including alignment padding.
+    pub fn high_water_bytes(&self) -> usize {
+        std::cmp::max(self.high_water, self.used)
+    }
+
+    /// The number of allocations made from this arena.
+    pub fn num_allocs(&self) -> u64 {
+        self.num_allocs
+    }
+}
+
+impl Default for RoundArena {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_alignment() {
+        let mut arena = RoundArena::new();
+
+        let a = arena.alloc(Layout::new::<u8>());
+        let b = arena.alloc(Layout::new::<u64>());
+        let c = arena.alloc(Layout::from_size_align(3, 16).unwrap());
+
+        assert_eq!(b.as_ptr() as usize % 8, 0);
+        assert_eq!(c.as_ptr() as usize % 16, 0);
+        assert!(a < b && b < c);
+
+        // 1 byte, 7 bytes of padding, 8 bytes, and 3 bytes
+        assert_eq!(arena.high_water_bytes(), 19);
+        assert_eq!(arena.num_allocs(), 3);
+    }
+
+    #[test]
+    fn test_grow_and_reset() {
+        let mut arena = RoundArena::new();
+
+        // larger than the first chunk
+        let layout = Layout::array::<u64>(MIN_CHUNK_NBYTES / 8 + 1).unwrap();
+        let ptrs: Vec<_> = (0..3).map(|_| arena.alloc(layout)).collect();
+
+        // the allocations are usable and don't overlap
+        for (i, ptr) in ptrs.iter().enumerate() {
+            unsafe { ptr.as_ptr().write_bytes(i as u8, layout.size()) };
+        }
+        for (i, ptr) in ptrs.iter().enumerate() {
+            let bytes = unsafe { std::slice::from_raw_parts(ptr.as_ptr(), layout.size()) };
+            assert!(bytes.iter().all(|x| *x == i as u8));
+        }
+
+        arena.reset();
+        assert_eq!(arena.chunks.len(), 1);
+        assert_eq!(arena.high_water_bytes(), 3 * layout.size());
+
+        // after the reset, the same usage fits in the single chunk
+        for _ in 0..3 {
+            arena.alloc(layout);
+        }
+        assert_eq!(arena.chunks.len(), 1);
+
+        // a smaller round doesn't lower the high-water mark
+        arena.reset();
+        arena.alloc(Layout::new::<u8>());
+        assert_eq!(arena.high_water_bytes(), 3 * layout.size());
+    }
+
+    #[test]
+    fn test_zero_size() {
+        let mut arena = RoundArena::new();
+        arena.alloc(Layout::new::<()>());
+        assert_eq!(arena.high_water_bytes(), 0);
+    }
+}
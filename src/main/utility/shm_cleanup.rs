@@ -1,14 +1,14 @@
-use std::collections::HashSet;
 use std::fs;
+use std::io;
 use std::path::Path;
 use std::path::PathBuf;
-use std::str::FromStr;
+use std::time::Duration;
 
 use anyhow::Context;
+use rustix::fs::FlockOperation;
+use shadow_shmem::util::{SHM_RUN_DIR_LOCK_NAME, SHM_RUN_DIR_PREFIX};
 
-pub const SHM_DIR_PATH: &str = "/dev/shm/";
-const PROC_DIR_PATH: &str = "/proc/";
-const SHADOW_SHM_FILE_PREFIX: &str = "shadow_shmemfile";
+pub const SHM_DIR_PATH: &str = shadow_shmem::util::SHM_DIR_PATH;
 
 // Get the paths from the given directory path.
 fn get_dir_contents(dir: &Path) -> anyhow::Result<Vec<PathBuf>> {
@@ -22,142 +22,151 @@ fn get_dir_contents(dir: &Path) -> anyhow::Result<Vec<PathBuf>> {
         .collect()
 }
 
-// Parse files in dir_path and return the paths to the shm files created by Shadow.
-fn get_shadow_shm_file_paths(dir_path: &Path) -> anyhow::Result<Vec<PathBuf>> {
+// Parse entries in dir_path and return the paths to the shm directories created by Shadow.
+fn get_shadow_shm_run_dir_paths(dir_path: &Path) -> anyhow::Result<Vec<PathBuf>> {
     let vec = get_dir_contents(dir_path)?
         .into_iter()
-        .filter_map(|path| match path.file_name() {
-            Some(name) => name
-                .to_string_lossy()
-                .starts_with(SHADOW_SHM_FILE_PREFIX)
-                .then_some(Some(path)),
-            None => None, // ignore paths ending in '..'
+        .filter(|path| match path.file_name() {
+            Some(name) => name.to_string_lossy().starts_with(SHM_RUN_DIR_PREFIX),
+            None => false, // ignore paths ending in '..'
         })
-        .flatten()
         .collect();
     Ok(vec)
 }
 
-// Parse PIDs from entries in dir_path.
-fn get_running_pid_set(dir_path: &Path) -> anyhow::Result<HashSet<i32>> {
-    let set: HashSet<i32> = get_dir_contents(dir_path)?
-        .into_iter()
-        .filter_map(|path| match path.file_name() {
-            // ignore names that don't parse into PIDs
-            Some(name) => i32::from_str(&name.to_string_lossy()).ok(),
-            None => None, // ignore paths ending in '..'
-        })
-        .collect();
-    Ok(set)
-}
+// A directory without a lock file is either still being created or is being removed, which only
+// takes a moment. If it has been without a lock file for longer than this, the process that
+// created it must have exited part way through.
+const LOCKLESS_RUN_DIR_GRACE_PERIOD: Duration = Duration::from_secs(60);
+
+// Returns true if the shadow process that created the shm directory has exited. The process holds
+// an exclusive lock on the directory's lock file for as long as it's running, so if we're able to
+// take the lock then no process is using the directory. A directory without a lock file is only
+// considered orphaned once it hasn't been modified for `LOCKLESS_RUN_DIR_GRACE_PERIOD`.
+fn is_orphaned(run_dir: &Path) -> bool {
+    let lock_file = match fs::File::open(run_dir.join(SHM_RUN_DIR_LOCK_NAME)) {
+        Ok(lock_file) => lock_file,
+        Err(e) if e.kind() == io::ErrorKind::NotFound => {
+            return fs::metadata(run_dir)
+                .and_then(|metadata| metadata.modified())
+                .ok()
+                .and_then(|modified| modified.elapsed().ok())
+                .is_some_and(|age| age >= LOCKLESS_RUN_DIR_GRACE_PERIOD);
+        }
+        Err(_) => return false,
+    };
 
-// Parse the PID that is encoded in the Shadow shmem file name. The PID is the
-// part after the '-', e.g., 2738869 in the example file name:
-// `shadow_shmemfile_6379761.950298775-2738869`
-fn pid_from_shadow_shm_file_name(file_name: &str) -> anyhow::Result<i32> {
-    let pid_str = file_name.split('-').last().context(format!(
-        "Parsing PID separator '-' from shm file name {:?}",
-        file_name
-    ))?;
-    let pid = i32::from_str(pid_str).context(format!(
-        "Parsing PID '{}' from shm file name {:?}",
-        pid_str, file_name
-    ))?;
-    Ok(pid)
+    // the lock is released when the file is closed
+    rustix::fs::flock(&lock_file, FlockOperation::NonBlockingLockExclusive).is_ok()
 }
 
-// Cleans up orphaned shared memory files that are no longer mapped by a shadow
-// process. This function should never fail or crash, but is not guaranteed to
-// reclaim all possible orphans. Returns the number of orphans removed.
+// Cleans up orphaned shared memory directories that are no longer used by a shadow process. This
+// function should never fail or crash, but is not guaranteed to reclaim all possible orphans.
+// Returns the number of orphaned directories removed.
 pub fn shm_cleanup(shm_dir: impl AsRef<Path>) -> anyhow::Result<u32> {
-    // Get the shm file paths before the PIDs to avoid a race condition (#1343).
-    let shm_paths = get_shadow_shm_file_paths(shm_dir.as_ref())?;
+    let run_dirs = get_shadow_shm_run_dir_paths(shm_dir.as_ref())?;
     log::debug!(
-        "Found {} shadow shared memory files in {}",
-        shm_paths.len(),
+        "Found {} shadow shared memory directories in {}",
+        run_dirs.len(),
         shm_dir.as_ref().display()
     );
 
-    let running_pids = get_running_pid_set(Path::new(PROC_DIR_PATH))?;
-    log::debug!(
-        "Found {} running PIDs in {}",
-        running_pids.len(),
-        PROC_DIR_PATH
-    );
-
-    // Count how many files we remove.
+    // Count how many directories we remove.
     let mut num_removed = 0;
 
     // Best effort: ignore failures on individual paths so we can try them all.
-    for path in shm_paths {
-        // Ignore paths ending in '..'
-        if let Some(file_name) = path.file_name() {
-            let creator_pid = match pid_from_shadow_shm_file_name(&file_name.to_string_lossy()) {
-                Ok(pid) => pid,
-                Err(e) => {
-                    log::warn!(
-                        "Unable to parse PID from shared memory file {:?}: {:?}",
-                        path,
-                        e
-                    );
-                    // Keep going to try the rest of the paths we found.
-                    continue;
-                }
-            };
-
-            // Do not remove the file if it's owner process is still running.
-            if !running_pids.contains(&creator_pid) {
-                log::trace!("Removing orphaned shared memory file {:?}", path);
-                if fs::remove_file(path).is_ok() {
-                    num_removed += 1;
-                }
+    for path in run_dirs {
+        if is_orphaned(&path) {
+            log::trace!("Removing orphaned shared memory directory {:?}", path);
+            if fs::remove_dir_all(path).is_ok() {
+                num_removed += 1;
             }
         }
     }
 
-    log::debug!("Removed {} total shared memory files.", num_removed);
+    log::debug!("Removed {} total shared memory directories.", num_removed);
     Ok(num_removed)
 }
 
 #[cfg(test)]
 mod tests {
     use std::fs::OpenOptions;
-    use std::io;
-    use std::process;
+    use std::time::SystemTime;
 
     use super::*;
 
-    fn touch(path: impl AsRef<Path>) -> io::Result<()> {
+    fn touch(path: impl AsRef<Path>) -> io::Result<fs::File> {
         OpenOptions::new()
             .create(true)
+            .truncate(false)
             .write(true)
-            .open(path.as_ref())?;
-        Ok(())
+            .open(path.as_ref())
+    }
+
+    // Create a shm directory like the allocator does, with a lock file and a shm file.
+    fn create_run_dir(dir: &Path, name: &str) -> (PathBuf, fs::File) {
+        let run_dir = dir.join(name);
+        fs::create_dir(&run_dir).unwrap();
+        touch(run_dir.join("shadow_shmemfile_6379761.950298775")).unwrap();
+        let lock = touch(run_dir.join(SHM_RUN_DIR_LOCK_NAME)).unwrap();
+        (run_dir, lock)
     }
 
     #[test]
-    fn test_expired_shm_file_is_removed() {
+    fn test_orphaned_shm_dir_is_removed() {
         let dir = tempfile::tempdir().unwrap();
-        let s = "shadow_shmemfile_6379761.950298775-999999999";
-        let expired: PathBuf = [dir.as_ref(), s.as_ref()].iter().collect();
+        let (orphaned, lock) =
+            create_run_dir(dir.as_ref(), "shadow_shmemdir_6379761.950298775-999999999");
+
+        // the creator has exited, so its lock was released
+        drop(lock);
 
-        touch(&expired).unwrap();
         assert_eq!(shm_cleanup(&dir).unwrap(), 1);
-        assert!(!expired.exists(), "Exists: {}", expired.display());
+        assert!(!orphaned.exists(), "Exists: {}", orphaned.display());
     }
 
     #[test]
-    fn test_valid_shm_file_is_not_removed() {
-        let my_pid = process::id();
+    fn test_locked_shm_dir_is_not_removed() {
         let dir = tempfile::tempdir().unwrap();
-        let s = format!("shadow_shmemfile_6379761.950298775-{my_pid}");
-        let valid: PathBuf = [dir.as_ref(), s.as_ref()].iter().collect();
+        let (valid, lock) =
+            create_run_dir(dir.as_ref(), "shadow_shmemdir_6379761.950298775-999999999");
+
+        rustix::fs::flock(&lock, FlockOperation::LockExclusive).unwrap();
 
-        touch(&valid).unwrap();
         assert_eq!(shm_cleanup(&dir).unwrap(), 0);
         assert!(valid.exists(), "Doesn't exist: {}", valid.display());
     }
 
+    #[test]
+    fn test_shm_dir_without_lock_is_not_removed() {
+        let dir = tempfile::tempdir().unwrap();
+        let (valid, _lock) =
+            create_run_dir(dir.as_ref(), "shadow_shmemdir_6379761.950298775-999999999");
+
+        fs::remove_file(valid.join(SHM_RUN_DIR_LOCK_NAME)).unwrap();
+
+        assert_eq!(shm_cleanup(&dir).unwrap(), 0);
+        assert!(valid.exists(), "Doesn't exist: {}", valid.display());
+    }
+
+    #[test]
+    fn test_old_shm_dir_without_lock_is_removed() {
+        let dir = tempfile::tempdir().unwrap();
+        let (orphaned, lock) =
+            create_run_dir(dir.as_ref(), "shadow_shmemdir_6379761.950298775-999999999");
+
+        // the creator exited after removing the lock file, but before removing the directory
+        drop(lock);
+        fs::remove_file(orphaned.join(SHM_RUN_DIR_LOCK_NAME)).unwrap();
+        fs::File::open(&orphaned)
+            .unwrap()
+            .set_modified(SystemTime::now() - 2 * LOCKLESS_RUN_DIR_GRACE_PERIOD)
+            .unwrap();
+
+        assert_eq!(shm_cleanup(&dir).unwrap(), 1);
+        assert!(!orphaned.exists(), "Exists: {}", orphaned.display());
+    }
+
     #[test]
     fn test_nonshadow_shm_file_is_not_removed() {
         let dir = tempfile::tempdir().unwrap();
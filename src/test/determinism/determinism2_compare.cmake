@@ -20,6 +20,10 @@ foreach(LOOPIDX RANGE 1 10)
         ${CMAKE_BINARY_DIR}/determinism2a-shadow.data/hosts/peer${LOOPIDX}/test-phold.1000.stdout
         ${CMAKE_BINARY_DIR}/determinism2c-shadow.data/hosts/peer${LOOPIDX}/test-phold.1000.stdout
     )
+    exec_diff_check(
+        ${CMAKE_BINARY_DIR}/determinism2a-shadow.data/hosts/peer${LOOPIDX}/test-phold.1000.stdout
+        ${CMAKE_BINARY_DIR}/determinism2d-shadow.data/hosts/peer${LOOPIDX}/test-phold.1000.stdout
+    )
     exec_diff_check(
         ${CMAKE_BINARY_DIR}/determinism2a-shadow.data/hosts/peer${LOOPIDX}/test-phold.1000.strace
         ${CMAKE_BINARY_DIR}/determinism2b-shadow.data/hosts/peer${LOOPIDX}/test-phold.1000.strace
@@ -28,6 +32,10 @@ foreach(LOOPIDX RANGE 1 10)
         ${CMAKE_BINARY_DIR}/determinism2a-shadow.data/hosts/peer${LOOPIDX}/test-phold.1000.strace
         ${CMAKE_BINARY_DIR}/determinism2c-shadow.data/hosts/peer${LOOPIDX}/test-phold.1000.strace
     )
+    exec_diff_check(
+        ${CMAKE_BINARY_DIR}/determinism2a-shadow.data/hosts/peer${LOOPIDX}/test-phold.1000.strace
+        ${CMAKE_BINARY_DIR}/determinism2d-shadow.data/hosts/peer${LOOPIDX}/test-phold.1000.strace
+    )
     exec_diff_check(
         ${CMAKE_BINARY_DIR}/determinism2a-shadow.data/hosts/peer${LOOPIDX}/lo.pcap
         ${CMAKE_BINARY_DIR}/determinism2b-shadow.data/hosts/peer${LOOPIDX}/lo.pcap
@@ -36,6 +44,10 @@ foreach(LOOPIDX RANGE 1 10)
         ${CMAKE_BINARY_DIR}/determinism2a-shadow.data/hosts/peer${LOOPIDX}/lo.pcap
         ${CMAKE_BINARY_DIR}/determinism2c-shadow.data/hosts/peer${LOOPIDX}/lo.pcap
     )
+    exec_diff_check(
+        ${CMAKE_BINARY_DIR}/determinism2a-shadow.data/hosts/peer${LOOPIDX}/lo.pcap
+        ${CMAKE_BINARY_DIR}/determinism2d-shadow.data/hosts/peer${LOOPIDX}/lo.pcap
+    )
     exec_diff_check(
         ${CMAKE_BINARY_DIR}/determinism2a-shadow.data/hosts/peer${LOOPIDX}/eth0.pcap
         ${CMAKE_BINARY_DIR}/determinism2b-shadow.data/hosts/peer${LOOPIDX}/eth0.pcap
@@ -44,4 +56,24 @@ foreach(LOOPIDX RANGE 1 10)
         ${CMAKE_BINARY_DIR}/determinism2a-shadow.data/hosts/peer${LOOPIDX}/eth0.pcap
         ${CMAKE_BINARY_DIR}/determinism2c-shadow.data/hosts/peer${LOOPIDX}/eth0.pcap
     )
+    exec_diff_check(
+        ${CMAKE_BINARY_DIR}/determinism2a-shadow.data/hosts/peer${LOOPIDX}/eth0.pcap
+        ${CMAKE_BINARY_DIR}/determinism2d-shadow.data/hosts/peer${LOOPIDX}/eth0.pcap
+    )
+    exec_diff_check(
+        ${CMAKE_BINARY_DIR}/determinism2e-shadow.data/hosts/peer${LOOPIDX}/test-phold.1000.stdout
+        ${CMAKE_BINARY_DIR}/determinism2f-shadow.data/hosts/peer${LOOPIDX}/test-phold.1000.stdout
+    )
+    exec_diff_check(
+        ${CMAKE_BINARY_DIR}/determinism2e-shadow.data/hosts/peer${LOOPIDX}/test-phold.1000.strace
+        ${CMAKE_BINARY_DIR}/determinism2f-shadow.data/hosts/peer${LOOPIDX}/test-phold.1000.strace
+    )
+    exec_diff_check(
+        ${CMAKE_BINARY_DIR}/determinism2e-shadow.data/hosts/peer${LOOPIDX}/lo.pcap
+        ${CMAKE_BINARY_DIR}/determinism2f-shadow.data/hosts/peer${LOOPIDX}/lo.pcap
+    )
+    exec_diff_check(
+        ${CMAKE_BINARY_DIR}/determinism2e-shadow.data/hosts/peer${LOOPIDX}/eth0.pcap
+        ${CMAKE_BINARY_DIR}/determinism2f-shadow.data/hosts/peer${LOOPIDX}/eth0.pcap
+    )
 endforeach(LOOPIDX)
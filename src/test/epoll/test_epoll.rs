@@ -237,6 +237,115 @@ fn test_threads_level_with_early_read() -> anyhow::Result<()> {
     })
 }
 
+/// This test has several threads wait on an exclusive entry and the woken thread read from the pipe
+/// immediately after returning from `epoll_wait`.
+///
+/// Shadow wakes the threads blocked in `epoll_wait` on the same epoll one at a time, so only the
+/// first thread should be woken and the others shouldn't be woken until the timeout expires.
+fn test_threads_exclusive_one_woken() -> anyhow::Result<()> {
+    let (readfd, writefd) = unistd::pipe2(nix::fcntl::OFlag::O_NONBLOCK)?;
+    let epollfd = epoll::epoll_create()?;
+
+    test_utils::run_and_close_fds(&[epollfd, readfd, writefd], || {
+        let mut event = epoll::EpollEvent::new(
+            EpollFlags::EPOLLEXCLUSIVE | EpollFlags::EPOLLIN,
+            readfd as u64,
+        );
+        epoll::epoll_ctl(
+            epollfd,
+            epoll::EpollOp::EpollCtlAdd,
+            readfd,
+            Some(&mut event),
+        )?;
+
+        let timeout = Duration::from_millis(100);
+
+        let threads = [
+            std::thread::spawn(move || do_epoll_wait(epollfd, timeout, /* do_read= */ true)),
+            std::thread::spawn(move || do_epoll_wait(epollfd, timeout, /* do_read= */ true)),
+            std::thread::spawn(move || do_epoll_wait(epollfd, timeout, /* do_read= */ true)),
+        ];
+
+        // Wait for readers to block.
+        std::thread::sleep(timeout / 2);
+
+        // Make the read-end readable.
+        unistd::write(writefd, &[0])?;
+
+        let mut results = threads.map(|t| t.join().unwrap());
+
+        // Sort results by number of events received.
+        results.sort_by(|lhs, rhs| lhs.events.len().cmp(&rhs.events.len()));
+
+        // All but one thread should have timed out with no events received.
+        for res in &results[..2] {
+            ensure_ord!(res.epoll_res, ==, Ok(0));
+            ensure_ord!(res.duration, >=, timeout);
+        }
+
+        // The woken thread should have gotten a single event.
+        ensure_ord!(results[2].epoll_res, ==, Ok(1));
+        ensure_ord!(results[2].duration, <, timeout);
+        ensure_ord!(results[2].events[0].events(), ==, EpollFlags::EPOLLIN);
+
+        Ok(())
+    })
+}
+
+/// This test has a child process block in `epoll_wait` on an epoll shared with the parent, and
+/// kills the child right after making the epoll readable.
+///
+/// The child was blocked first, so it's the one that Shadow wakes. Since it exits without reading
+/// from the pipe, the wakeup should be passed on to the parent's thread blocked on the same epoll
+/// rather than leaving it blocked until the timeout expires.
+fn test_threads_level_woken_exits() -> anyhow::Result<()> {
+    let (readfd, writefd) = unistd::pipe2(nix::fcntl::OFlag::O_NONBLOCK)?;
+    let epollfd = epoll::epoll_create()?;
+
+    test_utils::run_and_close_fds(&[epollfd, readfd, writefd], || {
+        let mut event = epoll::EpollEvent::new(EpollFlags::EPOLLIN, readfd as u64);
+        epoll::epoll_ctl(
+            epollfd,
+            epoll::EpollOp::EpollCtlAdd,
+            readfd,
+            Some(&mut event),
+        )?;
+
+        let timeout = Duration::from_millis(100);
+
+        let child = match unsafe { unistd::fork() }? {
+            unistd::ForkResult::Child => {
+                do_epoll_wait(epollfd, 10 * timeout, /* do_read= */ false);
+                unsafe { libc::_exit(0) };
+            }
+            unistd::ForkResult::Parent { child } => child,
+        };
+
+        // Wait for the child to block before the thread, so that the child is woken first.
+        std::thread::sleep(timeout / 10);
+
+        let thread =
+            std::thread::spawn(move || do_epoll_wait(epollfd, timeout, /* do_read= */ false));
+
+        // Wait for the thread to block.
+        std::thread::sleep(timeout / 2);
+
+        // Make the read-end readable and kill the woken child before it can run.
+        unistd::write(writefd, &[0])?;
+        nix::sys::signal::kill(child, nix::sys::signal::Signal::SIGKILL)?;
+
+        let res = thread.join().unwrap();
+        nix::sys::wait::waitpid(child, None)?;
+
+        // The thread should have been woken in place of the child.
+        ensure_ord!(res.epoll_res, ==, Ok(1));
+        ensure_ord!(res.duration, <, timeout);
+        ensure_ord!(res.events[0].events(), ==, EpollFlags::EPOLLIN);
+
+        Ok(())
+    })
+}
+
 fn test_wait_negative_timeout() -> anyhow::Result<()> {
     let (read_fd, write_fd) = unistd::pipe()?;
     let epoll_fd = epoll::epoll_create()?;
@@ -329,6 +438,65 @@ fn test_ctl_invalid_op() -> anyhow::Result<()> {
     })
 }
 
+fn test_ctl_exclusive() -> anyhow::Result<()> {
+    let (read_fd, write_fd) = unistd::pipe()?;
+    let epoll_fd = epoll::epoll_create()?;
+    let other_epoll_fd = epoll::epoll_create()?;
+
+    test_utils::run_and_close_fds(&[epoll_fd, other_epoll_fd, read_fd, write_fd], || {
+        let exclusive = EpollFlags::EPOLLEXCLUSIVE | EpollFlags::EPOLLIN;
+
+        // can't be used with other flags such as EPOLLONESHOT
+        let mut event = epoll::EpollEvent::new(exclusive | EpollFlags::EPOLLONESHOT, 0);
+        let rv = epoll::epoll_ctl(
+            epoll_fd,
+            epoll::EpollOp::EpollCtlAdd,
+            read_fd,
+            Some(&mut event),
+        );
+        assert_eq!(rv, Err(Errno::EINVAL));
+
+        // can't be used for epoll instances
+        let mut event = epoll::EpollEvent::new(exclusive, 0);
+        let rv = epoll::epoll_ctl(
+            epoll_fd,
+            epoll::EpollOp::EpollCtlAdd,
+            other_epoll_fd,
+            Some(&mut event),
+        );
+        assert_eq!(rv, Err(Errno::EINVAL));
+
+        let mut event = epoll::EpollEvent::new(exclusive, 0);
+        epoll::epoll_ctl(
+            epoll_fd,
+            epoll::EpollOp::EpollCtlAdd,
+            read_fd,
+            Some(&mut event),
+        )?;
+
+        // an exclusive entry can't be modified
+        let mut event = epoll::EpollEvent::new(EpollFlags::EPOLLIN, 0);
+        let rv = epoll::epoll_ctl(
+            epoll_fd,
+            epoll::EpollOp::EpollCtlMod,
+            read_fd,
+            Some(&mut event),
+        );
+        assert_eq!(rv, Err(Errno::EINVAL));
+
+        // but it still reports events
+        unistd::write(write_fd, &[0])?;
+        let mut events = [epoll::EpollEvent::empty()];
+        assert_eq!(epoll::epoll_wait(epoll_fd, &mut events, 0)?, 1);
+        assert_eq!(events[0].events(), EpollFlags::EPOLLIN);
+
+        // and can be removed
+        epoll::epoll_ctl(epoll_fd, epoll::EpollOp::EpollCtlDel, read_fd, None)?;
+
+        Ok(())
+    })
+}
+
 fn main() -> anyhow::Result<()> {
     // should we restrict the tests we run?
     let filter_shadow_passing = std::env::args().any(|x| x == "--shadow-passing");
@@ -351,12 +519,24 @@ fn main() -> anyhow::Result<()> {
             test_threads_level_with_early_read,
             set![TestEnvironment::Shadow],
         ),
+        // in Linux a woken waiter may also wake the others, or may not pass on its wakeup
+        ShadowTest::new(
+            "threads-exclusive-one-woken",
+            test_threads_exclusive_one_woken,
+            set![TestEnvironment::Shadow],
+        ),
+        ShadowTest::new(
+            "threads-level-woken-exits",
+            test_threads_level_woken_exits,
+            set![TestEnvironment::Shadow],
+        ),
         ShadowTest::new(
             "test_wait_negative_timeout",
             test_wait_negative_timeout,
             all_envs.clone(),
         ),
-        ShadowTest::new("test_ctl_invalid_op", test_ctl_invalid_op, all_envs),
+        ShadowTest::new("test_ctl_invalid_op", test_ctl_invalid_op, all_envs.clone()),
+        ShadowTest::new("test_ctl_exclusive", test_ctl_exclusive, all_envs),
     ];
 
     if filter_shadow_passing {
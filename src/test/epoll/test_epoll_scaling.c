@@ -0,0 +1,138 @@
+/*
+ * The Shadow Simulator
+ * See LICENSE for licensing information
+ */
+
+/* Watches many eventfds with one epoll, makes a fraction of them readable, and times how long it
+ * takes to harvest the ready events in small batches, as a busy server would. Under shadow the
+ * reported times are simulated, so compare the wall-clock time of the whole run instead.
+ *
+ * usage: test-epoll-scaling [num_fds] [num_ready] [rounds] */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_EVENTS 64
+
+static double _now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* returns the number of fds we can open, after raising our soft limit as far as we can */
+static long _raise_fd_limit() {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        perror("getrlimit");
+        return -1;
+    }
+    limit.rlim_cur = limit.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        perror("setrlimit");
+        return -1;
+    }
+    return (long)limit.rlim_cur;
+}
+
+int main(int argc, char* argv[]) {
+    long num_fds = (argc > 1) ? strtol(argv[1], NULL, 10) : 20000;
+    long num_ready = (argc > 2) ? strtol(argv[2], NULL, 10) : 2000;
+    long rounds = (argc > 3) ? strtol(argv[3], NULL, 10) : 20;
+
+    long fd_limit = _raise_fd_limit();
+    if (fd_limit < 0) {
+        return EXIT_FAILURE;
+    }
+    /* leave room for stdio and the epoll fd itself */
+    if (num_fds > fd_limit - 16) {
+        num_fds = fd_limit - 16;
+    }
+    if (num_ready > num_fds) {
+        num_ready = num_fds;
+    }
+
+    int epfd = epoll_create1(0);
+    if (epfd < 0) {
+        perror("epoll_create1");
+        return EXIT_FAILURE;
+    }
+
+    int* fds = calloc(num_fds, sizeof(*fds));
+    double start = _now_ms();
+    for (long i = 0; i < num_fds; i++) {
+        fds[i] = eventfd(0, EFD_NONBLOCK);
+        if (fds[i] < 0) {
+            perror("eventfd");
+            return EXIT_FAILURE;
+        }
+        struct epoll_event event = {.events = EPOLLIN, .data.u64 = (uint64_t)i};
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i], &event) != 0) {
+            perror("epoll_ctl");
+            return EXIT_FAILURE;
+        }
+    }
+    double register_ms = _now_ms() - start;
+
+    double harvest_ms = 0;
+    for (long round = 0; round < rounds; round++) {
+        /* make every (num_fds / num_ready)th fd readable */
+        long stride = num_fds / num_ready;
+        uint64_t one = 1;
+        for (long i = 0; i < num_ready; i++) {
+            if (write(fds[i * stride], &one, sizeof(one)) != sizeof(one)) {
+                perror("write");
+                return EXIT_FAILURE;
+            }
+        }
+
+        /* harvest in batches, reading each fd so it stops being ready */
+        start = _now_ms();
+        long harvested = 0;
+        while (harvested < num_ready) {
+            struct epoll_event events[MAX_EVENTS];
+            int n = epoll_wait(epfd, events, MAX_EVENTS, 0);
+            if (n < 0) {
+                perror("epoll_wait");
+                return EXIT_FAILURE;
+            } else if (n == 0) {
+                fprintf(stderr, "expected %ld ready fds, only found %ld\n", num_ready, harvested);
+                return EXIT_FAILURE;
+            }
+            for (int j = 0; j < n; j++) {
+                uint64_t value = 0;
+                if (read(fds[events[j].data.u64], &value, sizeof(value)) != sizeof(value)) {
+                    perror("read");
+                    return EXIT_FAILURE;
+                }
+            }
+            harvested += n;
+        }
+        harvest_ms += _now_ms() - start;
+
+        struct epoll_event event;
+        if (epoll_wait(epfd, &event, 1, 0) != 0) {
+            fprintf(stderr, "fds are still ready after harvesting every event\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("%ld fds, %ld ready: registered in %.2f ms, harvested %ld rounds in %.2f ms\n",
+           num_fds, num_ready, register_ms, rounds, harvest_ms);
+
+    for (long i = 0; i < num_fds; i++) {
+        close(fds[i]);
+    }
+    free(fds);
+    close(epfd);
+
+    return EXIT_SUCCESS;
+}
@@ -14,6 +14,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/uio.h>
@@ -254,6 +255,36 @@ static void _test_pwritev2() {
     assert_nonneg_errno(close(fd));
 }
 
+// Data written through one fd must be visible through other fds and paths of
+// the same file right away, even if the writes are made asynchronously.
+static void _test_read_other_fd() {
+    g_auto(AutoDeleteFile) adf = _create_auto_file();
+    const char wbuf[] = "test file write";
+    int fd, rv;
+    assert_nonneg_errno(fd = open(adf.name, O_WRONLY));
+    assert_nonneg_errno(rv = write(fd, wbuf, sizeof(wbuf)));
+    g_assert_cmpint(rv, ==, sizeof(wbuf));
+
+    struct stat filestat = {0};
+    assert_nonneg_errno(stat(adf.name, &filestat));
+    g_assert_cmpint(filestat.st_size, ==, sizeof(wbuf));
+
+    int fd2;
+    assert_nonneg_errno(fd2 = open(adf.name, O_RDONLY));
+    filestat = (struct stat){0};
+    assert_nonneg_errno(fstat(fd2, &filestat));
+    g_assert_cmpint(filestat.st_size, ==, sizeof(wbuf));
+
+    char rbuf[sizeof(wbuf)] = {0};
+    assert_nonneg_errno(rv = read(fd2, rbuf, sizeof(rbuf)));
+    g_assert_cmpint(rv, ==, sizeof(wbuf));
+    g_assert_cmpmem(rbuf, sizeof(rbuf), wbuf, sizeof(wbuf));
+
+    assert_nonneg_errno(fsync(fd));
+    assert_nonneg_errno(close(fd2));
+    assert_nonneg_errno(close(fd));
+}
+
 static void _test_read() {
     g_auto(AutoDeleteFile) adf = _create_auto_file();
     const char wbuf[] = "test file read";
@@ -534,6 +565,75 @@ static void _test_lseek_pipe() {
     assert_nonneg_errno(close(pipes[1]));
 }
 
+static void _test_sendfile() {
+    g_auto(AutoDeleteFile) adf = _create_auto_file();
+    const char wbuf[] = "0123456789";
+    char rbuf[sizeof(wbuf)] = {0};
+    int fd, rv;
+    int pipes[2] = {-1, -1};
+    _set_contents(&adf, wbuf, sizeof(wbuf));
+    assert_nonneg_errno(fd = open(adf.name, O_RDONLY));
+    assert_nonneg_errno(pipe(pipes));
+
+    // Send from the file's position, which should be updated
+    assert_nonneg_errno(rv = sendfile(pipes[1], fd, NULL, 4));
+    g_assert_cmpint(rv, ==, 4);
+    assert_nonneg_errno(rv = lseek(fd, 0, SEEK_CUR));
+    g_assert_cmpint(rv, ==, 4);
+    assert_nonneg_errno(rv = read(pipes[0], rbuf, sizeof(rbuf)));
+    g_assert_cmpint(rv, ==, 4);
+    g_assert_cmpmem(rbuf, 4, "0123", 4);
+
+    // Send from an offset, which should be updated instead of the file's position
+    off_t offset = 2;
+    assert_nonneg_errno(rv = sendfile(pipes[1], fd, &offset, 3));
+    g_assert_cmpint(rv, ==, 3);
+    g_assert_cmpint(offset, ==, 5);
+    assert_nonneg_errno(rv = lseek(fd, 0, SEEK_CUR));
+    g_assert_cmpint(rv, ==, 4);
+    assert_nonneg_errno(rv = read(pipes[0], rbuf, sizeof(rbuf)));
+    g_assert_cmpint(rv, ==, 3);
+    g_assert_cmpmem(rbuf, 3, "234", 3);
+
+    // Sending past the end of the file stops at the end
+    assert_nonneg_errno(rv = sendfile(pipes[1], fd, NULL, 100));
+    g_assert_cmpint(rv, ==, sizeof(wbuf) - 4);
+    assert_nonneg_errno(rv = read(pipes[0], rbuf, sizeof(rbuf)));
+    g_assert_cmpint(rv, ==, sizeof(wbuf) - 4);
+    g_assert_cmpmem(rbuf, rv, wbuf + 4, sizeof(wbuf) - 4);
+
+    // Nothing is left to send
+    assert_nonneg_errno(rv = sendfile(pipes[1], fd, NULL, 100));
+    g_assert_cmpint(rv, ==, 0);
+
+    // The input must be a file
+    rv = sendfile(pipes[1], pipes[0], NULL, 1);
+    g_assert_cmpint(rv, ==, -1);
+    assert_errno_is(EINVAL);
+
+    assert_nonneg_errno(close(pipes[0]));
+    assert_nonneg_errno(close(pipes[1]));
+    assert_nonneg_errno(close(fd));
+}
+
+static void _test_sendfile_to_file() {
+    g_auto(AutoDeleteFile) src = _create_auto_file();
+    g_auto(AutoDeleteFile) dst = _create_auto_file();
+    const char wbuf[] = "test file sendfile";
+    char rbuf[sizeof(wbuf)] = {0};
+    int rv;
+    _set_contents(&src, wbuf, sizeof(wbuf));
+
+    off_t offset = 0;
+    assert_nonneg_errno(rv = sendfile(dst.fd, src.fd, &offset, sizeof(wbuf)));
+    g_assert_cmpint(rv, ==, sizeof(wbuf));
+    g_assert_cmpint(offset, ==, sizeof(wbuf));
+
+    assert_nonneg_errno(rv = pread(dst.fd, rbuf, sizeof(rbuf), 0));
+    g_assert_cmpint(rv, ==, sizeof(wbuf));
+    g_assert_cmpstr(rbuf, ==, wbuf);
+}
+
 static void _test_fopen() {
     g_auto(AutoDeleteFile) adf = _create_auto_file();
     FILE* file;
@@ -991,12 +1091,15 @@ int main(int argc, char* argv[]) {
     g_test_add_func("/file/pwritev", _test_pwritev);
     g_test_add_func("/file/pwritev2", _test_pwritev2);
     g_test_add_func("/file/read", _test_read);
+    g_test_add_func("/file/read_other_fd", _test_read_other_fd);
     g_test_add_func("/file/pread", _test_pread);
     g_test_add_func("/file/readv", _test_readv);
     g_test_add_func("/file/preadv", _test_preadv);
     g_test_add_func("/file/preadv2", _test_preadv2);
     g_test_add_func("/file/lseek", _test_lseek);
     g_test_add_func("/file/lseek_pipe", _test_lseek_pipe);
+    g_test_add_func("/file/sendfile", _test_sendfile);
+    g_test_add_func("/file/sendfile_to_file", _test_sendfile_to_file);
     g_test_add_func("/file/fopen", _test_fopen);
     g_test_add_func("/file/fclose", _test_fclose);
     g_test_add_func("/file/fileno", _test_fileno);
@@ -12,6 +12,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -98,6 +99,73 @@ static void _futex_wait_test() {
     _wait_for_condition(&arg.child_finished);
 }
 
+typedef struct {
+    atomic_int* futex;
+    atomic_bool child_started;
+    atomic_bool child_finished;
+} FutexSharedTestChildArg;
+
+static void* _futex_shared_test_child(void* void_arg) {
+    FutexSharedTestChildArg* arg = void_arg;
+    atomic_store(&arg->child_started, true);
+    do {
+        long rv = syscall(SYS_futex, arg->futex, FUTEX_WAIT, UNAVAILABLE, NULL, NULL, 0);
+        if (rv != 0) {
+            assert_errno_is(EAGAIN);
+        }
+    } while (atomic_load(arg->futex) != AVAILABLE);
+    atomic_store(&arg->child_finished, true);
+    return NULL;
+}
+
+// Waits on a shared futex through one mapping of a file, and wakes it through another mapping of
+// the same file at a different address.
+static void _futex_shared_mapped_twice_test() {
+    char path[] = "futex_shared_XXXXXX";
+    int fd = mkstemp(path);
+    assert_nonneg_errno(fd);
+    assert_nonneg_errno(ftruncate(fd, sysconf(_SC_PAGESIZE)));
+
+    atomic_int* waitWord =
+        mmap(NULL, sizeof(atomic_int), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    g_assert_true(waitWord != MAP_FAILED);
+    atomic_int* wakeWord =
+        mmap(NULL, sizeof(atomic_int), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    g_assert_true(wakeWord != MAP_FAILED);
+    g_assert_true(waitWord != wakeWord);
+
+    atomic_store(waitWord, UNAVAILABLE);
+    g_assert_cmpint(atomic_load(wakeWord), ==, UNAVAILABLE);
+
+    FutexSharedTestChildArg arg = {
+        .futex = waitWord, .child_started = false, .child_finished = false};
+    pthread_t child = {0};
+    assert_nonneg_errno(pthread_create(&child, NULL, _futex_shared_test_child, &arg));
+    _wait_for_condition(&arg.child_started);
+
+    // The waiter is found through the other mapping. Like in `_futex_wait_test`, we may need to
+    // retry until the child is asleep.
+    while (1) {
+        long woken = syscall(SYS_futex, wakeWord, FUTEX_WAKE, 1, NULL, NULL, 0);
+        assert_nonneg_errno(woken);
+        if (woken == 1) {
+            break;
+        }
+        g_assert_cmpint(woken, ==, 0);
+        usleep(1);
+    }
+
+    g_assert_cmpint(atomic_exchange(wakeWord, AVAILABLE), ==, UNAVAILABLE);
+    assert_nonneg_errno(syscall(SYS_futex, wakeWord, FUTEX_WAKE, 1, NULL, NULL, 0));
+    _wait_for_condition(&arg.child_finished);
+    assert_nonneg_errno(pthread_join(child, NULL));
+
+    assert_nonneg_errno(munmap(waitWord, sizeof(atomic_int)));
+    assert_nonneg_errno(munmap(wakeWord, sizeof(atomic_int)));
+    assert_nonneg_errno(close(fd));
+    assert_nonneg_errno(unlink(path));
+}
+
 static void _futex_wait_stale_test() {
     int futex = AVAILABLE;
     g_assert_cmpint(syscall(SYS_futex, &futex, FUTEX_WAIT, UNAVAILABLE, NULL, NULL, 0), ==, -1);
@@ -109,6 +177,86 @@ static void _futex_wake_nobody_test() {
     g_assert_cmpint(syscall(SYS_futex, &futex, FUTEX_WAKE, INT_MAX), ==, 0);
 }
 
+static void _futex_wake_op_test() {
+    int futex1 = 0;
+    int futex2 = 5;
+
+    // Nobody waits on either futex, but the operation is still applied to futex2.
+    int op = FUTEX_OP(FUTEX_OP_SET, 7, FUTEX_OP_CMP_EQ, 5);
+    g_assert_cmpint(syscall(SYS_futex, &futex1, FUTEX_WAKE_OP, 1, 1, &futex2, op), ==, 0);
+    g_assert_cmpint(futex2, ==, 7);
+
+    op = FUTEX_OP(FUTEX_OP_ADD, -2, FUTEX_OP_CMP_GT, 0);
+    g_assert_cmpint(syscall(SYS_futex, &futex1, FUTEX_WAKE_OP, 1, 1, &futex2, op), ==, 0);
+    g_assert_cmpint(futex2, ==, 5);
+
+    op = FUTEX_OP(FUTEX_OP_OR | FUTEX_OP_OPARG_SHIFT, 4, FUTEX_OP_CMP_NE, 0);
+    g_assert_cmpint(syscall(SYS_futex, &futex1, FUTEX_WAKE_OP, 1, 1, &futex2, op), ==, 0);
+    g_assert_cmpint(futex2, ==, 5 | (1 << 4));
+}
+
+static void _futex_cmp_requeue_stale_test() {
+    int futex1 = AVAILABLE;
+    int futex2 = 0;
+    g_assert_cmpint(
+        syscall(SYS_futex, &futex1, FUTEX_CMP_REQUEUE, 0, 1, &futex2, UNAVAILABLE), ==, -1);
+    assert_errno_is(EAGAIN);
+}
+
+typedef struct {
+    atomic_int futex1;
+    atomic_int futex2;
+    atomic_bool child_started;
+    atomic_bool child_finished;
+} FutexRequeueTestChildArg;
+
+static void* _futex_requeue_test_child(void* void_arg) {
+    FutexRequeueTestChildArg* arg = void_arg;
+    atomic_store(&arg->child_started, true);
+    while (atomic_load(&arg->futex1) != AVAILABLE) {
+        long rv = syscall(SYS_futex, &arg->futex1, FUTEX_WAIT, UNAVAILABLE, NULL, NULL, 0);
+        if (rv != 0) {
+            assert_errno_is(EAGAIN);
+        }
+    }
+    atomic_store(&arg->child_finished, true);
+    return NULL;
+}
+
+static void _futex_cmp_requeue_test() {
+    FutexRequeueTestChildArg arg = {.futex1 = UNAVAILABLE,
+                                    .futex2 = 0,
+                                    .child_started = false,
+                                    .child_finished = false};
+    pthread_t child = {0};
+    assert_nonneg_errno(pthread_create(&child, NULL, _futex_requeue_test_child, &arg));
+    _wait_for_condition(&arg.child_started);
+
+    // Move the child from futex1 to futex2 without waking it. There's no way to guarantee that
+    // the child is already asleep on futex1, so we need to loop.
+    while (1) {
+        long moved =
+            syscall(SYS_futex, &arg.futex1, FUTEX_CMP_REQUEUE, 0, 1, &arg.futex2, UNAVAILABLE);
+        assert_nonneg_errno(moved);
+        if (moved == 1) {
+            break;
+        }
+        g_assert_cmpint(moved, ==, 0);
+        usleep(1);
+    }
+
+    // The child is no longer waiting on futex1.
+    g_assert_cmpint(syscall(SYS_futex, &arg.futex1, FUTEX_WAKE, 1, NULL, NULL, 0), ==, 0);
+    g_assert_true(!atomic_load(&arg.child_finished));
+
+    // Waking futex2 wakes the child.
+    atomic_store(&arg.futex1, AVAILABLE);
+    g_assert_cmpint(syscall(SYS_futex, &arg.futex2, FUTEX_WAKE, 1, NULL, NULL, 0), ==, 1);
+
+    assert_nonneg_errno(pthread_join(child, NULL));
+    g_assert_true(atomic_load(&arg.child_finished));
+}
+
 double timespec_to_double(const struct timespec* t) {
     return (double)t->tv_sec + (double)t->tv_nsec / 1000000000.0;
 }
@@ -404,6 +552,10 @@ int main(int argc, char** argv) {
     g_test_add_func("/futex/wait_intr", _futex_wait_intr_test);
     g_test_add_func("/futex/wait_stale", _futex_wait_stale_test);
     g_test_add_func("/futex/wake_nobody", _futex_wake_nobody_test);
+    g_test_add_func("/futex/shared_mapped_twice", _futex_shared_mapped_twice_test);
+    g_test_add_func("/futex/wake_op", _futex_wake_op_test);
+    g_test_add_func("/futex/cmp_requeue_stale", _futex_cmp_requeue_stale_test);
+    g_test_add_func("/futex/cmp_requeue", _futex_cmp_requeue_test);
     g_test_add_func("/futex/wake_stress", _futex_stress_test);
     g_test_add_func("/futex/wait_timeout", _futex_wait_timeout_test);
     g_test_add_func("/futex/wait_bitset_timeout", _futex_wait_bitset_timeout_test);
@@ -0,0 +1,214 @@
+/*
+ * The Shadow Simulator
+ * See LICENSE for licensing information
+ */
+
+/* Creates, reads, and frees packet payloads with a fixed mix of sizes, checking that their
+ * contents survive and that every allocation is freed, and reports how long each workload took.
+ * The "cross-thread" workload frees payloads on a different thread than the one that created
+ * them, like when a packet is delivered to a host run by another worker.
+ *
+ * usage: test-payload-bench [num_payloads] */
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main/core/worker.h"
+#include "main/routing/payload.h"
+
+/* A typical mix of payload sizes: small control messages, full MSS segments, and some sizes in
+ * between. */
+static const gsize _payloadSizes[] = {0, 1, 64, 100, 512, 1000, 1434, 1448, 4096, 16384, 65536};
+#define NUM_PAYLOAD_SIZES (sizeof(_payloadSizes) / sizeof(_payloadSizes[0]))
+
+/* The number of payloads that are alive at once, like packets queued in socket buffers. */
+#define NUM_LIVE_PAYLOADS 64
+
+static gint _numAllocs = 0;
+static gint _numDeallocs = 0;
+
+void worker_increment_object_alloc_counter(ObjectType object_type) {
+    g_atomic_int_inc(&_numAllocs);
+}
+
+void worker_increment_object_dealloc_counter(ObjectType object_type) {
+    g_atomic_int_inc(&_numDeallocs);
+}
+
+/* we only copy payloads to and from shadow's memory, so these are never called */
+const Process* thread_getProcess(const Thread* thread) { abort(); }
+int32_t process_readPtr(const Process* proc, void* dst, UntypedForeignPtr src, uintptr_t n) {
+    abort();
+}
+int32_t process_writePtr(const Process* proc, UntypedForeignPtr dst, const void* src,
+                         uintptr_t n) {
+    abort();
+}
+int32_t memorymanager_readPtr(const MemoryManager* mem, void* dst, UntypedForeignPtr src,
+                              uintptr_t n) {
+    abort();
+}
+int32_t memorymanager_writePtr(MemoryManager* mem, UntypedForeignPtr dst, const void* src,
+                               uintptr_t n) {
+    abort();
+}
+
+static gsize _sizeOf(gsize i) { return _payloadSizes[i % NUM_PAYLOAD_SIZES]; }
+
+/* returns FALSE if the payload doesn't hold `size` bytes of `fill` */
+static gboolean _check(Payload* payload, gsize size, guint8 fill, guint8* buf) {
+    if (payload_getLength(payload) != size) {
+        return FALSE;
+    }
+
+    gsize numRead = payload_getDataShadow(payload, 0, buf, size);
+    for (gsize i = 0; i < numRead; i++) {
+        if (buf[i] != fill) {
+            return FALSE;
+        }
+    }
+    return numRead == size;
+}
+
+/* Keeps NUM_LIVE_PAYLOADS payloads alive on this thread, replacing the oldest with a new one. */
+static gboolean _runLocal(gsize numPayloads, guint8* src, guint8* buf) {
+    Payload* live[NUM_LIVE_PAYLOADS] = {0};
+    gint64 start = g_get_monotonic_time();
+
+    for (gsize i = 0; i < numPayloads; i++) {
+        gsize slot = i % NUM_LIVE_PAYLOADS;
+        if (live[slot] != NULL) {
+            gsize oldIndex = i - NUM_LIVE_PAYLOADS;
+            if (!_check(live[slot], _sizeOf(oldIndex), (guint8)oldIndex, buf)) {
+                fprintf(stderr, "local: payload %zu has the wrong contents\n", oldIndex);
+                return FALSE;
+            }
+            payload_unref(live[slot]);
+        }
+
+        gsize size = _sizeOf(i);
+        void* data = NULL;
+        if (i % 2 == 0) {
+            live[slot] = payload_newUninitFromShadow(size, &data);
+            memset(data, (guint8)i, size);
+        } else {
+            memset(src, (guint8)i, size);
+            live[slot] = payload_newFromShadow(src, size);
+        }
+    }
+
+    for (gsize i = 0; i < NUM_LIVE_PAYLOADS; i++) {
+        if (live[i] != NULL) {
+            payload_unref(live[i]);
+        }
+    }
+
+    gint64 elapsed = g_get_monotonic_time() - start;
+    printf("local: %zu payloads created, read, and freed in %.2f ms\n", numPayloads,
+           elapsed / 1000.0);
+    return TRUE;
+}
+
+/* Shares each payload between several references, like a packet that is queued in both a
+ * socket's send and retransmit buffers. */
+static gboolean _runShared(gsize numPayloads, const guint8* src) {
+    gint64 start = g_get_monotonic_time();
+
+    for (gsize i = 0; i < numPayloads; i++) {
+        Payload* payload = payload_newFromShadow(src, _sizeOf(i));
+        for (gint j = 0; j < 4; j++) {
+            payload_ref(payload);
+        }
+        for (gint j = 0; j < 5; j++) {
+            payload_unref(payload);
+        }
+    }
+
+    gint64 elapsed = g_get_monotonic_time() - start;
+    printf("shared: %zu payloads created, shared, and freed in %.2f ms\n", numPayloads,
+           elapsed / 1000.0);
+    return TRUE;
+}
+
+typedef struct _Consumer {
+    GAsyncQueue* queue;
+    gsize numPayloads;
+    gboolean success;
+} Consumer;
+
+static gpointer _consumerRun(gpointer data) {
+    Consumer* consumer = data;
+    guint8* buf = g_malloc(_payloadSizes[NUM_PAYLOAD_SIZES - 1]);
+
+    consumer->success = TRUE;
+    for (gsize i = 0; i < consumer->numPayloads; i++) {
+        Payload* payload = g_async_queue_pop(consumer->queue);
+        if (consumer->success && !_check(payload, _sizeOf(i), (guint8)i, buf)) {
+            fprintf(stderr, "cross-thread: payload %zu has the wrong contents\n", i);
+            consumer->success = FALSE;
+        }
+        payload_unref(payload);
+    }
+
+    g_free(buf);
+    return NULL;
+}
+
+/* Creates payloads on this thread and frees them on another. */
+static gboolean _runCrossThread(gsize numPayloads) {
+    Consumer consumer = {
+        .queue = g_async_queue_new(),
+        .numPayloads = numPayloads,
+        .success = FALSE,
+    };
+
+    gint64 start = g_get_monotonic_time();
+
+    GThread* thread = g_thread_new("consumer", _consumerRun, &consumer);
+
+    for (gsize i = 0; i < numPayloads; i++) {
+        gsize size = _sizeOf(i);
+        void* data = NULL;
+        Payload* payload = payload_newUninitFromShadow(size, &data);
+        memset(data, (guint8)i, size);
+        g_async_queue_push(consumer.queue, payload);
+    }
+
+    g_thread_join(thread);
+
+    gint64 elapsed = g_get_monotonic_time() - start;
+    g_async_queue_unref(consumer.queue);
+
+    if (!consumer.success) {
+        return FALSE;
+    }
+
+    printf("cross-thread: %zu payloads created and freed on different threads in %.2f ms\n",
+           numPayloads, elapsed / 1000.0);
+    return TRUE;
+}
+
+int main(int argc, char* argv[]) {
+    gsize numPayloads = (argc > 1) ? strtoul(argv[1], NULL, 10) : 1000000;
+
+    gsize maxSize = _payloadSizes[NUM_PAYLOAD_SIZES - 1];
+    guint8* src = g_malloc(maxSize);
+    guint8* buf = g_malloc(maxSize);
+    memset(src, 0, maxSize);
+
+    gboolean success = _runLocal(numPayloads, src, buf) && _runShared(numPayloads, src) &&
+                       _runCrossThread(numPayloads);
+
+    g_free(src);
+    g_free(buf);
+
+    if (success && g_atomic_int_get(&_numAllocs) != g_atomic_int_get(&_numDeallocs)) {
+        fprintf(stderr, "%d payloads were created but only %d were freed\n",
+                g_atomic_int_get(&_numAllocs), g_atomic_int_get(&_numDeallocs));
+        success = FALSE;
+    }
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,240 @@
+#!/usr/bin/env python3
+
+'''
+Benchmark Shadow by running phold over a sweep of host counts, message loads,
+worker counts, and schedulers. Each configuration is run once, and the results
+are written as a JSON list with one object per run, so that they can be
+compared across Shadow versions.
+
+For each run we report the wall-clock time, the number of phold messages
+received (each is a network event in Shadow), the number of syscalls handled
+by Shadow (from sim-stats.json), their rates per wall-clock second, and the
+peak RSS of the shadow process.
+
+Example:
+$ ./bench_phold.py --shadow build/src/main/shadow \\
+    --phold build/src/test/phold/test-phold --hosts 100,1000 --output bench.json
+'''
+
+import argparse
+import glob
+import json
+import os
+import re
+import shutil
+import subprocess
+import sys
+import time
+
+HEARTBEAT_RE = re.compile(r'tot_msgs_recv=(\d+)')
+
+
+def parse_list(conv):
+    return lambda s: [conv(x) for x in s.split(',') if x]
+
+
+def write_config(path, num_hosts, msgload, args):
+    '''
+    Write a shadow config with `num_hosts` phold peers. JSON is valid YAML, so
+    we don't need a YAML library.
+    '''
+    weights_path = os.path.join(os.path.dirname(path), 'weights.txt')
+    with open(weights_path, 'w') as f:
+        f.write('\n'.join(['1.0'] * num_hosts) + '\n')
+
+    phold_args = ' '.join([
+        'loglevel=info',
+        'basename=peer',
+        f'quantity={num_hosts}',
+        f'msgload={msgload}',
+        f'cpuload={args.cpuload}',
+        f'size={args.size}',
+        f'weightsfilepath={weights_path}',
+        f'runtime={args.runtime}',
+    ])
+
+    process = {
+        'path': os.path.abspath(args.phold),
+        'args': phold_args,
+        'start_time': 1,
+    }
+
+    config = {
+        'general': {
+            # phold starts at 1s and runs for `runtime` seconds
+            'stop_time': args.runtime + 2,
+        },
+        'network': {
+            'graph': {
+                'type': 'gml',
+                'inline': '\n'.join([
+                    'graph [',
+                    '  directed 0',
+                    '  node [',
+                    '    id 0',
+                    '    host_bandwidth_down "1 Gbit"',
+                    '    host_bandwidth_up "1 Gbit"',
+                    '  ]',
+                    '  edge [',
+                    '    source 0',
+                    '    target 0',
+                    '    latency "50 ms"',
+                    '    packet_loss 0.0',
+                    '  ]',
+                    ']',
+                ]),
+            },
+        },
+        'hosts': {
+            f'peer{i}': {'network_node_id': 0, 'processes': [process]}
+            for i in range(1, num_hosts + 1)
+        },
+    }
+
+    with open(path, 'w') as f:
+        json.dump(config, f)
+
+
+def count_messages(data_dir):
+    '''
+    Sum the total number of messages received by each peer, as reported in its
+    last heartbeat.
+    '''
+    total = 0
+    for path in glob.glob(os.path.join(data_dir, 'hosts', '*', '*.stdout')):
+        last = None
+        with open(path, errors='replace') as f:
+            for line in f:
+                match = HEARTBEAT_RE.search(line)
+                if match:
+                    last = int(match.group(1))
+        total += last or 0
+    return total
+
+
+def count_syscalls(data_dir):
+    try:
+        with open(os.path.join(data_dir, 'sim-stats.json')) as f:
+            stats = json.load(f)
+    except (OSError, ValueError):
+        return None
+    return sum(stats.get('syscalls', {}).values())
+
+
+def run_one(args, run_dir, num_hosts, msgload, parallelism, scheduler):
+    os.makedirs(run_dir, exist_ok=True)
+    config_path = os.path.join(run_dir, 'shadow.yaml')
+    data_dir = os.path.join(run_dir, 'shadow.data')
+    shutil.rmtree(data_dir, ignore_errors=True)
+
+    write_config(config_path, num_hosts, msgload, args)
+
+    cmd = [
+        os.path.abspath(args.shadow),
+        '--data-directory', data_dir,
+        '--log-level', 'warning',
+        '--parallelism', str(parallelism),
+        '--scheduler', scheduler,
+        '--use-syscall-counters', 'true',
+        '--progress', 'false',
+        config_path,
+    ]
+
+    with open(os.path.join(run_dir, 'shadow.log'), 'w') as log:
+        start = time.monotonic()
+        proc = subprocess.Popen(cmd, stdout=log, stderr=subprocess.STDOUT)
+        # use wait4 rather than Popen.wait so that we get the resource usage of this run only
+        _, status, rusage = os.wait4(proc.pid, 0)
+        wall_time = time.monotonic() - start
+        proc.returncode = os.waitstatus_to_exitcode(status)
+
+    messages = count_messages(data_dir)
+    syscalls = count_syscalls(data_dir)
+
+    result = {
+        'hosts': num_hosts,
+        'msgload': msgload,
+        'parallelism': parallelism,
+        'scheduler': scheduler,
+        'exit_code': proc.returncode,
+        'wall_time_sec': round(wall_time, 3),
+        'messages': messages,
+        'messages_per_sec': round(messages / wall_time, 1),
+        'syscalls': syscalls,
+        'syscalls_per_sec': round(syscalls / wall_time, 1) if syscalls is not None else None,
+        # ru_maxrss is in KiB on Linux
+        'peak_rss_kib': rusage.ru_maxrss,
+    }
+
+    if not args.keep_data:
+        shutil.rmtree(data_dir, ignore_errors=True)
+
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--shadow', required=True, help='path to the shadow binary')
+    parser.add_argument('--phold', required=True, help='path to the test-phold binary')
+    parser.add_argument('--hosts', type=parse_list(int), default=[100, 1000, 10000, 100000],
+                        help='comma-separated host counts (default: %(default)s)')
+    parser.add_argument('--msgloads', type=parse_list(int), default=[1, 10],
+                        help='comma-separated messages per peer (default: %(default)s)')
+    parser.add_argument('--parallelism', type=parse_list(int),
+                        default=sorted({1, os.cpu_count() or 1}),
+                        help='comma-separated worker counts (default: %(default)s)')
+    parser.add_argument('--schedulers', type=parse_list(str),
+                        default=['thread-per-core', 'work-stealing'],
+                        help='comma-separated schedulers (default: %(default)s)')
+    parser.add_argument('--runtime', type=int, default=5,
+                        help='simulated seconds that phold runs for (default: %(default)s)')
+    parser.add_argument('--cpuload', type=int, default=1,
+                        help='phold cpu load per message (default: %(default)s)')
+    parser.add_argument('--size', type=int, default=1,
+                        help='phold message size in bytes (default: %(default)s)')
+    parser.add_argument('--work-dir', default='bench-phold.runs',
+                        help='directory for the configs and data (default: %(default)s)')
+    parser.add_argument('--keep-data', action='store_true',
+                        help="don't delete each run's data directory")
+    parser.add_argument('--output', help='write the JSON results here instead of stdout')
+    args = parser.parse_args()
+
+    results = []
+    failed = False
+
+    for num_hosts in args.hosts:
+        for msgload in args.msgloads:
+            for parallelism in args.parallelism:
+                for scheduler in args.schedulers:
+                    name = f'hosts{num_hosts}-msgload{msgload}-par{parallelism}-{scheduler}'
+                    print(f'Running {name}', file=sys.stderr, flush=True)
+
+                    run_dir = os.path.join(args.work_dir, name)
+                    result = run_one(args, run_dir, num_hosts, msgload, parallelism, scheduler)
+                    results.append(result)
+
+                    if result['exit_code'] != 0:
+                        failed = True
+                        print(f'{name} failed; see {run_dir}/shadow.log',
+                              file=sys.stderr, flush=True)
+                    else:
+                        print(f'{name}: {result["wall_time_sec"]} s, '
+                              f'{result["messages_per_sec"]} msgs/s, '
+                              f'{result["syscalls_per_sec"]} syscalls/s, '
+                              f'{result["peak_rss_kib"]} KiB peak RSS',
+                              file=sys.stderr, flush=True)
+
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(results, f, indent=2)
+            f.write('\n')
+    else:
+        json.dump(results, sys.stdout, indent=2)
+        sys.stdout.write('\n')
+
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,97 @@
+/*
+ * The Shadow Simulator
+ * See LICENSE for licensing information
+ */
+
+/* Pushes and pops items through shadow's PriorityQueue, checking that they come out in order,
+ * and reports how long it took with an intrusive index and with a hash table index.
+ *
+ * usage: test-priority-queue-bench [num_items] */
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "main/utility/priority_queue.h"
+
+typedef struct _Item Item;
+struct _Item {
+    guint64 key;
+    gsize queueIndex;
+};
+
+static gint _item_compare(const Item* a, const Item* b, gpointer userData) {
+    return a->key < b->key ? -1 : a->key > b->key ? 1 : 0;
+}
+
+static gsize* _item_getQueueIndex(Item* item) { return &item->queueIndex; }
+
+/* returns FALSE if the queue misbehaved */
+static gboolean _run(PriorityQueue* q, Item* items, gsize numItems, const char* name) {
+    gint64 start = g_get_monotonic_time();
+
+    for (gsize i = 0; i < numItems; i++) {
+        if (!priorityqueue_push(q, &items[i])) {
+            fprintf(stderr, "%s: push of a new item failed\n", name);
+            return FALSE;
+        }
+    }
+
+    /* pushing an item that is already queued must not add it again */
+    for (gsize i = 0; i < numItems; i += 1024) {
+        if (priorityqueue_find(q, &items[i]) != &items[i] || priorityqueue_push(q, &items[i])) {
+            fprintf(stderr, "%s: queued item %zu was not found\n", name, i);
+            return FALSE;
+        }
+    }
+
+    if (priorityqueue_getLength(q) != numItems) {
+        fprintf(stderr, "%s: expected %zu items, found %zu\n", name, numItems,
+                priorityqueue_getLength(q));
+        return FALSE;
+    }
+
+    guint64 lastKey = 0;
+    for (gsize i = 0; i < numItems; i++) {
+        Item* item = priorityqueue_pop(q);
+        if (item == NULL || item->key < lastKey) {
+            fprintf(stderr, "%s: item %zu popped out of order\n", name, i);
+            return FALSE;
+        }
+        lastKey = item->key;
+    }
+
+    if (!priorityqueue_isEmpty(q) || priorityqueue_find(q, &items[0]) != NULL) {
+        fprintf(stderr, "%s: queue is not empty after popping every item\n", name);
+        return FALSE;
+    }
+
+    gint64 elapsed = g_get_monotonic_time() - start;
+    printf("%s: %zu items pushed and popped in %.2f ms\n", name, numItems, elapsed / 1000.0);
+    return TRUE;
+}
+
+int main(int argc, char* argv[]) {
+    gsize numItems = (argc > 1) ? strtoul(argv[1], NULL, 10) : 1000000;
+
+    Item* items = g_new(Item, numItems);
+    GRand* rand = g_rand_new_with_seed(1);
+    for (gsize i = 0; i < numItems; i++) {
+        items[i].key = ((guint64)g_rand_int(rand) << 32) | g_rand_int(rand);
+    }
+    g_rand_free(rand);
+
+    PriorityQueue* intrusive = priorityqueue_newIntrusive(
+        (GCompareDataFunc)_item_compare, NULL, NULL, (PriorityQueueIndexFunc)_item_getQueueIndex);
+    PriorityQueue* hashed =
+        priorityqueue_new((GCompareDataFunc)_item_compare, NULL, NULL, NULL, NULL);
+
+    gboolean success = _run(intrusive, items, numItems, "intrusive") &&
+                       _run(hashed, items, numItems, "hashed");
+
+    priorityqueue_free(intrusive);
+    priorityqueue_free(hashed);
+    g_free(items);
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,37 @@
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+
+// Like the busy wait tests in `test_busy_wait`, but run without
+// `model_unblocked_syscall_latency`, so that Shadow can only move time forward
+// by preempting the busy thread with the shim's native preemption timer.
+
+fn test_wait_for_timeout() {
+    let t0 = Instant::now();
+    let target = t0 + Duration::from_millis(1);
+    while Instant::now() < target {
+        // wait
+    }
+}
+
+// A loop that makes no syscalls at all, and so never returns control to Shadow
+// on its own.
+fn test_wait_for_other_thread() {
+    let ready_flag = Arc::new(AtomicBool::new(false));
+    let waitee = {
+        let ready_flag = ready_flag.clone();
+        std::thread::spawn(move || {
+            std::thread::sleep(Duration::from_millis(1));
+            ready_flag.store(true, Ordering::Relaxed);
+        })
+    };
+    while !ready_flag.load(Ordering::Relaxed) {
+        std::hint::spin_loop();
+    }
+    waitee.join().unwrap();
+}
+
+fn main() {
+    test_wait_for_timeout();
+    test_wait_for_other_thread();
+}
@@ -64,6 +64,9 @@ impl Default for RecvfromArguments<'_> {
     }
 }
 
+/// The `UDP_SEGMENT` socket option and control message type (from linux/udp.h).
+const UDP_SEGMENT: libc::c_int = 103;
+
 #[derive(Copy, Clone, Debug, PartialEq, Eq)]
 enum SendRecvMethod {
     /// For `sendto()`/`recvfrom()`.
@@ -475,9 +478,233 @@ fn get_tests() -> Vec<test_utils::ShadowTest<(), String>> {
         set![TestEnv::Libc, TestEnv::Shadow],
     )]);
 
+    for &init_method in &init_methods {
+        // add details to the test names to avoid duplicates
+        let append_args = |s| format!("{s} <init_method={init_method:?}>");
+
+        tests.extend(vec![test_utils::ShadowTest::new(
+            &append_args("test_mmsg_batch_dgram"),
+            move || test_mmsg_batch_dgram(init_method),
+            set![TestEnv::Libc, TestEnv::Shadow],
+        )]);
+    }
+
+    tests.extend(vec![test_utils::ShadowTest::new(
+        "test_udp_segment",
+        test_udp_segment,
+        set![TestEnv::Libc, TestEnv::Shadow],
+    )]);
+
     tests
 }
 
+/// Test sending and receiving several datagrams with single sendmmsg() and recvmmsg() calls.
+fn test_mmsg_batch_dgram(init_method: SocketInitMethod) -> Result<(), String> {
+    let (fd_client, fd_server) = socket_init_helper(
+        init_method,
+        libc::SOCK_DGRAM,
+        libc::SOCK_NONBLOCK,
+        /* bind_client = */ false,
+    );
+
+    test_utils::run_and_close_fds(&[fd_client, fd_server], || {
+        let send_bufs = [vec![1u8; 10], vec![2u8; 20], vec![3u8; 30]];
+
+        let mut send_iovs: Vec<libc::iovec> = send_bufs
+            .iter()
+            .map(|buf| libc::iovec {
+                iov_base: buf.as_ptr() as *mut libc::c_void,
+                iov_len: buf.len(),
+            })
+            .collect();
+        let mut send_msgs: Vec<libc::mmsghdr> = send_iovs
+            .iter_mut()
+            .map(|iov| {
+                let mut msg: libc::mmsghdr = unsafe { std::mem::zeroed() };
+                msg.msg_hdr.msg_iov = iov;
+                msg.msg_hdr.msg_iovlen = 1;
+                msg
+            })
+            .collect();
+
+        // send all of the messages in one call
+        let rv = test_utils::check_system_call!(
+            || unsafe {
+                libc::sendmmsg(
+                    fd_client,
+                    send_msgs.as_mut_ptr(),
+                    send_msgs.len() as libc::c_uint,
+                    0,
+                )
+            },
+            &[],
+        )?;
+        test_utils::result_assert_eq(rv, 3, "Not all messages were sent")?;
+        for (msg, buf) in send_msgs.iter().zip(&send_bufs) {
+            test_utils::result_assert_eq(msg.msg_len as usize, buf.len(), "Unexpected msg_len")?;
+        }
+
+        // shadow needs to run events
+        assert_eq!(unsafe { libc::usleep(10000) }, 0);
+
+        // room for more messages than were sent
+        let mut recv_bufs = [[0u8; 100]; 4];
+        let mut recv_iovs: Vec<libc::iovec> = recv_bufs
+            .iter_mut()
+            .map(|buf| libc::iovec {
+                iov_base: buf.as_mut_ptr() as *mut libc::c_void,
+                iov_len: buf.len(),
+            })
+            .collect();
+        let mut recv_msgs: Vec<libc::mmsghdr> = recv_iovs
+            .iter_mut()
+            .map(|iov| {
+                let mut msg: libc::mmsghdr = unsafe { std::mem::zeroed() };
+                msg.msg_hdr.msg_iov = iov;
+                msg.msg_hdr.msg_iovlen = 1;
+                msg
+            })
+            .collect();
+
+        // receive all of the messages in one call; the socket is non-blocking, so this should
+        // return once there are no more messages
+        let rv = test_utils::check_system_call!(
+            || unsafe {
+                libc::recvmmsg(
+                    fd_server,
+                    recv_msgs.as_mut_ptr(),
+                    recv_msgs.len() as libc::c_uint,
+                    0,
+                    std::ptr::null_mut(),
+                )
+            },
+            &[],
+        )?;
+        test_utils::result_assert_eq(rv, 3, "Not all messages were received")?;
+
+        for i in 0..send_bufs.len() {
+            let len = recv_msgs[i].msg_len as usize;
+            test_utils::result_assert_eq(len, send_bufs[i].len(), "Unexpected msg_len")?;
+            test_utils::result_assert_eq(
+                &recv_bufs[i][..len],
+                &send_bufs[i][..],
+                "Unexpected message contents",
+            )?;
+        }
+
+        // there should be nothing left to receive
+        test_utils::check_system_call!(
+            || unsafe {
+                libc::recvmmsg(
+                    fd_server,
+                    recv_msgs.as_mut_ptr(),
+                    recv_msgs.len() as libc::c_uint,
+                    0,
+                    std::ptr::null_mut(),
+                )
+            },
+            &[libc::EAGAIN],
+        )?;
+
+        Ok(())
+    })
+}
+
+/// Test that sends larger than the `UDP_SEGMENT` size are split into several datagrams, using both
+/// the socket option and a control message.
+fn test_udp_segment() -> Result<(), String> {
+    let (fd_client, fd_server) = socket_init_helper(
+        SocketInitMethod::Inet,
+        libc::SOCK_DGRAM,
+        libc::SOCK_NONBLOCK,
+        /* bind_client = */ false,
+    );
+
+    test_utils::run_and_close_fds(&[fd_client, fd_server], || {
+        let gso_size: libc::c_int = 1000;
+        test_utils::check_system_call!(
+            || unsafe {
+                libc::setsockopt(
+                    fd_client,
+                    libc::SOL_UDP,
+                    UDP_SEGMENT,
+                    (&gso_size as *const libc::c_int).cast(),
+                    std::mem::size_of_val(&gso_size) as libc::socklen_t,
+                )
+            },
+            &[],
+        )?;
+
+        // should be sent as datagrams of 1000, 1000, and 500 bytes
+        let send_buf: Vec<u8> = (0..2500).map(|x| x as u8).collect();
+        simple_sendto_helper(SendRecvMethod::ToFrom, fd_client, &send_buf, &[], true)?;
+
+        // should be sent as datagrams of 600, 600, and 300 bytes
+        let mut cmsg_buf =
+            vec![0u8; unsafe { libc::CMSG_SPACE(std::mem::size_of::<u16>() as u32) } as usize];
+        let mut iov = libc::iovec {
+            iov_base: send_buf.as_ptr() as *mut libc::c_void,
+            iov_len: 1500,
+        };
+        let mut msg: libc::msghdr = unsafe { std::mem::zeroed() };
+        msg.msg_iov = &mut iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = cmsg_buf.as_mut_ptr().cast();
+        msg.msg_controllen = cmsg_buf.len();
+
+        unsafe {
+            let cmsg = libc::CMSG_FIRSTHDR(&msg);
+            (*cmsg).cmsg_level = libc::SOL_UDP;
+            (*cmsg).cmsg_type = UDP_SEGMENT;
+            (*cmsg).cmsg_len = libc::CMSG_LEN(std::mem::size_of::<u16>() as u32) as usize;
+            std::ptr::write_unaligned(libc::CMSG_DATA(cmsg).cast::<u16>(), 600);
+        }
+
+        let rv =
+            test_utils::check_system_call!(|| unsafe { libc::sendmsg(fd_client, &msg, 0) }, &[],)?;
+        test_utils::result_assert_eq(rv, 1500, "Unexpected number of bytes sent")?;
+
+        // shadow needs to run events
+        assert_eq!(unsafe { libc::usleep(10000) }, 0);
+
+        let expected = [
+            &send_buf[0..1000],
+            &send_buf[1000..2000],
+            &send_buf[2000..2500],
+            &send_buf[0..600],
+            &send_buf[600..1200],
+            &send_buf[1200..1500],
+        ];
+
+        for expected in expected {
+            let mut recv_buf = vec![0u8; 4000];
+            let len = simple_recvfrom_helper(
+                SendRecvMethod::ToFrom,
+                fd_server,
+                &mut recv_buf,
+                &[],
+                false,
+            )?;
+            test_utils::result_assert_eq(
+                &recv_buf[..len as usize],
+                expected,
+                "Unexpected datagram contents",
+            )?;
+        }
+
+        // there should be nothing left to receive
+        simple_recvfrom_helper(
+            SendRecvMethod::ToFrom,
+            fd_server,
+            &mut [0u8; 100],
+            &[libc::EAGAIN],
+            false,
+        )?;
+
+        Ok(())
+    })
+}
+
 /// Test sendto() and recvfrom() using an argument that cannot be a fd.
 fn test_invalid_fd(sys_method: SendRecvMethod, domain: libc::c_int) -> Result<(), String> {
     // expect both sendto() and recvfrom() to return EBADF
@@ -185,6 +185,16 @@ fn get_tests() -> Vec<test_utils::ShadowTest<(), String>> {
                     move || test_so_acceptconn(domain, sock_type),
                     set![TestEnv::Libc, TestEnv::Shadow],
                 ),
+                test_utils::ShadowTest::new(
+                    &append_args("test_so_priority"),
+                    move || test_so_priority(domain, sock_type),
+                    set![TestEnv::Libc, TestEnv::Shadow],
+                ),
+                test_utils::ShadowTest::new(
+                    &append_args("test_udp_segment"),
+                    move || test_udp_segment(domain, sock_type),
+                    set![TestEnv::Libc, TestEnv::Shadow],
+                ),
                 test_utils::ShadowTest::new(
                     &append_args("test_tcp_info"),
                     move || test_tcp_info(domain, sock_type),
@@ -776,6 +786,76 @@ fn test_so_acceptconn(domain: libc::c_int, sock_type: libc::c_int) -> Result<(),
     })
 }
 
+/// Test getsockopt() and setsockopt() using the SO_PRIORITY option.
+fn test_so_priority(domain: libc::c_int, sock_type: libc::c_int) -> Result<(), String> {
+    let fd = unsafe { libc::socket(domain, sock_type | libc::SOCK_NONBLOCK, 0) };
+    assert!(fd >= 0);
+
+    let level = libc::SOL_SOCKET;
+    let optname = libc::SO_PRIORITY;
+
+    // values above 6 require CAP_NET_ADMIN
+    let optval = 5i32.to_ne_bytes();
+    let zero = 0i32.to_ne_bytes();
+
+    let mut get_args_1 = GetsockoptArguments::new(fd, level, optname, Some(zero.into()));
+    let mut get_args_2 = GetsockoptArguments::new(fd, level, optname, Some(zero.into()));
+    let mut set_args = SetsockoptArguments::new(fd, level, optname, Some(optval.into()));
+
+    test_utils::run_and_close_fds(&[fd], || {
+        check_getsockopt_call(&mut get_args_1, &[])?;
+
+        let value = i32::from_ne_bytes(get_args_1.optval.unwrap().try_into().unwrap());
+        test_utils::result_assert_eq(value, 0, "Unexpected default value for SO_PRIORITY")?;
+
+        check_setsockopt_call(&mut set_args, &[])?;
+        check_getsockopt_call(&mut get_args_2, &[])?;
+
+        let value = i32::from_ne_bytes(get_args_2.optval.unwrap().try_into().unwrap());
+        test_utils::result_assert_eq(value, 5, "Unexpected value for SO_PRIORITY")?;
+
+        Ok(())
+    })
+}
+
+/// Test getsockopt() and setsockopt() using the UDP_SEGMENT option.
+fn test_udp_segment(domain: libc::c_int, sock_type: libc::c_int) -> Result<(), String> {
+    let fd = unsafe { libc::socket(domain, sock_type | libc::SOCK_NONBLOCK, 0) };
+    assert!(fd >= 0);
+
+    let level = libc::SOL_UDP;
+    // from linux/udp.h
+    let optname = 103;
+
+    let optval = 1200i32.to_ne_bytes();
+    let zero = 0i32.to_ne_bytes();
+
+    let mut get_args_1 = GetsockoptArguments::new(fd, level, optname, Some(zero.into()));
+    let mut get_args_2 = GetsockoptArguments::new(fd, level, optname, Some(zero.into()));
+    let mut set_args = SetsockoptArguments::new(fd, level, optname, Some(optval.into()));
+
+    test_utils::run_and_close_fds(&[fd], || {
+        if sock_type != libc::SOCK_DGRAM {
+            check_getsockopt_call(&mut get_args_1, &[libc::EOPNOTSUPP, libc::ENOPROTOOPT])?;
+            check_setsockopt_call(&mut set_args, &[libc::ENOPROTOOPT])?;
+            return Ok(());
+        }
+
+        check_getsockopt_call(&mut get_args_1, &[])?;
+
+        let value = i32::from_ne_bytes(get_args_1.optval.unwrap().try_into().unwrap());
+        test_utils::result_assert_eq(value, 0, "Unexpected default value for UDP_SEGMENT")?;
+
+        check_setsockopt_call(&mut set_args, &[])?;
+        check_getsockopt_call(&mut get_args_2, &[])?;
+
+        let value = i32::from_ne_bytes(get_args_2.optval.unwrap().try_into().unwrap());
+        test_utils::result_assert_eq(value, 1200, "Unexpected value for UDP_SEGMENT")?;
+
+        Ok(())
+    })
+}
+
 /// Test getsockopt() and setsockopt() using the TCP_INFO option.
 fn test_tcp_info(domain: libc::c_int, sock_type: libc::c_int) -> Result<(), String> {
     let fd = unsafe { libc::socket(domain, sock_type, 0) };
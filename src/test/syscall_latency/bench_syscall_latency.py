@@ -0,0 +1,166 @@
+#!/usr/bin/env python3
+
+'''
+Measure the wall-clock cost of a syscall round trip through shadow for each
+syscall made by test-syscall-latency, in each of the modes below. Inside shadow
+the managed process only sees simulated time, so for each syscall and mode we
+run shadow twice, once with no calls and once with `--iterations` calls, and
+divide the difference in shadow's wall-clock run time by the number of calls.
+The thread_create benchmark creates and joins a thread per call, and uses
+`--thread-create-iterations` instead since it's much slower.
+
+modes:
+  preload:     the shim's preloaded libc sends syscalls to shadow directly
+  seccomp:     every syscall is trapped by seccomp before being sent to shadow
+  passthrough: like preload, but natively-executed syscalls (getcwd) are let
+               through the seccomp filter to the kernel
+
+Example:
+$ ./bench_syscall_latency.py --shadow build/src/main/shadow \\
+    --bench build/src/test/syscall_latency/test-syscall-latency --output bench.json
+'''
+
+import argparse
+import json
+import os
+import shutil
+import subprocess
+import sys
+import time
+
+SYSCALLS = ['clock_gettime', 'getpid', 'fcntl', 'epoll_wait', 'getcwd', 'thread_create']
+
+MODES = {
+    'preload': [],
+    'seccomp': ['--use-preload-libc', 'false'],
+    'passthrough': ['--native-syscall-passthrough', 'getcwd'],
+}
+
+
+def parse_list(s):
+    return [x for x in s.split(',') if x]
+
+
+def write_config(path, bench, syscall, iterations):
+    # JSON is valid YAML, so we don't need a YAML library
+    config = {
+        'general': {'stop_time': 10},
+        'network': {'graph': {'type': '1_gbit_switch'}},
+        'hosts': {
+            'testnode': {
+                'network_node_id': 0,
+                'processes': [{
+                    'path': os.path.abspath(bench),
+                    'args': f'{syscall} {iterations}',
+                    'start_time': 1,
+                }],
+            },
+        },
+    }
+
+    with open(path, 'w') as f:
+        json.dump(config, f)
+
+
+def run_shadow(args, run_dir, mode, syscall, iterations):
+    '''Returns the wall-clock run time of shadow, or None if it failed.'''
+    os.makedirs(run_dir, exist_ok=True)
+    config = os.path.join(run_dir, 'shadow.yaml')
+    data_dir = os.path.join(run_dir, 'shadow.data')
+    shutil.rmtree(data_dir, ignore_errors=True)
+
+    write_config(config, args.bench, syscall, iterations)
+
+    cmd = [
+        os.path.abspath(args.shadow),
+        '--data-directory', data_dir,
+        '--log-level', 'warning',
+        '--progress', 'false',
+    ] + MODES[mode] + [config]
+
+    with open(os.path.join(run_dir, 'shadow.log'), 'w') as log:
+        start = time.monotonic()
+        rv = subprocess.run(cmd, stdout=log, stderr=subprocess.STDOUT).returncode
+        wall_time = time.monotonic() - start
+
+    if rv != 0:
+        print(f'shadow failed; see {run_dir}/shadow.log', file=sys.stderr, flush=True)
+        return None
+
+    if not args.keep_data:
+        shutil.rmtree(data_dir, ignore_errors=True)
+
+    return wall_time
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--shadow', required=True, help='path to the shadow binary')
+    parser.add_argument('--bench', required=True, help='path to the test-syscall-latency binary')
+    parser.add_argument('--syscalls', type=parse_list, default=SYSCALLS,
+                        help='comma-separated syscalls (default: %(default)s)')
+    parser.add_argument('--modes', type=parse_list, default=list(MODES),
+                        help='comma-separated modes (default: %(default)s)')
+    parser.add_argument('--iterations', type=int, default=1000000,
+                        help='calls of each syscall per run (default: %(default)s)')
+    parser.add_argument('--thread-create-iterations', type=int, default=10000,
+                        help='threads created by each thread_create run (default: %(default)s)')
+    parser.add_argument('--work-dir', default='bench-syscall-latency.runs',
+                        help='directory for the configs and data (default: %(default)s)')
+    parser.add_argument('--keep-data', action='store_true',
+                        help="don't delete each run's data directory")
+    parser.add_argument('--output', help='write the JSON results here instead of stdout')
+    args = parser.parse_args()
+
+    for syscall in args.syscalls:
+        if syscall not in SYSCALLS:
+            parser.error(f'unknown syscall {syscall!r}')
+    for mode in args.modes:
+        if mode not in MODES:
+            parser.error(f'unknown mode {mode!r}')
+
+    results = []
+    failed = False
+
+    for mode in args.modes:
+        for syscall in args.syscalls:
+            name = f'{mode}-{syscall}'
+            run_dir = os.path.join(args.work_dir, name)
+            if syscall == 'thread_create':
+                iterations = args.thread_create_iterations
+            else:
+                iterations = args.iterations
+
+            baseline = run_shadow(args, os.path.join(run_dir, 'baseline'), mode, syscall, 0)
+            loaded = run_shadow(args, os.path.join(run_dir, 'loaded'), mode, syscall, iterations)
+
+            result = {
+                'mode': mode,
+                'syscall': syscall,
+                'iterations': iterations,
+                'ns_per_call': None,
+            }
+
+            if baseline is None or loaded is None:
+                failed = True
+            else:
+                result['ns_per_call'] = round((loaded - baseline) * 1e9 / iterations, 1)
+                print(f'{name}: {result["ns_per_call"]} ns per call', file=sys.stderr,
+                      flush=True)
+
+            results.append(result)
+
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(results, f, indent=2)
+            f.write('\n')
+    else:
+        json.dump(results, sys.stdout, indent=2)
+        sys.stdout.write('\n')
+
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
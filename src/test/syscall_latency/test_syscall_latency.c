@@ -0,0 +1,196 @@
+/*
+ * The Shadow Simulator
+ * See LICENSE for licensing information
+ */
+
+/* Makes the same syscall many times in a tight loop, checking each result, and reports the average
+ * time per call. The syscalls cover the different ways that shadow can handle a syscall:
+ *
+ *   clock_gettime: handled in the shim without leaving the managed process
+ *   getpid, fcntl: emulated by shadow, and cheap once there
+ *   epoll_wait:    emulated by shadow on a path that can block (here with a timeout of 0)
+ *   getcwd:        trapped and then executed natively by shadow
+ *
+ * The thread_create benchmark instead creates and joins a thread on each iteration, to measure
+ * thread creation (a clone storm). It's much slower than the others, so it isn't included in
+ * "all".
+ *
+ * Under shadow the reported times are simulated, so compare the wall-clock time of the whole run
+ * instead (see bench_syscall_latency.py).
+ *
+ * usage: test-syscall-latency [syscall|all] [iterations] */
+
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct _Benchmark {
+    const char* name;
+    /* returns false if the syscall didn't behave as expected */
+    bool (*run)(long iterations);
+    /* whether to run it when "all" is requested */
+    bool in_all;
+} Benchmark;
+
+static double _now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static bool _run_clock_gettime(long iterations) {
+    struct timespec last = {0};
+    for (long i = 0; i < iterations; i++) {
+        struct timespec ts;
+        if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+            perror("clock_gettime");
+            return false;
+        }
+        if (ts.tv_sec < last.tv_sec || (ts.tv_sec == last.tv_sec && ts.tv_nsec < last.tv_nsec)) {
+            fprintf(stderr, "clock_gettime: the monotonic clock went backwards\n");
+            return false;
+        }
+        last = ts;
+    }
+    return true;
+}
+
+static bool _run_getpid(long iterations) {
+    pid_t pid = getpid();
+    for (long i = 0; i < iterations; i++) {
+        if (getpid() != pid) {
+            fprintf(stderr, "getpid: the pid changed\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool _run_fcntl(long iterations) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        return false;
+    }
+
+    bool success = true;
+    for (long i = 0; i < iterations; i++) {
+        int flags = fcntl(fds[0], F_GETFL);
+        if (flags < 0 || (flags & O_ACCMODE) != O_RDONLY) {
+            fprintf(stderr, "fcntl: unexpected flags %d\n", flags);
+            success = false;
+            break;
+        }
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+    return success;
+}
+
+static bool _run_epoll_wait(long iterations) {
+    int epfd = epoll_create1(0);
+    if (epfd < 0) {
+        perror("epoll_create1");
+        return false;
+    }
+
+    bool success = true;
+    for (long i = 0; i < iterations; i++) {
+        struct epoll_event event;
+        int rv = epoll_wait(epfd, &event, 1, 0);
+        if (rv != 0) {
+            fprintf(stderr, "epoll_wait: expected no events, got %d\n", rv);
+            success = false;
+            break;
+        }
+    }
+
+    close(epfd);
+    return success;
+}
+
+static bool _run_getcwd(long iterations) {
+    char expected[PATH_MAX];
+    if (getcwd(expected, sizeof(expected)) == NULL) {
+        perror("getcwd");
+        return false;
+    }
+
+    for (long i = 0; i < iterations; i++) {
+        char buf[PATH_MAX];
+        if (getcwd(buf, sizeof(buf)) == NULL || strcmp(buf, expected) != 0) {
+            fprintf(stderr, "getcwd: the working directory changed\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+static void* _thread_main(void* arg) { return arg; }
+
+static bool _run_thread_create(long iterations) {
+    for (long i = 0; i < iterations; i++) {
+        pthread_t thread;
+        int rv = pthread_create(&thread, NULL, _thread_main, (void*)i);
+        if (rv != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(rv));
+            return false;
+        }
+
+        void* retval = NULL;
+        rv = pthread_join(thread, &retval);
+        if (rv != 0) {
+            fprintf(stderr, "pthread_join: %s\n", strerror(rv));
+            return false;
+        }
+        if (retval != (void*)i) {
+            fprintf(stderr, "pthread_join: unexpected return value %p\n", retval);
+            return false;
+        }
+    }
+    return true;
+}
+
+static const Benchmark _benchmarks[] = {
+    {"clock_gettime", _run_clock_gettime, true}, {"getpid", _run_getpid, true},
+    {"fcntl", _run_fcntl, true},                 {"epoll_wait", _run_epoll_wait, true},
+    {"getcwd", _run_getcwd, true},               {"thread_create", _run_thread_create, false},
+};
+
+int main(int argc, char* argv[]) {
+    const char* which = (argc > 1) ? argv[1] : "all";
+    long iterations = (argc > 2) ? strtol(argv[2], NULL, 10) : 100000;
+
+    bool found = false;
+    for (size_t i = 0; i < sizeof(_benchmarks) / sizeof(_benchmarks[0]); i++) {
+        const Benchmark* benchmark = &_benchmarks[i];
+        if (strcmp(which, "all") == 0 ? !benchmark->in_all : strcmp(which, benchmark->name) != 0) {
+            continue;
+        }
+        found = true;
+
+        double start = _now_ns();
+        if (!benchmark->run(iterations)) {
+            return EXIT_FAILURE;
+        }
+        double elapsed = _now_ns() - start;
+
+        printf("%s: %ld calls, %.1f ns per call\n", benchmark->name, iterations,
+               iterations > 0 ? elapsed / iterations : 0.0);
+    }
+
+    if (!found) {
+        fprintf(stderr, "unknown syscall '%s'\n", which);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
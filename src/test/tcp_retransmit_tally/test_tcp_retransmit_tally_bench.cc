@@ -0,0 +1,471 @@
+/*
+ * Checks the retransmit tally against the sorted-vector implementation it
+ * replaced, by driving both through randomized sequences of acks, duplicate
+ * acks, sacks, losses, timeouts, and flushes and comparing their outputs after
+ * every step. Then reports how long each takes on a longer TCP-like event
+ * stream.
+ *
+ * usage: test-tcp-retransmit-tally-bench [num_events] [window]
+ */
+#include "main/host/descriptor/tcp_retransmit_tally.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+namespace {
+
+using VecRanges = std::vector<SeqRange>;
+
+// The previous implementation: sorted vectors, scanned linearly, with the
+// lost ranges recomputed from scratch after every loss or retransmission.
+// These are its helpers and entry points, unchanged apart from the names.
+namespace reference {
+
+bool still_sorted_(const VecRanges &r) {
+   bool sorted = true;
+
+   if (r.size() > 0) {
+      for (std::size_t idx = 0; sorted && idx < r.size() - 1; ++idx) {
+         sorted = r[idx].first < r[idx].second;
+         sorted = sorted && (r[idx].second < r[idx + 1].first);
+      }
+   }
+
+   return sorted;
+}
+
+bool range_contains(const SeqRange &range, SeqNum value) {
+   return (value >= range.first && value < range.second);
+}
+
+bool range_overlap(const SeqRange &lhs, const SeqRange &rhs) {
+   return lhs.first < rhs.second && rhs.first < lhs.second;
+}
+
+bool range_adj(const SeqRange &lhs, const SeqRange &rhs) {
+   return (lhs.second == rhs.first || rhs.second == lhs.first);
+}
+
+bool ranges_contains(const VecRanges &ranges, SeqNum value) {
+  for (const auto &range : ranges) {
+    if (range_contains(range, value)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+std::pair<VecRanges::iterator, VecRanges::iterator>
+ranges_mergable(VecRanges &ranges, const SeqRange &value) {
+   assert(still_sorted_(ranges));
+   std::pair<VecRanges::iterator, VecRanges::iterator> mergable;
+
+   mergable.first = ranges.end();
+
+   auto itr = ranges.begin();
+   for (; itr != ranges.end() && value.second >= itr->first; ++itr) {
+      if (mergable.first == ranges.cend()
+          && (range_overlap(*itr, value) || range_adj(*itr, value)))
+      {
+         mergable.first = itr;
+      }
+   }
+
+   mergable.second = itr;
+
+   assert(still_sorted_(ranges));
+
+   return mergable;
+}
+
+void range_merge(SeqRange *x, const SeqRange &y) {
+   x->first = std::min(x->first, y.first);
+   x->second = std::max(x->second, y.second);
+}
+
+void ranges_insert(VecRanges *ranges, const SeqRange &value) {
+   assert(still_sorted_(*ranges));
+   auto mergable = ranges_mergable(*ranges, value);
+
+   if (mergable.first == ranges->end()) {
+      ranges->insert(mergable.second, value);
+   } else {
+      auto itr = mergable.first;
+      range_merge(&(*itr), value);
+      for (auto jtr = itr + 1; jtr != mergable.second; ++jtr) {
+         range_merge(&(*itr), *jtr);
+      }
+      ranges->erase(mergable.first + 1, mergable.second);
+   }
+
+   assert(still_sorted_(*ranges));
+}
+
+VecRanges range_subtract(const SeqRange &lhs, const SeqRange &rhs) {
+   // Can produce two ranges in the case that rhs \in lhs.
+   // Returning a std::vector makes checking for this case easy.
+   VecRanges result;
+   result.reserve(2);
+
+   if (range_overlap(lhs, rhs)) {
+      if (lhs.first < rhs.first) {
+         result.emplace_back(lhs.first, rhs.first);
+      }
+
+      if (rhs.second < lhs.second) {
+         result.emplace_back(rhs.second, lhs.second);
+      }
+   } else {
+      result.push_back(lhs);
+   }
+
+   assert(still_sorted_(result));
+
+   return result;
+}
+
+VecRanges ranges_subtract(const VecRanges &lhs, const VecRanges &rhs) {
+   VecRanges result;
+
+   if (rhs.size() == 0) {
+      result = lhs; // Assignment here to encourage RVO
+   } else if (lhs.size() > 0) {
+
+      std::size_t idx = 0;
+      auto jtr = rhs.cbegin();
+      SeqRange lhs_to_consider = lhs[0];
+
+      while (idx < lhs.size() && jtr != rhs.cend()) {
+         if (jtr->second <= lhs_to_consider.first) {
+            ++jtr;
+         }
+         else if (lhs_to_consider.second <= jtr->first) {
+            result.push_back(lhs_to_consider);
+            ++idx;
+            if (idx < lhs.size()) { lhs_to_consider = lhs[idx]; }
+         } else {
+            VecRanges sub = range_subtract(lhs_to_consider, *jtr);
+            if (sub.size() == 2) { result.push_back(sub.front()); }
+            if (sub.size() >= 1) { lhs_to_consider = sub.back(); }
+            else {
+               ++idx;
+               if (idx < lhs.size()) { lhs_to_consider = lhs[idx]; }
+            }
+         }
+      }
+
+      if (jtr == rhs.cend()) {
+         result.push_back(lhs_to_consider);
+         ++idx;
+
+         while (idx < lhs.size()) {
+            result.push_back(lhs[idx++]);
+         }
+      }
+
+   }
+
+   for (const auto &range : result) {
+      assert(range.first < range.second);
+   }
+
+   assert(still_sorted_(result));
+
+   return result;
+}
+
+struct VecTally {
+   SeqNum last_ack_ = -1;
+   std::size_t num_dupl_ack_ = 0;
+   VecRanges marked_lost_, sacked_, retransmitted_, lost_;
+
+   void compute_lost() {
+      lost_ = ranges_subtract(marked_lost_, sacked_);
+      lost_ = ranges_subtract(lost_, retransmitted_);
+   }
+
+   void tidy_ranges(VecRanges *ranges) {
+      assert(still_sorted_(*ranges));
+
+      auto pred = [=] (const SeqRange range) -> bool {
+         return last_ack_ >= range.second;
+      };
+
+      if (ranges->size() > 0 && last_ack_ >= ranges->front().first
+          && last_ack_ < ranges->front().second - 1)
+      {
+         ranges->front().first = last_ack_;
+      }
+      else if (ranges->size() > 0 && last_ack_ >= ranges->front().second - 1) {
+         auto new_end = std::remove_if(ranges->begin(), ranges->end(), pred);
+         ranges->erase(new_end, ranges->end());
+      }
+
+      assert(still_sorted_(*ranges));
+   }
+
+   TCPProcessFlags_ update(uint32_t last_ack, bool is_dup) {
+      int ret = TCP_PF_NONE_;
+
+      if (is_dup && last_ack == last_ack_) {
+         ++num_dupl_ack_;
+      } else if (last_ack > last_ack_) { // new ack branch
+         last_ack_ = last_ack;
+         num_dupl_ack_ = 0;
+         tidy_ranges(&marked_lost_);
+         tidy_ranges(&sacked_);
+         tidy_ranges(&retransmitted_);
+      }
+
+      if (num_dupl_ack_ >= RetransmitTally::kDuplAckLostThresh
+          && !ranges_contains(retransmitted_, last_ack_)) {
+         uint32_t right_edge_exclusive = last_ack_ + 1;
+         ranges_insert(&marked_lost_, {last_ack_, right_edge_exclusive});
+         compute_lost(); // sacked packets are removed from lost list here
+         if (lost_.size() > 0) { ret |= TCP_PF_DATA_LOST_; }
+      }
+
+      return static_cast<TCPProcessFlags_>(ret);
+   }
+
+   void mark_sacked(uint32_t begin, uint32_t end) {
+      if (begin >= end) { return; }
+      SeqRange sacked_block{begin, end};
+      ranges_insert(&sacked_, sacked_block);
+   }
+
+   void mark_lost(uint32_t begin, uint32_t end) {
+      if (begin == end + 1) { return; } // fin?
+      if (begin == end) { end += 1; }
+      assert(begin < end);
+      SeqRange lost_block{begin, end};
+      ranges_insert(&marked_lost_, lost_block);
+      compute_lost();
+   }
+
+   void mark_retransmitted(uint32_t begin, uint32_t end) {
+      SeqRange retransmitted_block{begin, end};
+      ranges_insert(&retransmitted_, retransmitted_block);
+      compute_lost();
+   }
+
+   void clear_retransmitted() { retransmitted_.clear(); }
+
+   // What _tcp_flush did with the lost ranges: retransmit a copy of them one
+   // range at a time.
+   void retransmit_lost() {
+      VecRanges lost = lost_;
+      for (const auto &range : lost) {
+         mark_retransmitted(range.first, range.second);
+      }
+   }
+};
+
+} // namespace reference
+
+enum class Op { kAck, kDupAck, kSack, kLost, kTimeout, kFlush };
+
+struct Event {
+   Op op;
+   SeqNum begin, end;
+};
+
+// A window of in-flight segments: acks slowly advance the left edge, sacks
+// arrive for random segments within the window, occasional losses and
+// timeouts mark segments lost, and flushes retransmit everything currently
+// lost. Runs of duplicate acks trigger the tally's own loss detection.
+std::vector<Event> make_workload(std::mt19937_64 &rng, std::size_t num_events, SeqNum window) {
+   std::vector<Event> workload;
+   workload.reserve(num_events);
+
+   SeqNum last_ack = 0;
+   for (std::size_t i = 0; i < num_events; ++i) {
+      auto roll = rng() % 100;
+      SeqNum begin = last_ack + static_cast<SeqNum>(rng() % window);
+      SeqNum end = begin + 1 + static_cast<SeqNum>(rng() % 4);
+
+      if (roll < 10) {
+         last_ack += 1 + static_cast<SeqNum>(rng() % (window / 64 + 1));
+         workload.push_back({Op::kAck, last_ack, last_ack});
+      } else if (roll < 18) {
+         workload.push_back({Op::kDupAck, last_ack, last_ack});
+      } else if (roll < 75) {
+         workload.push_back({Op::kSack, begin, end});
+      } else if (roll < 85) {
+         // includes the empty and "fin" ranges that mark_lost special-cases
+         workload.push_back({Op::kLost, begin, begin + static_cast<SeqNum>(rng() % 4) - 1});
+      } else if (roll < 88) {
+         workload.push_back({Op::kTimeout, last_ack, last_ack + window});
+      } else {
+         workload.push_back({Op::kFlush, 0, 0});
+      }
+   }
+
+   return workload;
+}
+
+VecRanges to_vec(const Ranges &ranges) {
+   return VecRanges(ranges.begin(), ranges.end());
+}
+
+VecRanges lost_ranges(const void *tally) {
+   VecRanges lost;
+   retransmit_tally_for_each_lost_range(
+      tally,
+      [](uint32_t begin, uint32_t end, void *data) {
+         static_cast<VecRanges *>(data)->emplace_back(begin, end);
+      },
+      &lost);
+   return lost;
+}
+
+// Replays `workload` through the tally's C interface and the reference
+// implementation, and compares their flags, ranges, and lost ranges after
+// every event. Returns the index of the first event after which they differ,
+// or the workload's size if they never do.
+std::size_t compare_with_reference(const std::vector<Event> &workload) {
+   void *tally = nullptr;
+   retransmit_tally_init(&tally);
+   const auto *rt = static_cast<const RetransmitTally *>(tally);
+   reference::VecTally ref;
+
+   std::size_t idx = 0;
+   for (; idx < workload.size(); ++idx) {
+      const auto &event = workload[idx];
+      auto begin = static_cast<uint32_t>(event.begin);
+      auto end = static_cast<uint32_t>(event.end);
+      bool same = true;
+
+      switch (event.op) {
+         case Op::kAck:
+         case Op::kDupAck: {
+            bool is_dup = event.op == Op::kDupAck;
+            same = retransmit_tally_update(tally, begin, end, is_dup) == ref.update(begin, is_dup);
+            break;
+         }
+         case Op::kSack:
+            retransmit_tally_mark_sacked(tally, begin, end);
+            ref.mark_sacked(begin, end);
+            break;
+         case Op::kLost:
+            retransmit_tally_mark_lost(tally, begin, end);
+            ref.mark_lost(begin, end);
+            break;
+         case Op::kTimeout:
+            retransmit_tally_clear_retransmitted(tally);
+            ref.clear_retransmitted();
+            retransmit_tally_mark_lost(tally, begin, end);
+            ref.mark_lost(begin, end);
+            break;
+         case Op::kFlush:
+            retransmit_tally_mark_lost_retransmitted(tally);
+            ref.retransmit_lost();
+            break;
+      }
+
+      same = same && lost_ranges(tally) == ref.lost_;
+      same = same && to_vec(rt->marked_lost_) == ref.marked_lost_;
+      same = same && to_vec(rt->sacked_) == ref.sacked_;
+      same = same && to_vec(rt->retransmitted_) == ref.retransmitted_;
+      if (!same) { break; }
+   }
+
+   retransmit_tally_destroy(tally);
+   return idx;
+}
+
+template <typename Fn> double time_ms(Fn fn) {
+   auto start = std::chrono::steady_clock::now();
+   fn();
+   auto stop = std::chrono::steady_clock::now();
+   return std::chrono::duration<double, std::milli>(stop - start).count();
+}
+
+void run_reference(const std::vector<Event> &workload) {
+   reference::VecTally ref;
+   for (const auto &event : workload) {
+      auto begin = static_cast<uint32_t>(event.begin);
+      auto end = static_cast<uint32_t>(event.end);
+      switch (event.op) {
+         case Op::kAck: ref.update(begin, false); break;
+         case Op::kDupAck: ref.update(begin, true); break;
+         case Op::kSack: ref.mark_sacked(begin, end); break;
+         case Op::kLost: ref.mark_lost(begin, end); break;
+         case Op::kTimeout:
+            ref.clear_retransmitted();
+            ref.mark_lost(begin, end);
+            break;
+         case Op::kFlush: ref.retransmit_lost(); break;
+      }
+   }
+}
+
+// Replays `workload` the way tcp.c drives the tally, reading the lost ranges
+// before retransmitting them.
+void run_tally(const std::vector<Event> &workload) {
+   void *tally = nullptr;
+   retransmit_tally_init(&tally);
+
+   std::size_t num_lost = 0;
+   for (const auto &event : workload) {
+      auto begin = static_cast<uint32_t>(event.begin);
+      auto end = static_cast<uint32_t>(event.end);
+      switch (event.op) {
+         case Op::kAck: retransmit_tally_update(tally, begin, end, false); break;
+         case Op::kDupAck: retransmit_tally_update(tally, begin, end, true); break;
+         case Op::kSack: retransmit_tally_mark_sacked(tally, begin, end); break;
+         case Op::kLost: retransmit_tally_mark_lost(tally, begin, end); break;
+         case Op::kTimeout:
+            retransmit_tally_clear_retransmitted(tally);
+            retransmit_tally_mark_lost(tally, begin, end);
+            break;
+         case Op::kFlush:
+            retransmit_tally_for_each_lost_range(
+               tally, [](uint32_t, uint32_t, void *data) { ++*static_cast<std::size_t *>(data); },
+               &num_lost);
+            retransmit_tally_mark_lost_retransmitted(tally);
+            break;
+      }
+   }
+
+   retransmit_tally_destroy(tally);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+   std::size_t num_events = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000;
+   SeqNum window = argc > 2 ? std::strtol(argv[2], nullptr, 10) : 1 << 10;
+
+   // Short random runs over small and large windows, so that ranges often
+   // overlap, touch, and get acked away.
+   std::mt19937_64 rng(0x5eed);
+   for (SeqNum check_window : {4, 16, 256, 1024}) {
+      for (int run = 0; run < 50; ++run) {
+         auto workload = make_workload(rng, 500, check_window);
+         std::size_t idx = compare_with_reference(workload);
+         if (idx < workload.size()) {
+            std::fprintf(stderr,
+                         "tally differs from the vector implementation after event %zu of run %d "
+                         "with window %lld\n",
+                         idx, run, static_cast<long long>(check_window));
+            return EXIT_FAILURE;
+         }
+      }
+   }
+
+   auto workload = make_workload(rng, num_events, window);
+   double vec_ms = time_ms([&] { run_reference(workload); });
+   double tally_ms = time_ms([&] { run_tally(workload); });
+
+   std::printf("%zu events, window %lld: vector %.2f ms, tally %.2f ms\n", num_events,
+               static_cast<long long>(window), vec_ms, tally_ms);
+
+   return EXIT_SUCCESS;
+}
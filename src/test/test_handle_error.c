@@ -0,0 +1,24 @@
+/*
+ * The Shadow Simulator
+ * See LICENSE for licensing information
+ */
+
+/* Stands in for shadow's error handler in tests that link some of shadow's C sources without
+ * shadow's rust library, which normally provides it. */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "main/utility/utility.h"
+
+void utility_handleError(const char* file, int line, const char* function, const char* message,
+                         ...) {
+    va_list args;
+    va_start(args, message);
+    fprintf(stderr, "%s:%d (%s): ", file, line, function);
+    vfprintf(stderr, message, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    abort();
+}
@@ -0,0 +1,324 @@
+#!/usr/bin/env python3
+
+'''
+Benchmark Shadow's TCP stacks with tgen. There are two scenarios:
+
+- bulk: many parallel flows that each make one large bidirectional transfer
+  between a client and a server over a dumbbell network.
+- connect-storm: several clients that each repeatedly make many parallel
+  connections with a 1-byte transfer, to measure connection setup and teardown.
+
+Each scenario is run with both the legacy C TCP stack and the newer rust TCP
+stack (`--use-new-tcp`). For each run we report the wall-clock time, the number
+of successful tgen streams, the simulated bytes transferred per wall-clock
+second, and the connections completed per wall-clock second. The results are
+written as a JSON list with one object per run.
+
+The defaults match the standard scenarios (1000 flows of 1 GiB over 10 Gbit,
+and about 100k connections per simulated second), which take a long time to
+run. Use the options below to scale them down.
+
+Example:
+$ ./bench_tcp.py --shadow build/src/main/shadow --bulk-flows 10 \\
+    --bulk-bytes 10000000 --output bench.json
+'''
+
+import argparse
+import glob
+import json
+import os
+import shutil
+import subprocess
+import sys
+import time
+
+TCP_STACKS = {'legacy': 'false', 'new': 'true'}
+
+
+def parse_list(s):
+    return [x for x in s.split(',') if x]
+
+
+def write_graphml(path, nodes, edges):
+    '''
+    Write a tgen action graph. `nodes` maps each node id to its attributes, and
+    `edges` is a list of (source, target) pairs.
+    '''
+    keys = sorted({k for attrs in nodes.values() for k in attrs})
+    lines = [
+        "<?xml version='1.0' encoding='utf-8'?>",
+        '<graphml xmlns="http://graphml.graphdrawing.org/xmlns">',
+    ]
+    for key in keys:
+        lines.append(f'<key id="{key}" for="node" attr.name="{key}" attr.type="string"/>')
+    lines.append('<graph edgedefault="directed">')
+    for (node, attrs) in nodes.items():
+        lines.append(f'<node id="{node}">')
+        for (k, v) in attrs.items():
+            lines.append(f'  <data key="{k}">{v}</data>')
+        lines.append('</node>')
+    for (source, target) in edges:
+        lines.append(f'<edge source="{source}" target="{target}"/>')
+    lines.append('</graph></graphml>')
+
+    with open(path, 'w') as f:
+        f.write('\n'.join(lines) + '\n')
+
+
+def write_server(path):
+    # see src/test/tgen/fixed_size/gen_conf.py for the meaning of these attributes
+    write_graphml(path, {'start': {'serverport': '80', 'stallout': '60 seconds'}}, [])
+
+
+def write_client(path, num_parallel_streams, transfer_bytes, num_total_transfers):
+    '''
+    A client that starts `num_parallel_streams` bidirectional transfers at once,
+    waits for them all to complete, and repeats until `num_total_transfers`
+    streams have completed.
+    '''
+    nodes = {
+        'start': {
+            'time': '1 second',
+            'peers': 'server:80',
+            'stallout': '60 seconds',
+            'sendsize': f'{transfer_bytes} b',
+            'recvsize': f'{transfer_bytes} b',
+        },
+        'pause': {},
+        'end': {'count': str(num_total_transfers)},
+    }
+    edges = [('pause', 'end'), ('end', 'start')]
+    for i in range(num_parallel_streams):
+        nodes[f'stream{i}'] = {}
+        edges.append(('start', f'stream{i}'))
+        edges.append((f'stream{i}', 'pause'))
+
+    write_graphml(path, nodes, edges)
+
+
+def write_config(path, server_graph, clients, bandwidth, latency, stop_time):
+    '''
+    Write a shadow config with a server on one side of a dumbbell and the
+    clients on the other. `clients` maps each client hostname to its tgen
+    graph. JSON is valid YAML, so we don't need a YAML library.
+    '''
+    def tgen(graph, **kwargs):
+        return dict({
+            'path': 'tgen',
+            # See https://shadow.github.io/docs/guide/compatibility_notes.html#libopenblas
+            'environment': {'OPENBLAS_NUM_THREADS': '1'},
+            'args': os.path.abspath(graph),
+            'start_time': 1,
+        }, **kwargs)
+
+    node = '\n'.join([
+        '  node [',
+        '    id {}',
+        f'    host_bandwidth_down "{bandwidth}"',
+        f'    host_bandwidth_up "{bandwidth}"',
+        '  ]',
+    ])
+
+    edge = '\n'.join([
+        '  edge [',
+        '    source {}',
+        '    target {}',
+        f'    latency "{latency}"',
+        '    packet_loss 0.0',
+        '  ]',
+    ])
+
+    hosts = {
+        'server': {
+            'network_node_id': 1,
+            'processes': [tgen(server_graph, expected_final_state='running')],
+        },
+    }
+    for (name, graph) in clients.items():
+        hosts[name] = {'network_node_id': 0, 'processes': [tgen(graph)]}
+
+    config = {
+        'general': {'stop_time': stop_time},
+        'network': {
+            'graph': {
+                'type': 'gml',
+                'inline': '\n'.join([
+                    'graph [',
+                    '  directed 0',
+                    node.format(0),
+                    node.format(1),
+                    edge.format(0, 0),
+                    edge.format(1, 1),
+                    edge.format(0, 1),
+                    ']',
+                ]),
+            },
+        },
+        'hosts': hosts,
+    }
+
+    with open(path, 'w') as f:
+        json.dump(config, f)
+
+
+def setup_bulk(args, run_dir):
+    '''Returns the shadow config path and the bytes transferred by each stream.'''
+    server = os.path.join(run_dir, 'server.graphml')
+    client = os.path.join(run_dir, 'client.graphml')
+    write_server(server)
+    write_client(client, args.bulk_flows, args.bulk_bytes, args.bulk_flows)
+
+    # leave enough time for every flow to complete at the configured bandwidth, with some slack
+    bits = 2 * 8 * args.bulk_flows * args.bulk_bytes
+    stop_time = int(bits / args.bulk_bandwidth_bits * 1.5) + 60
+
+    config = os.path.join(run_dir, 'shadow.yaml')
+    write_config(config, server, {'client': client}, f'{args.bulk_bandwidth_bits} bit',
+                 args.latency, stop_time)
+    return (config, 2 * args.bulk_bytes)
+
+
+def setup_connect_storm(args, run_dir):
+    '''Returns the shadow config path and the bytes transferred by each stream.'''
+    server = os.path.join(run_dir, 'server.graphml')
+    client = os.path.join(run_dir, 'client.graphml')
+    write_server(server)
+    write_client(client, args.storm_streams, 1, args.storm_connections)
+
+    clients = {f'client{i}': client for i in range(1, args.storm_clients + 1)}
+
+    config = os.path.join(run_dir, 'shadow.yaml')
+    # clients stop on their own once they've made `storm_connections` connections
+    write_config(config, server, clients, '10 Gbit', args.latency, args.storm_stop_time)
+    return (config, 2)
+
+
+SCENARIOS = {
+    'bulk': setup_bulk,
+    'connect-storm': setup_connect_storm,
+}
+
+
+def count_successful_streams(data_dir):
+    count = 0
+    for path in glob.glob(os.path.join(data_dir, 'hosts', 'client*', 'tgen.*.stdout')):
+        with open(path, errors='replace') as f:
+            count += sum(1 for line in f if '[stream-success]' in line)
+    return count
+
+
+def run_one(args, scenario, tcp):
+    run_dir = os.path.join(args.work_dir, f'{scenario}-{tcp}')
+    data_dir = os.path.join(run_dir, 'shadow.data')
+    os.makedirs(run_dir, exist_ok=True)
+    shutil.rmtree(data_dir, ignore_errors=True)
+
+    (config, bytes_per_stream) = SCENARIOS[scenario](args, run_dir)
+
+    cmd = [
+        os.path.abspath(args.shadow),
+        '--data-directory', data_dir,
+        '--log-level', 'warning',
+        '--parallelism', str(args.parallelism),
+        '--use-new-tcp', TCP_STACKS[tcp],
+        '--progress', 'false',
+        config,
+    ]
+
+    with open(os.path.join(run_dir, 'shadow.log'), 'w') as log:
+        start = time.monotonic()
+        rv = subprocess.run(cmd, stdout=log, stderr=subprocess.STDOUT).returncode
+        wall_time = time.monotonic() - start
+
+    streams = count_successful_streams(data_dir)
+
+    result = {
+        'scenario': scenario,
+        'tcp': tcp,
+        'parallelism': args.parallelism,
+        'exit_code': rv,
+        'wall_time_sec': round(wall_time, 3),
+        'successful_streams': streams,
+        'sim_bytes_per_sec': round(streams * bytes_per_stream / wall_time, 1),
+        'connections_per_sec': round(streams / wall_time, 1),
+    }
+
+    if not args.keep_data:
+        shutil.rmtree(data_dir, ignore_errors=True)
+
+    return (result, run_dir)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--shadow', required=True, help='path to the shadow binary')
+    parser.add_argument('--scenarios', type=parse_list, default=list(SCENARIOS),
+                        help='comma-separated scenarios (default: %(default)s)')
+    parser.add_argument('--tcp', type=parse_list, default=list(TCP_STACKS),
+                        help='comma-separated TCP stacks (default: %(default)s)')
+    parser.add_argument('--parallelism', type=int, default=os.cpu_count() or 1,
+                        help='shadow worker threads (default: %(default)s)')
+    parser.add_argument('--latency', default='1 ms',
+                        help='latency between the two sides of the dumbbell (default: %(default)s)')
+    parser.add_argument('--bulk-flows', type=int, default=1000,
+                        help='parallel flows in the bulk scenario (default: %(default)s)')
+    parser.add_argument('--bulk-bytes', type=int, default=2**30,
+                        help='bytes sent in each direction by each bulk flow (default: %(default)s)')
+    parser.add_argument('--bulk-bandwidth-bits', type=int, default=10 * 10**9,
+                        help='host bandwidth in the bulk scenario (default: %(default)s)')
+    parser.add_argument('--storm-clients', type=int, default=10,
+                        help='client hosts in the connect-storm scenario (default: %(default)s)')
+    parser.add_argument('--storm-streams', type=int, default=60,
+                        help='parallel connections per connect-storm client (default: %(default)s)')
+    parser.add_argument('--storm-connections', type=int, default=100000,
+                        help='connections made by each connect-storm client (default: %(default)s)')
+    parser.add_argument('--storm-stop-time', type=int, default=600,
+                        help='simulated seconds to run the connect-storm scenario for '
+                             '(default: %(default)s)')
+    parser.add_argument('--work-dir', default='bench-tcp.runs',
+                        help='directory for the configs and data (default: %(default)s)')
+    parser.add_argument('--keep-data', action='store_true',
+                        help="don't delete each run's data directory")
+    parser.add_argument('--output', help='write the JSON results here instead of stdout')
+    args = parser.parse_args()
+
+    for scenario in args.scenarios:
+        if scenario not in SCENARIOS:
+            parser.error(f'unknown scenario {scenario!r}')
+    for tcp in args.tcp:
+        if tcp not in TCP_STACKS:
+            parser.error(f'unknown TCP stack {tcp!r}')
+
+    results = []
+    failed = False
+
+    for scenario in args.scenarios:
+        for tcp in args.tcp:
+            print(f'Running {scenario} with the {tcp} TCP stack', file=sys.stderr, flush=True)
+            (result, run_dir) = run_one(args, scenario, tcp)
+            results.append(result)
+
+            if result['exit_code'] != 0:
+                failed = True
+                print(f'{scenario}-{tcp} failed; see {run_dir}/shadow.log',
+                      file=sys.stderr, flush=True)
+            else:
+                print(f'{scenario}-{tcp}: {result["wall_time_sec"]} s, '
+                      f'{result["sim_bytes_per_sec"]} sim bytes/s, '
+                      f'{result["connections_per_sec"]} connections/s',
+                      file=sys.stderr, flush=True)
+
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(results, f, indent=2)
+            f.write('\n')
+    else:
+        json.dump(results, sys.stdout, indent=2)
+        sys.stdout.write('\n')
+
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
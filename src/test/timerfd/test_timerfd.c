@@ -242,6 +242,45 @@ static void _test_double_arm_timer() {
     close(tfd);
 }
 
+/* A periodic timer that isn't read should still count every expiration. */
+static void _test_overrun_timer() {
+    int tfd;
+    assert_nonneg_errno(tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK));
+
+    /* expire in 10 ms, then every 10 ms */
+    struct itimerspec t = {0};
+    t.it_value.tv_nsec = 10000000;
+    t.it_interval.tv_nsec = 10000000;
+    assert_nonneg_errno(timerfd_settime(tfd, 0, &t, NULL));
+
+    /* the timer should expire 100 times */
+    usleep(1005000);
+
+    uint64_t num_expires = 0;
+    assert_nonneg_errno(read(tfd, &num_expires, sizeof(uint64_t)));
+    g_assert_cmpint(num_expires, >=, 100);
+    g_assert_cmpint(num_expires, <=, 110);
+
+    /* the next expiration should be within the next interval */
+    assert_nonneg_errno(timerfd_gettime(tfd, &t));
+    g_assert_cmpint(t.it_value.tv_sec, ==, 0);
+    g_assert_cmpint(t.it_value.tv_nsec, >, 0);
+    g_assert_cmpint(t.it_value.tv_nsec, <=, 10000000);
+    g_assert_cmpint(t.it_interval.tv_nsec, ==, 10000000);
+
+    /* there shouldn't be any expirations left to read */
+    g_assert_cmpint(read(tfd, &num_expires, sizeof(uint64_t)), ==, -1);
+    assert_errno_is(EAGAIN);
+
+    /* and the timer should keep expiring after it was read */
+    usleep(25000);
+    assert_nonneg_errno(read(tfd, &num_expires, sizeof(uint64_t)));
+    g_assert_cmpint(num_expires, >=, 2);
+    g_assert_cmpint(num_expires, <=, 4);
+
+    close(tfd);
+}
+
 
 int main(int argc, char* argv[]) {
     g_test_init(&argc, &argv, NULL);
@@ -253,6 +292,7 @@ int main(int argc, char* argv[]) {
     g_test_add_func("/timerfd/disarm", _test_disarm_timer);
     g_test_add_func("/timerfd/rearm", _test_rearm_timer);
     g_test_add_func("/timerfd/double-arm", _test_double_arm_timer);
+    g_test_add_func("/timerfd/overrun", _test_overrun_timer);
 
     return g_test_run();
 }
\ No newline at end of file
@@ -0,0 +1,158 @@
+#!/usr/bin/env python3
+
+import sys, os, argparse, csv, glob, socket, struct
+
+DESCRIPTION="""
+Convert the binary host heartbeat files written by Shadow to CSV.
+
+Shadow writes these files when run with 'experimental.host_heartbeat_format'
+set to 'binary'. Each worker thread writes its own file to the 'heartbeats'
+directory in the data directory. This script reads all of them and writes one
+CSV file for each kind of heartbeat that was enabled in
+'experimental.host_heartbeat_log_info':
+$ python convert-heartbeats.py shadow.data/heartbeats
+
+Rows are sorted by time and then by host name. The record layouts are defined
+in src/main/host/tracker.c and src/main/utility/heartbeat_writer.rs.
+"""
+
+MAGIC = b"SHADOWHB"
+VERSION = 1
+
+FILE_HEADER = struct.Struct("<8sI")
+# kind, payload length, host id, reserved, time in nanoseconds
+RECORD_HEADER = struct.Struct("<IIIIQ")
+
+RECORD_HOST = 0
+RECORD_NODE = 1
+RECORD_SOCKET = 2
+RECORD_RAM = 3
+
+COUNTER_LABELS = ['packets_control', 'packets_control_retrans',
+    'packets_data', 'packets_data_retrans',
+    'bytes_control_header', 'bytes_control_header_retrans',
+    'bytes_data_header', 'bytes_data_header_retrans',
+    'bytes_data_payload', 'bytes_data_payload_retrans']
+COUNTER_GROUPS = ['in_local', 'out_local', 'in_remote', 'out_remote']
+COUNTERS_FORMAT = "Q" * (len(COUNTER_LABELS) * len(COUNTER_GROUPS))
+COUNTER_COLUMNS = ["{}_{}".format(g, l) for g in COUNTER_GROUPS for l in COUNTER_LABELS]
+
+NODE = struct.Struct("<QQQQ" + COUNTERS_FORMAT)
+NODE_COLUMNS = ['interval_ns', 'processing_time_ns', 'delayed_count', 'delay_time_ns'] + \
+    COUNTER_COLUMNS
+
+SOCKET = struct.Struct("<QIIIIQQQQ" + COUNTERS_FORMAT)
+SOCKET_COLUMNS = ['socket', 'protocol', 'peer_ip', 'peer_port',
+    'inbuf_len_bytes', 'inbuf_size_bytes', 'outbuf_len_bytes', 'outbuf_size_bytes'] + \
+    COUNTER_COLUMNS
+
+RAM = struct.Struct("<QQQQQQ")
+RAM_COLUMNS = ['interval_ns', 'alloc_bytes', 'dealloc_bytes', 'total_bytes', 'pointers_count',
+    'failfree_count']
+
+# must match ProtocolType in src/main/host/protocol.h
+PROTOCOLS = {0: 'NONE', 1: 'TCP', 2: 'UDP', 3: 'MOCK'}
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=DESCRIPTION,
+        formatter_class=argparse.RawTextHelpFormatter)
+
+    parser.add_argument(
+        help="""The PATH to the heartbeats directory, or to a single
+heartbeat file""",
+        metavar="PATH",
+        action="store", dest="inpath")
+
+    parser.add_argument('-p', '--prefix',
+        help="""A directory PATH prefix where the CSV output files
+will be written""",
+        metavar="PATH",
+        action="store", dest="prefix",
+        default=os.getcwd())
+
+    args = parser.parse_args()
+
+    if os.path.isdir(args.inpath):
+        paths = sorted(glob.glob(os.path.join(args.inpath, "*.bin")))
+    else:
+        paths = [args.inpath]
+
+    if len(paths) == 0:
+        print("No heartbeat files found at '{}'".format(args.inpath), file=sys.stderr)
+        return 1
+
+    host_names = {}
+    rows = {RECORD_NODE: [], RECORD_SOCKET: [], RECORD_RAM: []}
+
+    for path in paths:
+        read_file(path, host_names, rows)
+
+    write_csv(os.path.join(args.prefix, "heartbeat-node.csv"), NODE_COLUMNS,
+        rows[RECORD_NODE], host_names)
+    write_csv(os.path.join(args.prefix, "heartbeat-socket.csv"), SOCKET_COLUMNS,
+        [format_socket(r) for r in rows[RECORD_SOCKET]], host_names)
+    write_csv(os.path.join(args.prefix, "heartbeat-ram.csv"), RAM_COLUMNS,
+        rows[RECORD_RAM], host_names)
+
+    return 0
+
+def read_file(path, host_names, rows):
+    with open(path, 'rb') as f:
+        data = f.read()
+
+    if len(data) < FILE_HEADER.size:
+        raise ValueError("'{}' is too short to be a heartbeat file".format(path))
+    magic, version = FILE_HEADER.unpack_from(data, 0)
+    if magic != MAGIC:
+        raise ValueError("'{}' is not a heartbeat file".format(path))
+    if version != VERSION:
+        raise ValueError("'{}' has unsupported version {}".format(path, version))
+
+    offset = FILE_HEADER.size
+    while offset + RECORD_HEADER.size <= len(data):
+        kind, length, host_id, _, time_ns = RECORD_HEADER.unpack_from(data, offset)
+        offset += RECORD_HEADER.size
+        payload = data[offset:offset + length]
+        offset += length
+        if len(payload) < length:
+            # the simulation didn't finish writing this record
+            print("Ignoring truncated record at the end of '{}'".format(path), file=sys.stderr)
+            break
+
+        if kind == RECORD_HOST:
+            host_names[host_id] = payload.decode('utf-8')
+        elif kind == RECORD_NODE:
+            rows[kind].append((time_ns, host_id) + NODE.unpack(payload))
+        elif kind == RECORD_SOCKET:
+            rows[kind].append((time_ns, host_id) + SOCKET.unpack(payload))
+        elif kind == RECORD_RAM:
+            rows[kind].append((time_ns, host_id) + RAM.unpack(payload))
+        else:
+            print("Ignoring record of unknown kind {} in '{}'".format(kind, path),
+                file=sys.stderr)
+
+def format_socket(row):
+    # (time, host, socket, protocol, peer ip, peer port, reserved, ...)
+    row = list(row)
+    row[3] = PROTOCOLS.get(row[3], row[3])
+    row[4] = socket.inet_ntoa(struct.pack("=I", row[4]))
+    del row[6]
+    return row
+
+def write_csv(path, columns, rows, host_names):
+    if len(rows) == 0:
+        return
+
+    named = [[row[0], host_names.get(row[1], row[1])] + list(row[2:]) for row in rows]
+    named.sort(key=lambda row: (row[0], str(row[1])))
+
+    with open(path, 'w', newline='') as f:
+        writer = csv.writer(f)
+        writer.writerow(['time_ns', 'host'] + columns)
+        writer.writerows(named)
+
+    print("Wrote {} rows to '{}'".format(len(named), path), file=sys.stderr)
+
+if __name__ == '__main__':
+    sys.exit(main())